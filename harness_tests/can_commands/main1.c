@@ -40,7 +40,7 @@ void eps_hk_test( void ){
 		ASSERT_EQ(queue_data[2], field_num);
 
 		// insert simulated eps response into the rx_queue the response and process it
-		enqueue(&data_rx_msg_queue, eps_response[field_num]);
+		cmd_rx_callback(eps_response[field_num], 8);
 		process_next_rx_msg();
 		field_num++;
 	}
@@ -50,7 +50,7 @@ void eps_hk_test( void ){
 	 	uint32_t eps_response_data = ((uint32_t) eps_response[field][3] << 16) | 
 	 									((uint32_t) eps_response[field][4] << 8) | 
 	 									((uint32_t) eps_response[field][5]);
-	 	ASSERT_EQ(eps_response_data, eps_hk_fields[field]);
+	 	ASSERT_EQ(eps_response_data, get_packed_field(eps_hk_data_col.fields, field));
 	}
 }
 
@@ -82,7 +82,7 @@ void pay_hk_test( void ){
 		ASSERT_EQ(queue_data[2], field_num);
 
 		// insert simulated pay response into the rx_queue the response and process it
-		enqueue(&data_rx_msg_queue, pay_response[field_num]);
+		cmd_rx_callback(pay_response[field_num], 8);
 		process_next_rx_msg();
 		field_num++;
 	}
@@ -92,7 +92,7 @@ void pay_hk_test( void ){
 	 	uint32_t pay_response_data = ((uint32_t) pay_response[field][3] << 16) | 
 	 									((uint32_t) pay_response[field][4] << 8) | 
 	 									((uint32_t) pay_response[field][5]);
-	 	ASSERT_EQ(pay_response_data, pay_hk_fields[field]);
+	 	ASSERT_EQ(pay_response_data, get_packed_field(pay_hk_data_col.fields, field));
 	}
 }
 
@@ -124,7 +124,7 @@ void pay_opt_test( void ){
 		ASSERT_EQ(queue_data[2], field_num);
 
 		// insert simulated pay opt response into the rx_queue the response and process it
-		enqueue(&data_rx_msg_queue, pay_response[field_num]);
+		cmd_rx_callback(pay_response[field_num], 8);
 		process_next_rx_msg();
 		field_num++;
 	}
@@ -134,7 +134,7 @@ void pay_opt_test( void ){
 	 	uint32_t pay_response_data = ((uint32_t) pay_response[field][3] << 16) | 
 	 									((uint32_t) pay_response[field][4] << 8) | 
 	 									((uint32_t) pay_response[field][5]);
-	 	ASSERT_EQ(pay_response_data, pay_opt_fields[field]);
+	 	ASSERT_EQ(pay_response_data, get_packed_field(pay_opt_data_col.fields, field));
 	}
 }
 
@@ -2,6 +2,9 @@
  * Harness test for ensuring functionality of command utilities code
  * Tests include:
  *  - Correctness of enqueue_cmd and dequeue_cmd
+ *  - Main loop event flags set by the command queue
+ *  - ACK queue and ACK frames
+ *  - Batch uplink messages
  */
 
 #include <test/test.h>
@@ -121,10 +124,15 @@ void stair_queue_test(void) {
 
     ASSERT_TRUE(enqueue_cmd(eq_cmd_id, &send_pay_can_msg_cmd, eq_cmd_id, eq_cmd_id));
     ++eq_cmd_id;
+
+    // Fill the rest of the queue
+    while (cmd_queue_size() < CMD_QUEUE_SIZE) {
+        ASSERT_TRUE(enqueue_cmd(eq_cmd_id, &ping_obc_cmd, eq_cmd_id, eq_cmd_id));
+        ++eq_cmd_id;
+    }
     
     // Queue should be full
     ASSERT_FALSE(enqueue_cmd(eq_cmd_id, &send_pay_can_msg_cmd, eq_cmd_id, eq_cmd_id));
-    ++eq_cmd_id;
 
     dequeue_cmd(&dq_cmd_id, (cmd_t **) &current_cmd, &dq_arg1, &dq_arg2);
     ASSERT_EQ(check_cmd_id, dq_cmd_id);
@@ -156,6 +164,14 @@ void stair_queue_test(void) {
     ASSERT_EQ(check_cmd_id, dq_arg1);
     ASSERT_EQ(check_cmd_id++, dq_arg2);
 
+    while (check_cmd_id < eq_cmd_id) {
+        dequeue_cmd(&dq_cmd_id, (cmd_t **) &current_cmd, &dq_arg1, &dq_arg2);
+        ASSERT_EQ(check_cmd_id, dq_cmd_id);
+        ASSERT_EQ((uint16_t) &ping_obc_cmd, (uint16_t) current_cmd);
+        ASSERT_EQ(check_cmd_id, dq_arg1);
+        ASSERT_EQ(check_cmd_id++, dq_arg2);
+    }
+
     // Queue should be empty
     ASSERT_FALSE(dequeue_cmd(&dq_cmd_id, (cmd_t **) &current_cmd, &dq_arg1, &dq_arg2));
 }
@@ -166,8 +182,7 @@ void cmd_queue_contains_col_test(void) {
     uint32_t arg1;
     uint32_t arg2;
 
-    ASSERT_EQ(queue_size(&cmd_queue_1), 0);
-    ASSERT_EQ(queue_size(&cmd_queue_2), 0);
+    ASSERT_EQ(cmd_queue_size(), 0);
 
     // Normal order
     ASSERT_FALSE(cmd_queue_contains_col_data_block(CMD_OBC_HK));
@@ -261,8 +276,71 @@ void cmd_queue_contains_col_test(void) {
     ASSERT_FALSE(cmd_queue_contains_col_data_block(CMD_PAY_HK));
     ASSERT_FALSE(cmd_queue_contains_col_data_block(CMD_PAY_OPT));
 
-    ASSERT_EQ(queue_size(&cmd_queue_1), 0);
-    ASSERT_EQ(queue_size(&cmd_queue_2), 0);
+    // Same block type more than once (including at the front)
+    enqueue_cmd(1, &col_data_block_cmd, CMD_EPS_HK, 0);
+    enqueue_cmd_front(1, &col_data_block_cmd, CMD_EPS_HK, 4);
+    ASSERT_TRUE(cmd_queue_contains_col_data_block(CMD_EPS_HK));
+    dequeue_cmd(&cmd_id, &cmd, &arg1, &arg2);
+    ASSERT_EQ(arg2, 4);
+    ASSERT_TRUE(cmd_queue_contains_col_data_block(CMD_EPS_HK));
+    dequeue_cmd(&cmd_id, &cmd, &arg1, &arg2);
+    ASSERT_FALSE(cmd_queue_contains_col_data_block(CMD_EPS_HK));
+
+    ASSERT_EQ(cmd_queue_size(), 0);
+}
+
+// Commands from ground go ahead of maintenance and background commands, but
+// only until the waiting commands have been passed CMD_QUEUE_MAX_SKIPS times
+void priority_queue_test(void) {
+    uint16_t cmd_id;
+    cmd_t* cmd;
+    uint32_t arg1;
+    uint32_t arg2;
+
+    init_cmd_queue();
+
+    // Background, maintenance, then ground
+    ASSERT_TRUE(enqueue_cmd(CMD_CMD_ID_AUTO_ENQUEUED, &col_data_block_cmd, CMD_EPS_HK, 0));
+    ASSERT_TRUE(enqueue_cmd(0x10, &erase_mem_phy_sector_cmd, 0, 0));
+    ASSERT_TRUE(enqueue_cmd(0x11, &ping_obc_cmd, 0, 0));
+    ASSERT_TRUE(enqueue_cmd(0x12, &get_rtc_cmd, 0, 0));
+    ASSERT_EQ(cmd_queue_size(), 4);
+
+    ASSERT_TRUE(dequeue_cmd(&cmd_id, &cmd, &arg1, &arg2));
+    ASSERT_EQ(cmd_id, 0x11);
+    ASSERT_TRUE(dequeue_cmd(&cmd_id, &cmd, &arg1, &arg2));
+    ASSERT_EQ(cmd_id, 0x12);
+    ASSERT_TRUE(dequeue_cmd(&cmd_id, &cmd, &arg1, &arg2));
+    ASSERT_EQ(cmd_id, 0x10);
+    ASSERT_TRUE(dequeue_cmd(&cmd_id, &cmd, &arg1, &arg2));
+    ASSERT_EQ(cmd_id, CMD_CMD_ID_AUTO_ENQUEUED);
+    ASSERT_TRUE(cmd == &col_data_block_cmd);
+
+    // Starvation guard
+    ASSERT_TRUE(enqueue_cmd(CMD_CMD_ID_AUTO_ENQUEUED, &col_data_block_cmd, CMD_PAY_HK, 0));
+    for (uint8_t i = 0; i < CMD_QUEUE_MAX_SKIPS + 1; i++) {
+        ASSERT_TRUE(enqueue_cmd(0x20 + i, &ping_obc_cmd, 0, 0));
+    }
+    for (uint8_t i = 0; i < CMD_QUEUE_MAX_SKIPS; i++) {
+        ASSERT_TRUE(dequeue_cmd(&cmd_id, &cmd, &arg1, &arg2));
+        ASSERT_EQ(cmd_id, 0x20 + i);
+    }
+    ASSERT_TRUE(dequeue_cmd(&cmd_id, &cmd, &arg1, &arg2));
+    ASSERT_TRUE(cmd == &col_data_block_cmd);
+    ASSERT_TRUE(dequeue_cmd(&cmd_id, &cmd, &arg1, &arg2));
+    ASSERT_EQ(cmd_id, 0x20 + CMD_QUEUE_MAX_SKIPS);
+
+    // Background commands can't use the reserved slots
+    uint8_t count = 0;
+    while (enqueue_cmd(CMD_CMD_ID_AUTO_ENQUEUED, &col_data_block_cmd, CMD_PAY_OPT, 0)) {
+        count++;
+    }
+    ASSERT_EQ(count, CMD_QUEUE_SIZE - CMD_QUEUE_GROUND_RESERVED);
+    ASSERT_TRUE(enqueue_cmd(0x30, &ping_obc_cmd, 0, 0));
+    ASSERT_TRUE(peek_cmd(&cmd_id, &cmd, &arg1, &arg2));
+    ASSERT_EQ(cmd_id, 0x30);
+
+    init_cmd_queue();
 }
 
 // Miscellaneous constants and configuration parameters
@@ -288,6 +366,10 @@ void params_test(void) {
     ASSERT_EQ(MEM_PRIM_CMD_LOG_END_ADDR + 1,    MEM_SEC_CMD_LOG_START_ADDR);
     ASSERT_EQ(MEM_SEC_CMD_LOG_END_ADDR + 1,     MEM_NUM_ADDRESSES);
 
+    // Command latency histograms must fit in EEPROM before the memory journal
+    ASSERT_TRUE(CMD_LAT_EEPROM_ADDR + 4 + (all_cmds_list_len * sizeof(cmd_lat_t)) <=
+        MEM_JOURNAL_START_EEPROM_ADDR);
+
     // Check auto data collection default periods are valid (not too frequent)
     ASSERT_GREATER(OBC_HK_AUTO_DATA_COL_PERIOD, CMD_AUTO_DATA_COL_MIN_PERIOD);
     ASSERT_GREATER(EPS_HK_AUTO_DATA_COL_PERIOD, CMD_AUTO_DATA_COL_MIN_PERIOD);
@@ -295,13 +377,298 @@ void params_test(void) {
     ASSERT_GREATER(PAY_OPT_AUTO_DATA_COL_PERIOD, CMD_AUTO_DATA_COL_MIN_PERIOD);
 }
 
+void events_test(void) {
+    // Clear anything left over from initialization
+    take_events();
+    ASSERT_EQ(take_events(), 0);
+
+    set_event(EVENT_TICK | EVENT_CAN_RX);
+    ASSERT_EQ(take_events(), EVENT_TICK | EVENT_CAN_RX);
+    ASSERT_EQ(take_events(), 0);
+
+    // Enqueueing a command should wake up the command handler
+    ASSERT_TRUE(enqueue_cmd(0x1234, &ping_obc_cmd, 0, 0));
+    ASSERT_TRUE(take_events() & EVENT_CMD);
+
+    // Finishing a command should let the next one start
+    uint16_t dq_cmd_id = 0;
+    uint32_t dq_arg1 = 0;
+    uint32_t dq_arg2 = 0;
+    ASSERT_TRUE(dequeue_cmd(&dq_cmd_id, (cmd_t **) &current_cmd, &dq_arg1, &dq_arg2));
+    ASSERT_EQ(take_events(), 0);
+    finish_current_cmd(CMD_RESP_STATUS_OK);
+    ASSERT_TRUE(take_events() & EVENT_CMD);
+}
+
+void ack_queue_test(void) {
+    trans_tx_ack_coalesce = false;
+    trans_tx_enc_avail = false;
+    trans_tx_dec_avail = false;
+
+    // ACKs added back-to-back are all kept
+    add_trans_tx_ack(0x1234, CMD_ACK_STATUS_OK);
+    add_trans_tx_ack(0x1235, CMD_ACK_STATUS_INVALID_PWD);
+    add_trans_tx_ack(CMD_CMD_ID_UNKNOWN, CMD_ACK_STATUS_INVALID_CSUM);
+    ASSERT_EQ(trans_tx_ack_count, 3);
+
+    // One ACK per frame
+    process_trans_tx_ack();
+    ASSERT_TRUE(trans_tx_ack_msg_avail);
+    ASSERT_EQ(trans_tx_ack_msg_len, TRANS_TX_ACK_LEN);
+    ASSERT_EQ(trans_tx_ack_msg[0], 0x12);
+    ASSERT_EQ(trans_tx_ack_msg[1], 0x34);
+    ASSERT_EQ(trans_tx_ack_msg[2], CMD_ACK_STATUS_OK);
+    ASSERT_EQ(trans_tx_ack_count, 2);
+
+    // Not replaced until it has been sent
+    process_trans_tx_ack();
+    ASSERT_EQ(trans_tx_ack_msg[1], 0x34);
+    ASSERT_EQ(trans_tx_ack_count, 2);
+
+    // The ACK frame is encoded (in place) before a waiting response
+    trans_tx_dec_len = 4;
+    trans_tx_dec_avail = true;
+    encode_trans_tx_msg();
+    ASSERT_TRUE(trans_tx_enc_avail);
+    ASSERT_TRUE(trans_tx_enc_msg == trans_tx_ack_frame);
+    ASSERT_EQ(trans_tx_enc_len, TRANS_TX_ACK_LEN + 9);
+    ASSERT_EQ(trans_tx_enc_msg[TRANS_PKT_HEADER_LEN], 0x12);
+    ASSERT_TRUE(trans_tx_ack_msg_avail);
+    ASSERT_TRUE(trans_tx_dec_avail);
+    process_trans_tx_ack();
+    ASSERT_EQ(trans_tx_ack_count, 2);
+    // As when the frame has been sent
+    trans_tx_ack_msg_avail = false;
+    trans_tx_enc_avail = false;
+    trans_tx_dec_avail = false;
+
+    // The rest are combined into one frame
+    trans_tx_ack_coalesce = true;
+    process_trans_tx_ack();
+    ASSERT_EQ(trans_tx_ack_msg_len, 2 * TRANS_TX_ACK_LEN);
+    ASSERT_EQ(trans_tx_ack_msg[2], CMD_ACK_STATUS_INVALID_PWD);
+    ASSERT_EQ(trans_tx_ack_msg[5], CMD_ACK_STATUS_INVALID_CSUM);
+    ASSERT_EQ(trans_tx_ack_count, 0);
+    trans_tx_ack_msg_avail = false;
+
+    // When the queue is full, new ACKs are dropped
+    for (uint8_t i = 0; i < TRANS_TX_ACK_QUEUE_SIZE + 2; i++) {
+        add_trans_tx_ack(i, CMD_ACK_STATUS_OK);
+    }
+    ASSERT_EQ(trans_tx_ack_count, TRANS_TX_ACK_QUEUE_SIZE);
+    process_trans_tx_ack();
+    ASSERT_EQ(trans_tx_ack_msg_len, TRANS_TX_ACK_QUEUE_SIZE * TRANS_TX_ACK_LEN);
+    ASSERT_EQ(trans_tx_ack_msg[(TRANS_TX_ACK_QUEUE_SIZE * TRANS_TX_ACK_LEN) - 2],
+        TRANS_TX_ACK_QUEUE_SIZE - 1);
+    trans_tx_ack_msg_avail = false;
+    trans_tx_ack_coalesce = false;
+    take_events();
+}
+
+// Adds a command to a batch message in trans_rx_dec_msg
+void set_batch_cmd(uint8_t index, uint16_t cmd_id, uint8_t opcode) {
+    volatile uint8_t* cmd_msg = &trans_rx_dec_msg[CMD_BATCH_HEADER_LEN +
+        (index * CMD_BATCH_CMD_LEN)];
+    cmd_msg[0] = (cmd_id >> 8) & 0xFF;
+    cmd_msg[1] = cmd_id & 0xFF;
+    cmd_msg[2] = opcode;
+    for (uint8_t i = 3; i < CMD_BATCH_CMD_LEN; i++) {
+        cmd_msg[i] = 0;
+    }
+}
+
+void batch_uplink_test(void) {
+    uint16_t cmd_id = 0;
+    uint8_t status = 0;
+    uint8_t bitmap = 0;
+
+    ASSERT_TRUE(CMD_BATCH_HEADER_LEN + (CMD_BATCH_MAX_CMDS * CMD_BATCH_CMD_LEN)
+        <= TRANS_RX_DEC_MSG_MAX_SIZE);
+    ASSERT_TRUE(CMD_BATCH_MAX_CMDS <= 8);
+
+    init_cmd_queue();
+    trans_tx_ack_count = 0;
+    trans_last_cmd_id = 0x100;
+
+    // The repeated ID and invalid opcode are rejected, the others are enqueued
+    trans_rx_dec_msg[0] = 0xFF;
+    trans_rx_dec_msg[1] = 0xFF;
+    trans_rx_dec_msg[2] = 4;
+    for (uint8_t i = 3; i < CMD_BATCH_HEADER_LEN; i++) {
+        trans_rx_dec_msg[i] = 0;
+    }
+    set_batch_cmd(0, 0x101, CMD_PING_OBC);
+    set_batch_cmd(1, 0x101, CMD_PING_OBC);
+    set_batch_cmd(2, 0x102, 0xEE);
+    set_batch_cmd(3, 0x103, CMD_GET_RTC);
+    trans_rx_dec_len = CMD_BATCH_HEADER_LEN + (4 * CMD_BATCH_CMD_LEN);
+    trans_rx_dec_avail = true;
+    handle_trans_rx_dec_msg();
+
+    ASSERT_EQ(cmd_queue_size(), 2);
+    ASSERT_EQ(trans_last_cmd_id, 0x103);
+    ASSERT_EQ(trans_tx_ack_count, 1);
+    ASSERT_TRUE(dequeue_trans_tx_ack(&cmd_id, &status, &bitmap));
+    ASSERT_EQ(cmd_id, 0x101);
+    ASSERT_EQ(status, CMD_ACK_STATUS_BATCH);
+    ASSERT_EQ(bitmap, 0x09);
+
+    // Number of commands doesn't match the length
+    trans_rx_dec_msg[2] = 3;
+    trans_rx_dec_avail = true;
+    handle_trans_rx_dec_msg();
+    ASSERT_TRUE(dequeue_trans_tx_ack(&cmd_id, &status, &bitmap));
+    ASSERT_EQ(cmd_id, CMD_CMD_ID_UNKNOWN);
+    ASSERT_EQ(status, CMD_ACK_STATUS_INVALID_DEC_FMT);
+    ASSERT_EQ(cmd_queue_size(), 2);
+
+    // The batch ACK frame has the bitmap after the status
+    add_trans_tx_batch_ack(0x104, 0x03);
+    process_trans_tx_ack();
+    ASSERT_EQ(trans_tx_ack_msg_len, TRANS_TX_ACK_BATCH_LEN);
+    ASSERT_EQ(trans_tx_ack_msg[2], CMD_ACK_STATUS_BATCH);
+    ASSERT_EQ(trans_tx_ack_msg[3], 0x03);
+    trans_tx_ack_msg_avail = false;
+
+    trans_last_cmd_id = 0;
+    init_cmd_queue();
+    take_events();
+}
+
+// Test that only the beacon fields of the collected block type change, and that
+// the content is written to the transceiver at most once per period
+void beacon_test(void) {
+    init_trans_beacon();
+    trans_beacon_dirty = false;
+    trans_beacon_wait_s = TRANS_BEACON_MIN_PERIOD_S;
+    trans_cmd_count = 0;
+    ASSERT_EQ(strlen(trans_beacon_content), TRANS_BEACON_CONTENT_LEN);
+
+    set_packed_field(eps_hk_data_col.fields, CAN_EPS_HK_BAT_VOL, 0xABCDEF);
+    set_packed_field(eps_hk_data_col.fields, CAN_EPS_HK_RESTART_COUNT, 0x000003);
+    set_packed_field(eps_hk_data_col.fields, CAN_EPS_HK_RESTART_REASON, 0x000012);
+    update_beacon_fields(&eps_hk_data_col);
+    ASSERT_TRUE(trans_beacon_dirty);
+    ASSERT_EQ(strncmp(trans_beacon_content,
+        "000000000000000000ABCDEF000003000012", 36), 0);
+    ASSERT_EQ(trans_beacon_content[TRANS_BEACON_CONTENT_LEN - 1], '0');
+
+    run_trans_beacon();
+    ASSERT_EQ(trans_cmd_count, 1);
+    ASSERT_EQ(trans_cmd_queue[trans_cmd_head].reg, TRANS_REG_BEACON_CONTENT);
+    ASSERT_EQ(trans_cmd_queue[trans_cmd_head].value, TRANS_BEACON_CONTENT_LEN);
+    ASSERT_TRUE(trans_cmd_queue[trans_cmd_head].text == trans_beacon_content);
+    ASSERT_FALSE(trans_beacon_dirty);
+    trans_cmd_count = 0;
+    trans_beacon_cb(true);
+
+    // Same values do not need another write
+    update_beacon_fields(&eps_hk_data_col);
+    ASSERT_FALSE(trans_beacon_dirty);
+
+    // Rate limited
+    set_packed_field(eps_hk_data_col.fields, CAN_EPS_HK_BAT_VOL, 0xABCDEE);
+    update_beacon_fields(&eps_hk_data_col);
+    ASSERT_TRUE(trans_beacon_dirty);
+    run_trans_beacon();
+    ASSERT_EQ(trans_cmd_count, 0);
+    for (uint16_t i = 0; i < TRANS_BEACON_MIN_PERIOD_S; i++) {
+        trans_uptime_cb();
+    }
+    run_trans_beacon();
+    ASSERT_EQ(trans_cmd_count, 1);
+
+    // A failed write is tried again
+    trans_cmd_count = 0;
+    trans_beacon_cb(false);
+    ASSERT_TRUE(trans_beacon_dirty);
+    ASSERT_FALSE(trans_beacon_busy);
+
+    trans_beacon_dirty = false;
+    trans_link_check_pending = false;
+    take_events();
+}
+
+uint8_t sched_test_count = 0;
+uint8_t sched_test_arg = 0;
+
+void sched_test_cb(uint8_t arg) {
+    sched_test_count++;
+    sched_test_arg = arg;
+}
+
+void sched_test(void) {
+    // The data collections leave the spare timer
+    ASSERT_EQ(sched_num_timers, SCHED_MAX_TIMERS - 1);
+    uint8_t id = add_sched_timer(sched_test_cb, 5);
+    ASSERT_NEQ(id, SCHED_NO_TIMER);
+    ASSERT_EQ(sched_timer_deadline(id), SCHED_NO_DEADLINE);
+    ASSERT_EQ(add_sched_timer(sched_test_cb, 6), SCHED_NO_TIMER);
+    ASSERT_EQ(sched_timer_deadline(SCHED_NO_TIMER), SCHED_NO_DEADLINE);
+
+    uint32_t now_s = 0;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        now_s = uptime_s;
+    }
+
+    // Only runs once the deadline passes
+    set_sched_timer(id, now_s + 2);
+    ASSERT_TRUE(sched_next_deadline_s <= now_s + 2);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        uptime_s = now_s + 1;
+    }
+    run_sched();
+    ASSERT_EQ(sched_test_count, 0);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        uptime_s = now_s + 2;
+    }
+    run_sched();
+    ASSERT_EQ(sched_test_count, 1);
+    ASSERT_EQ(sched_test_arg, 5);
+
+    // Timers are one-shot
+    ASSERT_EQ(sched_timer_deadline(id), SCHED_NO_DEADLINE);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        uptime_s = now_s + 3;
+    }
+    run_sched();
+    ASSERT_EQ(sched_test_count, 1);
+
+    // A cleared timer does not run
+    set_sched_timer(id, now_s + 4);
+    clear_sched_timer(id);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        uptime_s = now_s + 5;
+    }
+    run_sched();
+    ASSERT_EQ(sched_test_count, 1);
+
+    // Setting an invalid ID does nothing
+    set_sched_timer(SCHED_NO_TIMER, 0);
+    ASSERT_EQ(sched_timer_deadline(SCHED_NO_TIMER), SCHED_NO_DEADLINE);
+
+    // Each data collection has both of its timers
+    for (uint8_t i = 0; i < NUM_DATA_COL_SECTIONS; i++) {
+        ASSERT_NEQ(all_data_cols[i]->auto_timer, SCHED_NO_TIMER);
+        ASSERT_NEQ(all_data_cols[i]->req_timer, SCHED_NO_TIMER);
+        ASSERT_NEQ(all_data_cols[i]->auto_timer, id);
+        ASSERT_NEQ(all_data_cols[i]->req_timer, id);
+    }
+}
+
 test_t t1 = {.name = "dequeue empty test", .fn = dequeue_empty_test}; 
 test_t t2 = {.name = "triangle_queue test", .fn = triangle_queue_test};
 test_t t3 = {.name = "stair_queue test", .fn = stair_queue_test};
 test_t t4 = {.name = "cmd queue contains col test", .fn = cmd_queue_contains_col_test};
-test_t t5 = {.name = "params test", .fn = params_test};
-
-test_t* suite[] = { &t1, &t2, &t3, &t4, &t5 };
+test_t t5 = {.name = "priority queue test", .fn = priority_queue_test};
+test_t t6 = {.name = "params test", .fn = params_test};
+test_t t7 = {.name = "events test", .fn = events_test};
+test_t t8 = {.name = "ack queue test", .fn = ack_queue_test};
+test_t t9 = {.name = "batch uplink test", .fn = batch_uplink_test};
+test_t t10 = {.name = "beacon test", .fn = beacon_test};
+test_t t11 = {.name = "sched test", .fn = sched_test};
+
+test_t* suite[] = { &t1, &t2, &t3, &t4, &t5, &t6, &t7, &t8, &t9, &t10, &t11 };
 
 int main( void ) {
     init_obc_phase1_core();
@@ -21,6 +21,13 @@
         ASSERT_EQ((bytes1)[__i], (bytes2)[__i]);    \
     }
 
+// Checks the command queue entry at index i
+#define ASSERT_CMD_QUEUE_ENTRY(i, exp_id, exp_cmd, exp_arg1, exp_arg2) \
+    ASSERT_EQ(cmd_queue.entries[(cmd_queue.head + (i)) % CMD_QUEUE_SIZE].cmd_id, (exp_id)); \
+    ASSERT_TRUE(cmd_index_to_cmd(cmd_queue.entries[(cmd_queue.head + (i)) % CMD_QUEUE_SIZE].cmd_index) == (exp_cmd)); \
+    ASSERT_EQ(cmd_queue.entries[(cmd_queue.head + (i)) % CMD_QUEUE_SIZE].arg1, (exp_arg1)); \
+    ASSERT_EQ(cmd_queue.entries[(cmd_queue.head + (i)) % CMD_QUEUE_SIZE].arg2, (exp_arg2));
+
 /**
  * Test some basic set and get commands
  */
@@ -218,135 +225,1229 @@ void mem_commands_test(void) {
     ASSERT_EQ(obc_hk_mem_section.start_addr, 0x3e8);
 }
 
-// Test that when an erase memory sector command is enqueued, it goes directly
-// to the front of the queue
+// Test that when a block crosses into a new sector, the sector (and the
+// look-ahead sectors after it) are queued for a background erase instead of
+// adding an erase command to the command queue
 void auto_erase_mem_sector_test(void) {
     // Make sure queues are empty after any previous tests
-    init_queue(&cmd_queue_1);
-    init_queue(&cmd_queue_2);
-    ASSERT_EQ(queue_size(&cmd_queue_1), 0);
-    ASSERT_EQ(queue_size(&cmd_queue_2), 0);
+    init_cmd_queue();
+    ASSERT_EQ(cmd_queue_size(), 0);
 
     // These got changed in a previous test, set them back to defaults
     set_mem_section_start_addr(&obc_hk_mem_section, MEM_OBC_HK_START_ADDR);
     set_mem_section_end_addr(&obc_hk_mem_section, MEM_OBC_HK_END_ADDR);
 
     // Each OBC block is 5 fields (15 bytes) + header (10 bytes)
-    // Total number of bytes in section is 0x100000
-    // Say we want to cross the sector boundary at 0xF0000 -> can fit 39,321 complete blocks
+    // Total number of bytes in section is 0x80000
+    // Say we want to cross the sector boundary at 0x70000 -> can fit 18,350 complete blocks
 
     // This block number should not rollover, but the next one should
-    set_mem_section_curr_block(&obc_hk_mem_section, 39319);
+    set_mem_section_curr_block(&obc_hk_mem_section, 18348);
 
     // Make sure OBC_HK section parameters are what we expect
     ASSERT_EQ(obc_hk_mem_section.start_addr, MEM_OBC_HK_START_ADDR);
     ASSERT_EQ(obc_hk_mem_section.end_addr, MEM_OBC_HK_END_ADDR);
-    ASSERT_EQ(obc_hk_mem_section.curr_block, 39319);
+    ASSERT_EQ(obc_hk_mem_section.curr_block, 18348);
     ASSERT_EQ(obc_hk_mem_section.curr_block_eeprom_addr, MEM_OBC_HK_CURR_BLOCK_EEPROM_ADDR);
     ASSERT_EQ(obc_hk_mem_section.fields_per_block, CAN_OBC_HK_FIELD_COUNT);
 
-    uint8_t cmd_101_1[8];
-    uint8_t cmd_101_2[8];
     enqueue_cmd(0x101, &col_data_block_cmd, CMD_OBC_HK, 0);
-    cmd_to_bytes(0x101, &col_data_block_cmd, CMD_OBC_HK, 0, cmd_101_1, cmd_101_2);
-
-    uint8_t cmd_102_1[8];
-    uint8_t cmd_102_2[8];
     enqueue_cmd(0x102, &col_data_block_cmd, CMD_OBC_HK, 0);
-    cmd_to_bytes(0x102, &col_data_block_cmd, CMD_OBC_HK, 0, cmd_102_1, cmd_102_2);
-
-    uint8_t erase_1[8];
-    uint8_t erase_2[8];
-    cmd_to_bytes(CMD_CMD_ID_AUTO_ENQUEUED, &erase_mem_phy_sector_cmd, 0xF0000, 0, erase_1, erase_2);
-
-    uint8_t cmd_105_1[8];
-    uint8_t cmd_105_2[8];
     enqueue_cmd(0x105, &ping_obc_cmd, 0, 0);
-    cmd_to_bytes(0x105, &ping_obc_cmd, 0, 0, cmd_105_1, cmd_105_2);
-
-    uint8_t cmd_109_1[8];
-    uint8_t cmd_109_2[8];
     enqueue_cmd(0x109, &get_rtc_cmd, 0, 0);
-    cmd_to_bytes(0x109, &get_rtc_cmd, 0, 0, cmd_109_1, cmd_109_2);
-    
-    ASSERT_EQ(queue_size(&cmd_queue_1), 4);
-    ASSERT_EQ(queue_size(&cmd_queue_2), 4);
-    ASSERT_BYTES_EQ(cmd_queue_1.content[0], cmd_101_1, 8);
-    ASSERT_BYTES_EQ(cmd_queue_2.content[0], cmd_101_2, 8);
-    ASSERT_BYTES_EQ(cmd_queue_1.content[1], cmd_102_1, 8);
-    ASSERT_BYTES_EQ(cmd_queue_2.content[1], cmd_102_2, 8);
-    ASSERT_BYTES_EQ(cmd_queue_1.content[2], cmd_105_1, 8);
-    ASSERT_BYTES_EQ(cmd_queue_2.content[2], cmd_105_2, 8);
-    ASSERT_BYTES_EQ(cmd_queue_1.content[3], cmd_109_1, 8);
-    ASSERT_BYTES_EQ(cmd_queue_2.content[3], cmd_109_2, 8);
+
+    ASSERT_EQ(cmd_queue_size(), 4);
+    ASSERT_CMD_QUEUE_ENTRY(0, 0x101, &col_data_block_cmd, CMD_OBC_HK, 0);
+    ASSERT_CMD_QUEUE_ENTRY(1, 0x102, &col_data_block_cmd, CMD_OBC_HK, 0);
+    ASSERT_CMD_QUEUE_ENTRY(2, 0x105, &ping_obc_cmd, 0, 0);
+    ASSERT_CMD_QUEUE_ENTRY(3, 0x109, &get_rtc_cmd, 0, 0);
 
     execute_next_cmd();
 
     // Should not get an erase memory sector command
-    ASSERT_EQ(queue_size(&cmd_queue_1), 3);
-    ASSERT_EQ(queue_size(&cmd_queue_2), 3);
-    ASSERT_BYTES_EQ(cmd_queue_1.content[1], cmd_102_1, 8);
-    ASSERT_BYTES_EQ(cmd_queue_2.content[1], cmd_102_2, 8);
-    ASSERT_BYTES_EQ(cmd_queue_1.content[2], cmd_105_1, 8);
-    ASSERT_BYTES_EQ(cmd_queue_2.content[2], cmd_105_2, 8);
-    ASSERT_BYTES_EQ(cmd_queue_1.content[3], cmd_109_1, 8);
-    ASSERT_BYTES_EQ(cmd_queue_2.content[3], cmd_109_2, 8);
-
-    execute_next_cmd();
-
-    // Expect an erase memory sector command at the front of the queue
-    ASSERT_EQ(queue_size(&cmd_queue_1), 3);
-    ASSERT_EQ(queue_size(&cmd_queue_2), 3);
-    ASSERT_BYTES_EQ(cmd_queue_1.content[1], erase_1, 8);
-    ASSERT_BYTES_EQ(cmd_queue_2.content[1], erase_2, 8);
-    ASSERT_BYTES_EQ(cmd_queue_1.content[2], cmd_105_1, 8);
-    ASSERT_BYTES_EQ(cmd_queue_2.content[2], cmd_105_2, 8);
-    ASSERT_BYTES_EQ(cmd_queue_1.content[3], cmd_109_1, 8);
-    ASSERT_BYTES_EQ(cmd_queue_2.content[3], cmd_109_2, 8);
-
-    uint8_t read_1[8];
-    uint8_t read_2[8];
-    peek_queue(&cmd_queue_1, read_1);
-    peek_queue(&cmd_queue_2, read_2);
-    ASSERT_BYTES_EQ(read_1, erase_1, 8);
-    ASSERT_BYTES_EQ(read_2, erase_2, 8);
-
-    ASSERT_EQ(queue_size(&cmd_queue_1), 3);
-    ASSERT_EQ(queue_size(&cmd_queue_2), 3);
-
-    // Execute the auto erase memory sector command
-    execute_next_cmd();
-
-    ASSERT_EQ(queue_size(&cmd_queue_1), 2);
-    ASSERT_EQ(queue_size(&cmd_queue_2), 2);
-    ASSERT_BYTES_EQ(cmd_queue_1.content[2], cmd_105_1, 8);
-    ASSERT_BYTES_EQ(cmd_queue_2.content[2], cmd_105_2, 8);
-    ASSERT_BYTES_EQ(cmd_queue_1.content[3], cmd_109_1, 8);
-    ASSERT_BYTES_EQ(cmd_queue_2.content[3], cmd_109_2, 8);
+    ASSERT_EQ(cmd_queue_size(), 3);
+    ASSERT_CMD_QUEUE_ENTRY(0, 0x102, &col_data_block_cmd, CMD_OBC_HK, 0);
+    ASSERT_CMD_QUEUE_ENTRY(1, 0x105, &ping_obc_cmd, 0, 0);
+    ASSERT_CMD_QUEUE_ENTRY(2, 0x109, &get_rtc_cmd, 0, 0);
+
+    execute_next_cmd();
+
+    // Expect no erase memory sector command, but background erases for
+    // sector 0x70 and the look-ahead sectors after it
+    ASSERT_EQ(cmd_queue_size(), 2);
+    ASSERT_CMD_QUEUE_ENTRY(0, 0x105, &ping_obc_cmd, 0, 0);
+    ASSERT_CMD_QUEUE_ENTRY(1, 0x109, &get_rtc_cmd, 0, 0);
+
+    ASSERT_EQ(mem_erase_queue_count, 1 + MEM_ERASE_LOOKAHEAD_SECTORS);
+    ASSERT_EQ(mem_erase_queue[0], mem_sector_for_addr(0x70000));
+    ASSERT_EQ(obc_hk_mem_section.erase_ahead_sector,
+        mem_sector_for_addr(0x70000) + MEM_ERASE_LOOKAHEAD_SECTORS);
+
+    // Start all the background erases
+    for (uint8_t i = 0; i < 1 + MEM_ERASE_LOOKAHEAD_SECTORS; i++) {
+        wait_for_all_mem_ready();
+        run_mem_erase();
+    }
+    ASSERT_EQ(mem_erase_queue_count, 0);
 
     // Ping
     execute_next_cmd();
 
-    ASSERT_EQ(queue_size(&cmd_queue_1), 1);
-    ASSERT_EQ(queue_size(&cmd_queue_2), 1);
-    ASSERT_BYTES_EQ(cmd_queue_1.content[3], cmd_109_1, 8);
-    ASSERT_BYTES_EQ(cmd_queue_2.content[3], cmd_109_2, 8);
+    ASSERT_EQ(cmd_queue_size(), 1);
+    ASSERT_CMD_QUEUE_ENTRY(0, 0x109, &get_rtc_cmd, 0, 0);
 
     // Get RTC
     execute_next_cmd();
 
-    ASSERT_EQ(queue_size(&cmd_queue_1), 0);
-    ASSERT_EQ(queue_size(&cmd_queue_2), 0);
+    ASSERT_EQ(cmd_queue_size(), 0);
+}
+
+
+// Test that a range of data blocks is split into responses with as many whole
+// blocks as fit, continuing from the front of the queue
+void read_data_block_range_test(void) {
+    init_cmd_queue();
+
+    // OBC_HK blocks are 25 bytes, so 5 fit in one response
+    uint8_t resp_count = (TRANS_TX_DEC_MSG_MAX_SIZE - 3) / MEM_OBC_HK_BYTES_PER_BLOCK;
+    ASSERT_EQ(resp_count, 5);
+
+    enqueue_cmd(0x30, &read_data_block_range_cmd, CMD_OBC_HK,
+        (7UL << CMD_READ_DATA_BLOCK_RANGE_COUNT_SHIFT) | 2);
+    enqueue_cmd(0x31, &ping_obc_cmd, 0, 0);
+
+    trans_tx_dec_avail = false;
+    trans_tx_enc_avail = false;
+    execute_next_cmd();
+    ASSERT_TRUE(trans_tx_dec_avail);
+    ASSERT_EQ(trans_tx_dec_len, 3 + (resp_count * MEM_OBC_HK_BYTES_PER_BLOCK));
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_OK);
+
+    // The continuation (remaining 2 blocks, starting at block 7) should be
+    // before the ping
+    ASSERT_EQ(cmd_queue_size(), 2);
+    uint16_t cmd_id = 0;
+    cmd_t* cmd = NULL;
+    uint32_t arg1 = 0;
+    uint32_t arg2 = 0;
+    ASSERT_TRUE(peek_cmd(&cmd_id, &cmd, &arg1, &arg2));
+    ASSERT_EQ(cmd_id, 0x30);
+    ASSERT_TRUE(cmd == &read_data_block_range_cmd);
+    ASSERT_EQ(arg1, CMD_OBC_HK | CMD_READ_DATA_BLOCK_RANGE_CONT);
+    ASSERT_EQ(arg2, (2UL << CMD_READ_DATA_BLOCK_RANGE_COUNT_SHIFT) | 7);
+
+    // Waits until the previous response is sent
+    execute_next_cmd();
+    ASSERT_EQ(cmd_queue_size(), 2);
+    trans_tx_dec_avail = false;
+
+    execute_next_cmd();
+    ASSERT_TRUE(trans_tx_dec_avail);
+    ASSERT_EQ(trans_tx_dec_len, 3 + (2 * MEM_OBC_HK_BYTES_PER_BLOCK));
+    ASSERT_EQ(cmd_queue_size(), 1);
+
+    // Past the end of the section
+    enqueue_cmd(0x32, &read_data_block_range_cmd, CMD_OBC_HK,
+        (1UL << CMD_READ_DATA_BLOCK_RANGE_COUNT_SHIFT) |
+        mem_section_num_blocks(&obc_hk_mem_section));
+    execute_next_cmd();    // ping
+    execute_next_cmd();
+    ASSERT_TRUE(trans_tx_dec_avail);
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_INVALID_ARGS);
+}
+
+
+// Returns the 24-bit value at `i` in the response
+uint32_t resp_field(uint8_t i) {
+    return ((uint32_t) trans_tx_dec_msg[i] << 16) |
+        ((uint32_t) trans_tx_dec_msg[i + 1] << 8) |
+        ((uint32_t) trans_tx_dec_msg[i + 2]);
+}
+
+// Test that the selected fields of a range of blocks are aggregated on board,
+// and that the running aggregate is updated as blocks are collected
+void agg_data_blocks_test(void) {
+    init_cmd_queue();
+
+    // Write PAY_HK blocks 1000 to 1003, field 1 is missing in block 1002
+    uint32_t start_block = 1000;
+    erase_mem_sector(mem_block_addr(&pay_hk_mem_section, start_block));
+    erase_mem_sector(mem_block_addr(&pay_hk_mem_section, start_block + 4) - 1);
+    for (uint8_t i = 0; i < 4; i++) {
+        mem_header_t header;
+        populate_header(&header, start_block + i, CMD_RESP_STATUS_OK);
+        uint8_t fields[CAN_PAY_HK_FIELD_COUNT * MEM_BYTES_PER_FIELD] = { 0 };
+        set_packed_field(fields, 0, 10 * (i + 1));
+        set_packed_field(fields, 1,
+            (i == 2) ? CMD_AGG_MISSING_FIELD : 100 + i);
+        ASSERT_EQ(write_mem_data_block_fields(&pay_hk_mem_section,
+            start_block + i, &header, fields, true, 0, CAN_PAY_HK_FIELD_COUNT), 1);
+    }
+
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0x60, &agg_data_blocks_cmd,
+        (0x03UL << CMD_AGG_DATA_BLOCKS_FIELD_MASK_SHIFT) | 4,
+        ((uint32_t) CMD_PAY_HK << CMD_AGG_DATA_BLOCKS_TYPE_SHIFT) | start_block);
+    execute_next_cmd();
+    ASSERT_TRUE(trans_tx_dec_avail);
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_OK);
+    ASSERT_EQ(trans_tx_dec_len, 3 + 5 + (2 * 14));
+    ASSERT_EQ(trans_tx_dec_msg[4], 4);
+    ASSERT_EQ(resp_field(5), start_block + 3);
+    // Field 0 - count, min, max, mean, last
+    ASSERT_EQ(trans_tx_dec_msg[9], 4);
+    ASSERT_EQ(resp_field(10), 10);
+    ASSERT_EQ(resp_field(13), 40);
+    ASSERT_EQ(resp_field(16), 25);
+    ASSERT_EQ(resp_field(19), 40);
+    // Field 1 skips the missing value
+    ASSERT_EQ(trans_tx_dec_msg[23], 3);
+    ASSERT_EQ(resp_field(24), 100);
+    ASSERT_EQ(resp_field(27), 103);
+    ASSERT_EQ(resp_field(30), 101);
+    ASSERT_EQ(resp_field(33), 103);
+
+    // No fields, or a field past the end of the block
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0x61, &agg_data_blocks_cmd, 4,
+        ((uint32_t) CMD_PAY_HK << CMD_AGG_DATA_BLOCKS_TYPE_SHIFT) | start_block);
+    execute_next_cmd();
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_INVALID_ARGS);
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0x62, &agg_data_blocks_cmd,
+        ((uint32_t) (CAN_PAY_HK_FIELD_COUNT - 1) << CMD_AGG_DATA_BLOCKS_FIRST_FIELD_SHIFT) |
+        (0x03UL << CMD_AGG_DATA_BLOCKS_FIELD_MASK_SHIFT) | 4,
+        ((uint32_t) CMD_PAY_HK << CMD_AGG_DATA_BLOCKS_TYPE_SHIFT) | start_block);
+    execute_next_cmd();
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_INVALID_ARGS);
+
+    // Select the OBC_HK restart count for the running aggregate (nothing
+    // was collected for it yet)
+    uint32_t run_arg1 =
+        ((uint32_t) CAN_OBC_HK_RESTART_COUNT << CMD_AGG_DATA_BLOCKS_FIRST_FIELD_SHIFT) |
+        (0x01UL << CMD_AGG_DATA_BLOCKS_FIELD_MASK_SHIFT);
+    uint32_t run_arg2 = (uint32_t) CMD_OBC_HK << CMD_AGG_DATA_BLOCKS_TYPE_SHIFT;
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0x63, &agg_data_blocks_cmd, run_arg1, run_arg2);
+    execute_next_cmd();
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_OK);
+    ASSERT_EQ(trans_tx_dec_len, 3 + 5 + 14);
+    ASSERT_EQ(trans_tx_dec_msg[4], 0);
+
+    for (uint8_t i = 0; i < 2; i++) {
+        enqueue_cmd(CMD_CMD_ID_AUTO_ENQUEUED, &col_data_block_cmd, CMD_OBC_HK, 0);
+        execute_next_cmd();
+    }
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0x64, &agg_data_blocks_cmd, run_arg1, run_arg2);
+    execute_next_cmd();
+    ASSERT_EQ(trans_tx_dec_msg[4], 2);
+    ASSERT_EQ(resp_field(5), obc_hk_data_col.header.block_num);
+    ASSERT_EQ(trans_tx_dec_msg[9], 2);
+    ASSERT_EQ(resp_field(19), restart_count);
+
+    // Reading it starts a new one
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0x65, &agg_data_blocks_cmd, run_arg1, run_arg2);
+    execute_next_cmd();
+    ASSERT_EQ(trans_tx_dec_msg[4], 0);
+}
+
+
+// Test that the blocks between two times are found from the block headers,
+// including after the section wraps around
+void find_data_blocks_by_time_test(void) {
+    init_cmd_queue();
+
+    mem_section_t* section = &obc_hk_mem_section;
+    uint32_t prev_curr_block = section->curr_block;
+    for (uint32_t addr = section->start_addr; addr < section->end_addr;
+            addr += MEM_BYTES_PER_SECTOR) {
+        erase_mem_sector(addr);
+    }
+
+    rtc_date_t date = { .dd = 28, .mm = 2, .yy = 20 };
+    rtc_time_t time = { .ss = 0, .mm = 0, .hh = 22 };
+    uint32_t start_s = rtc_clock_to_s(date, time);
+    rtc_date_t leap_date = { .dd = 29, .mm = 2, .yy = 20 };
+    rtc_time_t midnight = { .ss = 0, .mm = 0, .hh = 0 };
+    ASSERT_EQ(rtc_clock_to_s(leap_date, midnight) - start_s, 2UL * 60 * 60);
+
+    // Six blocks one hour apart from 2020-02-28 22:00:00, in the last three
+    // blocks of the section and then blocks 0 to 2
+    uint32_t last = mem_section_num_blocks(section) - 1;
+    uint32_t blocks[6] = { last - 2, last - 1, last, 0, 1, 2 };
+    for (uint8_t i = 0; i < 6; i++) {
+        mem_header_t header;
+        header.block_num = blocks[i];
+        header.date = (22 + i < 24) ? date : leap_date;
+        header.time = time;
+        header.time.hh = (22 + i) % 24;
+        header.status = CMD_RESP_STATUS_OK;
+        write_mem_header_main(section, blocks[i], &header);
+        write_mem_header_status(section, blocks[i], header.status);
+    }
+    set_mem_section_curr_block(section, 3);
+
+    // 22:30 to 00:30
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0x70, &find_data_blocks_by_time_cmd, start_s + (30 * 60),
+        ((uint32_t) CMD_OBC_HK << CMD_FIND_DATA_BLOCKS_BY_TIME_TYPE_SHIFT) |
+        (2 * 60 * 60));
+    execute_next_cmd();
+    ASSERT_TRUE(trans_tx_dec_avail);
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_OK);
+    ASSERT_EQ(trans_tx_dec_len, 3 + 6);
+    ASSERT_EQ(resp_field(3), last - 1);
+    ASSERT_EQ(resp_field(6), 2);
+
+    // Exactly the first and last block times - all of them
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0x71, &find_data_blocks_by_time_cmd, start_s,
+        ((uint32_t) CMD_OBC_HK << CMD_FIND_DATA_BLOCKS_BY_TIME_TYPE_SHIFT) |
+        (5 * 60 * 60));
+    execute_next_cmd();
+    ASSERT_EQ(resp_field(3), last - 2);
+    ASSERT_EQ(resp_field(6), 6);
+
+    // After all of them - none, at the current block
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0x72, &find_data_blocks_by_time_cmd, start_s + (6 * 60 * 60),
+        ((uint32_t) CMD_OBC_HK << CMD_FIND_DATA_BLOCKS_BY_TIME_TYPE_SHIFT) |
+        (60 * 60));
+    execute_next_cmd();
+    ASSERT_EQ(resp_field(3), 3);
+    ASSERT_EQ(resp_field(6), 0);
+
+    // Invalid type, and an end time that overflows
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0x73, &find_data_blocks_by_time_cmd, start_s,
+        (0xFFUL << CMD_FIND_DATA_BLOCKS_BY_TIME_TYPE_SHIFT) | 60);
+    execute_next_cmd();
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_INVALID_ARGS);
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0x74, &find_data_blocks_by_time_cmd, 0xFFFFFFFFUL,
+        ((uint32_t) CMD_OBC_HK << CMD_FIND_DATA_BLOCKS_BY_TIME_TYPE_SHIFT) | 60);
+    execute_next_cmd();
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_INVALID_ARGS);
+
+    set_mem_section_curr_block(section, prev_curr_block);
+}
+
+// Test that the fields of a collection are requested and stored as the CAN
+// responses arrive, with only the start and finish going through the command
+// queue
+void col_data_block_state_test(void) {
+    init_cmd_queue();
+    init_queue(&eps_tx_msg_queue);
+    init_can_rx_rings();
+    trans_tx_dec_avail = false;
+    // Field timeouts run from run_sched(), so don't let automatic collections
+    // get enqueued in the middle of the test
+    for (uint8_t i = 0; i < NUM_DATA_COL_SECTIONS; i++) {
+        clear_sched_timer(all_data_cols[i]->auto_timer);
+    }
+
+    enqueue_cmd(0x40, &col_data_block_cmd, CMD_EPS_HK, 0);
+    execute_next_cmd();
+    ASSERT_EQ(eps_hk_data_col.state, DATA_COL_STATE_COLLECTING);
+    ASSERT_EQ(cmd_queue_size(), 0);
+    ASSERT_FALSE(trans_tx_dec_avail);
+
+    uint8_t fields_per_block = eps_hk_mem_section.fields_per_block;
+    for (uint8_t field_num = 0; field_num < fields_per_block; field_num++) {
+        uint8_t msg[8] = {0x00};
+        ASSERT_FALSE(queue_empty(&eps_tx_msg_queue));
+        dequeue(&eps_tx_msg_queue, msg);
+        ASSERT_EQ(msg[0], CAN_EPS_HK);
+        ASSERT_EQ(msg[1], field_num);
+
+        // Other opcodes are not taken by the collection
+        msg[0] = CAN_PAY_HK;
+        cmd_rx_callback(msg, 8);
+        process_next_rx_msg();
+        ASSERT_EQ(eps_hk_data_col.staged_field_count, field_num);
+
+        // Field numbers past the end of the block are dropped, including the
+        // value of a free request slot (all the other slots are free while
+        // waiting for the last field)
+        if (field_num == fields_per_block - 1) {
+            uint8_t bad_msg[8] = {CAN_EPS_HK, fields_per_block, 0, 0, 0, 0, 0, 0};
+            cmd_rx_callback(bad_msg, 8);
+            process_next_rx_msg();
+            bad_msg[1] = CMD_COL_DATA_BLOCK_NO_REQ;
+            cmd_rx_callback(bad_msg, 8);
+            process_next_rx_msg();
+            ASSERT_EQ(eps_hk_data_col.received_field_count, field_num);
+            ASSERT_EQ(eps_hk_data_col.state, DATA_COL_STATE_COLLECTING);
+        }
+
+        msg[0] = CAN_EPS_HK;
+        msg[6] = field_num;
+        msg[7] = field_num + 1;
+        cmd_rx_callback(msg, 8);
+        process_next_rx_msg();
+        ASSERT_EQ(eps_hk_data_col.staged_field_count, field_num + 1);
+        ASSERT_EQ(get_packed_field(eps_hk_data_col.fields, field_num),
+            ((uint32_t) field_num << 8) | (field_num + 1));
+
+        if (field_num < fields_per_block - 1) {
+            ASSERT_EQ(cmd_queue_size(), 0);
+        }
+    }
+    ASSERT_TRUE(queue_empty(&eps_tx_msg_queue));
+
+    // Only the finish command should have been enqueued
+    ASSERT_EQ(eps_hk_data_col.state, DATA_COL_STATE_FINISHING);
+    ASSERT_EQ(cmd_queue_size(), 1);
+    execute_next_cmd();
+    ASSERT_EQ(eps_hk_data_col.state, DATA_COL_STATE_IDLE);
+    ASSERT_TRUE(trans_tx_dec_avail);
+    ASSERT_EQ(trans_tx_dec_len, 3 + 4);
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_OK);
+    ASSERT_EQ(eps_hk_data_col.header.status, CMD_RESP_STATUS_OK);
+
+    // A window of fields is requested at once and the responses can arrive
+    // out of order
+    trans_tx_dec_avail = false;
+    init_queue(&eps_tx_msg_queue);
+    enqueue_cmd(0x41, &col_data_block_cmd, CMD_EPS_HK, 0);
+    execute_next_cmd();
+    ASSERT_EQ(eps_hk_data_col.state, DATA_COL_STATE_COLLECTING);
+    ASSERT_EQ(queue_size(&eps_tx_msg_queue), CMD_COL_DATA_BLOCK_WINDOW_SIZE);
+    uint8_t resp[8] = {CAN_EPS_HK, 1, 0, 0, 0, 0, 0, 0x11};
+    cmd_rx_callback(resp, 8);
+    process_next_rx_msg();
+    ASSERT_EQ(eps_hk_data_col.received_field_count, 1);
+    ASSERT_EQ(eps_hk_data_col.staged_field_count, 0);
+    resp[1] = 0;
+    resp[7] = 0x10;
+    cmd_rx_callback(resp, 8);
+    process_next_rx_msg();
+    ASSERT_EQ(eps_hk_data_col.received_field_count, 2);
+    ASSERT_EQ(eps_hk_data_col.staged_field_count, 2);
+    ASSERT_EQ(get_packed_field(eps_hk_data_col.fields, 0), 0x10);
+    ASSERT_EQ(get_packed_field(eps_hk_data_col.fields, 1), 0x11);
+    // A duplicate response is dropped
+    cmd_rx_callback(resp, 8);
+    process_next_rx_msg();
+    ASSERT_EQ(eps_hk_data_col.received_field_count, 2);
+
+    // A field timeout only requests the missing fields again
+    init_queue(&eps_tx_msg_queue);
+    run_sched();
+    ASSERT_TRUE(queue_empty(&eps_tx_msg_queue));
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        uptime_s += CMD_COL_DATA_BLOCK_FIELD_TIMEOUT_S;
+    }
+    run_sched();
+    ASSERT_EQ(eps_hk_data_col.state, DATA_COL_STATE_COLLECTING);
+    ASSERT_EQ(queue_size(&eps_tx_msg_queue), CMD_COL_DATA_BLOCK_WINDOW_SIZE);
+    for (uint8_t i = 0; i < CMD_COL_DATA_BLOCK_WINDOW_SIZE; i++) {
+        uint8_t req[8] = {0x00};
+        dequeue(&eps_tx_msg_queue, req);
+        ASSERT_TRUE(req[1] >= 2);
+        ASSERT_TRUE(req[1] < 2 + CMD_COL_DATA_BLOCK_WINDOW_SIZE);
+    }
+
+    // After the retries, the collection finishes with a timed out status
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        uptime_s += CMD_COL_DATA_BLOCK_FIELD_TIMEOUT_S;
+    }
+    run_sched();
+    ASSERT_EQ(eps_hk_data_col.state, DATA_COL_STATE_FINISHING);
+    execute_next_cmd();
+    ASSERT_EQ(eps_hk_data_col.state, DATA_COL_STATE_IDLE);
+    ASSERT_TRUE(trans_tx_dec_avail);
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_TIMED_OUT);
+    ASSERT_EQ(eps_hk_data_col.header.status, CMD_RESP_STATUS_TIMED_OUT);
+
+    // Finishing without a collection in progress is rejected
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0x42, &col_data_block_cmd, CMD_EPS_HK, CMD_COL_DATA_BLOCK_FINISH);
+    execute_next_cmd();
+    ASSERT_TRUE(trans_tx_dec_avail);
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_INVALID_ARGS);
+}
+
+
+// Test that a command timeout is only flagged by the uptime callback and the
+// command is finished from the main loop
+void cmd_timeout_test(void) {
+    init_cmd_queue();
+    trans_tx_dec_avail = false;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        current_cmd_id = 0x44;
+        current_cmd = &ping_obc_cmd;
+    }
+    for (uint32_t i = 0; i < cmd_timeout_period_s; i++) {
+        cmd_timeout_timer_cb();
+    }
+    ASSERT_TRUE(cmd_timed_out);
+    ASSERT_TRUE(current_cmd == &ping_obc_cmd);
+    ASSERT_FALSE(trans_tx_dec_avail);
+
+    run_cmd_timeout();
+    ASSERT_FALSE(cmd_timed_out);
+    ASSERT_TRUE(current_cmd == &nop_cmd);
+    ASSERT_TRUE(trans_tx_dec_avail);
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_TIMED_OUT);
+
+    // A command that finishes normally before the main loop handles the
+    // timeout is not timed out, and neither is the next one
+    trans_tx_dec_avail = false;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        current_cmd_id = 0x45;
+        current_cmd = &ping_obc_cmd;
+    }
+    for (uint32_t i = 0; i < cmd_timeout_period_s; i++) {
+        cmd_timeout_timer_cb();
+    }
+    finish_current_cmd(CMD_RESP_STATUS_OK);
+    ASSERT_FALSE(cmd_timed_out);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        current_cmd_id = 0x46;
+        current_cmd = &ping_obc_cmd;
+    }
+    run_cmd_timeout();
+    ASSERT_TRUE(current_cmd == &ping_obc_cmd);
+    ASSERT_FALSE(trans_tx_dec_avail);
+    finish_current_cmd(CMD_RESP_STATUS_OK);
+}
+
+// Test that EPS and PAY collections run at the same time, each with its own
+// progress and command log block
+void concurrent_data_col_test(void) {
+    init_cmd_queue();
+    init_queue(&eps_tx_msg_queue);
+    init_queue(&pay_tx_msg_queue);
+    init_can_rx_rings();
+
+    enqueue_cmd(0x50, &col_data_block_cmd, CMD_EPS_HK, 0);
+    enqueue_cmd(0x51, &col_data_block_cmd, CMD_PAY_HK, 0);
+    execute_next_cmd();
+    execute_next_cmd();
+    ASSERT_EQ(eps_hk_data_col.state, DATA_COL_STATE_COLLECTING);
+    ASSERT_EQ(pay_hk_data_col.state, DATA_COL_STATE_COLLECTING);
+    ASSERT_NEQ(eps_hk_data_col.cmd_log_block_num, pay_hk_data_col.cmd_log_block_num);
+
+    // Answer the requests from both subsystems, with the responses interleaved
+    // in the RX interrupt
+    while (!queue_empty(&eps_tx_msg_queue) || !queue_empty(&pay_tx_msg_queue)) {
+        uint8_t msg[8] = {0x00};
+        if (!queue_empty(&eps_tx_msg_queue)) {
+            dequeue(&eps_tx_msg_queue, msg);
+            msg[7] = 0xE0 | msg[1];
+            cmd_rx_callback(msg, 8);
+        }
+        if (!queue_empty(&pay_tx_msg_queue)) {
+            dequeue(&pay_tx_msg_queue, msg);
+            msg[7] = 0xA0 | msg[1];
+            cmd_rx_callback(msg, 8);
+        }
+        // Both responses are processed in one call
+        process_next_rx_msg();
+        ASSERT_TRUE(can_rx_ring_empty(&eps_hk_rx_ring));
+        ASSERT_TRUE(can_rx_ring_empty(&pay_hk_rx_ring));
+    }
+
+    ASSERT_EQ(eps_hk_data_col.state, DATA_COL_STATE_FINISHING);
+    ASSERT_EQ(pay_hk_data_col.state, DATA_COL_STATE_FINISHING);
+    ASSERT_EQ(get_packed_field(eps_hk_data_col.fields, 3), 0xE3);
+    ASSERT_EQ(get_packed_field(pay_hk_data_col.fields, 3), 0xA3);
+    ASSERT_EQ(cmd_queue_size(), 2);
+    execute_next_cmd();
+    execute_next_cmd();
+    ASSERT_EQ(eps_hk_data_col.state, DATA_COL_STATE_IDLE);
+    ASSERT_EQ(pay_hk_data_col.state, DATA_COL_STATE_IDLE);
+
+    flush_cmd_log();
+    mem_header_t header;
+    read_mem_header(&prim_cmd_log_mem_section, eps_hk_data_col.cmd_log_block_num, &header);
+    ASSERT_EQ(header.status, CMD_RESP_STATUS_OK);
+    read_mem_header(&prim_cmd_log_mem_section, pay_hk_data_col.cmd_log_block_num, &header);
+    ASSERT_EQ(header.status, CMD_RESP_STATUS_OK);
+}
+
+
+// Test that every command is found from its opcode and that arguments outside
+// of a command's limits are rejected before its function runs
+void cmd_registry_test(void) {
+    init_cmd_queue();
+
+    for (uint8_t i = 0; i < all_cmds_list_len; i++) {
+        cmd_t* cmd = cmd_index_to_cmd(i);
+        ASSERT_TRUE(cmd_opcode_to_cmd(cmd_opcode(cmd)) == cmd);
+        ASSERT_EQ(cmd_to_cmd_index(cmd), i);
+    }
+    ASSERT_TRUE(cmd_opcode_to_cmd(0x0B) == &nop_cmd);
+    ASSERT_TRUE(cmd_opcode_to_cmd(0xFF) == &nop_cmd);
+    ASSERT_EQ(cmd_to_cmd_index(&nop_cmd), all_cmds_list_len);
+
+    ASSERT_TRUE(cmd_args_valid(&read_raw_mem_bytes_cmd, 0x200, CMD_READ_MEM_MAX_COUNT));
+    ASSERT_FALSE(cmd_args_valid(&read_raw_mem_bytes_cmd, 0x200, CMD_READ_MEM_MAX_COUNT + 1));
+    ASSERT_FALSE(cmd_args_valid(&read_raw_mem_bytes_cmd, MEM_NUM_ADDRESSES, 1));
+    ASSERT_TRUE(cmd_args_valid(&read_raw_mem_bytes_cmd, MEM_NUM_ADDRESSES - 2, 2));
+    ASSERT_FALSE(cmd_args_valid(&read_raw_mem_bytes_cmd, MEM_NUM_ADDRESSES - 2, 3));
+    ASSERT_TRUE(cmd_args_valid(&read_raw_mem_bytes_cmd, 0x200,
+        CMD_READ_COMPRESSED | (CMD_READ_MEM_MAX_COUNT + 1)));
+    ASSERT_FALSE(cmd_args_valid(&read_raw_mem_bytes_cmd, MEM_NUM_ADDRESSES - 2,
+        CMD_READ_COMPRESSED | 3));
+    ASSERT_FALSE(cmd_args_valid(&read_prim_cmd_blocks_cmd, 0,
+        CMD_READ_CMD_BLOCKS_MAX_COUNT + 1));
+    ASSERT_TRUE(cmd_args_valid(&read_prim_cmd_blocks_cmd, 0,
+        CMD_READ_COMPRESSED | (CMD_READ_CMD_BLOCKS_MAX_COUNT + 1)));
+    ASSERT_TRUE(cmd_args_valid(&set_mem_sec_start_addr_cmd, CMD_SEC_CMD_LOG, 0));
+    ASSERT_FALSE(cmd_args_valid(&set_mem_sec_start_addr_cmd, 5, 0));
+    ASSERT_FALSE(cmd_args_valid(&set_mem_sec_start_addr_cmd, 0x100, 0));
+    ASSERT_FALSE(cmd_args_valid(&set_auto_data_col_period_cmd, CMD_EPS_HK,
+        CMD_AUTO_DATA_COL_MIN_PERIOD - 1));
+    ASSERT_TRUE(cmd_args_valid(&ping_obc_cmd, 0xFFFFFFFF, 0xFFFFFFFF));
+
+    // The period is not changed by an invalid command
+    uint32_t period = eps_hk_data_col.auto_period;
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0x50, &set_auto_data_col_period_cmd, CMD_EPS_HK, 1);
+    execute_next_cmd();
+    ASSERT_TRUE(current_cmd == &nop_cmd);
+    ASSERT_TRUE(trans_tx_dec_avail);
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_INVALID_ARGS);
+    ASSERT_EQ(eps_hk_data_col.auto_period, period);
+
+    // Auto-enqueued commands are rejected without a response
+    trans_tx_dec_avail = false;
+    enqueue_cmd(CMD_CMD_ID_AUTO_ENQUEUED, &col_data_block_cmd, 0, 0);
+    execute_next_cmd();
+    ASSERT_TRUE(current_cmd == &nop_cmd);
+    ASSERT_FALSE(trans_tx_dec_avail);
 }
 
 
+// Test that command log records are kept in RAM with their status until they
+// are written to flash together
+void cmd_log_buf_test(void) {
+    init_cmd_queue();
+    flush_cmd_log();
+
+    uint32_t block_num = prim_cmd_log_mem_section.curr_block;
+    enqueue_cmd(0x60, &ping_obc_cmd, 0, 0);
+    enqueue_cmd(0x61, &ping_obc_cmd, 0, 0);
+    enqueue_cmd(0x62, &ping_obc_cmd, 0, 0);
+    execute_next_cmd();
+    execute_next_cmd();
+    ASSERT_EQ(cmd_log_buf.count, 2);
+    ASSERT_EQ(prim_cmd_log_mem_section.curr_block, block_num + 2);
+
+    // Not flushed while there are commands waiting
+    run_cmd_log();
+    ASSERT_EQ(cmd_log_buf.count, 2);
+    ASSERT_TRUE(is_mem_block_erased(&prim_cmd_log_mem_section, block_num));
+
+    // Flushed when idle
+    execute_next_cmd();
+    run_cmd_log();
+    ASSERT_EQ(cmd_log_buf.count, 0);
+    for (uint8_t i = 0; i < 3; i++) {
+        mem_header_t header;
+        uint16_t cmd_id = 0;
+        uint8_t opcode = 0;
+        uint32_t arg1 = 0;
+        uint32_t arg2 = 0;
+        read_mem_cmd_block(&prim_cmd_log_mem_section, block_num + i, &header,
+            &cmd_id, &opcode, &arg1, &arg2);
+        ASSERT_EQ(header.block_num, block_num + i);
+        ASSERT_EQ(header.status, CMD_RESP_STATUS_OK);
+        ASSERT_EQ(cmd_id, 0x60 + i);
+        ASSERT_EQ(opcode, CMD_PING_OBC);
+    }
+
+    // A full buffer is flushed before adding another record
+    block_num = prim_cmd_log_mem_section.curr_block;
+    for (uint8_t i = 0; i < CMD_LOG_BUF_SIZE + 1; i++) {
+        enqueue_cmd(0x70 + i, &ping_obc_cmd, 0, 0);
+        execute_next_cmd();
+    }
+    ASSERT_EQ(cmd_log_buf.count, 1);
+    ASSERT_FALSE(is_mem_block_erased(&prim_cmd_log_mem_section,
+        block_num + CMD_LOG_BUF_SIZE - 1));
+    ASSERT_TRUE(is_mem_block_erased(&prim_cmd_log_mem_section,
+        block_num + CMD_LOG_BUF_SIZE));
+
+    // Reading the command log includes the buffered records
+    enqueue_cmd(0x80, &read_prim_cmd_blocks_cmd, block_num + CMD_LOG_BUF_SIZE, 1);
+    execute_next_cmd();
+    ASSERT_TRUE(trans_tx_dec_avail);
+    ASSERT_EQ(trans_tx_dec_len, 3 + MEM_CMD_LOG_BYTES_PER_BLOCK);
+    ASSERT_EQ(trans_tx_dec_msg[3 + 9], CMD_RESP_STATUS_OK);
+    ASSERT_EQ(trans_tx_dec_msg[3 + 10], 0x00);
+    ASSERT_EQ(trans_tx_dec_msg[3 + 11], 0x70 + CMD_LOG_BUF_SIZE);
+}
+
+
+/**
+ * Test the profiler table response (see profiler.c)
+ */
+void prof_stats_test(void) {
+#ifdef PROFILER
+    reset_prof();
+    uint32_t start = prof_ticks();
+    prof_add_stage(PROF_STAGE_CMD_LOG, start);
+    prof_add_stage(PROF_STAGE_CMD_LOG, start);
+
+    enqueue_cmd(0x90, &read_prof_stats_cmd, 0, 0);
+    execute_next_cmd();
+    ASSERT_TRUE(trans_tx_dec_avail);
+    ASSERT_EQ(trans_tx_dec_len, 3 + 5 + (PROF_NUM_STAGES * 12));
+    ASSERT_EQ(trans_tx_dec_msg[3], (prof_ticks_per_s() >> 8) & 0xFF);
+    ASSERT_EQ(trans_tx_dec_msg[4], prof_ticks_per_s() & 0xFF);
+    ASSERT_EQ(trans_tx_dec_msg[7], PROF_NUM_STAGES);
+    // Count of the CMD_LOG stage
+    ASSERT_EQ(trans_tx_dec_msg[8 + (PROF_STAGE_CMD_LOG * 12) + 3], 2);
+
+    // Reading the table resets it
+    ASSERT_EQ(prof_stages[PROF_STAGE_CMD_LOG].count, 0);
+    ASSERT_EQ(prof_stages[PROF_STAGE_CMD].count, 0);
+#else
+    enqueue_cmd(0x90, &read_prof_stats_cmd, 0, 0);
+    execute_next_cmd();
+    ASSERT_TRUE(trans_tx_dec_avail);
+    ASSERT_EQ(trans_tx_dec_len, 3 + 5);
+    // No stages
+    ASSERT_EQ(trans_tx_dec_msg[7], 0);
+#endif
+}
+
+/**
+ * Test the command latency histograms
+ */
+void cmd_lats_test(void) {
+#ifdef CMD_LATS
+    ASSERT_EQ(cmd_lat_bucket(0), 0);
+    ASSERT_EQ(cmd_lat_bucket(7), 0);
+    ASSERT_EQ(cmd_lat_bucket(8), 1);
+    ASSERT_EQ(cmd_lat_bucket(63), 1);
+    ASSERT_EQ(cmd_lat_bucket(64), 2);
+    ASSERT_EQ(cmd_lat_bucket(32767), 4);
+    ASSERT_EQ(cmd_lat_bucket(32768), CMD_LAT_NUM_BUCKETS - 1);
+    ASSERT_EQ(cmd_lat_bucket(0xFFFFFFFF), CMD_LAT_NUM_BUCKETS - 1);
+
+    // A full bucket halves the histogram
+    uint8_t hist[CMD_LAT_NUM_BUCKETS] = { 0xFF, 0x10, 0, 0, 0, 0x03 };
+    add_cmd_lat(hist, prof_ticks());
+    ASSERT_EQ(hist[0], 0x80);
+    ASSERT_EQ(hist[1], 0x08);
+    ASSERT_EQ(hist[5], 0x01);
+
+    // Each run of a command is counted once in each of its histograms
+    uint8_t ping_index = cmd_to_cmd_index(&ping_obc_cmd);
+    uint16_t queue_total = 0;
+    uint16_t run_total = 0;
+    for (uint8_t i = 0; i < CMD_LAT_NUM_BUCKETS; i++) {
+        cmd_lats[ping_index].queue[i] = 0;
+        cmd_lats[ping_index].run[i] = 0;
+    }
+    enqueue_cmd(0xA0, &ping_obc_cmd, 0, 0);
+    enqueue_cmd(0xA1, &ping_obc_cmd, 0, 0);
+    execute_next_cmd();
+    execute_next_cmd();
+    for (uint8_t i = 0; i < CMD_LAT_NUM_BUCKETS; i++) {
+        queue_total += cmd_lats[ping_index].queue[i];
+        run_total += cmd_lats[ping_index].run[i];
+    }
+    ASSERT_EQ(queue_total, 2);
+    ASSERT_EQ(run_total, 2);
+
+    // Read out the histograms starting at ping_obc_cmd
+    enqueue_cmd(0xA2, &read_cmd_lats_cmd, ping_index, 0);
+    execute_next_cmd();
+    ASSERT_TRUE(trans_tx_dec_avail);
+    uint8_t count = all_cmds_list_len - ping_index;
+    if (count > CMD_READ_CMD_LATS_MAX_COUNT) {
+        count = CMD_READ_CMD_LATS_MAX_COUNT;
+    }
+    ASSERT_EQ(trans_tx_dec_len, 3 + 2 + (count * (1 + (2 * CMD_LAT_NUM_BUCKETS))));
+    ASSERT_EQ(trans_tx_dec_msg[3], all_cmds_list_len);
+    ASSERT_EQ(trans_tx_dec_msg[4], count);
+    ASSERT_EQ(trans_tx_dec_msg[5], CMD_PING_OBC);
+    ASSERT_BYTES_EQ(&trans_tx_dec_msg[6], cmd_lats[ping_index].queue,
+        CMD_LAT_NUM_BUCKETS);
+    ASSERT_BYTES_EQ(&trans_tx_dec_msg[6 + CMD_LAT_NUM_BUCKETS],
+        cmd_lats[ping_index].run, CMD_LAT_NUM_BUCKETS);
+
+    // Past the end of the list
+    enqueue_cmd(0xA3, &read_cmd_lats_cmd, all_cmds_list_len, 0);
+    execute_next_cmd();
+    ASSERT_EQ(trans_tx_dec_len, 3 + 2);
+    ASSERT_EQ(trans_tx_dec_msg[4], 0);
+
+    // Saved histograms are loaded after a reset
+    save_cmd_lats();
+    cmd_lat_t saved = cmd_lats[ping_index];
+    for (uint8_t i = 0; i < CMD_LAT_NUM_BUCKETS; i++) {
+        cmd_lats[ping_index].run[i] = 0;
+    }
+    init_cmd_lats();
+    ASSERT_BYTES_EQ(cmd_lats[ping_index].run, saved.run, CMD_LAT_NUM_BUCKETS);
+#else
+    enqueue_cmd(0xA2, &read_cmd_lats_cmd, 0, 0);
+    execute_next_cmd();
+    ASSERT_TRUE(trans_tx_dec_avail);
+    ASSERT_EQ(trans_tx_dec_len, 3 + 2);
+    ASSERT_EQ(trans_tx_dec_msg[3], all_cmds_list_len);
+    // No commands
+    ASSERT_EQ(trans_tx_dec_msg[4], 0);
+#endif
+}
+
+// Test that a bulk read streams the frames of the window back to back and
+// only sends the frames that are missing from the selective ACK again
+void bulk_read_test(void) {
+    init_cmd_queue();
+    trans_tx_dec_avail = false;
+
+    uint32_t start_addr = 0x200;
+    uint32_t num_bytes = (3 * CMD_BULK_READ_FRAME_SIZE) + 10;
+    enqueue_cmd(0xB0, &start_bulk_read_cmd, start_addr, num_bytes);
+    execute_next_cmd();
+    ASSERT_TRUE(trans_tx_dec_avail);
+    ASSERT_EQ(trans_tx_dec_len, 3 + 3);
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_OK);
+    ASSERT_EQ((trans_tx_dec_msg[3] << 8) | trans_tx_dec_msg[4], 4);
+    ASSERT_EQ(trans_tx_dec_msg[5], CMD_BULK_READ_FRAME_SIZE);
+    ASSERT_EQ(cmd_queue_size(), 1);
+    ASSERT_CMD_QUEUE_ENTRY(0, 0xB0, &start_bulk_read_cmd,
+        CMD_BULK_READ_CONT, 0);
+
+    // Waits for the previous frame to be encoded
+    execute_next_cmd();
+    ASSERT_EQ(cmd_queue_size(), 1);
+
+    uint8_t data[CMD_BULK_READ_FRAME_SIZE];
+    for (uint8_t seq = 0; seq < 4; seq++) {
+        trans_tx_dec_avail = false;
+        execute_next_cmd();
+        ASSERT_TRUE(trans_tx_dec_avail);
+        ASSERT_EQ(trans_tx_dec_msg[0], 0x80);
+        ASSERT_EQ(trans_tx_dec_msg[1], 0xB0);
+        ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_BULK_FRAME);
+        ASSERT_EQ((trans_tx_dec_msg[3] << 8) | trans_tx_dec_msg[4], seq);
+
+        uint8_t len = (seq < 3) ? CMD_BULK_READ_FRAME_SIZE : 10;
+        ASSERT_EQ(trans_tx_dec_len, 5 + len);
+        read_mem_bytes(start_addr + (seq * CMD_BULK_READ_FRAME_SIZE), data, len);
+        ASSERT_BYTES_EQ(&trans_tx_dec_msg[5], data, len);
+    }
+    // All frames sent, waiting for the ACK
+    ASSERT_EQ(cmd_queue_size(), 0);
+
+    // Frame 2 was lost
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0xB1, &ack_bulk_read_cmd, 0, 0x0B);
+    execute_next_cmd();
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_OK);
+    ASSERT_EQ((trans_tx_dec_msg[3] << 8) | trans_tx_dec_msg[4], 2);
+    ASSERT_EQ(cmd_queue_size(), 1);
+
+    trans_tx_dec_avail = false;
+    execute_next_cmd();
+    ASSERT_TRUE(trans_tx_dec_avail);
+    ASSERT_EQ((trans_tx_dec_msg[3] << 8) | trans_tx_dec_msg[4], 2);
+    ASSERT_EQ(cmd_queue_size(), 0);
+
+    // Done
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0xB2, &ack_bulk_read_cmd, 2, 0x01);
+    execute_next_cmd();
+    ASSERT_EQ((trans_tx_dec_msg[3] << 8) | trans_tx_dec_msg[4], 4);
+    ASSERT_FALSE(bulk_read.active);
+    ASSERT_EQ(cmd_queue_size(), 0);
+
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0xB3, &ack_bulk_read_cmd, 0, 0x0F);
+    execute_next_cmd();
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_INVALID_ARGS);
+
+    // Past the last address
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0xB4, &start_bulk_read_cmd, MEM_NUM_ADDRESSES - 2, 3);
+    execute_next_cmd();
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_INVALID_ARGS);
+    ASSERT_FALSE(bulk_read.active);
+}
+
+// Test that the software clock counts uptime seconds across minute, day, month
+// and year boundaries
+void rtc_clock_test(void) {
+    rtc_date_t date = { .dd = 28, .mm = 2, .yy = 24 };
+    rtc_time_t time = { .ss = 58, .mm = 59, .hh = 23 };
+    set_rtc_clock(date, time);
+
+    uptime_s += 3;
+    get_rtc_clock(&date, &time);
+    ASSERT_EQ(date.dd, 29);
+    ASSERT_EQ(date.mm, 2);
+    ASSERT_EQ(time.hh, 0);
+    ASSERT_EQ(time.mm, 0);
+    ASSERT_EQ(time.ss, 1);
+
+    // Not a leap year
+    date.dd = 28;
+    date.yy = 23;
+    time.ss = 59;
+    time.mm = 59;
+    time.hh = 23;
+    set_rtc_clock(date, time);
+    uptime_s += 1;
+    get_rtc_clock(&date, &time);
+    ASSERT_EQ(date.dd, 1);
+    ASSERT_EQ(date.mm, 3);
+
+    // A few days without a sync
+    date.dd = 30;
+    date.mm = 12;
+    date.yy = 21;
+    time.ss = 0;
+    time.mm = 30;
+    time.hh = 12;
+    set_rtc_clock(date, time);
+    uptime_s += (3 * 86400UL) + 3600 + 61;
+    get_rtc_clock(&date, &time);
+    ASSERT_EQ(date.yy, 22);
+    ASSERT_EQ(date.mm, 1);
+    ASSERT_EQ(date.dd, 2);
+    ASSERT_EQ(time.hh, 13);
+    ASSERT_EQ(time.mm, 31);
+    ASSERT_EQ(time.ss, 1);
+
+    // Headers use the software clock
+    mem_header_t header;
+    populate_header(&header, 5, CMD_RESP_STATUS_OK);
+    ASSERT_EQ(header.date.dd, 2);
+    ASSERT_EQ(header.time.mm, 31);
+
+    ASSERT_EQ(rtc_days_in_month(4, 21), 30);
+    ASSERT_EQ(rtc_days_in_month(2, 0), 29);
+}
+
+// Test that the antenna deployment progress can be read (without deploying)
+void ant_dep_status_test(void) {
+    init_cmd_queue();
+    ant_dep.state = ANT_DEP_STATE_ALG2;
+    ant_dep.state_s = 12;
+    ant_dep.timeout_s = 2 * ANT_DEP_ALG2_DOOR_TIMEOUT_S;
+    ant_dep.read_ok = true;
+    ant_dep.i2c_status = I2C_SUCCESS;
+    ant_dep.data[0] = 0x51;
+    ant_dep.data[1] = 0x0A;
+    ant_dep.data[2] = 0x03;
+
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0xC8, &get_ant_dep_status_cmd, 0, 0);
+    execute_next_cmd();
+    ASSERT_TRUE(trans_tx_dec_avail);
+    ASSERT_EQ(trans_tx_dec_len, 3 + 8);
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_OK);
+    ASSERT_EQ(trans_tx_dec_msg[3], ANT_DEP_STATE_ALG2);
+    ASSERT_EQ(trans_tx_dec_msg[4], 12);
+    ASSERT_EQ(trans_tx_dec_msg[5], 70);
+    ASSERT_EQ(trans_tx_dec_msg[6], 1);
+    ASSERT_EQ(trans_tx_dec_msg[7], I2C_SUCCESS);
+    ASSERT_EQ(trans_tx_dec_msg[8], 0x51);
+    ASSERT_EQ(trans_tx_dec_msg[10], 0x03);
+
+    // Not started, so this does nothing
+    ant_dep.state = ANT_DEP_STATE_IDLE;
+    uptime_s++;
+    run_ant_dep();
+    ASSERT_EQ(ant_dep.state, ANT_DEP_STATE_IDLE);
+}
+
+// Test that received CAN messages are routed to the ring for their opcode, and
+// that a generic response is not held up by another subsystem's responses
+void can_rx_rings_test(void) {
+    init_cmd_queue();
+    init_queue(&pay_tx_msg_queue);
+    init_can_rx_rings();
+
+    uint8_t msg[8] = {CAN_PAY_OPT, 3, 0, 0, 0, 0, 0, 0x42};
+    cmd_rx_callback(msg, 8);
+    msg[0] = CAN_EPS_CTRL;
+    cmd_rx_callback(msg, 8);
+    ASSERT_TRUE(can_rx_ring_empty(&eps_hk_rx_ring));
+    ASSERT_TRUE(can_rx_ring_empty(&pay_hk_rx_ring));
+    ASSERT_FALSE(can_rx_ring_empty(&pay_opt_rx_ring));
+    ASSERT_FALSE(can_rx_ring_empty(&gen_rx_ring));
+
+    uint8_t out[8] = {0x00};
+    ASSERT_TRUE(dequeue_can_rx_ring(&gen_rx_ring, out));
+    ASSERT_EQ(out[0], CAN_EPS_CTRL);
+    ASSERT_FALSE(dequeue_can_rx_ring(&gen_rx_ring, out));
+    ASSERT_TRUE(dequeue_can_rx_ring(&pay_opt_rx_ring, out));
+    ASSERT_EQ(out[0], CAN_PAY_OPT);
+    ASSERT_EQ(out[7], 0x42);
+
+    // A full ring drops new frames, the indices wrap around
+    for (uint16_t i = 0; i < 300; i++) {
+        out[1] = i;
+        ASSERT_TRUE(enqueue_can_rx_ring(&eps_hk_rx_ring, out));
+        ASSERT_TRUE(dequeue_can_rx_ring(&eps_hk_rx_ring, msg));
+        ASSERT_EQ(msg[1], i & 0xFF);
+    }
+    for (uint8_t i = 0; i < CAN_RX_RING_SIZE; i++) {
+        ASSERT_TRUE(enqueue_can_rx_ring(&eps_hk_rx_ring, out));
+    }
+    ASSERT_FALSE(enqueue_can_rx_ring(&eps_hk_rx_ring, out));
+    // No collection or command is waiting for them, so they are dropped
+    process_next_rx_msg();
+    ASSERT_TRUE(can_rx_ring_empty(&eps_hk_rx_ring));
+
+    // The response to a send CAN message command only goes to the command,
+    // not to a collection
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0xC0, &send_pay_can_msg_cmd, 0, 0);
+    execute_next_cmd();
+    ASSERT_TRUE(current_cmd == &send_pay_can_msg_cmd);
+    uint8_t resp[8] = {CAN_PAY_CTRL, 1, CAN_STATUS_OK, 0, 0, 0, 0, 0x55};
+    cmd_rx_callback(resp, 8);
+    process_next_rx_msg();
+    ASSERT_TRUE(current_cmd == &nop_cmd);
+    ASSERT_TRUE(trans_tx_dec_avail);
+    ASSERT_EQ(trans_tx_dec_msg[2], CAN_STATUS_OK);
+    ASSERT_EQ(trans_tx_dec_msg[3], CAN_PAY_CTRL);
+    ASSERT_EQ(trans_tx_dec_msg[10], 0x55);
+    ASSERT_TRUE(can_rx_ring_empty(&gen_rx_ring));
+    ASSERT_EQ(pay_hk_data_col.state, DATA_COL_STATE_IDLE);
+}
+
+void sync_data_blocks_test(void) {
+    init_cmd_queue();
+
+    mem_section_t* section = &obc_hk_mem_section;
+    bool block_crc = section->block_crc;
+
+    // Not valid without block CRCs
+    section->block_crc = false;
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0x70, &sync_data_blocks_cmd,
+        ((uint32_t) CMD_OBC_HK << CMD_SYNC_DATA_BLOCKS_TYPE_SHIFT) | 2000, 0);
+    execute_next_cmd();
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_INVALID_ARGS);
+
+    // Commit OBC_HK blocks 2000 to 2005, block 2006 is written but not
+    // committed
+    section->block_crc = true;
+    uint16_t block_size = mem_block_size(section);
+    uint32_t start_block = 2000;
+    erase_mem_sector(mem_block_addr(section, start_block));
+    erase_mem_sector(mem_block_end_addr(section,
+        start_block + CMD_SYNC_DATA_BLOCKS_COUNT - 1));
+    for (uint8_t i = 0; i < 7; i++) {
+        mem_header_t header;
+        populate_header(&header, start_block + i, CMD_RESP_STATUS_OK);
+        uint8_t fields[CAN_OBC_HK_FIELD_COUNT * MEM_BYTES_PER_FIELD] = { 0 };
+        set_packed_field(fields, 0, i + 1);
+        ASSERT_EQ(write_mem_data_block_fields(section, start_block + i,
+            &header, fields, true, 0, CAN_OBC_HK_FIELD_COUNT), 1);
+        if (i < 6) {
+            write_mem_block_crc(section, start_block + i);
+        }
+    }
+
+    // Ground has blocks 2000 to 2003 with the same CRCs
+    uint16_t have = 0x000F;
+    uint16_t digest = MEM_CRC_INIT;
+    for (uint8_t i = 0; i < 4; i++) {
+        uint16_t crc = read_mem_block_crc(section, start_block + i);
+        digest = mem_crc16_update(digest, (crc >> 8) & 0xFF);
+        digest = mem_crc16_update(digest, crc & 0xFF);
+    }
+    uint32_t arg1 = ((uint32_t) CMD_OBC_HK << CMD_SYNC_DATA_BLOCKS_TYPE_SHIFT) |
+        start_block;
+
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0x71, &sync_data_blocks_cmd, arg1,
+        ((uint32_t) have << CMD_SYNC_DATA_BLOCKS_HAVE_SHIFT) | digest);
+    execute_next_cmd();
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_OK);
+    ASSERT_EQ(trans_tx_dec_len, 3 + 2 + (2 * block_size));
+    ASSERT_EQ(trans_tx_dec_msg[3], 0x00);
+    ASSERT_EQ(trans_tx_dec_msg[4], 0x30);
+    ASSERT_EQ(resp_field(5), start_block + 4);
+    ASSERT_EQ(resp_field(5 + block_size), start_block + 5);
+    ASSERT_EQ(cmd_queue_size(), 0);
+
+    // A different digest sends all committed blocks, 4 fit in the first
+    // response and the rest are sent by the continuation
+    uint8_t per_resp = (TRANS_TX_DEC_MSG_MAX_SIZE - 5) / block_size;
+    ASSERT_EQ(per_resp, 4);
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0x72, &sync_data_blocks_cmd, arg1,
+        ((uint32_t) have << CMD_SYNC_DATA_BLOCKS_HAVE_SHIFT) | (digest ^ 1));
+    execute_next_cmd();
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_OK);
+    ASSERT_EQ(trans_tx_dec_len, 3 + 2 + (4 * block_size));
+    ASSERT_EQ(trans_tx_dec_msg[4], 0x3F);
+    ASSERT_EQ(resp_field(5), start_block);
+    ASSERT_EQ(cmd_queue_size(), 1);
+
+    // Waits until the response is sent
+    execute_next_cmd();
+    ASSERT_EQ(cmd_queue_size(), 1);
+    ASSERT_EQ(trans_tx_dec_msg[4], 0x3F);
+
+    trans_tx_dec_avail = false;
+    execute_next_cmd();
+    ASSERT_EQ(trans_tx_dec_len, 3 + 2 + (2 * block_size));
+    ASSERT_EQ(trans_tx_dec_msg[4], 0x30);
+    ASSERT_EQ(resp_field(5), start_block + 4);
+    // The CRC is sent after the fields
+    uint16_t crc = read_mem_block_crc(section, start_block + 4);
+    ASSERT_EQ(trans_tx_dec_msg[5 + block_size - 2], (crc >> 8) & 0xFF);
+    ASSERT_EQ(trans_tx_dec_msg[5 + block_size - 1], crc & 0xFF);
+    ASSERT_EQ(cmd_queue_size(), 0);
+
+    section->block_crc = block_crc;
+}
+
+void compressed_read_test(void) {
+    init_cmd_queue();
+
+    // Raw memory - 0x12, 3 x 0x00, 0x34, then erased
+    uint32_t address = mem_block_addr(&pay_hk_mem_section, 3000);
+    erase_mem_sector(address);
+    erase_mem_sector(address + 255);
+    uint8_t data[5] = { 0x12, 0x00, 0x00, 0x00, 0x34 };
+    write_mem_bytes(address, data, 5);
+
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0x90, &read_raw_mem_bytes_cmd, address,
+        CMD_READ_COMPRESSED | 256);
+    execute_next_cmd();
+    ASSERT_TRUE(trans_tx_dec_avail);
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_OK_COMPRESSED);
+    uint8_t exp_rle[] = { 0x01, 0x00,
+        CMD_RLE_LITERAL + 0, 0x12, CMD_RLE_ZERO_RUN | 2,
+        CMD_RLE_LITERAL + 0, 0x34, CMD_RLE_ERASED_RUN | 63,
+        CMD_RLE_ERASED_RUN | 63, CMD_RLE_ERASED_RUN | 63,
+        CMD_RLE_ERASED_RUN | 58 };
+    ASSERT_EQ(trans_tx_dec_len, 3 + sizeof(exp_rle));
+    ASSERT_BYTES_EQ(&trans_tx_dec_msg[3], exp_rle, sizeof(exp_rle));
+
+    // Not smaller, so sent as usual
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0x91, &read_raw_mem_bytes_cmd, address,
+        CMD_READ_COMPRESSED | 5);
+    execute_next_cmd();
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_OK);
+    ASSERT_EQ(trans_tx_dec_len, 3 + 5);
+    ASSERT_BYTES_EQ(&trans_tx_dec_msg[3], data, 5);
+
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0x92, &read_raw_mem_bytes_cmd, address,
+        CMD_READ_COMPRESSED | (CMD_READ_MEM_MAX_COMPRESSED_COUNT + 1));
+    execute_next_cmd();
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_INVALID_ARGS);
+
+    // Only the bytes that fit are encoded
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        start_trans_tx_resp(CMD_RESP_STATUS_OK_COMPRESSED);
+        rle_resp_t rle;
+        start_rle_resp(&rle);
+        uint8_t i = 0;
+        while (append_rle_resp(&rle, (i % 2) ? 0x55 : 0xAA)) {
+            i++;
+        }
+        finish_rle_resp(&rle);
+        ASSERT_EQ(rle.count, TRANS_TX_DEC_MSG_MAX_SIZE - 5 - 1);
+        ASSERT_EQ(trans_tx_dec_len, TRANS_TX_DEC_MSG_MAX_SIZE);
+        ASSERT_EQ(trans_tx_dec_msg[5], CMD_RLE_LITERAL + rle.count - 1);
+    }
+
+    // Command log - blocks 500 to 502 are the same auto-enqueued command a
+    // second apart, then erased blocks
+    mem_section_t* section = &sec_cmd_log_mem_section;
+    uint32_t start_block = 500;
+    erase_mem_sector(mem_block_addr(section, start_block));
+    erase_mem_sector(mem_block_end_addr(section,
+        start_block + CMD_READ_CMD_BLOCKS_MAX_COMPRESSED_COUNT - 1));
+    for (uint8_t i = 0; i < 3; i++) {
+        mem_header_t header = {
+            .block_num = start_block + i,
+            .date = { .yy = 0x21, .mm = 0x04, .dd = 0x01 },
+            .time = { .hh = 0x12, .mm = 0x00, .ss = i },
+            .status = CMD_RESP_STATUS_OK
+        };
+        write_mem_cmd_block(section, start_block + i, &header,
+            CMD_CMD_ID_AUTO_ENQUEUED, CMD_COL_DATA_BLOCK, CMD_OBC_HK, 0);
+        write_mem_header_status(section, start_block + i, CMD_RESP_STATUS_OK);
+    }
+
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0x93, &read_sec_cmd_blocks_cmd, start_block,
+        CMD_READ_COMPRESSED | 4);
+    execute_next_cmd();
+    ASSERT_TRUE(trans_tx_dec_avail);
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_OK_COMPRESSED);
+    ASSERT_EQ(trans_tx_dec_msg[3], 4);
+    // Block number, status, cmd ID and arg2 are the same as the block before
+    // the first one
+    ASSERT_EQ(trans_tx_dec_msg[4], (1 << CMD_CMD_LOG_REF_BLOCK_NUM) |
+        (1 << CMD_CMD_LOG_REF_STATUS) | (1 << CMD_CMD_LOG_REF_CMD_ID) |
+        (1 << CMD_CMD_LOG_REF_ARG2));
+    uint8_t exp_first[] = { 0x21, 0x04, 0x01, 0x12, 0x00, 0x00,
+        CMD_COL_DATA_BLOCK, 0x00, 0x00, 0x00, CMD_OBC_HK };
+    ASSERT_BYTES_EQ(&trans_tx_dec_msg[5], exp_first, sizeof(exp_first));
+    // Only the time changes
+    ASSERT_EQ(trans_tx_dec_msg[16], 0xFF & ~(1 << CMD_CMD_LOG_REF_TIME));
+    ASSERT_EQ(trans_tx_dec_msg[19], 0x01);
+    ASSERT_EQ(trans_tx_dec_msg[20], 0xFF & ~(1 << CMD_CMD_LOG_REF_TIME));
+    ASSERT_EQ(trans_tx_dec_msg[23], 0x02);
+    // Erased
+    ASSERT_EQ(trans_tx_dec_msg[24], 0x00);
+    ASSERT_EQ(trans_tx_dec_len, 25 + MEM_CMD_LOG_BYTES_PER_BLOCK);
+
+    // Only the blocks that fit - after the first erased block, only the
+    // block number changes
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0x94, &read_sec_cmd_blocks_cmd, start_block,
+        CMD_READ_COMPRESSED | CMD_READ_CMD_BLOCKS_MAX_COMPRESSED_COUNT);
+    execute_next_cmd();
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_OK_COMPRESSED);
+    ASSERT_EQ(trans_tx_dec_msg[3], 4 + 20);
+    ASSERT_EQ(trans_tx_dec_len, 25 + MEM_CMD_LOG_BYTES_PER_BLOCK + (20 * 4));
+    ASSERT_EQ(trans_tx_dec_msg[trans_tx_dec_len - 4],
+        0xFF & ~(1 << CMD_CMD_LOG_REF_BLOCK_NUM));
+
+    trans_tx_dec_avail = false;
+    enqueue_cmd(0x95, &read_sec_cmd_blocks_cmd, start_block,
+        CMD_READ_COMPRESSED | (CMD_READ_CMD_BLOCKS_MAX_COMPRESSED_COUNT + 1));
+    execute_next_cmd();
+    ASSERT_EQ(trans_tx_dec_msg[2], CMD_RESP_STATUS_INVALID_ARGS);
+}
 
 test_t t1 = { .name = "basic commands test", .fn = basic_commands_test };
 test_t t2 = { .name = "data collection test", .fn = data_collection_test };
 test_t t3 = { .name = "memory commands test", .fn = mem_commands_test };
 test_t t4 = { .name = "auto erase mem sector test", .fn = auto_erase_mem_sector_test };
+test_t t5 = { .name = "read data block range test", .fn = read_data_block_range_test };
+test_t t6 = { .name = "col data block state test", .fn = col_data_block_state_test };
+test_t t7 = { .name = "concurrent data col test", .fn = concurrent_data_col_test };
+test_t t8 = { .name = "cmd registry test", .fn = cmd_registry_test };
+test_t t9 = { .name = "cmd log buf test", .fn = cmd_log_buf_test };
+test_t t10 = { .name = "prof stats test", .fn = prof_stats_test };
+test_t t11 = { .name = "cmd lats test", .fn = cmd_lats_test };
+test_t t12 = { .name = "bulk read test", .fn = bulk_read_test };
+test_t t13 = { .name = "can rx rings test", .fn = can_rx_rings_test };
+test_t t14 = { .name = "ant dep status test", .fn = ant_dep_status_test };
+test_t t15 = { .name = "rtc clock test", .fn = rtc_clock_test };
+test_t t16 = { .name = "agg data blocks test", .fn = agg_data_blocks_test };
+test_t t17 = { .name = "find data blocks by time test", .fn = find_data_blocks_by_time_test };
+test_t t18 = { .name = "sync data blocks test", .fn = sync_data_blocks_test };
+test_t t19 = { .name = "compressed read test", .fn = compressed_read_test };
+test_t t20 = { .name = "cmd timeout test", .fn = cmd_timeout_test };
 
-test_t* suite[] = {&t1, &t2, &t3, &t4};
+test_t* suite[] = {&t1, &t2, &t3, &t4, &t5, &t6, &t7, &t8, &t9, &t10, &t11, &t12, &t13, &t14, &t15, &t16, &t17, &t18, &t19, &t20};
 
 int main( void ) {
     init_obc_phase1_core();
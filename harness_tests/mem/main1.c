@@ -234,23 +234,275 @@ void roll_over_test(void) {
 }
 
 // EEPROM test
+// Current block numbers are stored in the EEPROM journal
 void eeprom_test(void) {
     // load all section data from eeprom
     read_all_mem_sections_eeprom();
 
-    uint32_t eps_hk_block_prev = read_eeprom_or_default(eps_hk_mem_section.curr_block_eeprom_addr, 0);
-    uint32_t pay_hk_block_prev = read_eeprom_or_default(pay_hk_mem_section.curr_block_eeprom_addr, 0);
-    uint32_t pay_opt_block_prev = read_eeprom_or_default(pay_opt_mem_section.curr_block_eeprom_addr, 0);
+    uint32_t eps_hk_block_prev = eps_hk_mem_section.curr_block;
+    uint32_t pay_hk_block_prev = pay_hk_mem_section.curr_block;
+    uint32_t pay_opt_block_prev = pay_opt_mem_section.curr_block;
+    uint16_t journal_head_prev = mem_journal_head;
 
     set_mem_section_curr_block(&eps_hk_mem_section, eps_hk_mem_section.curr_block + 1);
     set_mem_section_curr_block(&pay_hk_mem_section, pay_hk_mem_section.curr_block + 1);
     set_mem_section_curr_block(&pay_opt_mem_section, pay_opt_mem_section.curr_block + 1);
 
-    ASSERT_EQ(eps_hk_block_prev + 1, read_eeprom(eps_hk_mem_section.curr_block_eeprom_addr));
-    ASSERT_EQ(pay_hk_block_prev + 1, read_eeprom(pay_hk_mem_section.curr_block_eeprom_addr));
-    ASSERT_EQ(pay_opt_block_prev + 1, read_eeprom(pay_opt_mem_section.curr_block_eeprom_addr));
+    // One record per update
+    ASSERT_EQ((journal_head_prev + 3) % MEM_JOURNAL_NUM_RECORDS, mem_journal_head);
+
+    // Clear the values in RAM and read them back
+    eps_hk_mem_section.curr_block = 0;
+    pay_hk_mem_section.curr_block = 0;
+    pay_opt_mem_section.curr_block = 0;
+    read_all_mem_sections_eeprom();
+
+    ASSERT_EQ(eps_hk_block_prev + 1, eps_hk_mem_section.curr_block);
+    ASSERT_EQ(pay_hk_block_prev + 1, pay_hk_mem_section.curr_block);
+    ASSERT_EQ(pay_opt_block_prev + 1, pay_opt_mem_section.curr_block);
+    ASSERT_EQ((journal_head_prev + 3) % MEM_JOURNAL_NUM_RECORDS, mem_journal_head);
+
+    // Wrap around the journal - the latest record should still be found
+    for (uint16_t i = 0; i < MEM_JOURNAL_NUM_RECORDS + 1; i++) {
+        set_mem_section_curr_block(&eps_hk_mem_section, i);
+    }
+    eps_hk_mem_section.curr_block = 0;
+    pay_hk_mem_section.curr_block = 0;
+    pay_opt_mem_section.curr_block = 0;
+    read_all_mem_sections_eeprom();
+    ASSERT_EQ(eps_hk_mem_section.curr_block, MEM_JOURNAL_NUM_RECORDS);
+    // PAY_HK's record was rewritten at the start of the new lap
+    ASSERT_EQ(pay_hk_mem_section.curr_block, pay_hk_block_prev + 1);
+    ASSERT_EQ(pay_opt_mem_section.curr_block, pay_opt_block_prev + 1);
+}
+
+
+// Check that a stale current block number is recovered from the headers in
+// flash
+void curr_block_recovery_test(void) {
+    erase_mem();
+
+    mem_section_t* section = &obc_hk_mem_section;
+    mem_header_t header;
+    clear_mem_header(&header);
+
+    // Nothing written - the current block number is trusted
+    set_mem_section_curr_block(section, 5);
+    recover_mem_section_curr_block(section);
+    ASSERT_EQ(section->curr_block, 5);
+
+    for (uint32_t i = 0; i < 10; i++) {
+        header.block_num = i;
+        header.status = 0x00;
+        write_mem_header_main(section, i, &header);
+        write_mem_header_status(section, i, header.status);
+    }
+    ASSERT_TRUE(is_mem_block_erased(section, 10));
+    ASSERT_FALSE(is_mem_block_erased(section, 9));
+
+    // Stale value (behind the written data)
+    set_mem_section_curr_block(section, 3);
+    recover_mem_section_curr_block(section);
+    ASSERT_EQ(section->curr_block, 10);
+
+    // Invalid value
+    set_mem_section_curr_block(section, mem_section_num_blocks(section) + 1);
+    recover_mem_section_curr_block(section);
+    ASSERT_EQ(section->curr_block, 10);
+
+    // Wrapped section - written at the end, erased gap, then old data
+    uint32_t last = mem_section_num_blocks(section) - 1;
+    header.block_num = last;
+    write_mem_header_main(section, last, &header);
+    ASSERT_EQ(find_mem_section_head(section, 0), 10);
+    ASSERT_EQ(find_mem_section_head(section, last), 10);
+
+    // Wrapped section with an erased gap of 2 blocks (reset before the
+    // sectors ahead were erased), shorter than the gallop step
+    uint32_t end_addr = section->end_addr;
+    section->end_addr = section->start_addr + (3 * MEM_BYTES_PER_SECTOR) - 1;
+    uint32_t num_blocks = mem_section_num_blocks(section);
+    uint32_t gap = MEM_BYTES_PER_SECTOR / mem_block_size(section) + 40;
+    ASSERT_TRUE(gap + 2 < num_blocks);
+    erase_mem();
+    for (uint32_t i = 0; i < num_blocks; i++) {
+        if (i == gap || i == gap + 1) {
+            continue;
+        }
+        header.block_num = i;
+        write_mem_header_main(section, i, &header);
+        write_mem_header_status(section, i, header.status);
+    }
+    // From the new data or the old data after the gap
+    ASSERT_EQ(find_mem_section_head(section, 0), gap);
+    ASSERT_EQ(find_mem_section_head(section, 5), gap);
+    ASSERT_EQ(find_mem_section_head(section, gap + 2), gap);
+    ASSERT_EQ(find_mem_section_head(section, num_blocks - 1), gap);
+    set_mem_section_curr_block(section, 5);
+    recover_mem_section_curr_block(section);
+    ASSERT_EQ(section->curr_block, gap);
+    ASSERT_TRUE(is_mem_block_erased(section, section->curr_block));
+
+    // Every block written - nothing better than the value from EEPROM
+    header.block_num = gap;
+    write_mem_header_main(section, gap, &header);
+    header.block_num = gap + 1;
+    write_mem_header_main(section, gap + 1, &header);
+    ASSERT_EQ(find_mem_section_head(section, 5), 5);
+
+    section->end_addr = end_addr;
+    erase_mem();
+    set_mem_section_curr_block(section, 0);
+}
+
+// Check that the most recently written block is cached and matches flash
+void mem_block_cache_test(void) {
+    erase_mem();
+
+    mem_section_t* section = &eps_hk_mem_section;
+    uint32_t block_num = 7;
+    ASSERT_FALSE(section->cache->valid);
+
+    uint8_t write_fields[section->fields_per_block * MEM_BYTES_PER_FIELD];
+    for (uint8_t i = 0; i < section->fields_per_block; i++) {
+        set_packed_field(write_fields, i, random() & 0xFFFFFF);
+    }
+    mem_header_t write_header;
+    write_header.block_num = block_num;
+    write_header.date = rand_rtc_date();
+    write_header.time = rand_rtc_time();
+    write_header.status = 0x00;
+    write_mem_data_block_fields(section, block_num, &write_header,
+        write_fields, true, 0, section->fields_per_block);
+
+    ASSERT_TRUE(section->cache->valid);
+    ASSERT_EQ(section->cache->block_num, block_num);
+
+    // Cache contents must match flash
+    uint8_t flash[MEM_EPS_HK_BYTES_PER_BLOCK];
+    read_mem_bytes(mem_block_addr(section, block_num), flash,
+        MEM_EPS_HK_BYTES_PER_BLOCK);
+    ASSERT_EQ_ARRAY(section->cache->bytes, flash, MEM_EPS_HK_BYTES_PER_BLOCK);
+
+    mem_header_t read_header;
+    uint8_t read_fields[section->fields_per_block * MEM_BYTES_PER_FIELD];
+    read_mem_data_block(section, block_num, &read_header, read_fields);
+    ASSERT_EQ(read_header.block_num, block_num);
+    ASSERT_EQ(read_header.status, 0x00);
+    ASSERT_EQ_ARRAY(write_fields, read_fields,
+        section->fields_per_block * MEM_BYTES_PER_FIELD);
+
+    // A new block starts as erased in the cache without reading flash (the
+    // zeros written directly to flash must not show up in the cache)
+    uint32_t new_block_num = block_num + 1;
+    uint8_t zeros[MEM_BYTES_PER_FIELD] = { 0x00 };
+    write_mem_bytes(mem_section_phy_addr(section,
+        mem_field_section_addr(section, new_block_num, 2)), zeros,
+        MEM_BYTES_PER_FIELD);
+    write_header.block_num = new_block_num;
+    write_mem_data_block_fields(section, new_block_num, &write_header,
+        write_fields, true, 0, 2);
+    ASSERT_TRUE(section->cache->valid);
+    ASSERT_EQ(section->cache->block_num, new_block_num);
+    ASSERT_EQ(section->cache->bytes[2], new_block_num & 0xFF);
+    ASSERT_EQ(read_mem_field(section, new_block_num, 2), 0xFFFFFF);
+
+    // Rewriting an older block reads it from flash
+    write_mem_header_status(section, block_num, 0x00);
+    ASSERT_EQ(section->cache->block_num, block_num);
+    ASSERT_EQ_ARRAY(section->cache->bytes, flash, MEM_EPS_HK_BYTES_PER_BLOCK);
+
+    // Erasing the sector must invalidate the cache
+    erase_mem_sector(mem_block_addr(section, block_num));
+    ASSERT_FALSE(section->cache->valid);
+    ASSERT_EQ(read_mem_field(section, block_num, 0), 0xFFFFFF);
 }
 
+// Check writing and decoding blocks in the compressed format (uses PAY_HK
+// temporarily switched to compressed)
+mem_compressed_state_t compressed_test_state;
+
+void mem_compressed_test(void) {
+    erase_mem();
+
+    mem_section_t* section = &pay_hk_mem_section;
+    mem_block_cache_t* cache = section->cache;
+    section->cache = NULL;
+    section->compressed = &compressed_test_state;
+    init_mem_compressed_section(section);
+
+    uint8_t num_fields = section->fields_per_block;
+    uint8_t fields[num_fields * MEM_BYTES_PER_FIELD];
+    for (uint8_t i = 0; i < num_fields; i++) {
+        set_packed_field(fields, i, random() & 0xFFFFFF);
+    }
+
+    mem_header_t header;
+    header.date = rand_rtc_date();
+    header.time = rand_rtc_time();
+    header.status = 0x00;
+
+    // Fill more than one sector with slowly changing fields (including
+    // negative changes)
+    uint32_t num_blocks = 600;
+    uint32_t field_0_start = get_packed_field(fields, 0);
+    for (uint32_t block = 0; block < num_blocks; block++) {
+        set_packed_field(fields, 0, field_0_start - (block * 3));
+        uint8_t field_num = 1 + (block % (num_fields - 1));
+        set_packed_field(fields, field_num,
+            get_packed_field(fields, field_num) ^ 0x01);
+
+        header.block_num = block;
+        header.time.ss = block & 0xFF;
+        ASSERT_TRUE(write_mem_data_block_fields(section, block, &header,
+            fields, true, 0, num_fields));
+    }
+
+    // Must take less space than the uncompressed blocks
+    uint32_t used = compressed_test_state.write_addr - section->start_addr;
+    ASSERT_TRUE(used > MEM_BYTES_PER_SECTOR);
+    ASSERT_TRUE(used < num_blocks * mem_block_size(section) / 2);
+
+    // The last block must match exactly
+    mem_header_t read_header;
+    uint8_t read_fields[num_fields * MEM_BYTES_PER_FIELD];
+    read_mem_data_block(section, num_blocks - 1, &read_header, read_fields);
+    ASSERT_EQ(read_header.block_num, num_blocks - 1);
+    ASSERT_EQ(read_header.status, 0x00);
+    ASSERT_EQ(read_header.time.ss, (num_blocks - 1) & 0xFF);
+    ASSERT_EQ_ARRAY(read_fields, fields, num_fields * MEM_BYTES_PER_FIELD);
+
+    // Random access to older blocks (including both sides of a sector)
+    for (uint32_t block = 0; block < num_blocks; block += 13) {
+        read_mem_header(section, block, &read_header);
+        ASSERT_EQ(read_header.block_num, block);
+        ASSERT_EQ(read_mem_field(section, block, 0),
+            (field_0_start - (block * 3)) & 0xFFFFFF);
+    }
+
+    // A block that was not written reads as erased
+    read_mem_data_block(section, num_blocks, &read_header, read_fields);
+    ASSERT_EQ(read_header.block_num, MEM_ERASED_BLOCK_NUM);
+    ASSERT_EQ(get_packed_field(read_fields, 0), 0xFFFFFF);
+
+    // After a restart, the head is found and the next block starts a new
+    // sector
+    set_mem_section_curr_block(section, 0);
+    recover_mem_section_curr_block(section);
+    ASSERT_EQ(section->curr_block, num_blocks);
+    header.block_num = num_blocks;
+    ASSERT_TRUE(write_mem_data_block_fields(section, num_blocks, &header,
+        fields, true, 0, num_fields));
+    ASSERT_EQ(read_mem_field(section, num_blocks, 1),
+        get_packed_field(fields, 1));
+    ASSERT_EQ(read_mem_field(section, num_blocks - 1, 0),
+        (field_0_start - ((num_blocks - 1) * 3)) & 0xFFFFFF);
+
+    erase_mem();
+    section->compressed = NULL;
+    section->cache = cache;
+    set_mem_section_curr_block(section, 0);
+}
 
 // Test headers for each of the mem_sections (metadata)
 void mem_header_test_individual( mem_section_t* section ) {
@@ -351,11 +603,11 @@ void mem_block_test_1(void){
         ASSERT_EQ(prev_block, block_num[i]);///////////////
     }
 
-    uint32_t read_fields_1[obc_hk_mem_section.fields_per_block];
-    uint32_t read_fields_2[eps_hk_mem_section.fields_per_block];
-    uint32_t read_fields_3[pay_hk_mem_section.fields_per_block];
-    uint32_t read_fields_4[pay_opt_mem_section.fields_per_block];
-    uint32_t* read_test_fields[4] = {read_fields_1, read_fields_2, read_fields_3, read_fields_4};
+    uint8_t read_fields_1[obc_hk_mem_section.fields_per_block * MEM_BYTES_PER_FIELD];
+    uint8_t read_fields_2[eps_hk_mem_section.fields_per_block * MEM_BYTES_PER_FIELD];
+    uint8_t read_fields_3[pay_hk_mem_section.fields_per_block * MEM_BYTES_PER_FIELD];
+    uint8_t read_fields_4[pay_opt_mem_section.fields_per_block * MEM_BYTES_PER_FIELD];
+    uint8_t* read_test_fields[4] = {read_fields_1, read_fields_2, read_fields_3, read_fields_4};
 
     mem_header_t read_header[4];
     uint32_t read_block_num[4];
@@ -382,19 +634,65 @@ void mem_block_test_1(void){
 
     //check fields
     for (uint8_t a = 0; a < obc_hk_mem_section.fields_per_block; a++){
-        ASSERT_EQ(write_fields_1[a], read_fields_1[a]);
+        ASSERT_EQ(write_fields_1[a], get_packed_field(read_fields_1, a));
     }
     for (uint8_t a = 0; a < eps_hk_mem_section.fields_per_block; a++){
-        ASSERT_EQ(write_fields_2[a], read_fields_2[a]);
+        ASSERT_EQ(write_fields_2[a], get_packed_field(read_fields_2, a));
     }
     for (uint8_t a = 0; a < pay_hk_mem_section.fields_per_block; a++){
-        ASSERT_EQ(write_fields_3[a], read_fields_3[a]);
+        ASSERT_EQ(write_fields_3[a], get_packed_field(read_fields_3, a));
     }
     for (uint8_t a = 0; a < pay_opt_mem_section.fields_per_block; a++){
-        ASSERT_EQ(write_fields_4[a], read_fields_4[a]);
+        ASSERT_EQ(write_fields_4[a], get_packed_field(read_fields_4, a));
     }
 }
 
+// Write a data block in bursts (as staged data collection does) and check it
+// matches field-by-field reads
+void mem_block_burst_test(void) {
+    erase_mem();
+
+    mem_section_t* section = &pay_opt_mem_section;
+    uint32_t block_num = 3;
+    uint8_t split = section->fields_per_block / 2;
+
+    uint8_t write_fields[section->fields_per_block * MEM_BYTES_PER_FIELD];
+    for (uint8_t i = 0; i < section->fields_per_block; i++) {
+        set_packed_field(write_fields, i, random() & 0xFFFFFF);
+    }
+
+    mem_header_t write_header;
+    write_header.block_num = block_num;
+    write_header.date = rand_rtc_date();
+    write_header.time = rand_rtc_time();
+    write_header.status = 0xFF;
+
+    // Partial flush - header (status still erased) and the first half
+    ASSERT_TRUE(write_mem_data_block_fields(section, block_num, &write_header,
+        write_fields, true, 0, split));
+    ASSERT_EQ(read_mem_field(section, block_num, split), 0xFFFFFF);
+
+    // Rest of the fields, then the status
+    ASSERT_TRUE(write_mem_data_block_fields(section, block_num, &write_header,
+        write_fields, false, split, section->fields_per_block));
+    write_mem_header_status(section, block_num, 0x00);
+
+    // The header can only be written together with field 0
+    ASSERT_FALSE(write_mem_data_block_fields(section, block_num, &write_header,
+        write_fields, true, 1, 2));
+
+    mem_header_t read_header;
+    uint8_t read_fields[section->fields_per_block * MEM_BYTES_PER_FIELD];
+    read_mem_data_block(section, block_num, &read_header, read_fields);
+
+    ASSERT_EQ(read_header.block_num, block_num);
+    ASSERT_EQ_DATE(write_header.date, read_header.date);
+    ASSERT_EQ_TIME(write_header.time, read_header.time);
+    ASSERT_EQ(read_header.status, 0x00);
+    ASSERT_EQ_ARRAY(write_fields, read_fields,
+        section->fields_per_block * MEM_BYTES_PER_FIELD);
+}
+
 //actually test blocks
 void mem_block_test_2(void){
     erase_mem();
@@ -404,27 +702,27 @@ void mem_block_test_2(void){
     uint32_t write_fields_3[pay_hk_mem_section.fields_per_block];
     uint32_t write_fields_4[pay_opt_mem_section.fields_per_block];
 
-    uint32_t read_fields_1[obc_hk_mem_section.fields_per_block];
-    uint32_t read_fields_2[eps_hk_mem_section.fields_per_block];
-    uint32_t read_fields_3[pay_hk_mem_section.fields_per_block];
-    uint32_t read_fields_4[pay_opt_mem_section.fields_per_block];
+    uint8_t read_fields_1[obc_hk_mem_section.fields_per_block * MEM_BYTES_PER_FIELD];
+    uint8_t read_fields_2[eps_hk_mem_section.fields_per_block * MEM_BYTES_PER_FIELD];
+    uint8_t read_fields_3[pay_hk_mem_section.fields_per_block * MEM_BYTES_PER_FIELD];
+    uint8_t read_fields_4[pay_opt_mem_section.fields_per_block * MEM_BYTES_PER_FIELD];
 
     //populate with random data
     for (uint8_t i=0; i<obc_hk_mem_section.fields_per_block; i++){
         write_fields_1[i] = 0x765432;
-        read_fields_1[i] = 0x234567;
+        set_packed_field(read_fields_1, i, 0x234567);
     }
     for (uint8_t i=0; i<eps_hk_mem_section.fields_per_block; i++){
         write_fields_2[i] = 0x765432;
-        read_fields_2[i] = 0x234567;
+        set_packed_field(read_fields_2, i, 0x234567);
     }
     for (uint8_t i=0; i<pay_hk_mem_section.fields_per_block; i++){
         write_fields_3[i] = 0x765432;
-        read_fields_3[i] = 0x234567;
+        set_packed_field(read_fields_3, i, 0x234567);
     }
     for (uint8_t i=0; i<pay_opt_mem_section.fields_per_block; i++){
         write_fields_4[i] = 0x765432;
-        read_fields_4[i] = 0x234567;
+        set_packed_field(read_fields_4, i, 0x234567);
     }
 
     //test obc housekeeping
@@ -453,7 +751,7 @@ void mem_block_test_2(void){
     ASSERT_EQ(write_header.status, read_header.status);
 
     for (uint8_t i=0; i<obc_hk_mem_section.fields_per_block; i++){
-        ASSERT_EQ(write_fields_1[i], read_fields_1[i]);
+        ASSERT_EQ(write_fields_1[i], get_packed_field(read_fields_1, i));
     }
 
     //test eps housekeeping
@@ -480,7 +778,7 @@ void mem_block_test_2(void){
     ASSERT_EQ(write_header.status, read_header.status);
 
     for (uint8_t i=0; i<eps_hk_mem_section.fields_per_block; i++){
-        ASSERT_EQ(write_fields_2[i], read_fields_2[i]);
+        ASSERT_EQ(write_fields_2[i], get_packed_field(read_fields_2, i));
     }
 
     //test pay housekeeping
@@ -507,7 +805,7 @@ void mem_block_test_2(void){
     ASSERT_EQ(write_header.status, read_header.status);
 
     for (uint8_t i=0; i<pay_hk_mem_section.fields_per_block; i++){
-        ASSERT_EQ(write_fields_3[i], read_fields_3[i]);
+        ASSERT_EQ(write_fields_3[i], get_packed_field(read_fields_3, i));
     }
 
     //test pay optical
@@ -534,7 +832,7 @@ void mem_block_test_2(void){
     ASSERT_EQ(write_header.status, read_header.status);
 
     for (uint8_t i=0; i<pay_opt_mem_section.fields_per_block; i++){
-        ASSERT_EQ(write_fields_4[i], read_fields_4[i]);
+        ASSERT_EQ(write_fields_4[i], get_packed_field(read_fields_4, i));
     }
 }
 
@@ -680,6 +978,256 @@ void mem_block_erase_test(void){
     }
 }
 
+/* Test that background sector erases on different chips run at the same time */
+void mem_parallel_erase_test(void) {
+    uint8_t data[DATA_LENGTH] = {0xAA, 0xBB, 0xCC, 0xDD, 0xEE};
+    uint8_t read[DATA_LENGTH] = {0};
+
+    // One sector on each chip, with two on chip 0
+    uint32_t addrs[MEM_NUM_CHIPS + 1];
+    for (uint8_t i = 0; i < MEM_NUM_CHIPS; i++) {
+        addrs[i] = ((uint32_t) i << MEM_CHIP_ADDR_WIDTH) + 0x3000;
+    }
+    addrs[MEM_NUM_CHIPS] = 0x5000;
+
+    for (uint8_t i = 0; i < MEM_NUM_CHIPS + 1; i++) {
+        write_mem_bytes(addrs[i], data, DATA_LENGTH);
+    }
+    wait_for_all_mem_ready();
+    for (uint8_t i = 0; i < MEM_NUM_CHIPS + 1; i++) {
+        ASSERT_TRUE(enqueue_mem_sector_erase(mem_sector_for_addr(addrs[i])));
+    }
+
+    // One erase is started on every chip, the second one on chip 0 waits
+    run_mem_erase();
+    ASSERT_EQ(mem_erase_queue_count, 1);
+    ASSERT_EQ(mem_erase_queue[0], mem_sector_for_addr(addrs[MEM_NUM_CHIPS]));
+    for (uint8_t i = 0; i < MEM_NUM_CHIPS; i++) {
+        ASSERT_EQ(mem_chip_busy[i], 1);
+    }
+
+    wait_for_all_mem_ready();
+    run_mem_erase();
+    ASSERT_EQ(mem_erase_queue_count, 0);
+    wait_for_all_mem_ready();
+
+    for (uint8_t i = 0; i < MEM_NUM_CHIPS + 1; i++) {
+        read_mem_bytes(addrs[i], read, DATA_LENGTH);
+        for (uint8_t j = 0; j < DATA_LENGTH; j++) {
+            ASSERT_EQ(read[j], 0xFF);
+        }
+    }
+
+    // With a full queue, a sector is neither queued nor erased synchronously
+    mem_section_t* section = &eps_hk_mem_section;
+    uint32_t sector = mem_sector_for_addr(section->start_addr) + 1;
+    uint32_t address = mem_addr_for_sector(sector);
+    write_mem_bytes(address, data, DATA_LENGTH);
+    wait_for_all_mem_ready();
+    for (uint8_t i = 0; i < MEM_ERASE_QUEUE_SIZE; i++) {
+        ASSERT_TRUE(enqueue_mem_sector_erase(
+            mem_sector_for_addr(addrs[0]) + 1 + i));
+    }
+    ASSERT_FALSE(enqueue_mem_sector_erase(sector));
+    read_mem_bytes(address, read, DATA_LENGTH);
+    ASSERT_EQ(read[0], data[0]);
+
+    // The section keeps the sector it entered to queue it again
+    section->erase_ahead_sector = 0;
+    ASSERT_FALSE(erase_mem_section_ahead(section, sector));
+    ASSERT_EQ(section->erase_retry_sector, sector);
+
+    // Writing to the section makes room so the sector is erased first
+    uint8_t new_data[DATA_LENGTH] = {0x11, 0x22, 0x33, 0x44, 0x55};
+    ASSERT_TRUE(write_mem_section_bytes(section,
+        address - section->start_addr, new_data, DATA_LENGTH));
+    read_mem_bytes(address, read, DATA_LENGTH);
+    ASSERT_EQ_ARRAY(read, new_data, DATA_LENGTH);
+
+    // The rest of the look-ahead is queued as the background erases finish
+    while (mem_erase_queue_count > 0) {
+        run_mem_erase();
+        wait_for_all_mem_ready();
+    }
+    ASSERT_EQ(section->erase_retry_sector, MEM_ERASE_NO_RETRY);
+    ASSERT_EQ(section->erase_ahead_sector,
+        sector + MEM_ERASE_LOOKAHEAD_SECTORS);
+    read_mem_bytes(address, read, DATA_LENGTH);
+    ASSERT_EQ_ARRAY(read, new_data, DATA_LENGTH);
+
+    // Erasing all memory starts all the chip erases before waiting
+    write_mem_bytes(addrs[1], data, DATA_LENGTH);
+    erase_mem();
+    for (uint8_t i = 0; i < MEM_NUM_CHIPS; i++) {
+        ASSERT_EQ(mem_chip_busy[i], 0);
+    }
+    read_mem_bytes(addrs[1], read, DATA_LENGTH);
+    ASSERT_EQ(read[0], 0xFF);
+}
+
+/* Test a section with its pages striped across chips */
+void mem_striped_section_test(void) {
+    erase_mem();
+
+    mem_section_t* section = &pay_opt_mem_section;
+    uint8_t stripes = section->stripes;
+    section->stripes = MEM_PAY_OPT_STRIPES;
+    ASSERT_EQ(mem_section_stripes(section), MEM_PAY_OPT_STRIPES);
+
+    uint32_t part_size = (section->end_addr - section->start_addr + 1) /
+        MEM_PAY_OPT_STRIPES;
+    uint8_t chip0;
+    uint8_t chip1;
+    process_mem_addr(mem_section_phy_addr(section, 0), &chip0, NULL, NULL,
+        NULL);
+    process_mem_addr(mem_section_phy_addr(section, MEM_BYTES_PER_PAGE),
+        &chip1, NULL, NULL, NULL);
+    ASSERT_NEQ(chip0, chip1);
+
+    ASSERT_EQ(mem_section_phy_addr(section, 0x10), section->start_addr + 0x10);
+    ASSERT_EQ(mem_section_phy_addr(section, MEM_BYTES_PER_PAGE + 0x10),
+        section->start_addr + part_size + 0x10);
+    ASSERT_EQ(mem_section_phy_addr(section, (2 * MEM_BYTES_PER_PAGE) + 0x10),
+        section->start_addr + MEM_BYTES_PER_PAGE + 0x10);
+    ASSERT_EQ(mem_section_phy_len(section, 0x10, 1000),
+        MEM_BYTES_PER_PAGE - 0x10);
+
+    // Block 1 is split across the first two pages
+    uint32_t block_num = 1;
+    uint8_t write_fields[section->fields_per_block * MEM_BYTES_PER_FIELD];
+    for (uint8_t i = 0; i < section->fields_per_block; i++) {
+        set_packed_field(write_fields, i, random() & 0xFFFFFF);
+    }
+    mem_header_t write_header;
+    write_header.block_num = block_num;
+    write_header.date = rand_rtc_date();
+    write_header.time = rand_rtc_time();
+    write_header.status = 0x00;
+    ASSERT_TRUE(write_mem_data_block_fields(section, block_num, &write_header,
+        write_fields, true, 0, section->fields_per_block));
+
+    mem_header_t read_header;
+    uint8_t read_fields[section->fields_per_block * MEM_BYTES_PER_FIELD];
+    read_mem_data_block(section, block_num, &read_header, read_fields);
+    ASSERT_EQ(read_header.block_num, block_num);
+    ASSERT_EQ(read_header.status, 0x00);
+    ASSERT_EQ_ARRAY(write_fields, read_fields,
+        section->fields_per_block * MEM_BYTES_PER_FIELD);
+
+    // The rest of the block after the first page is at the start of the
+    // second part
+    uint32_t block_addr = mem_block_section_addr(section, block_num);
+    uint8_t split = MEM_BYTES_PER_PAGE - block_addr - MEM_BYTES_PER_HEADER;
+    uint8_t raw[DATA_LENGTH];
+    read_mem_bytes(section->start_addr + part_size, raw, DATA_LENGTH);
+    ASSERT_EQ_ARRAY(&write_fields[split], raw, DATA_LENGTH);
+
+    // The same sector is erased ahead in both parts
+    uint32_t sector = mem_section_erase_sector(section,
+        MEM_BYTES_PER_SECTOR * MEM_PAY_OPT_STRIPES);
+    ASSERT_EQ(sector, mem_sector_for_addr(section->start_addr) + 1);
+    mem_erase_queue_count = 0;
+    section->erase_ahead_sector = 0;
+    erase_mem_section_ahead(section, sector);
+    ASSERT_EQ(mem_erase_queue_count,
+        (MEM_ERASE_LOOKAHEAD_SECTORS + 1) * MEM_PAY_OPT_STRIPES);
+    ASSERT_EQ(mem_erase_queue[0], sector);
+    ASSERT_EQ(mem_erase_queue[1],
+        sector + (part_size / MEM_BYTES_PER_SECTOR));
+    mem_erase_queue_count = 0;
+
+    // Not striped if the section can't be split evenly
+    uint32_t end_addr = section->end_addr;
+    section->end_addr -= MEM_BYTES_PER_SECTOR;
+    ASSERT_EQ(mem_section_stripes(section), 1);
+    section->end_addr = end_addr;
+
+    section->stripes = stripes;
+}
+
+/* Test the CRC stored after the fields of a committed block */
+void mem_block_crc_test(void) {
+    // CRC-16/CCITT-FALSE check value
+    uint16_t crc = MEM_CRC_INIT;
+    const char* check = "123456789";
+    for (uint8_t i = 0; check[i] != '\0'; i++) {
+        crc = mem_crc16_update(crc, check[i]);
+    }
+    ASSERT_EQ(crc, 0x29B1);
+
+    mem_section_t* section = &pay_hk_mem_section;
+    bool block_crc = section->block_crc;
+    section->block_crc = false;
+    uint32_t size = mem_block_size(section);
+    ASSERT_EQ(read_mem_block_crc(section, 0), MEM_CRC_ERASED);
+    section->block_crc = true;
+    ASSERT_TRUE(mem_section_has_block_crc(section));
+    ASSERT_EQ(mem_block_size(section), size + MEM_BYTES_PER_CRC);
+
+    uint32_t block_num = 20;
+    erase_mem_sector(mem_block_addr(section, block_num));
+    erase_mem_sector(mem_block_end_addr(section, block_num));
+
+    uint8_t fields[CAN_PAY_HK_FIELD_COUNT * MEM_BYTES_PER_FIELD];
+    for (uint8_t i = 0; i < section->fields_per_block; i++) {
+        set_packed_field(fields, i, random() & 0xFFFFFF);
+    }
+    mem_header_t header;
+    header.block_num = block_num;
+    header.date = rand_rtc_date();
+    header.time = rand_rtc_time();
+    header.status = 0x00;
+    ASSERT_TRUE(write_mem_data_block_fields(section, block_num, &header,
+        fields, true, 0, section->fields_per_block));
+
+    // Not committed yet
+    ASSERT_EQ(read_mem_block_crc(section, block_num), MEM_CRC_ERASED);
+    write_mem_block_crc(section, block_num);
+    crc = read_mem_block_crc(section, block_num);
+    ASSERT_NEQ(crc, MEM_CRC_ERASED);
+    ASSERT_EQ(crc, calc_mem_block_crc(section, block_num));
+
+    // The CRC does not change the data
+    mem_header_t read_header;
+    uint8_t read_fields[CAN_PAY_HK_FIELD_COUNT * MEM_BYTES_PER_FIELD];
+    read_mem_data_block(section, block_num, &read_header, read_fields);
+    ASSERT_EQ(read_header.block_num, block_num);
+    ASSERT_EQ_ARRAY(fields, read_fields,
+        CAN_PAY_HK_FIELD_COUNT * MEM_BYTES_PER_FIELD);
+
+    section->block_crc = block_crc;
+}
+
+/* Test that the SPI bus is only set up again when the settings change */
+void spi_bus_test(void) {
+    uint8_t data[DATA_LENGTH] = {0x11, 0x22, 0x33, 0x44, 0x55};
+    uint8_t read[DATA_LENGTH] = {0};
+
+    // Reads use the fast clock, everything else the default clock
+    read_mem_bytes(0, read, DATA_LENGTH);
+    ASSERT_EQ(spi_bus_mode, 0);
+    ASSERT_EQ(spi_bus_clk, SPI_BUS_CLK_MAX);
+    read_mem_status(0);
+    ASSERT_EQ(spi_bus_clk, SPI_BUS_CLK_DEFAULT);
+
+    // Accessing the same chip (or another chip with the same settings) does
+    // not change anything
+    uint16_t count = spi_bus_setup_count;
+    for (uint8_t i = 0; i < MEM_NUM_CHIPS; i++) {
+        read_mem_status(i);
+    }
+    ASSERT_EQ(spi_bus_setup_count, count);
+
+    erase_mem_sector(0x100);
+    write_mem_bytes(0x100, data, DATA_LENGTH);
+    read_mem_bytes(0x100, read, DATA_LENGTH);
+    for (uint8_t i = 0; i < DATA_LENGTH; i++) {
+        ASSERT_EQ(read[i], data[i]);
+    }
+    count = spi_bus_setup_count;
+    read_mem_bytes(0x100, read, DATA_LENGTH);
+    ASSERT_EQ(spi_bus_setup_count, count);
+}
 
 
 test_t t1 = { .name = "erase mem test", .fn = erase_mem_test };
@@ -697,8 +1245,16 @@ test_t t12 = { .name = "section byte isolation test", .fn = section_byte_isolati
 test_t t13 = { .name = "cmd block test", .fn = cmd_block_test };
 test_t t14 = { .name = "sector erase test", .fn = mem_sector_erase_test };
 test_t t15 = { .name = "block erase test", .fn = mem_block_erase_test };
-
-test_t* suite[] = { &t1, &t2, &t3, &t4, &t5, &t6, &t7, &t8, &t9, &t10, &t11, &t12, &t13, &t14, &t15 };
+test_t t16 = { .name = "mem block burst test", .fn = mem_block_burst_test };
+test_t t17 = { .name = "curr block recovery test", .fn = curr_block_recovery_test };
+test_t t18 = { .name = "mem block cache test", .fn = mem_block_cache_test };
+test_t t19 = { .name = "mem compressed test", .fn = mem_compressed_test };
+test_t t20 = { .name = "spi bus test", .fn = spi_bus_test };
+test_t t21 = { .name = "mem parallel erase test", .fn = mem_parallel_erase_test };
+test_t t22 = { .name = "mem striped section test", .fn = mem_striped_section_test };
+test_t t23 = { .name = "mem block crc test", .fn = mem_block_crc_test };
+
+test_t* suite[] = { &t1, &t2, &t3, &t4, &t5, &t6, &t7, &t8, &t9, &t10, &t11, &t12, &t13, &t14, &t15, &t16, &t17, &t18, &t19, &t20, &t21, &t22, &t23 };
 
 int main(void) {
     init_uart();
@@ -0,0 +1,367 @@
+/*
+ * Harness based benchmark for the OBC flash memory.
+ *
+ * Measures throughput and worst-case latency of the flash operations, so
+ * changes to the flash code can be compared on real hardware (the results are
+ * only meaningful when run on the OBC with the real flash chips).
+ *
+ * Each benchmark prints one line in this format (all values in decimal):
+ * BENCH name=<name> len=<bytes per op> ops=<count> total_us=<time>
+ *     avg_us=<time> max_us=<time> bytes_per_s=<throughput>
+ *
+ * Times are measured with the 16-bit timer started by init_uptime() (uptime_s
+ * plus the timer count within the current second), so the resolution is one
+ * timer tick (128 us with the 1024 prescaler at 8 MHz).
+ * Write benchmarks include waiting for the last write to finish programming
+ * in the total time (but not in each operation's latency, since writes
+ * return before programming is done).
+ *
+ * NOTE: This erases all of flash memory
+ */
+
+#include <avr/interrupt.h>
+
+#include <test/test.h>
+#include <uart/uart.h>
+#include <spi/spi.h>
+#include <uptime/uptime.h>
+#include "../../src/mem.h"
+
+// Number of operations per benchmark
+#define BENCH_OPS               32
+// Maximum number of bytes per operation
+#define BENCH_MAX_LEN           256
+// Number of sectors/blocks to erase for the erase benchmarks
+#define BENCH_ERASE_OPS         8
+
+// Start of an area used for the benchmarks (must be erased first)
+#define BENCH_ADDR              0x100000UL
+#define ROLLOVER_ADDR_1         0x1FFFFC
+#define ROLLOVER_ADDR_2         0x3FFFFB
+#define ROLLOVER_ADDR_3         0x5FFFFD
+#define NUM_ROLLOVER            3
+#define ROLLOVER_DATA_LEN       8
+
+
+#define ASSERT_EQ_ARRAY(array1, array2, count) \
+    for (uint16_t i = 0; i < count; i++) { \
+        ASSERT_EQ((array1)[i], (array2)[i]); \
+    }
+
+
+// Results of one benchmark
+typedef struct {
+    uint32_t ops;
+    uint32_t len;
+    uint32_t total_ticks;
+    uint32_t max_ticks;
+} bench_t;
+
+uint8_t bench_data[BENCH_MAX_LEN];
+uint8_t bench_read[BENCH_MAX_LEN];
+
+
+/*
+Returns the number of 16-bit timer ticks per second (one second per compare
+    match).
+*/
+uint32_t bench_ticks_per_s(void) {
+    return ((uint32_t) OCR1A) + 1;
+}
+
+/*
+Returns the time since init_uptime() in 16-bit timer ticks.
+*/
+uint32_t bench_ticks(void) {
+    uint32_t seconds;
+    uint16_t count;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        seconds = uptime_s;
+        count = TCNT1;
+        // If the compare match happened but the interrupt has not run yet,
+        // the count already started the next second
+        if (TIFR1 & _BV(OCF1A)) {
+            seconds++;
+            count = TCNT1;
+        }
+    }
+    return (seconds * bench_ticks_per_s()) + count;
+}
+
+uint32_t bench_ticks_to_us(uint32_t ticks) {
+    return (uint32_t) ((ticks * 1000000ULL) / bench_ticks_per_s());
+}
+
+void bench_start(bench_t* bench, uint32_t len) {
+    bench->ops = 0;
+    bench->len = len;
+    bench->total_ticks = 0;
+    bench->max_ticks = 0;
+}
+
+// Adds one operation that took from start to end (in ticks)
+void bench_add(bench_t* bench, uint32_t start, uint32_t end) {
+    uint32_t ticks = end - start;
+    bench->ops++;
+    bench->total_ticks += ticks;
+    if (ticks > bench->max_ticks) {
+        bench->max_ticks = ticks;
+    }
+}
+
+void bench_print(char* name, bench_t* bench) {
+    uint32_t total_us = bench_ticks_to_us(bench->total_ticks);
+    uint32_t avg_us = 0;
+    uint32_t bytes_per_s = 0;
+    if (bench->ops > 0) {
+        avg_us = total_us / bench->ops;
+    }
+    if (total_us > 0) {
+        bytes_per_s = (uint32_t) ((bench->ops * bench->len * 1000000ULL) /
+            total_us);
+    }
+
+    print("BENCH name=%s len=%lu ops=%lu total_us=%lu avg_us=%lu max_us=%lu bytes_per_s=%lu\n",
+        name, bench->len, bench->ops, total_us, avg_us,
+        bench_ticks_to_us(bench->max_ticks), bytes_per_s);
+}
+
+void populate_bench_data(void) {
+    for (uint16_t i = 0; i < BENCH_MAX_LEN; i++) {
+        bench_data[i] = i & 0xFF;
+    }
+}
+
+// Erases the sectors used by the write benchmarks (not timed)
+void erase_bench_area(uint32_t len) {
+    uint32_t end = BENCH_ADDR + (BENCH_OPS * len) + len;
+    for (uint32_t addr = BENCH_ADDR; addr < end;
+            addr += MEM_BYTES_PER_SECTOR) {
+        erase_mem_sector(addr);
+    }
+}
+
+
+// Writes of `len` bytes, each starting `offset` bytes into a page
+void write_bytes_bench(char* name, uint16_t len, uint8_t offset) {
+    erase_bench_area(BENCH_MAX_LEN);
+    populate_bench_data();
+
+    bench_t bench;
+    bench_start(&bench, len);
+
+    uint32_t total_start = bench_ticks();
+    for (uint32_t i = 0; i < BENCH_OPS; i++) {
+        uint32_t addr = BENCH_ADDR + (i * BENCH_MAX_LEN) + offset;
+        uint32_t start = bench_ticks();
+        write_mem_bytes(addr, bench_data, len);
+        bench_add(&bench, start, bench_ticks());
+    }
+    wait_for_all_mem_ready();
+    bench.total_ticks = bench_ticks() - total_start;
+
+    bench_print(name, &bench);
+
+    // Make sure the data was actually written
+    read_mem_bytes(BENCH_ADDR + offset, bench_read, len);
+    ASSERT_EQ_ARRAY(bench_read, bench_data, len);
+}
+
+void write_bytes_1_test(void) {
+    write_bytes_bench("write_mem_bytes", 1, 0);
+}
+
+void write_bytes_16_test(void) {
+    write_bytes_bench("write_mem_bytes", 16, 0);
+}
+
+void write_bytes_page_test(void) {
+    write_bytes_bench("write_mem_bytes", MEM_BYTES_PER_PAGE, 0);
+}
+
+// Same length as a page, but split across two pages
+void write_bytes_page_boundary_test(void) {
+    write_bytes_bench("write_mem_bytes_page_boundary", MEM_BYTES_PER_PAGE,
+        MEM_BYTES_PER_PAGE / 2);
+}
+
+
+void read_bytes_bench(uint16_t len) {
+    bench_t bench;
+    bench_start(&bench, len);
+
+    for (uint32_t i = 0; i < BENCH_OPS; i++) {
+        uint32_t addr = BENCH_ADDR + (i * BENCH_MAX_LEN);
+        uint32_t start = bench_ticks();
+        read_mem_bytes(addr, bench_read, len);
+        bench_add(&bench, start, bench_ticks());
+    }
+
+    bench_print("read_mem_bytes", &bench);
+}
+
+void read_bytes_test(void) {
+    read_bytes_bench(1);
+    read_bytes_bench(16);
+    read_bytes_bench(BENCH_MAX_LEN);
+}
+
+
+void write_field_test(void) {
+    mem_section_t* section = &eps_hk_mem_section;
+    erase_mem_sector(mem_block_addr(section, 0));
+    erase_mem_sector(mem_block_addr(section, 0) + MEM_BYTES_PER_SECTOR);
+
+    bench_t bench;
+    bench_start(&bench, MEM_BYTES_PER_FIELD);
+
+    uint32_t total_start = bench_ticks();
+    for (uint32_t i = 0; i < BENCH_OPS; i++) {
+        uint32_t start = bench_ticks();
+        write_mem_field(section, i / section->fields_per_block,
+            i % section->fields_per_block, i);
+        bench_add(&bench, start, bench_ticks());
+    }
+    wait_for_all_mem_ready();
+    bench.total_ticks = bench_ticks() - total_start;
+
+    bench_print("write_mem_field", &bench);
+
+    ASSERT_EQ(read_mem_field(section, 0, 1), 1);
+}
+
+
+void write_cmd_block_test(void) {
+    mem_section_t* section = &prim_cmd_log_mem_section;
+    erase_mem_sector(mem_block_addr(section, 0));
+
+    mem_header_t header;
+    clear_mem_header(&header);
+
+    bench_t bench;
+    bench_start(&bench, mem_block_size(section));
+
+    uint32_t total_start = bench_ticks();
+    for (uint32_t i = 0; i < BENCH_OPS; i++) {
+        header.block_num = i;
+        uint32_t start = bench_ticks();
+        write_mem_cmd_block(section, i, &header, i, 0x01, 0x12345678,
+            0x9ABCDEF0);
+        bench_add(&bench, start, bench_ticks());
+    }
+    wait_for_all_mem_ready();
+    bench.total_ticks = bench_ticks() - total_start;
+
+    bench_print("write_mem_cmd_block", &bench);
+
+    mem_header_t read_header;
+    uint16_t cmd_id;
+    uint8_t opcode;
+    uint32_t arg1;
+    uint32_t arg2;
+    read_mem_cmd_block(section, 1, &read_header, &cmd_id, &opcode, &arg1,
+        &arg2);
+    ASSERT_EQ(cmd_id, 1);
+    ASSERT_EQ(arg1, 0x12345678);
+}
+
+
+// Writes that cross from one chip to the next
+void write_rollover_test(void) {
+    uint32_t addrs[NUM_ROLLOVER] = {
+        ROLLOVER_ADDR_1, ROLLOVER_ADDR_2, ROLLOVER_ADDR_3
+    };
+    populate_bench_data();
+
+    bench_t bench;
+    bench_start(&bench, ROLLOVER_DATA_LEN);
+
+    for (uint8_t i = 0; i < NUM_ROLLOVER; i++) {
+        erase_mem_sector(addrs[i]);
+        if (addrs[i] + ROLLOVER_DATA_LEN - 1 < MEM_NUM_ADDRESSES) {
+            erase_mem_sector(addrs[i] + ROLLOVER_DATA_LEN - 1);
+        }
+    }
+
+    uint32_t total_start = bench_ticks();
+
+    for (uint8_t i = 0; i < NUM_ROLLOVER; i++) {
+        uint32_t start = bench_ticks();
+        write_mem_bytes(addrs[i], bench_data, ROLLOVER_DATA_LEN);
+        bench_add(&bench, start, bench_ticks());
+    }
+    wait_for_all_mem_ready();
+    bench.total_ticks = bench_ticks() - total_start;
+
+    bench_print("write_mem_bytes_rollover", &bench);
+
+    read_mem_bytes(ROLLOVER_ADDR_1, bench_read, ROLLOVER_DATA_LEN);
+    ASSERT_EQ_ARRAY(bench_read, bench_data, ROLLOVER_DATA_LEN);
+}
+
+
+void erase_sector_test(void) {
+    bench_t bench;
+    bench_start(&bench, MEM_BYTES_PER_SECTOR);
+
+    for (uint32_t i = 0; i < BENCH_ERASE_OPS; i++) {
+        uint32_t start = bench_ticks();
+        erase_mem_sector(BENCH_ADDR + (i * MEM_BYTES_PER_SECTOR));
+        bench_add(&bench, start, bench_ticks());
+    }
+
+    bench_print("erase_mem_sector", &bench);
+}
+
+void erase_block_test(void) {
+    // 64 kB blocks (all on the same chip)
+    bench_t bench;
+    bench_start(&bench, 0x10000UL);
+
+    for (uint32_t i = 0; i < BENCH_ERASE_OPS; i++) {
+        uint32_t start = bench_ticks();
+        erase_mem_block(BENCH_ADDR + (i * 0x10000UL));
+        bench_add(&bench, start, bench_ticks());
+    }
+
+    bench_print("erase_mem_block", &bench);
+}
+
+void erase_chip_test(void) {
+    bench_t bench;
+    bench_start(&bench, 1UL << MEM_CHIP_ADDR_WIDTH);
+
+    for (uint8_t i = 0; i < MEM_NUM_CHIPS; i++) {
+        uint32_t start = bench_ticks();
+        erase_mem_chip(i);
+        bench_add(&bench, start, bench_ticks());
+    }
+
+    bench_print("erase_mem_chip", &bench);
+}
+
+
+test_t t1 = { .name = "write bytes 1 bench", .fn = write_bytes_1_test };
+test_t t2 = { .name = "write bytes 16 bench", .fn = write_bytes_16_test };
+test_t t3 = { .name = "write bytes page bench", .fn = write_bytes_page_test };
+test_t t4 = { .name = "write page boundary bench", .fn = write_bytes_page_boundary_test };
+test_t t5 = { .name = "read bytes bench", .fn = read_bytes_test };
+test_t t6 = { .name = "write field bench", .fn = write_field_test };
+test_t t7 = { .name = "write cmd block bench", .fn = write_cmd_block_test };
+test_t t8 = { .name = "write rollover bench", .fn = write_rollover_test };
+test_t t9 = { .name = "erase sector bench", .fn = erase_sector_test };
+test_t t10 = { .name = "erase block bench", .fn = erase_block_test };
+test_t t11 = { .name = "erase chip bench", .fn = erase_chip_test };
+
+test_t* suite[] = { &t1, &t2, &t3, &t4, &t5, &t6, &t7, &t8, &t9, &t10, &t11 };
+
+int main(void) {
+    init_uart();
+    init_spi();
+    init_uptime();
+    sei();
+    init_mem();
+
+    run_tests(suite, sizeof(suite) / sizeof(suite[0]));
+    return 0;
+}
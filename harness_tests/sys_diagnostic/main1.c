@@ -12,11 +12,11 @@ void eps_hk_test(void){
         enqueue_tx_msg(&eps_tx_msg_queue, CAN_EPS_HK, field, 0);
         send_next_eps_tx_msg();
         /* Delay to give time to send and receive message */
-        for (uint32_t i = 0; i < 1000 && queue_empty(&data_rx_msg_queue); i++) {
+        for (uint32_t i = 0; i < 1000 && can_rx_ring_empty(&eps_hk_rx_ring); i++) {
             _delay_ms(1);
         }
-        ASSERT_FALSE(queue_empty(&data_rx_msg_queue));
-        dequeue(&data_rx_msg_queue, msg);
+        ASSERT_FALSE(can_rx_ring_empty(&eps_hk_rx_ring));
+        dequeue_can_rx_ring(&eps_hk_rx_ring, msg);
         ASSERT_EQ(msg[0], CAN_EPS_HK);
         ASSERT_EQ(msg[1], field);
         ASSERT_EQ(msg[2], CAN_STATUS_OK);
@@ -35,11 +35,11 @@ void pay_hk_test(void){
         enqueue_tx_msg(&pay_tx_msg_queue, CAN_PAY_HK, field, 0);
         send_next_pay_tx_msg();
         /* Delay to give time to send and receive message */
-        for (uint32_t i = 0; i < 1000 && queue_empty(&data_rx_msg_queue); i++) {
+        for (uint32_t i = 0; i < 1000 && can_rx_ring_empty(&pay_hk_rx_ring); i++) {
             _delay_ms(1);
         }
-        ASSERT_FALSE(queue_empty(&data_rx_msg_queue));
-        dequeue(&data_rx_msg_queue, msg);
+        ASSERT_FALSE(can_rx_ring_empty(&pay_hk_rx_ring));
+        dequeue_can_rx_ring(&pay_hk_rx_ring, msg);
         ASSERT_EQ(msg[0], CAN_PAY_HK);
         ASSERT_EQ(msg[1], field);
         ASSERT_EQ(msg[2], CAN_STATUS_OK);
@@ -61,11 +61,11 @@ void pay_opt_test(void){
         enqueue_tx_msg(&pay_tx_msg_queue, CAN_PAY_OPT, field, 0);
         send_next_pay_tx_msg();
         /* Delay to give time to send and receive message */
-        for (uint32_t i = 0; i < 15000 && queue_empty(&data_rx_msg_queue); i++) {
+        for (uint32_t i = 0; i < 15000 && can_rx_ring_empty(&pay_opt_rx_ring); i++) {
             _delay_ms(1);
         }
-        ASSERT_FALSE(queue_empty(&data_rx_msg_queue));
-        dequeue(&data_rx_msg_queue, msg);
+        ASSERT_FALSE(can_rx_ring_empty(&pay_opt_rx_ring));
+        dequeue_can_rx_ring(&pay_opt_rx_ring, msg);
         ASSERT_EQ(msg[0], CAN_PAY_OPT);
         ASSERT_EQ(msg[1], field);
         ASSERT_EQ(msg[2], CAN_STATUS_OK);
@@ -11,6 +11,9 @@ since the  transceiver itself is not used.
 #include <spi/spi.h>
 #include "../../src/transceiver.h"//also includes uptime.h by extension
 
+// Uncomment to also run the benchmark (see benchmark_test())
+// #define TRANS_ENCODING_BENCHMARK
+
 // 1
 void decode_trans_rx_msg_test(void){
     // Can't use the `enc_msg_len` variable as the array size, even if it is const
@@ -97,9 +100,12 @@ void encode_trans_tx_msg_test(void){
         ASSERT_EQ(trans_tx_enc_msg[i], enc_msg[i]);
     }
 
-    ASSERT_EQ(trans_tx_dec_avail, false);
+    // The message was encoded in place, so it is kept until it has been sent
+    ASSERT_EQ(trans_tx_dec_avail, true);
     ASSERT_EQ(trans_tx_enc_avail, true);
+    ASSERT_TRUE(trans_tx_enc_msg == trans_tx_dec_frame);
 
+    trans_tx_dec_avail = false;
     trans_tx_enc_avail = false;
 }
 
@@ -127,8 +133,9 @@ void random_encode_decode_test(void){
     encode_trans_tx_msg();
 
     // Check available flags
-    ASSERT_FALSE(trans_tx_dec_avail);
+    ASSERT_TRUE(trans_tx_dec_avail);
     ASSERT_TRUE(trans_tx_enc_avail);
+    trans_tx_dec_avail = false;
 
     // Check minimum length
     // Encoded length = decoded length + 9 always
@@ -194,13 +201,567 @@ void checksum_test(void){
 }
 
 
+// Checks that the checksums calculated as bytes are received or added match
+// the checksums of the whole messages
+void incremental_checksum_test(void) {
+    uint8_t enc_msg[24] = {
+        0x55,
+        0x0f,
+        0x55,
+        0x13, 0xa4, 0x12, 0xf3, 0xff, 0x34, 0x9e, 0x1e, 0x28, 0x9a, 0x6e, 0xa5,
+        0x49, 0x7e, 0xf2,
+        0x55,
+        0x16, 0xA4, 0xF6, 0x92,
+        0x55
+    };
+
+    // RX - parse each byte as it arrives (after some other bytes that are
+    // ignored)
+    reset_trans_rx_parser();
+    parse_trans_rx_byte(0x00);
+    parse_trans_rx_byte(0x12);
+    for (uint8_t i = 0; i < sizeof(enc_msg); i++) {
+        parse_trans_rx_byte(enc_msg[i]);
+    }
+    ASSERT_TRUE(trans_rx_enc_avail);
+    ASSERT_TRUE(trans_rx_enc_crc_avail);
+    ASSERT_EQ(trans_rx_enc_crc, 0x16A4F692);
+    decode_trans_rx_msg();
+    ASSERT_TRUE(trans_rx_dec_avail);
+    ASSERT_FALSE(trans_rx_enc_crc_avail);
+    trans_rx_dec_avail = false;
+
+    // A changed byte gives a different checksum
+    enc_msg[5] ^= 0x01;
+    for (uint8_t i = 0; i < sizeof(enc_msg); i++) {
+        parse_trans_rx_byte(enc_msg[i]);
+    }
+    ASSERT_TRUE(trans_rx_enc_avail);
+    ASSERT_NEQ(trans_rx_enc_crc, 0x16A4F692);
+    decode_trans_rx_msg();
+    ASSERT_FALSE(trans_rx_dec_avail);
+    enc_msg[5] ^= 0x01;
+
+    // TX - add the bytes one at a time (the maximum length message uses the
+    // last entry of the length table)
+    for (uint8_t dec_len = 1; dec_len <= TRANS_TX_DEC_MSG_MAX_SIZE; dec_len += 127) {
+        uint8_t dec_msg[TRANS_TX_DEC_MSG_MAX_SIZE + 1];
+        dec_msg[0] = dec_len;
+        start_trans_tx_dec_msg();
+        for (uint8_t i = 0; i < dec_len; i++) {
+            dec_msg[1 + i] = (uint8_t) rand();
+            append_to_trans_tx_dec_msg(dec_msg[1 + i]);
+        }
+        ASSERT_EQ(trans_tx_dec_crc_len, dec_len);
+        ASSERT_EQ(trans_tx_dec_checksum(), crc32(dec_msg, 1 + dec_len));
+
+        // Bytes written directly after the added ones are included
+        start_trans_tx_dec_msg();
+        for (uint8_t i = 0; i < dec_len - 1; i++) {
+            append_to_trans_tx_dec_msg(dec_msg[1 + i]);
+        }
+        trans_tx_dec_msg[trans_tx_dec_len] = dec_msg[dec_len];
+        trans_tx_dec_len++;
+        ASSERT_EQ(trans_tx_dec_crc_len, dec_len - 1);
+        ASSERT_EQ(trans_tx_dec_checksum(), crc32(dec_msg, 1 + dec_len));
+    }
+
+    // Register after one 0x00 byte (CRC32 of 0x00 is 0xD202EF8D)
+    ASSERT_EQ(crc32_update(CRC32_INIT, 0x00), 0x2DFD1072);
+}
+
+
+// Verifies that sending an encoded message does not block and that the buffer
+// is kept until the packet has been sent
+void send_state_test(void) {
+    uint8_t dec_msg[] = {0x01, 0x02, 0x03};
+    uint8_t enc_msg[sizeof(dec_msg) + 9];
+
+    trans_tx_enc_avail = false;
+    start_trans_tx_dec_msg();
+    for (uint8_t i = 0; i < sizeof(dec_msg); i++) {
+        append_to_trans_tx_dec_msg(dec_msg[i]);
+    }
+    trans_tx_dec_avail = true;
+    encode_trans_tx_msg();
+    ASSERT_TRUE(trans_tx_enc_avail);
+    ASSERT_EQ(trans_tx_enc_len, sizeof(dec_msg) + 9);
+    for (uint8_t i = 0; i < sizeof(enc_msg); i++) {
+        enc_msg[i] = trans_tx_enc_msg[i];
+    }
+
+    // Returns right away and waits for the guard time before the first byte
+    take_events();
+    send_trans_tx_enc_msg();
+    ASSERT_EQ(trans_tx_enc_state, TRANS_TX_ENC_PRE_GUARD);
+    ASSERT_EQ(trans_tx_enc_sent, 0);
+    ASSERT_TRUE(trans_tx_enc_avail);
+
+    // The main loop is not kept running during the guard time, the compare
+    // interrupt at the end of it wakes it up
+    ASSERT_FALSE(take_events() & EVENT_TRANS_TX);
+    ASSERT_TRUE(TIMSK1 & _BV(OCIE1B));
+    _delay_ms(TRANS_TX_PKT_DELAY_MS + 10);
+    ASSERT_FALSE(TIMSK1 & _BV(OCIE1B));
+    ASSERT_TRUE(take_events() & EVENT_TRANS_TX);
+
+    // The decoded message is the packet being sent, so it is not freed for
+    // the next response and is not encoded again
+    ASSERT_TRUE(trans_tx_dec_avail);
+    ASSERT_FALSE(take_events() & EVENT_CMD);
+    encode_trans_tx_msg();
+    ASSERT_EQ(trans_tx_enc_len, sizeof(enc_msg));
+    for (uint8_t i = 0; i < sizeof(enc_msg); i++) {
+        ASSERT_EQ(trans_tx_enc_msg[i], enc_msg[i]);
+    }
+
+    // An ACK frame can be built while the response is being sent
+    trans_tx_ack_msg_len = 0;
+    add_trans_tx_ack(0x1234, 0x00);
+    process_trans_tx_ack();
+    ASSERT_TRUE(trans_tx_ack_msg_avail);
+    ASSERT_TRUE(trans_tx_enc_msg == trans_tx_dec_frame);
+    for (uint8_t i = 0; i < sizeof(enc_msg); i++) {
+        ASSERT_EQ(trans_tx_enc_msg[i], enc_msg[i]);
+    }
+    trans_tx_ack_msg_avail = false;
+
+    trans_tx_dec_avail = false;
+    trans_tx_enc_avail = false;
+    trans_tx_enc_state = TRANS_TX_ENC_IDLE;
+}
+
+
+// Verifies the RX parser with packets of other lengths, invalid packets and
+// command responses
+void rx_parser_test(void) {
+    // Shorter packet than the usual 24 bytes
+    uint8_t dec_msg[] = {0x03, 0x01, 0x02, 0x03};
+    uint32_t checksum = crc32(dec_msg, sizeof(dec_msg));
+    uint8_t enc_msg[] = {
+        0x55, 0x03, 0x55, 0x01, 0x02, 0x03, 0x55,
+        (checksum >> 24) & 0xFF, (checksum >> 16) & 0xFF,
+        (checksum >> 8) & 0xFF, checksum & 0xFF,
+        0x55
+    };
+
+    reset_trans_rx_parser();
+    for (uint8_t i = 0; i < sizeof(enc_msg); i++) {
+        ASSERT_FALSE(trans_rx_enc_avail);
+        parse_trans_rx_byte(enc_msg[i]);
+    }
+    ASSERT_TRUE(trans_rx_enc_avail);
+    ASSERT_EQ(trans_rx_enc_len, sizeof(enc_msg));
+    ASSERT_EQ(trans_rx_state, TRANS_RX_IDLE);
+    ASSERT_EQ(trans_rx_count, 0);
+    decode_trans_rx_msg();
+    ASSERT_TRUE(trans_rx_dec_avail);
+    ASSERT_EQ(trans_rx_dec_len, 3);
+    for (uint8_t i = 0; i < 3; i++) {
+        ASSERT_EQ(trans_rx_dec_msg[i], dec_msg[1 + i]);
+    }
+    trans_rx_dec_avail = false;
+
+    // A delimiter that does not start a packet is skipped, then the packet is
+    // still found
+    parse_trans_rx_byte(0x55);
+    parse_trans_rx_byte(0x01);
+    parse_trans_rx_byte(0x02);
+    for (uint8_t i = 0; i < sizeof(enc_msg); i++) {
+        parse_trans_rx_byte(enc_msg[i]);
+    }
+    ASSERT_TRUE(trans_rx_enc_avail);
+    trans_rx_enc_avail = false;
+    trans_rx_enc_crc_avail = false;
+
+    // Wrong end delimiter - nothing received, waits for the timeout
+    enc_msg[sizeof(enc_msg) - 1] = 0x00;
+    for (uint8_t i = 0; i < sizeof(enc_msg); i++) {
+        parse_trans_rx_byte(enc_msg[i]);
+    }
+    ASSERT_FALSE(trans_rx_enc_avail);
+    ASSERT_EQ(trans_rx_count, sizeof(enc_msg));
+    reset_trans_rx_parser();
+
+    // Command response
+    uint8_t resp[] = {'O', 'K', '1', '2', '\r'};
+    trans_cmd_resp_avail = false;
+    for (uint8_t i = 0; i < sizeof(resp); i++) {
+        parse_trans_rx_byte(resp[i]);
+    }
+    ASSERT_TRUE(trans_cmd_resp_avail);
+    ASSERT_EQ(trans_cmd_resp_len, 4);
+    ASSERT_EQ(trans_cmd_resp[2], '1');
+    trans_cmd_resp_avail = false;
+
+    // Unsuccessful command response
+    uint8_t err[] = {'E', 'R', 'R', '\r'};
+    for (uint8_t i = 0; i < sizeof(err); i++) {
+        parse_trans_rx_byte(err[i]);
+    }
+    ASSERT_FALSE(trans_cmd_resp_avail);
+    ASSERT_EQ(trans_rx_state, TRANS_RX_IDLE);
+    reset_trans_rx_parser();
+}
+
+
+uint8_t trans_cmd_cb_count = 0;
+bool trans_cmd_cb_success = false;
+uint32_t trans_cmd_cb_value = 0;
+
+void trans_cmd_test_cb(bool success) {
+    trans_cmd_cb_count++;
+    trans_cmd_cb_success = success;
+    if (success) {
+        trans_cmd_cb_value = scan_uint(trans_cmd_resp, 5, 8);
+    }
+}
+
+// Verifies transceiver commands sent without blocking
+// Feeds a command response (followed by its checksum) to the RX parser
+void send_test_trans_cmd_resp(const char* text) {
+    uint8_t resp[TRANS_CMD_RESP_MAX_SIZE];
+    uint8_t len = 0;
+    while (text[len] != '\0') {
+        resp[len] = text[len];
+        len++;
+    }
+    uint32_t check_sum = crc32(resp, len);
+    resp[len++] = ' ';
+    for (uint8_t i = 0; i < 8; i++) {
+        resp[len++] = hex_to_char((check_sum >> ((7 - i) * 4)) & 0x0F);
+    }
+    resp[len++] = '\r';
+    for (uint8_t i = 0; i < len; i++) {
+        parse_trans_rx_byte(resp[i]);
+    }
+}
+
+void trans_cmd_queue_test(void) {
+    uint8_t buf[30];
+
+    // Same text as the send_trans_cmd() formats
+    trans_cmd_t freq_cmd = {.op = TRANS_CMD_WRITE, .reg = 0x01,
+        .num_digits = 8, .value = 0x76620F41, .text = NULL};
+    ASSERT_EQ(format_trans_cmd(&freq_cmd, buf, sizeof(buf)), 16);
+    ASSERT_EQ(string_cmp(buf, "ES+W220176620F41", 17), 1);
+    trans_cmd_t beacon_cmd = {.op = TRANS_CMD_WRITE, .reg = 0xFB,
+        .num_digits = 2, .value = 3, .text = "abc"};
+    ASSERT_EQ(format_trans_cmd(&beacon_cmd, buf, sizeof(buf)), 13);
+    ASSERT_EQ(string_cmp(buf, "ES+W22FB03abc", 14), 1);
+
+    // Read the number of received packets
+    trans_tx_enc_avail = false;
+    trans_cmd_cb_count = 0;
+    ASSERT_TRUE(enqueue_trans_read(0x04, 13, trans_cmd_test_cb));
+    ASSERT_EQ(trans_cmd_count, 1);
+    run_trans_cmds();
+    ASSERT_EQ(trans_cmd_state, TRANS_CMD_WAITING);
+    ASSERT_EQ(trans_cmd_attempts, 1);
+
+    // Nothing happens until the response arrives
+    run_trans_cmds();
+    ASSERT_EQ(trans_cmd_cb_count, 0);
+
+    send_test_trans_cmd_resp("OK+0012345678");
+    ASSERT_TRUE(trans_cmd_resp_avail);
+    run_trans_cmds();
+    ASSERT_EQ(trans_cmd_cb_count, 1);
+    ASSERT_TRUE(trans_cmd_cb_success);
+    ASSERT_EQ(trans_cmd_cb_value, 0x12345678);
+    ASSERT_EQ(trans_cmd_count, 0);
+    ASSERT_EQ(trans_cmd_state, TRANS_CMD_IDLE);
+    ASSERT_FALSE(trans_cmd_resp_avail);
+
+    // No response - tries TRANS_MAX_CMD_ATTEMPTS times, then fails
+    ASSERT_TRUE(enqueue_trans_read(0x05, 13, trans_cmd_test_cb));
+    for (uint8_t i = 0; i < TRANS_MAX_CMD_ATTEMPTS; i++) {
+        run_trans_cmds();
+        ASSERT_EQ(trans_cmd_attempts, i + 1);
+        for (uint8_t j = 0; j < TRANS_CMD_TIMEOUT_S; j++) {
+            trans_uptime_cb();
+        }
+        run_trans_cmds();
+    }
+    ASSERT_EQ(trans_cmd_cb_count, 2);
+    ASSERT_FALSE(trans_cmd_cb_success);
+    ASSERT_EQ(trans_cmd_count, 0);
+
+    // Queue full
+    for (uint8_t i = 0; i < TRANS_CMD_QUEUE_SIZE; i++) {
+        ASSERT_TRUE(enqueue_trans_read(0x04, 13, NULL));
+    }
+    ASSERT_FALSE(enqueue_trans_read(0x04, 13, NULL));
+    trans_cmd_count = 0;
+    trans_cmd_state = TRANS_CMD_IDLE;
+    trans_cmd_attempts = 0;
+    take_events();
+}
+
+// Test that the RF mode is switched to the fast mode when the link is good,
+// back when CRC errors rise, and that the change goes through the command queue
+void trans_link_test(void) {
+    // Manual mode unless nothing is received for a long time
+    trans_rf_auto = false;
+    ASSERT_EQ(next_trans_rf_mode(TRANS_RF_MODE_FAST, 0xFF, 10, 0, 0),
+        TRANS_RF_MODE_FAST);
+    ASSERT_EQ(next_trans_rf_mode(TRANS_RF_MODE_FAST, 0xFF, 0, 0,
+        TRANS_LINK_FALLBACK_S), TRANS_RF_MODE_DEF);
+
+    trans_rf_auto = true;
+    ASSERT_EQ(next_trans_rf_mode(TRANS_RF_MODE_DEF, TRANS_LINK_UP_RSSI,
+        TRANS_LINK_UP_MIN_RX, 0, 0), TRANS_RF_MODE_FAST);
+    ASSERT_EQ(next_trans_rf_mode(TRANS_RF_MODE_DEF, TRANS_LINK_UP_RSSI - 1,
+        TRANS_LINK_UP_MIN_RX, 0, 0), TRANS_RF_MODE_DEF);
+    ASSERT_EQ(next_trans_rf_mode(TRANS_RF_MODE_DEF, TRANS_LINK_UP_RSSI,
+        TRANS_LINK_UP_MIN_RX - 1, 0, 0), TRANS_RF_MODE_DEF);
+    ASSERT_EQ(next_trans_rf_mode(TRANS_RF_MODE_FAST, 0xFF, 8, 2, 0),
+        TRANS_RF_MODE_DEF);
+    ASSERT_EQ(next_trans_rf_mode(TRANS_RF_MODE_FAST, 0xFF, 9, 1, 0),
+        TRANS_RF_MODE_FAST);
+
+    // Two checks - the first one only reads the starting counts
+    trans_tx_enc_avail = false;
+    trans_tx_dec_avail = false;
+    trans_tx_ack_count = 0;
+    trans_tx_ack_msg_avail = false;
+    trans_rf_mode = TRANS_RF_MODE_DEF;
+    const char* rx_resps[2] = {"OK+6000000010", "OK+6000000020"};
+    for (uint8_t i = 0; i < 2; i++) {
+        for (uint8_t j = 0; j < TRANS_LINK_CHECK_PERIOD_S; j++) {
+            trans_uptime_cb();
+        }
+        ASSERT_TRUE(trans_link_check_pending);
+        run_trans_link();
+        ASSERT_EQ(trans_cmd_count, 2);
+
+        run_trans_cmds();
+        send_test_trans_cmd_resp(rx_resps[i]);
+        run_trans_cmds();
+        run_trans_cmds();
+        send_test_trans_cmd_resp("OK+6000000000");
+        run_trans_cmds();
+        ASSERT_EQ(trans_cmd_count, 0);
+    }
+    ASSERT_EQ(trans_link_rssi, 0x60);
+    ASSERT_EQ(trans_rf_mode_req, TRANS_RF_MODE_FAST);
+
+    // Waits until the downlink is idle
+    trans_tx_dec_avail = true;
+    run_trans_link();
+    ASSERT_EQ(trans_cmd_count, 0);
+    trans_tx_dec_avail = false;
+
+    // Read the status register, then write it with the new mode bits
+    run_trans_link();
+    ASSERT_EQ(trans_cmd_count, 1);
+    run_trans_cmds();
+    send_test_trans_cmd_resp("OK+6022DD0303");
+    run_trans_cmds();
+    ASSERT_EQ(trans_cmd_count, 1);
+    ASSERT_EQ(trans_cmd_queue[trans_cmd_head].op, TRANS_CMD_WRITE);
+    ASSERT_EQ(trans_cmd_queue[trans_cmd_head].value,
+        0x0003 | (TRANS_RF_MODE_FAST << TRANS_RF_MODE));
+    ASSERT_EQ(trans_rf_mode, TRANS_RF_MODE_DEF);
+    run_trans_cmds();
+    send_test_trans_cmd_resp("OK+0503");
+    run_trans_cmds();
+    ASSERT_EQ(trans_cmd_count, 0);
+    ASSERT_EQ(trans_rf_mode, TRANS_RF_MODE_FAST);
+    ASSERT_EQ(trans_rf_mode_req, TRANS_RF_MODE_NONE);
+
+    trans_rf_auto = false;
+    trans_rf_mode = TRANS_RF_MODE_DEF;
+    take_events();
+}
+
+
+#ifdef TRANS_ENCODING_BENCHMARK
+
+// Timer 1 settings, saved while it counts CPU cycles
+uint8_t bench_tccr1a = 0;
+uint8_t bench_tccr1b = 0;
+uint8_t bench_timsk1 = 0;
+uint16_t bench_ocr1a = 0;
+// Cycles measured for an empty BENCH()
+uint16_t bench_overhead = 0;
+
+// Runs `code` and sets `cycles` to the number of CPU cycles it took, or 0xFFFF
+// if it took too long for the 16-bit timer
+#define BENCH(cycles, code) \
+    do { \
+        TCNT1 = 0; \
+        TIFR1 = _BV(TOV1); \
+        code; \
+        uint16_t bench_end = TCNT1; \
+        if (TIFR1 & _BV(TOV1)) { \
+            (cycles) = 0xFFFF; \
+        } else { \
+            (cycles) = bench_end - bench_overhead; \
+        } \
+    } while (0)
+
+// Makes timer 1 count every CPU cycle from 0 to 0xFFFF (this stops the uptime
+// timer, and PROF_ATOMIC_BLOCK then measures in cycles)
+void start_bench(void) {
+    bench_tccr1a = TCCR1A;
+    bench_tccr1b = TCCR1B;
+    bench_timsk1 = TIMSK1;
+    bench_ocr1a = OCR1A;
+
+    TIMSK1 = 0;
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10);
+    OCR1A = 0xFFFF;
+
+    bench_overhead = 0;
+    uint16_t overhead = 0;
+    BENCH(overhead, );
+    bench_overhead = overhead;
+}
+
+void stop_bench(void) {
+    TCCR1A = bench_tccr1a;
+    TCCR1B = bench_tccr1b;
+    OCR1A = bench_ocr1a;
+    TCNT1 = 0;
+    TIMSK1 = bench_timsk1;
+}
+
+// Sets a single command (ping) in trans_rx_dec_msg at `offset`
+void set_bench_cmd(uint8_t offset, uint16_t cmd_id, uint8_t len) {
+    trans_rx_dec_msg[offset + 0] = (cmd_id >> 8) & 0xFF;
+    trans_rx_dec_msg[offset + 1] = cmd_id & 0xFF;
+    trans_rx_dec_msg[offset + 2] = CMD_PING_OBC;
+    for (uint8_t i = 3; i < len; i++) {
+        trans_rx_dec_msg[offset + i] = 0;
+    }
+}
+
+/*
+Measures the radio path in CPU cycles per call, for every decoded message
+    length from 3 to TRANS_TX_DEC_MSG_MAX_SIZE (decoding and the RX parser only
+    up to TRANS_RX_DEC_MSG_MAX_SIZE, the longest uplink message).
+Prints one CSV line per measurement so builds can be compared:
+    BENCH,<function>,<length>,<cycles>
+- rx_cb is the average per byte and rx_cb_max is the longest byte (the UART RX
+    callback runs with interrupts off)
+- atomic_max is the longest PROF_ATOMIC_BLOCK (only with PROFILER defined)
+*/
+void benchmark_test(void) {
+    uint8_t msg[TRANS_TX_DEC_MSG_MAX_SIZE];
+    uint16_t cycles = 0;
+
+    print("BENCH,function,length,cycles\n");
+    start_bench();
+#ifdef PROFILER
+    reset_prof();
+#endif
+
+    for (uint8_t len = 3; len <= TRANS_TX_DEC_MSG_MAX_SIZE; len++) {
+        for (uint8_t i = 0; i < len; i++) {
+            msg[i] = rand() & 0xFF;
+        }
+
+        BENCH(cycles, crc32(msg, len));
+        print("BENCH,crc32,%u,%u\n", len, cycles);
+
+        // Encode (the checksum is partly calculated as bytes are appended)
+        start_trans_tx_dec_msg();
+        for (uint8_t i = 0; i < len; i++) {
+            append_to_trans_tx_dec_msg(msg[i]);
+        }
+        trans_tx_dec_avail = true;
+        trans_tx_enc_avail = false;
+        trans_tx_ack_msg_avail = false;
+        BENCH(cycles, encode_trans_tx_msg());
+        print("BENCH,encode_trans_tx_msg,%u,%u\n", len, cycles);
+        trans_tx_enc_avail = false;
+
+        if (len > TRANS_RX_DEC_MSG_MAX_SIZE) {
+            continue;
+        }
+
+        // Feed the encoded message back through the RX parser one byte at a
+        // time, as the UART interrupt does
+        reset_trans_rx_parser();
+        uint32_t total = 0;
+        uint16_t max = 0;
+        for (uint8_t i = 0; i < trans_tx_enc_len; i++) {
+            uint8_t byte = trans_tx_enc_msg[i];
+            BENCH(cycles, trans_uart_rx_cb(&byte, 1));
+            total += cycles;
+            if (cycles > max) {
+                max = cycles;
+            }
+        }
+        print("BENCH,rx_cb,%u,%u\n", len, (uint16_t) (total / trans_tx_enc_len));
+        print("BENCH,rx_cb_max,%u,%u\n", len, max);
+
+        BENCH(cycles, decode_trans_rx_msg());
+        print("BENCH,decode_trans_rx_msg,%u,%u\n", len, cycles);
+        trans_rx_dec_avail = false;
+    }
+
+    // Handling a single command and a full batch
+    init_cmd_queue();
+    trans_last_cmd_id = 0;
+    set_bench_cmd(0, 0x01, CMD_SINGLE_MSG_LEN);
+    trans_rx_dec_len = CMD_SINGLE_MSG_LEN;
+    trans_rx_dec_avail = true;
+    BENCH(cycles, handle_trans_rx_dec_msg());
+    print("BENCH,handle_trans_rx_dec_msg,%u,%u\n", trans_rx_dec_len, cycles);
+
+    trans_rx_dec_msg[0] = (CMD_BATCH_CMD_ID >> 8) & 0xFF;
+    trans_rx_dec_msg[1] = CMD_BATCH_CMD_ID & 0xFF;
+    trans_rx_dec_msg[2] = CMD_BATCH_MAX_CMDS;
+    for (uint8_t i = 3; i < CMD_BATCH_HEADER_LEN; i++) {
+        trans_rx_dec_msg[i] = 0;
+    }
+    for (uint8_t i = 0; i < CMD_BATCH_MAX_CMDS; i++) {
+        set_bench_cmd(CMD_BATCH_HEADER_LEN + (i * CMD_BATCH_CMD_LEN), 0x02 + i,
+            CMD_BATCH_CMD_LEN);
+    }
+    trans_rx_dec_len = CMD_BATCH_HEADER_LEN + (CMD_BATCH_MAX_CMDS * CMD_BATCH_CMD_LEN);
+    trans_rx_dec_avail = true;
+    BENCH(cycles, handle_trans_rx_dec_msg());
+    print("BENCH,handle_trans_rx_dec_msg,%u,%u\n", trans_rx_dec_len, cycles);
+
+#ifdef PROFILER
+    print("BENCH,atomic_max,0,%u\n", prof_atomic_max_ticks);
+#endif
+    stop_bench();
+
+    init_cmd_queue();
+    trans_last_cmd_id = 0;
+    trans_tx_ack_count = 0;
+    trans_tx_ack_msg_avail = false;
+    trans_tx_dec_avail = false;
+    take_events();
+}
+
+#endif
+
+
 test_t t1 = {.name = "decode_trans_rx_msg_test", .fn = decode_trans_rx_msg_test};
 test_t t2 = {.name = "encode_trans_tx_msg_test", .fn = encode_trans_tx_msg_test};
 test_t t3 = {.name = "random_encode_decode_test", .fn = random_encode_decode_test};
 test_t t4 = {.name = "checksum_test", .fn = checksum_test};
-
-
-test_t* suite[] = { &t1, &t2, &t3, &t4};
+test_t t5 = {.name = "incremental_checksum_test", .fn = incremental_checksum_test};
+test_t t6 = {.name = "send_state_test", .fn = send_state_test};
+test_t t7 = {.name = "rx_parser_test", .fn = rx_parser_test};
+test_t t8 = {.name = "trans_cmd_queue_test", .fn = trans_cmd_queue_test};
+test_t t9 = {.name = "trans_link_test", .fn = trans_link_test};
+#ifdef TRANS_ENCODING_BENCHMARK
+test_t t10 = {.name = "benchmark_test", .fn = benchmark_test};
+#endif
+
+
+test_t* suite[] = { &t1, &t2, &t3, &t4, &t5, &t6, &t7, &t8, &t9,
+#ifdef TRANS_ENCODING_BENCHMARK
+    &t10
+#endif
+};
 
 int main(void) {
     run_tests(suite, sizeof(suite) / sizeof(suite[0]));
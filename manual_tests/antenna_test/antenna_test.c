@@ -42,6 +42,7 @@ int main(void) {
     init_spi();
     init_i2c();
     init_ant();
+    init_uptime();
     
     WDT_OFF();
     WDT_ENABLE_SYS_RESET(WDTO_8S);
@@ -54,6 +55,12 @@ int main(void) {
     // test_i2c_read();
     // test_i2c_write();
 
-    deploy_antenna();
+    // Run the deployment like the main loop would
+    start_ant_dep();
+    while (ant_dep.state != ANT_DEP_STATE_DONE) {
+        WDT_ENABLE_SYS_RESET(WDTO_8S);
+        run_i2c();
+        run_ant_dep();
+    }
     WDT_OFF();
 }
@@ -88,6 +88,33 @@ void test_read_single(void) {
     print_string(read, 5);
 }
 
+void async_write_cb(bool success, uint8_t status, uint8_t* data, uint8_t len) {
+    print("Async write: success = %u, status = %02x\n", success, status);
+}
+
+void async_read_cb(bool success, uint8_t status, uint8_t* data, uint8_t len) {
+    print("Async read: success = %u, status = %02x\n", success, status);
+    print_bytes(data, len);
+    print_string(data, len);
+}
+
+// Queues a write and a read, then runs the queue like the main loop would
+void test_async(void) {
+    uint8_t write[3] = { 'G', 'H', 'I' };
+
+    print("\n");
+    print("Async writing 'GHI' and reading 5 bytes\n");
+    enqueue_i2c_write(SLAVE_ADDR, write, 3, async_write_cb);
+    enqueue_i2c_read(SLAVE_ADDR, 5, async_read_cb);
+
+    uint32_t passes = 0;
+    while (!i2c_trans_idle()) {
+        run_i2c();
+        passes++;
+    }
+    print("Done after %lu passes\n", passes);
+}
+
 void test_write_read_inf(void) {
     while (1) {
         test_write_single();
@@ -100,6 +127,7 @@ void test_write_read_inf(void) {
 int main(void) {
     init_uart();
     init_spi();
+    init_uptime();
     
     print("\n\n\nStarting I2C test\n\n");
 
@@ -107,6 +135,7 @@ int main(void) {
     print_all_regs();
 
     test_power_down();
+    test_async();
     test_write_read_inf();
 
     print("\nDone I2C test\n\n\n");
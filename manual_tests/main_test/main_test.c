@@ -162,8 +162,8 @@ void sim_send_next_eps_tx_msg(void) {
 
     rx_msg[2] = rx_status;
 
-    // print("Enqueued to data_rx_msg_queue\n");
-    enqueue(&data_rx_msg_queue, rx_msg);
+    // print("Received CAN message\n");
+    cmd_rx_callback(rx_msg, 8);
 }
 
 // Simulates sending a PAY TX message and getting a response back
@@ -265,8 +265,8 @@ void sim_send_next_pay_tx_msg(void) {
 
     rx_msg[2] = rx_status;
 
-    // print("Enqueued to data_rx_msg_queue\n");
-    enqueue(&data_rx_msg_queue, rx_msg);
+    // print("Received CAN message\n");
+    cmd_rx_callback(rx_msg, 8);
 }
 
 
@@ -347,7 +347,7 @@ int main(void){
             run_hb();
         }
 
-        run_auto_data_col();
+        run_sched();
 
         // Trans RX (encoded)
         decode_trans_rx_msg();
@@ -363,6 +363,7 @@ int main(void){
 
         // Command
         execute_next_cmd();
+        run_cmd_log();
 
         // EPS TX
         // Either simulate EPS over CAN or actually send the CAN message
@@ -382,6 +383,7 @@ int main(void){
 
         // EPS/PAY RX
         process_next_rx_msg();
+        run_data_cols();
 
         // Trans TX (decoded)
         encode_trans_tx_msg();
@@ -69,7 +69,7 @@ void test_standard_message(uint8_t msg_type, uint32_t arg1, uint32_t arg2) {
     print_decoded();
     encode_trans_tx_msg();
     print_encoded();
-    send_trans_tx_enc_msg();
+    flush_trans_tx_enc_msg();
     print("\n");
     // print_decoded();
     // print_encoded();
@@ -81,7 +81,7 @@ void test_string_message(char* string) {
     print_decoded();
     encode_trans_tx_msg();
     print_encoded();
-    send_trans_tx_enc_msg();
+    flush_trans_tx_enc_msg();
     print("\n");
     // print_decoded();
     // print_encoded();
@@ -96,7 +96,7 @@ void test_enc_message(char* string) {
     trans_tx_enc_avail = true;
 
     print_encoded();
-    send_trans_tx_enc_msg();
+    flush_trans_tx_enc_msg();
     print("\n");
 }
 
@@ -0,0 +1,384 @@
+/*
+Simulation core - virtual clock, events and interrupts, command line and the
+    report at the end of a run
+
+There are two queues of events (ordered by time, then by when they were
+    scheduled):
+- device events (e.g. a byte reaching the transceiver, a packet reaching the
+  ground station) run as soon as the clock passes their time
+- interrupt events (e.g. a received UART byte, the uptime timer) call OBC
+  callbacks, so they only run when interrupts are enabled and no other ISR is
+  running, like on the MCU
+
+The main() here replaces the OBC's main(), which is compiled as obc_main().
+*/
+
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sim.h"
+
+typedef struct {
+    uint64_t at_ns;
+    uint64_t seq;
+    sim_event_fn_t fn;
+    uintptr_t arg;
+} sim_event_t;
+
+typedef struct {
+    sim_event_t* events;
+    uint32_t count;
+    uint32_t size;
+} sim_heap_t;
+
+sim_opts_t sim_opts = {
+    .duration_ns = 600 * SIM_NS_PER_S,
+    .seed = 1,
+    .ground_start_ns = 10 * SIM_NS_PER_S,
+    .ground_gap_ns = 500 * SIM_NS_PER_MS,
+    .ground_window = 1,
+    .ground_timeout_ns = 30 * SIM_NS_PER_S,
+    .fault_prob = 0.0,
+    .script = NULL,
+    .verbose = false,
+};
+
+// Current simulated time
+uint64_t sim_ns = 0;
+// True while an interrupt event is running
+bool sim_in_isr = false;
+volatile uint8_t sim_irq_enabled = 0;
+
+static sim_heap_t sim_dev_events = { NULL, 0, 0 };
+static sim_heap_t sim_irq_events = { NULL, 0, 0 };
+static uint64_t sim_event_seq = 0;
+static uint64_t sim_rand_state = 1;
+// Time spent in sleep_cpu()
+static uint64_t sim_sleep_ns = 0;
+static uint64_t sim_irq_count = 0;
+static clock_t sim_host_start = 0;
+
+int obc_main(void);
+
+
+static bool sim_event_before(const sim_event_t* a, const sim_event_t* b) {
+    if (a->at_ns != b->at_ns) {
+        return a->at_ns < b->at_ns;
+    }
+    return a->seq < b->seq;
+}
+
+static void sim_heap_push(sim_heap_t* heap, sim_event_t event) {
+    if (heap->count == heap->size) {
+        heap->size = (heap->size == 0) ? 64 : heap->size * 2;
+        heap->events = realloc(heap->events, heap->size * sizeof(sim_event_t));
+        if (heap->events == NULL) {
+            fprintf(stderr, "sim: out of memory\n");
+            exit(1);
+        }
+    }
+
+    uint32_t i = heap->count++;
+    heap->events[i] = event;
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (!sim_event_before(&heap->events[i], &heap->events[parent])) {
+            break;
+        }
+        sim_event_t tmp = heap->events[parent];
+        heap->events[parent] = heap->events[i];
+        heap->events[i] = tmp;
+        i = parent;
+    }
+}
+
+static sim_event_t sim_heap_pop(sim_heap_t* heap) {
+    sim_event_t top = heap->events[0];
+    heap->events[0] = heap->events[--heap->count];
+
+    uint32_t i = 0;
+    while (1) {
+        uint32_t left = (2 * i) + 1;
+        uint32_t right = left + 1;
+        uint32_t min = i;
+        if (left < heap->count &&
+                sim_event_before(&heap->events[left], &heap->events[min])) {
+            min = left;
+        }
+        if (right < heap->count &&
+                sim_event_before(&heap->events[right], &heap->events[min])) {
+            min = right;
+        }
+        if (min == i) {
+            break;
+        }
+        sim_event_t tmp = heap->events[min];
+        heap->events[min] = heap->events[i];
+        heap->events[i] = tmp;
+        i = min;
+    }
+
+    return top;
+}
+
+static bool sim_heap_due(const sim_heap_t* heap, uint64_t ns) {
+    return heap->count > 0 && heap->events[0].at_ns <= ns;
+}
+
+/*
+Schedules `fn(arg)` to run at `at_ns` (or as soon as possible if that is in
+    the past).
+type - SIM_EVENT_DEVICE or SIM_EVENT_IRQ
+*/
+void sim_schedule(uint64_t at_ns, uint8_t type, sim_event_fn_t fn, uintptr_t arg) {
+    sim_event_t event = { at_ns, sim_event_seq++, fn, arg };
+    sim_heap_push((type == SIM_EVENT_IRQ) ? &sim_irq_events : &sim_dev_events,
+        event);
+}
+
+/*
+Runs all events that are due and allowed to run now.
+*/
+static void sim_run_due(void) {
+    while (sim_heap_due(&sim_dev_events, sim_ns)) {
+        sim_event_t event = sim_heap_pop(&sim_dev_events);
+        event.fn(event.arg);
+    }
+
+    if (!sim_irq_enabled || sim_in_isr) {
+        return;
+    }
+
+    while (sim_heap_due(&sim_irq_events, sim_ns)) {
+        sim_event_t event = sim_heap_pop(&sim_irq_events);
+        // The I bit is cleared while an ISR runs
+        sim_in_isr = true;
+        sim_irq_enabled = 0;
+        sim_irq_count++;
+        event.fn(event.arg);
+        sim_irq_enabled = 1;
+        sim_in_isr = false;
+
+        // Device events scheduled by the ISR
+        while (sim_heap_due(&sim_dev_events, sim_ns)) {
+            sim_event_t dev_event = sim_heap_pop(&sim_dev_events);
+            dev_event.fn(dev_event.arg);
+        }
+    }
+}
+
+/*
+Advances the clock by `ns` (the OBC is busy waiting for that long) and runs the
+    events that became due.
+*/
+void sim_advance(uint64_t ns) {
+    sim_ns += ns;
+    if (sim_ns >= sim_opts.duration_ns) {
+        sim_finish("end of simulated time");
+    }
+    sim_run_due();
+}
+
+void sim_advance_cycles(uint32_t cycles) {
+    sim_advance(cycles * SIM_CYCLE_NS);
+}
+
+/*
+Idle sleep - skips ahead through the device events to the next interrupt.
+*/
+void sim_sleep_cpu(void) {
+    if (!sim_irq_enabled) {
+        sim_finish("sleep with interrupts disabled (would never wake up)");
+    }
+
+    sim_check_timer1_compb();
+
+    uint64_t start = sim_ns;
+    while (1) {
+        if (sim_irq_events.count == 0 && sim_dev_events.count == 0) {
+            sim_finish("sleep with no interrupts left to wake up");
+        }
+
+        bool irq_next = sim_irq_events.count > 0 &&
+            (sim_dev_events.count == 0 ||
+            !sim_event_before(&sim_dev_events.events[0],
+                &sim_irq_events.events[0]));
+        uint64_t next = irq_next ?
+            sim_irq_events.events[0].at_ns : sim_dev_events.events[0].at_ns;
+        if (next > sim_ns) {
+            if (next >= sim_opts.duration_ns) {
+                sim_sleep_ns += sim_opts.duration_ns - start;
+                sim_ns = sim_opts.duration_ns;
+                sim_finish("end of simulated time");
+            }
+            sim_ns = next;
+        }
+
+        sim_run_due();
+        if (irq_next) {
+            break;
+        }
+    }
+    sim_sleep_ns += sim_ns - start;
+}
+
+void sim_cli(void) {
+    sim_irq_enabled = 0;
+}
+
+void sim_sei(void) {
+    // Like the MCU, the instruction after sei() (e.g. sleep_cpu()) runs
+    // before any pending interrupt
+    sim_irq_enabled = 1;
+}
+
+uint8_t sim_irq_save(void) {
+    return sim_irq_enabled;
+}
+
+// Cleanup function for ATOMIC_RESTORESTATE
+void sim_irq_restore(const uint8_t* saved) {
+    sim_irq_enabled = *saved;
+    if (sim_irq_enabled) {
+        sim_run_due();
+    }
+}
+
+// Cleanup function for ATOMIC_FORCEON
+void sim_irq_force_on(const uint8_t* unused) {
+    (void) unused;
+    sim_irq_enabled = 1;
+    sim_run_due();
+}
+
+// Cleanup function for NONATOMIC_FORCEOFF
+void sim_irq_force_off(const uint8_t* unused) {
+    (void) unused;
+    sim_irq_enabled = 0;
+}
+
+// xorshift64*
+uint64_t sim_rand(void) {
+    sim_rand_state ^= sim_rand_state >> 12;
+    sim_rand_state ^= sim_rand_state << 25;
+    sim_rand_state ^= sim_rand_state >> 27;
+    return sim_rand_state * 0x2545F4914F6CDD1DULL;
+}
+
+// Uniform in [0, 1)
+double sim_rand_unit(void) {
+    return (sim_rand() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+Prints the report and exits.
+*/
+void sim_finish(const char* reason) {
+    static bool finishing = false;
+    if (finishing) {
+        return;
+    }
+    finishing = true;
+
+    double host_s = (double) (clock() - sim_host_start) / CLOCKS_PER_SEC;
+    double sim_s = (double) sim_ns / SIM_NS_PER_S;
+
+    FILE* out = stdout;
+    fflush(stderr);
+    fprintf(out, "\n==== OBC simulation report ====\n");
+    fprintf(out, "Stopped: %s\n", reason);
+    fprintf(out, "Simulated time: %.3f s (host CPU time %.3f s, %.1fx real time)\n",
+        sim_s, host_s, (host_s > 0) ? (sim_s / host_s) : 0.0);
+    fprintf(out, "Idle sleep: %.1f%% of the time, %llu interrupts\n",
+        (sim_ns > 0) ? (100.0 * sim_sleep_ns / sim_ns) : 0.0,
+        (unsigned long long) sim_irq_count);
+
+    sim_report_mcu(out);
+    sim_report_ground(out);
+    sim_report_trans(out);
+    sim_report_bus(out);
+    sim_report_ssm(out);
+    sim_report_flash(out);
+    sim_report_devices(out);
+
+    fflush(out);
+    exit(0);
+}
+
+static void sim_usage(const char* prog) {
+    fprintf(stderr,
+        "usage: %s [-t seconds] [-g ms] [-w window] [-T seconds] [-s seed]\n"
+        "          [-f probability] [-x script] [-v]\n"
+        "  -t  simulated time to run for (default %llu s)\n"
+        "  -g  minimum time between ground commands (default %llu ms)\n"
+        "  -w  ground commands in flight at once (default %u)\n"
+        "  -T  ground response timeout (default %llu s)\n"
+        "  -s  random seed (default %llu)\n"
+        "  -f  probability of corrupting an uplink packet or dropping a CAN\n"
+        "      response (default 0)\n"
+        "  -x  ground command script instead of the random command mix, one\n"
+        "      command per line: <time s> <opcode> <arg1> <arg2>\n"
+        "  -v  print the OBC UART output\n",
+        prog,
+        (unsigned long long) (sim_opts.duration_ns / SIM_NS_PER_S),
+        (unsigned long long) (sim_opts.ground_gap_ns / SIM_NS_PER_MS),
+        sim_opts.ground_window,
+        (unsigned long long) (sim_opts.ground_timeout_ns / SIM_NS_PER_S),
+        (unsigned long long) sim_opts.seed);
+}
+
+int main(int argc, char** argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "t:g:w:T:s:f:x:vh")) != -1) {
+        switch (opt) {
+            case 't':
+                sim_opts.duration_ns = (uint64_t) (atof(optarg) * SIM_NS_PER_S);
+                break;
+            case 'g':
+                sim_opts.ground_gap_ns = (uint64_t) (atof(optarg) * SIM_NS_PER_MS);
+                break;
+            case 'w':
+                sim_opts.ground_window = (uint32_t) atoi(optarg);
+                if (sim_opts.ground_window == 0) {
+                    sim_opts.ground_window = 1;
+                }
+                break;
+            case 'T':
+                sim_opts.ground_timeout_ns = (uint64_t) (atof(optarg) * SIM_NS_PER_S);
+                break;
+            case 's':
+                sim_opts.seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'f':
+                sim_opts.fault_prob = atof(optarg);
+                break;
+            case 'x':
+                sim_opts.script = optarg;
+                break;
+            case 'v':
+                sim_opts.verbose = true;
+                break;
+            default:
+                sim_usage(argv[0]);
+                return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    // xorshift can't start from 0
+    sim_rand_state = sim_opts.seed ^ 0x9E3779B97F4A7C15ULL;
+    if (sim_rand_state == 0) {
+        sim_rand_state = 1;
+    }
+    sim_host_start = clock();
+
+    sim_init_mcu();
+    sim_init_flash();
+    sim_init_trans();
+    sim_init_ground();
+
+    obc_main();
+    sim_finish("OBC main() returned");
+    return 0;
+}
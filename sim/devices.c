@@ -0,0 +1,311 @@
+/*
+Simulated RTC (DS3234) and I2C bridge (SC18IS600) on the SPI bus
+
+The RTC counts from 2020-01-01 00:00:00 at the start of the run (in simulated
+    time) and can be set through its time registers.
+
+There are no devices on the simulated I2C bus, so every I2C transaction ends
+    with an address NACK after the time for the address byte. The bridge pulls
+    INT low when it finishes and releases it when the status register is read,
+    with a pin change interrupt (PCINT2) on each edge if the OBC enabled it.
+*/
+
+#include <string.h>
+
+#include <avr/io.h>
+
+#include "sim.h"
+
+#define SIM_RTC_NUM_REGS    0x20
+// Seconds from 2000-01-01 to 2020-01-01
+#define SIM_RTC_START_S     631152000UL
+
+// SC18IS600 commands and registers
+#define SIM_I2C_WRITE       0x00
+#define SIM_I2C_READ        0x01
+#define SIM_I2C_READ_BUF    0x06
+#define SIM_I2C_WRITE_REG   0x20
+#define SIM_I2C_READ_REG    0x21
+#define SIM_I2C_POWER_DOWN  0x30
+#define SIM_I2C_STAT        0x04
+#define SIM_I2C_NUM_REGS    6
+#define SIM_I2C_ADDR_NACK   0xF1
+#define SIM_I2C_BUSY        0xF3
+#define SIM_I2C_IDLE        0xF0
+// Time for the start condition and address byte at 100kHz
+#define SIM_I2C_ADDR_NS     (100 * SIM_NS_PER_US)
+
+// RTC
+static uint8_t sim_rtc_regs[SIM_RTC_NUM_REGS];
+// The time registers are calculated from this and the simulated time
+static uint64_t sim_rtc_base_s = SIM_RTC_START_S;
+static uint64_t sim_rtc_base_ns = 0;
+static bool sim_rtc_selected = false;
+static uint32_t sim_rtc_pos = 0;
+static uint8_t sim_rtc_addr = 0;
+static bool sim_rtc_write = false;
+static uint8_t sim_rtc_time_regs[7];
+static bool sim_rtc_time_written = false;
+static uint64_t sim_rtc_reads = 0;
+static uint64_t sim_rtc_writes = 0;
+static uint64_t sim_rtc_bad_mode = 0;
+
+// I2C bridge
+static uint8_t sim_i2c_regs[SIM_I2C_NUM_REGS] = { 0x00, 0x00, 0x19, 0xFE, SIM_I2C_IDLE, 0x00 };
+static bool sim_i2c_selected = false;
+static uint32_t sim_i2c_pos = 0;
+static uint8_t sim_i2c_cmd = 0;
+static uint8_t sim_i2c_reg = 0;
+static bool sim_i2c_int = false;
+static uint64_t sim_i2c_transactions = 0;
+static uint64_t sim_i2c_interrupts = 0;
+static uint64_t sim_i2c_bad_mode = 0;
+
+void PCINT2_vect(void) __attribute__((weak));
+
+
+static uint8_t sim_to_bcd(uint32_t value) {
+    return (uint8_t) (((value / 10) << 4) | (value % 10));
+}
+
+static uint32_t sim_from_bcd(uint8_t value) {
+    return ((value >> 4) * 10) + (value & 0x0F);
+}
+
+static bool sim_leap_year(uint32_t year) {
+    return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+static uint32_t sim_days_in_month(uint32_t year, uint32_t month) {
+    static const uint8_t days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    if (month == 2 && sim_leap_year(year)) {
+        return 29;
+    }
+    return days[month - 1];
+}
+
+static uint64_t sim_rtc_now_s(void) {
+    return sim_rtc_base_s + ((sim_ns - sim_rtc_base_ns) / SIM_NS_PER_S);
+}
+
+// Fills regs (0x00-0x06) with the BCD time for `s` seconds since 2000
+static void sim_rtc_to_regs(uint64_t s, uint8_t* regs) {
+    uint32_t days = (uint32_t) (s / 86400);
+    uint32_t secs = (uint32_t) (s % 86400);
+    // 2000-01-01 was a Saturday (day 7, with Sunday as 1)
+    uint32_t weekday = ((days + 6) % 7) + 1;
+
+    uint32_t year = 2000;
+    while (days >= (sim_leap_year(year) ? 366U : 365U)) {
+        days -= sim_leap_year(year) ? 366 : 365;
+        year++;
+    }
+    uint32_t month = 1;
+    while (days >= sim_days_in_month(year, month)) {
+        days -= sim_days_in_month(year, month);
+        month++;
+    }
+
+    regs[0] = sim_to_bcd(secs % 60);
+    regs[1] = sim_to_bcd((secs / 60) % 60);
+    regs[2] = sim_to_bcd(secs / 3600);
+    regs[3] = sim_to_bcd(weekday);
+    regs[4] = sim_to_bcd(days + 1);
+    regs[5] = sim_to_bcd(month);
+    regs[6] = sim_to_bcd(year % 100);
+}
+
+static uint64_t sim_rtc_from_regs(const uint8_t* regs) {
+    uint32_t year = 2000 + sim_from_bcd(regs[6]);
+    uint32_t month = sim_from_bcd(regs[5] & 0x1F);
+    uint32_t day = sim_from_bcd(regs[4]);
+    if (month < 1 || month > 12) {
+        month = 1;
+    }
+    if (day < 1) {
+        day = 1;
+    }
+
+    uint64_t days = 0;
+    for (uint32_t y = 2000; y < year; y++) {
+        days += sim_leap_year(y) ? 366 : 365;
+    }
+    for (uint32_t m = 1; m < month; m++) {
+        days += sim_days_in_month(year, m);
+    }
+    days += day - 1;
+
+    return (days * 86400) + (sim_from_bcd(regs[2] & 0x3F) * 3600) +
+        (sim_from_bcd(regs[1]) * 60) + sim_from_bcd(regs[0]);
+}
+
+void sim_rtc_select(bool selected) {
+    if (selected == sim_rtc_selected) {
+        return;
+    }
+    sim_rtc_selected = selected;
+    sim_rtc_pos = 0;
+
+    if (selected) {
+        // The time registers are latched when the transfer starts
+        sim_rtc_to_regs(sim_rtc_now_s(), sim_rtc_time_regs);
+        sim_rtc_time_written = false;
+    } else if (sim_rtc_time_written) {
+        // Writing any time register restarts the count from the new time
+        sim_rtc_base_s = sim_rtc_from_regs(sim_rtc_time_regs);
+        sim_rtc_base_ns = sim_ns;
+    }
+}
+
+uint8_t sim_rtc_spi(uint8_t mode, uint8_t byte) {
+    // DS3234 supports modes 1 and 3
+    if (mode != 1 && mode != 3) {
+        sim_rtc_bad_mode++;
+        return 0xFF;
+    }
+
+    uint32_t pos = sim_rtc_pos++;
+    if (pos == 0) {
+        sim_rtc_write = (byte & 0x80) != 0;
+        sim_rtc_addr = byte & 0x7F;
+        return 0xFF;
+    }
+
+    // Auto-increments (wraps at the end of the registers)
+    uint8_t addr = sim_rtc_addr % SIM_RTC_NUM_REGS;
+    sim_rtc_addr = (sim_rtc_addr + 1) % SIM_RTC_NUM_REGS;
+
+    if (sim_rtc_write) {
+        sim_rtc_writes++;
+        if (addr < 7) {
+            sim_rtc_time_regs[addr] = byte;
+            sim_rtc_time_written = true;
+        } else {
+            sim_rtc_regs[addr] = byte;
+        }
+        return 0xFF;
+    }
+
+    sim_rtc_reads++;
+    if (addr < 7) {
+        return sim_rtc_time_regs[addr];
+    }
+    return sim_rtc_regs[addr];
+}
+
+
+static void sim_i2c_isr(uintptr_t arg) {
+    (void) arg;
+    PCINT2_vect();
+}
+
+static void sim_i2c_set_int(bool asserted) {
+    if (asserted == sim_i2c_int) {
+        return;
+    }
+    sim_i2c_int = asserted;
+    if (asserted) {
+        sim_i2c_interrupts++;
+    }
+
+    // Pin change interrupt for PD6
+    if ((PCICR & _BV(PCIE2)) && (PCMSK2 & _BV(6)) && PCINT2_vect != NULL) {
+        sim_schedule(sim_ns, SIM_EVENT_IRQ, sim_i2c_isr, 0);
+    }
+}
+
+// INT pin level (low when asserted)
+bool sim_i2c_int_pin(void) {
+    return !sim_i2c_int;
+}
+
+static void sim_i2c_done(uintptr_t arg) {
+    (void) arg;
+    sim_i2c_regs[SIM_I2C_STAT] = SIM_I2C_ADDR_NACK;
+    sim_i2c_set_int(true);
+}
+
+void sim_i2c_select(bool selected) {
+    if (selected == sim_i2c_selected) {
+        return;
+    }
+    sim_i2c_selected = selected;
+
+    if (selected) {
+        sim_i2c_pos = 0;
+        return;
+    }
+
+    // A write or read to the I2C bus starts when CS goes high
+    if ((sim_i2c_cmd == SIM_I2C_WRITE || sim_i2c_cmd == SIM_I2C_READ) &&
+            sim_i2c_pos >= 3) {
+        sim_i2c_transactions++;
+        sim_i2c_regs[SIM_I2C_STAT] = SIM_I2C_BUSY;
+        sim_i2c_set_int(false);
+        sim_schedule(sim_ns + SIM_I2C_ADDR_NS, SIM_EVENT_DEVICE, sim_i2c_done, 0);
+    }
+}
+
+uint8_t sim_i2c_spi(uint8_t mode, uint8_t byte) {
+    // SC18IS600 only supports mode 3
+    if (mode != 3) {
+        sim_i2c_bad_mode++;
+        return 0xFF;
+    }
+
+    uint32_t pos = sim_i2c_pos++;
+    if (pos == 0) {
+        sim_i2c_cmd = byte;
+        return 0xFF;
+    }
+
+    switch (sim_i2c_cmd) {
+        case SIM_I2C_WRITE_REG:
+            if (pos == 1) {
+                sim_i2c_reg = byte;
+            } else if (pos == 2 && sim_i2c_reg < SIM_I2C_NUM_REGS &&
+                    sim_i2c_reg != SIM_I2C_STAT) {
+                sim_i2c_regs[sim_i2c_reg] = byte;
+            }
+            return 0xFF;
+        case SIM_I2C_READ_REG:
+            if (pos == 1) {
+                sim_i2c_reg = byte;
+                return 0xFF;
+            }
+            if (sim_i2c_reg >= SIM_I2C_NUM_REGS) {
+                return 0xFF;
+            }
+            if (sim_i2c_reg == SIM_I2C_STAT) {
+                // Reading the status clears INT
+                uint8_t stat = sim_i2c_regs[SIM_I2C_STAT];
+                sim_i2c_set_int(false);
+                return stat;
+            }
+            return sim_i2c_regs[sim_i2c_reg];
+        case SIM_I2C_READ_BUF:
+            // Nothing was read from the bus
+            return 0x00;
+        default:
+            return 0xFF;
+    }
+}
+
+void sim_report_devices(FILE* out) {
+    uint8_t regs[7];
+    sim_rtc_to_regs(sim_rtc_now_s(), regs);
+    fprintf(out, "\n-- RTC --\n");
+    fprintf(out, "Time: 20%02x-%02x-%02x %02x:%02x:%02x, %llu register reads, "
+        "%llu writes, %llu wrong SPI mode\n",
+        regs[6], regs[5], regs[4], regs[2], regs[1], regs[0],
+        (unsigned long long) sim_rtc_reads,
+        (unsigned long long) sim_rtc_writes,
+        (unsigned long long) sim_rtc_bad_mode);
+
+    fprintf(out, "\n-- I2C bridge --\n");
+    fprintf(out, "Transactions: %llu (all NACKed, no devices), %llu interrupts, "
+        "%llu wrong SPI mode\n",
+        (unsigned long long) sim_i2c_transactions,
+        (unsigned long long) sim_i2c_interrupts,
+        (unsigned long long) sim_i2c_bad_mode);
+}
@@ -0,0 +1,348 @@
+/*
+Simulated flash memory - 3 SST26VF016B chips (2MB each) on the SPI bus
+
+Commands used by mem.c are supported, with the datasheet's maximum program and
+    erase times. The status register's BUSY bit is set during a program or
+    erase, and any other command sent while a chip is busy is ignored and
+    counted as a violation (the OBC must poll the status first). Programming
+    can only clear bits, so writing over data that was not erased is counted
+    too.
+
+Like the real chips, all blocks are write-protected after power-on until the
+    global block protection unlock command.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+#define SIM_FLASH_NUM_CHIPS     3
+#define SIM_FLASH_CHIP_SIZE     (1UL << 21)
+#define SIM_FLASH_PAGE_SIZE     256
+#define SIM_FLASH_SECTOR_SIZE   4096
+
+// Maximum times (SST26VF016B datasheet, p. 47)
+#define SIM_FLASH_PP_NS         (1500 * SIM_NS_PER_US)
+#define SIM_FLASH_SE_NS         (25 * SIM_NS_PER_MS)
+#define SIM_FLASH_BE_NS         (25 * SIM_NS_PER_MS)
+#define SIM_FLASH_CE_NS         (50 * SIM_NS_PER_MS)
+
+#define SIM_FLASH_RDSR      0x05
+#define SIM_FLASH_WRSR      0x01
+#define SIM_FLASH_WREN      0x06
+#define SIM_FLASH_WRDI      0x04
+#define SIM_FLASH_READ      0x03
+#define SIM_FLASH_FAST_READ 0x0B
+#define SIM_FLASH_PP        0x02
+#define SIM_FLASH_SE        0x20
+#define SIM_FLASH_BE        0xD8
+#define SIM_FLASH_CE        0xC7
+#define SIM_FLASH_ULBPR     0x98
+#define SIM_FLASH_RSTEN     0x66
+#define SIM_FLASH_RST       0x99
+
+typedef struct {
+    uint8_t* data;
+    bool selected;
+    // Number of bytes received since CS went low
+    uint32_t pos;
+    uint8_t cmd;
+    uint32_t addr;
+    bool wel;
+    bool locked;
+    bool rst_enabled;
+    uint64_t busy_until_ns;
+    // Page program buffer (written when CS goes high)
+    uint8_t page[SIM_FLASH_PAGE_SIZE];
+    bool page_used[SIM_FLASH_PAGE_SIZE];
+    uint32_t page_count;
+} sim_flash_chip_t;
+
+typedef struct {
+    uint64_t read_bytes;
+    uint64_t fast_read_bytes;
+    uint64_t programs;
+    uint64_t programmed_bytes;
+    uint64_t sector_erases;
+    uint64_t block_erases;
+    uint64_t chip_erases;
+    uint64_t status_polls;
+    uint64_t busy_violations;
+    uint64_t not_erased_writes;
+    uint64_t locked_writes;
+    uint64_t no_wel;
+    uint64_t bad_mode;
+    uint64_t busy_ns;
+} sim_flash_stats_t;
+
+static sim_flash_chip_t sim_flash_chips[SIM_FLASH_NUM_CHIPS];
+static sim_flash_stats_t sim_flash_stats;
+
+
+void sim_init_flash(void) {
+    for (uint8_t i = 0; i < SIM_FLASH_NUM_CHIPS; i++) {
+        sim_flash_chip_t* chip = &sim_flash_chips[i];
+        memset(chip, 0, sizeof(*chip));
+        chip->data = malloc(SIM_FLASH_CHIP_SIZE);
+        if (chip->data == NULL) {
+            fprintf(stderr, "sim: out of memory\n");
+            exit(1);
+        }
+        memset(chip->data, 0xFF, SIM_FLASH_CHIP_SIZE);
+        chip->locked = true;
+    }
+}
+
+static bool sim_flash_busy(const sim_flash_chip_t* chip) {
+    return sim_ns < chip->busy_until_ns;
+}
+
+static void sim_flash_start_busy(sim_flash_chip_t* chip, uint64_t ns) {
+    chip->busy_until_ns = sim_ns + ns;
+    chip->wel = false;
+    sim_flash_stats.busy_ns += ns;
+}
+
+/*
+Returns the start and size of the erase block containing `addr` - 8KB blocks
+    in the 32KB at each end, then one 32KB block, and 64KB blocks in between.
+*/
+static void sim_flash_block(uint32_t addr, uint32_t* start, uint32_t* size) {
+    if (addr < 0x8000 || addr >= SIM_FLASH_CHIP_SIZE - 0x8000) {
+        *size = 0x2000;
+    } else if (addr < 0x10000 || addr >= SIM_FLASH_CHIP_SIZE - 0x10000) {
+        *size = 0x8000;
+    } else {
+        *size = 0x10000;
+    }
+    *start = addr & ~(*size - 1);
+}
+
+// Checks the conditions for a program/erase, returns true if it can start
+static bool sim_flash_can_write(sim_flash_chip_t* chip) {
+    if (!chip->wel) {
+        sim_flash_stats.no_wel++;
+        return false;
+    }
+    if (chip->locked) {
+        sim_flash_stats.locked_writes++;
+        chip->wel = false;
+        return false;
+    }
+    return true;
+}
+
+static void sim_flash_erase(sim_flash_chip_t* chip, uint32_t start,
+        uint32_t size, uint64_t ns) {
+    memset(&chip->data[start], 0xFF, size);
+    sim_flash_start_busy(chip, ns);
+}
+
+static void sim_flash_program(sim_flash_chip_t* chip) {
+    uint32_t page_start = chip->addr & ~(SIM_FLASH_PAGE_SIZE - 1);
+    for (uint32_t i = 0; i < SIM_FLASH_PAGE_SIZE; i++) {
+        if (!chip->page_used[i]) {
+            continue;
+        }
+        uint8_t* byte = &chip->data[page_start + i];
+        // Programming can only change bits from 1 to 0
+        if ((chip->page[i] & ~*byte) != 0) {
+            sim_flash_stats.not_erased_writes++;
+        }
+        *byte &= chip->page[i];
+        sim_flash_stats.programmed_bytes++;
+    }
+    sim_flash_stats.programs++;
+    sim_flash_start_busy(chip, SIM_FLASH_PP_NS);
+}
+
+/*
+Called when CS (for chip `index`) changes. Program and erase commands start
+    when CS goes high.
+*/
+void sim_flash_select(uint8_t index, bool selected) {
+    sim_flash_chip_t* chip = &sim_flash_chips[index];
+    if (selected == chip->selected) {
+        return;
+    }
+    chip->selected = selected;
+
+    if (selected) {
+        chip->pos = 0;
+        chip->page_count = 0;
+        memset(chip->page_used, 0, sizeof(chip->page_used));
+        return;
+    }
+
+    // Nothing to do for an ignored or incomplete command
+    if (chip->pos == 0 || sim_flash_busy(chip)) {
+        return;
+    }
+
+    uint32_t start, size;
+    switch (chip->cmd) {
+        case SIM_FLASH_PP:
+            if (chip->pos >= 5 && sim_flash_can_write(chip)) {
+                sim_flash_program(chip);
+            }
+            break;
+        case SIM_FLASH_SE:
+            if (chip->pos >= 4 && sim_flash_can_write(chip)) {
+                start = chip->addr & ~(SIM_FLASH_SECTOR_SIZE - 1);
+                sim_flash_erase(chip, start, SIM_FLASH_SECTOR_SIZE,
+                    SIM_FLASH_SE_NS);
+                sim_flash_stats.sector_erases++;
+            }
+            break;
+        case SIM_FLASH_BE:
+            if (chip->pos >= 4 && sim_flash_can_write(chip)) {
+                sim_flash_block(chip->addr, &start, &size);
+                sim_flash_erase(chip, start, size, SIM_FLASH_BE_NS);
+                sim_flash_stats.block_erases++;
+            }
+            break;
+        case SIM_FLASH_CE:
+            if (sim_flash_can_write(chip)) {
+                sim_flash_erase(chip, 0, SIM_FLASH_CHIP_SIZE, SIM_FLASH_CE_NS);
+                sim_flash_stats.chip_erases++;
+            }
+            break;
+        case SIM_FLASH_ULBPR:
+            if (chip->wel) {
+                chip->locked = false;
+                chip->wel = false;
+            } else {
+                sim_flash_stats.no_wel++;
+            }
+            break;
+        case SIM_FLASH_WRSR:
+            chip->wel = false;
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+Handles one byte sent to chip `index` while its CS is low.
+Returns the byte sent back.
+*/
+uint8_t sim_flash_spi(uint8_t index, uint8_t mode, uint8_t byte) {
+    sim_flash_chip_t* chip = &sim_flash_chips[index];
+    uint32_t pos = chip->pos++;
+
+    // SST26 supports modes 0 and 3
+    if (mode != 0 && mode != 3) {
+        sim_flash_stats.bad_mode++;
+        chip->pos = 0;
+        return 0xFF;
+    }
+
+    if (pos == 0) {
+        chip->cmd = byte;
+        chip->addr = 0;
+
+        if (byte == SIM_FLASH_RDSR) {
+            sim_flash_stats.status_polls++;
+        } else if (sim_flash_busy(chip)) {
+            // Only the status can be read during a program/erase
+            sim_flash_stats.busy_violations++;
+            chip->pos = 0;
+            return 0xFF;
+        }
+
+        switch (byte) {
+            case SIM_FLASH_WREN:
+                chip->wel = true;
+                break;
+            case SIM_FLASH_WRDI:
+                chip->wel = false;
+                break;
+            case SIM_FLASH_RSTEN:
+                chip->rst_enabled = true;
+                break;
+            case SIM_FLASH_RST:
+                if (chip->rst_enabled) {
+                    chip->wel = false;
+                    chip->locked = true;
+                }
+                chip->rst_enabled = false;
+                break;
+            default:
+                break;
+        }
+        if (byte != SIM_FLASH_RSTEN) {
+            chip->rst_enabled = false;
+        }
+        return 0xFF;
+    }
+
+    if (chip->cmd == SIM_FLASH_RDSR) {
+        return (sim_flash_busy(chip) ? 0x01 : 0x00) | (chip->wel ? 0x02 : 0x00);
+    }
+    if (sim_flash_busy(chip)) {
+        return 0xFF;
+    }
+
+    // 3 address bytes
+    if (pos <= 3) {
+        chip->addr = ((chip->addr << 8) | byte) & (SIM_FLASH_CHIP_SIZE - 1);
+        return 0xFF;
+    }
+
+    uint8_t ret = 0xFF;
+    switch (chip->cmd) {
+        case SIM_FLASH_READ:
+            ret = chip->data[chip->addr];
+            chip->addr = (chip->addr + 1) & (SIM_FLASH_CHIP_SIZE - 1);
+            sim_flash_stats.read_bytes++;
+            break;
+        case SIM_FLASH_FAST_READ:
+            // One dummy byte first
+            if (pos > 4) {
+                ret = chip->data[chip->addr];
+                chip->addr = (chip->addr + 1) & (SIM_FLASH_CHIP_SIZE - 1);
+                sim_flash_stats.fast_read_bytes++;
+            }
+            break;
+        case SIM_FLASH_PP: {
+            // Wraps around within the page
+            uint32_t offset = (chip->addr + chip->page_count) &
+                (SIM_FLASH_PAGE_SIZE - 1);
+            chip->page[offset] = byte;
+            chip->page_used[offset] = true;
+            chip->page_count++;
+            break;
+        }
+        default:
+            break;
+    }
+    return ret;
+}
+
+void sim_report_flash(FILE* out) {
+    sim_flash_stats_t* s = &sim_flash_stats;
+    fprintf(out, "\n-- Flash (%u x SST26VF016B) --\n", SIM_FLASH_NUM_CHIPS);
+    fprintf(out, "Read: %llu bytes (+ %llu fast read)\n",
+        (unsigned long long) s->read_bytes,
+        (unsigned long long) s->fast_read_bytes);
+    fprintf(out, "Programmed: %llu bytes in %llu page programs\n",
+        (unsigned long long) s->programmed_bytes,
+        (unsigned long long) s->programs);
+    fprintf(out, "Erases: %llu sector, %llu block, %llu chip\n",
+        (unsigned long long) s->sector_erases,
+        (unsigned long long) s->block_erases,
+        (unsigned long long) s->chip_erases);
+    fprintf(out, "Busy: %.3f s total (all chips), %llu status polls\n",
+        (double) s->busy_ns / SIM_NS_PER_S,
+        (unsigned long long) s->status_polls);
+    fprintf(out, "Errors: %llu commands while busy, %llu writes over data "
+        "that was not erased, %llu writes while locked, %llu writes without "
+        "write enable, %llu wrong SPI mode\n",
+        (unsigned long long) s->busy_violations,
+        (unsigned long long) s->not_erased_writes,
+        (unsigned long long) s->locked_writes,
+        (unsigned long long) s->no_wel,
+        (unsigned long long) s->bad_mode);
+}
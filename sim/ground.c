@@ -0,0 +1,577 @@
+/*
+Simulated ground station
+
+At the start time, it resets the OBC's last command ID, then sends commands
+    (starting from ID 1) and parses the ACKs and responses that come back. It
+    sends the next command when fewer than the window size are waiting for a
+    response and the minimum gap has passed. A command that gets no response
+    before the timeout is given up on.
+
+The commands are a random mix of ones that read data or start data
+    collections (nothing that erases memory or changes settings), or come from
+    a script file with one command per line:
+    <time (s from the start of the run)> <opcode> <arg1> <arg2>
+The numbers can be decimal or hex (0x...) and lines starting with # are
+    ignored.
+
+With the -f option, some uplink packets have a bit flipped so the OBC's
+    NACKs are exercised.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+// Same as in src/ (not included to keep this independent of the OBC code)
+#define SIM_PKT_DELIMITER       0x55
+#define SIM_CMD_RESP_MASK       0x8000
+#define SIM_ACK_OK              0x00
+#define SIM_ACK_RESET_CMD_ID    0x01
+#define SIM_ACK_BATCH           0x0C
+#define SIM_RESP_OK             0x00
+#define SIM_RESP_BULK_FRAME     0x04
+#define SIM_RESP_OK_COMPRESSED  0x05
+// Seconds from 2000-01-01 to the RTC's start time (see devices.c)
+#define SIM_GROUND_RTC_START_S  631152000UL
+
+// How often to check for timeouts and whether to send the next command
+#define SIM_GROUND_TICK_NS      (10 * SIM_NS_PER_MS)
+
+#define SIM_GROUND_NUM_OPCODES  0x100
+
+typedef enum {
+    SIM_GROUND_WAITING,
+    SIM_GROUND_RESETTING,
+    SIM_GROUND_RUNNING,
+} sim_ground_state_t;
+
+typedef struct {
+    uint8_t opcode;
+    uint64_t sent_ns;
+    uint64_t ack_ns;
+    uint64_t resp_ns;
+    uint8_t ack_status;
+    uint8_t resp_status;
+    bool acked;
+    // Final response received, NACKed or timed out
+    bool done;
+} sim_ground_cmd_t;
+
+typedef struct {
+    uint64_t sent;
+    uint64_t acks;
+    uint64_t nacks;
+    uint64_t resps;
+    uint64_t resp_errors;
+    uint64_t timeouts;
+    uint64_t ack_ns;
+    uint64_t resp_ns;
+} sim_ground_op_stats_t;
+
+typedef struct {
+    uint64_t* values;
+    uint32_t count;
+    uint32_t size;
+} sim_ground_lats_t;
+
+typedef struct {
+    double time_s;
+    uint8_t opcode;
+    uint32_t arg1;
+    uint32_t arg2;
+} sim_ground_script_cmd_t;
+
+static sim_ground_state_t sim_ground_state = SIM_GROUND_WAITING;
+static uint64_t sim_ground_reset_ns = 0;
+static uint64_t sim_ground_next_ns = 0;
+
+// Index i is command ID i + 1
+static sim_ground_cmd_t* sim_ground_cmds = NULL;
+static uint32_t sim_ground_cmds_count = 0;
+static uint32_t sim_ground_cmds_size = 0;
+// Number of commands sent and not done
+static uint32_t sim_ground_in_flight = 0;
+
+static sim_ground_script_cmd_t* sim_ground_script = NULL;
+static uint32_t sim_ground_script_count = 0;
+static uint32_t sim_ground_script_next = 0;
+
+static sim_ground_op_stats_t sim_ground_op_stats[SIM_GROUND_NUM_OPCODES];
+static sim_ground_lats_t sim_ground_ack_lats = { NULL, 0, 0 };
+static sim_ground_lats_t sim_ground_resp_lats = { NULL, 0, 0 };
+
+static uint64_t sim_ground_resets = 0;
+static uint64_t sim_ground_corrupted = 0;
+static uint64_t sim_ground_unknown_nacks = 0;
+static uint64_t sim_ground_unmatched = 0;
+static uint64_t sim_ground_dl_pkts = 0;
+static uint64_t sim_ground_dl_bad = 0;
+static uint64_t sim_ground_dl_bytes = 0;
+static uint64_t sim_ground_ul_bytes = 0;
+
+
+static uint32_t sim_ground_crc32_update(uint32_t crc, uint8_t byte) {
+    crc ^= byte;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+        crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+    }
+    return crc;
+}
+
+// Checksum of a packet - the length byte, then the decoded bytes
+static uint32_t sim_ground_pkt_crc32(const uint8_t* msg, uint8_t len) {
+    uint32_t crc = sim_ground_crc32_update(0xFFFFFFFF, len);
+    for (uint8_t i = 0; i < len; i++) {
+        crc = sim_ground_crc32_update(crc, msg[i]);
+    }
+    return ~crc;
+}
+
+static void sim_ground_add_lat(sim_ground_lats_t* lats, uint64_t ns) {
+    if (lats->count == lats->size) {
+        lats->size = (lats->size == 0) ? 256 : lats->size * 2;
+        lats->values = realloc(lats->values, lats->size * sizeof(uint64_t));
+        if (lats->values == NULL) {
+            fprintf(stderr, "sim: out of memory\n");
+            exit(1);
+        }
+    }
+    lats->values[lats->count++] = ns;
+}
+
+static void sim_ground_put_u32(uint8_t* buf, uint32_t value) {
+    buf[0] = (value >> 24) & 0xFF;
+    buf[1] = (value >> 16) & 0xFF;
+    buf[2] = (value >> 8) & 0xFF;
+    buf[3] = value & 0xFF;
+}
+
+/*
+Encodes and sends a message (same packet format as the OBC's downlink).
+*/
+static void sim_ground_send(const uint8_t* msg, uint8_t len) {
+    uint8_t pkt[256];
+    pkt[0] = SIM_PKT_DELIMITER;
+    pkt[1] = len;
+    pkt[2] = SIM_PKT_DELIMITER;
+    memcpy(&pkt[3], msg, len);
+    pkt[3 + len] = SIM_PKT_DELIMITER;
+    sim_ground_put_u32(&pkt[4 + len], sim_ground_pkt_crc32(msg, len));
+    pkt[8 + len] = SIM_PKT_DELIMITER;
+
+    uint8_t pkt_len = len + 9;
+    if (sim_opts.fault_prob > 0 && sim_rand_unit() < sim_opts.fault_prob) {
+        uint32_t bit = (uint32_t) (sim_rand() % (pkt_len * 8));
+        pkt[bit / 8] ^= (uint8_t) (1 << (bit % 8));
+        sim_ground_corrupted++;
+    }
+
+    sim_ground_ul_bytes += pkt_len;
+    sim_trans_uplink(pkt, pkt_len);
+}
+
+static void sim_ground_send_reset(void) {
+    uint8_t msg[2] = { 0x00, 0x00 };
+    sim_ground_send(msg, sizeof(msg));
+    sim_ground_reset_ns = sim_ns;
+    sim_ground_resets++;
+}
+
+static void sim_ground_send_cmd(uint8_t opcode, uint32_t arg1, uint32_t arg2) {
+    extern const uint8_t correct_pwd_1[];
+
+    if (sim_ground_cmds_count == sim_ground_cmds_size) {
+        sim_ground_cmds_size = (sim_ground_cmds_size == 0) ?
+            256 : sim_ground_cmds_size * 2;
+        sim_ground_cmds = realloc(sim_ground_cmds,
+            sim_ground_cmds_size * sizeof(sim_ground_cmd_t));
+        if (sim_ground_cmds == NULL) {
+            fprintf(stderr, "sim: out of memory\n");
+            exit(1);
+        }
+    }
+    // Command IDs can't have the MSB set
+    if (sim_ground_cmds_count >= 0x7FFF) {
+        return;
+    }
+
+    sim_ground_cmd_t* cmd = &sim_ground_cmds[sim_ground_cmds_count++];
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->opcode = opcode;
+    cmd->sent_ns = sim_ns;
+    sim_ground_in_flight++;
+    sim_ground_op_stats[opcode].sent++;
+
+    uint16_t cmd_id = (uint16_t) sim_ground_cmds_count;
+    uint8_t msg[15];
+    msg[0] = (cmd_id >> 8) & 0xFF;
+    msg[1] = cmd_id & 0xFF;
+    msg[2] = opcode;
+    sim_ground_put_u32(&msg[3], arg1);
+    sim_ground_put_u32(&msg[7], arg2);
+    memcpy(&msg[11], correct_pwd_1, 4);
+    sim_ground_send(msg, sizeof(msg));
+}
+
+// Picks a random command that does not change anything on the OBC
+static void sim_ground_send_random_cmd(void) {
+    // Types of data blocks (CMD_OBC_HK to CMD_PAY_OPT)
+    uint32_t type = 1 + (uint32_t) (sim_rand() % 4);
+    uint32_t now_s = SIM_GROUND_RTC_START_S + (uint32_t) (sim_ns / SIM_NS_PER_S);
+
+    switch (sim_rand() % 16) {
+        case 0:
+            sim_ground_send_cmd(0x00, 0, 0);    // Ping
+            break;
+        case 1:
+            sim_ground_send_cmd(0x01, 0, 0);    // Get RTC
+            break;
+        case 2:
+            sim_ground_send_cmd(0x03, 0, 0);    // Read EEPROM
+            break;
+        case 3:
+            sim_ground_send_cmd(0x07, 0, 0);    // Read profiler stats
+            break;
+        case 4:
+            sim_ground_send_cmd(0x08, 0, 0);    // Read command latencies
+            break;
+        case 5:
+            sim_ground_send_cmd(0x0A, 0, 0);    // Antenna deployment status
+            break;
+        case 6:
+            sim_ground_send_cmd(0x10, type, 0); // Read data block
+            break;
+        case 7:
+            sim_ground_send_cmd(0x11, 0, 5);    // Read primary command blocks
+            break;
+        case 8:
+            sim_ground_send_cmd(0x14, type, 0); // Read recent local data block
+            break;
+        case 9:
+            sim_ground_send_cmd(0x15, 0, 64);   // Read raw memory bytes
+            break;
+        case 10:
+            // Find data blocks by time (in the last hour)
+            sim_ground_send_cmd(0x1A, now_s - 3600, (type << 24) | 7200);
+            break;
+        case 11:
+        case 12:
+            sim_ground_send_cmd(0x20, type, 0); // Collect data block
+            break;
+        case 13:
+            sim_ground_send_cmd(0x21, 0, 0);    // Get auto data col settings
+            break;
+        case 14:
+            sim_ground_send_cmd(0x30, 0, 0);    // Get current block numbers
+            break;
+        default:
+            // Send an EPS housekeeping request for field 0 over CAN
+            sim_ground_send_cmd(0x40, 0x00000000, 0);
+            break;
+    }
+}
+
+static void sim_ground_finish_cmd(sim_ground_cmd_t* cmd) {
+    if (!cmd->done) {
+        cmd->done = true;
+        sim_ground_in_flight--;
+    }
+}
+
+static void sim_ground_check_timeouts(void) {
+    for (uint32_t i = 0; i < sim_ground_cmds_count && sim_ground_in_flight > 0; i++) {
+        sim_ground_cmd_t* cmd = &sim_ground_cmds[i];
+        if (!cmd->done && sim_ns - cmd->sent_ns >= sim_opts.ground_timeout_ns) {
+            sim_ground_op_stats[cmd->opcode].timeouts++;
+            sim_ground_finish_cmd(cmd);
+        }
+    }
+}
+
+static void sim_ground_tick(uintptr_t arg) {
+    (void) arg;
+
+    if (sim_ground_state == SIM_GROUND_WAITING) {
+        sim_ground_state = SIM_GROUND_RESETTING;
+        sim_ground_send_reset();
+    } else if (sim_ground_state == SIM_GROUND_RESETTING) {
+        if (sim_ns - sim_ground_reset_ns >= sim_opts.ground_timeout_ns) {
+            sim_ground_send_reset();
+        }
+    } else {
+        sim_ground_check_timeouts();
+
+        if (sim_opts.script != NULL) {
+            // Scripted commands are sent at their time regardless of the
+            // window
+            while (sim_ground_script_next < sim_ground_script_count &&
+                    sim_ground_script[sim_ground_script_next].time_s *
+                    SIM_NS_PER_S <= sim_ns) {
+                sim_ground_script_cmd_t* s =
+                    &sim_ground_script[sim_ground_script_next++];
+                sim_ground_send_cmd(s->opcode, s->arg1, s->arg2);
+            }
+        } else if (sim_ground_in_flight < sim_opts.ground_window &&
+                sim_ns >= sim_ground_next_ns) {
+            sim_ground_send_random_cmd();
+            sim_ground_next_ns = sim_ns + sim_opts.ground_gap_ns;
+        }
+    }
+
+    sim_schedule(sim_ns + SIM_GROUND_TICK_NS, SIM_EVENT_DEVICE, sim_ground_tick, 0);
+}
+
+static uint32_t sim_ground_parse_num(const char* str, bool* ok) {
+    char* end;
+    unsigned long value = strtoul(str, &end, 0);
+    if (end == str) {
+        *ok = false;
+    }
+    return (uint32_t) value;
+}
+
+static void sim_ground_load_script(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "sim: can't open script %s\n", path);
+        exit(1);
+    }
+
+    char line[256];
+    uint32_t size = 0;
+    uint32_t line_num = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_num++;
+        char time_str[32], opcode_str[32], arg1_str[32], arg2_str[32];
+        if (line[0] == '#' || sscanf(line, "%31s %31s %31s %31s",
+                time_str, opcode_str, arg1_str, arg2_str) != 4) {
+            continue;
+        }
+
+        bool ok = true;
+        sim_ground_script_cmd_t cmd;
+        cmd.time_s = atof(time_str);
+        cmd.opcode = (uint8_t) sim_ground_parse_num(opcode_str, &ok);
+        cmd.arg1 = sim_ground_parse_num(arg1_str, &ok);
+        cmd.arg2 = sim_ground_parse_num(arg2_str, &ok);
+        if (!ok) {
+            fprintf(stderr, "sim: %s:%u: invalid command\n", path, line_num);
+            exit(1);
+        }
+        // Commands must be sent with increasing IDs, so in time order
+        if (sim_ground_script_count > 0 &&
+                cmd.time_s < sim_ground_script[sim_ground_script_count - 1].time_s) {
+            fprintf(stderr, "sim: %s:%u: times must not decrease\n", path, line_num);
+            exit(1);
+        }
+
+        if (sim_ground_script_count == size) {
+            size = (size == 0) ? 64 : size * 2;
+            sim_ground_script = realloc(sim_ground_script,
+                size * sizeof(sim_ground_script_cmd_t));
+            if (sim_ground_script == NULL) {
+                fprintf(stderr, "sim: out of memory\n");
+                exit(1);
+            }
+        }
+        sim_ground_script[sim_ground_script_count++] = cmd;
+    }
+    fclose(file);
+}
+
+void sim_init_ground(void) {
+    if (sim_opts.script != NULL) {
+        sim_ground_load_script(sim_opts.script);
+    }
+    sim_schedule(sim_opts.ground_start_ns, SIM_EVENT_DEVICE, sim_ground_tick, 0);
+}
+
+static sim_ground_cmd_t* sim_ground_find_cmd(uint16_t cmd_id) {
+    if (cmd_id == 0 || cmd_id > sim_ground_cmds_count) {
+        return NULL;
+    }
+    return &sim_ground_cmds[cmd_id - 1];
+}
+
+static void sim_ground_handle_ack(uint16_t cmd_id, uint8_t status) {
+    if (status == SIM_ACK_RESET_CMD_ID) {
+        if (sim_ground_state == SIM_GROUND_RESETTING) {
+            sim_ground_state = SIM_GROUND_RUNNING;
+            sim_ground_next_ns = sim_ns;
+        }
+        return;
+    }
+
+    sim_ground_cmd_t* cmd = sim_ground_find_cmd(cmd_id);
+    if (cmd == NULL) {
+        // e.g. a checksum NACK for a corrupted packet (the command then times
+        // out)
+        if (status != SIM_ACK_OK) {
+            sim_ground_unknown_nacks++;
+        } else {
+            sim_ground_unmatched++;
+        }
+        return;
+    }
+    if (cmd->acked) {
+        sim_ground_unmatched++;
+        return;
+    }
+
+    sim_ground_op_stats_t* stats = &sim_ground_op_stats[cmd->opcode];
+    cmd->acked = true;
+    cmd->ack_ns = sim_ns;
+    cmd->ack_status = status;
+    if (status == SIM_ACK_OK) {
+        stats->acks++;
+        stats->ack_ns += sim_ns - cmd->sent_ns;
+        sim_ground_add_lat(&sim_ground_ack_lats, sim_ns - cmd->sent_ns);
+    } else {
+        stats->nacks++;
+        sim_ground_finish_cmd(cmd);
+    }
+}
+
+static void sim_ground_handle_resp(uint16_t cmd_id, uint8_t status) {
+    sim_ground_cmd_t* cmd = sim_ground_find_cmd(cmd_id);
+    // Also ignore responses after the command timed out
+    if (cmd == NULL || cmd->done) {
+        sim_ground_unmatched++;
+        return;
+    }
+
+    // Bulk frames come before the final response
+    if (status == SIM_RESP_BULK_FRAME) {
+        return;
+    }
+
+    sim_ground_op_stats_t* stats = &sim_ground_op_stats[cmd->opcode];
+    cmd->resp_ns = sim_ns;
+    cmd->resp_status = status;
+    stats->resps++;
+    if (status != SIM_RESP_OK && status != SIM_RESP_OK_COMPRESSED) {
+        stats->resp_errors++;
+    }
+    stats->resp_ns += sim_ns - cmd->sent_ns;
+    sim_ground_add_lat(&sim_ground_resp_lats, sim_ns - cmd->sent_ns);
+    sim_ground_finish_cmd(cmd);
+}
+
+/*
+Called when a packet from the OBC has been received by the ground station
+    (`len` bytes, encoded).
+*/
+void sim_ground_downlink(const uint8_t* pkt, uint8_t len) {
+    sim_ground_dl_pkts++;
+
+    if (len < 9 || pkt[0] != SIM_PKT_DELIMITER || pkt[2] != SIM_PKT_DELIMITER ||
+            pkt[1] != len - 9 || pkt[len - 6] != SIM_PKT_DELIMITER ||
+            pkt[len - 1] != SIM_PKT_DELIMITER) {
+        sim_ground_dl_bad++;
+        return;
+    }
+    uint8_t dec_len = pkt[1];
+    uint32_t crc = ((uint32_t) pkt[len - 5] << 24) |
+        ((uint32_t) pkt[len - 4] << 16) | ((uint32_t) pkt[len - 3] << 8) |
+        pkt[len - 2];
+    if (crc != sim_ground_pkt_crc32(&pkt[3], dec_len)) {
+        sim_ground_dl_bad++;
+        return;
+    }
+
+    const uint8_t* msg = &pkt[3];
+    if (dec_len < 3) {
+        sim_ground_dl_bad++;
+        return;
+    }
+    sim_ground_dl_bytes += dec_len;
+
+    uint16_t cmd_id = ((uint16_t) msg[0] << 8) | msg[1];
+    if (cmd_id & SIM_CMD_RESP_MASK) {
+        sim_ground_handle_resp(cmd_id & ~SIM_CMD_RESP_MASK, msg[2]);
+        return;
+    }
+
+    // One or more ACKs (a batch ACK has an extra bitmap byte)
+    uint8_t i = 0;
+    while (i + 3 <= dec_len) {
+        uint16_t ack_id = ((uint16_t) msg[i] << 8) | msg[i + 1];
+        uint8_t status = msg[i + 2];
+        sim_ground_handle_ack(ack_id, status);
+        i += (status == SIM_ACK_BATCH) ? 4 : 3;
+    }
+}
+
+static int sim_ground_cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+static void sim_ground_report_lats(FILE* out, const char* name,
+        sim_ground_lats_t* lats) {
+    if (lats->count == 0) {
+        fprintf(out, "%s latency: none\n", name);
+        return;
+    }
+
+    qsort(lats->values, lats->count, sizeof(uint64_t), sim_ground_cmp_u64);
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < lats->count; i++) {
+        total += lats->values[i];
+    }
+    fprintf(out, "%s latency: avg %.1f ms, p50 %.1f ms, p95 %.1f ms, "
+        "max %.1f ms (%u samples)\n", name,
+        (double) total / lats->count / SIM_NS_PER_MS,
+        (double) lats->values[lats->count / 2] / SIM_NS_PER_MS,
+        (double) lats->values[(lats->count * 95) / 100] / SIM_NS_PER_MS,
+        (double) lats->values[lats->count - 1] / SIM_NS_PER_MS,
+        lats->count);
+}
+
+void sim_report_ground(FILE* out) {
+    fprintf(out, "\n-- Ground station --\n");
+    if (sim_ground_state != SIM_GROUND_RUNNING) {
+        fprintf(out, "Never got the ACK for resetting the command ID "
+            "(%llu attempts)\n", (unsigned long long) sim_ground_resets);
+    }
+
+    fprintf(out, "%-8s %8s %8s %8s %8s %8s %8s %12s %12s\n", "Opcode",
+        "Sent", "ACKs", "NACKs", "Resps", "Errors", "Timeouts", "Avg ACK ms",
+        "Avg resp ms");
+    for (uint32_t op = 0; op < SIM_GROUND_NUM_OPCODES; op++) {
+        sim_ground_op_stats_t* s = &sim_ground_op_stats[op];
+        if (s->sent == 0) {
+            continue;
+        }
+        fprintf(out, "0x%02X     %8llu %8llu %8llu %8llu %8llu %8llu %12.1f %12.1f\n",
+            op, (unsigned long long) s->sent, (unsigned long long) s->acks,
+            (unsigned long long) s->nacks, (unsigned long long) s->resps,
+            (unsigned long long) s->resp_errors,
+            (unsigned long long) s->timeouts,
+            (s->acks > 0) ? ((double) s->ack_ns / s->acks / SIM_NS_PER_MS) : 0.0,
+            (s->resps > 0) ? ((double) s->resp_ns / s->resps / SIM_NS_PER_MS) : 0.0);
+    }
+
+    sim_ground_report_lats(out, "ACK", &sim_ground_ack_lats);
+    sim_ground_report_lats(out, "Response", &sim_ground_resp_lats);
+
+    double s = (sim_ns > sim_opts.ground_start_ns) ?
+        ((double) (sim_ns - sim_opts.ground_start_ns) / SIM_NS_PER_S) : 0.0;
+    fprintf(out, "Commands: %u sent, %u still waiting, %llu corrupted uplink "
+        "packets, %llu NACKs without a command ID, %llu unmatched ACKs/responses\n",
+        sim_ground_cmds_count, sim_ground_in_flight,
+        (unsigned long long) sim_ground_corrupted,
+        (unsigned long long) sim_ground_unknown_nacks,
+        (unsigned long long) sim_ground_unmatched);
+    fprintf(out, "Downlink: %llu packets (%llu invalid), %llu message bytes, "
+        "%.1f bytes/s\n",
+        (unsigned long long) sim_ground_dl_pkts,
+        (unsigned long long) sim_ground_dl_bad,
+        (unsigned long long) sim_ground_dl_bytes,
+        (s > 0) ? (sim_ground_dl_bytes / s) : 0.0);
+    fprintf(out, "Uplink: %llu packet bytes, %.1f bytes/s\n",
+        (unsigned long long) sim_ground_ul_bytes,
+        (s > 0) ? (sim_ground_ul_bytes / s) : 0.0);
+}
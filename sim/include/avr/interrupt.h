@@ -0,0 +1,22 @@
+/*
+<avr/interrupt.h> for the host simulation
+
+An ISR is a normal function, called by the simulation (between CPU time steps)
+    when its interrupt is due and interrupts are enabled.
+*/
+
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+#define sei() sim_sei()
+#define cli() sim_cli()
+
+#define ISR_BLOCK
+#define ISR_NOBLOCK
+#define ISR_NAKED
+#define ISR(vector, ...)    void vector(void); void vector(void)
+#define EMPTY_INTERRUPT(vector) void vector(void); void vector(void) {}
+
+#endif
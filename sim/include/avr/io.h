@@ -0,0 +1,201 @@
+/*
+<avr/io.h> for the host simulation - ATmega64M1 registers and bit numbers
+    used by the OBC and lib-common
+*/
+
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+#include <stdint.h>
+
+#include <sim_mcu.h>
+
+#define SIM_REG8(name)  extern volatile uint8_t name;
+#define SIM_REG16(name) extern volatile uint16_t name;
+#include <avr/sim_regs.h>
+#undef SIM_REG8
+#undef SIM_REG16
+
+// Registers that depend on simulated time
+#define TCNT1   (*sim_tcnt1())
+#define TIFR1   (*sim_tifr1())
+#define LINSIR  (*sim_linsir())
+
+#define _BV(bit)                (1 << (bit))
+#define bit_is_set(sfr, bit)    ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit)  (!((sfr) & _BV(bit)))
+#define loop_until_bit_is_set(sfr, bit)     do { } while (bit_is_clear(sfr, bit))
+#define loop_until_bit_is_clear(sfr, bit)   do { } while (bit_is_set(sfr, bit))
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define PC7 7
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+#define PE0 0
+#define PE1 1
+#define PE2 2
+
+// PCICR
+#define PCIE0 0
+#define PCIE1 1
+#define PCIE2 2
+#define PCIE3 3
+
+// PCMSK0-3 (PCINT0-7 are port B, 8-15 port C, 16-23 port D, 24-26 port E)
+#define PCINT0  0
+#define PCINT1  1
+#define PCINT2  2
+#define PCINT3  3
+#define PCINT4  4
+#define PCINT5  5
+#define PCINT6  6
+#define PCINT7  7
+#define PCINT8  0
+#define PCINT9  1
+#define PCINT10 2
+#define PCINT11 3
+#define PCINT12 4
+#define PCINT13 5
+#define PCINT14 6
+#define PCINT15 7
+#define PCINT16 0
+#define PCINT17 1
+#define PCINT18 2
+#define PCINT19 3
+#define PCINT20 4
+#define PCINT21 5
+#define PCINT22 6
+#define PCINT23 7
+#define PCINT24 0
+#define PCINT25 1
+#define PCINT26 2
+
+// MCUSR
+#define PORF    0
+#define EXTRF   1
+#define BORF    2
+#define WDRF    3
+
+// WDTCSR
+#define WDP0    0
+#define WDP1    1
+#define WDP2    2
+#define WDE     3
+#define WDCE    4
+#define WDP3    5
+#define WDIE    6
+#define WDIF    7
+
+// SMCR
+#define SE      0
+#define SM0     1
+#define SM1     2
+#define SM2     3
+
+// TCCR0A/B, TIMSK0, TIFR0
+#define WGM00   0
+#define WGM01   1
+#define CS00    0
+#define CS01    1
+#define CS02    2
+#define WGM02   3
+#define TOIE0   0
+#define OCIE0A  1
+#define OCIE0B  2
+#define TOV0    0
+#define OCF0A   1
+#define OCF0B   2
+
+// TCCR1A/B, TIMSK1, TIFR1
+#define WGM10   0
+#define WGM11   1
+#define CS10    0
+#define CS11    1
+#define CS12    2
+#define WGM12   3
+#define WGM13   4
+#define TOIE1   0
+#define OCIE1A  1
+#define OCIE1B  2
+#define ICIE1   5
+#define TOV1    0
+#define OCF1A   1
+#define OCF1B   2
+#define ICF1    5
+
+// SPCR, SPSR
+#define SPR0    0
+#define SPR1    1
+#define CPHA    2
+#define CPOL    3
+#define MSTR    4
+#define DORD    5
+#define SPE     6
+#define SPIE    7
+#define SPI2X   0
+#define WCOL    6
+#define SPIF    7
+
+// LINSIR, LINENIR, LINCR
+#define LRXOK   0
+#define LTXOK   1
+#define LIDOK   2
+#define LERR    3
+#define LBUSY   4
+#define LENRXOK 0
+#define LENTXOK 1
+#define LENIDOK 2
+#define LENERR  3
+#define LCMD0   0
+#define LCMD1   1
+#define LCMD2   2
+#define LENA    3
+#define LCONF0  4
+#define LCONF1  5
+#define LIN13   6
+#define LSWRES  7
+
+// CANGCON, CANGIE, CANSTMOB, CANCDMOB
+#define SWRES   0
+#define ENASTB  1
+#define ENFG    2
+#define ENRX    5
+#define ENTX    4
+#define ENIT    7
+#define TXOK    6
+#define RXOK    5
+#define CONMOB0 6
+#define CONMOB1 7
+#define IDE     4
+
+// EECR
+#define EERE    0
+#define EEPE    1
+#define EEMPE   2
+#define EERIE   3
+
+#define RAMEND  0x10FF
+#define E2END   0x07FF
+#define FLASHEND 0xFFFF
+
+#endif
@@ -0,0 +1,31 @@
+/*
+<avr/pgmspace.h> for the host simulation - program memory is normal memory
+*/
+
+#ifndef SIM_AVR_PGMSPACE_H
+#define SIM_AVR_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+
+#define pgm_read_byte(addr)     (*(const uint8_t*) (addr))
+#define pgm_read_word(addr)     (*(const uint16_t*) (addr))
+#define pgm_read_dword(addr)    (*(const uint32_t*) (addr))
+#define pgm_read_float(addr)    (*(const float*) (addr))
+#define pgm_read_ptr(addr)      (*(void* const*) (addr))
+
+#define memcpy_P    memcpy
+#define memcmp_P    memcmp
+#define strcpy_P    strcpy
+#define strncpy_P   strncpy
+#define strcmp_P    strcmp
+#define strncmp_P   strncmp
+#define strlen_P    strlen
+#define printf_P    printf
+#define sprintf_P   sprintf
+#define snprintf_P  snprintf
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ATmega64M1 I/O registers for the host simulation
+
+Each register is a plain variable (defined in sim/regs.c), except the ones
+    that depend on simulated time (TCNT1, TIFR1, LINSIR), which are macros in
+    avr/io.h that call into the simulation.
+
+This file is an X-macro list - define SIM_REG8() and SIM_REG16() before
+    including it.
+*/
+
+// Ports
+SIM_REG8(PINB)
+SIM_REG8(DDRB)
+SIM_REG8(PORTB)
+SIM_REG8(PINC)
+SIM_REG8(DDRC)
+SIM_REG8(PORTC)
+SIM_REG8(PIND)
+SIM_REG8(DDRD)
+SIM_REG8(PORTD)
+SIM_REG8(PINE)
+SIM_REG8(DDRE)
+SIM_REG8(PORTE)
+
+// Interrupts
+SIM_REG8(SREG)
+SIM_REG8(PCICR)
+SIM_REG8(PCIFR)
+SIM_REG8(PCMSK0)
+SIM_REG8(PCMSK1)
+SIM_REG8(PCMSK2)
+SIM_REG8(PCMSK3)
+SIM_REG8(EICRA)
+SIM_REG8(EIMSK)
+SIM_REG8(EIFR)
+
+// System
+SIM_REG8(MCUSR)
+SIM_REG8(MCUCR)
+SIM_REG8(SMCR)
+SIM_REG8(WDTCSR)
+SIM_REG8(CLKPR)
+SIM_REG8(PRR)
+
+// Timers
+SIM_REG8(TCCR0A)
+SIM_REG8(TCCR0B)
+SIM_REG8(TCNT0)
+SIM_REG8(OCR0A)
+SIM_REG8(OCR0B)
+SIM_REG8(TIMSK0)
+SIM_REG8(TIFR0)
+SIM_REG8(TCCR1A)
+SIM_REG8(TCCR1B)
+SIM_REG8(TCCR1C)
+SIM_REG16(OCR1A)
+SIM_REG16(OCR1B)
+SIM_REG16(ICR1)
+SIM_REG8(TIMSK1)
+
+// SPI
+SIM_REG8(SPCR)
+SIM_REG8(SPSR)
+SIM_REG8(SPDR)
+
+// LIN/UART
+SIM_REG8(LINCR)
+SIM_REG8(LINENIR)
+SIM_REG8(LINERR)
+SIM_REG8(LINBTR)
+SIM_REG16(LINBRR)
+SIM_REG8(LINDLR)
+SIM_REG8(LINIDR)
+SIM_REG8(LINSEL)
+SIM_REG8(LINDAT)
+
+// CAN
+SIM_REG8(CANGCON)
+SIM_REG8(CANGSTA)
+SIM_REG8(CANGIT)
+SIM_REG8(CANGIE)
+SIM_REG8(CANEN1)
+SIM_REG8(CANEN2)
+SIM_REG8(CANIE1)
+SIM_REG8(CANIE2)
+SIM_REG8(CANSIT1)
+SIM_REG8(CANSIT2)
+SIM_REG8(CANBT1)
+SIM_REG8(CANBT2)
+SIM_REG8(CANBT3)
+SIM_REG8(CANTCON)
+SIM_REG8(CANTEC)
+SIM_REG8(CANREC)
+SIM_REG8(CANHPMOB)
+SIM_REG8(CANPAGE)
+SIM_REG8(CANSTMOB)
+SIM_REG8(CANCDMOB)
+SIM_REG8(CANIDT1)
+SIM_REG8(CANIDT2)
+SIM_REG8(CANIDT3)
+SIM_REG8(CANIDT4)
+SIM_REG8(CANIDM1)
+SIM_REG8(CANIDM2)
+SIM_REG8(CANIDM3)
+SIM_REG8(CANIDM4)
+SIM_REG8(CANMSG)
+
+// ADC
+SIM_REG8(ADCSRA)
+SIM_REG8(ADCSRB)
+SIM_REG8(ADMUX)
+SIM_REG16(ADC)
+SIM_REG8(DIDR0)
+SIM_REG8(DIDR1)
+
+// EEPROM (the contents are in sim/mcu.c)
+SIM_REG8(EECR)
+SIM_REG8(EEDR)
+SIM_REG16(EEAR)
@@ -0,0 +1,26 @@
+/*
+<avr/wdt.h> for the host simulation - the simulation records the longest time
+    between watchdog resets (and counts the ones that would have reset the MCU)
+*/
+
+#ifndef SIM_AVR_WDT_H
+#define SIM_AVR_WDT_H
+
+#include <avr/io.h>
+
+#define WDTO_15MS   0
+#define WDTO_30MS   1
+#define WDTO_60MS   2
+#define WDTO_120MS  3
+#define WDTO_250MS  4
+#define WDTO_500MS  5
+#define WDTO_1S     6
+#define WDTO_2S     7
+#define WDTO_4S     8
+#define WDTO_8S     9
+
+#define wdt_reset()         sim_wdt_reset()
+#define wdt_enable(value)   sim_wdt_enable(value)
+#define wdt_disable()       sim_wdt_disable()
+
+#endif
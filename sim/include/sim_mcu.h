@@ -0,0 +1,32 @@
+/*
+Functions the AVR header shims in sim/include call into (implemented in
+    sim/core.c and sim/mcu.c)
+*/
+
+#ifndef SIM_MCU_H
+#define SIM_MCU_H
+
+#include <stdint.h>
+
+// Global interrupt enable (the I bit in SREG)
+extern volatile uint8_t sim_irq_enabled;
+
+void sim_cli(void);
+void sim_sei(void);
+uint8_t sim_irq_save(void);
+void sim_irq_restore(const uint8_t* saved);
+void sim_irq_force_on(const uint8_t* unused);
+void sim_irq_force_off(const uint8_t* unused);
+
+volatile uint16_t* sim_tcnt1(void);
+volatile uint8_t* sim_tifr1(void);
+volatile uint8_t* sim_linsir(void);
+
+void sim_delay_us(double us);
+void sim_sleep_cpu(void);
+
+void sim_wdt_reset(void);
+void sim_wdt_enable(uint8_t timeout);
+void sim_wdt_disable(void);
+
+#endif
@@ -0,0 +1,41 @@
+/*
+<util/atomic.h> for the host simulation
+
+Same structure as avr-libc (a one-pass for loop with a cleanup variable that
+    restores the interrupt flag), using the simulated interrupt flag instead of
+    SREG. If interrupts are enabled again when a block ends, any interrupt that
+    became due inside the block runs right after it.
+*/
+
+#ifndef SIM_UTIL_ATOMIC_H
+#define SIM_UTIL_ATOMIC_H
+
+#include <stdint.h>
+
+#include <sim_mcu.h>
+
+static __inline__ uint8_t sim_atomic_cli(void) {
+    sim_cli();
+    return 1;
+}
+
+static __inline__ uint8_t sim_atomic_sei(void) {
+    sim_sei();
+    return 1;
+}
+
+#define ATOMIC_BLOCK(type) \
+    for (type, sim_atomic_todo = sim_atomic_cli(); sim_atomic_todo; sim_atomic_todo = 0)
+#define NONATOMIC_BLOCK(type) \
+    for (type, sim_atomic_todo = sim_atomic_sei(); sim_atomic_todo; sim_atomic_todo = 0)
+
+#define ATOMIC_RESTORESTATE \
+    uint8_t sim_sreg_save __attribute__((__cleanup__(sim_irq_restore))) = sim_irq_save()
+#define ATOMIC_FORCEON \
+    uint8_t sim_sreg_save __attribute__((__cleanup__(sim_irq_force_on))) = 0
+#define NONATOMIC_RESTORESTATE \
+    uint8_t sim_sreg_save __attribute__((__cleanup__(sim_irq_restore))) = sim_irq_save()
+#define NONATOMIC_FORCEOFF \
+    uint8_t sim_sreg_save __attribute__((__cleanup__(sim_irq_force_off))) = 0
+
+#endif
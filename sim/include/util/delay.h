@@ -0,0 +1,18 @@
+/*
+<util/delay.h> for the host simulation - delays advance the simulated time
+    (interrupts still run during them, like on the MCU)
+*/
+
+#ifndef SIM_UTIL_DELAY_H
+#define SIM_UTIL_DELAY_H
+
+#include <sim_mcu.h>
+
+#ifndef F_CPU
+#define F_CPU 8000000UL
+#endif
+
+#define _delay_us(us)   sim_delay_us(us)
+#define _delay_ms(ms)   sim_delay_us((ms) * 1000.0)
+
+#endif
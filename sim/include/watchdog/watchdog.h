@@ -0,0 +1,14 @@
+/*
+Replaces lib-common's watchdog.h (which writes the WDT registers directly with
+    timed sequences) for the simulation
+*/
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <avr/wdt.h>
+
+#define WDT_OFF()                       sim_wdt_disable()
+#define WDT_ENABLE_SYS_RESET(timeout)   sim_wdt_enable(timeout)
+
+#endif
@@ -0,0 +1,779 @@
+/*
+Replacements for the lib-common functions used by the OBC, built on the
+    simulated peripherals
+
+The declarations come from lib-common's own headers, so these have to match
+    them. Variables declared by lib-common use __typeof__ so they always have
+    the declared type.
+
+UART - put_uart_char() waits while the UART is busy (LINSIR LBUSY), and each
+    byte reaches the transceiver after its 10 bit times. Received bytes are
+    buffered and passed to the RX callback from the "interrupt", like
+    lib-common.
+SPI - each byte takes 8 SPI clocks (from SPCR/SPSR) and goes to whichever
+    device has its CS low.
+CAN - resume_mob() gets the data from the TX callback in an "interrupt", the
+    frame takes its time on the bus (shared with the responses), and the SSM
+    model answers on the RX mob.
+Uptime - timer 1 compare match once per second (1024 cycle ticks, like
+    lib-common), which also drives TCNT1 and TIFR1. The OBC's own compare B
+    interrupt (OCR1B) is scheduled by sim_check_timer1_compb().
+*/
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <can/can.h>
+#include <heartbeat/heartbeat.h>
+#include <queue/queue.h>
+#include <spi/spi.h>
+#include <uart/uart.h>
+#include <uptime/uptime.h>
+#include <utilities/utilities.h>
+
+#include "i2c.h"
+#include "mem.h"
+#include "rtc.h"
+#include "sim.h"
+
+// CPU cycles charged for a lib-common call that doesn't wait for anything
+#define SIM_CALL_CYCLES     8
+
+#define SIM_UART_RX_BUF_SIZE    50
+#define SIM_UART_PRINT_SIZE     256
+
+#define SIM_CAN_NUM_MOBS    6
+#define SIM_CAN_BPS         125000
+// Time from resume_mob() to the TX interrupt
+#define SIM_CAN_TX_IRQ_NS   (2 * SIM_NS_PER_US)
+
+#define SIM_UPTIME_NUM_CALLBACKS    16
+
+// SPI devices (by CS pin)
+#define SIM_SPI_NONE    0xFF
+#define SIM_SPI_RTC     MEM_NUM_CHIPS
+#define SIM_SPI_I2C     (MEM_NUM_CHIPS + 1)
+#define SIM_SPI_NUM_DEVS (MEM_NUM_CHIPS + 2)
+
+typedef struct {
+    uint8_t mob_num;
+    uint8_t len;
+    uint8_t data[8];
+} sim_can_frame_t;
+
+// lib-common variables
+__typeof__(uptime_s) uptime_s = 0;
+__typeof__(restart_count) restart_count = 0;
+__typeof__(restart_reason) restart_reason = 0;
+
+// UART
+static uint32_t sim_uart_baud_rate = 9600;
+static uart_rx_cb_t sim_uart_rx_cb = NULL;
+static uint8_t sim_uart_rx_buf[SIM_UART_RX_BUF_SIZE];
+static uint8_t sim_uart_rx_count = 0;
+// When the byte being sent is done
+static uint64_t sim_uart_tx_free_ns = 0;
+static volatile uint8_t sim_linsir_value = 0;
+
+// SPI
+static bool sim_spi_selected[SIM_SPI_NUM_DEVS];
+
+// CAN
+static mob_t* sim_can_mobs[SIM_CAN_NUM_MOBS];
+static bool sim_can_paused[SIM_CAN_NUM_MOBS];
+static uint64_t sim_can_bus_free_ns = 0;
+
+// Uptime
+static bool sim_uptime_started = false;
+static uint64_t sim_uptime_last_tick_ns = 0;
+static uint64_t sim_uptime_next_tick_ns = 0;
+static uptime_fn_t sim_uptime_callbacks[SIM_UPTIME_NUM_CALLBACKS];
+static uint8_t sim_uptime_num_callbacks = 0;
+static volatile uint16_t sim_tcnt1_value = 0;
+static volatile uint8_t sim_tifr1_value = 0;
+// When the scheduled compare B interrupt is for (0 if none is scheduled)
+static uint64_t sim_compb_at_ns = 0;
+static uint64_t sim_com_timeout_last_ns = 0;
+static uint64_t sim_com_timeout_max_ns = 0;
+
+typedef struct {
+    uint64_t uart_tx_bytes;
+    uint64_t uart_tx_wait_ns;
+    uint64_t uart_rx_bytes;
+    uint64_t uart_rx_overflows;
+    uint64_t uart_rx_baud_errors;
+    uint64_t spi_bytes[SIM_SPI_NUM_DEVS];
+    uint64_t spi_ns;
+    uint64_t spi_no_device;
+    uint64_t spi_conflicts;
+    uint64_t can_tx_frames;
+    uint64_t can_rx_frames;
+    uint64_t can_rx_no_mob;
+    uint64_t can_bus_ns;
+    uint64_t uptime_callbacks_dropped;
+} sim_bus_stats_t;
+
+static sim_bus_stats_t sim_bus_stats;
+
+
+/* ---------------------------------- UART ---------------------------------- */
+
+void init_uart(void) {
+    sim_uart_baud_rate = 9600;
+    sim_uart_rx_cb = NULL;
+    sim_uart_rx_count = 0;
+}
+
+void set_uart_baud_rate(uart_baud_rate_t baud_rate) {
+    switch (baud_rate) {
+        case UART_BAUD_1200:
+            sim_uart_baud_rate = 1200;
+            break;
+        case UART_BAUD_19200:
+            sim_uart_baud_rate = 19200;
+            break;
+        case UART_BAUD_115200:
+            sim_uart_baud_rate = 115200;
+            break;
+        case UART_BAUD_9600:
+        default:
+            sim_uart_baud_rate = 9600;
+            break;
+    }
+    sim_advance_cycles(SIM_CALL_CYCLES);
+}
+
+uint32_t sim_uart_baud(void) {
+    return sim_uart_baud_rate;
+}
+
+static void sim_uart_tx_done(uintptr_t arg) {
+    sim_trans_uart_byte(arg & 0xFF, (uint32_t) (arg >> 8));
+}
+
+void put_uart_char(uint8_t c) {
+    // Wait for the previous byte
+    if (sim_ns < sim_uart_tx_free_ns) {
+        uint64_t wait = sim_uart_tx_free_ns - sim_ns;
+        sim_bus_stats.uart_tx_wait_ns += wait;
+        sim_advance(wait);
+    }
+
+    sim_uart_tx_free_ns = sim_ns + (10 * SIM_NS_PER_S) / sim_uart_baud_rate;
+    sim_bus_stats.uart_tx_bytes++;
+    sim_schedule(sim_uart_tx_free_ns, SIM_EVENT_DEVICE, sim_uart_tx_done,
+        c | ((uintptr_t) sim_uart_baud_rate << 8));
+    sim_advance_cycles(SIM_CALL_CYCLES);
+}
+
+int print(char* fmt, ...) {
+    char buf[SIM_UART_PRINT_SIZE];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+
+    if (len < 0) {
+        return len;
+    }
+    if (len >= (int) sizeof(buf)) {
+        len = sizeof(buf) - 1;
+    }
+    for (int i = 0; i < len; i++) {
+        put_uart_char((uint8_t) buf[i]);
+    }
+    return len;
+}
+
+void set_uart_rx_cb(uart_rx_cb_t cb) {
+    sim_uart_rx_cb = cb;
+}
+
+void clear_uart_rx_buf(void) {
+    sim_uart_rx_count = 0;
+}
+
+uint8_t get_uart_rx_count(void) {
+    return sim_uart_rx_count;
+}
+
+// LBUSY while a byte is being sent
+volatile uint8_t* sim_linsir(void) {
+    sim_advance_cycles(1);
+    sim_linsir_value = (sim_ns < sim_uart_tx_free_ns) ? _BV(LBUSY) : 0;
+    return &sim_linsir_value;
+}
+
+/*
+UART RX interrupt for a byte from the transceiver (sent at `baud`).
+*/
+void sim_uart_rx_byte(uint8_t byte, uint32_t baud) {
+    if (baud != sim_uart_baud_rate) {
+        sim_bus_stats.uart_rx_baud_errors++;
+        return;
+    }
+    sim_bus_stats.uart_rx_bytes++;
+
+    if (sim_uart_rx_count >= SIM_UART_RX_BUF_SIZE) {
+        sim_bus_stats.uart_rx_overflows++;
+        return;
+    }
+    sim_uart_rx_buf[sim_uart_rx_count++] = byte;
+
+    if (sim_uart_rx_cb == NULL) {
+        return;
+    }
+    uint8_t processed = sim_uart_rx_cb(sim_uart_rx_buf, sim_uart_rx_count);
+    if (processed >= sim_uart_rx_count) {
+        sim_uart_rx_count = 0;
+    } else if (processed > 0) {
+        memmove(sim_uart_rx_buf, &sim_uart_rx_buf[processed],
+            sim_uart_rx_count - processed);
+        sim_uart_rx_count -= processed;
+    }
+}
+
+
+/* ---------------------------------- SPI ----------------------------------- */
+
+void init_spi(void) {
+    // Master, F_CPU / 16, mode 0
+    SPCR = _BV(SPE) | _BV(MSTR) | _BV(SPR0);
+    SPSR = 0;
+}
+
+void set_spi_mode(uint8_t mode) {
+    SPCR = (SPCR & ~(_BV(CPOL) | _BV(CPHA))) |
+        ((mode & 0x02) ? _BV(CPOL) : 0) | ((mode & 0x01) ? _BV(CPHA) : 0);
+}
+
+void reset_spi_mode(void) {
+    set_spi_mode(0);
+}
+
+void init_cs(uint8_t pin, volatile uint8_t* ddr) {
+    *ddr |= _BV(pin);
+}
+
+// Returns the SPI device with its CS on `pin` of `port`
+static uint8_t sim_spi_dev(uint8_t pin, volatile uint8_t* port) {
+    if (port == &MEM_CS_PORT) {
+        if (pin == MEM_CHIP0_CS_PIN) {
+            return 0;
+        }
+        if (pin == MEM_CHIP1_CS_PIN) {
+            return 1;
+        }
+        if (pin == MEM_CHIP2_CS_PIN) {
+            return 2;
+        }
+    }
+    if (port == &RTC_PORT && pin == RTC_CS) {
+        return SIM_SPI_RTC;
+    }
+    if (port == &I2C_CS_PORT && pin == I2C_CS_PIN) {
+        return SIM_SPI_I2C;
+    }
+    return SIM_SPI_NONE;
+}
+
+static void sim_spi_select(uint8_t dev, bool selected) {
+    if (dev == SIM_SPI_NONE) {
+        return;
+    }
+    sim_spi_selected[dev] = selected;
+
+    if (dev < MEM_NUM_CHIPS) {
+        sim_flash_select(dev, selected);
+    } else if (dev == SIM_SPI_RTC) {
+        sim_rtc_select(selected);
+    } else {
+        sim_i2c_select(selected);
+    }
+}
+
+void set_cs_low(uint8_t pin, volatile uint8_t* port) {
+    *port &= ~_BV(pin);
+    sim_spi_select(sim_spi_dev(pin, port), true);
+    sim_advance_cycles(2);
+}
+
+void set_cs_high(uint8_t pin, volatile uint8_t* port) {
+    *port |= _BV(pin);
+    sim_spi_select(sim_spi_dev(pin, port), false);
+    sim_advance_cycles(2);
+}
+
+uint8_t send_spi(uint8_t data) {
+    static const uint8_t dividers[4] = { 4, 16, 64, 128 };
+    uint32_t divider = dividers[SPCR & (_BV(SPR1) | _BV(SPR0))];
+    if (SPSR & _BV(SPI2X)) {
+        divider /= 2;
+    }
+    uint8_t mode = ((SPCR & _BV(CPOL)) ? 2 : 0) | ((SPCR & _BV(CPHA)) ? 1 : 0);
+
+    uint8_t selected = SIM_SPI_NONE;
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < SIM_SPI_NUM_DEVS; i++) {
+        if (sim_spi_selected[i]) {
+            selected = i;
+            count++;
+        }
+    }
+
+    uint8_t ret = 0xFF;
+    if (count == 0) {
+        sim_bus_stats.spi_no_device++;
+    } else if (count > 1) {
+        // Several devices driving MISO
+        sim_bus_stats.spi_conflicts++;
+        ret = 0x00;
+    } else {
+        sim_bus_stats.spi_bytes[selected]++;
+        if (selected < MEM_NUM_CHIPS) {
+            ret = sim_flash_spi(selected, mode, data);
+        } else if (selected == SIM_SPI_RTC) {
+            ret = sim_rtc_spi(mode, data);
+        } else {
+            ret = sim_i2c_spi(mode, data);
+        }
+    }
+
+    // 8 SPI clocks plus the loop waiting for SPIF
+    uint64_t ns = ((8 * divider) + 4) * SIM_CYCLE_NS;
+    sim_bus_stats.spi_ns += ns;
+    sim_advance(ns);
+    return ret;
+}
+
+
+/* ---------------------------------- CAN ----------------------------------- */
+
+void init_can(void) {
+    memset(sim_can_mobs, 0, sizeof(sim_can_mobs));
+}
+
+static void sim_can_init_mob(mob_t* mob) {
+    if (mob->mob_num < SIM_CAN_NUM_MOBS) {
+        sim_can_mobs[mob->mob_num] = mob;
+        sim_can_paused[mob->mob_num] = true;
+    }
+}
+
+void init_rx_mob(mob_t* mob) {
+    sim_can_init_mob(mob);
+    sim_can_paused[mob->mob_num] = false;
+}
+
+void init_tx_mob(mob_t* mob) {
+    sim_can_init_mob(mob);
+}
+
+// Time for a standard frame with `len` data bytes (with some bit stuffing)
+static uint64_t sim_can_frame_ns(uint8_t len) {
+    uint32_t bits = 47 + (8 * len);
+    bits += bits / 8;
+    return ((uint64_t) bits * SIM_NS_PER_S) / SIM_CAN_BPS;
+}
+
+static uint64_t sim_can_bus_slot(uint8_t len) {
+    uint64_t start = (sim_ns > sim_can_bus_free_ns) ? sim_ns : sim_can_bus_free_ns;
+    uint64_t frame_ns = sim_can_frame_ns(len);
+    sim_can_bus_free_ns = start + frame_ns;
+    sim_bus_stats.can_bus_ns += frame_ns;
+    return sim_can_bus_free_ns;
+}
+
+static void sim_can_tx_done(uintptr_t arg) {
+    sim_can_frame_t* frame = (sim_can_frame_t*) arg;
+    sim_can_paused[frame->mob_num] = true;
+    sim_bus_stats.can_tx_frames++;
+    sim_ssm_rx(frame->mob_num, frame->data, frame->len);
+    free(frame);
+}
+
+// TX interrupt - gets the data to send from the mob's callback
+static void sim_can_tx_irq(uintptr_t mob_num) {
+    mob_t* mob = sim_can_mobs[mob_num];
+    sim_can_frame_t* frame = malloc(sizeof(sim_can_frame_t));
+    if (mob == NULL || frame == NULL) {
+        free(frame);
+        return;
+    }
+
+    memset(frame, 0, sizeof(*frame));
+    frame->mob_num = (uint8_t) mob_num;
+    mob->tx_data_cb(frame->data, &frame->len);
+    if (frame->len == 0) {
+        sim_can_paused[mob_num] = true;
+        free(frame);
+        return;
+    }
+    if (frame->len > 8) {
+        frame->len = 8;
+    }
+    sim_schedule(sim_can_bus_slot(frame->len), SIM_EVENT_DEVICE,
+        sim_can_tx_done, (uintptr_t) frame);
+}
+
+void resume_mob(mob_t* mob) {
+    sim_advance_cycles(SIM_CALL_CYCLES);
+    if (mob->mob_num >= SIM_CAN_NUM_MOBS || !sim_can_paused[mob->mob_num]) {
+        return;
+    }
+    sim_can_paused[mob->mob_num] = false;
+    if (mob->mob_type == TX_MOB) {
+        sim_schedule(sim_ns + SIM_CAN_TX_IRQ_NS, SIM_EVENT_IRQ,
+            sim_can_tx_irq, mob->mob_num);
+    }
+}
+
+void pause_mob(mob_t* mob) {
+    if (mob->mob_num < SIM_CAN_NUM_MOBS) {
+        sim_can_paused[mob->mob_num] = true;
+    }
+}
+
+uint8_t is_paused(mob_t* mob) {
+    sim_advance_cycles(SIM_CALL_CYCLES);
+    return mob->mob_num < SIM_CAN_NUM_MOBS && sim_can_paused[mob->mob_num];
+}
+
+// RX interrupt - passes the frame to the RX mob's callback
+static void sim_can_rx_irq(uintptr_t arg) {
+    sim_can_frame_t* frame = (sim_can_frame_t*) arg;
+    bool handled = false;
+    for (uint8_t i = 0; i < SIM_CAN_NUM_MOBS; i++) {
+        mob_t* mob = sim_can_mobs[i];
+        if (mob != NULL && mob->mob_type == RX_MOB && !sim_can_paused[i] &&
+                mob->rx_cb != NULL) {
+            sim_bus_stats.can_rx_frames++;
+            mob->rx_cb(frame->data, frame->len);
+            handled = true;
+            break;
+        }
+    }
+    if (!handled) {
+        sim_bus_stats.can_rx_no_mob++;
+    }
+    free(frame);
+}
+
+/*
+Sends a frame from an SSM to the OBC (starts when the bus is free).
+*/
+void sim_can_rx(const uint8_t* data, uint8_t len) {
+    sim_can_frame_t* frame = malloc(sizeof(sim_can_frame_t));
+    if (frame == NULL) {
+        return;
+    }
+    memset(frame, 0, sizeof(*frame));
+    frame->len = (len > 8) ? 8 : len;
+    memcpy(frame->data, data, frame->len);
+    sim_schedule(sim_can_bus_slot(frame->len), SIM_EVENT_IRQ, sim_can_rx_irq,
+        (uintptr_t) frame);
+}
+
+
+/* --------------------------------- Uptime --------------------------------- */
+
+static uint64_t sim_uptime_period_ns(void) {
+    return ((uint64_t) OCR1A + 1) * 1024 * SIM_CYCLE_NS;
+}
+
+// Timer 1 compare match interrupt
+static void sim_uptime_tick(uintptr_t arg) {
+    (void) arg;
+    uptime_s++;
+    sim_uptime_last_tick_ns = sim_uptime_next_tick_ns;
+    sim_uptime_next_tick_ns += sim_uptime_period_ns();
+    sim_schedule(sim_uptime_next_tick_ns, SIM_EVENT_IRQ, sim_uptime_tick, 0);
+
+    for (uint8_t i = 0; i < sim_uptime_num_callbacks; i++) {
+        sim_uptime_callbacks[i]();
+    }
+}
+
+void init_uptime(void) {
+    if (sim_uptime_started) {
+        return;
+    }
+    // One compare match per second with the /1024 prescaler
+    OCR1A = (SIM_F_CPU / 1024) - 1;
+    sim_uptime_started = true;
+    sim_uptime_last_tick_ns = sim_ns;
+    sim_uptime_next_tick_ns = sim_ns + sim_uptime_period_ns();
+    sim_schedule(sim_uptime_next_tick_ns, SIM_EVENT_IRQ, sim_uptime_tick, 0);
+}
+
+uint8_t add_uptime_callback(uptime_fn_t callback) {
+    if (sim_uptime_num_callbacks >= SIM_UPTIME_NUM_CALLBACKS) {
+        sim_bus_stats.uptime_callbacks_dropped++;
+        return 0;
+    }
+    sim_uptime_callbacks[sim_uptime_num_callbacks++] = callback;
+    return 1;
+}
+
+volatile uint16_t* sim_tcnt1(void) {
+    sim_advance_cycles(1);
+    uint16_t count = 0;
+    if (sim_uptime_started) {
+        uint64_t ticks = (sim_ns - sim_uptime_last_tick_ns) / (1024 * SIM_CYCLE_NS);
+        // The counter restarts at the compare match, even if the interrupt
+        // has not run yet
+        count = (uint16_t) (ticks % ((uint64_t) OCR1A + 1));
+    }
+    sim_tcnt1_value = count;
+    return &sim_tcnt1_value;
+}
+
+void TIMER1_COMPB_vect(void) __attribute__((weak));
+
+static void sim_timer1_compb(uintptr_t arg) {
+    // OCR1B or OCIE1B changed since it was scheduled
+    if ((uint64_t) arg != sim_compb_at_ns) {
+        return;
+    }
+    sim_compb_at_ns = 0;
+    if ((TIMSK1 & _BV(OCIE1B)) && TIMER1_COMPB_vect != NULL) {
+        TIMER1_COMPB_vect();
+    }
+}
+
+/*
+Schedules the timer 1 compare B interrupt for the next time TCNT1 reaches
+    OCR1B, if it is enabled. The registers are plain variables, so this is
+    called for each main loop pass and before sleeping instead of when they
+    are written.
+*/
+void sim_check_timer1_compb(void) {
+    if (!sim_uptime_started || !(TIMSK1 & _BV(OCIE1B))) {
+        return;
+    }
+
+    uint64_t tick_ns = 1024 * SIM_CYCLE_NS;
+    uint64_t at_ns = sim_uptime_last_tick_ns + ((uint64_t) OCR1B * tick_ns);
+    if (at_ns <= sim_ns) {
+        at_ns = sim_uptime_next_tick_ns + ((uint64_t) OCR1B * tick_ns);
+    }
+    if (at_ns == sim_compb_at_ns) {
+        return;
+    }
+    sim_compb_at_ns = at_ns;
+    sim_schedule(at_ns, SIM_EVENT_IRQ, sim_timer1_compb, (uintptr_t) at_ns);
+}
+
+volatile uint8_t* sim_tifr1(void) {
+    sim_tifr1_value = (sim_uptime_started && sim_ns >= sim_uptime_next_tick_ns) ?
+        _BV(OCF1A) : 0;
+    return &sim_tifr1_value;
+}
+
+void reset_self_mcu(uint32_t reason) {
+    char msg[64];
+    snprintf(msg, sizeof(msg), "OBC reset itself (reason 0x%02lx)",
+        (unsigned long) reason);
+    sim_finish(msg);
+}
+
+void init_com_timeout(void) {
+    sim_com_timeout_last_ns = sim_ns;
+}
+
+void restart_com_timeout(void) {
+    uint64_t gap = sim_ns - sim_com_timeout_last_ns;
+    if (gap > sim_com_timeout_max_ns) {
+        sim_com_timeout_max_ns = gap;
+    }
+    sim_com_timeout_last_ns = sim_ns;
+}
+
+
+/* ----------------------------- Heartbeat ---------------------------------- */
+
+void init_hb(uint8_t self) {
+    (void) self;
+}
+
+// Called once per main loop pass
+void run_hb(void) {
+    sim_count_loop();
+}
+
+
+/* ----------------------------- Utilities ---------------------------------- */
+
+static volatile uint8_t* sim_port_for_ddr(volatile uint8_t* ddr) {
+    if (ddr == &DDRB) {
+        return &PORTB;
+    }
+    if (ddr == &DDRC) {
+        return &PORTC;
+    }
+    if (ddr == &DDRD) {
+        return &PORTD;
+    }
+    if (ddr == &DDRE) {
+        return &PORTE;
+    }
+    return NULL;
+}
+
+void init_output_pin(uint8_t pin, volatile uint8_t* ddr, uint8_t val) {
+    *ddr |= _BV(pin);
+    volatile uint8_t* port = sim_port_for_ddr(ddr);
+    if (port != NULL) {
+        if (val) {
+            *port |= _BV(pin);
+        } else {
+            *port &= ~_BV(pin);
+        }
+    }
+}
+
+void init_input_pin(uint8_t pin, volatile uint8_t* ddr) {
+    *ddr &= ~_BV(pin);
+}
+
+void set_pin_high(uint8_t pin, volatile uint8_t* port) {
+    *port |= _BV(pin);
+    sim_advance_cycles(2);
+}
+
+void set_pin_low(uint8_t pin, volatile uint8_t* port) {
+    *port &= ~_BV(pin);
+    sim_advance_cycles(2);
+}
+
+uint8_t get_pin_val(uint8_t pin, volatile uint8_t* port) {
+    sim_advance_cycles(SIM_CALL_CYCLES);
+    if (port == &I2C_INT_PORT && pin == I2C_INT_PIN) {
+        return sim_i2c_int_pin() ? 1 : 0;
+    }
+    // Other inputs (e.g. the RTC alarm interrupt) are pulled up
+    if (port == &PORTB && !(DDRB & _BV(pin))) {
+        return 1;
+    }
+    return (*port >> pin) & 0x01;
+}
+
+void print_bytes(uint8_t* data, uint8_t len) {
+    for (uint8_t i = 0; i < len; i++) {
+        print("%.2X ", data[i]);
+    }
+    print("\n");
+}
+
+uint32_t read_eeprom(uint16_t addr) {
+    return eeprom_read_dword((const uint32_t*) (uintptr_t) addr);
+}
+
+void write_eeprom(uint16_t addr, uint32_t data) {
+    eeprom_update_dword((uint32_t*) (uintptr_t) addr, data);
+}
+
+uint32_t read_eeprom_or_default(uint16_t addr, uint32_t default_data) {
+    uint32_t data = read_eeprom(addr);
+    if (data == EEPROM_DEF_DWORD) {
+        return default_data;
+    }
+    return data;
+}
+
+
+/* ---------------------------------- Queue --------------------------------- */
+
+// Ring buffer, one slot is left empty to tell full from empty
+
+void init_queue(queue_t* queue) {
+    queue->head = 0;
+    queue->tail = 0;
+}
+
+uint8_t queue_size(queue_t* queue) {
+    return (queue->tail + MAX_QUEUE_SIZE - queue->head) % MAX_QUEUE_SIZE;
+}
+
+uint8_t queue_full(queue_t* queue) {
+    return queue_size(queue) == MAX_QUEUE_SIZE - 1;
+}
+
+uint8_t queue_empty(queue_t* queue) {
+    return queue->head == queue->tail;
+}
+
+void enqueue(queue_t* queue, const uint8_t* data) {
+    if (queue_full(queue)) {
+        return;
+    }
+    memcpy(queue->content[queue->tail], data, QUEUE_DATA_SIZE);
+    queue->tail = (queue->tail + 1) % MAX_QUEUE_SIZE;
+}
+
+void enqueue_front(queue_t* queue, const uint8_t* data) {
+    if (queue_full(queue)) {
+        return;
+    }
+    queue->head = (queue->head + MAX_QUEUE_SIZE - 1) % MAX_QUEUE_SIZE;
+    memcpy(queue->content[queue->head], data, QUEUE_DATA_SIZE);
+}
+
+void dequeue(queue_t* queue, uint8_t* data) {
+    if (queue_empty(queue)) {
+        return;
+    }
+    memcpy(data, queue->content[queue->head], QUEUE_DATA_SIZE);
+    queue->head = (queue->head + 1) % MAX_QUEUE_SIZE;
+}
+
+void peek_queue(queue_t* queue, uint8_t* data) {
+    if (queue_empty(queue)) {
+        return;
+    }
+    memcpy(data, queue->content[queue->head], QUEUE_DATA_SIZE);
+}
+
+
+void sim_report_bus(FILE* out) {
+    sim_bus_stats_t* s = &sim_bus_stats;
+    fprintf(out, "\n-- UART --\n");
+    fprintf(out, "OBC: %u baud, %llu bytes sent (%.3f s waiting for the UART), "
+        "%llu bytes received\n",
+        sim_uart_baud_rate, (unsigned long long) s->uart_tx_bytes,
+        (double) s->uart_tx_wait_ns / SIM_NS_PER_S,
+        (unsigned long long) s->uart_rx_bytes);
+    fprintf(out, "Errors: %llu RX buffer overflows, %llu bytes received at the "
+        "wrong baud rate\n",
+        (unsigned long long) s->uart_rx_overflows,
+        (unsigned long long) s->uart_rx_baud_errors);
+
+    fprintf(out, "\n-- SPI --\n");
+    fprintf(out, "Bytes: flash %llu/%llu/%llu, RTC %llu, I2C bridge %llu "
+        "(%.3f s on the bus)\n",
+        (unsigned long long) s->spi_bytes[0], (unsigned long long) s->spi_bytes[1],
+        (unsigned long long) s->spi_bytes[2],
+        (unsigned long long) s->spi_bytes[SIM_SPI_RTC],
+        (unsigned long long) s->spi_bytes[SIM_SPI_I2C],
+        (double) s->spi_ns / SIM_NS_PER_S);
+    fprintf(out, "Errors: %llu bytes with no device selected, %llu with several "
+        "devices selected\n",
+        (unsigned long long) s->spi_no_device,
+        (unsigned long long) s->spi_conflicts);
+
+    fprintf(out, "\n-- CAN --\n");
+    fprintf(out, "Frames: %llu sent, %llu received (%llu with no RX mob), "
+        "bus busy %.2f%% of the time\n",
+        (unsigned long long) s->can_tx_frames,
+        (unsigned long long) s->can_rx_frames,
+        (unsigned long long) s->can_rx_no_mob,
+        (sim_ns > 0) ? (100.0 * s->can_bus_ns / sim_ns) : 0.0);
+
+    fprintf(out, "\n-- Uptime --\n");
+    fprintf(out, "uptime_s = %lu, %u callbacks (%llu dropped), longest gap "
+        "between communication timeout restarts %.1f s\n",
+        (unsigned long) uptime_s, sim_uptime_num_callbacks,
+        (unsigned long long) s->uptime_callbacks_dropped,
+        (double) sim_com_timeout_max_ns / SIM_NS_PER_S);
+}
@@ -0,0 +1,230 @@
+/*
+Simulated MCU - I/O registers, EEPROM, delays, watchdog and the main loop
+    statistics (including the profiler table when built with -DPROFILER)
+*/
+
+#include <string.h>
+
+#include <avr/eeprom.h>
+#include <avr/io.h>
+
+#include "profiler.h"
+#include "sim.h"
+
+#define SIM_REG8(name)  volatile uint8_t name = 0;
+#define SIM_REG16(name) volatile uint16_t name = 0;
+#include <avr/sim_regs.h>
+#undef SIM_REG8
+#undef SIM_REG16
+
+#define SIM_EEPROM_SIZE (E2END + 1)
+// Time to write one EEPROM byte (erase and write)
+#define SIM_EEPROM_WRITE_NS (3400 * SIM_NS_PER_US)
+
+static uint8_t sim_eeprom[SIM_EEPROM_SIZE];
+static uint64_t sim_eeprom_reads = 0;
+static uint64_t sim_eeprom_writes = 0;
+static uint64_t sim_eeprom_out_of_range = 0;
+
+// Watchdog
+static bool sim_wdt_on = false;
+static uint64_t sim_wdt_timeout_ns = 0;
+static uint64_t sim_wdt_last_ns = 0;
+static uint64_t sim_wdt_max_gap_ns = 0;
+static uint64_t sim_wdt_expired = 0;
+
+// Main loop
+static uint64_t sim_loop_count = 0;
+static uint64_t sim_delay_ns = 0;
+
+
+void sim_init_mcu(void) {
+    memset(sim_eeprom, 0xFF, sizeof(sim_eeprom));
+    // Power-on reset
+    MCUSR = _BV(PORF);
+}
+
+
+static bool sim_eeprom_addr_ok(uintptr_t addr, size_t n) {
+    if (addr + n > SIM_EEPROM_SIZE) {
+        sim_eeprom_out_of_range++;
+        return false;
+    }
+    return true;
+}
+
+void eeprom_read_block(void* dst, const void* src, size_t n) {
+    uintptr_t addr = (uintptr_t) src;
+    memset(dst, 0xFF, n);
+    if (sim_eeprom_addr_ok(addr, n)) {
+        memcpy(dst, &sim_eeprom[addr], n);
+    }
+    sim_eeprom_reads += n;
+    sim_advance_cycles(4 * n);
+}
+
+void eeprom_update_block(const void* src, void* dst, size_t n) {
+    uintptr_t addr = (uintptr_t) dst;
+    if (!sim_eeprom_addr_ok(addr, n)) {
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        uint8_t value = ((const uint8_t*) src)[i];
+        if (sim_eeprom[addr + i] != value) {
+            sim_eeprom[addr + i] = value;
+            sim_eeprom_writes++;
+            sim_advance(SIM_EEPROM_WRITE_NS);
+        }
+    }
+}
+
+void eeprom_write_block(const void* src, void* dst, size_t n) {
+    uintptr_t addr = (uintptr_t) dst;
+    if (!sim_eeprom_addr_ok(addr, n)) {
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        sim_eeprom[addr + i] = ((const uint8_t*) src)[i];
+        sim_eeprom_writes++;
+        sim_advance(SIM_EEPROM_WRITE_NS);
+    }
+}
+
+uint8_t eeprom_read_byte(const uint8_t* addr) {
+    uint8_t value;
+    eeprom_read_block(&value, addr, sizeof(value));
+    return value;
+}
+
+uint16_t eeprom_read_word(const uint16_t* addr) {
+    uint16_t value;
+    eeprom_read_block(&value, addr, sizeof(value));
+    return value;
+}
+
+uint32_t eeprom_read_dword(const uint32_t* addr) {
+    uint32_t value;
+    eeprom_read_block(&value, addr, sizeof(value));
+    return value;
+}
+
+void eeprom_write_byte(uint8_t* addr, uint8_t value) {
+    eeprom_write_block(&value, addr, sizeof(value));
+}
+
+void eeprom_write_word(uint16_t* addr, uint16_t value) {
+    eeprom_write_block(&value, addr, sizeof(value));
+}
+
+void eeprom_write_dword(uint32_t* addr, uint32_t value) {
+    eeprom_write_block(&value, addr, sizeof(value));
+}
+
+void eeprom_update_byte(uint8_t* addr, uint8_t value) {
+    eeprom_update_block(&value, addr, sizeof(value));
+}
+
+void eeprom_update_word(uint16_t* addr, uint16_t value) {
+    eeprom_update_block(&value, addr, sizeof(value));
+}
+
+void eeprom_update_dword(uint32_t* addr, uint32_t value) {
+    eeprom_update_block(&value, addr, sizeof(value));
+}
+
+
+void sim_delay_us(double us) {
+    if (us <= 0) {
+        return;
+    }
+    uint64_t ns = (uint64_t) (us * SIM_NS_PER_US);
+    sim_delay_ns += ns;
+    sim_advance(ns);
+}
+
+
+/*
+Records the time since the last reset. If it is longer than the timeout, the
+    MCU would have been reset (the simulation keeps going so the report shows
+    what took so long).
+*/
+void sim_wdt_reset(void) {
+    if (sim_wdt_on) {
+        uint64_t gap = sim_ns - sim_wdt_last_ns;
+        if (gap > sim_wdt_max_gap_ns) {
+            sim_wdt_max_gap_ns = gap;
+        }
+        if (gap > sim_wdt_timeout_ns) {
+            sim_wdt_expired++;
+        }
+    }
+    sim_wdt_last_ns = sim_ns;
+}
+
+// WDTO_* values are 16ms * 2^value
+void sim_wdt_enable(uint8_t timeout) {
+    sim_wdt_reset();
+    sim_wdt_on = true;
+    sim_wdt_timeout_ns = (16 * SIM_NS_PER_MS) << timeout;
+}
+
+void sim_wdt_disable(void) {
+    sim_wdt_reset();
+    sim_wdt_on = false;
+}
+
+
+// Called for each main loop pass (from run_hb())
+void sim_count_loop(void) {
+    sim_loop_count++;
+    sim_check_timer1_compb();
+    sim_advance(SIM_LOOP_NS);
+}
+
+void sim_report_mcu(FILE* out) {
+    fprintf(out, "\n-- MCU --\n");
+    fprintf(out, "Main loop passes: %llu (%.1f per simulated second)\n",
+        (unsigned long long) sim_loop_count,
+        (sim_ns > 0) ? ((double) sim_loop_count * SIM_NS_PER_S / sim_ns) : 0.0);
+    fprintf(out, "Busy-wait delays: %.3f s\n",
+        (double) sim_delay_ns / SIM_NS_PER_S);
+
+    uint64_t gap = sim_ns - sim_wdt_last_ns;
+    if (gap < sim_wdt_max_gap_ns) {
+        gap = sim_wdt_max_gap_ns;
+    }
+    fprintf(out, "Watchdog: longest gap between resets %.3f s (timeout %.3f s), "
+        "%llu expired\n",
+        (double) gap / SIM_NS_PER_S,
+        (double) sim_wdt_timeout_ns / SIM_NS_PER_S,
+        (unsigned long long) sim_wdt_expired);
+
+    fprintf(out, "EEPROM: %llu bytes read, %llu bytes written, "
+        "%llu out of range accesses\n",
+        (unsigned long long) sim_eeprom_reads,
+        (unsigned long long) sim_eeprom_writes,
+        (unsigned long long) sim_eeprom_out_of_range);
+
+#ifdef PROFILER
+    static const char* stage_names[PROF_NUM_STAGES] = {
+        "HB", "TICK", "TRANS_RX", "CMD", "CMD_LOG", "MEM_ERASE", "CAN_TX",
+        "CAN_RX", "DATA_COLS", "TRANS_TX"
+    };
+    // One tick is 1024 cycles
+    double tick_ms = 1024.0 * 1000.0 / SIM_F_CPU;
+
+    fprintf(out, "\nProfiler (main loop stages):\n");
+    fprintf(out, "%-10s %10s %12s %10s %10s\n",
+        "stage", "count", "total (ms)", "avg (ms)", "max (ms)");
+    for (uint8_t i = 0; i < PROF_NUM_STAGES; i++) {
+        prof_stage_t* stage = &prof_stages[i];
+        fprintf(out, "%-10s %10lu %12.1f %10.3f %10.3f\n",
+            stage_names[i], (unsigned long) stage->count,
+            stage->total_ticks * tick_ms,
+            (stage->count > 0) ? (stage->total_ticks * tick_ms / stage->count) : 0.0,
+            stage->max_ticks * tick_ms);
+    }
+    fprintf(out, "Longest atomic block: %.3f ms\n",
+        prof_atomic_max_ticks * tick_ms);
+#endif
+}
@@ -0,0 +1,121 @@
+/*
+Host simulation of the OBC
+
+The real OBC code (src/) is compiled for the host and linked with replacements
+    for the AVR headers (sim/include) and lib-common (sim/lib_common.c). The
+    peripherals are simulated on a virtual clock:
+- flash memory (3 SST26 chips), RTC and I2C bridge on the SPI bus
+- transceiver on the UART, with a simulated ground station sending commands
+- EPS and PAY on the CAN bus
+
+Time only advances when the OBC waits on something (SPI and UART bytes,
+    delays, sleeping until the next interrupt) plus a fixed cost for each main
+    loop pass. The CPU time of the OBC code itself is not modelled, so the
+    results show I/O bound latencies and throughput, not instruction timing.
+*/
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <sim_mcu.h>
+
+// MCU clock (the uptime timer, SPI clock and UART bit times are based on it)
+#define SIM_F_CPU       8000000ULL
+
+#define SIM_NS_PER_S    1000000000ULL
+#define SIM_NS_PER_MS   1000000ULL
+#define SIM_NS_PER_US   1000ULL
+
+// Time for one CPU cycle
+#define SIM_CYCLE_NS    (SIM_NS_PER_S / SIM_F_CPU)
+// Time charged for each main loop pass (decoding the events and calling the
+//     handlers, which is not otherwise modelled)
+#define SIM_LOOP_NS     (20 * SIM_NS_PER_US)
+
+// MCU interrupts only run when interrupts are enabled and no other ISR is
+// running, device events run at their time no matter what the OBC is doing
+#define SIM_EVENT_DEVICE    0
+#define SIM_EVENT_IRQ       1
+
+typedef void (*sim_event_fn_t)(uintptr_t arg);
+
+// Command line options
+typedef struct {
+    // Simulated time to run for
+    uint64_t duration_ns;
+    // Seed for all random choices
+    uint64_t seed;
+    // Time from the start of the run to the first ground command
+    uint64_t ground_start_ns;
+    // Minimum time between ground commands
+    uint64_t ground_gap_ns;
+    // Ground commands without a response before it waits
+    uint32_t ground_window;
+    // Time to wait for a response before giving up on a command
+    uint64_t ground_timeout_ns;
+    // Probability of corrupting an uplink packet or dropping a CAN response
+    double fault_prob;
+    // Ground command script (NULL for a random mix)
+    const char* script;
+    // Print the OBC UART output
+    bool verbose;
+} sim_opts_t;
+
+extern sim_opts_t sim_opts;
+extern uint64_t sim_ns;
+extern bool sim_in_isr;
+
+// core.c
+void sim_schedule(uint64_t at_ns, uint8_t type, sim_event_fn_t fn, uintptr_t arg);
+void sim_advance(uint64_t ns);
+void sim_advance_cycles(uint32_t cycles);
+uint64_t sim_rand(void);
+double sim_rand_unit(void);
+void sim_finish(const char* reason);
+
+// mcu.c
+void sim_init_mcu(void);
+void sim_count_loop(void);
+void sim_report_mcu(FILE* out);
+
+// flash.c
+void sim_init_flash(void);
+uint8_t sim_flash_spi(uint8_t chip, uint8_t mode, uint8_t byte);
+void sim_flash_select(uint8_t chip, bool selected);
+void sim_report_flash(FILE* out);
+
+// devices.c
+uint8_t sim_rtc_spi(uint8_t mode, uint8_t byte);
+void sim_rtc_select(bool selected);
+uint8_t sim_i2c_spi(uint8_t mode, uint8_t byte);
+void sim_i2c_select(bool selected);
+bool sim_i2c_int_pin(void);
+void sim_report_devices(FILE* out);
+
+// trans.c
+void sim_init_trans(void);
+void sim_trans_uart_byte(uint8_t byte, uint32_t baud);
+void sim_trans_uplink(const uint8_t* pkt, uint8_t len);
+void sim_report_trans(FILE* out);
+
+// lib_common.c
+void sim_uart_rx_byte(uint8_t byte, uint32_t baud);
+uint32_t sim_uart_baud(void);
+void sim_can_rx(const uint8_t* data, uint8_t len);
+void sim_check_timer1_compb(void);
+void sim_report_bus(FILE* out);
+
+// ssm.c
+void sim_ssm_rx(uint8_t mob_num, const uint8_t* data, uint8_t len);
+void sim_report_ssm(FILE* out);
+
+// ground.c
+void sim_init_ground(void);
+void sim_ground_downlink(const uint8_t* pkt, uint8_t len);
+void sim_report_ground(FILE* out);
+
+#endif
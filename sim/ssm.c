@@ -0,0 +1,129 @@
+/*
+Simulated EPS and PAY (the subsystem microcontrollers on the CAN bus)
+
+Every request is answered after a processing time, with the same opcode and
+    field number, an OK status and a 24-bit value that changes slowly over
+    time. Optical measurements take longer than housekeeping fields. With the
+    -f option, some responses are dropped so the OBC's field timeouts are
+    exercised.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <can/data_protocol.h>
+#include <can/ids.h>
+
+#include "sim.h"
+
+// Time to measure a field and respond
+#define SIM_SSM_HK_NS       (2 * SIM_NS_PER_MS)
+#define SIM_SSM_OPT_NS      (30 * SIM_NS_PER_MS)
+#define SIM_SSM_CTRL_NS     (500 * SIM_NS_PER_US)
+
+typedef struct {
+    uint8_t from_mob;
+    uint8_t len;
+    uint8_t data[8];
+} sim_ssm_msg_t;
+
+typedef struct {
+    uint64_t eps_reqs;
+    uint64_t pay_reqs;
+    uint64_t resps;
+    uint64_t dropped;
+    uint64_t latency_ns;
+} sim_ssm_stats_t;
+
+static sim_ssm_stats_t sim_ssm_stats;
+// Requests being processed (one at a time for each SSM)
+static uint64_t sim_ssm_free_ns[2] = { 0, 0 };
+
+
+static void sim_ssm_respond(uintptr_t arg) {
+    sim_ssm_msg_t* msg = (sim_ssm_msg_t*) arg;
+    sim_ssm_stats.resps++;
+    sim_can_rx(msg->data, 8);
+    free(msg);
+}
+
+/*
+Called when a frame from the OBC has been sent on TX mob `mob_num`.
+*/
+void sim_ssm_rx(uint8_t mob_num, const uint8_t* data, uint8_t len) {
+    bool eps = (mob_num == EPS_CMD_MOB_NUM);
+    if (eps) {
+        sim_ssm_stats.eps_reqs++;
+    } else {
+        sim_ssm_stats.pay_reqs++;
+    }
+    if (len < 2) {
+        return;
+    }
+
+    if (sim_opts.fault_prob > 0 && sim_rand_unit() < sim_opts.fault_prob) {
+        sim_ssm_stats.dropped++;
+        return;
+    }
+
+    uint8_t opcode = data[0];
+    uint8_t field = data[1];
+    uint64_t ns;
+    switch (opcode) {
+        case CAN_PAY_OPT:
+            ns = SIM_SSM_OPT_NS;
+            break;
+        case CAN_EPS_CTRL:
+        case CAN_PAY_CTRL:
+            ns = SIM_SSM_CTRL_NS;
+            break;
+        default:
+            ns = SIM_SSM_HK_NS;
+            break;
+    }
+    // Some jitter (up to 25%)
+    ns += (uint64_t) (ns * 0.25 * sim_rand_unit());
+
+    uint64_t* free_ns = &sim_ssm_free_ns[eps ? 0 : 1];
+    uint64_t start = (sim_ns > *free_ns) ? sim_ns : *free_ns;
+    *free_ns = start + ns;
+    sim_ssm_stats.latency_ns += *free_ns - sim_ns;
+
+    sim_ssm_msg_t* msg = malloc(sizeof(sim_ssm_msg_t));
+    if (msg == NULL) {
+        return;
+    }
+    memset(msg, 0, sizeof(*msg));
+    msg->from_mob = mob_num;
+    msg->len = 8;
+    msg->data[0] = opcode;
+    msg->data[1] = field;
+    msg->data[2] = CAN_STATUS_OK;
+    msg->data[3] = 0x00;
+    // Value that drifts with time and differs for each field
+    uint32_t value = (((uint32_t) field * 0x10101) +
+        (uint32_t) (sim_ns / (10 * SIM_NS_PER_S))) & 0xFFFFFF;
+    // Control messages echo their argument
+    if (opcode == CAN_EPS_CTRL || opcode == CAN_PAY_CTRL) {
+        value = ((uint32_t) data[4] << 24) | ((uint32_t) data[5] << 16) |
+            ((uint32_t) data[6] << 8) | data[7];
+    }
+    msg->data[4] = (value >> 24) & 0xFF;
+    msg->data[5] = (value >> 16) & 0xFF;
+    msg->data[6] = (value >> 8) & 0xFF;
+    msg->data[7] = value & 0xFF;
+
+    sim_schedule(*free_ns, SIM_EVENT_DEVICE, sim_ssm_respond, (uintptr_t) msg);
+}
+
+void sim_report_ssm(FILE* out) {
+    sim_ssm_stats_t* s = &sim_ssm_stats;
+    uint64_t reqs = s->eps_reqs + s->pay_reqs;
+    uint64_t answered = reqs - s->dropped;
+    fprintf(out, "\n-- SSMs --\n");
+    fprintf(out, "Requests: %llu to EPS, %llu to PAY, %llu responses, "
+        "%llu dropped (fault injection), average response time %.2f ms\n",
+        (unsigned long long) s->eps_reqs, (unsigned long long) s->pay_reqs,
+        (unsigned long long) s->resps, (unsigned long long) s->dropped,
+        (answered > 0) ? ((double) s->latency_ns / answered / SIM_NS_PER_MS) : 0.0);
+}
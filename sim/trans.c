@@ -0,0 +1,426 @@
+/*
+Simulated transceiver (EnduroSat UHF) on the OBC's UART
+
+Bytes from the OBC are handled like the real transceiver in pipe mode:
+- "ES+..." command lines (terminated by '\r') are answered with "OK..." plus
+  the CRC32, after a short processing time
+- packets (delimiter, length, delimiter, ...) are transmitted to the ground
+  station over the RF link
+- anything else (debug output) is counted and ignored
+
+Packets from the ground station are received over the RF link and written to
+    the OBC's UART. Both directions of the UART use the baud rate from the
+    status register (bits 13-12), and bytes sent at a different rate come out
+    as garbage. The RF data rate depends on the RF mode (bits 10-8).
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+#define SIM_TRANS_DEF_SCW       0x0303
+#define SIM_TRANS_ADDR          0x22
+#define SIM_TRANS_RSSI          0x60
+#define SIM_TRANS_LINE_SIZE     200
+#define SIM_TRANS_PKT_DELIMITER 0x55
+#define SIM_TRANS_PKT_MAX_SIZE  (255 + 9)
+// Time to process a command before the response starts
+#define SIM_TRANS_CMD_NS        (2 * SIM_NS_PER_MS)
+// Preamble, sync word, header and CRC sent with each RF packet
+#define SIM_TRANS_RF_OVERHEAD   12
+
+typedef struct {
+    uint8_t len;
+    uint8_t data[SIM_TRANS_PKT_MAX_SIZE];
+} sim_trans_pkt_t;
+
+static uint16_t sim_trans_scw = SIM_TRANS_DEF_SCW;
+static uint8_t sim_trans_reset_count = 0;
+static uint32_t sim_trans_freq = 0x7CB3BE94;
+static uint8_t sim_trans_pipe_timeout = 30;
+static uint16_t sim_trans_beacon_period = 30;
+static char sim_trans_dest_call_sign[7] = "VA3ZBR";
+static char sim_trans_src_call_sign[7] = "VE3OSB";
+
+// Command line being received
+static char sim_trans_line[SIM_TRANS_LINE_SIZE];
+static uint32_t sim_trans_line_len = 0;
+// Packet being received (from the OBC)
+static uint8_t sim_trans_pkt[SIM_TRANS_PKT_MAX_SIZE];
+static uint32_t sim_trans_pkt_pos = 0;
+static uint32_t sim_trans_pkt_len = 0;
+
+// When the UART to the OBC and the RF link are free
+static uint64_t sim_trans_uart_free_ns = 0;
+static uint64_t sim_trans_rf_free_ns = 0;
+
+typedef struct {
+    uint64_t cmds;
+    uint64_t cmd_crc_errors;
+    uint64_t baud_errors;
+    uint64_t baud_changes;
+    uint64_t resets;
+    uint64_t beacon_updates;
+    uint64_t text_bytes;
+    uint64_t tx_pkts;
+    uint64_t tx_bytes;
+    uint64_t rx_pkts;
+    uint64_t rx_bytes;
+    uint64_t rf_busy_ns;
+} sim_trans_stats_t;
+
+static sim_trans_stats_t sim_trans_stats;
+
+
+static uint32_t sim_trans_crc32(const uint8_t* data, uint32_t len) {
+    uint32_t crc = 0xFFFFFFFF;
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+        }
+    }
+    return ~crc;
+}
+
+static uint32_t sim_trans_baud_for_bits(uint8_t bits) {
+    switch (bits & 0x3) {
+        case 0x1:
+            return 1200;
+        case 0x2:
+            return 19200;
+        case 0x3:
+            return 115200;
+        default:
+            return 9600;
+    }
+}
+
+static uint32_t sim_trans_baud(void) {
+    return sim_trans_baud_for_bits((sim_trans_scw >> 12) & 0x3);
+}
+
+// RF data rate (bps) for the RF mode (p. 15)
+static uint32_t sim_trans_rf_bps(void) {
+    static const uint32_t rates[8] = {
+        1200, 2400, 4800, 9600, 9600, 19200, 19200, 19200
+    };
+    return rates[(sim_trans_scw >> 8) & 0x7];
+}
+
+static uint64_t sim_trans_rf_airtime_ns(uint32_t len) {
+    return ((uint64_t) (len + SIM_TRANS_RF_OVERHEAD) * 8 * SIM_NS_PER_S) /
+        sim_trans_rf_bps();
+}
+
+void sim_init_trans(void) {
+    memset(&sim_trans_stats, 0, sizeof(sim_trans_stats));
+}
+
+static void sim_trans_uart_tx_event(uintptr_t arg) {
+    sim_uart_rx_byte(arg & 0xFF, (uint32_t) (arg >> 8));
+}
+
+/*
+Sends bytes to the OBC over the UART, starting at `start_ns` (or when the
+    previous bytes are done).
+Returns the time the last byte is received.
+*/
+static uint64_t sim_trans_uart_tx(const uint8_t* data, uint32_t len,
+        uint64_t start_ns) {
+    uint32_t baud = sim_trans_baud();
+    // 10 bits per byte (start, 8 data, stop)
+    uint64_t byte_ns = (10 * SIM_NS_PER_S) / baud;
+    uint64_t t = (start_ns > sim_trans_uart_free_ns) ? start_ns : sim_trans_uart_free_ns;
+
+    for (uint32_t i = 0; i < len; i++) {
+        t += byte_ns;
+        sim_schedule(t, SIM_EVENT_IRQ, sim_trans_uart_tx_event,
+            data[i] | ((uintptr_t) baud << 8));
+    }
+    sim_trans_uart_free_ns = t;
+    return t;
+}
+
+// Sends "<text> <CRC32>\r" to the OBC
+static uint64_t sim_trans_respond(const char* text) {
+    char buf[SIM_TRANS_LINE_SIZE];
+    uint32_t crc = sim_trans_crc32((const uint8_t*) text, strlen(text));
+    int len = snprintf(buf, sizeof(buf), "%s %08X\r", text, crc);
+    return sim_trans_uart_tx((const uint8_t*) buf, len, sim_ns + SIM_TRANS_CMD_NS);
+}
+
+static void sim_trans_set_scw_event(uintptr_t arg) {
+    uint16_t scw = (uint16_t) arg;
+    if (((scw ^ sim_trans_scw) >> 12) & 0x3) {
+        sim_trans_stats.baud_changes++;
+    }
+    if (scw & (1 << 11)) {
+        // The reset bit clears itself
+        scw &= ~(1 << 11);
+        sim_trans_reset_count++;
+        sim_trans_stats.resets++;
+    }
+    sim_trans_scw = scw;
+}
+
+static uint32_t sim_trans_hex(const char* s, uint32_t count) {
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < count && s[i] != '\0'; i++) {
+        char c = s[i];
+        uint32_t digit = 0;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        }
+        value = (value << 4) | digit;
+    }
+    return value;
+}
+
+/*
+Handles a command line "ES+<R|W><addr><reg>[payload] <CRC32>" (without '\r').
+*/
+static void sim_trans_handle_cmd(char* line, uint32_t len) {
+    sim_trans_stats.cmds++;
+
+    char* space = strrchr(line, ' ');
+    if (space == NULL || len < 8 || (line + len) - space != 9) {
+        sim_trans_stats.cmd_crc_errors++;
+        sim_trans_respond("ERR");
+        return;
+    }
+    *space = '\0';
+    uint32_t body_len = space - line;
+    if (sim_trans_crc32((const uint8_t*) line, body_len) !=
+            sim_trans_hex(space + 1, 8)) {
+        sim_trans_stats.cmd_crc_errors++;
+        sim_trans_respond("ERR");
+        return;
+    }
+
+    char op = line[3];
+    uint8_t addr = (uint8_t) sim_trans_hex(&line[4], 2);
+    uint8_t reg = (uint8_t) sim_trans_hex(&line[6], 2);
+    const char* payload = &line[8];
+    if (addr != SIM_TRANS_ADDR || (op != 'R' && op != 'W')) {
+        sim_trans_respond("ERR");
+        return;
+    }
+
+    char resp[SIM_TRANS_LINE_SIZE];
+    uint32_t value = 0;
+
+    if (op == 'W') {
+        switch (reg) {
+            case 0x00: {
+                uint16_t scw = (uint16_t) sim_trans_hex(payload, 4);
+                snprintf(resp, sizeof(resp), "OK+%02X%02X",
+                    SIM_TRANS_RSSI, sim_trans_reset_count);
+                uint64_t done = sim_trans_respond(resp);
+                // The new baud rate is used after the response
+                sim_schedule(done, SIM_EVENT_DEVICE, sim_trans_set_scw_event, scw);
+                return;
+            }
+            case 0x01:
+                sim_trans_freq = sim_trans_hex(payload, 8);
+                break;
+            case 0x06:
+                sim_trans_pipe_timeout = (uint8_t) sim_trans_hex(payload, 8);
+                break;
+            case 0x07:
+                sim_trans_beacon_period = (uint16_t) sim_trans_hex(payload, 8);
+                break;
+            case 0xF5:
+                snprintf(sim_trans_dest_call_sign, sizeof(sim_trans_dest_call_sign),
+                    "%.6s", payload);
+                break;
+            case 0xF6:
+                snprintf(sim_trans_src_call_sign, sizeof(sim_trans_src_call_sign),
+                    "%.6s", payload);
+                break;
+            case 0xFB:
+                sim_trans_stats.beacon_updates++;
+                break;
+            default:
+                break;
+        }
+        sim_trans_respond("OK");
+        return;
+    }
+
+    switch (reg) {
+        case 0x00:
+            snprintf(resp, sizeof(resp), "OK+%02X%02X%02X%04X", SIM_TRANS_RSSI,
+                SIM_TRANS_ADDR, sim_trans_reset_count, sim_trans_scw);
+            sim_trans_respond(resp);
+            return;
+        case 0xF5:
+            snprintf(resp, sizeof(resp), "OK+%-6.6s", sim_trans_dest_call_sign);
+            sim_trans_respond(resp);
+            return;
+        case 0xF6:
+            snprintf(resp, sizeof(resp), "OK+%-6.6s", sim_trans_src_call_sign);
+            sim_trans_respond(resp);
+            return;
+        case 0x01:
+            value = sim_trans_freq;
+            break;
+        case 0x02:
+            value = (uint32_t) (sim_ns / SIM_NS_PER_S);
+            break;
+        case 0x03:
+            value = (uint32_t) sim_trans_stats.tx_pkts;
+            break;
+        case 0x04:
+            value = (uint32_t) sim_trans_stats.rx_pkts;
+            break;
+        case 0x05:
+            value = 0;
+            break;
+        case 0x06:
+            value = sim_trans_pipe_timeout;
+            break;
+        case 0x07:
+            value = sim_trans_beacon_period;
+            break;
+        default:
+            break;
+    }
+    snprintf(resp, sizeof(resp), "OK+%02X%08X", SIM_TRANS_RSSI, value);
+    sim_trans_respond(resp);
+}
+
+static void sim_trans_downlink_event(uintptr_t arg) {
+    sim_trans_pkt_t* pkt = (sim_trans_pkt_t*) arg;
+    sim_ground_downlink(pkt->data, pkt->len);
+    free(pkt);
+}
+
+// Transmits a complete packet from the OBC to the ground station
+static void sim_trans_transmit(const uint8_t* data, uint32_t len) {
+    sim_trans_pkt_t* pkt = malloc(sizeof(sim_trans_pkt_t));
+    if (pkt == NULL) {
+        return;
+    }
+    memcpy(pkt->data, data, len);
+    pkt->len = (uint8_t) len;
+
+    uint64_t start = (sim_ns > sim_trans_rf_free_ns) ? sim_ns : sim_trans_rf_free_ns;
+    uint64_t airtime = sim_trans_rf_airtime_ns(len);
+    sim_trans_rf_free_ns = start + airtime;
+    sim_trans_stats.rf_busy_ns += airtime;
+    sim_trans_stats.tx_pkts++;
+    sim_trans_stats.tx_bytes += len;
+    sim_schedule(sim_trans_rf_free_ns, SIM_EVENT_DEVICE, sim_trans_downlink_event,
+        (uintptr_t) pkt);
+}
+
+static void sim_trans_text_byte(uint8_t byte) {
+    if (byte == '\r') {
+        sim_trans_line[sim_trans_line_len] = '\0';
+        if (sim_trans_line_len >= 3 && strncmp(sim_trans_line, "ES+", 3) == 0) {
+            sim_trans_handle_cmd(sim_trans_line, sim_trans_line_len);
+        } else {
+            sim_trans_stats.text_bytes += sim_trans_line_len + 1;
+        }
+        sim_trans_line_len = 0;
+        return;
+    }
+    if (byte == '\n' || sim_trans_line_len >= SIM_TRANS_LINE_SIZE - 1) {
+        sim_trans_stats.text_bytes += sim_trans_line_len + 1;
+        sim_trans_line_len = 0;
+        return;
+    }
+    sim_trans_line[sim_trans_line_len++] = (char) byte;
+}
+
+static void sim_trans_pkt_byte(uint8_t byte) {
+    uint32_t pos = sim_trans_pkt_pos;
+
+    if (pos == 0) {
+        // Only start a packet at the start of a line (debug output can
+        // contain 'U')
+        if (byte != SIM_TRANS_PKT_DELIMITER || sim_trans_line_len != 0) {
+            sim_trans_text_byte(byte);
+            return;
+        }
+    } else if (pos == 1) {
+        sim_trans_pkt_len = byte + 9;
+    } else if (pos == 2 && byte != SIM_TRANS_PKT_DELIMITER) {
+        // Not a packet, it was text
+        sim_trans_pkt_pos = 0;
+        sim_trans_text_byte(sim_trans_pkt[0]);
+        sim_trans_text_byte(sim_trans_pkt[1]);
+        sim_trans_pkt_byte(byte);
+        return;
+    }
+
+    sim_trans_pkt[pos] = byte;
+    sim_trans_pkt_pos = pos + 1;
+    if (pos >= 2 && sim_trans_pkt_pos >= sim_trans_pkt_len) {
+        sim_trans_transmit(sim_trans_pkt, sim_trans_pkt_len);
+        sim_trans_pkt_pos = 0;
+    }
+}
+
+/*
+Called when a byte from the OBC has been received over the UART.
+baud - the OBC's UART baud rate when it sent the byte
+*/
+void sim_trans_uart_byte(uint8_t byte, uint32_t baud) {
+    if (sim_opts.verbose) {
+        fputc(byte == '\r' ? '\n' : byte, stderr);
+    }
+
+    if (baud != sim_trans_baud()) {
+        // Comes out as garbage, which also breaks any line or packet in
+        // progress
+        sim_trans_stats.baud_errors++;
+        sim_trans_line_len = 0;
+        sim_trans_pkt_pos = 0;
+        return;
+    }
+
+    sim_trans_pkt_byte(byte);
+}
+
+/*
+Starts receiving a packet from the ground station (`len` bytes, already
+    encoded).
+*/
+void sim_trans_uplink(const uint8_t* pkt, uint8_t len) {
+    uint64_t start = (sim_ns > sim_trans_rf_free_ns) ? sim_ns : sim_trans_rf_free_ns;
+    uint64_t airtime = sim_trans_rf_airtime_ns(len);
+    sim_trans_rf_free_ns = start + airtime;
+    sim_trans_stats.rf_busy_ns += airtime;
+    sim_trans_stats.rx_pkts++;
+    sim_trans_stats.rx_bytes += len;
+
+    sim_trans_uart_tx(pkt, len, sim_trans_rf_free_ns);
+}
+
+void sim_report_trans(FILE* out) {
+    sim_trans_stats_t* s = &sim_trans_stats;
+    fprintf(out, "\n-- Transceiver --\n");
+    fprintf(out, "UART: %u baud, %llu baud rate changes, %llu bytes received at "
+        "the wrong baud rate\n",
+        sim_trans_baud(), (unsigned long long) s->baud_changes,
+        (unsigned long long) s->baud_errors);
+    fprintf(out, "Commands: %llu (%llu bad format/CRC), %llu resets, "
+        "%llu beacon content updates\n",
+        (unsigned long long) s->cmds, (unsigned long long) s->cmd_crc_errors,
+        (unsigned long long) s->resets, (unsigned long long) s->beacon_updates);
+    fprintf(out, "RF (%u bps): %llu packets (%llu bytes) down, %llu packets "
+        "(%llu bytes) up, busy %.1f%% of the time\n",
+        sim_trans_rf_bps(),
+        (unsigned long long) s->tx_pkts, (unsigned long long) s->tx_bytes,
+        (unsigned long long) s->rx_pkts, (unsigned long long) s->rx_bytes,
+        (sim_ns > 0) ? (100.0 * s->rf_busy_ns / sim_ns) : 0.0);
+    fprintf(out, "Other UART output (debug text): %llu bytes\n",
+        (unsigned long long) s->text_bytes);
+}
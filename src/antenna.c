@@ -13,137 +13,250 @@ void init_ant(void) {
 }
 
 /*
-NOTE: Must call init_spi() followed by init_i2c() before this function
+Deployment
+
+This runs as a state machine that steps forward once per second from the main
+    loop (run_ant_dep()), so commands, data collection and the command timeout
+    timers keep running during the several minutes it can take. All I2C
+    transactions go through the asynchronous queue (see i2c.c).
+
+1. Blink the warning LED for 10 seconds
+2. Clear any antenna commands in progress
+3. Algorithm 1 for all doors, until the antenna is idle or 70 seconds
+4. Algorithm 2 for the doors that are not open, 35 seconds per door
+5. If any doors are still closed (or I2C isn't working), burn each release
+    resistor for 10 seconds
+
+If reading the antenna data fails, the algorithm for that step is skipped.
+The progress and last antenna data can be read with the get antenna deployment
+    status command.
 */
-void deploy_antenna(void) {
-    // 10 second delay before start deploying antenna
-    for (uint32_t seconds = 0; seconds < 10; seconds++) {
-        WDT_ENABLE_SYS_RESET(WDTO_8S);
-        print("Antenna deploying now!\n");
-
-        for (uint8_t i = 0; i < 10; i++) {
-            // blink antenna warn light
-            set_pin_high(ANT_DEP_WARN, &PORT_ANT_WARN);
-            _delay_ms(50);
-            set_pin_low(ANT_DEP_WARN, &PORT_ANT_WARN);
-            _delay_ms(50);
-        }
+
+ant_dep_t ant_dep = {
+    .state = ANT_DEP_STATE_IDLE
+};
+
+static void set_ant_dep_state(uint8_t state) {
+    ant_dep.state = state;
+    ant_dep.state_s = 0;
+    ant_dep.timeout_s = 0;
+    ant_dep.cmd_sent = false;
+}
+
+static void ant_dep_read_cb(bool success, uint8_t status, uint8_t* data,
+        uint8_t len) {
+    ant_dep.read_pending = false;
+    ant_dep.read_done = true;
+    ant_dep.read_ok = success;
+    ant_dep.i2c_status = status;
+    for (uint8_t i = 0; i < sizeof(ant_dep.data); i++) {
+        ant_dep.data[i] = (success && i < len) ? data[i] : 0x00;
     }
+}
 
-    // Set 369 kHz clock
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        write_i2c_reg(I2C_CLOCK, 5);
+/*
+Returns true if a read of the antenna data has finished that the current state
+    has not used yet. Otherwise starts one (if there isn't one waiting) and
+    returns false.
+*/
+static bool ant_dep_read(void) {
+    if (ant_dep.read_done) {
+        ant_dep.read_done = false;
+        return true;
+    }
+    if (!ant_dep.read_pending &&
+            enqueue_i2c_read(ANTENNA_I2C_ADDRESS, sizeof(ant_dep.data),
+                ant_dep_read_cb)) {
+        ant_dep.read_pending = true;
     }
+    return false;
+}
 
-    // Check Ant doors before the release algorithm FB1
-    uint8_t door_positions[4] = {0x00, 0x00, 0x00, 0x00};
-    uint8_t mode = 0x00;
-    uint8_t main_heaters[4] = {0x00, 0x00, 0x00, 0x00};
-    uint8_t backup_heaters[4] = {0x00, 0x00, 0x00, 0x00};
-    uint8_t timer_s = 0x00;
-    uint8_t i2c_status = 0x00;
-    uint8_t ret = 0;
+// Writes a 1 byte antenna command (after any reads already queued)
+static void ant_dep_write(uint8_t cmd) {
+    enqueue_i2c_write(ANTENNA_I2C_ADDRESS, &cmd, 1, NULL);
+    ant_dep.cmd_sent = true;
+    ant_dep.state_s = 0;
+}
 
-    // Clear all in progress antenna commands
-    ret = read_antenna_data(door_positions, &mode, main_heaters, backup_heaters, &timer_s, &i2c_status);
-    if (ret) {
-        write_antenna_clear(&i2c_status);
-        _delay_ms(1000);
-    }
-
-    // Start algorithm 1 for all doors, each door takes a maximum of 15 seconds
-    // The mode is only valid if reading antenna data over I2C was successful
-    print("Alg1\n");
-    ret = read_antenna_data(door_positions, &mode, main_heaters, backup_heaters, &timer_s, &i2c_status);
-    if (ret) {
-        write_antenna_alg1(&i2c_status);
-        ret = read_antenna_data(door_positions, &mode, main_heaters, backup_heaters, &timer_s, &i2c_status);
-        
-        uint8_t timeout = 70; //Wait more than 15*4=60 seconds for algorithm to finish
-        while (mode != 0 && timeout > 0) {
-            WDT_ENABLE_SYS_RESET(WDTO_8S);
-            _delay_ms(1000);
-            read_antenna_data(door_positions, &mode, main_heaters, backup_heaters, &timer_s, &i2c_status);
-            timeout -= 1;
+// Mode from the last read (0 if the antenna is idle)
+static uint8_t ant_dep_mode(void) {
+    return ant_dep.data[0] & 0x03;
+}
+
+// Bit i is set if door i + 1 was closed in the last read
+static uint8_t ant_dep_closed_doors(void) {
+    return ~(ant_dep.data[0] >> 4) & 0x0F;
+}
+
+static uint8_t count_doors(uint8_t doors) {
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < 4; i++) {
+        if (doors & (0x01 << i)) {
+            count++;
         }
     }
+    return count;
+}
 
-    // Use algorithm 2 on doors not open
-    print("Alg2\n");
-    ret = read_antenna_data(door_positions, &mode, main_heaters, backup_heaters, &timer_s, &i2c_status);
-    if (ret) {
-        // Get doors that are unopened and need to be redeployed
-        uint8_t doors_to_redeploy = 0x00;
-        uint8_t num_doors = 0;
-        for (uint8_t i = 0; i < 4; i++) {
-            // Door closed and heaters not on
-            if (!door_positions[i]) {
-                num_doors += 1;
-                doors_to_redeploy = doors_to_redeploy | (0x01 << i);
-            }
-        }
+/*
+Starts deploying the antenna (the warning LED first).
+NOTE: Must call init_spi() followed by init_i2c() before this function
+*/
+void start_ant_dep(void) {
+    ant_dep.read_pending = false;
+    ant_dep.read_done = false;
+    ant_dep.read_ok = false;
+    ant_dep.i2c_status = 0x00;
+    for (uint8_t i = 0; i < sizeof(ant_dep.data); i++) {
+        ant_dep.data[i] = 0x00;
+    }
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ant_dep.prev_uptime_s = uptime_s;
+    }
 
-        // Start Algorithm 2 for not opened doors
-        write_antenna_alg2(doors_to_redeploy, &i2c_status);
-        ret = read_antenna_data(door_positions, &mode, main_heaters, backup_heaters, &timer_s, &i2c_status);
-        
-#ifdef ANTENNA_DEBUG
-        print_bytes(&doors_to_redeploy, 1);
-#endif
+    set_ant_dep_state(ANT_DEP_STATE_WARN);
+}
 
-        // Wait ~35seconds per door for algorithm to finish
-        uint8_t timeout = 35 * num_doors;
-        while (mode != 0 && timeout > 0) {
-            WDT_ENABLE_SYS_RESET(WDTO_8S);
-            _delay_ms(1000);
-            ret = read_antenna_data(door_positions, &mode, main_heaters, backup_heaters, &timer_s, &i2c_status);
-            timeout -= 1;
-        }
+/*
+Steps the antenna deployment forward (call from the main loop, does nothing
+    if it is not in progress or if it already stepped during this second).
+*/
+void run_ant_dep(void) {
+    if (ant_dep.state == ANT_DEP_STATE_IDLE ||
+            ant_dep.state == ANT_DEP_STATE_DONE) {
+        return;
     }
 
-    // Check which doors are still open
-    uint8_t num_doors = 0;
-    ret = read_antenna_data(door_positions, &mode, main_heaters, backup_heaters, &timer_s, &i2c_status);
-    if (ret) {
-        for (uint8_t i = 0; i < 4; i ++) {
-            // Door closed and heaters not on
-            if (!door_positions[i]) {
-                num_doors += 1;
-            }
-        }
-
-        write_antenna_clear(&i2c_status);
-        _delay_ms(1000);
+    uint32_t now_s = 0;
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        now_s = uptime_s;
     }
-    else {
-        num_doors = 4;
+    if (now_s == ant_dep.prev_uptime_s) {
+        return;
+    }
+    ant_dep.prev_uptime_s = now_s;
+    if (ant_dep.state_s < UINT8_MAX) {
+        ant_dep.state_s++;
     }
 
-    // Doors are still open (could be because I2C failed)
-    print("Rel\n");
-    if (num_doors > 0) {
-        // Manual release for 10 seconds for each burning resistor
+    switch (ant_dep.state) {
+        case ANT_DEP_STATE_WARN:
+            print("Antenna deploying now!\n");
+            // Blink antenna warning LED on/off for even/odd seconds
+            if (ant_dep.state_s % 2 == 0) {
+                set_pin_high(ANT_DEP_WARN, &PORT_ANT_WARN);
+            } else {
+                set_pin_low(ANT_DEP_WARN, &PORT_ANT_WARN);
+            }
 
-        print("RelA\n");
-        set_pin_high(ANT_REL_A, &PORT_ANT_REL);
-        for (uint8_t seconds = 0; seconds < 10; seconds += 1) {
-            WDT_ENABLE_SYS_RESET(WDTO_8S);
-            _delay_ms(1000);
-        }
-        set_pin_low(ANT_REL_A, &PORT_ANT_REL);
+            if (ant_dep.state_s >= ANT_DEP_WARN_S) {
+                set_pin_low(ANT_DEP_WARN, &PORT_ANT_WARN);
+                // Set 369 kHz clock
+                write_i2c_reg(I2C_CLOCK, 5);
+                set_ant_dep_state(ANT_DEP_STATE_CLEAR);
+            }
+            break;
 
-        _delay_ms(1000);
+        case ANT_DEP_STATE_CLEAR:
+            if (!ant_dep_read()) {
+                break;
+            }
+            if (ant_dep.read_ok) {
+                ant_dep_write(ANT_CMD_CLEAR);
+            }
+            set_ant_dep_state(ANT_DEP_STATE_ALG1);
+            break;
 
-        print("RelB\n");
-        set_pin_high(ANT_REL_B, &PORT_ANT_REL);
-        for (uint8_t seconds = 0; seconds < 10; seconds += 1) {
-            WDT_ENABLE_SYS_RESET(WDTO_8S);
-            _delay_ms(1000);
-        }
-        set_pin_low(ANT_REL_B, &PORT_ANT_REL);
-    }
+        // The mode is only valid if reading antenna data over I2C was
+        // successful
+        case ANT_DEP_STATE_ALG1:
+            if (!ant_dep_read()) {
+                break;
+            }
+            if (!ant_dep.cmd_sent) {
+                if (!ant_dep.read_ok) {
+                    set_ant_dep_state(ANT_DEP_STATE_ALG2);
+                    break;
+                }
+                print("Alg1\n");
+                ant_dep_write(ANT_CMD_ALG1);
+                ant_dep.timeout_s = ANT_DEP_ALG1_TIMEOUT_S;
+                break;
+            }
+            if (ant_dep_mode() == 0 || ant_dep.state_s >= ant_dep.timeout_s) {
+                set_ant_dep_state(ANT_DEP_STATE_ALG2);
+            }
+            break;
+
+        case ANT_DEP_STATE_ALG2:
+            if (!ant_dep_read()) {
+                break;
+            }
+            if (!ant_dep.cmd_sent) {
+                uint8_t doors = ant_dep_closed_doors();
+                if (!ant_dep.read_ok || doors == 0) {
+                    set_ant_dep_state(ANT_DEP_STATE_CHECK);
+                    break;
+                }
+                print("Alg2\n");
+#ifdef ANTENNA_DEBUG
+                print_bytes(&doors, 1);
+#endif
+                ant_dep_write(ANT_CMD_ALG2 | doors);
+                ant_dep.timeout_s = ANT_DEP_ALG2_DOOR_TIMEOUT_S *
+                    count_doors(doors);
+                break;
+            }
+            if (ant_dep_mode() == 0 || ant_dep.state_s >= ant_dep.timeout_s) {
+                set_ant_dep_state(ANT_DEP_STATE_CHECK);
+            }
+            break;
+
+        // Doors can still be closed because I2C failed
+        case ANT_DEP_STATE_CHECK:
+            if (!ant_dep_read()) {
+                break;
+            }
+            if (ant_dep.read_ok) {
+                ant_dep_write(ANT_CMD_CLEAR);
+            }
+            if (!ant_dep.read_ok || ant_dep_closed_doors() != 0) {
+                print("RelA\n");
+                set_pin_high(ANT_REL_A, &PORT_ANT_REL);
+                set_ant_dep_state(ANT_DEP_STATE_REL_A);
+            } else {
+                print("Done deployment\n");
+                set_ant_dep_state(ANT_DEP_STATE_DONE);
+            }
+            break;
+
+        case ANT_DEP_STATE_REL_A:
+            if (ant_dep.state_s >= ANT_DEP_REL_S) {
+                set_pin_low(ANT_REL_A, &PORT_ANT_REL);
+                set_ant_dep_state(ANT_DEP_STATE_REL_GAP);
+            }
+            break;
+
+        case ANT_DEP_STATE_REL_GAP:
+            if (ant_dep.state_s >= ANT_DEP_REL_GAP_S) {
+                print("RelB\n");
+                set_pin_high(ANT_REL_B, &PORT_ANT_REL);
+                set_ant_dep_state(ANT_DEP_STATE_REL_B);
+            }
+            break;
+
+        case ANT_DEP_STATE_REL_B:
+            if (ant_dep.state_s >= ANT_DEP_REL_S) {
+                set_pin_low(ANT_REL_B, &PORT_ANT_REL);
+                print("Done deployment\n");
+                set_ant_dep_state(ANT_DEP_STATE_DONE);
+            }
+            break;
 
-    print("Done deployment");
+        default:
+            break;
+    }
 }
 
 /*
@@ -162,7 +275,7 @@ uint8_t read_antenna_data(uint8_t* door_positions, uint8_t* mode,
     uint8_t ret = 0;
 
     // Make sure I2C operation won't be interrupted
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         ret = read_i2c(ANTENNA_I2C_ADDRESS, data, 3, &status);
     }
 
@@ -205,7 +318,7 @@ uint8_t write_antenna_alg1(uint8_t* i2c_status) {
 #endif
     uint8_t data[1] = {0x1F};
     uint8_t ret = 0;
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         ret = write_i2c(ANTENNA_I2C_ADDRESS, data, 1, i2c_status);
     }
     return ret;
@@ -219,7 +332,7 @@ uint8_t write_antenna_alg2(uint8_t ant_num_in_bytes, uint8_t* i2c_status) {
     uint8_t data[1] = {0x20};
     data[0] = data[0] | ant_num_in_bytes;
     uint8_t ret = 0;
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         ret = write_i2c(ANTENNA_I2C_ADDRESS, data, 1, i2c_status);
     }
     return ret;
@@ -232,7 +345,7 @@ uint8_t write_antenna_clear(uint8_t* i2c_status) {
 #endif
     uint8_t data[1] = {0x00};
     uint8_t ret = 0;
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         ret = write_i2c(ANTENNA_I2C_ADDRESS, data, 1, i2c_status);
     }
     return ret;
@@ -1,6 +1,9 @@
 #ifndef ANTENNA_H
 #define ANTENNA_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include <avr/eeprom.h>
 
 #include <uart/uart.h>
@@ -8,6 +11,7 @@
 #include <watchdog/watchdog.h>
 
 #include "i2c.h"
+#include "profiler.h"
 
 // Antenna I2C address according to the datasheet
 #define ANTENNA_I2C_ADDRESS ((uint8_t) 0x33)
@@ -20,9 +24,57 @@
 #define PORT_ANT_WARN   PORTD
 #define DDR_ANT_WARN    DDRD
 
+// Antenna deployment states (see run_ant_dep())
+#define ANT_DEP_STATE_IDLE      0x00    // Not started yet
+#define ANT_DEP_STATE_WARN      0x01    // Blinking the warning LED
+#define ANT_DEP_STATE_CLEAR     0x02    // Clearing in progress antenna commands
+#define ANT_DEP_STATE_ALG1      0x03    // Algorithm 1 for all doors
+#define ANT_DEP_STATE_ALG2      0x04    // Algorithm 2 for doors not open
+#define ANT_DEP_STATE_CHECK     0x05    // Checking which doors are still closed
+#define ANT_DEP_STATE_REL_A     0x06    // Manual release with resistor A
+#define ANT_DEP_STATE_REL_GAP   0x07    // Between the manual releases
+#define ANT_DEP_STATE_REL_B     0x08    // Manual release with resistor B
+#define ANT_DEP_STATE_DONE      0x09
+
+// Times for each deployment state (in seconds)
+#define ANT_DEP_WARN_S              10
+// Each door takes a maximum of 15 seconds, so wait more than 15 * 4 = 60
+#define ANT_DEP_ALG1_TIMEOUT_S      70
+#define ANT_DEP_ALG2_DOOR_TIMEOUT_S 35
+#define ANT_DEP_REL_S               10
+#define ANT_DEP_REL_GAP_S           1
+
+// Antenna commands (written as 1 byte)
+#define ANT_CMD_CLEAR   0x00
+#define ANT_CMD_ALG1    0x1F
+#define ANT_CMD_ALG2    0x20
+
+typedef struct {
+    uint8_t state;
+    // Seconds since the current state (or its algorithm) started
+    uint8_t state_s;
+    // Time allowed for the algorithm in the current state
+    uint8_t timeout_s;
+    // True if the antenna command for the current state has been written
+    bool cmd_sent;
+    // True if an I2C read of the antenna data is waiting
+    bool read_pending;
+    // True if a read finished that the current state has not used yet
+    bool read_done;
+    // Result of the last read (data is all 0 if it failed)
+    bool read_ok;
+    uint8_t i2c_status;
+    uint8_t data[3];
+    // Uptime of the last step (one step per second)
+    uint32_t prev_uptime_s;
+} ant_dep_t;
+
+extern ant_dep_t ant_dep;
+
 
 void init_ant(void);
-void deploy_antenna(void);
+void start_ant_dep(void);
+void run_ant_dep(void);
 uint8_t read_antenna_data(uint8_t* door_positions, uint8_t* mode,
         uint8_t* main_heaters, uint8_t* backup_heaters, uint8_t* timer_s,
         uint8_t* i2c_status);
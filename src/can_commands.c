@@ -5,28 +5,93 @@
 
 queue_t eps_tx_msg_queue;
 queue_t pay_tx_msg_queue;
-queue_t data_rx_msg_queue;
+
+// Received frames, one ring per consumer so a frame never has to be looked at
+// (or put back) by a consumer it isn't for
+// Responses for the data collections
+can_rx_ring_t eps_hk_rx_ring;
+can_rx_ring_t pay_hk_rx_ring;
+can_rx_ring_t pay_opt_rx_ring;
+// All other responses (e.g. for the send CAN message commands)
+can_rx_ring_t gen_rx_ring;
 
 
 // Set to true to print TX and RX CAN messages
 bool print_can_msgs = false;
 
 
-// If there is an RX messsage in the queue, process it
-void process_next_rx_msg(void) {
-    uint8_t msg[8] = {0x00};
+void init_can_rx_rings(void) {
+    can_rx_ring_t* rings[] = {
+        &eps_hk_rx_ring, &pay_hk_rx_ring, &pay_opt_rx_ring, &gen_rx_ring
+    };
+    for (uint8_t i = 0; i < sizeof(rings) / sizeof(rings[0]); i++) {
+        rings[i]->head = 0;
+        rings[i]->tail = 0;
+    }
+}
 
-    uint8_t opcode = 0;
-    uint8_t status = 0;
+// Returns the ring that a received frame with this opcode (byte 0) goes to
+can_rx_ring_t* can_rx_ring_for_opcode(uint8_t opcode) {
+    switch (opcode) {
+        case CAN_EPS_HK:
+            return &eps_hk_rx_ring;
+        case CAN_PAY_HK:
+            return &pay_hk_rx_ring;
+        case CAN_PAY_OPT:
+            return &pay_opt_rx_ring;
+        default:
+            return &gen_rx_ring;
+    }
+}
 
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        if (queue_empty(&data_rx_msg_queue)) {
-            return;
-        }
-        // Remove it from the queue, but we might put it back after
-        dequeue(&data_rx_msg_queue, msg);
+bool can_rx_ring_empty(can_rx_ring_t* ring) {
+    return ring->head == ring->tail;
+}
+
+/*
+Adds a frame to the ring (only called by the producer).
+msg - 8 bytes of the CAN message
+Returns false if the ring is full (the frame is dropped).
+*/
+bool enqueue_can_rx_ring(can_rx_ring_t* ring, const uint8_t* msg) {
+    uint8_t tail = ring->tail;
+    if ((uint8_t) (tail - ring->head) >= CAN_RX_RING_SIZE) {
+        return false;
+    }
+
+    volatile uint8_t* slot = ring->msgs[tail & (CAN_RX_RING_SIZE - 1)];
+    for (uint8_t i = 0; i < 8; i++) {
+        slot[i] = msg[i];
     }
-    
+    // Only make the frame visible after it is copied
+    ring->tail = tail + 1;
+    return true;
+}
+
+/*
+Removes the oldest frame from the ring (only called by the consumer).
+msg - set to the 8 bytes of the CAN message
+Returns false if the ring is empty.
+*/
+bool dequeue_can_rx_ring(can_rx_ring_t* ring, uint8_t* msg) {
+    uint8_t head = ring->head;
+    if (head == ring->tail) {
+        return false;
+    }
+
+    volatile uint8_t* slot = ring->msgs[head & (CAN_RX_RING_SIZE - 1)];
+    for (uint8_t i = 0; i < 8; i++) {
+        msg[i] = slot[i];
+    }
+    // Only give the slot back to the producer after it is copied
+    ring->head = head + 1;
+    return true;
+}
+
+/*
+Processes a received message that is not for a data collection in progress
+*/
+static void process_gen_rx_msg(uint8_t* msg) {
     if (print_can_msgs) {
         // Extra spaces to align with CAN TX messages
         print("CAN RX:       ");
@@ -34,27 +99,12 @@ void process_next_rx_msg(void) {
     }
 
     // Break down the message into components
-    opcode = msg[0];
-    status = msg[2];
-
-    // If we are in the middle of a collect data block command for this type,
-    // don't remove it from the queue
-    if ((opcode == CAN_EPS_HK && cmd_queue_contains_col_data_block(CMD_EPS_HK)) ||
-            (opcode == CAN_PAY_HK && cmd_queue_contains_col_data_block(CMD_PAY_HK)) ||
-            (opcode == CAN_PAY_OPT && cmd_queue_contains_col_data_block(CMD_PAY_OPT))) {
-        enqueue_front(&data_rx_msg_queue, msg);
-        if (print_can_msgs) {
-            print("Re-enqueued\n");
-        }
-        return;
-    }
-
-    // Continue with processing this message here
+    uint8_t status = msg[2];
 
     //General CAN message command-Intercept and send back data
     // Use the status received in the CAN message as the command status
     if ((current_cmd == &send_eps_can_msg_cmd) || (current_cmd == &send_pay_can_msg_cmd)) {
-        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
             start_trans_tx_resp(status);
             for (uint8_t i = 0; i < 8; i++) {
                 append_to_trans_tx_resp(msg[i]);
@@ -65,6 +115,52 @@ void process_next_rx_msg(void) {
     }
 }
 
+/*
+Processes the messages in one RX ring
+At most CAN_RX_RING_SIZE messages are processed, so messages arriving
+    continuously can't block the main loop.
+data_col_ring - true if the ring has responses for a data collection
+Returns true if there are still messages left in the ring.
+*/
+static bool process_can_rx_ring(can_rx_ring_t* ring, bool data_col_ring) {
+    uint8_t msg[8] = {0x00};
+
+    for (uint8_t i = 0; i < CAN_RX_RING_SIZE; i++) {
+        if (!dequeue_can_rx_ring(ring, msg)) {
+            return false;
+        }
+
+        // If we are in the middle of a collect data block command for this
+        // type, the message goes straight to the collection
+        // Otherwise (e.g. the response to a send CAN message command that
+        // requested a HK field), it is processed like any other response
+        if (!data_col_ring || !handle_data_col_rx_msg(msg)) {
+            process_gen_rx_msg(msg);
+        }
+    }
+
+    return !can_rx_ring_empty(ring);
+}
+
+/*
+Processes the received messages in the RX rings
+Each ring is processed separately, so collections from different subsystems
+    running at the same time don't wait for each other's responses and a stale
+    message only affects its own ring.
+*/
+void process_next_rx_msg(void) {
+    bool more = false;
+    more |= process_can_rx_ring(&eps_hk_rx_ring, true);
+    more |= process_can_rx_ring(&pay_hk_rx_ring, true);
+    more |= process_can_rx_ring(&pay_opt_rx_ring, true);
+    more |= process_can_rx_ring(&gen_rx_ring, false);
+
+    if (more) {
+        // Continue on the next pass
+        set_event(EVENT_CAN_RX);
+    }
+}
+
 
 
 
@@ -89,7 +185,15 @@ void send_next_eps_tx_msg(void) {
         print_bytes(tx_msg, 8);
     }
 
-    resume_mob(&eps_cmd_tx_mob);
+    // The RX interrupt can also resume the mob (see cmd_rx_callback())
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (is_paused(&eps_cmd_tx_mob)) {
+            resume_mob(&eps_cmd_tx_mob);
+        } else {
+            // Still sending the previous message, try again on the next pass
+            set_event(EVENT_CAN_TX);
+        }
+    }
 }
 
 /*
@@ -113,7 +217,15 @@ void send_next_pay_tx_msg(void) {
         print_bytes(tx_msg, 8);
     }
 
-    resume_mob(&pay_cmd_tx_mob);
+    // The RX interrupt can also resume the mob (see cmd_rx_callback())
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (is_paused(&pay_cmd_tx_mob)) {
+            resume_mob(&pay_cmd_tx_mob);
+        } else {
+            // Still sending the previous message, try again on the next pass
+            set_event(EVENT_CAN_TX);
+        }
+    }
 }
 
 
@@ -132,6 +244,7 @@ void enqueue_tx_msg_bytes(queue_t* queue, uint32_t data1, uint32_t data2) {
     msg[7] = data2 & 0xFF;
 
     enqueue(queue, msg);
+    set_event(EVENT_CAN_TX);
 }
 
 /*
@@ -153,4 +266,5 @@ void enqueue_tx_msg(queue_t* queue, uint8_t opcode, uint8_t field_num, uint32_t
     msg[7] = data & 0xFF;
 
     enqueue(queue, msg);
+    set_event(EVENT_CAN_TX);
 }
@@ -1,6 +1,7 @@
 #ifndef CAN_COMMANDS_H
 #define CAN_COMMANDS_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include <can/data_protocol.h>
@@ -13,15 +14,44 @@
 #include "mem.h"
 #include "rtc.h"
 
+// Number of frames in each CAN RX ring (must be a power of 2)
+// A collection has at most CMD_COL_DATA_BLOCK_WINDOW_SIZE requests waiting for
+// a response, so that many frames need to fit
+#define CAN_RX_RING_SIZE    4
+
+/*
+Ring of received CAN frames with a single producer (the RX interrupt) and a
+    single consumer (the main loop), so it doesn't need an atomic block.
+The indices only increase (and wrap around at 256), the number of frames is
+    tail - head.
+*/
+typedef struct {
+    volatile uint8_t msgs[CAN_RX_RING_SIZE][8];
+    // Only written by the producer
+    volatile uint8_t tail;
+    // Only written by the consumer
+    volatile uint8_t head;
+} can_rx_ring_t;
+
 extern queue_t eps_tx_msg_queue;
 extern queue_t pay_tx_msg_queue;
-extern queue_t data_rx_msg_queue;
+
+extern can_rx_ring_t eps_hk_rx_ring;
+extern can_rx_ring_t pay_hk_rx_ring;
+extern can_rx_ring_t pay_opt_rx_ring;
+extern can_rx_ring_t gen_rx_ring;
 
 extern bool print_can_msgs;
 
 
 void handle_rx_msg(void);
 
+void init_can_rx_rings(void);
+can_rx_ring_t* can_rx_ring_for_opcode(uint8_t opcode);
+bool can_rx_ring_empty(can_rx_ring_t* ring);
+bool enqueue_can_rx_ring(can_rx_ring_t* ring, const uint8_t* msg);
+bool dequeue_can_rx_ring(can_rx_ring_t* ring, uint8_t* msg);
+
 void process_next_rx_msg(void);
 void send_next_eps_tx_msg(void);
 void send_next_pay_tx_msg(void);
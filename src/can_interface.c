@@ -1,7 +1,7 @@
 #include "can_interface.h"
 
 void pay_cmd_tx_callback(uint8_t* data, uint8_t *len) {
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         if (queue_empty(&pay_tx_msg_queue)) {
             *len = 0;
             return;
@@ -9,11 +9,17 @@ void pay_cmd_tx_callback(uint8_t* data, uint8_t *len) {
 
         dequeue(&pay_tx_msg_queue, data);
         *len = 8;
+
+        // The mob needs to be resumed again for the next message (if a
+        // response doesn't do it first)
+        if (!queue_empty(&pay_tx_msg_queue)) {
+            set_event(EVENT_CAN_TX);
+        }
     }
 }
 
 void eps_cmd_tx_callback(uint8_t* data, uint8_t *len) {
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         if (queue_empty(&eps_tx_msg_queue)) {
             *len = 0;
             return;
@@ -21,15 +27,48 @@ void eps_cmd_tx_callback(uint8_t* data, uint8_t *len) {
 
         dequeue(&eps_tx_msg_queue, data);
         *len = 8;
+
+        if (!queue_empty(&eps_tx_msg_queue)) {
+            set_event(EVENT_CAN_TX);
+        }
+    }
+}
+
+/*
+Starts sending the next message in `queue` from the CAN interrupt if `mob` is
+    paused (done sending the previous message).
+The interrupt has the page of the mob it is handling selected, so that is
+    restored after.
+*/
+static void chain_tx_mob(mob_t* mob, queue_t* queue) {
+    if (queue_empty(queue) || !is_paused(mob)) {
+        return;
     }
+
+    uint8_t canpage = CANPAGE;
+    resume_mob(mob);
+    CANPAGE = canpage;
 }
 
+// Routes each received frame to the ring for its consumer (by opcode)
+// If the ring is full, the frame is dropped (the collection will request the
+// field again after a timeout)
 void cmd_rx_callback(const uint8_t* data, uint8_t len) {
     if (len == 0) {
         return;
     }
 
-    enqueue(&data_rx_msg_queue, data);
+    enqueue_can_rx_ring(can_rx_ring_for_opcode(data[0]), data);
+    set_event(EVENT_CAN_RX);
+
+    // A response means the subsystem got our last message, so the next one can
+    // go out now instead of waiting for the main loop to get to the CAN TX
+    // stage (which can be a long time during a flash erase or transceiver
+    // send)
+    // The mob is paused after each message, so the library doesn't have a TX
+    // done callback for this
+    chain_tx_mob(&eps_cmd_tx_mob, &eps_tx_msg_queue);
+    chain_tx_mob(&pay_cmd_tx_mob, &pay_tx_msg_queue);
 }
 
 
@@ -8,9 +8,15 @@
 #include <uart/uart.h>
 
 #include "can_commands.h"
+#include "events.h"
+#include "profiler.h"
 
 extern mob_t pay_cmd_tx_mob;
 extern mob_t eps_cmd_tx_mob;
 extern mob_t cmd_rx_mob;
 
+void pay_cmd_tx_callback(uint8_t* data, uint8_t *len);
+void eps_cmd_tx_callback(uint8_t* data, uint8_t *len);
+void cmd_rx_callback(const uint8_t* data, uint8_t len);
+
 #endif
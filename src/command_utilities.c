@@ -16,10 +16,10 @@ const uint8_t correct_pwd_1[5] = SECURITY_CORRECT_PWD_1;
 const uint8_t correct_pwd_2[5] = SECURITY_CORRECT_PWD_2;
 
 // Queue of commands that need to be executed but have not been executed yet
-// Contains command ID and opcode
-queue_t cmd_queue_1;
-// Contains arguments 1 and 2
-queue_t cmd_queue_2;
+cmd_queue_t cmd_queue;
+
+// Command log records waiting to be written to flash
+cmd_log_buf_t cmd_log_buf = { .count = 0 };
 
 // Sequenced command ID from ground (or 0 for auto-scheduled)
 // Default to 0xFFFF instead of 0x0000 because that represents an auto command
@@ -30,6 +30,8 @@ volatile cmd_t* volatile current_cmd = &nop_cmd;
 // Current command arguments
 volatile uint32_t current_cmd_arg1 = 0;
 volatile uint32_t current_cmd_arg2 = 0;
+// Value of prof_ticks() when the current command started
+volatile uint32_t current_cmd_start_ticks = 0;
 // Don't need to store a variable for the password because it is checked in the
 // decoded message before enqueueing to the command queue
 
@@ -37,12 +39,26 @@ volatile uint32_t current_cmd_arg2 = 0;
 // after some number of time
 volatile uint32_t cmd_timeout_count_s = 0;
 uint32_t cmd_timeout_period_s = CMD_TIMEOUT_DEF_PERIOD_S;
+// Set by cmd_timeout_timer_cb() for run_cmd_timeout() to finish the command
+// from the main loop
+volatile bool cmd_timed_out = false;
+
+#ifdef CMD_LATS
+// Value of `uptime_s` when cmd_lats were last saved to EEPROM
+uint32_t cmd_lat_prev_save_uptime_s = 0;
+#endif
 
 // Must define these separately here because of different array sizes
-uint32_t obc_hk_fields[CAN_OBC_HK_FIELD_COUNT] = { 0 };
-uint32_t eps_hk_fields[CAN_EPS_HK_FIELD_COUNT] = { 0 };
-uint32_t pay_hk_fields[CAN_PAY_HK_FIELD_COUNT] = { 0 };
-uint32_t pay_opt_fields[CAN_PAY_OPT_TOT_FIELD_COUNT] = { 0 };
+// Fields are only 24 bits, so they are packed (see get_packed_field())
+uint8_t obc_hk_fields[CAN_OBC_HK_FIELD_COUNT * MEM_BYTES_PER_FIELD] = { 0 };
+uint8_t eps_hk_fields[CAN_EPS_HK_FIELD_COUNT * MEM_BYTES_PER_FIELD] = { 0 };
+uint8_t pay_hk_fields[CAN_PAY_HK_FIELD_COUNT * MEM_BYTES_PER_FIELD] = { 0 };
+uint8_t pay_opt_fields[CAN_PAY_OPT_TOT_FIELD_COUNT * MEM_BYTES_PER_FIELD] = { 0 };
+
+// Bitmaps of received fields (OBC_HK fields are all filled in at once)
+uint8_t eps_hk_received_fields[(CAN_EPS_HK_FIELD_COUNT + 7) / 8] = { 0 };
+uint8_t pay_hk_received_fields[(CAN_PAY_HK_FIELD_COUNT + 7) / 8] = { 0 };
+uint8_t pay_opt_received_fields[(CAN_PAY_OPT_TOT_FIELD_COUNT + 7) / 8] = { 0 };
 
 mem_header_t cmd_log_header;
 
@@ -57,7 +73,16 @@ data_col_t obc_hk_data_col = {
     .auto_period_eeprom_addr = OBC_HK_AUTO_DATA_COL_PERIOD_EEPROM_ADDR,
     .prev_auto_col_uptime_s = 0,
     .prev_field_col_uptime_s = 0,
+    .auto_timer = SCHED_NO_TIMER,
+    .req_timer = SCHED_NO_TIMER,
+    .state = DATA_COL_STATE_IDLE,
+    .cmd_id = CMD_CMD_ID_AUTO_ENQUEUED,
+    .finish_status = CMD_RESP_STATUS_UNKNOWN,
     .fields = obc_hk_fields,
+    .received_fields = NULL,
+    .received_field_count = 0,
+    .staged_field_count = 0,
+    .flushed_field_count = 0,
     .mem_section = &obc_hk_mem_section,
     .cmd_log_block_num = 0,
     .cmd_arg1 = CMD_OBC_HK,
@@ -72,7 +97,16 @@ data_col_t eps_hk_data_col = {
     .auto_period_eeprom_addr = EPS_HK_AUTO_DATA_COL_PERIOD_EEPROM_ADDR,
     .prev_auto_col_uptime_s = 0,
     .prev_field_col_uptime_s = 0,
+    .auto_timer = SCHED_NO_TIMER,
+    .req_timer = SCHED_NO_TIMER,
+    .state = DATA_COL_STATE_IDLE,
+    .cmd_id = CMD_CMD_ID_AUTO_ENQUEUED,
+    .finish_status = CMD_RESP_STATUS_UNKNOWN,
     .fields = eps_hk_fields,
+    .received_fields = eps_hk_received_fields,
+    .received_field_count = 0,
+    .staged_field_count = 0,
+    .flushed_field_count = 0,
     .mem_section = &eps_hk_mem_section,
     .cmd_log_block_num = 0,
     .cmd_arg1 = CMD_EPS_HK,
@@ -87,7 +121,16 @@ data_col_t pay_hk_data_col = {
     .auto_period_eeprom_addr = PAY_HK_AUTO_DATA_COL_PERIOD_EEPROM_ADDR,
     .prev_auto_col_uptime_s = 0,
     .prev_field_col_uptime_s = 0,
+    .auto_timer = SCHED_NO_TIMER,
+    .req_timer = SCHED_NO_TIMER,
+    .state = DATA_COL_STATE_IDLE,
+    .cmd_id = CMD_CMD_ID_AUTO_ENQUEUED,
+    .finish_status = CMD_RESP_STATUS_UNKNOWN,
     .fields = pay_hk_fields,
+    .received_fields = pay_hk_received_fields,
+    .received_field_count = 0,
+    .staged_field_count = 0,
+    .flushed_field_count = 0,
     .mem_section = &pay_hk_mem_section,
     .cmd_log_block_num = 0,
     .cmd_arg1 = CMD_PAY_HK,
@@ -102,7 +145,16 @@ data_col_t pay_opt_data_col = {
     .auto_period_eeprom_addr = PAY_OPT_AUTO_DATA_COL_PERIOD_EEPROM_ADDR,
     .prev_auto_col_uptime_s = 0,
     .prev_field_col_uptime_s = 0,
+    .auto_timer = SCHED_NO_TIMER,
+    .req_timer = SCHED_NO_TIMER,
+    .state = DATA_COL_STATE_IDLE,
+    .cmd_id = CMD_CMD_ID_AUTO_ENQUEUED,
+    .finish_status = CMD_RESP_STATUS_UNKNOWN,
     .fields = pay_opt_fields,
+    .received_fields = pay_opt_received_fields,
+    .received_field_count = 0,
+    .staged_field_count = 0,
+    .flushed_field_count = 0,
     .mem_section = &pay_opt_mem_section,
     .cmd_log_block_num = 0,
     .cmd_arg1 = CMD_PAY_OPT,
@@ -117,6 +169,26 @@ data_col_t* all_data_cols[NUM_DATA_COL_SECTIONS] = {
     &pay_opt_data_col,
 };
 
+// Running aggregate, updated as each block is collected (not used until it is
+// first read with the aggregate data blocks command, which selects the fields)
+data_agg_t run_data_agg = {
+    .block_type = 0
+};
+
+// Beacon content (see set_trans_beacon_field()), one entry per beacon field
+const beacon_field_t beacon_fields[TRANS_BEACON_NUM_FIELDS] PROGMEM = {
+    { CMD_OBC_HK, CAN_OBC_HK_UPTIME },
+    { CMD_OBC_HK, CAN_OBC_HK_RESTART_COUNT },
+    { CMD_OBC_HK, CAN_OBC_HK_RESTART_REASON },
+    { CMD_EPS_HK, CAN_EPS_HK_BAT_VOL },
+    { CMD_EPS_HK, CAN_EPS_HK_RESTART_COUNT },
+    { CMD_EPS_HK, CAN_EPS_HK_RESTART_REASON },
+    { CMD_PAY_HK, CAN_PAY_HK_AMB_TEMP },
+    { CMD_PAY_HK, CAN_PAY_HK_HUM },
+    { CMD_PAY_HK, CAN_PAY_HK_PRES },
+    { CMD_PAY_HK, CAN_PAY_HK_RESTART_REASON },
+};
+
 
 // Date and time of the most recent restart
 rtc_date_t restart_date = { .yy = 0, .mm = 0, .dd  = 0 };
@@ -127,6 +199,10 @@ rtc_time_t restart_time = { .hh = 0, .mm = 0, .ss  = 0 };
 bool print_cmds = false;
 // Set to true to print ACKs
 bool print_trans_tx_acks = false;
+// Set to true to send all waiting ACKs in one frame (one 3-byte ACK after
+// another) instead of one frame per ACK - the ground station must be able to
+// split these up
+bool trans_tx_ack_coalesce = false;
 
 
 bool does_pwd_match(uint8_t* received_pwd, const uint8_t* correct_pwd) {
@@ -138,12 +214,129 @@ bool does_pwd_match(uint8_t* received_pwd, const uint8_t* correct_pwd) {
     return true;
 }
 
+/*
+Checks a command received from ground, and enqueues it if it is OK.
+Returns - the ACK status (CMD_ACK_STATUS_OK if it was enqueued)
+*/
+uint8_t accept_trans_rx_cmd(uint16_t cmd_id, uint8_t opcode, uint32_t arg1,
+        uint32_t arg2, uint8_t* received_pwd) {
+    // NACK if the MSB of the command ID is 1
+    if ((cmd_id >> 15) & 0x01) {
+        return CMD_ACK_STATUS_INVALID_CMD_ID;
+    }
+
+    // NACK if the command ID is less than the previous received ID
+    if (cmd_id < trans_last_cmd_id) {
+        return CMD_ACK_STATUS_DECREMENTED_CMD_ID;
+    }
+
+    // NACK if the command ID is equal to the previous received ID (repeated command)
+    if (cmd_id == trans_last_cmd_id) {
+        return CMD_ACK_STATUS_REPEATED_CMD_ID;
+    }
+
+    // Get the corresponding cmd_t struct for the opcode
+    cmd_t* cmd = cmd_opcode_to_cmd(opcode);
+    // Check if it is a valid opcode/command
+    if (cmd == &nop_cmd) {
+        return CMD_ACK_STATUS_INVALID_OPCODE;
+    }
+
+    // Check 4-byte password if necessary for the command
+    if (cmd_pwd_protected(cmd)) {
+        if (!(does_pwd_match(received_pwd, correct_pwd_1) ||
+                does_pwd_match(received_pwd, correct_pwd_2))) {
+            return CMD_ACK_STATUS_INVALID_PWD;
+        }
+    }
+
+    // Check if the command queue is full
+    if (cmd_queue_full()) {
+        return CMD_ACK_STATUS_FULL_CMD_QUEUE;
+    }
+
+    // If all the checks passed, the command is OK to put into the queue
+    enqueue_cmd(cmd_id, cmd, arg1, arg2);
+
+    // Update the last command ID for the one we just received
+    trans_last_cmd_id = cmd_id;
+
+    // Restart the counter for not receiving communication from ground
+    // By design, OBC will not reset the communication timeout when it
+    // receives a reset command ID request
+    restart_com_timeout();
+
+    return CMD_ACK_STATUS_OK;
+}
+
+/*
+Processes a batch message in trans_rx_dec_msg (see CMD_BATCH_CMD_ID) - each
+    command is checked the same way as a separate message, then one combined
+    ACK is sent with a bitmap of the ones that were enqueued.
+*/
+void handle_trans_rx_batch_msg(void) {
+    volatile uint8_t* msg = (volatile uint8_t*) trans_rx_dec_msg;
+
+    uint8_t count = 0;
+    if (trans_rx_dec_len >= CMD_BATCH_HEADER_LEN) {
+        count = msg[2];
+    }
+    if (count == 0 || count > CMD_BATCH_MAX_CMDS ||
+            trans_rx_dec_len != CMD_BATCH_HEADER_LEN + (count * CMD_BATCH_CMD_LEN)) {
+        add_trans_tx_ack(CMD_CMD_ID_UNKNOWN, CMD_ACK_STATUS_INVALID_DEC_FMT);
+        return;
+    }
+
+    uint8_t received_pwd[4];
+    for (uint8_t i = 0; i < 4; i++) {
+        received_pwd[i] = msg[3 + i];
+    }
+
+    uint16_t first_cmd_id = CMD_CMD_ID_UNKNOWN;
+    uint8_t bitmap = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        volatile uint8_t* cmd_msg = &msg[CMD_BATCH_HEADER_LEN +
+            (i * CMD_BATCH_CMD_LEN)];
+
+        uint16_t cmd_id =
+            ((uint16_t) cmd_msg[0] << 8) |
+            ((uint16_t) cmd_msg[1] << 0);
+        uint8_t opcode = cmd_msg[2];
+        uint32_t arg1 =
+            ((uint32_t) cmd_msg[3] << 24) |
+            ((uint32_t) cmd_msg[4] << 16) |
+            ((uint32_t) cmd_msg[5] << 8) |
+            ((uint32_t) cmd_msg[6]);
+        uint32_t arg2 =
+            ((uint32_t) cmd_msg[7] << 24) |
+            ((uint32_t) cmd_msg[8] << 16) |
+            ((uint32_t) cmd_msg[9] << 8) |
+            ((uint32_t) cmd_msg[10]);
+
+        if (i == 0) {
+            first_cmd_id = cmd_id;
+        }
+
+        if (accept_trans_rx_cmd(cmd_id, opcode, arg1, arg2, received_pwd) ==
+                CMD_ACK_STATUS_OK) {
+            bitmap |= _BV(i);
+        }
+    }
+
+    // Same as separate messages - an ACK can't have the MSB of the command ID
+    // set
+    if ((first_cmd_id >> 15) & 0x01) {
+        first_cmd_id = CMD_CMD_ID_UNKNOWN;
+    }
+    add_trans_tx_batch_ack(first_cmd_id, bitmap);
+}
+
 /*
 If there is a message in trans_rx_dec_msg, processes its components and enqueues the appropriate command and arguments.
 */
 void handle_trans_rx_dec_msg(void) {
     // Need to put everything in an atomic block because the message is in a global array
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         if (!trans_rx_dec_avail) {
             return;
         }
@@ -166,8 +359,16 @@ void handle_trans_rx_dec_msg(void) {
             return;
         }
 
+        // Several commands in one message
+        if (trans_rx_dec_len >= 2 &&
+                trans_rx_dec_msg[0] == ((CMD_BATCH_CMD_ID >> 8) & 0xFF) &&
+                trans_rx_dec_msg[1] == (CMD_BATCH_CMD_ID & 0xFF)) {
+            handle_trans_rx_batch_msg();
+            return;
+        }
+
         // Only accept 15 byte messages
-        if (trans_rx_dec_len < 15) {
+        if (trans_rx_dec_len != CMD_SINGLE_MSG_LEN) {
             // Don't know the opcode/args
             add_trans_tx_ack(CMD_CMD_ID_UNKNOWN, CMD_ACK_STATUS_INVALID_DEC_FMT);
             return;
@@ -196,89 +397,59 @@ void handle_trans_rx_dec_msg(void) {
         received_pwd[2] = msg[13];
         received_pwd[3] = msg[14];
 
-        // NACK if the MSB of the command ID is 1
-        // Send back the unknown command ID because if we sent back the actual
-        // ID, the MSB would be 1 so ground would interpret it as a response
-        // rather than an ACK packet
-        if ((cmd_id >> 15) & 0x01) {
-            add_trans_tx_ack(CMD_CMD_ID_UNKNOWN, CMD_ACK_STATUS_INVALID_CMD_ID);
-            return;
-        }
-
-        // NACK if the command ID is less than the previous received ID
-        if (cmd_id < trans_last_cmd_id) {
-            add_trans_tx_ack(cmd_id, CMD_ACK_STATUS_DECREMENTED_CMD_ID);
-            return;
-        }
-
-        // NACK if the command ID is equal to the previous received ID (repeated command)
-        if (cmd_id == trans_last_cmd_id) {
-            add_trans_tx_ack(cmd_id, CMD_ACK_STATUS_REPEATED_CMD_ID);
-            return;
-        }
-
-        // Get the corresponding cmd_t struct for the opcode
-        cmd_t* cmd = cmd_opcode_to_cmd(opcode);
-        // Check if it is a valid opcode/command
-        if (cmd == &nop_cmd) {
-            add_trans_tx_ack(cmd_id, CMD_ACK_STATUS_INVALID_OPCODE);
-            return;
-        }
+        uint8_t status = accept_trans_rx_cmd(cmd_id, opcode, arg1, arg2,
+            received_pwd);
 
-        // Check 4-byte password if necessary for the command
-        if (cmd->pwd_protected) {
-            if (!(does_pwd_match(received_pwd, correct_pwd_1) ||
-                    does_pwd_match(received_pwd, correct_pwd_2))) {
-                // NACK
-                add_trans_tx_ack(cmd_id, CMD_ACK_STATUS_INVALID_PWD);
-                return;
-            }
+        // Send back the unknown command ID if the MSB is 1 because if we sent
+        // back the actual ID, the MSB would be 1 so ground would interpret it
+        // as a response rather than an ACK packet
+        if (status == CMD_ACK_STATUS_INVALID_CMD_ID) {
+            cmd_id = CMD_CMD_ID_UNKNOWN;
         }
-
-        // Check if either command queue is full (they should both be the same
-        // size, but check both just in case)
-        if (queue_full(&cmd_queue_1) || queue_full(&cmd_queue_2)) {
-            add_trans_tx_ack(cmd_id, CMD_ACK_STATUS_FULL_CMD_QUEUE);
-            return;
-        }
-
-        // If all the checks passed, the command is OK to put into the queue
-        add_trans_tx_ack(cmd_id, CMD_ACK_STATUS_OK);
-        enqueue_cmd(cmd_id, cmd, arg1, arg2);
-
-        // Update the last command ID for the one we just received
-        trans_last_cmd_id = cmd_id;
-
-        // Restart the counter for not receiving communication from ground
-        // By design, OBC will not reset the communication timeout when it
-        // receives a reset command ID request
-        restart_com_timeout();
+        add_trans_tx_ack(cmd_id, status);
     }
 }
 
 void process_trans_tx_ack(void) {
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        if (!trans_tx_ack_avail) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        // Wait until the previous ACK frame has been sent
+        if (trans_tx_ack_msg_avail) {
             return;
         }
-        trans_tx_ack_avail = false;
-
-        if (print_trans_tx_acks) {
-            print("ACK: cmd_id = 0x%.4x, status = 0x%.2x\n",
-                trans_tx_ack_cmd_id, trans_tx_ack_status);
-        }
 
         // No mask on the command ID because this is an ACK
-        uint16_t cmd_id = trans_tx_ack_cmd_id;
-        uint8_t status = trans_tx_ack_status;
+        uint16_t cmd_id = 0;
+        uint8_t status = 0;
+        uint8_t bitmap = 0;
+
+        // Can't use the trans_tx_dec functions because the response from the
+        // current command might be waiting in trans_tx_dec_msg
+        trans_tx_ack_msg_len = 0;
+        // Leave room for the longest (batch) ACK
+        while (trans_tx_ack_msg_len + TRANS_TX_ACK_BATCH_LEN <= TRANS_TX_ACK_MSG_MAX_SIZE &&
+                dequeue_trans_tx_ack(&cmd_id, &status, &bitmap)) {
+            if (print_trans_tx_acks) {
+                print("ACK: cmd_id = 0x%.4x, status = 0x%.2x\n",
+                    cmd_id, status);
+            }
+
+            trans_tx_ack_msg[trans_tx_ack_msg_len + 0] = (cmd_id >> 8) & 0xFF;
+            trans_tx_ack_msg[trans_tx_ack_msg_len + 1] = (cmd_id >> 0) & 0xFF;
+            trans_tx_ack_msg[trans_tx_ack_msg_len + 2] = status;
+            trans_tx_ack_msg_len += TRANS_TX_ACK_LEN;
+            if (status == CMD_ACK_STATUS_BATCH) {
+                trans_tx_ack_msg[trans_tx_ack_msg_len] = bitmap;
+                trans_tx_ack_msg_len++;
+            }
 
-        // Can't use the standard trans_tx_dec functions because they use the current_cmd variables
-        trans_tx_dec_msg[0] = (cmd_id >> 8) & 0xFF;
-        trans_tx_dec_msg[1] = (cmd_id >> 0) & 0xFF;
-        trans_tx_dec_msg[2] = status;
+            if (!trans_tx_ack_coalesce) {
+                break;
+            }
+        }
 
-        trans_tx_dec_len = 3;
-        trans_tx_dec_avail = true;
+        if (trans_tx_ack_msg_len > 0) {
+            trans_tx_ack_msg_avail = true;
+        }
     }
 }
 
@@ -286,22 +457,70 @@ void process_trans_tx_ack(void) {
 
 void start_trans_tx_resp(uint8_t status) {
     uint16_t cmd_id = current_cmd_id | CMD_RESP_CMD_ID_MASK;
-    trans_tx_dec_msg[0] = (cmd_id >> 8) & 0xFF;
-    trans_tx_dec_msg[1] = (cmd_id >> 0) & 0xFF;
-    trans_tx_dec_msg[2] = status;
-
-    trans_tx_dec_len = 3;
+    start_trans_tx_dec_msg();
+    append_to_trans_tx_dec_msg((cmd_id >> 8) & 0xFF);
+    append_to_trans_tx_dec_msg((cmd_id >> 0) & 0xFF);
+    append_to_trans_tx_dec_msg(status);
 }
 
+// The checksum is updated as each byte is added (see transceiver.c)
 void append_to_trans_tx_resp(uint8_t byte) {
-    if (trans_tx_dec_len < TRANS_TX_DEC_MSG_MAX_SIZE) {
-        trans_tx_dec_msg[trans_tx_dec_len] = byte;
-        trans_tx_dec_len++;
-    }
+    append_to_trans_tx_dec_msg(byte);
 }
 
 void finish_trans_tx_resp(void) {
     trans_tx_dec_avail = true;
+    set_event(EVENT_TRANS_TX);
+}
+
+// Accessors for the fields of a command (cmd_t is stored in flash)
+
+cmd_fn_t cmd_fn(cmd_t* cmd) {
+    return (cmd_fn_t) pgm_read_ptr(&cmd->fn);
+}
+
+uint8_t cmd_opcode(cmd_t* cmd) {
+    return pgm_read_byte(&cmd->opcode);
+}
+
+bool cmd_pwd_protected(cmd_t* cmd) {
+    return pgm_read_byte(&cmd->pwd_protected) ? true : false;
+}
+
+/*
+Returns true if the arguments are within the limits in the command's
+    cmd_args_t.
+*/
+bool cmd_args_valid(cmd_t* cmd, uint32_t arg1, uint32_t arg2) {
+    cmd_args_t args;
+    memcpy_P(&args, &cmd->args, sizeof(cmd_args_t));
+
+    if (args.arg1_mask != 0 &&
+            (arg1 >= 16 || (args.arg1_mask & (1U << arg1)) == 0)) {
+        return false;
+    }
+    if (args.arg1_max != 0 && arg1 > args.arg1_max) {
+        return false;
+    }
+    // The count of a compressed read is checked by the command's function
+    if ((args.flags & CMD_ARGS_COMPRESSIBLE) &&
+            (arg2 & CMD_READ_COMPRESSED) != 0) {
+        arg2 &= ~CMD_READ_COMPRESSED;
+        args.arg2_max = 0;
+    }
+    if (arg2 < args.arg2_min) {
+        return false;
+    }
+    if (args.arg2_max != 0 && arg2 > args.arg2_max) {
+        return false;
+    }
+    // Enforce not rolling over addresses past the third chip
+    if ((args.flags & CMD_ARGS_MEM_RANGE) &&
+            arg1 + arg2 - 1 >= MEM_NUM_ADDRESSES) {
+        return false;
+    }
+
+    return true;
 }
 
 /*
@@ -309,13 +528,15 @@ Returns the cmd_t struct corresponding to the given opcode,
 or &nop_cmd if not found.
 */
 cmd_t* cmd_opcode_to_cmd(uint8_t opcode) {
-    for (uint8_t i = 0; i < all_cmds_list_len; i++) {
-        if (all_cmds_list[i]->opcode == opcode) {
-            return all_cmds_list[i];
-        }
+    if (opcode >= CMD_OPCODE_TABLE_SIZE) {
+        return &nop_cmd;
     }
 
-    return &nop_cmd;
+    uint8_t entry = pgm_read_byte(&cmd_opcode_table[opcode]);
+    if (entry == 0) {
+        return &nop_cmd;
+    }
+    return cmd_index_to_cmd(entry - 1);
 }
 
 mem_section_t* mem_section_for_cmd(cmd_t* cmd) {
@@ -323,7 +544,9 @@ mem_section_t* mem_section_for_cmd(cmd_t* cmd) {
             cmd == &read_data_block_cmd ||
             cmd == &read_prim_cmd_blocks_cmd ||
             cmd == &read_sec_cmd_blocks_cmd ||
-            cmd == &read_raw_mem_bytes_cmd) {
+            cmd == &read_raw_mem_bytes_cmd ||
+            cmd == &read_data_block_range_cmd ||
+            cmd == &sync_data_blocks_cmd) {
         return &sec_cmd_log_mem_section;
     } else {
         return &prim_cmd_log_mem_section;
@@ -333,178 +556,276 @@ mem_section_t* mem_section_for_cmd(cmd_t* cmd) {
 
 
 
-// We know that the microcontroller uses 16 bit addresses, so store a function
-// pointer in the first 2 bytes of the queue entry (data[0] = MSB, data[1] = LSB)
+/*
+Returns the command at the index in all_cmds_list, or &nop_cmd if the index is
+    out of range.
+*/
+cmd_t* cmd_index_to_cmd(uint8_t cmd_index) {
+    if (cmd_index >= all_cmds_list_len) {
+        return &nop_cmd;
+    }
+    return (cmd_t*) pgm_read_ptr(&all_cmds_list[cmd_index]);
+}
+
+/*
+Returns the index of the command in all_cmds_list, or all_cmds_list_len if it
+    is not in the list.
+*/
+uint8_t cmd_to_cmd_index(cmd_t* cmd) {
+    uint8_t opcode = cmd_opcode(cmd);
+    if (opcode >= CMD_OPCODE_TABLE_SIZE) {
+        return all_cmds_list_len;
+    }
+
+    // Check the command at that index is this one in case cmd is not in the
+    // list
+    uint8_t entry = pgm_read_byte(&cmd_opcode_table[opcode]);
+    if (entry == 0 || cmd_index_to_cmd(entry - 1) != cmd) {
+        return all_cmds_list_len;
+    }
+    return entry - 1;
+}
+
+/*
+Returns the priority class to schedule a command with.
+*/
+uint8_t cmd_priority(uint16_t cmd_id, cmd_t* cmd, uint32_t arg2) {
+    // Long erases should not hold up other commands from ground
+    if (cmd == &erase_mem_phy_sector_cmd || cmd == &erase_mem_phy_block_cmd ||
+            cmd == &erase_all_mem_cmd) {
+        return CMD_PRIORITY_MAINTENANCE;
+    }
+    if (cmd_id != CMD_CMD_ID_AUTO_ENQUEUED) {
+        return CMD_PRIORITY_GROUND;
+    }
+    // Starting an auto data collection can wait, but finishing one writes the
+    // block and frees the collection for the next one
+    if (cmd == &col_data_block_cmd && arg2 != CMD_COL_DATA_BLOCK_FINISH) {
+        return CMD_PRIORITY_BACKGROUND;
+    }
+    return CMD_PRIORITY_MAINTENANCE;
+}
 
 /*
-Serialize command information to bytes.
-Assumes bytes1 and bytes2 are each 8-byte arrays.
+Empties the command queue.
 */
-void cmd_to_bytes(uint16_t cmd_id, cmd_t* cmd, uint32_t arg1, uint32_t arg2,
-        uint8_t* bytes1, uint8_t* bytes2) {
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        bytes1[0] = (cmd_id >> 8) & 0xFF;
-        bytes1[1] = (cmd_id >> 0) & 0xFF;
-        bytes1[2] = cmd->opcode;
-        // Fill unused bytes with zeros just in case it is uninitialized
-        bytes1[3] = 0x00;
-        bytes1[4] = 0x00;
-        bytes1[5] = 0x00;
-        bytes1[6] = 0x00;
-        bytes1[7] = 0x00;
+void init_cmd_queue(void) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        cmd_queue.head = 0;
+        cmd_queue.count = 0;
+        for (uint8_t i = 0; i < CMD_QUEUE_NUM_BLOCK_TYPES; i++) {
+            cmd_queue.col_data_block_counts[i] = 0;
+        }
+    }
+}
+
+bool cmd_queue_full(void) {
+    return cmd_queue.count >= CMD_QUEUE_SIZE;
+}
+
+bool cmd_queue_empty(void) {
+    return cmd_queue.count == 0;
+}
+
+uint8_t cmd_queue_size(void) {
+    return cmd_queue.count;
+}
 
-        bytes2[0] = (arg1 >> 24) & 0xFF;
-        bytes2[1] = (arg1 >> 16) & 0xFF;
-        bytes2[2] = (arg1 >> 8) & 0xFF;
-        bytes2[3] = arg1 & 0xFF;
-        bytes2[4] = (arg2 >> 24) & 0xFF;
-        bytes2[5] = (arg2 >> 16) & 0xFF;
-        bytes2[6] = (arg2 >> 8) & 0xFF;
-        bytes2[7] = arg2 & 0xFF;
+/*
+Updates the count of queued col_data_block_cmd commands for the entry's block
+    type (delta is +1 for enqueue, -1 for dequeue).
+Must be called atomically with the change to the queue.
+*/
+void update_cmd_queue_counts(cmd_queue_entry_t* entry, int8_t delta) {
+    if (cmd_index_to_cmd(entry->cmd_index) == &col_data_block_cmd &&
+            entry->arg1 < CMD_QUEUE_NUM_BLOCK_TYPES) {
+        cmd_queue.col_data_block_counts[entry->arg1] += delta;
     }
 }
 
 /*
-Enqueues a command and arguments to the back of the queues.
-Enqueue the opcode instead of the function pointer because it's safer in case
-something goes wrong.
+Enqueues a command and arguments behind the commands with the same or higher
+    priority (see cmd_priority()). It is enqueued behind lower priority
+    commands that have already been passed CMD_QUEUE_MAX_SKIPS times.
+Returns false if the queue is full or the command is not in all_cmds_list.
 */
 bool enqueue_cmd(uint16_t cmd_id, cmd_t* cmd, uint32_t arg1, uint32_t arg2) {
 #ifdef COMMAND_UTILITIES_DEBUG_QUEUES
     print("enqueue_cmd: id = 0x%.4x, opcode = 0x%x, arg1 = 0x%lx, arg2 = 0x%lx\n",
-        cmd_id, cmd->opcode, arg1, arg2);
+        cmd_id, cmd_opcode(cmd), arg1, arg2);
 #endif
 
-    // Enqueue the command as two 8-byte arrays
-    uint8_t bytes1[8] = {0};
-    uint8_t bytes2[8] = {0};
-    
-    // Make sure modifications to the states of the two queues are atomic/consistent
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        if (queue_full(&cmd_queue_1)) {
+    // Look up the index before disabling interrupts
+    uint8_t cmd_index = cmd_to_cmd_index(cmd);
+    if (cmd_index >= all_cmds_list_len) {
+        return false;
+    }
+
+    uint8_t priority = cmd_priority(cmd_id, cmd, arg2);
+#ifdef CMD_LATS
+    uint32_t enqueue_ticks = prof_ticks();
+#endif
+
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (cmd_queue_full() || (priority == CMD_PRIORITY_BACKGROUND &&
+                cmd_queue.count + CMD_QUEUE_GROUND_RESERVED >= CMD_QUEUE_SIZE)) {
             return false;
         }
-        if (queue_full(&cmd_queue_2)) {
-            return false;
+
+        // Start at the back and move ahead of lower priority commands
+        uint8_t pos = cmd_queue.head + cmd_queue.count;
+        if (pos >= CMD_QUEUE_SIZE) {
+            pos -= CMD_QUEUE_SIZE;
+        }
+        for (uint8_t i = cmd_queue.count; i > 0; i--) {
+            uint8_t prev = (pos == 0) ? CMD_QUEUE_SIZE - 1 : pos - 1;
+            cmd_queue_entry_t* prev_entry = &cmd_queue.entries[prev];
+            if (prev_entry->priority <= priority ||
+                    prev_entry->skips >= CMD_QUEUE_MAX_SKIPS) {
+                break;
+            }
+
+            prev_entry->skips++;
+            cmd_queue.entries[pos] = *prev_entry;
+            pos = prev;
         }
-        cmd_to_bytes(cmd_id, cmd, arg1, arg2, bytes1, bytes2);
 
-        enqueue(&cmd_queue_1, bytes1);
-        enqueue(&cmd_queue_2, bytes2);
+        cmd_queue_entry_t* entry = &cmd_queue.entries[pos];
+        entry->cmd_id = cmd_id;
+        entry->cmd_index = cmd_index;
+        entry->priority = priority;
+        entry->skips = 0;
+        entry->arg1 = arg1;
+        entry->arg2 = arg2;
+#ifdef CMD_LATS
+        entry->enqueue_ticks = enqueue_ticks;
+#endif
+
+        cmd_queue.count++;
+        update_cmd_queue_counts(entry, 1);
     }
 
+    set_event(EVENT_CMD);
     return true;
 }
 
 /*
-Enqueues a command and arguments to the front of the queues so it is guaranteed
+Enqueues a command and arguments to the front of the queue so it is guaranteed
 to be the next executed command.
-Enqueue the opcode instead of the function pointer because it's safer in case
-something goes wrong.
+Returns false if the queue is full or the command is not in all_cmds_list.
 */
 bool enqueue_cmd_front(uint16_t cmd_id, cmd_t* cmd, uint32_t arg1, uint32_t arg2) {
 #ifdef COMMAND_UTILITIES_DEBUG_QUEUES
     print("enqueue_cmd_front: id = 0x%.4x, opcode = 0x%x, arg1 = 0x%lx, arg2 = 0x%lx\n",
-        cmd_id, cmd->opcode, arg1, arg2);
+        cmd_id, cmd_opcode(cmd), arg1, arg2);
 #endif
 
-    // Enqueue the command as two 8-byte arrays
-    uint8_t bytes1[8] = {0};
-    uint8_t bytes2[8] = {0};
-    
-    // Make sure modifications to the states of the two queues are atomic/consistent
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        if (queue_full(&cmd_queue_1)) {
+    uint8_t cmd_index = cmd_to_cmd_index(cmd);
+    if (cmd_index >= all_cmds_list_len) {
+        return false;
+    }
+
+#ifdef CMD_LATS
+    uint32_t enqueue_ticks = prof_ticks();
+#endif
+
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (cmd_queue_full()) {
             return false;
         }
-        if (queue_full(&cmd_queue_2)) {
-            return false;
+
+        if (cmd_queue.head == 0) {
+            cmd_queue.head = CMD_QUEUE_SIZE - 1;
+        } else {
+            cmd_queue.head--;
         }
-        cmd_to_bytes(cmd_id, cmd, arg1, arg2, bytes1, bytes2);
+        cmd_queue_entry_t* entry = &cmd_queue.entries[cmd_queue.head];
+        entry->cmd_id = cmd_id;
+        entry->cmd_index = cmd_index;
+        // Nothing enqueued later can go ahead of this
+        entry->priority = CMD_PRIORITY_GROUND;
+        entry->skips = 0;
+        entry->arg1 = arg1;
+        entry->arg2 = arg2;
+#ifdef CMD_LATS
+        entry->enqueue_ticks = enqueue_ticks;
+#endif
 
-        enqueue_front(&cmd_queue_1, bytes1);
-        enqueue_front(&cmd_queue_2, bytes2);
+        cmd_queue.count++;
+        update_cmd_queue_counts(entry, 1);
     }
 
+    set_event(EVENT_CMD);
     return true;
 }
 
 /*
-Deserialize command information from bytes.
-Assumes bytes1 and bytes2 are each 8-byte arrays.
+Gets the next command in the queue without removing it.
+cmd - Use a double pointer because we need to set the value of the cmd pointer
+Returns false if the queue is empty.
 */
-void bytes_to_cmd(uint16_t* cmd_id, cmd_t** cmd, uint32_t* arg1, uint32_t* arg2,
-        uint8_t* bytes1, uint8_t* bytes2) {
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        *cmd_id =
-            ((uint16_t) bytes1[0] << 8) |
-            ((uint16_t) bytes1[1] << 0);
-        *cmd = cmd_opcode_to_cmd(bytes1[2]);
+bool peek_cmd(uint16_t* cmd_id, cmd_t** cmd, uint32_t* arg1, uint32_t* arg2) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (cmd_queue_empty()) {
+            return false;
+        }
 
-        *arg1 =
-            (((uint32_t) bytes2[0]) << 24) |
-            (((uint32_t) bytes2[1]) << 16) |
-            (((uint32_t) bytes2[2]) << 8) |
-            (((uint32_t) bytes2[3]));
-        *arg2 =
-            (((uint32_t) bytes2[4]) << 24) |
-            (((uint32_t) bytes2[5]) << 16) |
-            (((uint32_t) bytes2[6]) << 8) |
-            (((uint32_t) bytes2[7]));
+        cmd_queue_entry_t* entry = &cmd_queue.entries[cmd_queue.head];
+        *cmd_id = entry->cmd_id;
+        *cmd = cmd_index_to_cmd(entry->cmd_index);
+        *arg1 = entry->arg1;
+        *arg2 = entry->arg2;
     }
+
+    return true;
 }
 
 /*
-cmd - The struct must already exist (be allocated) before calling this function,
-      then this function sets the value of cmd->fn
-      Use a double pointer because we need to set the value of the cmd pointer
+Removes the next command from the queue.
+cmd - Use a double pointer because we need to set the value of the cmd pointer
+Returns false if the queue is empty.
 */
 bool dequeue_cmd(uint16_t* cmd_id, cmd_t** cmd, uint32_t* arg1, uint32_t* arg2) {
-    // Dequeue the command as an 8-byte array
-    uint8_t bytes1[8] = {0};
-    uint8_t bytes2[8] = {0};
-
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        if (queue_empty(&cmd_queue_1)) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (cmd_queue_empty()) {
             return false;
         }
-        if (queue_empty(&cmd_queue_2)) {
-            return false;
-        }
-        dequeue(&cmd_queue_1, bytes1);
-        dequeue(&cmd_queue_2, bytes2);
 
-        bytes_to_cmd(cmd_id, cmd, arg1, arg2, bytes1, bytes2);
+        cmd_queue_entry_t* entry = &cmd_queue.entries[cmd_queue.head];
+        *cmd_id = entry->cmd_id;
+        *cmd = cmd_index_to_cmd(entry->cmd_index);
+        *arg1 = entry->arg1;
+        *arg2 = entry->arg2;
+
+        update_cmd_queue_counts(entry, -1);
+        cmd_queue.head++;
+        if (cmd_queue.head >= CMD_QUEUE_SIZE) {
+            cmd_queue.head = 0;
+        }
+        cmd_queue.count--;
     }
 
 #ifdef COMMAND_UTILITIES_DEBUG_QUEUES
     print("dequeue_cmd: id = 0x%.4x, opcode = 0x%x, arg1 = 0x%lx, arg2 = 0x%lx\n",
-        *cmd_id, (*cmd)->opcode, *arg1, *arg2);
+        *cmd_id, cmd_opcode(*cmd), *arg1, *arg2);
 #endif
 
     return true;
 }
 
-// Returns true if the command queue(s) contains a collect data block command
-// with the specified block type (arg 1) and field num (arg 2)
+// Returns true if the command queue contains a collect data block command
+// with the specified block type (arg 1)
+// This only reads one byte, so it does not need to disable interrupts
 bool cmd_queue_contains_col_data_block(uint8_t block_type) {
-    // Assume that the head and tail are the same between queues 1 and 2,
-    // since we always enqueue/dequeue to/from them at the same time atomically
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        for (uint8_t i = cmd_queue_1.head; i < cmd_queue_1.tail; i++) {
-            uint16_t cmd_id = 0;
-            cmd_t* cmd = NULL;
-            uint32_t arg1 = 0;
-            uint32_t arg2 = 0;
-            bytes_to_cmd(&cmd_id, &cmd, &arg1, &arg2, cmd_queue_1.content[i], cmd_queue_2.content[i]);
-
-            if (cmd == &col_data_block_cmd && arg1 == ((uint32_t) block_type)) {
+    if (block_type >= CMD_QUEUE_NUM_BLOCK_TYPES) {
+        return false;
+    }
+
+    if (cmd_queue.col_data_block_counts[block_type] > 0) {
 #ifdef COMMAND_UTILITIES_VERBOSE
-                print("Found col data cmd in queue (%lu, %lu)\n", arg1, arg2);
+        print("Found col data cmd in queue (%u)\n", block_type);
 #endif
-                return true;
-            }
-        }
+        return true;
     }
 
     return false;
@@ -512,11 +833,13 @@ bool cmd_queue_contains_col_data_block(uint8_t block_type) {
 
 // If the command queue is not empty, dequeues the next command and executes it
 void execute_next_cmd(void) {
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        if (queue_empty(&cmd_queue_1)) {
-            return;
-        }
-        if (queue_empty(&cmd_queue_2)) {
+#ifdef CMD_LATS
+    uint8_t cmd_index = 0;
+    uint32_t enqueue_ticks = 0;
+#endif
+
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (cmd_queue_empty()) {
             return;
         }
         // Only continue if we are open to start a new command
@@ -524,14 +847,25 @@ void execute_next_cmd(void) {
             return;
         }
 
+#ifdef CMD_LATS
+        cmd_index = cmd_queue.entries[cmd_queue.head].cmd_index;
+        enqueue_ticks = cmd_queue.entries[cmd_queue.head].enqueue_ticks;
+#endif
+
         // Fetch the next command
         dequeue_cmd((uint16_t*) &current_cmd_id, (cmd_t**) &current_cmd,
             (uint32_t*) &current_cmd_arg1, (uint32_t*) &current_cmd_arg2);
     }
 
+    current_cmd_start_ticks = prof_ticks();
+#ifdef CMD_LATS
+    add_cmd_lat(cmd_lats[cmd_index].queue, enqueue_ticks);
+#endif
+
     if (print_cmds) {
         print("Cmd: id = 0x%.4x, opcode = 0x%.2x, arg1 = 0x%lx, arg2 = 0x%lx\n",
-            current_cmd_id, current_cmd->opcode, current_cmd_arg1, current_cmd_arg2);
+            current_cmd_id, cmd_opcode((cmd_t*) current_cmd), current_cmd_arg1,
+            current_cmd_arg2);
     }
 
 #ifdef COMMAND_UTILITIES_DEBUG
@@ -539,8 +873,9 @@ void execute_next_cmd(void) {
 #endif
 
     // Start timeout timer at 0
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         cmd_timeout_count_s = 0;
+        cmd_timed_out = false;
     }
 
     // Decide whether to use the primary or secondary command log
@@ -549,13 +884,18 @@ void execute_next_cmd(void) {
     // Log everything for the command (except the status byte)
     // If we are running col_data_block_cmd, only populate the header and write
     // to the command log if it is field 0 (starting the command)
-    if ((current_cmd != &col_data_block_cmd) ||
-            (current_cmd == &col_data_block_cmd && current_cmd_arg2 == 0)) {
+    // Continuations of read_data_block_range_cmd, sync_data_blocks_cmd and
+    // start_bulk_read_cmd are not logged either
+    if (((current_cmd != &col_data_block_cmd) ||
+            (current_cmd == &col_data_block_cmd && current_cmd_arg2 == 0)) &&
+            !(current_cmd == &read_data_block_range_cmd &&
+            (current_cmd_arg1 & CMD_READ_DATA_BLOCK_RANGE_CONT)) &&
+            !(current_cmd == &sync_data_blocks_cmd &&
+            (current_cmd_arg1 & CMD_SYNC_DATA_BLOCKS_CONT)) &&
+            !(current_cmd == &start_bulk_read_cmd &&
+            (current_cmd_arg1 & CMD_BULK_READ_CONT))) {
         populate_header(&cmd_log_header, cmd_log_mem_section->curr_block, CMD_RESP_STATUS_UNKNOWN);
-        write_mem_cmd_block(cmd_log_mem_section, cmd_log_mem_section->curr_block,
-            &cmd_log_header, current_cmd_id, current_cmd->opcode, current_cmd_arg1,
-            current_cmd_arg2);
-        
+
         // If we are starting a col_data_block_cmd (therefore must be field 0),
         // store the block number
         // in the command log (will be primary) so it can keep track of it
@@ -565,11 +905,15 @@ void execute_next_cmd(void) {
                 data_col_t* data_col = all_data_cols[i];
                 if (current_cmd_arg1 == data_col->cmd_arg1) {
                     data_col->cmd_log_block_num = cmd_log_mem_section->curr_block;
+                    data_col->start_ticks = current_cmd_start_ticks;
                 }
             }
         }
 
-        inc_and_prepare_mem_section_curr_block(cmd_log_mem_section);
+        // Buffered to be written to flash later with its status
+        append_cmd_log(cmd_log_mem_section, &cmd_log_header, current_cmd_id,
+            cmd_opcode((cmd_t*) current_cmd), current_cmd_arg1,
+            current_cmd_arg2);
     }
     else {
 #ifdef COMMAND_UTILITIES_VERBOSE
@@ -577,91 +921,412 @@ void execute_next_cmd(void) {
 #endif
     }
 
+    // Reject the command without running it if the arguments are invalid
+    // (it is still logged above with this status)
+    if (!cmd_args_valid((cmd_t*) current_cmd, current_cmd_arg1, current_cmd_arg2)) {
+        if (current_cmd_id != CMD_CMD_ID_AUTO_ENQUEUED) {
+            add_def_trans_tx_dec_msg(CMD_RESP_STATUS_INVALID_ARGS);
+        }
+        finish_current_cmd(CMD_RESP_STATUS_INVALID_ARGS);
+        return;
+    }
+
     // Execute the command's function
-    (current_cmd->fn)();
+    (cmd_fn((cmd_t*) current_cmd))();
 }
 
-// Finishes executing the current command and writes the status byte in the command log
+/*
+Finishes executing the current command and writes the status byte in the
+    command log.
+The command is taken first (with interrupts disabled) so nothing else can
+    finish it again, then its results are written to flash with interrupts
+    enabled.
+*/
 void finish_current_cmd(uint8_t status) {
 #ifdef COMMAND_UTILITIES_VERBOSE
     print("%s: stat = 0x%.2x\n", __FUNCTION__, status);
 #endif
 
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        // The erase flash command erases the command log as well, therefore re-write the command log
-        // for the erase flash command
-        if (current_cmd == &erase_all_mem_cmd) {
-            write_mem_cmd_block(&prim_cmd_log_mem_section,
-                prim_cmd_log_mem_section.curr_block - 1, &cmd_log_header,
-                current_cmd_id, current_cmd->opcode, current_cmd_arg1,
-                current_cmd_arg2);
-        }
+    uint16_t cmd_id = 0;
+    cmd_t* cmd = &nop_cmd;
+    uint32_t arg1 = 0;
+    uint32_t arg2 = 0;
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        cmd_id = current_cmd_id;
+        cmd = (cmd_t*) current_cmd;
+        arg1 = current_cmd_arg1;
+        arg2 = current_cmd_arg2;
 
-        // If we are collecting a data block and it is the last field, write the
-        // status byte to the header of the data section and the header of the
-        // primary command log
-        if (current_cmd == &col_data_block_cmd) {
-            // Only do this if the status argument is not the dummy value that
-            // indicates data collection is still in progress
-            if (status != CMD_RESP_STATUS_DATA_COL_IN_PROGRESS) {
-    #ifdef COMMAND_UTILITIES_VERBOSE
-                print("Writing mem header status\n");
-    #endif
-
-                for (uint8_t i = 0; i < NUM_DATA_COL_SECTIONS; i++) {
-                    data_col_t* data_col = all_data_cols[i];
-
-                    // If we just finished the last field of a command
-                    // or it timed out
-                    // or it was OBC_HK (is only enqueued and executed once)
-                    if (current_cmd_arg1 == data_col->cmd_arg1 &&
-                            (current_cmd_arg2 == data_col->mem_section->fields_per_block ||
-                            status == CMD_RESP_STATUS_TIMED_OUT ||
-                            current_cmd_arg1 == CMD_OBC_HK)) {
+        current_cmd_id = 0xFFFF;
+        current_cmd = &nop_cmd;
+        current_cmd_arg1 = 0;
+        current_cmd_arg2 = 0;
+
+        cmd_timeout_count_s = 0;
+        cmd_timed_out = false;
+    }
+
+    // The erase flash command erases the command log as well, therefore re-write the command log
+    // for the erase flash command
+    if (cmd == &erase_all_mem_cmd) {
+        write_mem_cmd_block(&prim_cmd_log_mem_section,
+            prim_cmd_log_mem_section.curr_block - 1, &cmd_log_header,
+            cmd_id, cmd_opcode(cmd), arg1, arg2);
+    }
+
+    // If we are collecting a data block and it is the last field, write the
+    // status byte to the header of the data section and the header of the
+    // primary command log
+    if (cmd == &col_data_block_cmd) {
+        // Only do this if the status argument is not the dummy value that
+        // indicates data collection is still in progress
+        if (status != CMD_RESP_STATUS_DATA_COL_IN_PROGRESS) {
+#ifdef COMMAND_UTILITIES_VERBOSE
+            print("Writing mem header status\n");
+#endif
+
+            for (uint8_t i = 0; i < NUM_DATA_COL_SECTIONS; i++) {
+                data_col_t* data_col = all_data_cols[i];
+
+                // If this is the command finishing a collection
+                // (after the last field or a field timeout)
+                // or it was OBC_HK (is only enqueued and executed once)
+                if (arg1 == data_col->cmd_arg1 &&
+                        status != CMD_RESP_STATUS_INVALID_ARGS &&
+                        (arg2 == CMD_COL_DATA_BLOCK_FINISH ||
+                        arg1 == CMD_OBC_HK)) {
 #ifdef COMMAND_UTILITIES_DEBUG_DATA_COL
-                        print("\nWriting mem header status: ");
-                        print("arg1 = 0x%lx, arg2 = 0x%lx, status = 0x%x, block_num = 0x%lx\n\n",
-                            current_cmd_arg1, current_cmd_arg2, status, data_col->header.block_num);
+                    print("\nWriting mem header status: ");
+                    print("arg1 = 0x%lx, arg2 = 0x%lx, status = 0x%x, block_num = 0x%lx\n\n",
+                        arg1, arg2, status, data_col->header.block_num);
 #endif
 
-                        write_mem_header_status(
-                            data_col->mem_section, data_col->header.block_num,
-                            status);
-                        write_mem_header_status(&prim_cmd_log_mem_section, data_col->cmd_log_block_num, status);
-                    }
+                    commit_data_col_block(data_col, status);
+                    set_cmd_log_status(&prim_cmd_log_mem_section, data_col->cmd_log_block_num, status);
                 }
             }
         }
+    }
 
-        else {
-            // Write the status byte to the appropriate command log (based on command)
-            mem_section_t* section = mem_section_for_cmd((cmd_t*) current_cmd);
-            write_mem_header_status(section, section->curr_block - 1, status);
-        }
-
-        current_cmd_id = 0xFFFF;
-        current_cmd = &nop_cmd;
-        current_cmd_arg1 = 0;
-        current_cmd_arg2 = 0;
+    // If the command re-enqueued itself to continue later, it will write
+    // the status when it is done
+    else if (status != CMD_RESP_STATUS_IN_PROGRESS) {
+        // Write the status byte to the appropriate command log (based on command)
+        mem_section_t* section = mem_section_for_cmd(cmd);
+        set_cmd_log_status(section, section->curr_block - 1, status);
+    }
 
-        cmd_timeout_count_s = 0;
+#ifdef CMD_LATS
+    // Add the run time, unless the command will continue later
+    // (a collection's run time is from the start of the collection)
+    uint8_t cmd_index = cmd_to_cmd_index(cmd);
+    if (status != CMD_RESP_STATUS_IN_PROGRESS &&
+            cmd_index < all_cmds_list_len) {
+        uint32_t start_ticks = current_cmd_start_ticks;
+        if (cmd == &col_data_block_cmd &&
+                arg2 == CMD_COL_DATA_BLOCK_FINISH) {
+            for (uint8_t i = 0; i < NUM_DATA_COL_SECTIONS; i++) {
+                if (arg1 == all_data_cols[i]->cmd_arg1) {
+                    start_ticks = all_data_cols[i]->start_ticks;
+                }
+            }
+        }
+        add_cmd_lat(cmd_lats[cmd_index].run, start_ticks);
     }
+#endif
+
+    // The next command can start
+    set_event(EVENT_CMD);
 
 #ifdef COMMAND_UTILITIES_DEBUG
     print("Finish cmd: stat = 0x%.2x\n", status);
 #endif
 }
 
+#ifdef CMD_LATS
 
+/*
+Returns the cmd_lat_t bucket for a duration in uptime timer ticks.
+*/
+uint8_t cmd_lat_bucket(uint32_t ticks) {
+    uint8_t bucket = 0;
+    while (bucket < CMD_LAT_NUM_BUCKETS - 1 &&
+            ticks >= (1UL << CMD_LAT_BUCKET_SHIFT)) {
+        ticks >>= CMD_LAT_BUCKET_SHIFT;
+        bucket++;
+    }
+    return bucket;
+}
 
+/*
+Counts a duration from `start_ticks` (from prof_ticks()) until now in one of
+    the histograms (queue or run) of a cmd_lat_t.
+If the bucket is full, all buckets of the histogram are halved first.
+*/
+void add_cmd_lat(uint8_t* hist, uint32_t start_ticks) {
+    uint8_t bucket = cmd_lat_bucket(prof_ticks() - start_ticks);
+
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (hist[bucket] == 0xFF) {
+            for (uint8_t i = 0; i < CMD_LAT_NUM_BUCKETS; i++) {
+                hist[i] >>= 1;
+            }
+        }
+        hist[bucket]++;
+    }
+}
+
+/*
+Loads the histograms saved in EEPROM, unless they were saved by firmware with
+    a different command list (or never saved).
+*/
+void init_cmd_lats(void) {
+    if (read_eeprom(CMD_LAT_EEPROM_ADDR) != CMD_LAT_EEPROM_MARKER) {
+        return;
+    }
+
+    eeprom_read_block(cmd_lats, (const void*) (CMD_LAT_EEPROM_ADDR + 4),
+        all_cmds_list_len * sizeof(cmd_lat_t));
+}
+
+/*
+Writes the histograms to EEPROM (only the bytes that have changed are
+    written). Interrupts are not disabled, so a count that changes during the
+    save might be one behind.
+*/
+void save_cmd_lats(void) {
+    eeprom_update_block(cmd_lats, (void*) (CMD_LAT_EEPROM_ADDR + 4),
+        all_cmds_list_len * sizeof(cmd_lat_t));
+    write_eeprom(CMD_LAT_EEPROM_ADDR, CMD_LAT_EEPROM_MARKER);
+}
+
+// Saves the histograms every CMD_LAT_SAVE_PERIOD_S, to run in the main loop
+void run_cmd_lats(void) {
+    uint32_t now = 0;
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        now = uptime_s;
+    }
+
+    if (now >= cmd_lat_prev_save_uptime_s + CMD_LAT_SAVE_PERIOD_S) {
+        cmd_lat_prev_save_uptime_s = now;
+        save_cmd_lats();
+    }
+}
+
+#endif
+
+
+
+
+/*
+Writes the fields staged since the last flush to flash in one burst, with the
+    header first if this is the first flush for the block. The header status
+    byte is left as CMD_RESP_STATUS_UNKNOWN (erased) so it can be written when
+    the block is committed.
+Compressed sections are never flushed early because each block is written as
+    one record when it is committed.
+*/
+void flush_data_col_block(data_col_t* data_col) {
+    if (data_col->flushed_field_count >= data_col->staged_field_count ||
+            data_col->mem_section->compressed != NULL) {
+        return;
+    }
+
+    mem_header_t header = data_col->header;
+    header.status = CMD_RESP_STATUS_UNKNOWN;
+
+    write_mem_data_block_fields(data_col->mem_section,
+        data_col->header.block_num, &header, data_col->fields,
+        data_col->flushed_field_count == 0,
+        data_col->flushed_field_count, data_col->staged_field_count);
+    data_col->flushed_field_count = data_col->staged_field_count;
+}
+
+/*
+Finishes the current block for the data collection - writes the header status
+    and all staged fields not yet written to flash, then the block's CRC (if
+    the section has one).
+If nothing was flushed early, the header, fields and status all go in a single
+    burst. Fields that were never received are left erased in flash.
+*/
+void commit_data_col_block(data_col_t* data_col, uint8_t status) {
+    data_col->header.status = status;
+
+    if (data_col->flushed_field_count == 0) {
+        write_mem_data_block_fields(data_col->mem_section,
+            data_col->header.block_num, &data_col->header, data_col->fields,
+            true, 0, data_col->staged_field_count);
+    } else {
+        write_mem_data_block_fields(data_col->mem_section,
+            data_col->header.block_num, &data_col->header, data_col->fields,
+            false, data_col->flushed_field_count,
+            data_col->staged_field_count);
+        write_mem_header_status(data_col->mem_section,
+            data_col->header.block_num, status);
+    }
+    write_mem_block_crc(data_col->mem_section, data_col->header.block_num);
+
+    data_col->flushed_field_count = data_col->staged_field_count;
+
+    if (status == CMD_RESP_STATUS_OK) {
+        update_beacon_fields(data_col);
+    }
+    add_data_col_to_run_agg(data_col);
+}
+
+/*
+Re-writes the beacon fields that come from this block type with the block that
+    was just collected (the other fields are not changed).
+*/
+void update_beacon_fields(data_col_t* data_col) {
+    for (uint8_t i = 0; i < TRANS_BEACON_NUM_FIELDS; i++) {
+        if (pgm_read_byte(&beacon_fields[i].block_type) == data_col->cmd_arg1) {
+            uint8_t field = pgm_read_byte(&beacon_fields[i].field);
+            set_trans_beacon_field(i, get_packed_field(data_col->fields, field));
+        }
+    }
+}
+
+/*
+Adds a command log record to cmd_log_buf for the section's current block and
+    moves the section to the next block. The record and the new current block
+    number (in EEPROM) are written by flush_cmd_log(), which is called first if
+    the buffer is full.
+*/
+void append_cmd_log(mem_section_t* section, mem_header_t* header,
+        uint16_t cmd_id, uint8_t opcode, uint32_t arg1, uint32_t arg2) {
+    if (cmd_log_buf.count >= CMD_LOG_BUF_SIZE) {
+        flush_cmd_log();
+    }
+
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        uint8_t i = cmd_log_buf.count;
+        cmd_log_buf.sections[i] = section;
+        cmd_log_buf.block_nums[i] = section->curr_block;
+        mem_header_to_bytes(header, cmd_log_buf.bytes[i]);
+        mem_cmd_to_bytes(cmd_id, opcode, arg1, arg2,
+            &cmd_log_buf.bytes[i][MEM_BYTES_PER_HEADER]);
+        cmd_log_buf.count++;
+
+        // Only the erases for the next block are started now, the block
+        // number is written to EEPROM when the buffer is flushed
+        uint32_t next_block = next_mem_section_block(section);
+        erase_ahead_mem_section_block(section, next_block);
+        section->curr_block = next_block;
+    }
+}
+
+/*
+Sets the status byte of a command log record, in cmd_log_buf if the record has
+    not been written yet, or else in flash (with interrupts enabled).
+*/
+void set_cmd_log_status(mem_section_t* section, uint32_t block_num,
+        uint8_t status) {
+    bool buffered = false;
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        for (uint8_t i = 0; i < cmd_log_buf.count; i++) {
+            if (cmd_log_buf.sections[i] == section &&
+                    cmd_log_buf.block_nums[i] == block_num) {
+                cmd_log_buf.bytes[i][MEM_STATUS_HEADER_OFFSET] = status;
+                buffered = true;
+                break;
+            }
+        }
+    }
+
+    if (!buffered) {
+        write_mem_header_status(section, block_num, status);
+    }
+}
+
+/*
+Writes all records in cmd_log_buf to flash, with one write for each run of
+    consecutive blocks in the same section, then journals the current block
+    number of each section that was written to.
+Must be called before anything else reads or changes the command log sections
+    in flash (e.g. reading command blocks, erasing or resetting).
+*/
+void flush_cmd_log(void) {
+    // Only take the records with interrupts disabled, then write them with
+    // interrupts enabled
+    // They stay in cmd_log_buf while they are written - records are only
+    // added from the main loop, so they can't be overwritten until this
+    // returns
+    uint8_t count = 0;
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        count = cmd_log_buf.count;
+        cmd_log_buf.count = 0;
+    }
+
+    uint8_t i = 0;
+    while (i < count) {
+        mem_section_t* section = cmd_log_buf.sections[i];
+        uint8_t run = 1;
+        while (i + run < count &&
+                cmd_log_buf.sections[i + run] == section &&
+                cmd_log_buf.block_nums[i + run] ==
+                cmd_log_buf.block_nums[i] + run) {
+            run++;
+        }
+
+        write_mem_section_bytes(section,
+            mem_block_section_addr(section, cmd_log_buf.block_nums[i]),
+            cmd_log_buf.bytes[i], run * MEM_CMD_LOG_BYTES_PER_BLOCK);
+        i += run;
+    }
+
+    // One EEPROM journal record for each section
+    for (i = 0; i < count; i++) {
+        bool first = true;
+        for (uint8_t j = 0; j < i; j++) {
+            if (cmd_log_buf.sections[j] == cmd_log_buf.sections[i]) {
+                first = false;
+            }
+        }
+        if (first) {
+            append_mem_journal(cmd_log_buf.sections[i]);
+        }
+    }
+}
+
+/*
+Flushes the command log buffer if it has reached CMD_LOG_BUF_FLUSH_THRESHOLD
+    records, or if no command is running or waiting (idle).
+*/
+void run_cmd_log(void) {
+    if (cmd_log_buf.count == 0) {
+        return;
+    }
+
+    if (cmd_log_buf.count >= CMD_LOG_BUF_FLUSH_THRESHOLD ||
+            (cmd_queue_empty() && current_cmd == &nop_cmd)) {
+        flush_cmd_log();
+    }
+}
+
+
+
+
+/*
+Queues background erases if the next block is in a different sector than the
+    section's current block.
+*/
+void erase_ahead_mem_section_block(mem_section_t* section, uint32_t next_block) {
+    // Compressed sections don't have fixed block addresses - the sectors are
+    // erased as the records are written
+    if (section->compressed != NULL) {
+        return;
+    }
 
-void prepare_mem_section_curr_block(mem_section_t* section, uint32_t next_block) {
     // If the next block is going into a different memory sector, erase it
     // Use the end address because it reaches the farthest possible address
-    uint32_t curr_end_addr = mem_block_end_addr(section, section->curr_block);
-    uint32_t curr_sector = mem_sector_for_addr(curr_end_addr);
-    uint32_t next_end_addr = mem_block_end_addr(section, next_block);
-    uint32_t next_sector = mem_sector_for_addr(next_end_addr);
+    // (offsets from the start of the section, see mem_section_erase_sector()
+    // for striped sections)
+    uint32_t curr_end_addr = mem_block_end_section_addr(section,
+        section->curr_block);
+    uint32_t curr_sector = mem_section_erase_sector(section, curr_end_addr);
+    uint32_t next_end_addr = mem_block_end_section_addr(section, next_block);
+    uint32_t next_sector = mem_section_erase_sector(section, next_end_addr);
     
 #ifdef COMMAND_UTILITIES_VERBOSE
     print("Preparing mem section block\n");
@@ -672,19 +1337,35 @@ void prepare_mem_section_curr_block(mem_section_t* section, uint32_t next_block)
 #endif
 
     if (next_sector != curr_sector) {
-        // Enqueue to front to be guaranteed to be executed next
-        enqueue_cmd_front(CMD_CMD_ID_AUTO_ENQUEUED, &erase_mem_phy_sector_cmd,
-            mem_addr_for_sector(next_sector), 0);    // auto
+        // Erase in the background (along with the sectors after it) instead
+        // of blocking the command queue
+        // Writes to a sector still waiting to be erased erase it first
+        erase_mem_section_ahead(section, next_sector);
     }
+}
+
+void prepare_mem_section_curr_block(mem_section_t* section, uint32_t next_block) {
+    erase_ahead_mem_section_block(section, next_block);
 
     // Set the new block number
     set_mem_section_curr_block(section, next_block);
 }
 
-void inc_and_prepare_mem_section_curr_block(mem_section_t* section) {
+/*
+Returns the block number after the section's current block (wrapping around to
+    block 0 at the end of the section).
+*/
+uint32_t next_mem_section_block(mem_section_t* section) {
     uint32_t curr_block = section->curr_block;
     uint32_t next_block = curr_block + 1;
 
+    if (section->compressed != NULL) {
+        if (next_block >= MEM_ERASED_BLOCK_NUM) {
+            next_block = 0;
+        }
+        return next_block;
+    }
+
     // If the next block will go outside the bounds of the section,
     // go back to block 0
     // Use the end address because it reaches the farthest possible address
@@ -696,7 +1377,85 @@ void inc_and_prepare_mem_section_curr_block(mem_section_t* section) {
         next_block = 0;
     }
 
-    prepare_mem_section_curr_block(section, next_block);
+    return next_block;
+}
+
+void inc_and_prepare_mem_section_curr_block(mem_section_t* section) {
+    prepare_mem_section_curr_block(section, next_mem_section_block(section));
+}
+
+/*
+Returns the number of positions in the order the blocks of a data section were
+    written (see data_block_write_order()).
+*/
+uint32_t data_block_write_order_count(mem_section_t* section) {
+    if (section->compressed != NULL) {
+        return section->curr_block;
+    }
+    return mem_section_num_blocks(section);
+}
+
+/*
+Returns the block number at position `pos` in the order the blocks of a data
+    section were written, oldest first. This starts at the current block, since
+    after the section wraps around that is where the oldest data is (after the
+    blocks erased ahead of it).
+Block numbers in a compressed section do not wrap around (old sectors are
+    dropped instead), so the position is the block number.
+*/
+uint32_t data_block_write_order(mem_section_t* section, uint32_t pos) {
+    if (section->compressed != NULL) {
+        return pos;
+    }
+
+    uint32_t num_blocks = mem_section_num_blocks(section);
+    uint32_t block_num = section->curr_block + pos;
+    if (block_num >= num_blocks) {
+        block_num -= num_blocks;
+    }
+    return block_num;
+}
+
+/*
+Finds where a time falls in a data section - the first position (see
+    data_block_write_order()) with a block from after time_s, or at time_s if
+    `inclusive` is true.
+time_s - seconds since 2000 (see rtc_clock_to_s())
+
+The header of every block has its date and time, and the address of a block is
+    calculated from its number, so the headers in flash are already an index
+    from time to block and this is a binary search over them (O(log n) header
+    reads, about 15 for a full section).
+Unwritten blocks count as older than all written ones - they can only be at
+    the start of the order (erased ahead of the current block, or the section
+    has not wrapped around yet). This relies on the RTC time increasing in the
+    order the blocks are written.
+Returns data_block_write_order_count() if there is no such block.
+*/
+uint32_t find_data_block_by_time(mem_section_t* section, uint32_t time_s,
+        bool inclusive) {
+    uint32_t lo = 0;
+    uint32_t hi = data_block_write_order_count(section);
+
+    while (lo < hi) {
+        uint32_t mid = lo + ((hi - lo) / 2);
+        mem_header_t header;
+        read_mem_header(section, data_block_write_order(section, mid), &header);
+
+        bool before = true;
+        if (header.block_num != MEM_ERASED_BLOCK_NUM) {
+            uint32_t header_s = rtc_clock_to_s(header.date, header.time);
+            before = inclusive ? (header_s < time_s) : (header_s <= time_s);
+        }
+
+        if (before) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
 }
 
 /*
@@ -704,13 +1463,12 @@ Populates the block number, success, and current live date/time.
 */
 void populate_header(mem_header_t* header, uint32_t block_num, uint8_t status) {
     header->block_num = block_num;
-    header->date = read_rtc_date();
-    header->time = read_rtc_time();
+    get_rtc_clock(&header->date, &header->time);
     header->status = status;
 }
 
 void add_def_trans_tx_dec_msg(uint8_t status) {
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         start_trans_tx_resp(status);
         finish_trans_tx_resp();
     }
@@ -729,11 +1487,274 @@ void append_header_to_tx_msg(mem_header_t* header) {
     append_to_trans_tx_resp(header->status);
 }
 
-void append_fields_to_tx_msg(uint32_t* fields, uint8_t num_fields) {
-    for (uint8_t i = 0; i < num_fields; i++) {
-        append_to_trans_tx_resp((fields[i] >> 16) & 0xFF);
-        append_to_trans_tx_resp((fields[i] >> 8) & 0xFF);
-        append_to_trans_tx_resp(fields[i] & 0xFF);
+// fields - packed (see get_packed_field()), so they are already in the order
+// they are sent
+void append_fields_to_tx_msg(uint8_t* fields, uint8_t num_fields) {
+    for (uint8_t i = 0; i < num_fields * MEM_BYTES_PER_FIELD; i++) {
+        append_to_trans_tx_resp(fields[i]);
+    }
+}
+
+/*
+Starts a run-length encoded response after start_trans_tx_resp(). The first 2
+    bytes are the number of bytes encoded, which are set by finish_rle_resp().
+*/
+void start_rle_resp(rle_resp_t* rle) {
+    rle->count = 0;
+    rle->literal_index = 0;
+    rle->run_len = 0;
+    rle->full = false;
+
+    trans_tx_dec_msg[trans_tx_dec_len + 0] = 0x00;
+    trans_tx_dec_msg[trans_tx_dec_len + 1] = 0x00;
+    trans_tx_dec_len += 2;
+}
+
+// Returns false if the response is full
+static bool append_rle_literal(rle_resp_t* rle, uint8_t byte) {
+    if (rle->literal_index != 0 && trans_tx_dec_msg[rle->literal_index] <
+            CMD_RLE_LITERAL + CMD_RLE_MAX_LITERAL - 1) {
+        if (trans_tx_dec_len + 1 > TRANS_TX_DEC_MSG_MAX_SIZE) {
+            rle->full = true;
+            return false;
+        }
+        trans_tx_dec_msg[rle->literal_index]++;
+    } else {
+        if (trans_tx_dec_len + 2 > TRANS_TX_DEC_MSG_MAX_SIZE) {
+            rle->full = true;
+            return false;
+        }
+        rle->literal_index = trans_tx_dec_len;
+        trans_tx_dec_msg[trans_tx_dec_len] = CMD_RLE_LITERAL;
+        trans_tx_dec_len++;
+    }
+
+    trans_tx_dec_msg[trans_tx_dec_len] = byte;
+    trans_tx_dec_len++;
+    rle->count++;
+    return true;
+}
+
+// Encodes the pending run, returns false if the response is full
+static bool flush_rle_run(rle_resp_t* rle) {
+    uint8_t len = rle->run_len;
+    rle->run_len = 0;
+
+    if (len < CMD_RLE_MIN_RUN) {
+        for (uint8_t i = 0; i < len; i++) {
+            if (!append_rle_literal(rle, rle->run_byte)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    if (trans_tx_dec_len + 1 > TRANS_TX_DEC_MSG_MAX_SIZE) {
+        rle->full = true;
+        return false;
+    }
+    trans_tx_dec_msg[trans_tx_dec_len] = ((rle->run_byte == 0x00) ?
+        CMD_RLE_ZERO_RUN : CMD_RLE_ERASED_RUN) | (len - 1);
+    trans_tx_dec_len++;
+    rle->literal_index = 0;
+    rle->count += len;
+    return true;
+}
+
+/*
+Adds the next byte to a run-length encoded response. Runs of 0x00 or 0xFF are
+    only encoded when they end (or in finish_rle_resp()).
+Returns false once the response is full, but rle->count is only the bytes that
+    were encoded (a run that did not fit is not counted).
+*/
+bool append_rle_resp(rle_resp_t* rle, uint8_t byte) {
+    if (rle->full) {
+        return false;
+    }
+
+    if (rle->run_len > 0 && byte == rle->run_byte &&
+            rle->run_len < CMD_RLE_MAX_RUN) {
+        rle->run_len++;
+        return true;
+    }
+    if (!flush_rle_run(rle)) {
+        return false;
+    }
+
+    if (byte == 0x00 || byte == 0xFF) {
+        rle->run_byte = byte;
+        rle->run_len = 1;
+        return true;
+    }
+    return append_rle_literal(rle, byte);
+}
+
+// Encodes the last run and sets the number of bytes encoded
+void finish_rle_resp(rle_resp_t* rle) {
+    if (!rle->full) {
+        flush_rle_run(rle);
+    }
+
+    // After cmd ID and status
+    trans_tx_dec_msg[3] = (rle->count >> 8) & 0xFF;
+    trans_tx_dec_msg[4] = rle->count & 0xFF;
+}
+
+// Offset and length of each part of a command log block (see
+// CMD_CMD_LOG_REF_*)
+static const uint8_t cmd_log_ref_offsets[CMD_CMD_LOG_REF_PARTS] PROGMEM = {
+    0, 3, 6, MEM_STATUS_HEADER_OFFSET,
+    MEM_BYTES_PER_HEADER + 0, MEM_BYTES_PER_HEADER + 2,
+    MEM_BYTES_PER_HEADER + 3, MEM_BYTES_PER_HEADER + 7
+};
+static const uint8_t cmd_log_ref_lens[CMD_CMD_LOG_REF_PARTS] PROGMEM = {
+    3, 3, 3, 1, 2, 1, 4, 4
+};
+
+/*
+Adds a command log block (MEM_CMD_LOG_BYTES_PER_BLOCK bytes, as in memory) to
+    a compressed response: a bitmap of the parts that are the same as in
+    `prev`, then the other parts.
+Returns false (without adding anything) if it does not fit.
+*/
+bool append_cmd_log_ref_to_tx_msg(uint8_t* prev, uint8_t* block) {
+    uint32_t prev_block_num = ((uint32_t) prev[0] << 16) |
+        ((uint32_t) prev[1] << 8) | prev[2];
+    uint32_t block_num = ((uint32_t) block[0] << 16) |
+        ((uint32_t) block[1] << 8) | block[2];
+
+    uint8_t bitmap = 0;
+    uint8_t len = 1;
+    for (uint8_t i = 0; i < CMD_CMD_LOG_REF_PARTS; i++) {
+        uint8_t offset = pgm_read_byte(&cmd_log_ref_offsets[i]);
+        uint8_t part_len = pgm_read_byte(&cmd_log_ref_lens[i]);
+        bool same;
+        if (i == CMD_CMD_LOG_REF_BLOCK_NUM) {
+            same = block_num == ((prev_block_num + 1) & 0xFFFFFF);
+        } else {
+            same = memcmp(&prev[offset], &block[offset], part_len) == 0;
+        }
+
+        if (same) {
+            bitmap |= 1U << i;
+        } else {
+            len += part_len;
+        }
+    }
+
+    if (trans_tx_dec_len + len > TRANS_TX_DEC_MSG_MAX_SIZE) {
+        return false;
+    }
+
+    trans_tx_dec_msg[trans_tx_dec_len] = bitmap;
+    trans_tx_dec_len++;
+    for (uint8_t i = 0; i < CMD_CMD_LOG_REF_PARTS; i++) {
+        if ((bitmap & (1U << i)) == 0) {
+            uint8_t part_len = pgm_read_byte(&cmd_log_ref_lens[i]);
+            memcpy((uint8_t*) &trans_tx_dec_msg[trans_tx_dec_len],
+                &block[pgm_read_byte(&cmd_log_ref_offsets[i])], part_len);
+            trans_tx_dec_len += part_len;
+        }
+    }
+    return true;
+}
+
+// Clears an aggregate and selects the fields for it
+void init_data_agg(data_agg_t* agg, uint8_t block_type, uint8_t first_field,
+        uint8_t field_mask) {
+    agg->block_type = block_type;
+    agg->first_field = first_field;
+    agg->field_mask = field_mask;
+    agg->block_count = 0;
+    agg->last_block_num = 0;
+    for (uint8_t i = 0; i < CMD_AGG_MAX_FIELDS; i++) {
+        agg->fields[i].count = 0;
+        agg->fields[i].min = 0;
+        agg->fields[i].max = 0;
+        agg->fields[i].sum = 0;
+        agg->fields[i].last = 0;
+    }
+}
+
+/*
+Adds one block to an aggregate.
+block_num - block number
+fields - values of fields (first_field) to (first_field + CMD_AGG_MAX_FIELDS -
+    1), only the ones selected by the field mask are used
+Blocks past CMD_AGG_MAX_BLOCKS are ignored.
+*/
+void add_to_data_agg(data_agg_t* agg, uint32_t block_num, uint32_t* fields) {
+    if (agg->block_count >= CMD_AGG_MAX_BLOCKS) {
+        return;
+    }
+
+    for (uint8_t i = 0; i < CMD_AGG_MAX_FIELDS; i++) {
+        if (!(agg->field_mask & _BV(i)) || fields[i] == CMD_AGG_MISSING_FIELD) {
+            continue;
+        }
+
+        data_agg_field_t* field = &agg->fields[i];
+        if (field->count == 0 || fields[i] < field->min) {
+            field->min = fields[i];
+        }
+        if (field->count == 0 || fields[i] > field->max) {
+            field->max = fields[i];
+        }
+        field->sum += fields[i];
+        field->last = fields[i];
+        field->count++;
+    }
+
+    agg->block_count++;
+    agg->last_block_num = block_num;
+}
+
+// Adds a block that was just collected to the running aggregate (if it is
+// for the same block type)
+void add_data_col_to_run_agg(data_col_t* data_col) {
+    if (run_data_agg.block_type != data_col->cmd_arg1) {
+        return;
+    }
+
+    // Fields after the last one staged were not received
+    uint32_t fields[CMD_AGG_MAX_FIELDS];
+    for (uint8_t i = 0; i < CMD_AGG_MAX_FIELDS; i++) {
+        uint8_t field_num = run_data_agg.first_field + i;
+        fields[i] = (field_num < data_col->staged_field_count) ?
+            get_packed_field(data_col->fields, field_num) :
+            CMD_AGG_MISSING_FIELD;
+    }
+    add_to_data_agg(&run_data_agg, data_col->header.block_num, fields);
+}
+
+/*
+Appends an aggregate to the response - number of blocks (2 bytes), most recent
+    block number (3 bytes), then for each selected field: number of values
+    (2 bytes), minimum, maximum, mean and most recent value (3 bytes each).
+Fields without any values have all 0s.
+*/
+void append_data_agg_to_tx_msg(data_agg_t* agg) {
+    append_to_trans_tx_resp((agg->block_count >> 8) & 0xFF);
+    append_to_trans_tx_resp(agg->block_count & 0xFF);
+    append_to_trans_tx_resp((agg->last_block_num >> 16) & 0xFF);
+    append_to_trans_tx_resp((agg->last_block_num >> 8) & 0xFF);
+    append_to_trans_tx_resp(agg->last_block_num & 0xFF);
+
+    for (uint8_t i = 0; i < CMD_AGG_MAX_FIELDS; i++) {
+        if (!(agg->field_mask & _BV(i))) {
+            continue;
+        }
+
+        data_agg_field_t* field = &agg->fields[i];
+        uint8_t values[4 * MEM_BYTES_PER_FIELD];
+        set_packed_field(values, 0, field->min);
+        set_packed_field(values, 1, field->max);
+        set_packed_field(values, 2,
+            field->count > 0 ? field->sum / field->count : 0);
+        set_packed_field(values, 3, field->last);
+        append_to_trans_tx_resp((field->count >> 8) & 0xFF);
+        append_to_trans_tx_resp(field->count & 0xFF);
+        append_fields_to_tx_msg(values, 4);
     }
 }
 
@@ -756,45 +1777,72 @@ void init_auto_data_col(void) {
         PAY_HK_AUTO_DATA_COL_PERIOD_EEPROM_ADDR, PAY_HK_AUTO_DATA_COL_PERIOD);
     pay_opt_data_col.auto_period = read_eeprom_or_default(
         PAY_OPT_AUTO_DATA_COL_PERIOD_EEPROM_ADDR, PAY_OPT_AUTO_DATA_COL_PERIOD);
+
+    for (uint8_t i = 0; i < NUM_DATA_COL_SECTIONS; i++) {
+        data_col_t* data_col = all_data_cols[i];
+        // Only add the timers the first time
+        if (data_col->auto_timer == SCHED_NO_TIMER) {
+            data_col->auto_timer = add_sched_timer(auto_data_col_timer_cb, i);
+            data_col->req_timer = add_sched_timer(data_col_req_timer_cb, i);
+        }
+        update_auto_data_col_timer(data_col);
+    }
 }
 
-// Automatic data collection functionality to run in main loop
-void run_auto_data_col(void) {
-#ifdef COMMAND_UTILITIES_VERBOSE
-    print("Auto data col\n");
-#endif
+// Sets the automatic collection timer from the period and the previous
+// automatic collection (call after changing any of them)
+void update_auto_data_col_timer(data_col_t* data_col) {
+    if (data_col->auto_enabled) {
+        set_sched_timer(data_col->auto_timer,
+            data_col->prev_auto_col_uptime_s + data_col->auto_period);
+    } else {
+        clear_sched_timer(data_col->auto_timer);
+    }
+}
 
-    // Atomic because uptime_s could be changed by interrupt
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        // Could have multiple triggering at the same time
-        for (uint8_t i = 0; i < NUM_DATA_COL_SECTIONS; i++) {
-            data_col_t* data_col = all_data_cols[i];
+/*
+Automatic data collection (scheduler timer function, one timer for each data
+    collection)
+index - index of the data collection in all_data_cols
+*/
+void auto_data_col_timer_cb(uint8_t index) {
+    data_col_t* data_col = all_data_cols[index];
+    if (!data_col->auto_enabled) {
+        return;
+    }
 
-            if (data_col->auto_enabled &&
-                    (uptime_s >= data_col->prev_auto_col_uptime_s + data_col->auto_period)) {
 #ifdef COMMAND_UTILITIES_DEBUG
-                print("Auto %s\n", data_col->name);
+    print("Auto %s\n", data_col->name);
 #endif
 
-                // To avoid filling up the command queue, only enqueue it if
-                // the queue does not alreay contain a collect data block
-                // command for this block type
-                if (!cmd_queue_contains_col_data_block(data_col->cmd_arg1)) {
-                    data_col->prev_auto_col_uptime_s = uptime_s;
-                    enqueue_cmd(CMD_CMD_ID_AUTO_ENQUEUED, &col_data_block_cmd, data_col->cmd_arg1, 0);
-                }
-                else {
+    // Atomic because uptime_s could be changed by interrupt
+    uint32_t now_s = 0;
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        now_s = uptime_s;
+    }
+
+    // To avoid filling up the command queue, only enqueue it if the queue does
+    // not alreay contain a collect data block command for this block type
+    // Also skip it if a collection of this type is still running
+    // If the queue is too full, try again in a second
+    if (data_col->state == DATA_COL_STATE_IDLE &&
+            !cmd_queue_contains_col_data_block(data_col->cmd_arg1) &&
+            enqueue_cmd(CMD_CMD_ID_AUTO_ENQUEUED, &col_data_block_cmd, data_col->cmd_arg1, 0)) {
+        data_col->prev_auto_col_uptime_s = now_s;
+        update_auto_data_col_timer(data_col);
+    }
+    else {
 #ifdef COMMAND_UTILITIES_DEBUG
-                    print("Already in cmd queue\n");
+        print("Already in cmd queue\n");
 #endif
-                }
-            }
-        }
+        set_sched_timer(data_col->auto_timer, now_s + 1);
     }
 }
 
 // If a command (e.g. waiting for a CAN response) is not finished after the
 // designated period, stop waiting to finish
+// Finishing the command writes to flash, so this only flags it for
+// run_cmd_timeout() in the main loop
 void cmd_timeout_timer_cb(void) {
     if (current_cmd == &nop_cmd) {
         return;
@@ -803,14 +1851,24 @@ void cmd_timeout_timer_cb(void) {
     cmd_timeout_count_s += 1;
 
     if (cmd_timeout_count_s >= cmd_timeout_period_s) {
-        print("CMD TIMEOUT\n");
-
         cmd_timeout_count_s = 0;
+        cmd_timed_out = true;
+        set_event(EVENT_CMD);
+    }
+}
 
-        // Only add response packet if not auto command
-        if (current_cmd_id != CMD_CMD_ID_AUTO_ENQUEUED) {
-            add_def_trans_tx_dec_msg(CMD_RESP_STATUS_TIMED_OUT);
-        }
-        finish_current_cmd(CMD_RESP_STATUS_TIMED_OUT);
+// Finishes the current command if cmd_timeout_timer_cb() found it timed out
+// (finish_current_cmd() clears the flag if it finished normally first)
+void run_cmd_timeout(void) {
+    if (!cmd_timed_out) {
+        return;
+    }
+
+    print("CMD TIMEOUT\n");
+
+    // Only add response packet if not auto command
+    if (current_cmd_id != CMD_CMD_ID_AUTO_ENQUEUED) {
+        add_def_trans_tx_dec_msg(CMD_RESP_STATUS_TIMED_OUT);
     }
+    finish_current_cmd(CMD_RESP_STATUS_TIMED_OUT);
 }
@@ -3,24 +3,82 @@
 
 #include <stdbool.h>
 
+#include <avr/pgmspace.h>
+
 #include <can/data_protocol.h>
 #include <queue/queue.h>
 
 #include "mem.h"
+#include "sched.h"
 #include "transceiver.h"
 
 
 // Callback function signature to run a command
 typedef void(*cmd_fn_t)(void);
 
+// Limits on a command's arguments, checked before the command's function runs
+// A max or mask of 0 means that argument is not checked
 typedef struct {
+    // Bit n is set if arg1 = n is allowed (only for arg1 < 16)
+    uint16_t arg1_mask;
+    uint32_t arg1_max;
+    uint32_t arg2_min;
+    uint32_t arg2_max;
+    // CMD_ARGS_* flags
+    uint8_t flags;
+} cmd_args_t;
+
+// Commands are stored in flash (PROGMEM), so cmd_t is const and its fields
+// must be read with cmd_fn(), cmd_opcode(), cmd_pwd_protected() and
+// cmd_args_valid()
+typedef const struct {
     cmd_fn_t fn;
     uint8_t opcode;
     // true if password needs to be correct to execute
     bool pwd_protected;
+    cmd_args_t args;
 } cmd_t;
 
-// Need to declare `cmd_t` before this include to prevent errors from ordering
+// Uncomment (or build with -DCMD_LATS) to keep the command latency histograms
+// When this is not defined, no RAM is used for the histograms (12 bytes per
+// command in all_cmds_list) and the read command latencies command returns
+// no commands
+// #define CMD_LATS
+
+// Command latency histograms (per command in all_cmds_list)
+// Bucket i counts durations below 8^(i+1) uptime timer ticks (1 ms, 8 ms,
+// 65 ms, 0.5 s, 4.2 s at 128 us per tick), and the last bucket counts anything
+// longer
+#define CMD_LAT_NUM_BUCKETS             6
+#define CMD_LAT_BUCKET_SHIFT            3
+
+// Log-scale histograms of how long a command waited in the command queue
+// (enqueue to start) and how long it ran (start to finish)
+// Counts are halved when one of them would overflow, so the shape is kept but
+// the totals are not exact
+typedef struct {
+    uint8_t queue[CMD_LAT_NUM_BUCKETS];
+    uint8_t run[CMD_LAT_NUM_BUCKETS];
+} cmd_lat_t;
+
+// Bulk read session - frames `base_seq` to `base_seq + 31` are in the window
+// and bit i of each bitmap is for frame `base_seq + i`
+typedef struct {
+    bool active;
+    // Command ID of the start bulk read command, used for all frames
+    uint16_t cmd_id;
+    uint32_t start_addr;
+    uint32_t num_bytes;
+    uint16_t num_frames;
+    // First frame that has not been ACKed
+    uint16_t base_seq;
+    // Frames received by ground
+    uint32_t acked;
+    // Frames sent since the last ACK (not sent again until ground asks)
+    uint32_t sent;
+} bulk_read_t;
+
+// Need to declare `cmd_t`, `cmd_lat_t` and `bulk_read_t` before this include to prevent errors from ordering
 // of header includes
 #include "commands.h"
 
@@ -30,6 +88,13 @@ typedef struct {
 #define CMD_EPS       2
 #define CMD_PAY       3
 
+// arg1 is a flash address and arg2 is a number of bytes that must not go past
+// the last address
+#define CMD_ARGS_MEM_RANGE  0x01
+// arg2 may have CMD_READ_COMPRESSED set - it is cleared before the other checks,
+// and arg2_max is then checked by the command's function
+#define CMD_ARGS_COMPRESSIBLE   0x02
+
 // Block types
 #define CMD_OBC_HK          1
 #define CMD_EPS_HK          2
@@ -40,6 +105,14 @@ typedef struct {
 #define CMD_PRIM_CMD_LOG    7
 #define CMD_SEC_CMD_LOG     8
 
+// Allowed arg1 values for cmd_args_t.arg1_mask
+#define CMD_ARGS_DATA_COL_MASK \
+    ((1U << CMD_OBC_HK) | (1U << CMD_EPS_HK) | (1U << CMD_PAY_HK) | \
+    (1U << CMD_PAY_OPT))
+#define CMD_ARGS_MEM_SECTION_MASK \
+    (CMD_ARGS_DATA_COL_MASK | (1U << CMD_PRIM_CMD_LOG) | \
+    (1U << CMD_SEC_CMD_LOG))
+
 // Command opcodes
 #define CMD_PING_OBC                    0x00
 #define CMD_GET_RTC                     0x01
@@ -48,12 +121,22 @@ typedef struct {
 #define CMD_ERASE_OBC_EEPROM            0x04
 #define CMD_READ_OBC_RAM_BYTE           0x05
 #define CMD_SET_INDEF_BEACON_ENABLE     0x06
+#define CMD_READ_PROF_STATS             0x07
+#define CMD_READ_CMD_LATS               0x08
+#define CMD_SET_TRANS_LINK              0x09
+#define CMD_GET_ANT_DEP_STATUS          0x0A
 #define CMD_READ_DATA_BLOCK             0x10
 #define CMD_READ_PRIM_CMD_BLOCKS        0x11
 #define CMD_READ_SEC_CMD_BLOCKS         0x12
 #define CMD_READ_REC_STATUS_INFO        0x13
 #define CMD_READ_REC_LOC_DATA_BLOCK     0x14
 #define CMD_READ_RAW_MEM_BYTES          0x15
+#define CMD_READ_DATA_BLOCK_RANGE       0x16
+#define CMD_START_BULK_READ             0x17
+#define CMD_ACK_BULK_READ               0x18
+#define CMD_AGG_DATA_BLOCKS             0x19
+#define CMD_FIND_DATA_BLOCKS_BY_TIME    0x1A
+#define CMD_SYNC_DATA_BLOCKS            0x1B
 #define CMD_COL_DATA_BLOCK              0x20
 #define CMD_GET_AUTO_DATA_COL_SETTINGS  0x21
 #define CMD_SET_AUTO_DATA_COL_ENABLE    0x22
@@ -71,6 +154,9 @@ typedef struct {
 #define CMD_SEND_PAY_CAN_MSG            0x41
 #define CMD_RESET_SUBSYS                0x42
 
+// Size of the opcode lookup table (largest opcode + 1)
+#define CMD_OPCODE_TABLE_SIZE           (CMD_RESET_SUBSYS + 1)
+
 // Mask to set MSB on opcode byte for response packets
 #define CMD_RESP_CMD_ID_MASK            (0x1 << 15)
 
@@ -87,12 +173,22 @@ typedef struct {
 #define CMD_ACK_STATUS_INVALID_OPCODE       0x09
 #define CMD_ACK_STATUS_INVALID_PWD          0x0A
 #define CMD_ACK_STATUS_FULL_CMD_QUEUE       0x0B
+// Combined ACK for a batch frame, followed by a bitmap of the commands that
+// were accepted (bit i for command i)
+#define CMD_ACK_STATUS_BATCH                0x0C
 
 // Response/command log status bytes
 #define CMD_RESP_STATUS_OK                      0x00
 #define CMD_RESP_STATUS_INVALID_ARGS            0x01
 #define CMD_RESP_STATUS_TIMED_OUT               0x02
 #define CMD_RESP_STATUS_DATA_COL_IN_PROGRESS    0x03
+// Same value - the command has re-enqueued itself to continue later, so the
+// status should not be written to the command log yet
+#define CMD_RESP_STATUS_IN_PROGRESS             CMD_RESP_STATUS_DATA_COL_IN_PROGRESS
+// One sequence-numbered data frame of a bulk read (not a final status)
+#define CMD_RESP_STATUS_BULK_FRAME              0x04
+// Successful response with a compressed payload (see CMD_READ_COMPRESSED)
+#define CMD_RESP_STATUS_OK_COMPRESSED           0x05
 #define CMD_RESP_STATUS_UNKNOWN                 0xFF
 
 // For unsuccessful ACKs where opcode/args are unknown
@@ -101,16 +197,147 @@ typedef struct {
 // When a command is automatically enqueued by OBC
 #define CMD_CMD_ID_AUTO_ENQUEUED        0x0000
 
+// Uplink message with one command: command ID (2 bytes), opcode (1),
+// argument 1 (4), argument 2 (4), password (4)
+#define CMD_SINGLE_MSG_LEN              15
+// Batch uplink message with several commands (in one packet and checksum):
+// CMD_BATCH_CMD_ID (2 bytes), number of commands (1), password (4) used for
+// all of them, then for each command: command ID (2), opcode (1),
+// argument 1 (4), argument 2 (4)
+// The command IDs must be increasing, the same as separate messages
+#define CMD_BATCH_CMD_ID                0xFFFF
+#define CMD_BATCH_HEADER_LEN            7
+#define CMD_BATCH_CMD_LEN               11
+// Must fit in TRANS_RX_DEC_MSG_MAX_SIZE, and have one bit per command in the
+// ACK bitmap
+#define CMD_BATCH_MAX_CMDS              4
+
 #define CMD_TIMEOUT_DEF_PERIOD_S            20
-// Maximum number of seconds between fields of a collect data block command
-// before it times out
-#define CMD_COL_DATA_BLOCK_FIELD_TIMEOUT_S  20
+// Maximum number of seconds to wait for the response to a field request of a
+// collect data block command before requesting it again
+#define CMD_COL_DATA_BLOCK_FIELD_TIMEOUT_S  10
+// Number of times a field is requested again before the collection times out
+#define CMD_COL_DATA_BLOCK_FIELD_RETRIES    1
+// Maximum number of field requests waiting for a response at the same time for
+// each collection (1 for stop-and-wait)
+#define CMD_COL_DATA_BLOCK_WINDOW_SIZE      4
+// Value of `field_num` in data_col_req_t for a free slot
+#define CMD_COL_DATA_BLOCK_NO_REQ           0xFF
+// Fields of a data block are staged in RAM and written to flash in one burst
+// when the block finishes. If this many fields have been staged since the last
+// write, they are flushed early so a reset does not lose all of them
+// (0 to only write the block once it finishes)
+#define CMD_COL_DATA_BLOCK_FLUSH_FIELD_COUNT    16
+// Value of arg2 for the collect data block command that is enqueued once all
+// fields have been received (or a field timed out) to finish the collection
+#define CMD_COL_DATA_BLOCK_FINISH   0xFF
+
+// States of the collection for each data_col_t
+// No collection in progress
+#define DATA_COL_STATE_IDLE             0
+// Waiting for the field `staged_field_count` over CAN
+#define DATA_COL_STATE_COLLECTING       1
+// Done receiving, but the finish command could not be enqueued yet
+#define DATA_COL_STATE_FINISH_PENDING   2
+// Done receiving, the finish command is in the command queue
+#define DATA_COL_STATE_FINISHING        3
 
 
 // Max number of command log blocks
 #define CMD_READ_CMD_BLOCKS_MAX_COUNT   5
 // Max memory read
 #define CMD_READ_MEM_MAX_COUNT          106
+// Set in arg2 of the raw memory and command log reads to ask for a compressed
+// response. If compressing does not make it smaller, the response is sent as
+// usual with CMD_RESP_STATUS_OK, otherwise with CMD_RESP_STATUS_OK_COMPRESSED:
+// - Raw memory - number of bytes read (2 bytes), then the bytes run-length
+//   encoded (see CMD_RLE_*). The bytes that don't fit are not read, so ground
+//   can continue from the next address.
+// - Command log - number of blocks read (1 byte), then each block as a bitmap
+//   of its parts that are the same as in the previous block (see
+//   CMD_CMD_LOG_REF_*), followed by the other parts
+#define CMD_READ_COMPRESSED             (1UL << 31)
+// Max count for compressed reads
+#define CMD_READ_MEM_MAX_COMPRESSED_COUNT       4096
+#define CMD_READ_CMD_BLOCKS_MAX_COMPRESSED_COUNT    32
+// Bytes read from memory at a time for a compressed raw memory read
+#define CMD_READ_MEM_COMPRESSED_CHUNK   16
+// Run-length encoding of raw memory - each token byte is one of:
+// - 0x00 to 0x7F - (token + 1) bytes follow as they are
+// - 0x80 to 0xBF - ((token & 0x3F) + 1) bytes of 0x00
+// - 0xC0 to 0xFF - ((token & 0x3F) + 1) bytes of 0xFF (erased memory)
+#define CMD_RLE_LITERAL                 0x00
+#define CMD_RLE_ZERO_RUN                0x80
+#define CMD_RLE_ERASED_RUN              0xC0
+#define CMD_RLE_MAX_LITERAL             128
+#define CMD_RLE_MAX_RUN                 64
+// Shorter runs are sent in literals (a run in the middle of a literal costs
+// up to 2 token bytes)
+#define CMD_RLE_MIN_RUN                 3
+// Bit i of a compressed command log block is set if part i is the same as in
+// the previous block (for the block number, if it is the previous one + 1)
+// The previous block of the first one is all 0x00 with block number
+// (arg1 - 1)
+#define CMD_CMD_LOG_REF_BLOCK_NUM       0
+#define CMD_CMD_LOG_REF_DATE            1
+#define CMD_CMD_LOG_REF_TIME            2
+#define CMD_CMD_LOG_REF_STATUS          3
+#define CMD_CMD_LOG_REF_CMD_ID          4
+#define CMD_CMD_LOG_REF_OPCODE          5
+#define CMD_CMD_LOG_REF_ARG1            6
+#define CMD_CMD_LOG_REF_ARG2            7
+#define CMD_CMD_LOG_REF_PARTS           8
+// Data block range read - arg2 is {count (8 bits), start block (24 bits)}
+#define CMD_READ_DATA_BLOCK_RANGE_COUNT_SHIFT   24
+#define CMD_READ_DATA_BLOCK_RANGE_BLOCK_MASK    0xFFFFFFUL
+// Set in arg1 when the command re-enqueues itself for the next response (so
+// it is not logged again), must not be set from ground
+#define CMD_READ_DATA_BLOCK_RANGE_CONT          (1UL << 31)
+// Aggregate data blocks - arg1 is {first field (8 bits), field mask
+// (8 bits), count (16 bits)} and arg2 is {block type (8 bits), start block
+// (24 bits)}
+// Bit i of the field mask selects field (first field + i)
+// A count of 0 reads the running aggregate instead of a range
+#define CMD_AGG_DATA_BLOCKS_FIRST_FIELD_SHIFT   24
+#define CMD_AGG_DATA_BLOCKS_FIELD_MASK_SHIFT    16
+#define CMD_AGG_DATA_BLOCKS_COUNT_MASK          0xFFFFUL
+#define CMD_AGG_DATA_BLOCKS_TYPE_SHIFT          24
+#define CMD_AGG_DATA_BLOCKS_BLOCK_MASK          0xFFFFFFUL
+// Maximum number of fields in an aggregate (one bit each in the field mask)
+#define CMD_AGG_MAX_FIELDS              8
+// Maximum number of blocks in an aggregate, so the sum of 24-bit fields fits
+// in 32 bits
+#define CMD_AGG_MAX_BLOCKS              256
+// Field value that was not received (or was never written)
+#define CMD_AGG_MISSING_FIELD           0xFFFFFFUL
+// Find data blocks by time - arg1 is the start time (seconds since 2000, see
+// rtc_clock_to_s()) and arg2 is {block type (8 bits), duration in seconds
+// (24 bits, up to 194 days)}
+#define CMD_FIND_DATA_BLOCKS_BY_TIME_TYPE_SHIFT     24
+#define CMD_FIND_DATA_BLOCKS_BY_TIME_DUR_MASK       0xFFFFFFUL
+// Sync data blocks - arg1 is {block type (8 bits), start block (24 bits)} and
+// arg2 is {bitmap of the blocks ground has (16 bits), digest of their CRCs
+// (16 bits)} for the CMD_SYNC_DATA_BLOCKS_COUNT blocks from the start block
+// (see sync_data_blocks_fn())
+#define CMD_SYNC_DATA_BLOCKS_TYPE_SHIFT     24
+#define CMD_SYNC_DATA_BLOCKS_BLOCK_MASK     0xFFFFFFUL
+#define CMD_SYNC_DATA_BLOCKS_HAVE_SHIFT     16
+#define CMD_SYNC_DATA_BLOCKS_DIGEST_MASK    0xFFFFUL
+// Number of blocks in a sync (one bit each in the bitmap)
+#define CMD_SYNC_DATA_BLOCKS_COUNT          16
+// Set in arg1 when the command re-enqueues itself to send the rest of the
+// blocks (arg2 is then {bitmap of those blocks (16 bits), 0}), must not be set
+// from ground
+#define CMD_SYNC_DATA_BLOCKS_CONT           (1UL << 31)
+// Bulk read - data bytes in one frame (after cmd ID, status and 2 byte
+// sequence number)
+#define CMD_BULK_READ_FRAME_SIZE        (TRANS_TX_DEC_MSG_MAX_SIZE - 5)
+// Number of frames that can be sent before they are ACKed (one bit each in
+// the selective ACK bitmap)
+#define CMD_BULK_READ_WINDOW_SIZE       32
+// Set in arg1 when the bulk read command re-enqueues itself to send the next
+// frame (so it is not logged again), must not be set from ground
+#define CMD_BULK_READ_CONT              (1UL << 31)
 // Max number of fields for any data section (64)
 #define CMD_DATA_BLOCK_MAX_FIELD_COUNT  CAN_PAY_OPT_TOT_FIELD_COUNT
 // Minimum auto data collection period in seconds
@@ -142,6 +369,105 @@ typedef struct {
 #define PAY_OPT_AUTO_DATA_COL_PERIOD_EEPROM_ADDR    0x194
 
 
+// Maximum number of commands waiting in the command queue
+#define CMD_QUEUE_SIZE                  MAX_QUEUE_SIZE
+// Number of col_data_block_cmd block types (arg1) tracked in the command queue
+// (CMD_OBC_HK to CMD_PAY_OPT)
+#define CMD_QUEUE_NUM_BLOCK_TYPES       (CMD_PAY_OPT + 1)
+
+// Priority classes of commands in the command queue (lower value runs first)
+// Commands from ground (except long maintenance commands)
+#define CMD_PRIORITY_GROUND             0
+// Erasing memory, finishing data collection (writing memory and the command
+// log)
+#define CMD_PRIORITY_MAINTENANCE        1
+// Automatic data collection
+#define CMD_PRIORITY_BACKGROUND         2
+// Maximum number of times a command can be passed by higher priority commands
+// before they have to wait behind it (so background work is not starved)
+#define CMD_QUEUE_MAX_SKIPS             4
+// Number of slots in the command queue that background commands can't use
+// (so a command from ground is not rejected because of auto data collection)
+#define CMD_QUEUE_GROUND_RESERVED       1
+
+// Number of command log records that can be waiting to be written to flash
+#define CMD_LOG_BUF_SIZE                8
+// Number of waiting records that are written even if there are still commands
+// to execute (otherwise they are written when no command is running)
+#define CMD_LOG_BUF_FLUSH_THRESHOLD     6
+
+// Command latency histograms for all commands are saved in EEPROM (after a
+// 32-bit marker) when this many seconds have passed since the last save
+#define CMD_LAT_EEPROM_ADDR             0x200
+#define CMD_LAT_SAVE_PERIOD_S           3600
+// Marker in EEPROM before the histograms, includes the number of commands and
+// buckets so histograms from firmware with a different list are not loaded
+#define CMD_LAT_EEPROM_MARKER \
+    (0xC7A70000UL | ((uint32_t) all_cmds_list_len << 8) | CMD_LAT_NUM_BUCKETS)
+// Max number of commands in one read command latencies response
+#define CMD_READ_CMD_LATS_MAX_COUNT     9
+
+// One command waiting to be executed
+typedef struct {
+    // Sequenced command ID from ground (or 0 for auto-scheduled)
+    uint16_t cmd_id;
+    // Index of the command in all_cmds_list (store this instead of the
+    // function pointer because it's safer in case something goes wrong)
+    uint8_t cmd_index;
+    // Priority class (CMD_PRIORITY_*)
+    uint8_t priority;
+    // Number of higher priority commands enqueued ahead of this one
+    uint8_t skips;
+    uint32_t arg1;
+    uint32_t arg2;
+#ifdef CMD_LATS
+    // Value of prof_ticks() when the command was enqueued
+    uint32_t enqueue_ticks;
+#endif
+} cmd_queue_entry_t;
+
+// Ring buffer of commands that need to be executed but have not been executed
+// yet, ordered by priority class and then by the order they were enqueued
+typedef struct {
+    cmd_queue_entry_t entries[CMD_QUEUE_SIZE];
+    // Index of the next command to execute
+    uint8_t head;
+    // Number of commands in the queue
+    uint8_t count;
+    // Number of col_data_block_cmd commands in the queue for each block type,
+    // updated on enqueue and dequeue so the queue doesn't need to be searched
+    uint8_t col_data_block_counts[CMD_QUEUE_NUM_BLOCK_TYPES];
+} cmd_queue_t;
+
+// Command log records kept in RAM (with their status once the command
+// finishes) and written to flash together by flush_cmd_log()
+typedef struct {
+    // Section and block number of each record
+    mem_section_t* sections[CMD_LOG_BUF_SIZE];
+    uint32_t block_nums[CMD_LOG_BUF_SIZE];
+    // Each record as stored in flash (header then command), so consecutive
+    // records in the same section can be written in one burst
+    uint8_t bytes[CMD_LOG_BUF_SIZE][MEM_CMD_LOG_BYTES_PER_BLOCK];
+    uint8_t count;
+} cmd_log_buf_t;
+
+// Field of the most recent block of a type that is shown in the beacon
+typedef struct {
+    // CMD_OBC_HK, CMD_EPS_HK, etc.
+    uint8_t block_type;
+    uint8_t field;
+} beacon_field_t;
+
+// A field request sent over CAN for a data collection
+typedef struct {
+    // Field number requested (CMD_COL_DATA_BLOCK_NO_REQ if the slot is free)
+    uint8_t field_num;
+    // Number of times the field has been requested again
+    uint8_t retries;
+    // Value of `uptime_s` when the field was last requested
+    uint32_t req_uptime_s;
+} data_col_req_t;
+
 // Automatic data collection for one block type
 typedef struct {
     // String name for section (longest is PAY_OPT, 7 characters + terminating character)
@@ -158,10 +484,37 @@ typedef struct {
     uint32_t prev_auto_col_uptime_s;
     // Value of `uptime_s` when we last received a field of this type of data
     uint32_t prev_field_col_uptime_s;
+    // Scheduler timers for the next automatic collection and the earliest
+    // field request timeout (added by init_auto_data_col())
+    uint8_t auto_timer;
+    uint8_t req_timer;
+    // State of the current collection (DATA_COL_STATE_*)
+    // Changed by the CAN RX processing and the field timeout check in the main
+    // loop, the command queue only starts and finishes the collection
+    uint8_t state;
+    // Command ID of the collect data block command that started the current
+    // collection (to decide whether to send a response)
+    uint16_t cmd_id;
+    // Status to finish the current collection with
+    uint8_t finish_status;
+    // Field requests waiting for a response
+    data_col_req_t reqs[CMD_COL_DATA_BLOCK_WINDOW_SIZE];
+    // Next field number that has not been requested yet
+    uint8_t next_req_field_num;
     // Header for this section
     mem_header_t header;
-    // Array of field data
-    uint32_t* fields;
+    // Array of field data, packed (see get_packed_field())
+    uint8_t* fields;
+    // Bitmap of the fields in `fields` received for the current block
+    uint8_t* received_fields;
+    // Total number of fields received for the current block
+    uint8_t received_field_count;
+    // Number of fields in `fields` received in order for the current block
+    // (fields 0 to `staged_field_count - 1` have all been received)
+    uint8_t staged_field_count;
+    // Number of staged fields already written to flash (the header is written
+    // with the first flush, so 0 means nothing is in flash yet)
+    uint8_t flushed_field_count;
     // Corresponding section in memory to write data to
     mem_section_t* mem_section;
     // Keep track of the block number this command corresponds to in the
@@ -171,23 +524,72 @@ typedef struct {
     uint32_t cmd_log_block_num;
     // Value of arg1 for this memory section/block type
     uint32_t cmd_arg1;
+    // Value of prof_ticks() when the current collection started (for the run
+    // time in cmd_lats)
+    uint32_t start_ticks;
     // Queue to enqueue CAN TX messages to
     queue_t* can_tx_queue;
     // Opcode byte in CAN messages
     uint8_t can_opcode;
 } data_col_t;
 
+// Statistics of one field over several blocks (missing values are skipped)
+typedef struct {
+    // Number of blocks with a value for this field
+    uint16_t count;
+    uint32_t min;
+    uint32_t max;
+    uint32_t sum;
+    // Value from the most recent block
+    uint32_t last;
+} data_agg_field_t;
+
+// Statistics for up to CMD_AGG_MAX_FIELDS fields of one block type
+typedef struct {
+    // CMD_OBC_HK, CMD_EPS_HK, CMD_PAY_HK or CMD_PAY_OPT (0 if not used)
+    uint8_t block_type;
+    // Field number of bit 0 in `field_mask`
+    uint8_t first_field;
+    uint8_t field_mask;
+    // Number of blocks added
+    uint16_t block_count;
+    // Block number of the most recent block added
+    uint32_t last_block_num;
+    data_agg_field_t fields[CMD_AGG_MAX_FIELDS];
+} data_agg_t;
+
+// Run-length encoder for a compressed response (see CMD_RLE_*)
+// The encoded bytes are written directly to trans_tx_dec_msg (so the open
+// literal token can be updated), and added to the checksum when it is sent
+typedef struct {
+    // Number of bytes encoded in the response so far
+    uint16_t count;
+    // Index of the open literal token in trans_tx_dec_msg (0 if none)
+    uint8_t literal_index;
+    // Run of 0x00 or 0xFF bytes that has not been encoded yet
+    uint8_t run_byte;
+    uint8_t run_len;
+    // Set when a byte did not fit in the response
+    bool full;
+} rle_resp_t;
+
 
-extern queue_t cmd_queue_1;
-extern queue_t cmd_queue_2;
+extern cmd_queue_t cmd_queue;
+extern cmd_log_buf_t cmd_log_buf;
 
 extern volatile uint16_t current_cmd_id;
 extern volatile cmd_t* volatile current_cmd;
 extern volatile uint32_t current_cmd_arg1;
 extern volatile uint32_t current_cmd_arg2;
 
+extern volatile uint32_t current_cmd_start_ticks;
+#ifdef CMD_LATS
+extern uint32_t cmd_lat_prev_save_uptime_s;
+#endif
+
 extern volatile uint32_t cmd_timeout_count_s;
 extern uint32_t cmd_timeout_period_s;
+extern volatile bool cmd_timed_out;
 
 extern mem_header_t cmd_log_header;
 
@@ -196,14 +598,20 @@ extern data_col_t eps_hk_data_col;
 extern data_col_t pay_hk_data_col;
 extern data_col_t pay_opt_data_col;
 extern data_col_t* all_data_cols[];
+extern data_agg_t run_data_agg;
+extern const beacon_field_t beacon_fields[];
 
 extern rtc_date_t restart_date;
 extern rtc_time_t restart_time;
 
 extern bool print_cmds;
 extern bool print_trans_tx_acks;
+extern bool trans_tx_ack_coalesce;
 
 
+uint8_t accept_trans_rx_cmd(uint16_t cmd_id, uint8_t opcode, uint32_t arg1,
+    uint32_t arg2, uint8_t* received_pwd);
+void handle_trans_rx_batch_msg(void);
 void handle_trans_rx_dec_msg(void);
 void process_trans_tx_ack(void);
 
@@ -211,31 +619,83 @@ void start_trans_tx_resp(uint8_t status);
 void append_to_trans_tx_resp(uint8_t byte);
 void finish_trans_tx_resp(void);
 
+cmd_fn_t cmd_fn(cmd_t* cmd);
+uint8_t cmd_opcode(cmd_t* cmd);
+bool cmd_pwd_protected(cmd_t* cmd);
+bool cmd_args_valid(cmd_t* cmd, uint32_t arg1, uint32_t arg2);
+
 cmd_t* cmd_opcode_to_cmd(uint8_t opcode);
 mem_section_t* mem_section_for_cmd(cmd_t* cmd);
 
-void cmd_to_bytes(uint16_t cmd_id, cmd_t* cmd, uint32_t arg1, uint32_t arg2,
-        uint8_t* bytes1, uint8_t* bytes2);
+cmd_t* cmd_index_to_cmd(uint8_t cmd_index);
+uint8_t cmd_to_cmd_index(cmd_t* cmd);
+uint8_t cmd_priority(uint16_t cmd_id, cmd_t* cmd, uint32_t arg2);
+
+void init_cmd_queue(void);
+bool cmd_queue_full(void);
+bool cmd_queue_empty(void);
+uint8_t cmd_queue_size(void);
+void update_cmd_queue_counts(cmd_queue_entry_t* entry, int8_t delta);
 bool enqueue_cmd(uint16_t cmd_id, cmd_t* cmd, uint32_t arg1, uint32_t arg2);
 bool enqueue_cmd_front(uint16_t cmd_id, cmd_t* cmd, uint32_t arg1, uint32_t arg2);
-void bytes_to_cmd(uint16_t* cmd_id, cmd_t** cmd, uint32_t* arg1, uint32_t* arg2,
-        uint8_t* bytes1, uint8_t* bytes2);
+bool peek_cmd(uint16_t* cmd_id, cmd_t** cmd, uint32_t* arg1, uint32_t* arg2);
 bool dequeue_cmd(uint16_t* cmd_id, cmd_t** cmd, uint32_t* arg1, uint32_t* arg2);
 bool cmd_queue_contains_col_data_block(uint8_t block_type);
 
 void execute_next_cmd(void);
 void finish_current_cmd(uint8_t status);
 
+#ifdef CMD_LATS
+uint8_t cmd_lat_bucket(uint32_t ticks);
+void add_cmd_lat(uint8_t* hist, uint32_t start_ticks);
+void init_cmd_lats(void);
+void save_cmd_lats(void);
+void run_cmd_lats(void);
+#else
+#define init_cmd_lats() do {} while (0)
+#define save_cmd_lats() do {} while (0)
+#define run_cmd_lats()  do {} while (0)
+#endif
+
+void append_cmd_log(mem_section_t* section, mem_header_t* header,
+    uint16_t cmd_id, uint8_t opcode, uint32_t arg1, uint32_t arg2);
+void set_cmd_log_status(mem_section_t* section, uint32_t block_num,
+    uint8_t status);
+void flush_cmd_log(void);
+void run_cmd_log(void);
+
+void erase_ahead_mem_section_block(mem_section_t* section, uint32_t next_block);
 void prepare_mem_section_curr_block(mem_section_t* section, uint32_t next_block);
+uint32_t next_mem_section_block(mem_section_t* section);
 void inc_and_prepare_mem_section_curr_block(mem_section_t* section);
+uint32_t data_block_write_order_count(mem_section_t* section);
+uint32_t data_block_write_order(mem_section_t* section, uint32_t pos);
+uint32_t find_data_block_by_time(mem_section_t* section, uint32_t time_s,
+    bool inclusive);
 void populate_header(mem_header_t* header, uint32_t block_num, uint8_t status);
+void flush_data_col_block(data_col_t* data_col);
+void commit_data_col_block(data_col_t* data_col, uint8_t status);
+void update_beacon_fields(data_col_t* data_col);
 
 void add_def_trans_tx_dec_msg(uint8_t status);
 void append_header_to_tx_msg(mem_header_t* header);
-void append_fields_to_tx_msg(uint32_t* fields, uint8_t num_fields);
+void append_fields_to_tx_msg(uint8_t* fields, uint8_t num_fields);
+
+void start_rle_resp(rle_resp_t* rle);
+bool append_rle_resp(rle_resp_t* rle, uint8_t byte);
+void finish_rle_resp(rle_resp_t* rle);
+bool append_cmd_log_ref_to_tx_msg(uint8_t* prev, uint8_t* block);
+
+void init_data_agg(data_agg_t* agg, uint8_t block_type, uint8_t first_field,
+    uint8_t field_mask);
+void add_to_data_agg(data_agg_t* agg, uint32_t block_num, uint32_t* fields);
+void add_data_col_to_run_agg(data_col_t* data_col);
+void append_data_agg_to_tx_msg(data_agg_t* agg);
 
 void init_auto_data_col(void);
-void run_auto_data_col(void);
+void update_auto_data_col_timer(data_col_t* data_col);
+void auto_data_col_timer_cb(uint8_t index);
 void cmd_timeout_timer_cb(void);
+void run_cmd_timeout(void);
 
 #endif
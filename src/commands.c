@@ -14,6 +14,10 @@ void read_obc_eeprom_fn(void);
 void erase_obc_eeprom_fn(void);
 void read_obc_ram_byte_fn(void);
 void set_indef_beacon_enable_fn(void);
+void read_prof_stats_fn(void);
+void read_cmd_lats_fn(void);
+void set_trans_link_fn(void);
+void get_ant_dep_status_fn(void);
 void send_eps_can_msg_fn(void);
 void send_pay_can_msg_fn(void);
 void reset_subsys_fn(void);
@@ -24,11 +28,19 @@ void read_rec_loc_data_block_fn(void);
 void read_prim_cmd_blocks_fn(void);
 void read_sec_cmd_blocks_fn(void);
 void read_raw_mem_bytes_fn(void);
+void read_data_block_range_fn(void);
+void start_bulk_read_fn(void);
+void ack_bulk_read_fn(void);
+void agg_data_blocks_fn(void);
+void find_data_blocks_by_time_fn(void);
+void sync_data_blocks_fn(void);
 void erase_mem_phy_sector_fn(void);
 void erase_mem_phy_block_fn(void);
 void erase_all_mem_fn(void);
 
 void col_data_block_fn(void);
+void fill_data_col_window(data_col_t* data_col);
+void arm_data_col_req_timer(data_col_t* data_col);
 void get_cur_block_nums_fn(void);
 void set_cur_block_num_fn(void);
 void get_mem_sec_addrs_fn(void);
@@ -46,157 +58,266 @@ void resync_auto_data_col_timers_fn(void);
 
 // Default no-op command
 // Don't care about `num`
-cmd_t nop_cmd = {
+cmd_t nop_cmd PROGMEM = {
     .fn = nop_fn,
     .opcode = 0xFF,
     .pwd_protected = false
 };
 
 
-cmd_t ping_obc_cmd = {
+cmd_t ping_obc_cmd PROGMEM = {
     .fn = ping_obc_fn,
     .opcode = CMD_PING_OBC,
     .pwd_protected = false
 };
-cmd_t get_rtc_cmd = {
+cmd_t get_rtc_cmd PROGMEM = {
     .fn = get_rtc_fn,
     .opcode = CMD_GET_RTC,
     .pwd_protected = false
 };
-cmd_t set_rtc_cmd = {
+cmd_t set_rtc_cmd PROGMEM = {
     .fn = set_rtc_fn,
     .opcode = CMD_SET_RTC,
     .pwd_protected = true
 };
-cmd_t read_obc_eeprom_cmd = {
+cmd_t read_obc_eeprom_cmd PROGMEM = {
     .fn = read_obc_eeprom_fn,
     .opcode = CMD_READ_OBC_EEPROM,
     .pwd_protected = true
 };
-cmd_t erase_obc_eeprom_cmd = {
+cmd_t erase_obc_eeprom_cmd PROGMEM = {
     .fn = erase_obc_eeprom_fn,
     .opcode = CMD_ERASE_OBC_EEPROM,
     .pwd_protected = true
 };
-cmd_t read_obc_ram_byte_cmd = {
+cmd_t read_obc_ram_byte_cmd PROGMEM = {
     .fn = read_obc_ram_byte_fn,
     .opcode = CMD_READ_OBC_RAM_BYTE,
     .pwd_protected = true
 };
-cmd_t set_indef_beacon_enable_cmd = {
+cmd_t set_indef_beacon_enable_cmd PROGMEM = {
     .fn = set_indef_beacon_enable_fn,
     .opcode = CMD_SET_INDEF_BEACON_ENABLE,
+    .pwd_protected = true,
+    .args = {
+        .arg1_mask = (1U << 1) | (1U << 2)
+    }
+};
+cmd_t read_prof_stats_cmd PROGMEM = {
+    .fn = read_prof_stats_fn,
+    .opcode = CMD_READ_PROF_STATS,
+    .pwd_protected = true
+};
+cmd_t read_cmd_lats_cmd PROGMEM = {
+    .fn = read_cmd_lats_fn,
+    .opcode = CMD_READ_CMD_LATS,
     .pwd_protected = true
 };
-cmd_t send_eps_can_msg_cmd = {
+// arg1 is checked in set_trans_link_fn()
+cmd_t set_trans_link_cmd PROGMEM = {
+    .fn = set_trans_link_fn,
+    .opcode = CMD_SET_TRANS_LINK,
+    .pwd_protected = true,
+    .args = {
+        .arg2_max = 1
+    }
+};
+cmd_t get_ant_dep_status_cmd PROGMEM = {
+    .fn = get_ant_dep_status_fn,
+    .opcode = CMD_GET_ANT_DEP_STATUS,
+    .pwd_protected = false
+};
+cmd_t send_eps_can_msg_cmd PROGMEM = {
     .fn = send_eps_can_msg_fn,
     .opcode = CMD_SEND_EPS_CAN_MSG,
     .pwd_protected = true
 };
-cmd_t send_pay_can_msg_cmd = {
+cmd_t send_pay_can_msg_cmd PROGMEM = {
     .fn = send_pay_can_msg_fn,
     .opcode = CMD_SEND_PAY_CAN_MSG,
     .pwd_protected = true
 };
-cmd_t reset_subsys_cmd = {
+cmd_t reset_subsys_cmd PROGMEM = {
     .fn = reset_subsys_fn,
     .opcode = CMD_RESET_SUBSYS,
-    .pwd_protected = true
+    .pwd_protected = true,
+    .args = {
+        .arg1_mask = (1U << CMD_OBC) | (1U << CMD_EPS) | (1U << CMD_PAY)
+    }
 };
 
-cmd_t read_rec_status_info_cmd = {
+cmd_t read_rec_status_info_cmd PROGMEM = {
     .fn = read_rec_status_info_fn,
     .opcode = CMD_READ_REC_STATUS_INFO,
     .pwd_protected = false
 };
-cmd_t read_data_block_cmd = {
+cmd_t read_data_block_cmd PROGMEM = {
     .fn = read_data_block_fn,
     .opcode = CMD_READ_DATA_BLOCK,
     .pwd_protected = false
 };
-cmd_t read_rec_loc_data_block_cmd = {
+cmd_t read_rec_loc_data_block_cmd PROGMEM = {
     .fn = read_rec_loc_data_block_fn,
     .opcode = CMD_READ_REC_LOC_DATA_BLOCK,
     .pwd_protected = false
 };
-cmd_t read_prim_cmd_blocks_cmd = {
+cmd_t read_prim_cmd_blocks_cmd PROGMEM = {
     .fn = read_prim_cmd_blocks_fn,
     .opcode = CMD_READ_PRIM_CMD_BLOCKS,
-    .pwd_protected = false
+    .pwd_protected = false,
+    .args = {
+        .arg2_max = CMD_READ_CMD_BLOCKS_MAX_COUNT,
+        .flags = CMD_ARGS_COMPRESSIBLE
+    }
 };
-cmd_t read_sec_cmd_blocks_cmd = {
+cmd_t read_sec_cmd_blocks_cmd PROGMEM = {
     .fn = read_sec_cmd_blocks_fn,
     .opcode = CMD_READ_SEC_CMD_BLOCKS,
-    .pwd_protected = false
+    .pwd_protected = false,
+    .args = {
+        .arg2_max = CMD_READ_CMD_BLOCKS_MAX_COUNT,
+        .flags = CMD_ARGS_COMPRESSIBLE
+    }
 };
-cmd_t read_raw_mem_bytes_cmd = {
+cmd_t read_raw_mem_bytes_cmd PROGMEM = {
     .fn = read_raw_mem_bytes_fn,
     .opcode = CMD_READ_RAW_MEM_BYTES,
+    .pwd_protected = true,
+    .args = {
+        .arg1_max = MEM_NUM_ADDRESSES - 1,
+        .arg2_max = CMD_READ_MEM_MAX_COUNT,
+        .flags = CMD_ARGS_MEM_RANGE | CMD_ARGS_COMPRESSIBLE
+    }
+};
+cmd_t read_data_block_range_cmd PROGMEM = {
+    .fn = read_data_block_range_fn,
+    .opcode = CMD_READ_DATA_BLOCK_RANGE,
+    .pwd_protected = false
+};
+// The range is checked in start_bulk_read_fn() (continuations set
+// CMD_BULK_READ_CONT in arg1)
+cmd_t start_bulk_read_cmd PROGMEM = {
+    .fn = start_bulk_read_fn,
+    .opcode = CMD_START_BULK_READ,
     .pwd_protected = true
 };
-cmd_t erase_mem_phy_sector_cmd = {
+cmd_t ack_bulk_read_cmd PROGMEM = {
+    .fn = ack_bulk_read_fn,
+    .opcode = CMD_ACK_BULK_READ,
+    .pwd_protected = true,
+    .args = {
+        .arg1_max = 0xFFFF
+    }
+};
+// The block type, fields and range are checked in agg_data_blocks_fn()
+cmd_t agg_data_blocks_cmd PROGMEM = {
+    .fn = agg_data_blocks_fn,
+    .opcode = CMD_AGG_DATA_BLOCKS,
+    .pwd_protected = false
+};
+// The block type is checked in find_data_blocks_by_time_fn()
+cmd_t find_data_blocks_by_time_cmd PROGMEM = {
+    .fn = find_data_blocks_by_time_fn,
+    .opcode = CMD_FIND_DATA_BLOCKS_BY_TIME,
+    .pwd_protected = false
+};
+// The block type and start block are checked in sync_data_blocks_fn()
+cmd_t sync_data_blocks_cmd PROGMEM = {
+    .fn = sync_data_blocks_fn,
+    .opcode = CMD_SYNC_DATA_BLOCKS,
+    .pwd_protected = false
+};
+cmd_t erase_mem_phy_sector_cmd PROGMEM = {
     .fn = erase_mem_phy_sector_fn,
     .opcode = CMD_ERASE_MEM_PHY_SECTOR,
-    .pwd_protected = true
+    .pwd_protected = true,
+    .args = {
+        .arg1_max = MEM_NUM_ADDRESSES - 1
+    }
 };
-cmd_t erase_mem_phy_block_cmd = {
+cmd_t erase_mem_phy_block_cmd PROGMEM = {
     .fn = erase_mem_phy_block_fn,
     .opcode = CMD_ERASE_MEM_PHY_BLOCK,
-    .pwd_protected = true
+    .pwd_protected = true,
+    .args = {
+        .arg1_max = MEM_NUM_ADDRESSES - 1
+    }
 };
-cmd_t erase_all_mem_cmd = {
+cmd_t erase_all_mem_cmd PROGMEM = {
     .fn = erase_all_mem_fn,
     .opcode = CMD_ERASE_ALL_MEM,
     .pwd_protected = true
 };
 
 
-cmd_t col_data_block_cmd = {
+cmd_t col_data_block_cmd PROGMEM = {
     .fn = col_data_block_fn,
     .opcode = CMD_COL_DATA_BLOCK,
-    .pwd_protected = false
+    .pwd_protected = false,
+    .args = {
+        .arg1_mask = CMD_ARGS_DATA_COL_MASK
+    }
 };
-cmd_t get_cur_block_nums_cmd = {
+cmd_t get_cur_block_nums_cmd PROGMEM = {
     .fn = get_cur_block_nums_fn,
     .opcode = CMD_GET_CUR_BLOCK_NUMS,
     .pwd_protected = false
 };
-cmd_t set_cur_block_num_cmd = {
+cmd_t set_cur_block_num_cmd PROGMEM = {
     .fn = set_cur_block_num_fn,
     .opcode = CMD_SET_CUR_BLOCK_NUM,
-    .pwd_protected = true
+    .pwd_protected = true,
+    .args = {
+        .arg1_mask = CMD_ARGS_MEM_SECTION_MASK
+    }
 };
-cmd_t get_mem_sec_addrs_cmd = {
+cmd_t get_mem_sec_addrs_cmd PROGMEM = {
     .fn = get_mem_sec_addrs_fn,
     .opcode = CMD_GET_MEM_SEC_ADDRS,
     .pwd_protected = true
 };
-cmd_t set_mem_sec_start_addr_cmd = {
+cmd_t set_mem_sec_start_addr_cmd PROGMEM = {
     .fn = set_mem_sec_start_addr_fn,
     .opcode = CMD_SET_MEM_SEC_START_ADDR,
-    .pwd_protected = true
+    .pwd_protected = true,
+    .args = {
+        .arg1_mask = CMD_ARGS_MEM_SECTION_MASK,
+        .arg2_max = MEM_NUM_ADDRESSES - 1
+    }
 };
-cmd_t set_mem_sec_end_addr_cmd = {
+cmd_t set_mem_sec_end_addr_cmd PROGMEM = {
     .fn = set_mem_sec_end_addr_fn,
     .opcode = CMD_SET_MEM_SEC_END_ADDR,
-    .pwd_protected = true
+    .pwd_protected = true,
+    .args = {
+        .arg1_mask = CMD_ARGS_MEM_SECTION_MASK,
+        .arg2_max = MEM_NUM_ADDRESSES - 1
+    }
 };
-cmd_t get_auto_data_col_settings_cmd = {
+cmd_t get_auto_data_col_settings_cmd PROGMEM = {
     .fn = get_auto_data_col_settings_fn,
     .opcode = CMD_GET_AUTO_DATA_COL_SETTINGS,
     .pwd_protected = false
 };
-cmd_t set_auto_data_col_enable_cmd = {
+cmd_t set_auto_data_col_enable_cmd PROGMEM = {
     .fn = set_auto_data_col_enable_fn,
     .opcode = CMD_SET_AUTO_DATA_COL_ENABLE,
-    .pwd_protected = true
+    .pwd_protected = true,
+    .args = {
+        .arg1_mask = CMD_ARGS_DATA_COL_MASK,
+        .arg2_max = 1
+    }
 };
-cmd_t set_auto_data_col_period_cmd = {
+cmd_t set_auto_data_col_period_cmd PROGMEM = {
     .fn = set_auto_data_col_period_fn,
     .opcode = CMD_SET_AUTO_DATA_COL_PERIOD,
-    .pwd_protected = true
+    .pwd_protected = true,
+    .args = {
+        .arg1_mask = CMD_ARGS_DATA_COL_MASK,
+        .arg2_min = CMD_AUTO_DATA_COL_MIN_PERIOD
+    }
 };
-cmd_t resync_auto_data_col_timers_cmd = {
+cmd_t resync_auto_data_col_timers_cmd PROGMEM = {
     .fn = resync_auto_data_col_timers_fn,
     .opcode = CMD_RESYNC_AUTO_DATA_COL_TIMERS,
     .pwd_protected = true
@@ -205,42 +326,82 @@ cmd_t resync_auto_data_col_timers_cmd = {
 
 
 
-// List of all command structs
+// List of all commands and their opcodes
 // Should not include nop_cmd
-cmd_t* all_cmds_list[] = {
-    &ping_obc_cmd,
-    &get_rtc_cmd,
-    &set_rtc_cmd,
-    &read_obc_eeprom_cmd,
-    &erase_obc_eeprom_cmd,
-    &read_obc_ram_byte_cmd,
-    &set_indef_beacon_enable_cmd,
-    &send_eps_can_msg_cmd,
-    &send_pay_can_msg_cmd,
-    &reset_subsys_cmd,
-    &read_rec_status_info_cmd,
-    &read_data_block_cmd,
-    &read_rec_loc_data_block_cmd,
-    &read_prim_cmd_blocks_cmd,
-    &read_sec_cmd_blocks_cmd,
-    &read_raw_mem_bytes_cmd,
-    &erase_mem_phy_sector_cmd,
-    &erase_mem_phy_block_cmd,
-    &erase_all_mem_cmd,
-    &col_data_block_cmd,
-    &get_cur_block_nums_cmd,
-    &set_cur_block_num_cmd,
-    &get_mem_sec_addrs_cmd,
-    &set_mem_sec_start_addr_cmd,
-    &set_mem_sec_end_addr_cmd,
-    &get_auto_data_col_settings_cmd,
-    &set_auto_data_col_enable_cmd,
-    &set_auto_data_col_period_cmd,
-    &resync_auto_data_col_timers_cmd,
+#define ALL_CMDS(X) \
+    X(ping_obc_cmd, CMD_PING_OBC)                                        \
+    X(get_rtc_cmd, CMD_GET_RTC)                                          \
+    X(set_rtc_cmd, CMD_SET_RTC)                                          \
+    X(read_obc_eeprom_cmd, CMD_READ_OBC_EEPROM)                          \
+    X(erase_obc_eeprom_cmd, CMD_ERASE_OBC_EEPROM)                        \
+    X(read_obc_ram_byte_cmd, CMD_READ_OBC_RAM_BYTE)                      \
+    X(set_indef_beacon_enable_cmd, CMD_SET_INDEF_BEACON_ENABLE)          \
+    X(read_prof_stats_cmd, CMD_READ_PROF_STATS)                          \
+    X(read_cmd_lats_cmd, CMD_READ_CMD_LATS)                              \
+    X(set_trans_link_cmd, CMD_SET_TRANS_LINK)                            \
+    X(get_ant_dep_status_cmd, CMD_GET_ANT_DEP_STATUS)                    \
+    X(send_eps_can_msg_cmd, CMD_SEND_EPS_CAN_MSG)                        \
+    X(send_pay_can_msg_cmd, CMD_SEND_PAY_CAN_MSG)                        \
+    X(reset_subsys_cmd, CMD_RESET_SUBSYS)                                \
+    X(read_rec_status_info_cmd, CMD_READ_REC_STATUS_INFO)                \
+    X(read_data_block_cmd, CMD_READ_DATA_BLOCK)                          \
+    X(read_rec_loc_data_block_cmd, CMD_READ_REC_LOC_DATA_BLOCK)          \
+    X(read_prim_cmd_blocks_cmd, CMD_READ_PRIM_CMD_BLOCKS)                \
+    X(read_sec_cmd_blocks_cmd, CMD_READ_SEC_CMD_BLOCKS)                  \
+    X(read_raw_mem_bytes_cmd, CMD_READ_RAW_MEM_BYTES)                    \
+    X(read_data_block_range_cmd, CMD_READ_DATA_BLOCK_RANGE)              \
+    X(start_bulk_read_cmd, CMD_START_BULK_READ)                          \
+    X(ack_bulk_read_cmd, CMD_ACK_BULK_READ)                              \
+    X(agg_data_blocks_cmd, CMD_AGG_DATA_BLOCKS)                          \
+    X(find_data_blocks_by_time_cmd, CMD_FIND_DATA_BLOCKS_BY_TIME)        \
+    X(sync_data_blocks_cmd, CMD_SYNC_DATA_BLOCKS)                        \
+    X(erase_mem_phy_sector_cmd, CMD_ERASE_MEM_PHY_SECTOR)                \
+    X(erase_mem_phy_block_cmd, CMD_ERASE_MEM_PHY_BLOCK)                  \
+    X(erase_all_mem_cmd, CMD_ERASE_ALL_MEM)                              \
+    X(col_data_block_cmd, CMD_COL_DATA_BLOCK)                            \
+    X(get_cur_block_nums_cmd, CMD_GET_CUR_BLOCK_NUMS)                    \
+    X(set_cur_block_num_cmd, CMD_SET_CUR_BLOCK_NUM)                      \
+    X(get_mem_sec_addrs_cmd, CMD_GET_MEM_SEC_ADDRS)                      \
+    X(set_mem_sec_start_addr_cmd, CMD_SET_MEM_SEC_START_ADDR)            \
+    X(set_mem_sec_end_addr_cmd, CMD_SET_MEM_SEC_END_ADDR)                \
+    X(get_auto_data_col_settings_cmd, CMD_GET_AUTO_DATA_COL_SETTINGS)    \
+    X(set_auto_data_col_enable_cmd, CMD_SET_AUTO_DATA_COL_ENABLE)        \
+    X(set_auto_data_col_period_cmd, CMD_SET_AUTO_DATA_COL_PERIOD)        \
+    X(resync_auto_data_col_timers_cmd, CMD_RESYNC_AUTO_DATA_COL_TIMERS)
+
+// Index of each command in all_cmds_list
+enum {
+#define X(cmd, opcode) cmd##_index,
+    ALL_CMDS(X)
+#undef X
+    ALL_CMDS_LIST_LEN
+};
+
+// List of all command structs (in flash)
+cmd_t* const all_cmds_list[] PROGMEM = {
+#define X(cmd, opcode) &cmd,
+    ALL_CMDS(X)
+#undef X
 };
 
 // Length of `all_cmds_list` array
-const uint8_t all_cmds_list_len = sizeof(all_cmds_list) / sizeof(all_cmds_list[0]);
+const uint8_t all_cmds_list_len = ALL_CMDS_LIST_LEN;
+
+// Index in all_cmds_list plus 1 for each opcode, or 0 if there is no command
+// with that opcode
+const uint8_t cmd_opcode_table[CMD_OPCODE_TABLE_SIZE] PROGMEM = {
+#define X(cmd, opcode) [opcode] = cmd##_index + 1,
+    ALL_CMDS(X)
+#undef X
+};
+
+#ifdef CMD_LATS
+// Latency histograms for each command in all_cmds_list
+cmd_lat_t cmd_lats[ALL_CMDS_LIST_LEN];
+#endif
+
+// Current bulk read session (only one at a time)
+bulk_read_t bulk_read = { .active = false };
 
 
 
@@ -258,10 +419,11 @@ void ping_obc_fn(void) {
 }
 
 void get_rtc_fn(void) {
-    rtc_date_t date = read_rtc_date();
-    rtc_time_t time = read_rtc_time();
+    rtc_date_t date;
+    rtc_time_t time;
+    get_rtc_clock(&date, &time);
 
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         start_trans_tx_resp(CMD_RESP_STATUS_OK);
         append_to_trans_tx_resp(date.yy);
         append_to_trans_tx_resp(date.mm);
@@ -288,6 +450,8 @@ void set_rtc_fn(void) {
 
     set_rtc_date(date);
     set_rtc_time(time);
+    // Read it back so the software clock has exactly what the RTC has
+    sync_rtc_clock();
 
     add_def_trans_tx_dec_msg(CMD_RESP_STATUS_OK);
     finish_current_cmd(CMD_RESP_STATUS_OK);
@@ -296,7 +460,7 @@ void set_rtc_fn(void) {
 void read_obc_eeprom_fn(void) {
     uint32_t data = read_eeprom((uint16_t) current_cmd_arg1);
 
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         start_trans_tx_resp(CMD_RESP_STATUS_OK);
         append_to_trans_tx_resp((data >> 24) & 0xFF);
         append_to_trans_tx_resp((data >> 16) & 0xFF);
@@ -325,7 +489,7 @@ void read_obc_ram_byte_fn(void) {
     volatile uint8_t* pointer = (volatile uint8_t*) ((uint16_t) current_cmd_arg1);
     uint8_t data = *pointer;
 
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         start_trans_tx_resp(CMD_RESP_STATUS_OK);
         append_to_trans_tx_resp(data);
         finish_trans_tx_resp();
@@ -333,18 +497,167 @@ void read_obc_ram_byte_fn(void) {
     finish_current_cmd(CMD_RESP_STATUS_OK);
 }
 
+// arg1 is checked by set_indef_beacon_enable_cmd.args
 void set_indef_beacon_enable_fn(void) {
     if (current_cmd_arg1 == 1) {
         write_eeprom(BEACON_ENABLE_1_EEPROM_ADDR, current_cmd_arg2);
-    } else if (current_cmd_arg1 == 2) {
-        write_eeprom(BEACON_ENABLE_2_EEPROM_ADDR, current_cmd_arg2);
     } else {
+        write_eeprom(BEACON_ENABLE_2_EEPROM_ADDR, current_cmd_arg2);
+    }
+    
+    add_def_trans_tx_dec_msg(CMD_RESP_STATUS_OK);
+    finish_current_cmd(CMD_RESP_STATUS_OK);
+}
+
+/*
+Sends the main loop profiler table (see profiler.c) and resets it.
+Response (times in uptime timer ticks, all fields big-endian):
+    - ticks per second (2 bytes)
+    - longest PROF_ATOMIC_BLOCK (2 bytes)
+    - number of stages (1 byte, 0 if the profiler is not compiled in)
+    - for each stage (PROF_STAGE_*): count, total, max (4 bytes each)
+*/
+void read_prof_stats_fn(void) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        start_trans_tx_resp(CMD_RESP_STATUS_OK);
+
+#ifdef PROFILER
+        uint16_t ticks_per_s = prof_ticks_per_s();
+        append_to_trans_tx_resp((ticks_per_s >> 8) & 0xFF);
+        append_to_trans_tx_resp(ticks_per_s & 0xFF);
+        append_to_trans_tx_resp((prof_atomic_max_ticks >> 8) & 0xFF);
+        append_to_trans_tx_resp(prof_atomic_max_ticks & 0xFF);
+        append_to_trans_tx_resp(PROF_NUM_STAGES);
+
+        for (uint8_t i = 0; i < PROF_NUM_STAGES; i++) {
+            uint32_t fields[3] = {
+                prof_stages[i].count,
+                prof_stages[i].total_ticks,
+                prof_stages[i].max_ticks
+            };
+            for (uint8_t j = 0; j < 3; j++) {
+                append_to_trans_tx_resp((fields[j] >> 24) & 0xFF);
+                append_to_trans_tx_resp((fields[j] >> 16) & 0xFF);
+                append_to_trans_tx_resp((fields[j] >> 8) & 0xFF);
+                append_to_trans_tx_resp(fields[j] & 0xFF);
+            }
+        }
+
+        reset_prof();
+#else
+        for (uint8_t i = 0; i < 5; i++) {
+            append_to_trans_tx_resp(0x00);
+        }
+#endif
+
+        finish_trans_tx_resp();
+    }
+    finish_current_cmd(CMD_RESP_STATUS_OK);
+}
+
+/*
+Sends the latency histograms (see cmd_lat_t) for up to
+    CMD_READ_CMD_LATS_MAX_COUNT commands, starting at index arg1 in
+    all_cmds_list.
+Response:
+    - number of commands in all_cmds_list (1 byte)
+    - number of commands in this response (1 byte, 0 if the histograms are
+      not compiled in)
+    - for each command: opcode (1 byte), queue buckets, run buckets (1 byte
+      each)
+*/
+void read_cmd_lats_fn(void) {
+    uint8_t count = 0;
+#ifdef CMD_LATS
+    if (current_cmd_arg1 < all_cmds_list_len) {
+        count = all_cmds_list_len - current_cmd_arg1;
+    }
+    if (count > CMD_READ_CMD_LATS_MAX_COUNT) {
+        count = CMD_READ_CMD_LATS_MAX_COUNT;
+    }
+#endif
+
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        start_trans_tx_resp(CMD_RESP_STATUS_OK);
+        append_to_trans_tx_resp(all_cmds_list_len);
+        append_to_trans_tx_resp(count);
+
+#ifdef CMD_LATS
+        for (uint8_t i = 0; i < count; i++) {
+            uint8_t cmd_index = current_cmd_arg1 + i;
+            append_to_trans_tx_resp(cmd_opcode(cmd_index_to_cmd(cmd_index)));
+            for (uint8_t j = 0; j < CMD_LAT_NUM_BUCKETS; j++) {
+                append_to_trans_tx_resp(cmd_lats[cmd_index].queue[j]);
+            }
+            for (uint8_t j = 0; j < CMD_LAT_NUM_BUCKETS; j++) {
+                append_to_trans_tx_resp(cmd_lats[cmd_index].run[j]);
+            }
+        }
+#endif
+
+        finish_trans_tx_resp();
+    }
+    finish_current_cmd(CMD_RESP_STATUS_OK);
+}
+
+/*
+Sets the transceiver RF mode and automatic switching (see run_trans_link()).
+arg1 - RF mode (0 to 7), or TRANS_RF_MODE_NONE to keep the current mode
+arg2 - 1 to switch the RF mode automatically, 0 to only use the set mode
+The mode is changed after this response has been sent. Response:
+    - current RF mode (1 byte)
+    - requested RF mode (1 byte, TRANS_RF_MODE_NONE if none)
+    - automatic switching (1 byte)
+    - last RSSI (1 byte)
+    - UART baud rate (1 byte, uart_baud_rate_t)
+*/
+void set_trans_link_fn(void) {
+    if (current_cmd_arg1 > TRANS_RF_MODE_MAX &&
+            current_cmd_arg1 != TRANS_RF_MODE_NONE) {
         add_def_trans_tx_dec_msg(CMD_RESP_STATUS_INVALID_ARGS);
         finish_current_cmd(CMD_RESP_STATUS_INVALID_ARGS);
         return;
     }
-    
-    add_def_trans_tx_dec_msg(CMD_RESP_STATUS_OK);
+
+    trans_rf_auto = current_cmd_arg2;
+    if (current_cmd_arg1 != TRANS_RF_MODE_NONE) {
+        request_trans_rf_mode(current_cmd_arg1);
+    }
+
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        start_trans_tx_resp(CMD_RESP_STATUS_OK);
+        append_to_trans_tx_resp(trans_rf_mode);
+        append_to_trans_tx_resp(trans_rf_mode_req);
+        append_to_trans_tx_resp(trans_rf_auto);
+        append_to_trans_tx_resp(trans_link_rssi);
+        append_to_trans_tx_resp(trans_uart_baud);
+        finish_trans_tx_resp();
+    }
+    finish_current_cmd(CMD_RESP_STATUS_OK);
+}
+
+/*
+Gets the progress of the antenna deployment (see antenna.c). Response:
+    - state (1 byte, ANT_DEP_STATE_*)
+    - seconds in the current state or algorithm (1 byte)
+    - algorithm timeout (1 byte, 0 if none is running)
+    - 1 if the last antenna data read was successful (1 byte)
+    - I2C status of the last read (1 byte)
+    - last antenna data (3 bytes - door positions and mode, heaters, timer)
+*/
+void get_ant_dep_status_fn(void) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        start_trans_tx_resp(CMD_RESP_STATUS_OK);
+        append_to_trans_tx_resp(ant_dep.state);
+        append_to_trans_tx_resp(ant_dep.state_s);
+        append_to_trans_tx_resp(ant_dep.timeout_s);
+        append_to_trans_tx_resp(ant_dep.read_ok);
+        append_to_trans_tx_resp(ant_dep.i2c_status);
+        for (uint8_t i = 0; i < sizeof(ant_dep.data); i++) {
+            append_to_trans_tx_resp(ant_dep.data[i]);
+        }
+        finish_trans_tx_resp();
+    }
     finish_current_cmd(CMD_RESP_STATUS_OK);
 }
 
@@ -360,6 +673,10 @@ void send_pay_can_msg_fn(void) {
 
 void reset_subsys_fn(void) {
     if (current_cmd_arg1 == CMD_OBC) {
+        // Don't lose the buffered command log records or the latencies since
+        // the last save
+        flush_cmd_log();
+        save_cmd_lats();
         reset_self_mcu(UPTIME_RESTART_REASON_RESET_CMD);
         // Program should stop here and restart from the beginning
 
@@ -374,20 +691,17 @@ void reset_subsys_fn(void) {
         add_def_trans_tx_dec_msg(CMD_RESP_STATUS_OK);
         finish_current_cmd(CMD_RESP_STATUS_OK);
     }
-    else if (current_cmd_arg1 == CMD_PAY) {
+    // CMD_PAY (arg1 is checked by reset_subsys_cmd.args)
+    else {
         enqueue_tx_msg(&pay_tx_msg_queue, CAN_PAY_CTRL, CAN_PAY_CTRL_RESET_SSM, 0);
 
         add_def_trans_tx_dec_msg(CMD_RESP_STATUS_OK);
         finish_current_cmd(CMD_RESP_STATUS_OK);
     }
-    else {
-        add_def_trans_tx_dec_msg(CMD_RESP_STATUS_INVALID_ARGS);
-        finish_current_cmd(CMD_RESP_STATUS_INVALID_ARGS);
-    }
 }
 
 void read_rec_status_info_fn(void) {
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         start_trans_tx_resp(CMD_RESP_STATUS_OK);
 
         for (uint8_t i = 0; i < NUM_DATA_COL_SECTIONS; i++) {
@@ -403,11 +717,8 @@ void read_rec_status_info_fn(void) {
                 // Don't use data_col->header and data_col->fields because those
                 // could be currently used for collecting a data block so we
                 // should not corrupt them
-                mem_header_t header;
-                uint32_t fields[CMD_DATA_BLOCK_MAX_FIELD_COUNT] = {0x00};
-                read_mem_data_block(data_col->mem_section, block,
-                    &header, fields);
-
+                // The most recent block is normally in the section's block
+                // cache, so this does not need to read flash
                 uint8_t start_field = 0;
                 uint8_t end_field = 0;
 
@@ -428,9 +739,11 @@ void read_rec_status_info_fn(void) {
                 }
 
                 for (uint8_t field = start_field; field <= end_field; field++) {
-                    append_to_trans_tx_resp((fields[field] >> 16) & 0xFF);
-                    append_to_trans_tx_resp((fields[field] >> 8) & 0xFF);
-                    append_to_trans_tx_resp((fields[field] >> 0) & 0xFF);
+                    uint32_t data = read_mem_field(data_col->mem_section,
+                        block, field);
+                    append_to_trans_tx_resp((data >> 16) & 0xFF);
+                    append_to_trans_tx_resp((data >> 8) & 0xFF);
+                    append_to_trans_tx_resp((data >> 0) & 0xFF);
                 }
             }
         }
@@ -440,41 +753,62 @@ void read_rec_status_info_fn(void) {
     }
 }
 
+/*
+Responds with the header and fields start_field to (start_field + num_fields -
+    1) of a block, read straight into the response (the fields are packed the
+    same way in flash, in data_col->fields and in the response).
+*/
 void read_data_block_impl(data_col_t* data_col, bool read_mem,
         uint8_t start_field, uint8_t num_fields) {
 
     // Don't modify data_col->header and data_col->fields because those
     // could be currently used for collecting a data block so we
     // should not corrupt them
-    mem_header_t header;
-    uint32_t fields[CMD_DATA_BLOCK_MAX_FIELD_COUNT] = {0x00};
+    mem_section_t* section = data_col->mem_section;
+
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        start_trans_tx_resp(CMD_RESP_STATUS_OK);
 
-    if (read_mem) {
+        if (!read_mem) {
 #ifdef COMMANDS_DEBUG
-        print("Reading data block from mem\n");
+            print("Using existing data block from collection\n");
 #endif
+            append_header_to_tx_msg(&data_col->header);
+            append_fields_to_tx_msg(
+                &data_col->fields[start_field * MEM_BYTES_PER_FIELD],
+                num_fields);
+        }
 
-        // Read data block from flash memory
-        read_mem_data_block(data_col->mem_section, current_cmd_arg2,
-            &header, fields);
-    }
-
-    else {
+        else if (section->compressed != NULL) {
 #ifdef COMMANDS_DEBUG
-        print("Using existing data block from collection\n");
+            print("Reading data block from mem\n");
 #endif
+            // Decode the block into the space after the header in the
+            // response, then move the selected fields down to follow it
+            mem_header_t header;
+            uint8_t* fields = (uint8_t*) &trans_tx_dec_msg[
+                trans_tx_dec_len + MEM_BYTES_PER_HEADER];
+            read_mem_data_block(section, current_cmd_arg2, &header, fields);
+            memmove(fields, &fields[start_field * MEM_BYTES_PER_FIELD],
+                num_fields * MEM_BYTES_PER_FIELD);
+            append_header_to_tx_msg(&header);
+            trans_tx_dec_len += num_fields * MEM_BYTES_PER_FIELD;
+        }
 
-        // copy header and fields from data collection
-        header = data_col->header;
-        for (uint8_t i = 0; i < data_col->mem_section->fields_per_block; i++) {
-            fields[i] = data_col->fields[i];
+        else {
+#ifdef COMMANDS_DEBUG
+            print("Reading data block from mem\n");
+#endif
+            mem_header_t header;
+            read_mem_header(section, current_cmd_arg2, &header);
+            append_header_to_tx_msg(&header);
+            read_mem_section_bytes(section,
+                mem_field_section_addr(section, current_cmd_arg2, start_field),
+                (uint8_t*) &trans_tx_dec_msg[trans_tx_dec_len],
+                num_fields * MEM_BYTES_PER_FIELD);
+            trans_tx_dec_len += num_fields * MEM_BYTES_PER_FIELD;
         }
-    }
 
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        start_trans_tx_resp(CMD_RESP_STATUS_OK);
-        append_header_to_tx_msg(&header);
-        append_fields_to_tx_msg(&fields[start_field], num_fields);
         finish_trans_tx_resp();
     }
 }
@@ -524,19 +858,76 @@ void read_rec_loc_data_block_fn(void) {
     read_data_block_common(false);    
 }
 
+/*
+Sends command log blocks in a compressed response (see CMD_READ_COMPRESSED),
+    with as many blocks as fit.
+Returns false (without sending) if it would not be smaller than the
+    uncompressed response.
+*/
+bool read_cmd_blocks_compressed(mem_section_t* section, uint32_t count) {
+    // The block before the first one
+    uint8_t prev[MEM_CMD_LOG_BYTES_PER_BLOCK] = { 0x00 };
+    uint32_t prev_block_num = current_cmd_arg1 - 1;
+    prev[0] = (prev_block_num >> 16) & 0xFF;
+    prev[1] = (prev_block_num >> 8) & 0xFF;
+    prev[2] = prev_block_num & 0xFF;
+
+    bool sent = false;
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        start_trans_tx_resp(CMD_RESP_STATUS_OK_COMPRESSED);
+        // Number of blocks, set below
+        trans_tx_dec_msg[trans_tx_dec_len] = 0;
+        trans_tx_dec_len++;
+
+        uint8_t num_blocks = 0;
+        for (; num_blocks < count; num_blocks++) {
+            uint8_t block[MEM_CMD_LOG_BYTES_PER_BLOCK];
+            read_mem_section_bytes(section,
+                mem_block_section_addr(section, current_cmd_arg1 + num_blocks),
+                block, MEM_CMD_LOG_BYTES_PER_BLOCK);
+            if (!append_cmd_log_ref_to_tx_msg(prev, block)) {
+                break;
+            }
+            memcpy(prev, block, MEM_CMD_LOG_BYTES_PER_BLOCK);
+        }
+        trans_tx_dec_msg[3] = num_blocks;
+
+        // After cmd ID and status
+        if (num_blocks < count || count > CMD_READ_CMD_BLOCKS_MAX_COUNT ||
+                trans_tx_dec_len - 3 < count * MEM_CMD_LOG_BYTES_PER_BLOCK) {
+            finish_trans_tx_resp();
+            sent = true;
+        }
+    }
+
+    return sent;
+}
+
 // Common functionality for primary and secondary blocks
+// The count is limited to CMD_READ_CMD_BLOCKS_MAX_COUNT by the commands' args,
+// or to CMD_READ_CMD_BLOCKS_MAX_COMPRESSED_COUNT here for a compressed read
 void read_cmd_blocks(mem_section_t* section) {
-    if (current_cmd_arg2 > CMD_READ_CMD_BLOCKS_MAX_COUNT) {
+    bool compressed = (current_cmd_arg2 & CMD_READ_COMPRESSED) != 0;
+    uint32_t count = current_cmd_arg2 & ~CMD_READ_COMPRESSED;
+    if (compressed && count > CMD_READ_CMD_BLOCKS_MAX_COMPRESSED_COUNT) {
         add_def_trans_tx_dec_msg(CMD_RESP_STATUS_INVALID_ARGS);
         finish_current_cmd(CMD_RESP_STATUS_INVALID_ARGS);
         return;
     }
 
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    // Include the records that have not been written yet
+    flush_cmd_log();
+
+    if (compressed && read_cmd_blocks_compressed(section, count)) {
+        finish_current_cmd(CMD_RESP_STATUS_OK);
+        return;
+    }
+
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         start_trans_tx_resp(CMD_RESP_STATUS_OK);
 
         for (uint32_t block_num = current_cmd_arg1;
-            block_num < current_cmd_arg1 + current_cmd_arg2;
+            block_num < current_cmd_arg1 + count;
             block_num++) {
             
             mem_header_t header;
@@ -575,34 +966,72 @@ void read_sec_cmd_blocks_fn(void) {
     read_cmd_blocks(&sec_cmd_log_mem_section);
 }
 
-void read_raw_mem_bytes_fn(void) {
-    // Enforce starting address
-    if (current_cmd_arg1 >= MEM_NUM_ADDRESSES) {
-        add_def_trans_tx_dec_msg(CMD_RESP_STATUS_INVALID_ARGS);
-        finish_current_cmd(CMD_RESP_STATUS_INVALID_ARGS);
-        return;
+/*
+Sends raw memory bytes run-length encoded (see CMD_READ_COMPRESSED), with as
+    many bytes as fit.
+Returns false (without sending) if it would not be smaller than the
+    uncompressed response.
+*/
+bool read_raw_mem_bytes_compressed(uint32_t count) {
+    bool sent = false;
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        start_trans_tx_resp(CMD_RESP_STATUS_OK_COMPRESSED);
+        rle_resp_t rle;
+        start_rle_resp(&rle);
+
+        for (uint32_t offset = 0; offset < count && !rle.full;
+                offset += CMD_READ_MEM_COMPRESSED_CHUNK) {
+            uint8_t data[CMD_READ_MEM_COMPRESSED_CHUNK];
+            uint8_t len = CMD_READ_MEM_COMPRESSED_CHUNK;
+            if (offset + len > count) {
+                len = count - offset;
+            }
+            read_mem_bytes(current_cmd_arg1 + offset, data, len);
+
+            for (uint8_t i = 0; i < len; i++) {
+                if (!append_rle_resp(&rle, data[i])) {
+                    break;
+                }
+            }
+        }
+        finish_rle_resp(&rle);
+
+        // After cmd ID and status
+        if (rle.count < count || count > CMD_READ_MEM_MAX_COUNT ||
+                trans_tx_dec_len - 3 < count) {
+            finish_trans_tx_resp();
+            sent = true;
+        }
     }
 
-    // Enforce max number of bytes
-    if (current_cmd_arg2 > CMD_READ_MEM_MAX_COUNT) {
+    return sent;
+}
+
+// The address range and count are checked by read_raw_mem_bytes_cmd.args, or
+// the count is checked here for a compressed read
+void read_raw_mem_bytes_fn(void) {
+    bool compressed = (current_cmd_arg2 & CMD_READ_COMPRESSED) != 0;
+    uint32_t count = current_cmd_arg2 & ~CMD_READ_COMPRESSED;
+    if (compressed && count > CMD_READ_MEM_MAX_COMPRESSED_COUNT) {
         add_def_trans_tx_dec_msg(CMD_RESP_STATUS_INVALID_ARGS);
         finish_current_cmd(CMD_RESP_STATUS_INVALID_ARGS);
         return;
     }
 
-    // Enforce not rolling over addresses past the third chip
-    if (current_cmd_arg1 + current_cmd_arg2 - 1 >= MEM_NUM_ADDRESSES) {
-        add_def_trans_tx_dec_msg(CMD_RESP_STATUS_INVALID_ARGS);
-        finish_current_cmd(CMD_RESP_STATUS_INVALID_ARGS);
+    // In case the range includes the command log
+    flush_cmd_log();
+
+    if (compressed && read_raw_mem_bytes_compressed(count)) {
+        finish_current_cmd(CMD_RESP_STATUS_OK);
         return;
     }
 
     uint8_t data[CMD_READ_MEM_MAX_COUNT] = { 0x00 };
-    read_mem_bytes(current_cmd_arg1, data, current_cmd_arg2);
+    read_mem_bytes(current_cmd_arg1, data, count);
 
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         start_trans_tx_resp(CMD_RESP_STATUS_OK);
-        for (uint32_t i = 0; i < current_cmd_arg2; i++) {
+        for (uint32_t i = 0; i < count; i++) {
             append_to_trans_tx_resp(data[i]);
         }
         finish_trans_tx_resp();
@@ -611,274 +1040,775 @@ void read_raw_mem_bytes_fn(void) {
     finish_current_cmd(CMD_RESP_STATUS_OK);
 }
 
-void erase_mem_phy_sector_fn(void) {
-    if (current_cmd_arg1 >= MEM_NUM_ADDRESSES) {
+/*
+Reads `count` consecutive data blocks starting at `start block`.
+arg1 - block type
+arg2 - {count (8 bits), start block (24 bits)}
+Each response is packed with as many whole blocks as fit. After sending one
+    response, the command re-enqueues itself to the front of the queue with
+    the remaining range (and CMD_READ_DATA_BLOCK_RANGE_CONT set so it is only
+    logged once).
+When all fields of a block are read, the blocks are contiguous in memory so
+    they are read directly into the response in one sequential read (except
+    in compressed sections, where each block is decoded). They are sent as
+    they are stored, so each one is followed by its CRC if the section has
+    block CRCs (see sync_data_blocks_fn()).
+*/
+void read_data_block_range_fn(void) {
+    bool cont = (current_cmd_arg1 & CMD_READ_DATA_BLOCK_RANGE_CONT) != 0;
+    uint32_t block_type = current_cmd_arg1 & ~CMD_READ_DATA_BLOCK_RANGE_CONT;
+    uint32_t start_block = current_cmd_arg2 & CMD_READ_DATA_BLOCK_RANGE_BLOCK_MASK;
+    uint8_t count = current_cmd_arg2 >> CMD_READ_DATA_BLOCK_RANGE_COUNT_SHIFT;
+
+    mem_section_t* section = NULL;
+    uint8_t start_field = 0;
+    uint8_t num_fields = 0;
+    switch (block_type) {
+        case CMD_OBC_HK:
+            section = &obc_hk_mem_section;
+            num_fields = CAN_OBC_HK_FIELD_COUNT;
+            break;
+        case CMD_EPS_HK:
+            section = &eps_hk_mem_section;
+            num_fields = CAN_EPS_HK_FIELD_COUNT;
+            break;
+        case CMD_PAY_HK:
+            section = &pay_hk_mem_section;
+            num_fields = CAN_PAY_HK_FIELD_COUNT;
+            break;
+        case CMD_PAY_OPT_OD:
+            section = &pay_opt_mem_section;
+            num_fields = CAN_PAY_OPT_OD_FIELD_COUNT;
+            break;
+        case CMD_PAY_OPT_FL:
+            section = &pay_opt_mem_section;
+            start_field = CAN_PAY_OPT_OD_FIELD_COUNT;
+            num_fields = CAN_PAY_OPT_FL_FIELD_COUNT;
+            break;
+        default:
+            break;
+    }
+
+    // Enforce a valid type, a non-empty range, and not reading past the end
+    // of the section
+    if (section == NULL || count == 0 ||
+            start_block + count > mem_section_num_blocks(section)) {
         add_def_trans_tx_dec_msg(CMD_RESP_STATUS_INVALID_ARGS);
         finish_current_cmd(CMD_RESP_STATUS_INVALID_ARGS);
         return;
     }
 
-    erase_mem_sector(current_cmd_arg1);
+    // Wait until the previous response has been sent
+    if (cont && (trans_tx_dec_avail || trans_tx_enc_avail)) {
+        enqueue_cmd_front(current_cmd_id, &read_data_block_range_cmd,
+            current_cmd_arg1, current_cmd_arg2);
+        finish_current_cmd(CMD_RESP_STATUS_IN_PROGRESS);
+        return;
+    }
 
-    // Only send a transceiver packet if the erase was initiated by the ground
-    // station
-    if (current_cmd_id != CMD_CMD_ID_AUTO_ENQUEUED) {
-        add_def_trans_tx_dec_msg(CMD_RESP_STATUS_OK);
+    // Number of blocks that fit in one response (after cmd ID and status)
+    uint8_t resp_block_size = MEM_BYTES_PER_HEADER +
+        (num_fields * MEM_BYTES_PER_FIELD);
+    // Whole blocks are sent as they are stored (with the CRC after the
+    // fields if the section has one)
+    bool whole_blocks = section->compressed == NULL &&
+        num_fields == section->fields_per_block;
+    if (whole_blocks) {
+        resp_block_size = mem_block_size(section);
+    }
+    uint8_t resp_count = (TRANS_TX_DEC_MSG_MAX_SIZE - 3) / resp_block_size;
+    // A compressed block is decoded whole into the response, so the last one
+    // also needs space for the fields after the ones sent
+    if (section->compressed != NULL) {
+        resp_count = (TRANS_TX_DEC_MSG_MAX_SIZE - 3 -
+            ((section->fields_per_block - num_fields) * MEM_BYTES_PER_FIELD)) /
+            resp_block_size;
+    }
+    if (resp_count > count) {
+        resp_count = count;
     }
-    finish_current_cmd(CMD_RESP_STATUS_OK);
-}
 
-void erase_mem_phy_block_fn(void) {
-    if (current_cmd_arg1 >= MEM_NUM_ADDRESSES) {
-        add_def_trans_tx_dec_msg(CMD_RESP_STATUS_INVALID_ARGS);
-        finish_current_cmd(CMD_RESP_STATUS_INVALID_ARGS);
-        return;
+    // Only start and finish the response with interrupts disabled - reading
+    // from a chip can wait for a background erase, and nothing else writes
+    // to the response before finish_trans_tx_resp()
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        start_trans_tx_resp(CMD_RESP_STATUS_OK);
     }
 
-    erase_mem_block(current_cmd_arg1);
+    if (section->compressed != NULL) {
+        // Blocks have to be decoded one at a time, each one in place in
+        // the response after the space for its header
+        for (uint8_t i = 0; i < resp_count; i++) {
+            mem_header_t header;
+            uint8_t* fields = (uint8_t*) &trans_tx_dec_msg[
+                trans_tx_dec_len + MEM_BYTES_PER_HEADER];
+            read_mem_data_block(section, start_block + i, &header, fields);
+            memmove(fields, &fields[start_field * MEM_BYTES_PER_FIELD],
+                num_fields * MEM_BYTES_PER_FIELD);
+            append_header_to_tx_msg(&header);
+            trans_tx_dec_len += num_fields * MEM_BYTES_PER_FIELD;
+        }
+    } else if (whole_blocks) {
+        read_mem_section_bytes(section,
+            mem_block_section_addr(section, start_block),
+            (uint8_t*) &trans_tx_dec_msg[trans_tx_dec_len],
+            resp_count * resp_block_size);
+        trans_tx_dec_len += resp_count * resp_block_size;
+    } else {
+        for (uint8_t i = 0; i < resp_count; i++) {
+            uint32_t block_num = start_block + i;
+            read_mem_section_bytes(section,
+                mem_block_section_addr(section, block_num),
+                (uint8_t*) &trans_tx_dec_msg[trans_tx_dec_len],
+                MEM_BYTES_PER_HEADER);
+            trans_tx_dec_len += MEM_BYTES_PER_HEADER;
+            read_mem_section_bytes(section,
+                mem_field_section_addr(section, block_num, start_field),
+                (uint8_t*) &trans_tx_dec_msg[trans_tx_dec_len],
+                num_fields * MEM_BYTES_PER_FIELD);
+            trans_tx_dec_len += num_fields * MEM_BYTES_PER_FIELD;
+        }
+    }
 
-    add_def_trans_tx_dec_msg(CMD_RESP_STATUS_OK);
-    finish_current_cmd(CMD_RESP_STATUS_OK);
-}
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        finish_trans_tx_resp();
+    }
 
-void erase_all_mem_fn(void) {
-    erase_mem();
+    // Continue with the rest of the range
+    if (resp_count < count) {
+        uint32_t next_arg2 =
+            ((uint32_t) (count - resp_count) << CMD_READ_DATA_BLOCK_RANGE_COUNT_SHIFT) |
+            ((start_block + resp_count) & CMD_READ_DATA_BLOCK_RANGE_BLOCK_MASK);
+        enqueue_cmd_front(current_cmd_id, &read_data_block_range_cmd,
+            block_type | CMD_READ_DATA_BLOCK_RANGE_CONT, next_arg2);
+        finish_current_cmd(CMD_RESP_STATUS_IN_PROGRESS);
+        return;
+    }
 
-    add_def_trans_tx_dec_msg(CMD_RESP_STATUS_OK);
     finish_current_cmd(CMD_RESP_STATUS_OK);
 }
 
-void col_data_block_obc_hk(void) {
-#ifdef COMMANDS_VERBOSE
-    print("Start %s\n", obc_hk_data_col.name);
-#endif
-
-    data_col_t* data_col = &obc_hk_data_col;
-
-    // Populate header
-    populate_header(&data_col->header,
-        data_col->mem_section->curr_block,
-        CMD_RESP_STATUS_UNKNOWN);
-    // Write header (except status) to memory
-    write_mem_header_main(data_col->mem_section,
-        data_col->mem_section->curr_block,
-        &data_col->header);
-    // Increment the block number
-    inc_and_prepare_mem_section_curr_block(data_col->mem_section);
+/*
+Aggregates data blocks on board - responds with the minimum, maximum, mean and
+    most recent value of each selected field (see append_data_agg_to_tx_msg()).
+arg1 - {first field (8 bits), field mask (8 bits), count (16 bits)}
+arg2 - {block type (8 bits), start block (24 bits)}
+Only the selected fields of each block are read from memory, and fields that
+    are missing (0xFFFFFF) are skipped.
+If count is 0, responds with the running aggregate instead (updated as each
+    block is collected) and starts a new one for the selected fields. It only
+    has blocks if the previous one was for the same block type and fields.
+*/
+void agg_data_blocks_fn(void) {
+    uint8_t first_field = current_cmd_arg1 >> CMD_AGG_DATA_BLOCKS_FIRST_FIELD_SHIFT;
+    uint8_t field_mask = (current_cmd_arg1 >> CMD_AGG_DATA_BLOCKS_FIELD_MASK_SHIFT) & 0xFF;
+    uint16_t count = current_cmd_arg1 & CMD_AGG_DATA_BLOCKS_COUNT_MASK;
+    uint8_t block_type = current_cmd_arg2 >> CMD_AGG_DATA_BLOCKS_TYPE_SHIFT;
+    uint32_t start_block = current_cmd_arg2 & CMD_AGG_DATA_BLOCKS_BLOCK_MASK;
+
+    mem_section_t* section = NULL;
+    for (uint8_t i = 0; i < NUM_DATA_COL_SECTIONS; i++) {
+        if (all_data_cols[i]->cmd_arg1 == block_type) {
+            section = all_data_cols[i]->mem_section;
+            break;
+        }
+    }
 
-    // Populate fields
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        data_col->fields[CAN_OBC_HK_UPTIME] = uptime_s;
+    // Number of fields to read from each block (up to the last selected one)
+    uint8_t num_fields = 0;
+    for (uint8_t i = 0; i < CMD_AGG_MAX_FIELDS; i++) {
+        if (field_mask & _BV(i)) {
+            num_fields = i + 1;
+        }
     }
-    data_col->fields[CAN_OBC_HK_RESTART_COUNT] = restart_count;
-    data_col->fields[CAN_OBC_HK_RESTART_REASON] = restart_reason;
-    data_col->fields[CAN_OBC_HK_RESTART_DATE] =
-        ((uint32_t) restart_date.yy << 16) |
-        ((uint32_t) restart_date.mm << 8) |
-        ((uint32_t) restart_date.dd << 0);
-    data_col->fields[CAN_OBC_HK_RESTART_TIME] =
-        ((uint32_t) restart_time.hh << 16) |
-        ((uint32_t) restart_time.mm << 8) |
-        ((uint32_t) restart_time.ss << 0);
 
-    // Write fields to memory
-    for (uint8_t i = 0; i < data_col->mem_section->fields_per_block; i++) {
-        write_mem_field(data_col->mem_section,
-            data_col->mem_section->curr_block,
-            i, data_col->fields[i]);
-        // i is field number; fields[i] corresponds to associated field data
+    // Enforce a valid type, at least one field that is in the block, and not
+    // reading past the end of the section
+    if (section == NULL || field_mask == 0 ||
+            first_field + num_fields > section->fields_per_block ||
+            count > CMD_AGG_MAX_BLOCKS ||
+            start_block + count > mem_section_num_blocks(section)) {
+        add_def_trans_tx_dec_msg(CMD_RESP_STATUS_INVALID_ARGS);
+        finish_current_cmd(CMD_RESP_STATUS_INVALID_ARGS);
+        return;
     }
 
-#ifdef COMMANDS_VERBOSE
-    print("Done %s\n", data_col->name);
-#endif
+    if (count == 0) {
+        if (run_data_agg.block_type != block_type ||
+                run_data_agg.first_field != first_field ||
+                run_data_agg.field_mask != field_mask) {
+            init_data_agg(&run_data_agg, block_type, first_field, field_mask);
+        }
 
-    // Only send back a transceiver packet if the command was sent from
-    // ground (not auto)
-    if (current_cmd_id != CMD_CMD_ID_AUTO_ENQUEUED) {
-        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
             start_trans_tx_resp(CMD_RESP_STATUS_OK);
-            // Need to use the block number from the header because the block
-            // number for the memory section has already been incremented
-            // past the block just collected
-            append_to_trans_tx_resp((data_col->header.block_num >> 24) & 0xFF);
-            append_to_trans_tx_resp((data_col->header.block_num >> 16) & 0xFF);
-            append_to_trans_tx_resp((data_col->header.block_num >> 8) & 0xFF);
-            append_to_trans_tx_resp((data_col->header.block_num >> 0) & 0xFF);
+            append_data_agg_to_tx_msg(&run_data_agg);
             finish_trans_tx_resp();
         }
+
+        init_data_agg(&run_data_agg, block_type, first_field, field_mask);
+        finish_current_cmd(CMD_RESP_STATUS_OK);
+        return;
     }
 
-    finish_current_cmd(CMD_RESP_STATUS_OK);
-    return;
-}
+    data_agg_t agg;
+    init_data_agg(&agg, block_type, first_field, field_mask);
 
-// Field 0
-void col_data_block_other_start(data_col_t* data_col) {
-#ifdef COMMANDS_VERBOSE
-    print("Start data col\n", data_col->name, cmd_field);
-#endif
+    // The response is only built after the loop and nothing else writes to
+    // it while a command runs, so the blocks are read into it instead of a
+    // buffer on the stack (a whole compressed block is
+    // MEM_COMPRESSED_MAX_FIELDS fields, which fits)
+    uint8_t* block_fields = (uint8_t*) trans_tx_dec_msg;
 
-    populate_header(&data_col->header,
-        data_col->mem_section->curr_block,
-        CMD_RESP_STATUS_UNKNOWN);
-    write_mem_header_main(data_col->mem_section,
-        data_col->mem_section->curr_block,
-        &data_col->header);
-    
-    // Reset all field data so we don't leave garbage data from last collection
-    for (uint8_t i = 0; i < data_col->mem_section->fields_per_block; i++) {
-        data_col->fields[i] = 0;
+    for (uint16_t i = 0; i < count; i++) {
+        uint32_t block_num = start_block + i;
+        uint32_t fields[CMD_AGG_MAX_FIELDS];
+
+        if (section->compressed != NULL) {
+            // Blocks have to be decoded one at a time
+            mem_header_t header;
+            read_mem_data_block(section, block_num, &header, block_fields);
+            for (uint8_t j = 0; j < num_fields; j++) {
+                fields[j] = get_packed_field(block_fields, first_field + j);
+            }
+        } else {
+            read_mem_section_bytes(section,
+                mem_field_section_addr(section, block_num, first_field),
+                block_fields, num_fields * MEM_BYTES_PER_FIELD);
+            for (uint8_t j = 0; j < num_fields; j++) {
+                fields[j] = get_packed_field(block_fields, j);
+            }
+        }
+        for (uint8_t j = num_fields; j < CMD_AGG_MAX_FIELDS; j++) {
+            fields[j] = CMD_AGG_MISSING_FIELD;
+        }
+
+        add_to_data_agg(&agg, block_num, fields);
     }
 
-    // This increment invalidates the current block number for the
-    // memory section struct for the current command, so the command
-    // will need to fetch the block number from the header
-    inc_and_prepare_mem_section_curr_block(
-        data_col->mem_section);
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        start_trans_tx_resp(CMD_RESP_STATUS_OK);
+        append_data_agg_to_tx_msg(&agg);
+        finish_trans_tx_resp();
+    }
 
-    enqueue_tx_msg(data_col->can_tx_queue,
-        data_col->can_opcode, 0, 0);
+    finish_current_cmd(CMD_RESP_STATUS_OK);
+}
+
+/*
+Finds the data blocks collected between two times (inclusive), so ground can
+    read an event window with read data block range without reading headers
+    to find it (see find_data_block_by_time()).
+arg1 - start time (seconds since 2000-01-01 00:00:00)
+arg2 - {block type (8 bits), duration in seconds (24 bits)}
+Responds with the first block number (3 bytes) and the number of blocks
+    (3 bytes). If the section has wrapped around, the range can continue from
+    block 0. If there are no blocks, the first block number is where the next
+    one after the start time would be.
+*/
+void find_data_blocks_by_time_fn(void) {
+    uint8_t block_type = current_cmd_arg2 >> CMD_FIND_DATA_BLOCKS_BY_TIME_TYPE_SHIFT;
+    uint32_t start_s = current_cmd_arg1;
+    uint32_t end_s = start_s +
+        (current_cmd_arg2 & CMD_FIND_DATA_BLOCKS_BY_TIME_DUR_MASK);
+
+    mem_section_t* section = NULL;
+    for (uint8_t i = 0; i < NUM_DATA_COL_SECTIONS; i++) {
+        if (all_data_cols[i]->cmd_arg1 == block_type) {
+            section = all_data_cols[i]->mem_section;
+            break;
+        }
+    }
 
-    // Enqueue command (check for response 0 then send field 1)
-    enqueue_cmd(current_cmd_id, &col_data_block_cmd, current_cmd_arg1, 1);
+    // Enforce a valid type and an end time that does not overflow
+    if (section == NULL || end_s < start_s) {
+        add_def_trans_tx_dec_msg(CMD_RESP_STATUS_INVALID_ARGS);
+        finish_current_cmd(CMD_RESP_STATUS_INVALID_ARGS);
+        return;
+    }
 
-    // Store the current uptime before receiving first field
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        data_col->prev_field_col_uptime_s = uptime_s;
+    uint32_t start_pos = find_data_block_by_time(section, start_s, true);
+    uint32_t end_pos = find_data_block_by_time(section, end_s, false);
+    uint32_t start_block = data_block_write_order(section, start_pos);
+    uint32_t count = end_pos - start_pos;
+
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        start_trans_tx_resp(CMD_RESP_STATUS_OK);
+        append_to_trans_tx_resp((start_block >> 16) & 0xFF);
+        append_to_trans_tx_resp((start_block >> 8) & 0xFF);
+        append_to_trans_tx_resp(start_block & 0xFF);
+        append_to_trans_tx_resp((count >> 16) & 0xFF);
+        append_to_trans_tx_resp((count >> 8) & 0xFF);
+        append_to_trans_tx_resp(count & 0xFF);
+        finish_trans_tx_resp();
     }
 
-    finish_current_cmd(CMD_RESP_STATUS_DATA_COL_IN_PROGRESS);
-    return;
+    finish_current_cmd(CMD_RESP_STATUS_OK);
 }
 
-// Fields 1...N
-void col_data_block_other_check(data_col_t* data_col) {
-    // Check if we have timed out before receiving a field response
-    uint32_t cur_uptime = 0;
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        cur_uptime = uptime_s;
+/*
+Sends only the data blocks in a range that ground does not already have (or
+    that are different from its copy), so blocks are not downlinked again
+    after a partial pass.
+arg1 - {block type (8 bits), start block (24 bits)}
+arg2 - {bitmap of the blocks ground has (16 bits), digest (16 bits)}
+The range is the CMD_SYNC_DATA_BLOCKS_COUNT blocks from the start block (up to
+    the end of the section), and bit i of the bitmap is block (start + i). The
+    digest is the CRC (from MEM_CRC_INIT, see mem_crc16_update()) of the
+    stored CRCs (2 bytes each, big-endian) of the blocks ground has, in order.
+Blocks that have not been committed (no CRC yet) are never sent. If the digest
+    matches, only the blocks ground does not have are needed. Otherwise at
+    least one of ground's blocks is different, so all of them are needed.
+Each response is {bitmap of the needed blocks not sent in an earlier response
+    (16 bits)}, then as many of them as fit, as they are stored (header,
+    fields and CRC). After sending one response, the command re-enqueues itself
+    to the front of the queue for the rest (with CMD_SYNC_DATA_BLOCKS_CONT
+    set). If one block does not fit in a response (PAY_OPT), only the bitmap is
+    sent so ground can read those blocks with read data block range.
+Only for sections with block CRCs (see MEM_DATA_BLOCK_CRC).
+*/
+void sync_data_blocks_fn(void) {
+    bool cont = (current_cmd_arg1 & CMD_SYNC_DATA_BLOCKS_CONT) != 0;
+    uint8_t block_type = (current_cmd_arg1 & ~CMD_SYNC_DATA_BLOCKS_CONT) >>
+        CMD_SYNC_DATA_BLOCKS_TYPE_SHIFT;
+    uint32_t start_block = current_cmd_arg1 & CMD_SYNC_DATA_BLOCKS_BLOCK_MASK;
+    uint16_t have = current_cmd_arg2 >> CMD_SYNC_DATA_BLOCKS_HAVE_SHIFT;
+    uint16_t digest = current_cmd_arg2 & CMD_SYNC_DATA_BLOCKS_DIGEST_MASK;
+
+    mem_section_t* section = NULL;
+    for (uint8_t i = 0; i < NUM_DATA_COL_SECTIONS; i++) {
+        if (all_data_cols[i]->cmd_arg1 == block_type) {
+            section = all_data_cols[i]->mem_section;
+            break;
+        }
     }
-    if (cur_uptime >= data_col->prev_field_col_uptime_s +
-            CMD_COL_DATA_BLOCK_FIELD_TIMEOUT_S) {
-        print("\nCOL TIMEOUT\n\n");
 
-        if (current_cmd_id != CMD_CMD_ID_AUTO_ENQUEUED) {
-            add_def_trans_tx_dec_msg(CMD_RESP_STATUS_TIMED_OUT);
-        }
-        finish_current_cmd(CMD_RESP_STATUS_TIMED_OUT);
-        
+    // Enforce a valid type with block CRCs and a start block in the section
+    if (section == NULL || !mem_section_has_block_crc(section) ||
+            start_block >= mem_section_num_blocks(section)) {
+        add_def_trans_tx_dec_msg(CMD_RESP_STATUS_INVALID_ARGS);
+        finish_current_cmd(CMD_RESP_STATUS_INVALID_ARGS);
         return;
     }
 
-    uint8_t msg[8] = {0x00};
+    // Wait until the previous response has been sent
+    if (cont && (trans_tx_dec_avail || trans_tx_enc_avail)) {
+        enqueue_cmd_front(current_cmd_id, &sync_data_blocks_cmd,
+            current_cmd_arg1, current_cmd_arg2);
+        finish_current_cmd(CMD_RESP_STATUS_IN_PROGRESS);
+        return;
+    }
 
-    uint8_t opcode = 0;
-    uint8_t field_num = 0;
-    uint32_t data = 0;
+    uint8_t count = CMD_SYNC_DATA_BLOCKS_COUNT;
+    if (start_block + count > mem_section_num_blocks(section)) {
+        count = mem_section_num_blocks(section) - start_block;
+    }
 
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        // If there are no messages in the CAN RX queue, re-enqueue
-        // this command to the command queue and stop
-        if (queue_empty(&data_rx_msg_queue)) {
-            enqueue_cmd(current_cmd_id, &col_data_block_cmd,
-                current_cmd_arg1, current_cmd_arg2);
-            finish_current_cmd(CMD_RESP_STATUS_DATA_COL_IN_PROGRESS);
-            return;
+    // A continuation already has the blocks left to send in arg2
+    uint16_t needed = have;
+    if (!cont) {
+        uint16_t committed = 0;
+        uint16_t crc = MEM_CRC_INIT;
+        for (uint8_t i = 0; i < count; i++) {
+            uint16_t block_crc = read_mem_block_crc(section, start_block + i);
+            if (block_crc != MEM_CRC_ERASED) {
+                committed |= 1U << i;
+            }
+            // Including blocks that are no longer committed (e.g. erased),
+            // which can't match ground's copy
+            if (have & (1U << i)) {
+                crc = mem_crc16_update(crc, (block_crc >> 8) & 0xFF);
+                crc = mem_crc16_update(crc, block_crc & 0xFF);
+            }
+        }
+
+        needed = committed;
+        if (crc == digest) {
+            needed &= ~have;
         }
-        // Dequeue the message, but we might re-enqueue it after
-        dequeue(&data_rx_msg_queue, msg);
     }
 
-    if (print_can_msgs) {
-        // Extra spaces to align with CAN TX messages
-        print("CAN RX (DC): ");
-        print_bytes(msg, 8);
+    uint16_t block_size = mem_block_size(section);
+    // Number of blocks that fit in one response (after cmd ID, status and
+    // bitmap)
+    uint8_t resp_count = (TRANS_TX_DEC_MSG_MAX_SIZE - 5) / block_size;
+    uint16_t sent = 0;
+
+    // Flash is read with interrupts enabled (see read_data_block_range_fn())
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        start_trans_tx_resp(CMD_RESP_STATUS_OK);
+        append_to_trans_tx_resp((needed >> 8) & 0xFF);
+        append_to_trans_tx_resp(needed & 0xFF);
     }
 
-    // Break down the message into components
-    opcode = msg[0];
-    field_num = msg[1];
-    // Don't need to check status
-    data =
-        ((uint32_t) msg[4] << 24) |
-        ((uint32_t) msg[5] << 16) |
-        ((uint32_t) msg[6] << 8) |
-        ((uint32_t) msg[7]);
+    for (uint8_t i = 0; i < count && resp_count > 0; i++) {
+        if ((needed & (1U << i)) == 0) {
+            continue;
+        }
+        read_mem_section_bytes(section,
+            mem_block_section_addr(section, start_block + i),
+            (uint8_t*) &trans_tx_dec_msg[trans_tx_dec_len], block_size);
+        trans_tx_dec_len += block_size;
+        sent |= 1U << i;
+        resp_count--;
+    }
+
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        finish_trans_tx_resp();
+    }
 
-    // If the opcode does not match this block type, put it back in the queue
-    if (opcode != data_col->can_opcode) {
-        enqueue_front(&data_rx_msg_queue, msg);
-        if (print_can_msgs) {
-            print("Re-enqueued\n");
+    // Continue with the rest of the blocks
+    needed &= ~sent;
+    if (needed != 0 && sent != 0) {
+        enqueue_cmd_front(current_cmd_id, &sync_data_blocks_cmd,
+            current_cmd_arg1 | CMD_SYNC_DATA_BLOCKS_CONT,
+            (uint32_t) needed << CMD_SYNC_DATA_BLOCKS_HAVE_SHIFT);
+        finish_current_cmd(CMD_RESP_STATUS_IN_PROGRESS);
+        return;
+    }
+
+    finish_current_cmd(CMD_RESP_STATUS_OK);
+}
+
+/*
+Returns the index in the bulk read window of the next frame to send, or
+    CMD_BULK_READ_WINDOW_SIZE if all of them have been sent.
+*/
+uint8_t next_bulk_read_frame(void) {
+    for (uint8_t i = 0; i < CMD_BULK_READ_WINDOW_SIZE; i++) {
+        if ((uint32_t) bulk_read.base_seq + i >= bulk_read.num_frames) {
+            break;
+        }
+        if ((bulk_read.sent & (1UL << i)) == 0) {
+            return i;
         }
+    }
+    return CMD_BULK_READ_WINDOW_SIZE;
+}
 
-        // Re-enqueue the same command to check for this field
-        enqueue_cmd(current_cmd_id, &col_data_block_cmd,
+/*
+Sends the next frame of the bulk read window, then re-enqueues itself to the
+    front of the queue if there are more to send.
+The decoded message is free again once the previous frame's last byte has been
+    written, so the next frame is built during its guard time, which keeps the
+    link busy.
+*/
+void send_bulk_read_frame(void) {
+    // Continuation of a session that was replaced
+    if (!bulk_read.active || current_cmd_id != bulk_read.cmd_id) {
+        finish_current_cmd(CMD_RESP_STATUS_IN_PROGRESS);
+        return;
+    }
+
+    if (trans_tx_dec_avail) {
+        enqueue_cmd_front(current_cmd_id, &start_bulk_read_cmd,
             current_cmd_arg1, current_cmd_arg2);
-        finish_current_cmd(CMD_RESP_STATUS_DATA_COL_IN_PROGRESS);
+        finish_current_cmd(CMD_RESP_STATUS_IN_PROGRESS);
+        return;
+    }
+
+    // The whole window has been sent, wait for ack_bulk_read_cmd
+    uint8_t index = next_bulk_read_frame();
+    if (index >= CMD_BULK_READ_WINDOW_SIZE) {
+        finish_current_cmd(CMD_RESP_STATUS_IN_PROGRESS);
         return;
     }
 
-    // If the CAN opcode in the message matches the opcode for
-    // this block type
-    // Continue with processing the message
+    uint16_t seq = bulk_read.base_seq + index;
+    uint32_t offset = (uint32_t) seq * CMD_BULK_READ_FRAME_SIZE;
+    uint8_t len = CMD_BULK_READ_FRAME_SIZE;
+    if (bulk_read.num_bytes - offset < len) {
+        len = bulk_read.num_bytes - offset;
+    }
+
+    // In case the range includes the command log
+    flush_cmd_log();
 
-    // If the field number received in the CAN message is what we are expecting
-    if (field_num != current_cmd_arg2 - 1) {
-        // Re-enqueue the same command to check for this field
-        enqueue_cmd(current_cmd_id, &col_data_block_cmd,
+    // Flash is read with interrupts enabled (see read_data_block_range_fn())
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        start_trans_tx_resp(CMD_RESP_STATUS_BULK_FRAME);
+        append_to_trans_tx_resp((seq >> 8) & 0xFF);
+        append_to_trans_tx_resp(seq & 0xFF);
+    }
+    read_mem_bytes(bulk_read.start_addr + offset,
+        (uint8_t*) &trans_tx_dec_msg[trans_tx_dec_len], len);
+    trans_tx_dec_len += len;
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        finish_trans_tx_resp();
+    }
+    bulk_read.sent |= 1UL << index;
+
+    if (next_bulk_read_frame() < CMD_BULK_READ_WINDOW_SIZE) {
+        enqueue_cmd_front(current_cmd_id, &start_bulk_read_cmd,
             current_cmd_arg1, current_cmd_arg2);
-        finish_current_cmd(CMD_RESP_STATUS_DATA_COL_IN_PROGRESS);
+    }
+    finish_current_cmd(CMD_RESP_STATUS_IN_PROGRESS);
+}
+
+/*
+Starts a bulk read of a memory range, replacing any previous session.
+arg1 - start address
+arg2 - number of bytes
+Responds with the number of frames (2 bytes) and the number of data bytes per
+    frame (1 byte). Then the command streams the frames of the window back to
+    back (re-enqueued with CMD_BULK_READ_CONT set). Each frame has status
+    CMD_RESP_STATUS_BULK_FRAME, a 2 byte sequence number and the data.
+When the window has been sent, streaming stops until ground sends
+    ack_bulk_read_cmd with the frames it received.
+*/
+void start_bulk_read_fn(void) {
+    if (current_cmd_arg1 & CMD_BULK_READ_CONT) {
+        send_bulk_read_frame();
+        return;
+    }
+
+    // Enforce a non-empty range that does not go past the last address
+    if (current_cmd_arg2 == 0 || current_cmd_arg1 >= MEM_NUM_ADDRESSES ||
+            current_cmd_arg2 > MEM_NUM_ADDRESSES - current_cmd_arg1) {
+        add_def_trans_tx_dec_msg(CMD_RESP_STATUS_INVALID_ARGS);
+        finish_current_cmd(CMD_RESP_STATUS_INVALID_ARGS);
+        return;
+    }
+
+    bulk_read.active = true;
+    bulk_read.cmd_id = current_cmd_id;
+    bulk_read.start_addr = current_cmd_arg1;
+    bulk_read.num_bytes = current_cmd_arg2;
+    bulk_read.num_frames = (current_cmd_arg2 + CMD_BULK_READ_FRAME_SIZE - 1) /
+        CMD_BULK_READ_FRAME_SIZE;
+    bulk_read.base_seq = 0;
+    bulk_read.acked = 0;
+    bulk_read.sent = 0;
+
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        start_trans_tx_resp(CMD_RESP_STATUS_OK);
+        append_to_trans_tx_resp((bulk_read.num_frames >> 8) & 0xFF);
+        append_to_trans_tx_resp(bulk_read.num_frames & 0xFF);
+        append_to_trans_tx_resp(CMD_BULK_READ_FRAME_SIZE);
+        finish_trans_tx_resp();
+    }
+
+    enqueue_cmd_front(current_cmd_id, &start_bulk_read_cmd,
+        CMD_BULK_READ_CONT, 0);
+    finish_current_cmd(CMD_RESP_STATUS_OK);
+}
+
+/*
+Selective ACK for the current bulk read.
+arg1 - sequence number of the first frame in the bitmap
+arg2 - bitmap of the frames ground has received (bit i for frame arg1 + i)
+The window slides past the received frames at its start. All frames in the
+    window that have not been received are sent again (so an empty bitmap
+    restarts a stopped stream).
+Responds with the first frame that has not been received (2 bytes). This is
+    the number of frames when the transfer is done, which ends the session.
+*/
+void ack_bulk_read_fn(void) {
+    if (!bulk_read.active) {
+        add_def_trans_tx_dec_msg(CMD_RESP_STATUS_INVALID_ARGS);
+        finish_current_cmd(CMD_RESP_STATUS_INVALID_ARGS);
         return;
     }
 
+    for (uint8_t i = 0; i < CMD_BULK_READ_WINDOW_SIZE; i++) {
+        uint32_t seq = current_cmd_arg1 + i;
+        if ((current_cmd_arg2 & (1UL << i)) != 0 &&
+                seq >= bulk_read.base_seq &&
+                seq < (uint32_t) bulk_read.base_seq + CMD_BULK_READ_WINDOW_SIZE &&
+                seq < bulk_read.num_frames) {
+            bulk_read.acked |= 1UL << (seq - bulk_read.base_seq);
+        }
+    }
+
+    while ((bulk_read.acked & 1) != 0) {
+        bulk_read.base_seq++;
+        bulk_read.acked >>= 1;
+    }
+    bulk_read.sent = bulk_read.acked;
+
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        start_trans_tx_resp(CMD_RESP_STATUS_OK);
+        append_to_trans_tx_resp((bulk_read.base_seq >> 8) & 0xFF);
+        append_to_trans_tx_resp(bulk_read.base_seq & 0xFF);
+        finish_trans_tx_resp();
+    }
+
+    if (bulk_read.base_seq >= bulk_read.num_frames) {
+        bulk_read.active = false;
+    } else {
+        enqueue_cmd_front(bulk_read.cmd_id, &start_bulk_read_cmd,
+            CMD_BULK_READ_CONT, 0);
+    }
+    finish_current_cmd(CMD_RESP_STATUS_OK);
+}
+
+void erase_mem_phy_sector_fn(void) {
+    // Write the buffered records first so none are written into the erased
+    // range afterwards
+    flush_cmd_log();
+    erase_mem_sector(current_cmd_arg1);
+
+    // Only send a transceiver packet if the erase was initiated by the ground
+    // station
+    if (current_cmd_id != CMD_CMD_ID_AUTO_ENQUEUED) {
+        add_def_trans_tx_dec_msg(CMD_RESP_STATUS_OK);
+    }
+    finish_current_cmd(CMD_RESP_STATUS_OK);
+}
+
+void erase_mem_phy_block_fn(void) {
+    flush_cmd_log();
+    erase_mem_block(current_cmd_arg1);
+
+    add_def_trans_tx_dec_msg(CMD_RESP_STATUS_OK);
+    finish_current_cmd(CMD_RESP_STATUS_OK);
+}
+
+// This command's own log record is written again by finish_current_cmd()
+void erase_all_mem_fn(void) {
+    flush_cmd_log();
+    erase_mem();
+
+    add_def_trans_tx_dec_msg(CMD_RESP_STATUS_OK);
+    finish_current_cmd(CMD_RESP_STATUS_OK);
+}
+
+void col_data_block_obc_hk(void) {
 #ifdef COMMANDS_VERBOSE
-    print("Received field %u\n", field_num);
+    print("Start %s\n", obc_hk_data_col.name);
 #endif
 
-    // Update the current uptime for receiving this field
-    
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        data_col->prev_field_col_uptime_s = uptime_s;
+    data_col_t* data_col = &obc_hk_data_col;
+
+    // Populate header
+    // The header and fields are staged here and written to memory together
+    // by finish_current_cmd()
+    populate_header(&data_col->header,
+        data_col->mem_section->curr_block,
+        CMD_RESP_STATUS_UNKNOWN);
+    // Increment the block number
+    inc_and_prepare_mem_section_curr_block(data_col->mem_section);
+
+    // Populate fields
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        set_packed_field(data_col->fields, CAN_OBC_HK_UPTIME, uptime_s);
     }
+    set_packed_field(data_col->fields, CAN_OBC_HK_RESTART_COUNT,
+        restart_count);
+    set_packed_field(data_col->fields, CAN_OBC_HK_RESTART_REASON,
+        restart_reason);
+    set_packed_field(data_col->fields, CAN_OBC_HK_RESTART_DATE,
+        ((uint32_t) restart_date.yy << 16) |
+        ((uint32_t) restart_date.mm << 8) |
+        ((uint32_t) restart_date.dd << 0));
+    set_packed_field(data_col->fields, CAN_OBC_HK_RESTART_TIME,
+        ((uint32_t) restart_time.hh << 16) |
+        ((uint32_t) restart_time.mm << 8) |
+        ((uint32_t) restart_time.ss << 0));
+    data_col->staged_field_count = data_col->mem_section->fields_per_block;
+    data_col->flushed_field_count = 0;
 
-    // Save received field data
-    // Note that data_col->mem_section.curr_block has already been incremented,
-    // so we need to use the block number from the header that was populated
-    // at the start of this command
-    data_col->fields[field_num] = data;
-    write_mem_field(data_col->mem_section,
-        data_col->header.block_num,
-        field_num, data);
-
-    // Send request for next field if there are more fields
-    uint8_t next_field_num = field_num + 1;
-    if (next_field_num < data_col->mem_section->fields_per_block) {
-        // Enqueue CAN message
-        enqueue_tx_msg(data_col->can_tx_queue,
-            data_col->can_opcode, next_field_num, 0);
-        // Enqueue command to check for the response
-        // (note command argument 2 must be 1 greater
-        // than the field number in the CAN message)
-        enqueue_cmd(current_cmd_id,
-            &col_data_block_cmd, current_cmd_arg1,
-            next_field_num + 1);
+#ifdef COMMANDS_VERBOSE
+    print("Done %s\n", data_col->name);
+#endif
+
+    // Only send back a transceiver packet if the command was sent from
+    // ground (not auto)
+    if (current_cmd_id != CMD_CMD_ID_AUTO_ENQUEUED) {
+        PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            start_trans_tx_resp(CMD_RESP_STATUS_OK);
+            // Need to use the block number from the header because the block
+            // number for the memory section has already been incremented
+            // past the block just collected
+            append_to_trans_tx_resp((data_col->header.block_num >> 24) & 0xFF);
+            append_to_trans_tx_resp((data_col->header.block_num >> 16) & 0xFF);
+            append_to_trans_tx_resp((data_col->header.block_num >> 8) & 0xFF);
+            append_to_trans_tx_resp((data_col->header.block_num >> 0) & 0xFF);
+            finish_trans_tx_resp();
+        }
+    }
 
+    finish_current_cmd(CMD_RESP_STATUS_OK);
+    return;
+}
+
+// Field 0
+void col_data_block_other_start(data_col_t* data_col) {
 #ifdef COMMANDS_VERBOSE
-        print("Req field %u\n", next_field_num);
+    print("Start data col\n", data_col->name, cmd_field);
 #endif
 
-        finish_current_cmd(CMD_RESP_STATUS_DATA_COL_IN_PROGRESS);
+    // Only one collection of each block type can run at a time
+    if (data_col->state != DATA_COL_STATE_IDLE) {
+        if (current_cmd_id != CMD_CMD_ID_AUTO_ENQUEUED) {
+            add_def_trans_tx_dec_msg(CMD_RESP_STATUS_INVALID_ARGS);
+        }
+        finish_current_cmd(CMD_RESP_STATUS_INVALID_ARGS);
         return;
     }
 
-    // If we have received all the fields
-    else {
-        // Only send back a transceiver packet if the
-        // command was sent from ground
+    // The header is only written to memory when the fields are flushed
+    populate_header(&data_col->header,
+        data_col->mem_section->curr_block,
+        CMD_RESP_STATUS_UNKNOWN);
+    
+    // Reset all field data so we don't leave garbage data from last collection
+    memset(data_col->fields, 0,
+        data_col->mem_section->fields_per_block * MEM_BYTES_PER_FIELD);
+    for (uint8_t i = 0; i < (data_col->mem_section->fields_per_block + 7) / 8; i++) {
+        data_col->received_fields[i] = 0;
+    }
+    data_col->received_field_count = 0;
+    data_col->staged_field_count = 0;
+    data_col->flushed_field_count = 0;
+    for (uint8_t i = 0; i < CMD_COL_DATA_BLOCK_WINDOW_SIZE; i++) {
+        data_col->reqs[i].field_num = CMD_COL_DATA_BLOCK_NO_REQ;
+    }
+    data_col->next_req_field_num = 0;
+
+    // This increment invalidates the current block number for the
+    // memory section struct for the current command, so the command
+    // will need to fetch the block number from the header
+    inc_and_prepare_mem_section_curr_block(
+        data_col->mem_section);
+
+    // The rest of the fields are collected by handle_data_col_rx_msg() as the
+    // CAN responses arrive, without going through the command queue
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        // Store the current uptime before receiving first field
+        data_col->prev_field_col_uptime_s = uptime_s;
+    }
+    data_col->cmd_id = current_cmd_id;
+    data_col->finish_status = CMD_RESP_STATUS_UNKNOWN;
+    data_col->state = DATA_COL_STATE_COLLECTING;
+
+    // Request the first window of fields
+    fill_data_col_window(data_col);
+
+    finish_current_cmd(CMD_RESP_STATUS_DATA_COL_IN_PROGRESS);
+    return;
+}
+
+// Finishes the collection (after all fields were received or a field timed
+// out) - the block is committed to memory by finish_current_cmd()
+void col_data_block_other_finish(data_col_t* data_col) {
+    // Don't accept this from ground if there is no collection to finish
+    if (data_col->state != DATA_COL_STATE_FINISHING) {
         if (current_cmd_id != CMD_CMD_ID_AUTO_ENQUEUED) {
-            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            add_def_trans_tx_dec_msg(CMD_RESP_STATUS_INVALID_ARGS);
+        }
+        finish_current_cmd(CMD_RESP_STATUS_INVALID_ARGS);
+        return;
+    }
+
+    uint8_t status = data_col->finish_status;
+    data_col->state = DATA_COL_STATE_IDLE;
+
+    // Only send back a transceiver packet if the
+    // command was sent from ground
+    if (current_cmd_id != CMD_CMD_ID_AUTO_ENQUEUED) {
+        if (status == CMD_RESP_STATUS_OK) {
+            PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
                 start_trans_tx_resp(CMD_RESP_STATUS_OK);
                 append_to_trans_tx_resp((data_col->header.block_num >> 24) & 0xFF);
                 append_to_trans_tx_resp((data_col->header.block_num >> 16) & 0xFF);
@@ -886,14 +1816,15 @@ void col_data_block_other_check(data_col_t* data_col) {
                 append_to_trans_tx_resp((data_col->header.block_num >> 0) & 0xFF);
                 finish_trans_tx_resp();
             }
+        } else {
+            add_def_trans_tx_dec_msg(status);
         }
+    }
 
 #ifdef COMMANDS_VERBOSE
-        print("Done %s\n", data_col->name);
+    print("Done %s\n", data_col->name);
 #endif
-        finish_current_cmd(CMD_RESP_STATUS_OK);
-        return;
-    }
+    finish_current_cmd(status);
 }
 
 void col_data_block_other(void) {
@@ -902,8 +1833,7 @@ void col_data_block_other(void) {
 
         if (data_col->cmd_arg1 == current_cmd_arg1) {
 #ifdef COMMANDS_VERBOSE
-            print("%s: field %lu\n", data_col->name, current_cmd_arg2);
-            print("prev field uptime = %lu\n", data_col->prev_field_col_uptime_s);
+            print("%s: arg2 %lu\n", data_col->name, current_cmd_arg2);
 #endif
 
             if (current_cmd_arg2 == 0) {
@@ -911,11 +1841,8 @@ void col_data_block_other(void) {
                 return;
             }
 
-            // Checking for a CAN response
-            // If not receiving the last field, send the next request
-            else if (1 <= current_cmd_arg2 &&
-                    current_cmd_arg2 <= data_col->mem_section->fields_per_block) {
-                col_data_block_other_check(data_col);
+            else if (current_cmd_arg2 == CMD_COL_DATA_BLOCK_FINISH) {
+                col_data_block_other_finish(data_col);
                 return;
             }
         }
@@ -928,31 +1855,271 @@ void col_data_block_other(void) {
     return;
 }
 
+// Stops receiving fields and enqueues the command to finish the collection
+// If the command queue is full, run_data_cols() tries again later
+void end_data_col(data_col_t* data_col, uint8_t status) {
+    if (data_col->state == DATA_COL_STATE_COLLECTING) {
+        // Also store the fields received after a missing one - the missing
+        // ones are written as 0xFFFFFF, which leaves them erased in flash
+        uint8_t end_field = data_col->staged_field_count;
+        for (uint8_t i = end_field; i < data_col->mem_section->fields_per_block; i++) {
+            if (data_col->received_fields[i / 8] & _BV(i % 8)) {
+                end_field = i + 1;
+            }
+        }
+        for (uint8_t i = data_col->staged_field_count; i < end_field; i++) {
+            if (!(data_col->received_fields[i / 8] & _BV(i % 8))) {
+                set_packed_field(data_col->fields, i, 0xFFFFFF);
+            }
+        }
+        data_col->staged_field_count = end_field;
+
+        data_col->finish_status = status;
+        data_col->state = DATA_COL_STATE_FINISH_PENDING;
+        clear_sched_timer(data_col->req_timer);
+    }
+
+    if (enqueue_cmd(data_col->cmd_id, &col_data_block_cmd, data_col->cmd_arg1,
+            CMD_COL_DATA_BLOCK_FINISH)) {
+        data_col->state = DATA_COL_STATE_FINISHING;
+    }
+}
+
+// Sends a CAN request for the field in the given request slot
+void send_data_col_req(data_col_t* data_col, data_col_req_t* req) {
+    enqueue_tx_msg(data_col->can_tx_queue,
+        data_col->can_opcode, req->field_num, 0);
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        req->req_uptime_s = uptime_s;
+    }
+    arm_data_col_req_timer(data_col);
+
+#ifdef COMMANDS_VERBOSE
+    print("Req field %u\n", req->field_num);
+#endif
+}
 
+// Sets the field request timer to the earliest timeout of the requests waiting
+// for a response
+void arm_data_col_req_timer(data_col_t* data_col) {
+    uint32_t deadline_s = SCHED_NO_DEADLINE;
+    for (uint8_t i = 0; i < CMD_COL_DATA_BLOCK_WINDOW_SIZE; i++) {
+        data_col_req_t* req = &data_col->reqs[i];
+        if (req->field_num != CMD_COL_DATA_BLOCK_NO_REQ &&
+                req->req_uptime_s + CMD_COL_DATA_BLOCK_FIELD_TIMEOUT_S < deadline_s) {
+            deadline_s = req->req_uptime_s + CMD_COL_DATA_BLOCK_FIELD_TIMEOUT_S;
+        }
+    }
+
+    if (deadline_s == SCHED_NO_DEADLINE) {
+        clear_sched_timer(data_col->req_timer);
+    } else {
+        set_sched_timer(data_col->req_timer, deadline_s);
+    }
+}
+
+/*
+Requests fields that have not been requested yet, until there are
+    CMD_COL_DATA_BLOCK_WINDOW_SIZE requests waiting for a response (or the CAN
+    TX queue is full).
+*/
+void fill_data_col_window(data_col_t* data_col) {
+    for (uint8_t i = 0; i < CMD_COL_DATA_BLOCK_WINDOW_SIZE; i++) {
+        if (data_col->next_req_field_num >= data_col->mem_section->fields_per_block ||
+                queue_full(data_col->can_tx_queue)) {
+            return;
+        }
+
+        data_col_req_t* req = &data_col->reqs[i];
+        if (req->field_num == CMD_COL_DATA_BLOCK_NO_REQ) {
+            req->field_num = data_col->next_req_field_num;
+            req->retries = 0;
+            data_col->next_req_field_num++;
+            send_data_col_req(data_col, req);
+        }
+    }
+}
+
+/*
+Processes a received CAN message if it is a field for a collection in progress.
+Fields can arrive in any order, but only fields that are waiting for a response
+    are accepted.
+msg - 8 bytes of the CAN message
+Returns true if the message was used by a collection (should not be processed
+    any further).
+*/
+bool handle_data_col_rx_msg(uint8_t* msg) {
+    // Break down the message into components
+    uint8_t opcode = msg[0];
+    uint8_t field_num = msg[1];
+    // Don't need to check status
+    uint32_t data =
+        ((uint32_t) msg[4] << 24) |
+        ((uint32_t) msg[5] << 16) |
+        ((uint32_t) msg[6] << 8) |
+        ((uint32_t) msg[7]);
+
+    data_col_t* data_col = NULL;
+    for (uint8_t i = 0; i < NUM_DATA_COL_SECTIONS; i++) {
+        if (all_data_cols[i] != &obc_hk_data_col &&
+                all_data_cols[i]->can_opcode == opcode) {
+            data_col = all_data_cols[i];
+            break;
+        }
+    }
+    if (data_col == NULL || data_col->state != DATA_COL_STATE_COLLECTING) {
+        return false;
+    }
+
+    if (print_can_msgs) {
+        // Extra spaces to align with CAN TX messages
+        print("CAN RX (DC): ");
+        print_bytes(msg, 8);
+    }
+
+    // A field number past the end of the block can't be stored (and would
+    // match the free request slots if it is CMD_COL_DATA_BLOCK_NO_REQ)
+    if (field_num >= data_col->mem_section->fields_per_block) {
+        return true;
+    }
+
+    // If we are not waiting for this field number (e.g. a duplicate response
+    // after a retry), drop it
+    data_col_req_t* req = NULL;
+    for (uint8_t i = 0; i < CMD_COL_DATA_BLOCK_WINDOW_SIZE; i++) {
+        if (data_col->reqs[i].field_num != CMD_COL_DATA_BLOCK_NO_REQ &&
+                data_col->reqs[i].field_num == field_num) {
+            req = &data_col->reqs[i];
+            break;
+        }
+    }
+    if (req == NULL) {
+        return true;
+    }
+    req->field_num = CMD_COL_DATA_BLOCK_NO_REQ;
+
+#ifdef COMMANDS_VERBOSE
+    print("Received field %u\n", field_num);
+#endif
+
+    // Update the current uptime for receiving this field
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        data_col->prev_field_col_uptime_s = uptime_s;
+    }
+
+    // Save received field data
+    // Note that data_col->mem_section.curr_block has already been incremented,
+    // so we need to use the block number from the header that was populated
+    // at the start of this command
+    // The field is staged in RAM and written to memory later
+    set_packed_field(data_col->fields, field_num, data);
+    data_col->received_fields[field_num / 8] |= _BV(field_num % 8);
+    data_col->received_field_count++;
+
+    // Only the fields received in order can be flushed
+    while (data_col->staged_field_count < data_col->mem_section->fields_per_block &&
+            (data_col->received_fields[data_col->staged_field_count / 8] &
+                _BV(data_col->staged_field_count % 8))) {
+        data_col->staged_field_count++;
+    }
+    if (CMD_COL_DATA_BLOCK_FLUSH_FIELD_COUNT > 0 &&
+            data_col->staged_field_count <
+                data_col->mem_section->fields_per_block &&
+            data_col->staged_field_count - data_col->flushed_field_count >=
+                CMD_COL_DATA_BLOCK_FLUSH_FIELD_COUNT) {
+        flush_data_col_block(data_col);
+    }
+
+    // If we have received all the fields
+    if (data_col->received_field_count >= data_col->mem_section->fields_per_block) {
+        end_data_col(data_col, CMD_RESP_STATUS_OK);
+    }
+
+    // Send requests for the next fields if there are more fields
+    else {
+        fill_data_col_window(data_col);
+    }
+
+    return true;
+}
+
+/*
+Checks the timeout of each field request for a collection in progress,
+    requesting only the fields that timed out again (scheduler timer function,
+    set by arm_data_col_req_timer()).
+index - index of the data collection in all_data_cols
+*/
+void data_col_req_timer_cb(uint8_t index) {
+    data_col_t* data_col = all_data_cols[index];
+    if (data_col->state != DATA_COL_STATE_COLLECTING) {
+        return;
+    }
+
+    uint32_t cur_uptime = 0;
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        cur_uptime = uptime_s;
+    }
+
+    for (uint8_t j = 0; j < CMD_COL_DATA_BLOCK_WINDOW_SIZE; j++) {
+        data_col_req_t* req = &data_col->reqs[j];
+        if (req->field_num == CMD_COL_DATA_BLOCK_NO_REQ ||
+                cur_uptime < req->req_uptime_s +
+                    CMD_COL_DATA_BLOCK_FIELD_TIMEOUT_S) {
+            continue;
+        }
+
+        if (req->retries >= CMD_COL_DATA_BLOCK_FIELD_RETRIES) {
+            print("\nCOL TIMEOUT\n\n");
+            end_data_col(data_col, CMD_RESP_STATUS_TIMED_OUT);
+            return;
+        }
+
+        // Wait for space in the CAN TX queue
+        if (!queue_full(data_col->can_tx_queue)) {
+            req->retries++;
+            send_data_col_req(data_col, req);
+        }
+    }
+
+    // If a request did not fit in the CAN TX queue, its deadline has already
+    // passed, so this runs again on the next tick
+    arm_data_col_req_timer(data_col);
+}
+
+/*
+Requests fields that did not fit in the CAN TX queue before and retries
+    enqueueing the finish command for collections that could not enqueue it.
+Field timeouts are handled by data_col_req_timer_cb() instead.
+Should be called from the main loop.
+*/
+void run_data_cols(void) {
+    for (uint8_t i = 0; i < NUM_DATA_COL_SECTIONS; i++) {
+        data_col_t* data_col = all_data_cols[i];
+
+        if (data_col->state == DATA_COL_STATE_COLLECTING) {
+            fill_data_col_window(data_col);
+        }
+
+        else if (data_col->state == DATA_COL_STATE_FINISH_PENDING) {
+            end_data_col(data_col, data_col->finish_status);
+        }
+    }
+}
+
+
+// arg1 is checked to be a data col type by col_data_block_cmd.args
 void col_data_block_fn(void) {
     if (current_cmd_arg1 == CMD_OBC_HK) {
         col_data_block_obc_hk();
-        return;
     }
-
     // Not OBC_HK
-    else if (current_cmd_arg1 == CMD_EPS_HK ||
-            current_cmd_arg1 == CMD_PAY_HK ||
-            current_cmd_arg1 == CMD_PAY_OPT) {
+    else {
         col_data_block_other();
-        return;
     }
-
-    // If it doesn't match any of the data col types
-    if (current_cmd_id != CMD_CMD_ID_AUTO_ENQUEUED) {
-        add_def_trans_tx_dec_msg(CMD_RESP_STATUS_INVALID_ARGS);
-    }
-    finish_current_cmd(CMD_RESP_STATUS_INVALID_ARGS);
-    return;
 }
 
 void get_cur_block_nums_fn(void) {
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         start_trans_tx_resp(CMD_RESP_STATUS_OK);
 
         for (uint8_t i = 0; i < MEM_NUM_SECTIONS; i++) {
@@ -969,6 +2136,9 @@ void get_cur_block_nums_fn(void) {
 }
 
 void set_cur_block_num_fn(void) {
+    // Buffered records are for the blocks before this change
+    flush_cmd_log();
+
     switch (current_cmd_arg1) {
         case CMD_OBC_HK:
             prepare_mem_section_curr_block(&obc_hk_mem_section, current_cmd_arg2);
@@ -999,7 +2169,7 @@ void set_cur_block_num_fn(void) {
 }
 
 void get_mem_sec_addrs_fn(void) {
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         start_trans_tx_resp(CMD_RESP_STATUS_OK);
 
         for (uint8_t i = 0; i < MEM_NUM_SECTIONS; i++) {
@@ -1020,11 +2190,8 @@ void get_mem_sec_addrs_fn(void) {
 }
 
 void set_mem_sec_start_addr_fn(void) {
-    if (current_cmd_arg2 >= MEM_NUM_ADDRESSES) {
-        add_def_trans_tx_dec_msg(CMD_RESP_STATUS_INVALID_ARGS);
-        finish_current_cmd(CMD_RESP_STATUS_INVALID_ARGS);
-        return;
-    }
+    // Buffered records are for the blocks before this change
+    flush_cmd_log();
 
     switch (current_cmd_arg1) {
         case CMD_OBC_HK:
@@ -1062,11 +2229,8 @@ void set_mem_sec_start_addr_fn(void) {
 }
 
 void set_mem_sec_end_addr_fn(void) {
-    if (current_cmd_arg2 >= MEM_NUM_ADDRESSES) {
-        add_def_trans_tx_dec_msg(CMD_RESP_STATUS_INVALID_ARGS);
-        finish_current_cmd(CMD_RESP_STATUS_INVALID_ARGS);
-        return;
-    }
+    // Buffered records are for the blocks before this change
+    flush_cmd_log();
 
     switch (current_cmd_arg1) {
         case CMD_OBC_HK:
@@ -1104,12 +2268,12 @@ void set_mem_sec_end_addr_fn(void) {
 }
 
 void get_auto_data_col_settings_fn(void) {
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         start_trans_tx_resp(CMD_RESP_STATUS_OK);
 
         // Current system uptime
 
-        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
             append_to_trans_tx_resp((uptime_s >> 24) & 0xFF);
             append_to_trans_tx_resp((uptime_s >> 16) & 0xFF);
             append_to_trans_tx_resp((uptime_s >> 8) & 0xFF);
@@ -1139,12 +2303,6 @@ void set_auto_data_col_enable_fn(void) {
         data_col_t* data_col = all_data_cols[i];
 
         if (current_cmd_arg1 == data_col->cmd_arg1) {
-            if (current_cmd_arg2 > 1) {
-                add_def_trans_tx_dec_msg(CMD_RESP_STATUS_INVALID_ARGS);
-                finish_current_cmd(CMD_RESP_STATUS_INVALID_ARGS);
-                return;
-            }
-
             data_col->auto_enabled = current_cmd_arg2 ? true : false;
             write_eeprom(data_col->auto_enabled_eeprom_addr, (uint32_t) data_col->auto_enabled);
 
@@ -1153,9 +2311,10 @@ void set_auto_data_col_enable_fn(void) {
             // e.g. say we never enabled OBC_HK auto, so last auto time is 0,
             // say it is uptime 100s and period is 60s, it would trigger
             // immediately
-            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
                 data_col->prev_auto_col_uptime_s = uptime_s;
             }
+            update_auto_data_col_timer(data_col);
 
             add_def_trans_tx_dec_msg(CMD_RESP_STATUS_OK);
             finish_current_cmd(CMD_RESP_STATUS_OK);
@@ -1168,20 +2327,16 @@ void set_auto_data_col_enable_fn(void) {
     return;
 }
 
+// The minimum period (to not collect too quickly) is enforced by
+// set_auto_data_col_period_cmd.args
 void set_auto_data_col_period_fn(void) {
-    // Enforce minimum period to not collect too quickly
-    if (current_cmd_arg2 < CMD_AUTO_DATA_COL_MIN_PERIOD) {
-        add_def_trans_tx_dec_msg(CMD_RESP_STATUS_INVALID_ARGS);
-        finish_current_cmd(CMD_RESP_STATUS_INVALID_ARGS);
-        return;
-    }
-
     for (uint8_t i = 0; i < NUM_DATA_COL_SECTIONS; i++) {
         data_col_t* data_col = all_data_cols[i];
 
         if (current_cmd_arg1 == data_col->cmd_arg1) {
             data_col->auto_period = current_cmd_arg2;
             write_eeprom(data_col->auto_period_eeprom_addr, (uint32_t) data_col->auto_period);
+            update_auto_data_col_timer(data_col);
 
             add_def_trans_tx_dec_msg(CMD_RESP_STATUS_OK);
             finish_current_cmd(CMD_RESP_STATUS_OK);
@@ -1195,11 +2350,14 @@ void set_auto_data_col_period_fn(void) {
 }
 
 void resync_auto_data_col_timers_fn(void) {
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         for (uint8_t i = 0; i < NUM_DATA_COL_SECTIONS; i++) {
             all_data_cols[i]->prev_auto_col_uptime_s = uptime_s;
         }
     }
+    for (uint8_t i = 0; i < NUM_DATA_COL_SECTIONS; i++) {
+        update_auto_data_col_timer(all_data_cols[i]);
+    }
 
     add_def_trans_tx_dec_msg(CMD_RESP_STATUS_OK);
     finish_current_cmd(CMD_RESP_STATUS_OK);
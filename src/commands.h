@@ -8,6 +8,7 @@
 #include <timer/timer.h>
 #include <uptime/uptime.h>
 
+#include "antenna.h"
 #include "can_interface.h"
 #include "command_utilities.h"
 #include "mem.h"
@@ -21,6 +22,10 @@ extern cmd_t read_obc_eeprom_cmd;
 extern cmd_t erase_obc_eeprom_cmd;
 extern cmd_t read_obc_ram_byte_cmd;
 extern cmd_t set_indef_beacon_enable_cmd;
+extern cmd_t read_prof_stats_cmd;
+extern cmd_t read_cmd_lats_cmd;
+extern cmd_t set_trans_link_cmd;
+extern cmd_t get_ant_dep_status_cmd;
 extern cmd_t send_eps_can_msg_cmd;
 extern cmd_t send_pay_can_msg_cmd;
 extern cmd_t reset_subsys_cmd;
@@ -31,6 +36,12 @@ extern cmd_t read_rec_loc_data_block_cmd;
 extern cmd_t read_prim_cmd_blocks_cmd;
 extern cmd_t read_sec_cmd_blocks_cmd;
 extern cmd_t read_raw_mem_bytes_cmd;
+extern cmd_t read_data_block_range_cmd;
+extern cmd_t start_bulk_read_cmd;
+extern cmd_t ack_bulk_read_cmd;
+extern cmd_t agg_data_blocks_cmd;
+extern cmd_t find_data_blocks_by_time_cmd;
+extern cmd_t sync_data_blocks_cmd;
 extern cmd_t erase_mem_phy_sector_cmd;
 extern cmd_t erase_mem_phy_block_cmd;
 extern cmd_t erase_all_mem_cmd;
@@ -46,7 +57,16 @@ extern cmd_t set_auto_data_col_enable_cmd;
 extern cmd_t set_auto_data_col_period_cmd;
 extern cmd_t resync_auto_data_col_timers_cmd;
 
-extern cmd_t* all_cmds_list[];
+extern cmd_t* const all_cmds_list[];
 extern const uint8_t all_cmds_list_len;
+extern const uint8_t cmd_opcode_table[];
+#ifdef CMD_LATS
+extern cmd_lat_t cmd_lats[];
+#endif
+extern bulk_read_t bulk_read;
+
+bool handle_data_col_rx_msg(uint8_t* msg);
+void data_col_req_timer_cb(uint8_t index);
+void run_data_cols(void);
 
 #endif
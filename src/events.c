@@ -0,0 +1,65 @@
+/*
+Event flags for the main loop
+
+Instead of polling every module on each pass, the main loop only runs the
+handlers for events that are set. When no event is set, the MCU goes into idle
+sleep until the next interrupt (UART RX, CAN, or the uptime timer, which sets
+EVENT_TICK every second).
+
+A handler that leaves work behind (e.g. more messages in a queue than it
+processes in one call) must set its event again.
+*/
+
+#include "events.h"
+
+volatile uint8_t events = 0;
+
+
+/*
+Sets all events so each handler runs once after startup, and adds the uptime
+    callback for EVENT_TICK.
+*/
+void init_events(void) {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    set_event(EVENT_ALL);
+    add_uptime_callback(events_uptime_cb);
+}
+
+void events_uptime_cb(void) {
+    set_event(EVENT_TICK);
+}
+
+// Can be called from ISRs or the main loop
+void set_event(uint8_t event) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        events |= event;
+    }
+}
+
+/*
+Returns the events that are set and clears them.
+*/
+uint8_t take_events(void) {
+    uint8_t taken = 0;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        taken = events;
+        events = 0;
+    }
+    return taken;
+}
+
+/*
+Goes into idle sleep if no events are set, until an interrupt wakes up the MCU.
+Interrupts are disabled while checking so an event set by an ISR just before
+    sleeping is not missed (sleep_cpu() runs before any interrupt after sei()).
+*/
+void sleep_until_event(void) {
+    cli();
+    if (events == 0) {
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+    }
+    sei();
+}
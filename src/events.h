@@ -0,0 +1,45 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+
+#include <uptime/uptime.h>
+
+// Flags for work that is waiting for the main loop
+// Set (mostly from ISRs/callbacks) with set_event() and cleared when the main
+// loop takes them with take_events()
+
+// One second of uptime has passed
+#define EVENT_TICK          (1 << 0)
+// Encoded message received from the transceiver, or a transceiver command
+// to send, response or timeout
+#define EVENT_TRANS_RX      (1 << 1)
+// ACK or decoded response waiting to be sent to the transceiver
+#define EVENT_TRANS_TX      (1 << 2)
+// A command can be started (one was enqueued or the current one finished)
+#define EVENT_CMD           (1 << 3)
+// Message in the CAN RX queue
+#define EVENT_CAN_RX        (1 << 4)
+// Message in the EPS or PAY CAN TX queue
+#define EVENT_CAN_TX        (1 << 5)
+// Sector erase waiting to be started in the background
+#define EVENT_MEM_ERASE     (1 << 6)
+// Asynchronous I2C transaction to start, or the I2C bridge asserted INT
+#define EVENT_I2C           (1 << 7)
+
+#define EVENT_ALL           0xFF
+
+extern volatile uint8_t events;
+
+void init_events(void);
+void events_uptime_cb(void);
+void set_event(uint8_t event);
+uint8_t take_events(void);
+void sleep_until_event(void);
+
+#endif
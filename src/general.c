@@ -24,10 +24,9 @@ void init_obc_phase1_core(void) {
 
     init_queue(&eps_tx_msg_queue);
     init_queue(&pay_tx_msg_queue);
-    init_queue(&data_rx_msg_queue);
+    init_can_rx_rings();
 
-    init_queue(&cmd_queue_1);
-    init_queue(&cmd_queue_2);
+    init_cmd_queue();
 
     init_can();
     init_rx_mob(&cmd_rx_mob);
@@ -39,9 +38,13 @@ void init_obc_phase1_core(void) {
 
     init_uptime();
     init_com_timeout();
+    sync_rtc_clock();
 
     init_auto_data_col();
+    init_cmd_lats();
     add_uptime_callback(cmd_timeout_timer_cb);
+
+    init_events();
 }
 
 void init_obc_phase1_comms(void) {
@@ -52,15 +55,19 @@ void init_obc_phase1_comms(void) {
     uart_baud_rate_t previous_baud = UART_BAUD_9600;
     correct_transceiver_baud_rate(UART_BAUD_9600, &previous_baud);
     set_uart_baud_rate(UART_BAUD_9600);
+    // Then go as fast as the UART link is stable at
+    init_trans_uart_baud();
+    init_trans_link();
 }
 
 // Initializes the transceiver parts of OBC that must be delayed after initial startup
 void init_obc_phase2(void) {
-    deploy_antenna();
+    // Continues from the main loop (run_ant_dep())
+    start_ant_dep();
 }
 
 void init_phase2_delay(void) {
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         phase2_delay.in_progress = true;
 
         phase2_delay.done = false;
@@ -78,7 +85,7 @@ void init_phase2_delay(void) {
 // Delays 30 minutes before we can init comms
 // Fetches previous value in EEPROM to see if we have already finished this
 void run_phase2_delay(void) {
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         if (!phase2_delay.in_progress) {
             return;
         }
@@ -13,9 +13,12 @@
 #include "antenna.h"
 #include "can_interface.h"
 #include "commands.h"
+#include "events.h"
+#include "profiler.h"
 #include "i2c.h"
 #include "mem.h"
 #include "rtc.h"
+#include "sched.h"
 #include "transceiver.h"
 
 
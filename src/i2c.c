@@ -26,8 +26,15 @@ NOTE: There are inconsistencies in representing I2C addresses. Some use the
     functions in this library take 7-bit addresses as input and shift it left by
     1 bit within the function.
 
-For interrupts (e.g. when read and write operations complete), we can just poll
-    because we are blocking in a loop until the operation is finished anyways.
+There are two ways to run a transaction:
+- write_i2c()/read_i2c() block until the bridge asserts INT (polling the pin)
+- enqueue_i2c_write()/enqueue_i2c_read() add it to a queue and return right
+  away. The INT pin change interrupt sets EVENT_I2C, then run_i2c() in the main
+  loop reads the status (and buffer for a read) and calls the callback. The
+  bridge is only accessed from the main loop since the SPI bus is shared with
+  the flash memory and RTC, so a transaction can't be interrupted in the middle.
+  Don't use the blocking functions while asynchronous transactions are waiting
+  (see i2c_trans_idle()).
 
 - Not implementing read after write or write after write
 - Default I2CClk register is 0x19 (p. 5) -> 73.728 kHz (p. 9)
@@ -38,11 +45,15 @@ addition to the normal 3.3V power!
 
 #include "i2c.h"
 
-// CS pin connection
-pin_info_t i2c_cs = {
-    .port = &I2C_CS_PORT,
-    .ddr = &I2C_CS_DDR,
-    .pin = I2C_CS_PIN
+// SPI settings and CS pin connection (SPI mode 3, p. 1,5)
+spi_dev_t i2c_spi_dev = {
+    .cs = {
+        .port = &I2C_CS_PORT,
+        .ddr = &I2C_CS_DDR,
+        .pin = I2C_CS_PIN
+    },
+    .mode = 3,
+    .clk = SPI_BUS_CLK_DEFAULT
 };
 
 // RESETn pin connection
@@ -65,12 +76,24 @@ pin_info_t i2c_wakeup = {
     .pin = I2C_WAKEUP_PIN
 };
 
+// Asynchronous transactions, oldest first (circular buffer)
+i2c_trans_t i2c_trans_queue[I2C_QUEUE_SIZE];
+uint8_t i2c_trans_head = 0;
+uint8_t i2c_trans_count = 0;
+// True if the transaction at the head was sent to the bridge and we are
+// waiting for INT
+bool i2c_trans_started = false;
+uint32_t i2c_trans_start_s = 0;
+// Set by the INT pin interrupt
+volatile bool i2c_int_flag = false;
+
 
 /*
 Initializes the microcontroller's output pin for the I2C bridge.
 */
 void init_i2c(void) {
     init_i2c_pins();
+    init_i2c_trans_queue();
     init_i2c_int();
 
     // Reset the I2C bridge
@@ -83,7 +106,7 @@ void init_i2c(void) {
 
 void init_i2c_pins(void) {
     // Initialize the CS output pin
-    init_cs(i2c_cs.pin, i2c_cs.ddr);
+    init_spi_dev(&i2c_spi_dev);
     // Initialize reset pin (default high - not active)
     init_output_pin(i2c_reset.pin, i2c_reset.ddr, 1);
     // Initialize interrupt pin
@@ -135,19 +158,18 @@ void power_up_i2c(void) {
 }
 
 /*
-Sets SPI to mode 3 (p. 1,5) and sets chip select low.
+Sets up SPI for the bridge (if another device changed it) and sets chip select
+    low.
 */
 void start_i2c_spi(void) {
-    set_spi_mode(3);
-    set_cs_low(i2c_cs.pin, i2c_cs.port);
+    start_spi_dev(&i2c_spi_dev);
 }
 
 /*
-Resets the SPI mode and sets chip select high.
+Sets chip select high.
 */
 void end_i2c_spi(void) {
-    set_cs_high(i2c_cs.pin, i2c_cs.port);
-    reset_spi_mode();
+    end_spi_dev(&i2c_spi_dev);
 }
 
 /*
@@ -314,12 +336,198 @@ uint8_t read_i2c(uint8_t addr, uint8_t* data, uint8_t len, uint8_t* status) {
     return 1;
 }
 
+void init_i2c_trans_queue(void) {
+    i2c_trans_head = 0;
+    i2c_trans_count = 0;
+    i2c_trans_started = false;
+    i2c_int_flag = false;
+}
+
+// Returns true if there are no asynchronous transactions waiting or in progress
+bool i2c_trans_idle(void) {
+    return i2c_trans_count == 0;
+}
+
+// Returns the next free slot in the queue, or NULL if it is full
+static i2c_trans_t* alloc_i2c_trans(uint8_t addr, bool read, uint8_t len,
+        i2c_cb_t cb) {
+    if (i2c_trans_count >= I2C_QUEUE_SIZE || len == 0 ||
+            len > I2C_MAX_DATA_LEN) {
+        return NULL;
+    }
+
+    i2c_trans_t* trans = &i2c_trans_queue[
+        (i2c_trans_head + i2c_trans_count) % I2C_QUEUE_SIZE];
+    trans->addr = addr;
+    trans->read = read;
+    trans->len = len;
+    trans->cb = cb;
+    return trans;
+}
+
+/*
+Adds a write I2C command to the asynchronous queue.
+addr - 7-bit slave address
+data - array of data bytes to write (`len` bytes long, copied so it doesn't
+    need to stay allocated)
+len - number of data bytes to send (at most I2C_MAX_DATA_LEN)
+cb - called when the transaction finishes (can be NULL)
+Returns - true if it was added, false if the queue is full or len is invalid
+*/
+bool enqueue_i2c_write(uint8_t addr, const uint8_t* data, uint8_t len,
+        i2c_cb_t cb) {
+    i2c_trans_t* trans = alloc_i2c_trans(addr, false, len, cb);
+    if (trans == NULL) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < len; i++) {
+        trans->data[i] = data[i];
+    }
+    i2c_trans_count++;
+    set_event(EVENT_I2C);
+    return true;
+}
+
+/*
+Adds a read I2C command to the asynchronous queue.
+addr - 7-bit slave address
+len - number of data bytes to read (at most I2C_MAX_DATA_LEN)
+cb - called with the data read when the transaction finishes (can be NULL)
+Returns - true if it was added, false if the queue is full or len is invalid
+*/
+bool enqueue_i2c_read(uint8_t addr, uint8_t len, i2c_cb_t cb) {
+    if (alloc_i2c_trans(addr, true, len, cb) == NULL) {
+        return false;
+    }
+
+    i2c_trans_count++;
+    set_event(EVENT_I2C);
+    return true;
+}
+
+// Sends the command for the transaction at the head of the queue
+static void start_i2c_trans(i2c_trans_t* trans) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        i2c_int_flag = false;
+        i2c_trans_start_s = uptime_s;
+    }
+
+    start_i2c_spi();
+    send_spi(trans->read ? I2C_READ : I2C_WRITE);
+    send_spi(trans->len);
+    send_spi(trans->addr << 1);
+    if (!trans->read) {
+        for (uint8_t i = 0; i < trans->len; i++) {
+            send_spi(trans->data[i]);
+        }
+    }
+    end_i2c_spi();
+
+    i2c_trans_started = true;
+}
+
+// Removes the transaction at the head of the queue and calls its callback
+static void finish_i2c_trans(bool success, uint8_t status) {
+    i2c_trans_t* trans = &i2c_trans_queue[i2c_trans_head];
+
+    // Copy these first so the callback can enqueue another transaction in
+    // this slot
+    i2c_cb_t cb = trans->cb;
+    uint8_t len = trans->len;
+    uint8_t data[I2C_MAX_DATA_LEN];
+    for (uint8_t i = 0; i < len; i++) {
+        data[i] = trans->data[i];
+    }
+
+    i2c_trans_head = (i2c_trans_head + 1) % I2C_QUEUE_SIZE;
+    i2c_trans_count--;
+    i2c_trans_started = false;
+
+    if (cb != NULL) {
+        cb(success, status, data, len);
+    }
+    if (i2c_trans_count > 0) {
+        set_event(EVENT_I2C);
+    }
+}
+
+/*
+Advances the asynchronous transaction queue (call on EVENT_I2C and EVENT_TICK).
+This only does a few short SPI transactions and never waits for the bridge -
+    if it isn't done yet, this function runs again when INT is asserted or on
+    the next second (to check the timeout).
+*/
+void run_i2c(void) {
+    if (i2c_trans_count == 0) {
+        return;
+    }
+
+    i2c_trans_t* trans = &i2c_trans_queue[i2c_trans_head];
+    uint32_t now_s = 0;
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        now_s = uptime_s;
+    }
+
+    if (!i2c_trans_started) {
+        // The bridge could still be busy with a blocking transaction that
+        // timed out, try again on the next second
+        if (read_i2c_reg(I2C_STAT) == I2C_BUSY) {
+            return;
+        }
+        start_i2c_trans(trans);
+        return;
+    }
+
+    bool asserted = false;
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        asserted = i2c_int_flag;
+        i2c_int_flag = false;
+    }
+    // Also check the pin level in case the interrupt was missed (INT stays low
+    // until the status register is read)
+    if (!asserted && get_pin_val(i2c_int.pin, i2c_int.port)) {
+        if (now_s - i2c_trans_start_s >= I2C_TIMEOUT_S) {
+            finish_i2c_trans(false, 0);
+        }
+        return;
+    }
+
+    // Reading the status register also clears INT (p. 10)
+    // For a read, the buffer is read in the same batch (it is only used if
+    // the status is successful)
+    // Each byte is sent before the one received replaces it, so the same
+    // buffers are used for both
+    uint8_t stat[3] = { I2C_READ_REG, I2C_STAT, 0x00 };
+    uint8_t buf[1 + I2C_MAX_DATA_LEN] = { I2C_READ_BUF };
+    spi_trans_t batch[2] = {
+        { .tx = stat, .rx = stat, .len = sizeof(stat) },
+        { .tx = buf, .rx = buf, .len = 1 + trans->len },
+    };
+    run_spi_batch(&i2c_spi_dev, batch, trans->read ? 2 : 1);
+
+    uint8_t status = stat[2];
+    if (status == I2C_BUSY) {
+        return;
+    }
+    if (trans->read && status == I2C_SUCCESS) {
+        for (uint8_t i = 0; i < trans->len; i++) {
+            trans->data[i] = buf[1 + i];
+        }
+    }
+    finish_i2c_trans(status == I2C_SUCCESS, status);
+}
+
 // Interrupt service routine for pin change interrupt (INT pin)
+// The bridge sets INT low when a transaction finishes, the rest is handled in
+// the main loop by run_i2c() (the blocking functions just poll the pin)
 // Can uncomment the print statement to test the INT pin with an interrupt
 // vector
-// Can use for testing, but this is not needed since the logic just blocks until
-// the interrupt is asserted (INT goes low)
 ISR(PCINT2_vect) {
     // print("\nPCINT2: pin = %u, PIND = %.2x\n",
     //     get_pin_val(i2c_int.pin, i2c_int.port), PIND);
+    if (i2c_trans_started && !get_pin_val(i2c_int.pin, i2c_int.port)) {
+        i2c_int_flag = true;
+        set_event(EVENT_I2C);
+    }
 }
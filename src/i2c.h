@@ -9,6 +9,11 @@
 #include <spi/spi.h>
 #include <uart/uart.h>
 #include <utilities/utilities.h>
+#include <uptime/uptime.h>
+
+#include "events.h"
+#include "profiler.h"
+#include "spi_bus.h"
 
 // CS output pin
 #define I2C_CS_PIN  PD1
@@ -57,6 +62,35 @@
 #define I2C_TIME_OUT        0xF8
 #define I2C_INVALID_COUNT   0xF9
 
+// Asynchronous transactions
+// Maximum number of transactions waiting (including the one in progress)
+#define I2C_QUEUE_SIZE          4
+// Maximum number of data bytes for one transaction
+#define I2C_MAX_DATA_LEN        8
+// Give up on a transaction if INT has not been asserted for this many seconds
+// (the status/data bytes passed to the callback are not valid)
+#define I2C_TIMEOUT_S           2
+
+/*
+Called from the main loop (run_i2c()) when an asynchronous transaction
+    finishes.
+success - true if the status register was I2C_SUCCESS
+status - status register value (0 if the transaction timed out)
+data - for a read, the bytes read from the bridge's buffer (`len` bytes, only
+    valid during the callback)
+*/
+typedef void (*i2c_cb_t)(bool success, uint8_t status, uint8_t* data,
+    uint8_t len);
+
+typedef struct {
+    uint8_t addr;
+    bool read;
+    uint8_t len;
+    // Data to write, or the data read
+    uint8_t data[I2C_MAX_DATA_LEN];
+    i2c_cb_t cb;
+} i2c_trans_t;
+
 
 void init_i2c(void);
 void init_i2c_pins(void);
@@ -79,4 +113,11 @@ uint8_t wait_for_i2c_not_busy(void);
 uint8_t write_i2c(uint8_t addr, uint8_t* data, uint8_t len, uint8_t* status);
 uint8_t read_i2c(uint8_t addr, uint8_t* data, uint8_t len, uint8_t* status);
 
+void init_i2c_trans_queue(void);
+bool i2c_trans_idle(void);
+bool enqueue_i2c_write(uint8_t addr, const uint8_t* data, uint8_t len,
+    i2c_cb_t cb);
+bool enqueue_i2c_read(uint8_t addr, uint8_t len, i2c_cb_t cb);
+void run_i2c(void);
+
 #endif
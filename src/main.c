@@ -12,27 +12,78 @@ int main(void) {
     while (1) {
         WDT_ENABLE_SYS_RESET(WDTO_8S);
 
-        run_phase2_delay();
+        // Heartbeat messages are handled by lib-common, so check it every
+        // time an interrupt wakes up the loop
+        PROF_STAGE(PROF_STAGE_HB, run_hb());
 
-        run_hb();
+        // Only run the handlers with work waiting (see events.h)
+        uint8_t pending = take_events();
 
-        run_auto_data_col();
+        if (pending & EVENT_TICK) {
+            PROF_STAGE(PROF_STAGE_TICK,
+                run_phase2_delay();
+                run_ant_dep();
+                run_rtc_clock();
+                run_sched();
+                run_cmd_lats());
+        }
 
-        decode_trans_rx_msg();
-        handle_trans_rx_dec_msg();
+        if (pending & EVENT_TRANS_RX) {
+            PROF_STAGE(PROF_STAGE_TRANS_RX,
+                decode_trans_rx_msg();
+                handle_trans_rx_dec_msg();
+                run_trans_link();
+                run_trans_beacon();
+                run_trans_cmds());
+        }
 
-        process_trans_tx_ack();
-        encode_trans_tx_msg();
-        send_trans_tx_enc_msg();
+        if (pending & EVENT_CMD) {
+            // Don't time out or start a command until the previous response
+            // has been encoded so it can't be overwritten
+            // (encode_trans_tx_msg() sets EVENT_CMD again)
+            if (!trans_tx_dec_avail) {
+                PROF_STAGE(PROF_STAGE_CMD, run_cmd_timeout());
+            }
+            if (!trans_tx_dec_avail) {
+                PROF_STAGE(PROF_STAGE_CMD, execute_next_cmd());
+            }
+            PROF_STAGE(PROF_STAGE_CMD_LOG, run_cmd_log());
+        }
 
-        execute_next_cmd();
+        if (pending & EVENT_MEM_ERASE) {
+            PROF_STAGE(PROF_STAGE_MEM_ERASE, run_mem_erase());
+        }
 
-        send_next_eps_tx_msg();
-        send_next_pay_tx_msg();
-        process_next_rx_msg();
+        // Not profiled separately (there is no room for another stage), this
+        // only does a few short SPI transactions
+        if (pending & (EVENT_TICK | EVENT_I2C)) {
+            run_i2c();
+        }
 
-        encode_trans_tx_msg();
-        send_trans_tx_enc_msg();
+        if (pending & EVENT_CAN_TX) {
+            PROF_STAGE(PROF_STAGE_CAN_TX,
+                send_next_eps_tx_msg();
+                send_next_pay_tx_msg());
+        }
+
+        if (pending & EVENT_CAN_RX) {
+            PROF_STAGE(PROF_STAGE_CAN_RX, process_next_rx_msg());
+        }
+
+        // Retries for requests or finish commands that did not fit in a queue
+        // (field timeouts are scheduler timers, see data_col_req_timer_cb())
+        if (pending & (EVENT_TICK | EVENT_CMD | EVENT_CAN_RX)) {
+            PROF_STAGE(PROF_STAGE_DATA_COLS, run_data_cols());
+        }
+
+        if (pending & EVENT_TRANS_TX) {
+            PROF_STAGE(PROF_STAGE_TRANS_TX,
+                process_trans_tx_ack();
+                encode_trans_tx_msg();
+                send_trans_tx_enc_msg());
+        }
+
+        sleep_until_event();
     }
 
     return 0;
@@ -20,26 +20,86 @@ Flash is designed so that you can erase large sections at once, which means sett
 // #define MEM_DEBUG
 
 
-// Chip selects for each of the memory chips
-pin_info_t mem_cs[MEM_NUM_CHIPS] = {
-    {
-        .port = &MEM_CS_PORT,
-        .ddr = &MEM_CS_DDR,
-        .pin = MEM_CHIP0_CS_PIN
-    },
-
-    {
-        .port = &MEM_CS_PORT,
-        .ddr = &MEM_CS_DDR,
-        .pin = MEM_CHIP1_CS_PIN
-    },
-
-    {
-        .port = &MEM_CS_PORT,
-        .ddr = &MEM_CS_DDR,
-        .pin = MEM_CHIP2_CS_PIN
+// SPI settings and chip selects for each of the memory chips (SPI mode 0)
+#define MEM_SPI_DEV(cs_pin, clk_freq) \
+    { \
+        .cs = { \
+            .port = &MEM_CS_PORT, \
+            .ddr = &MEM_CS_DDR, \
+            .pin = (cs_pin) \
+        }, \
+        .mode = 0, \
+        .clk = (clk_freq) \
     }
+
+spi_dev_t mem_spi_devs[MEM_NUM_CHIPS] = {
+    MEM_SPI_DEV(MEM_CHIP0_CS_PIN, SPI_BUS_CLK_DEFAULT),
+    MEM_SPI_DEV(MEM_CHIP1_CS_PIN, SPI_BUS_CLK_DEFAULT),
+    MEM_SPI_DEV(MEM_CHIP2_CS_PIN, SPI_BUS_CLK_DEFAULT),
+};
+
+/*
+1 if a page program has been started on the chip and we have not yet confirmed
+it finished. The BUSY bit is only polled right before the next operation on
+that chip (see wait_for_mem_ready()), so the CPU can return to the main loop
+while the chip is programming.
+*/
+uint8_t mem_chip_busy[MEM_NUM_CHIPS] = { 0 };
+
+// Sector numbers waiting for a background erase to be started (in order)
+uint32_t mem_erase_queue[MEM_ERASE_QUEUE_SIZE];
+uint8_t mem_erase_queue_count = 0;
+
+// Index of the next record to write in the EEPROM journal
+uint16_t mem_journal_head = 0;
+// Lap bit to use for the next record (flips every time the journal wraps around)
+uint8_t mem_journal_lap = 0;
+
+// Block caches (PAY_OPT does not have one to save RAM - its most recent block
+// is already kept in pay_opt_data_col)
+uint8_t obc_hk_mem_cache_bytes[MEM_OBC_HK_BYTES_PER_BLOCK + MEM_BYTES_PER_CRC];
+#ifndef MEM_EPS_HK_COMPRESSED
+uint8_t eps_hk_mem_cache_bytes[MEM_EPS_HK_BYTES_PER_BLOCK + MEM_BYTES_PER_CRC];
+#endif
+uint8_t pay_hk_mem_cache_bytes[MEM_PAY_HK_BYTES_PER_BLOCK + MEM_BYTES_PER_CRC];
+uint8_t prim_cmd_log_mem_cache_bytes[MEM_CMD_LOG_BYTES_PER_BLOCK];
+uint8_t sec_cmd_log_mem_cache_bytes[MEM_CMD_LOG_BYTES_PER_BLOCK];
+
+mem_block_cache_t obc_hk_mem_cache = {
+    .valid = false,
+    .block_num = 0,
+    .bytes = obc_hk_mem_cache_bytes
+};
+#ifndef MEM_EPS_HK_COMPRESSED
+mem_block_cache_t eps_hk_mem_cache = {
+    .valid = false,
+    .block_num = 0,
+    .bytes = eps_hk_mem_cache_bytes
+};
+#endif
+mem_block_cache_t pay_hk_mem_cache = {
+    .valid = false,
+    .block_num = 0,
+    .bytes = pay_hk_mem_cache_bytes
+};
+mem_block_cache_t prim_cmd_log_mem_cache = {
+    .valid = false,
+    .block_num = 0,
+    .bytes = prim_cmd_log_mem_cache_bytes
+};
+mem_block_cache_t sec_cmd_log_mem_cache = {
+    .valid = false,
+    .block_num = 0,
+    .bytes = sec_cmd_log_mem_cache_bytes
+};
+
+#ifdef MEM_EPS_HK_COMPRESSED
+mem_compressed_state_t eps_hk_mem_compressed = {
+    .write_addr = MEM_EPS_HK_START_ADDR,
+    .resync = true,
+    .prev_block_num = MEM_ERASED_BLOCK_NUM
 };
+#endif
 
 
 mem_section_t obc_hk_mem_section = {
@@ -49,7 +109,17 @@ mem_section_t obc_hk_mem_section = {
     .end_addr_eeprom_addr = MEM_OBC_HK_END_ADDR_EEPROM_ADDR,
     .curr_block = 0,
     .curr_block_eeprom_addr = MEM_OBC_HK_CURR_BLOCK_EEPROM_ADDR,
-    .fields_per_block = CAN_OBC_HK_FIELD_COUNT
+    .fields_per_block = CAN_OBC_HK_FIELD_COUNT,
+    .stripes = 1,
+#ifdef MEM_DATA_BLOCK_CRC
+    .block_crc = true,
+#else
+    .block_crc = false,
+#endif
+    .erase_ahead_sector = 0,
+    .erase_retry_sector = MEM_ERASE_NO_RETRY,
+    .cache = &obc_hk_mem_cache,
+    .compressed = NULL
 };
 
 mem_section_t eps_hk_mem_section = {
@@ -59,7 +129,22 @@ mem_section_t eps_hk_mem_section = {
     .end_addr_eeprom_addr = MEM_EPS_HK_END_ADDR_EEPROM_ADDR,
     .curr_block = 0,
     .curr_block_eeprom_addr = MEM_EPS_HK_CURR_BLOCK_EEPROM_ADDR,
-    .fields_per_block = CAN_EPS_HK_FIELD_COUNT
+    .fields_per_block = CAN_EPS_HK_FIELD_COUNT,
+    .stripes = 1,
+#ifdef MEM_DATA_BLOCK_CRC
+    .block_crc = true,
+#else
+    .block_crc = false,
+#endif
+    .erase_ahead_sector = 0,
+    .erase_retry_sector = MEM_ERASE_NO_RETRY,
+#ifdef MEM_EPS_HK_COMPRESSED
+    .cache = NULL,
+    .compressed = &eps_hk_mem_compressed
+#else
+    .cache = &eps_hk_mem_cache,
+    .compressed = NULL
+#endif
 };
 
 mem_section_t pay_hk_mem_section = {
@@ -69,7 +154,17 @@ mem_section_t pay_hk_mem_section = {
     .end_addr_eeprom_addr = MEM_PAY_HK_END_ADDR_EEPROM_ADDR,
     .curr_block = 0,
     .curr_block_eeprom_addr = MEM_PAY_HK_CURR_BLOCK_EEPROM_ADDR,
-    .fields_per_block = CAN_PAY_HK_FIELD_COUNT
+    .fields_per_block = CAN_PAY_HK_FIELD_COUNT,
+    .stripes = 1,
+#ifdef MEM_DATA_BLOCK_CRC
+    .block_crc = true,
+#else
+    .block_crc = false,
+#endif
+    .erase_ahead_sector = 0,
+    .erase_retry_sector = MEM_ERASE_NO_RETRY,
+    .cache = &pay_hk_mem_cache,
+    .compressed = NULL
 };
 
 mem_section_t pay_opt_mem_section = {
@@ -79,7 +174,21 @@ mem_section_t pay_opt_mem_section = {
     .end_addr_eeprom_addr = MEM_PAY_OPT_END_ADDR_EEPROM_ADDR,
     .curr_block = 0,
     .curr_block_eeprom_addr = MEM_PAY_OPT_CURR_BLOCK_EEPROM_ADDR,
-    .fields_per_block = CAN_PAY_OPT_TOT_FIELD_COUNT
+    .fields_per_block = CAN_PAY_OPT_TOT_FIELD_COUNT,
+#ifdef MEM_PAY_OPT_STRIPED
+    .stripes = MEM_PAY_OPT_STRIPES,
+#else
+    .stripes = 1,
+#endif
+#ifdef MEM_DATA_BLOCK_CRC
+    .block_crc = true,
+#else
+    .block_crc = false,
+#endif
+    .erase_ahead_sector = 0,
+    .erase_retry_sector = MEM_ERASE_NO_RETRY,
+    .cache = NULL,
+    .compressed = NULL
 };
 
 mem_section_t prim_cmd_log_mem_section = {
@@ -89,7 +198,13 @@ mem_section_t prim_cmd_log_mem_section = {
     .end_addr_eeprom_addr = MEM_PRIM_CMD_LOG_END_ADDR_EEPROM_ADDR,
     .curr_block = 0,
     .curr_block_eeprom_addr = MEM_PRIM_CMD_LOG_CURR_BLOCK_EEPROM_ADDR,
-    .fields_per_block = 1   // don't care
+    .fields_per_block = 1,  // don't care
+    .stripes = 1,
+    .block_crc = false,
+    .erase_ahead_sector = 0,
+    .erase_retry_sector = MEM_ERASE_NO_RETRY,
+    .cache = &prim_cmd_log_mem_cache,
+    .compressed = NULL
 };
 
 mem_section_t sec_cmd_log_mem_section = {
@@ -99,7 +214,13 @@ mem_section_t sec_cmd_log_mem_section = {
     .end_addr_eeprom_addr = MEM_SEC_CMD_LOG_END_ADDR_EEPROM_ADDR,
     .curr_block = 0,
     .curr_block_eeprom_addr = MEM_SEC_CMD_LOG_CURR_BLOCK_EEPROM_ADDR,
-    .fields_per_block = 1   // don't care
+    .fields_per_block = 1,  // don't care
+    .stripes = 1,
+    .block_crc = false,
+    .erase_ahead_sector = 0,
+    .erase_retry_sector = MEM_ERASE_NO_RETRY,
+    .cache = &sec_cmd_log_mem_cache,
+    .compressed = NULL
 };
 
 // All memory sections
@@ -117,19 +238,20 @@ mem_section_t* all_mem_sections[MEM_NUM_SECTIONS] = {
 void init_mem(void){
 /*
     intializes the chip select pin, unlocks (un-write protects)
-    NOTE: this function DOES NOT read from EEPROM - need to call
-    write_all_mem_sections_eeprom() and read_all_mem_sections_eeprom() separately
+    reads all section data from EEPROM and checks each section's current
+    block number against the block headers in flash
 */
     // initialize the Chip Select pins
     for (uint8_t i = 0; i < MEM_NUM_CHIPS; i++) {
-        init_cs(mem_cs[i].pin, mem_cs[i].ddr);
-        set_cs_high(mem_cs[i].pin, mem_cs[i].port);
+        init_spi_dev(&mem_spi_devs[i]);
     }
 
     unlock_mem(); //use global unlock to unlock memory
 
     // Read all previously stored EEPROM data
     read_all_mem_sections_eeprom();
+    // Make sure the block numbers from EEPROM don't point at written data
+    recover_all_mem_sections_curr_block();
 }
 
 /*
@@ -150,19 +272,36 @@ void clear_mem_header(mem_header_t* header) {
     header->status = 0xFF;
 }
 
+/*
+Sets the header to what is read from a block that has not been written.
+*/
+void set_mem_header_erased(mem_header_t* header) {
+    header->block_num = MEM_ERASED_BLOCK_NUM;
+    header->date.yy = 0xFF;
+    header->date.mm = 0xFF;
+    header->date.dd = 0xFF;
+    header->time.hh = 0xFF;
+    header->time.mm = 0xFF;
+    header->time.ss = 0xFF;
+    header->status = 0xFF;
+}
+
 
 
 /*
-writes the current block number of `section` to its designated address in EEPROM
+writes the current block number, start address, and end address of `section`
+to their designated addresses in EEPROM
+the current block number is written as a journal record (see append_mem_journal())
 */
 void write_mem_section_eeprom(mem_section_t* section) {
-    write_eeprom(section->curr_block_eeprom_addr, section->curr_block);
+    append_mem_journal(section);
     write_eeprom(section->start_addr_eeprom_addr, section->start_addr);
     write_eeprom(section->end_addr_eeprom_addr, section->end_addr);
 }
 
 /*
 reads the current block number from its designated address in EEPROM and stores it in `section`
+(the journal is checked separately by read_all_mem_sections_eeprom())
 */
 void read_mem_section_eeprom(mem_section_t* section) {
     section->curr_block = read_eeprom_or_default(
@@ -180,34 +319,202 @@ void read_all_mem_sections_eeprom(void) {
     for (uint8_t i = 0; i < MEM_NUM_SECTIONS; i++) {
         read_mem_section_eeprom(all_mem_sections[i]);
     }
+
+    init_mem_journal();
+    read_mem_journal();
 }
 
 /*
 Sets the section's current block number and writes it to EEPROM.
+Only one journal record is written (the start/end addresses did not change).
 */
 void set_mem_section_curr_block(mem_section_t* section, uint32_t curr_block) {
     section->curr_block = curr_block;
-    write_mem_section_eeprom(section);
+    append_mem_journal(section);
+}
+
+/*
+Returns the index of the section in all_mem_sections (or MEM_NUM_SECTIONS if
+    it is not found).
+*/
+uint8_t mem_section_index(mem_section_t* section) {
+    for (uint8_t i = 0; i < MEM_NUM_SECTIONS; i++) {
+        if (all_mem_sections[i] == section) {
+            return i;
+        }
+    }
+    return MEM_NUM_SECTIONS;
+}
+
+/*
+Finds the position to write the next journal record.
+Records before the head have the current lap bit and records from the head
+    onwards have the previous lap bit (or are still erased on the first lap),
+    so the head is the first record whose lap bit differs from record 0.
+*/
+void init_mem_journal(void) {
+    uint32_t first = read_eeprom(MEM_JOURNAL_START_EEPROM_ADDR);
+    if (first == EEPROM_DEF_DWORD) {
+        mem_journal_head = 0;
+        mem_journal_lap = 0;
+        return;
+    }
+
+    uint8_t lap = (first >> MEM_JOURNAL_LAP_BIT) & 0x01;
+    for (uint16_t i = 1; i < MEM_JOURNAL_NUM_RECORDS; i++) {
+        uint32_t record = read_eeprom(MEM_JOURNAL_START_EEPROM_ADDR + (i * 4));
+        if (record == EEPROM_DEF_DWORD ||
+                ((record >> MEM_JOURNAL_LAP_BIT) & 0x01) != lap) {
+            mem_journal_head = i;
+            mem_journal_lap = lap;
+            return;
+        }
+    }
+
+    // Every record is from this lap, so the next one starts a new lap
+    mem_journal_head = 0;
+    mem_journal_lap = lap ^ 0x01;
+}
+
+/*
+Sets each section's current block number from its most recent journal record
+    (searching backwards from the head). Sections without a record keep the
+    value that was already read.
+Must be called after init_mem_journal().
+*/
+void read_mem_journal(void) {
+    uint8_t found = 0;
+    uint8_t all_found = (1 << MEM_NUM_SECTIONS) - 1;
+
+    uint16_t index = mem_journal_head;
+    for (uint16_t i = 0; i < MEM_JOURNAL_NUM_RECORDS && found != all_found;
+            i++) {
+        index = (index == 0) ? (MEM_JOURNAL_NUM_RECORDS - 1) : (index - 1);
+
+        uint32_t record = read_eeprom(
+            MEM_JOURNAL_START_EEPROM_ADDR + (index * 4));
+        if (record == EEPROM_DEF_DWORD) {
+            continue;
+        }
+
+        uint8_t section_index =
+            (record >> MEM_JOURNAL_SECTION_SHIFT) & MEM_JOURNAL_SECTION_MASK;
+        if (section_index >= MEM_NUM_SECTIONS ||
+                (found & (1 << section_index))) {
+            continue;
+        }
+
+        all_mem_sections[section_index]->curr_block =
+            record & MEM_JOURNAL_BLOCK_MASK;
+        found |= (1 << section_index);
+    }
+}
+
+// Writes one record at the head of the journal and moves the head forward
+void write_mem_journal_record(uint8_t section_index, uint32_t curr_block) {
+    uint32_t record =
+        ((uint32_t) mem_journal_lap << MEM_JOURNAL_LAP_BIT) |
+        ((uint32_t) section_index << MEM_JOURNAL_SECTION_SHIFT) |
+        (curr_block & MEM_JOURNAL_BLOCK_MASK);
+    write_eeprom(MEM_JOURNAL_START_EEPROM_ADDR + (mem_journal_head * 4),
+        record);
+
+    mem_journal_head++;
+    if (mem_journal_head >= MEM_JOURNAL_NUM_RECORDS) {
+        mem_journal_head = 0;
+        mem_journal_lap ^= 0x01;
+    }
+}
+
+/*
+Writes the section's current block number as the next record in the journal.
+This is a single 32-bit EEPROM write, spread over MEM_JOURNAL_NUM_RECORDS
+    locations for wear leveling.
+Block numbers are stored as 24 bits (the same as in block headers).
+When the journal wraps around, the first records of the new lap are the
+    current block numbers of all sections, so a section that is rarely updated
+    does not lose its only record to a busy one. Until they are written, the
+    previous lap's records are still there to be read (see read_mem_journal()).
+*/
+void append_mem_journal(mem_section_t* section) {
+    uint8_t section_index = mem_section_index(section);
+    if (section_index >= MEM_NUM_SECTIONS) {
+        return;
+    }
+
+    write_mem_journal_record(section_index, section->curr_block);
+
+    if (mem_journal_head == 0) {
+        for (uint8_t i = 0; i < MEM_NUM_SECTIONS; i++) {
+            write_mem_journal_record(i, all_mem_sections[i]->curr_block);
+        }
+    }
 }
 
 /*
 Sets the section's start address and writes it to EEPROM.
 */
 void set_mem_section_start_addr(mem_section_t* section, uint32_t start_addr) {
+    if (section->cache != NULL) {
+        section->cache->valid = false;
+    }
     section->start_addr = start_addr;
     write_mem_section_eeprom(section);
+    // Find the write head within the new range
+    if (section->compressed != NULL) {
+        recover_mem_compressed_section(section);
+    }
 }
 
 /*
 Sets the section's end address and writes it to EEPROM.
 */
 void set_mem_section_end_addr(mem_section_t* section, uint32_t end_addr) {
+    if (section->cache != NULL) {
+        section->cache->valid = false;
+    }
     section->end_addr = end_addr;
     write_mem_section_eeprom(section);
+    if (section->compressed != NULL) {
+        recover_mem_compressed_section(section);
+    }
+}
+
+/*
+Returns field `field_num` of packed fields (MEM_BYTES_PER_FIELD bytes each,
+    most significant byte first, the same as in flash).
+*/
+uint32_t get_packed_field(const uint8_t* fields, uint8_t field_num) {
+    const uint8_t* bytes = &fields[field_num * MEM_BYTES_PER_FIELD];
+    return (((uint32_t) bytes[0]) << 16) |
+        (((uint32_t) bytes[1]) << 8) |
+        ((uint32_t) bytes[2]);
+}
+
+/*
+Sets field `field_num` of packed fields to the least significant 24 bits of
+    `value`.
+*/
+void set_packed_field(uint8_t* fields, uint8_t field_num, uint32_t value) {
+    uint8_t* bytes = &fields[field_num * MEM_BYTES_PER_FIELD];
+    bytes[0] = (value >> 16) & 0xFF;
+    bytes[1] = (value >> 8) & 0xFF;
+    bytes[2] = value & 0xFF;
 }
 
+/*
+Reads the header and all fields of a block (decodes it if the section is
+    compressed).
+fields - set to the packed fields (section->fields_per_block *
+    MEM_BYTES_PER_FIELD bytes)
+*/
 void read_mem_data_block(mem_section_t* section, uint32_t block_num,
-    mem_header_t* header, uint32_t* fields) {
+    mem_header_t* header, uint8_t* fields) {
+
+    if (section->compressed != NULL) {
+        read_mem_compressed_block(section, block_num, header, fields);
+        return;
+    }
 
     // print("%s: ", __FUNCTION__);
     // print("start_addr = 0x%.8lX, block_num = %lu\n", section->start_addr,
@@ -215,10 +522,10 @@ void read_mem_data_block(mem_section_t* section, uint32_t block_num,
 
     // Read header
     read_mem_header(section, block_num, header);
-    // Read fields
-    for (uint8_t i = 0; i < section->fields_per_block; i++) {
-        fields[i] = read_mem_field(section, block_num, i);
-    }
+    // The fields are stored packed, so they are read as they are
+    read_mem_section_bytes(section,
+        mem_field_section_addr(section, block_num, 0), fields,
+        section->fields_per_block * MEM_BYTES_PER_FIELD);
 }
 
 uint8_t write_mem_cmd_block(mem_section_t* section, uint32_t block_num,
@@ -231,20 +538,18 @@ uint8_t write_mem_cmd_block(mem_section_t* section, uint32_t block_num,
      * fields forming a block
      * This does NOT write the status byte (should be done separately later)
      * Returns a 1 if write was successful, 0 if not
+     * The block must be erased (it is a new block at the head of the log)
      */
 
+    start_mem_block_cache(section, block_num);
     write_mem_header_main(section, block_num, header);
 
     // calculate the address based on block number. This is the offset address from the start of the section
     uint32_t start_address = mem_cmd_section_addr(section, block_num);
 
     // write the 21 bytes of information and check if write was successful
-    uint8_t bytes[MEM_BYTES_PER_CMD] = {
-        (cmd_id >> 8) & 0xFF, cmd_id & 0xFF,
-        opcode,
-        (arg1 >> 24) & 0xFF, (arg1 >> 16) & 0xFF, (arg1 >> 8) & 0xFF, arg1 & 0xFF,
-        (arg2 >> 24) & 0xFF, (arg2 >> 16) & 0xFF, (arg2 >> 8) & 0xFF, arg2 & 0xFF
-    };
+    uint8_t bytes[MEM_BYTES_PER_CMD];
+    mem_cmd_to_bytes(cmd_id, opcode, arg1, arg2, bytes);
     if (write_mem_section_bytes(section, start_address,
         bytes, MEM_BYTES_PER_CMD)) {
         return 1;
@@ -253,6 +558,24 @@ uint8_t write_mem_cmd_block(mem_section_t* section, uint32_t block_num,
     }
 }
 
+/*
+Packs a command into its MEM_BYTES_PER_CMD bytes as stored in memory (after
+    the header).
+*/
+void mem_cmd_to_bytes(uint16_t cmd_id, uint8_t opcode, uint32_t arg1,
+        uint32_t arg2, uint8_t* bytes) {
+    bytes[0] = (cmd_id >> 8) & 0xFF;
+    bytes[1] = cmd_id & 0xFF;
+    bytes[2] = opcode;
+    bytes[3] = (arg1 >> 24) & 0xFF;
+    bytes[4] = (arg1 >> 16) & 0xFF;
+    bytes[5] = (arg1 >> 8) & 0xFF;
+    bytes[6] = arg1 & 0xFF;
+    bytes[7] = (arg2 >> 24) & 0xFF;
+    bytes[8] = (arg2 >> 16) & 0xFF;
+    bytes[9] = (arg2 >> 8) & 0xFF;
+    bytes[10] = arg2 & 0xFF;
+}
 
 void read_mem_cmd_block(mem_section_t* section, uint32_t block_num,
     mem_header_t* header, uint16_t* cmd_id,
@@ -286,6 +609,40 @@ void read_mem_cmd_block(mem_section_t* section, uint32_t block_num,
 }
 
 
+/*
+Parses the header from its MEM_BYTES_PER_HEADER bytes as stored in memory.
+*/
+void mem_bytes_to_header(uint8_t* bytes, mem_header_t* header) {
+    header->block_num =
+        (((uint32_t) bytes[0]) << 16) |
+        (((uint32_t) bytes[1]) << 8) |
+        ((uint32_t) bytes[2]);
+    header->date.yy = bytes[3];
+    header->date.mm = bytes[4];
+    header->date.dd = bytes[5];
+    header->time.hh = bytes[6];
+    header->time.mm = bytes[7];
+    header->time.ss = bytes[8];
+    header->status = bytes[MEM_STATUS_HEADER_OFFSET];
+}
+
+/*
+Splits the header into its MEM_BYTES_PER_HEADER bytes as stored in memory
+(including the status byte at MEM_STATUS_HEADER_OFFSET).
+*/
+void mem_header_to_bytes(mem_header_t* header, uint8_t* bytes) {
+    bytes[0] = (header->block_num >> 16) & 0xFF;
+    bytes[1] = (header->block_num >> 8) & 0xFF;
+    bytes[2] = header->block_num & 0xFF;
+    bytes[3] = header->date.yy;
+    bytes[4] = header->date.mm;
+    bytes[5] = header->date.dd;
+    bytes[6] = header->time.hh;
+    bytes[7] = header->time.mm;
+    bytes[8] = header->time.ss;
+    bytes[MEM_STATUS_HEADER_OFFSET] = header->status;
+}
+
 void write_mem_header_main(mem_section_t* section, uint32_t block_num,
     mem_header_t* header) {
 
@@ -296,23 +653,170 @@ void write_mem_header_main(mem_section_t* section, uint32_t block_num,
     this does NOT write the status byte (should be written separately)
     */
 
-    uint8_t bytes[MEM_BYTES_PER_HEADER - 1] = {
-        (header->block_num >> 16) & 0xFF,
-        (header->block_num >> 8) & 0xFF,
-        header->block_num & 0xFF,
-        header->date.yy, header->date.mm, header->date.dd,
-        header->time.hh, header->time.mm, header->time.ss,
-    };
+    uint8_t bytes[MEM_BYTES_PER_HEADER];
+    mem_header_to_bytes(header, bytes);
 
     write_mem_section_bytes(section,
         mem_block_section_addr(section, block_num),
         bytes, MEM_BYTES_PER_HEADER - 1);
 }
 
+/*
+Returns true if the block's header has never been written (erased block number
+    and status). Anything else (including garbage) counts as written, so it
+    will not be overwritten.
+*/
+bool is_mem_block_erased(mem_section_t* section, uint32_t block_num) {
+    mem_header_t header;
+    read_mem_header(section, block_num, &header);
+    return header.block_num == MEM_ERASED_BLOCK_NUM && header.status == 0xFF;
+}
+
+/*
+Returns the first erased block after start_block (wrapping around to the
+    start of the section), reading every header on the way. Returns
+    start_block if every block is written.
+*/
+uint32_t scan_mem_section_head(mem_section_t* section, uint32_t start_block) {
+    uint32_t num_blocks = mem_section_num_blocks(section);
+    uint32_t block_num = start_block;
+    for (uint32_t i = 1; i < num_blocks; i++) {
+        block_num++;
+        if (block_num >= num_blocks) {
+            block_num = 0;
+        }
+        if (is_mem_block_erased(section, block_num)) {
+            return block_num;
+        }
+    }
+    return start_block;
+}
+
+/*
+Finds the write head of the section - the first erased block after the most
+    recently written block - using the block headers in flash.
+start_block - block number to start searching from (normally the value from
+    EEPROM). If it is already erased, it is returned right away.
+
+If the last block of the section is erased, the section has not wrapped
+    around yet, so written/erased blocks are in order and a binary search is
+    used (O(log n) header reads).
+Otherwise the section has wrapped and old data follows the erased gap after
+    the head, so the search gallops forward from start_block (doubling the
+    step, but never more than one sector of blocks) and then binary searches
+    the last step. The gap is usually longer than one sector, but a reset
+    before the sectors ahead are erased can leave a shorter one that the
+    gallop jumps over, so if it finds no erased block the section is scanned
+    one block at a time.
+Returns start_block only if every block of the section is written.
+*/
+uint32_t find_mem_section_head(mem_section_t* section, uint32_t start_block) {
+    uint32_t num_blocks = mem_section_num_blocks(section);
+    if (num_blocks == 0) {
+        return start_block;
+    }
+    if (start_block >= num_blocks) {
+        start_block = 0;
+    }
+    if (is_mem_block_erased(section, start_block)) {
+        return start_block;
+    }
+
+    // Search invariant: lo is written, hi is erased
+    uint32_t lo = start_block;
+    uint32_t hi = num_blocks - 1;
+
+    if (!is_mem_block_erased(section, hi)) {
+        uint32_t max_step = MEM_BYTES_PER_SECTOR / mem_block_size(section);
+        if (max_step == 0) {
+            max_step = 1;
+        }
+        uint32_t step = 1;
+        // Allow one pass from start_block to the end and one from block 0
+        uint8_t passes = 0;
+
+        while (1) {
+            uint32_t next = lo + step;
+            if (next >= num_blocks) {
+                passes++;
+                if (passes >= 2) {
+                    return scan_mem_section_head(section, start_block);
+                }
+                // Continue from the start of the section
+                if (is_mem_block_erased(section, 0)) {
+                    return 0;
+                }
+                lo = 0;
+                step = 1;
+                continue;
+            }
+
+            if (is_mem_block_erased(section, next)) {
+                hi = next;
+                break;
+            }
+
+            lo = next;
+            if (step < max_step) {
+                step <<= 1;
+                if (step > max_step) {
+                    step = max_step;
+                }
+            }
+        }
+    }
+
+    while (hi - lo > 1) {
+        uint32_t mid = lo + ((hi - lo) / 2);
+        if (is_mem_block_erased(section, mid)) {
+            hi = mid;
+        } else {
+            lo = mid;
+        }
+    }
+    return hi;
+}
+
+/*
+Reconciles the section's current block number (from EEPROM) with flash. If it
+    points at a block that was already written (e.g. EEPROM is stale), it is
+    moved to the real write head and written back to EEPROM.
+Normally this takes one header read.
+*/
+void recover_mem_section_curr_block(mem_section_t* section) {
+    if (section->compressed != NULL) {
+        recover_mem_compressed_section(section);
+        return;
+    }
+
+    uint32_t head = find_mem_section_head(section, section->curr_block);
+    if (head != section->curr_block) {
+#ifdef MEM_DEBUG
+        print("Recovered curr_block: 0x%lx -> 0x%lx\n",
+            section->curr_block, head);
+#endif
+        set_mem_section_curr_block(section, head);
+    }
+}
+
+/*
+Reconciles all sections' current block numbers with flash.
+*/
+void recover_all_mem_sections_curr_block(void) {
+    for (uint8_t i = 0; i < MEM_NUM_SECTIONS; i++) {
+        recover_mem_section_curr_block(all_mem_sections[i]);
+    }
+}
+
 // Write only the success bytes - whether command was a success/failure
+// Compressed records can't be modified after they are written, so this does
+// nothing for compressed sections
 void write_mem_header_status(mem_section_t* section, uint32_t block_num,
     uint8_t status) {
-    
+    if (section->compressed != NULL) {
+        return;
+    }
+
     uint8_t data_bytes[1] = {
         status
     };
@@ -330,23 +834,164 @@ header - will be set by this function to the results
 void read_mem_header(mem_section_t* section, uint32_t block_num,
     mem_header_t* header) {
 
+    if (section->compressed != NULL) {
+        uint8_t fields[MEM_COMPRESSED_MAX_FIELDS * MEM_BYTES_PER_FIELD];
+        read_mem_compressed_block(section, block_num, header, fields);
+        return;
+    }
+
     uint8_t bytes[MEM_BYTES_PER_HEADER];
     read_mem_section_bytes(section, mem_block_section_addr(section, block_num), bytes,
         MEM_BYTES_PER_HEADER);
+    mem_bytes_to_header(bytes, header);
+}
 
-    header->block_num =
-        (((uint32_t) bytes[0]) << 16) |
-        (((uint32_t) bytes[1]) << 8) |
-        ((uint32_t) bytes[2]);
-    header->date.yy = bytes[3];
-    header->date.mm = bytes[4];
-    header->date.dd = bytes[5];
-    header->time.hh = bytes[6];
-    header->time.mm = bytes[7];
-    header->time.ss = bytes[8];
-    header->status = bytes[9];
+
+/*
+Writes part of a data block with one burst for the fields (a single
+    write_mem_section_bytes() call straight from `fields`, since they are
+    already packed as in flash) instead of one transaction per field.
+fields - packed fields (see get_packed_field())
+write_header - if true, also writes the full header (including the status
+    byte). It is written after the fields, so a block's status is only in
+    flash once its fields are. start_field must be 0 in this case, and this
+    must be the first write to the block (which is erased, see
+    start_mem_block_cache()).
+start_field, end_field - writes fields start_field to (end_field - 1)
+In a compressed section, the whole block is written as one record, so
+    write_header must be true. Fields from end_field onwards are set to erased
+    (0xFFFFFF) in `fields` and stored that way.
+Returns 1 if the write was successful, 0 if not.
+*/
+uint8_t write_mem_data_block_fields(mem_section_t* section, uint32_t block_num,
+        mem_header_t* header, uint8_t* fields, bool write_header,
+        uint8_t start_field, uint8_t end_field) {
+    if ((write_header && start_field != 0) ||
+            end_field > section->fields_per_block ||
+            start_field > end_field) {
+        return 0;
+    }
+
+    if (section->compressed != NULL) {
+        if (!write_header ||
+                section->fields_per_block > MEM_COMPRESSED_MAX_FIELDS) {
+            return 0;
+        }
+
+        for (uint8_t i = end_field; i < section->fields_per_block; i++) {
+            set_packed_field(fields, i, 0xFFFFFF);
+        }
+        return write_mem_compressed_block(section, header, fields);
+    }
+
+    if (write_header) {
+        start_mem_block_cache(section, block_num);
+    }
+
+    uint8_t ret = 1;
+    if (end_field > start_field) {
+        ret = write_mem_section_bytes(section,
+            mem_field_section_addr(section, block_num, start_field),
+            &fields[start_field * MEM_BYTES_PER_FIELD],
+            (end_field - start_field) * MEM_BYTES_PER_FIELD);
+    }
+
+    if (write_header && ret) {
+        uint8_t bytes[MEM_BYTES_PER_HEADER];
+        mem_header_to_bytes(header, bytes);
+        ret = write_mem_section_bytes(section,
+            mem_block_section_addr(section, block_num), bytes,
+            MEM_BYTES_PER_HEADER);
+    }
+    return ret;
+}
+
+/*
+Returns true if the blocks in the section have a CRC after their fields.
+*/
+bool mem_section_has_block_crc(mem_section_t* section) {
+    return section->block_crc && section->compressed == NULL;
+}
+
+/*
+Adds a byte to a CRC-16/CCITT-FALSE (polynomial 0x1021, MSB first, starting
+    from MEM_CRC_INIT).
+*/
+uint16_t mem_crc16_update(uint16_t crc, uint8_t byte) {
+    crc ^= (uint16_t) byte << 8;
+    for (uint8_t i = 0; i < 8; i++) {
+        if (crc & 0x8000) {
+            crc = (crc << 1) ^ 0x1021;
+        } else {
+            crc <<= 1;
+        }
+    }
+    return crc;
+}
+
+/*
+Calculates the CRC of a block's header and fields as they are in flash (read a
+    few bytes at a time to keep the stack small).
+Never returns MEM_CRC_ERASED, so a stored CRC can't look uncommitted.
+*/
+uint16_t calc_mem_block_crc(mem_section_t* section, uint32_t block_num) {
+    uint32_t address = mem_block_section_addr(section, block_num);
+    uint16_t len = MEM_BYTES_PER_HEADER +
+        ((uint16_t) section->fields_per_block * MEM_BYTES_PER_FIELD);
+
+    uint16_t crc = MEM_CRC_INIT;
+    uint8_t bytes[16];
+    while (len > 0) {
+        uint8_t count = len < sizeof(bytes) ? len : sizeof(bytes);
+        read_mem_section_bytes(section, address, bytes, count);
+        for (uint8_t i = 0; i < count; i++) {
+            crc = mem_crc16_update(crc, bytes[i]);
+        }
+        address += count;
+        len -= count;
+    }
+
+    if (crc == MEM_CRC_ERASED) {
+        crc = MEM_CRC_ERASED - 1;
+    }
+    return crc;
 }
 
+/*
+Writes the CRC of a block after its fields. Called when the block is
+    committed (after the status byte is written), so the CRC covers the final
+    header and fields.
+Does nothing if the section does not have block CRCs.
+*/
+void write_mem_block_crc(mem_section_t* section, uint32_t block_num) {
+    if (!mem_section_has_block_crc(section)) {
+        return;
+    }
+
+    uint16_t crc = calc_mem_block_crc(section, block_num);
+    uint8_t bytes[MEM_BYTES_PER_CRC] = {
+        (crc >> 8) & 0xFF,
+        crc & 0xFF
+    };
+    write_mem_section_bytes(section, mem_crc_section_addr(section, block_num),
+        bytes, MEM_BYTES_PER_CRC);
+}
+
+/*
+Reads the CRC stored after a block's fields.
+Returns MEM_CRC_ERASED if the block has not been committed or the section
+    does not have block CRCs.
+*/
+uint16_t read_mem_block_crc(mem_section_t* section, uint32_t block_num) {
+    if (!mem_section_has_block_crc(section)) {
+        return MEM_CRC_ERASED;
+    }
+
+    uint8_t bytes[MEM_BYTES_PER_CRC];
+    read_mem_section_bytes(section, mem_crc_section_addr(section, block_num),
+        bytes, MEM_BYTES_PER_CRC);
+    return ((uint16_t) bytes[0] << 8) | bytes[1];
+}
 
 // fields are indexed from ZERO
 void write_mem_field(mem_section_t* section, uint32_t block_num,
@@ -360,6 +1005,10 @@ void write_mem_field(mem_section_t* section, uint32_t block_num,
     data - the least significant 24 bits will be written to memory
 */
 
+    if (section->compressed != NULL) {
+        return;
+    }
+
     uint32_t address = mem_field_section_addr(section, block_num, field_num);
 
     // Split the data into 3 bytes
@@ -378,6 +1027,16 @@ uint32_t read_mem_field(mem_section_t* section, uint32_t block_num,
     Reads and returns the 24-bit data for the specified section, block, and field
 */
 
+    if (section->compressed != NULL) {
+        mem_header_t header;
+        uint8_t fields[MEM_COMPRESSED_MAX_FIELDS * MEM_BYTES_PER_FIELD];
+        read_mem_compressed_block(section, block_num, &header, fields);
+        if (field_num >= section->fields_per_block) {
+            return 0xFFFFFF;
+        }
+        return get_packed_field(fields, field_num);
+    }
+
     uint32_t address = mem_field_section_addr(section, block_num, field_num);
 
     uint8_t data_bytes[MEM_BYTES_PER_FIELD];
@@ -408,41 +1067,165 @@ uint32_t mem_addr_for_sector(uint32_t sector) {
 }
 
 /*
-Calculates the number of bytes per block for the section.
+Returns the number of stripes the section is actually stored with. Striping is
+    only used if the section can be split into that many equal parts that are
+    each a whole number of sectors (it may not be if the start or end address
+    was changed), and not for compressed sections.
 */
-uint32_t mem_block_size(mem_section_t* section) {
-    if (section == &prim_cmd_log_mem_section ||
-        section == &sec_cmd_log_mem_section) {
-        return MEM_BYTES_PER_HEADER + MEM_BYTES_PER_CMD;
-    } else {
-        return MEM_BYTES_PER_HEADER +
-            (((uint32_t) section->fields_per_block) * MEM_BYTES_PER_FIELD);
+uint8_t mem_section_stripes(mem_section_t* section) {
+    if (section->stripes <= 1 || section->compressed != NULL ||
+            section->end_addr < section->start_addr) {
+        return 1;
     }
+
+    uint32_t size = section->end_addr - section->start_addr + 1;
+    uint32_t stripe_size = (uint32_t) section->stripes * MEM_BYTES_PER_SECTOR;
+    if ((section->start_addr % MEM_BYTES_PER_SECTOR) != 0 ||
+            (size % stripe_size) != 0) {
+        return 1;
+    }
+    return section->stripes;
 }
 
 /*
-Calculates and returns the address of the start of a block (where the header starts).
-This is an offset from the beginning of the section.
+Calculates the address (from the beginning of all memory) where a byte of the
+    section is stored.
+address - offset from the start of the section
+For a striped section, the section is split into `stripes` equal parts, and
+    consecutive pages of the section rotate across the parts - page 0 is the
+    first page of part 0, page 1 is the first page of part 1, ..., then page
+    `stripes` is the second page of part 0, etc. If the parts are on different
+    chips, writing a block that spans pages (or the next block) can start on
+    the next chip while the previous one is still programming.
 */
-uint32_t mem_block_section_addr(mem_section_t* section, uint32_t block_num) {
-    uint32_t block_address = block_num * mem_block_size(section);
-    return block_address;
+uint32_t mem_section_phy_addr(mem_section_t* section, uint32_t address) {
+    uint8_t stripes = mem_section_stripes(section);
+    if (stripes == 1) {
+        return section->start_addr + address;
+    }
+
+    uint32_t part_size = (section->end_addr - section->start_addr + 1) / stripes;
+    uint32_t page = address / MEM_BYTES_PER_PAGE;
+    return section->start_addr +
+        ((page % stripes) * part_size) +
+        ((page / stripes) * MEM_BYTES_PER_PAGE) +
+        (address % MEM_BYTES_PER_PAGE);
 }
 
 /*
-Calculates and returns the address of the start of a block (where the header starts).
-This is an offset from the beginning of all memory.
+Returns how many of the data_len bytes starting at `address` (offset from the
+    start of the section) are stored contiguously, i.e. can be written or read
+    in one operation starting at mem_section_phy_addr().
 */
-uint32_t mem_block_addr(mem_section_t* section, uint32_t block_num) {
-    return section->start_addr + mem_block_section_addr(section, block_num);
+uint32_t mem_section_phy_len(mem_section_t* section, uint32_t address,
+        uint32_t data_len) {
+    if (mem_section_stripes(section) == 1) {
+        return data_len;
+    }
+
+    // Until the end of the page
+    uint32_t len = MEM_BYTES_PER_PAGE - (address % MEM_BYTES_PER_PAGE);
+    if (len > data_len) {
+        len = data_len;
+    }
+    return len;
 }
 
 /*
-Calculates and returns the address of the end of a block (the last byte written to by that block).
-This is an offset from the beginning of the section.
+Returns true if any of the data_len bytes starting at `address` (offset from the
+    start of the section) are stored in the range of addresses from start_addr
+    to end_addr (inclusive, offsets from the beginning of all memory).
 */
-uint32_t mem_block_end_section_addr(mem_section_t* section, uint32_t block_num) {
-    return mem_block_section_addr(section, block_num) + mem_block_size(section) - 1;
+bool mem_section_bytes_overlap(mem_section_t* section, uint32_t address,
+        uint32_t data_len, uint32_t start_addr, uint32_t end_addr) {
+    while (data_len > 0) {
+        uint32_t phy_addr = mem_section_phy_addr(section, address);
+        uint32_t len = mem_section_phy_len(section, address, data_len);
+        if (phy_addr <= end_addr && start_addr <= phy_addr + len - 1) {
+            return true;
+        }
+        address += len;
+        data_len -= len;
+    }
+    return false;
+}
+
+/*
+Returns the sector to pass to erase_mem_section_ahead() for the byte at
+    `address` (offset from the start of the section).
+This is the sector the byte is in, except for striped sections where it is the
+    sector in the first part at the same offset (the same sector is erased in
+    every part together).
+*/
+uint32_t mem_section_erase_sector(mem_section_t* section, uint32_t address) {
+    uint8_t stripes = mem_section_stripes(section);
+    if (stripes == 1) {
+        return mem_sector_for_addr(section->start_addr + address);
+    }
+
+    uint32_t row_size = (uint32_t) stripes * MEM_BYTES_PER_SECTOR;
+    return mem_sector_for_addr(section->start_addr) + (address / row_size);
+}
+
+/*
+Calculates the number of bytes per block for the section.
+*/
+uint32_t mem_block_size(mem_section_t* section) {
+    if (section == &prim_cmd_log_mem_section ||
+        section == &sec_cmd_log_mem_section) {
+        return MEM_BYTES_PER_HEADER + MEM_BYTES_PER_CMD;
+    } else if (mem_section_has_block_crc(section)) {
+        return MEM_BYTES_PER_HEADER +
+            (((uint32_t) section->fields_per_block) * MEM_BYTES_PER_FIELD) +
+            MEM_BYTES_PER_CRC;
+    } else {
+        return MEM_BYTES_PER_HEADER +
+            (((uint32_t) section->fields_per_block) * MEM_BYTES_PER_FIELD);
+    }
+}
+
+/*
+Calculates the number of complete blocks that fit in the section.
+For compressed sections this depends on the data, so it is the number of
+    possible block numbers instead.
+*/
+uint32_t mem_section_num_blocks(mem_section_t* section) {
+    if (section->compressed != NULL) {
+        return MEM_ERASED_BLOCK_NUM;
+    }
+    if (section->end_addr < section->start_addr) {
+        return 0;
+    }
+    return (section->end_addr - section->start_addr + 1) /
+        mem_block_size(section);
+}
+
+/*
+Calculates and returns the address of the start of a block (where the header starts).
+This is an offset from the beginning of the section.
+*/
+uint32_t mem_block_section_addr(mem_section_t* section, uint32_t block_num) {
+    uint32_t block_address = block_num * mem_block_size(section);
+    return block_address;
+}
+
+/*
+Calculates and returns the address of the start of a block (where the header starts).
+This is an offset from the beginning of all memory.
+In a striped section, the rest of the block is not necessarily after this
+    address (see mem_section_phy_addr()).
+*/
+uint32_t mem_block_addr(mem_section_t* section, uint32_t block_num) {
+    return mem_section_phy_addr(section,
+        mem_block_section_addr(section, block_num));
+}
+
+/*
+Calculates and returns the address of the end of a block (the last byte written to by that block).
+This is an offset from the beginning of the section.
+*/
+uint32_t mem_block_end_section_addr(mem_section_t* section, uint32_t block_num) {
+    return mem_block_section_addr(section, block_num) + mem_block_size(section) - 1;
 }
 
 /*
@@ -450,7 +1233,8 @@ Calculates and returns the address of the end of a block (the last byte written
 This is an offset from the beginning of all memory.
 */
 uint32_t mem_block_end_addr(mem_section_t* section, uint32_t block_num) {
-    return section->start_addr + mem_block_end_section_addr(section, block_num);
+    return mem_section_phy_addr(section,
+        mem_block_end_section_addr(section, block_num));
 }
 
 /*
@@ -465,6 +1249,16 @@ uint32_t mem_field_section_addr(mem_section_t* section, uint32_t block_num,
     return field_address;
 }
 
+/*
+Calculates and returns the address of the CRC in a block (after the fields).
+Only applies to data sections with a CRC (see mem_section_has_block_crc()).
+This is an offset from the beginning of the section.
+*/
+uint32_t mem_crc_section_addr(mem_section_t* section, uint32_t block_num) {
+    return mem_field_section_addr(section, block_num,
+        section->fields_per_block);
+}
+
 /*
 Calculates and returns the address of the start of a command in a block (after the header).
 Only applies to the command sections.
@@ -506,12 +1300,28 @@ uint8_t write_mem_section_bytes(mem_section_t *section, uint32_t address, uint8_
 /*
     writes an array of bytes to the specific section where address is the offset from the start of
     the section. Data will only be written if the array fits into the section. Returns 1 if write was success.
+    also updates the section's block cache
 */
     if(address < 0 || data_len <= 0)
         return 0;
 
     if((section->start_addr + address + data_len - 1) <= section->end_addr ){
-        write_mem_bytes(address + section->start_addr, data, data_len);
+        retry_mem_section_erase_ahead(section);
+        write_mem_block_cache(section, address, data, data_len);
+
+        // One write per contiguous part (each page in a striped section)
+        while (data_len > 0) {
+            uint32_t phy_addr = mem_section_phy_addr(section, address);
+            uint8_t len = mem_section_phy_len(section, address, data_len);
+            // Sections should not overlap, but make sure no other cache goes
+            // stale
+            invalidate_mem_caches(phy_addr, phy_addr + len - 1, section);
+            write_mem_bytes_raw(phy_addr, data, len);
+
+            address += len;
+            data += len;
+            data_len -= len;
+        }
         return 1;
     } else {
         return 0;
@@ -521,8 +1331,563 @@ uint8_t write_mem_section_bytes(mem_section_t *section, uint32_t address, uint8_
 void read_mem_section_bytes(mem_section_t *section, uint32_t address, uint8_t* data, uint8_t data_len){
 /*
     reads an array of bytes from a section where address is the offset from the start of the section
+    (from the section's block cache if possible)
+*/
+    if (read_mem_block_cache(section, address, data, data_len)) {
+        return;
+    }
+    read_mem_section_bytes_raw(section, address, data, data_len);
+}
+
+/*
+Same as read_mem_section_bytes(), but always reads from memory (not the block
+    cache).
+*/
+void read_mem_section_bytes_raw(mem_section_t* section, uint32_t address,
+        uint8_t* data, uint32_t data_len) {
+    while (data_len > 0) {
+        uint32_t len = mem_section_phy_len(section, address, data_len);
+        read_mem_bytes(mem_section_phy_addr(section, address), data, len);
+        address += len;
+        data += len;
+        data_len -= len;
+    }
+}
+
+/*
+Invalidates the block cache of any section whose cached block overlaps the
+    range of addresses (inclusive, offsets from the beginning of all memory).
+Must be called for any flash change that does not go through
+    write_mem_section_bytes().
+Also makes a compressed section start a new sector if the records already
+    written in its current sector are changed, since the next delta record
+    would be based on them.
+skip_section - section whose cache is not checked (NULL to check all sections)
+*/
+void invalidate_mem_caches(uint32_t start_addr, uint32_t end_addr,
+        mem_section_t* skip_section) {
+    for (uint8_t i = 0; i < MEM_NUM_SECTIONS; i++) {
+        mem_section_t* section = all_mem_sections[i];
+        mem_compressed_state_t* state = section->compressed;
+        if (section != skip_section && state != NULL) {
+            uint32_t sector_addr = mem_addr_for_sector(
+                mem_sector_for_addr(state->write_addr));
+            if (sector_addr < state->write_addr &&
+                    sector_addr <= end_addr &&
+                    start_addr < state->write_addr) {
+                state->resync = true;
+            }
+        }
+
+        mem_block_cache_t* cache = section->cache;
+        if (section == skip_section || cache == NULL || !cache->valid) {
+            continue;
+        }
+
+        if (mem_section_bytes_overlap(section,
+                mem_block_section_addr(section, cache->block_num),
+                mem_block_size(section), start_addr, end_addr)) {
+            cache->valid = false;
+        }
+    }
+}
+
+/*
+If the bytes (address is an offset from the start of the section) are all
+    within the section's cached block, copies them from the cache to `data`.
+Returns true if the cache was used, false if memory needs to be read instead.
+*/
+bool read_mem_block_cache(mem_section_t* section, uint32_t address,
+        uint8_t* data, uint8_t data_len) {
+    mem_block_cache_t* cache = section->cache;
+    if (cache == NULL || !cache->valid) {
+        return false;
+    }
+
+    uint32_t block_addr = mem_block_section_addr(section, cache->block_num);
+    if (address < block_addr ||
+            address + data_len > block_addr + mem_block_size(section)) {
+        return false;
+    }
+
+    uint32_t offset = address - block_addr;
+    for (uint8_t i = 0; i < data_len; i++) {
+        data[i] = cache->bytes[offset + i];
+    }
+    return true;
+}
+
+/*
+Makes the section's block cache hold block_num as erased (all 0xFF) without
+    reading it from flash. Only for a new block at the head of the section, which
+    is known to be erased (see recover_mem_section_curr_block() and
+    erase_ahead_mem_section_block()).
+*/
+void start_mem_block_cache(mem_section_t* section, uint32_t block_num) {
+    mem_block_cache_t* cache = section->cache;
+    if (cache == NULL) {
+        return;
+    }
+
+    memset(cache->bytes, 0xFF, mem_block_size(section));
+    cache->block_num = block_num;
+    cache->valid = true;
+}
+
+/*
+Applies a write (address is an offset from the start of the section) to the
+    section's block cache. Must be called before the bytes are written to flash.
+If the write is to a different block than the cached one, that block is read
+    from flash into the cache first (this becomes the most recent block). This
+    is only needed for writes to older blocks (e.g. a status or CRC rewrite),
+    since new blocks start with start_mem_block_cache().
+Writes that are not within one block invalidate the cache.
+*/
+void write_mem_block_cache(mem_section_t* section, uint32_t address,
+        uint8_t* data, uint8_t data_len) {
+    mem_block_cache_t* cache = section->cache;
+    if (cache == NULL) {
+        return;
+    }
+
+    uint32_t block_size = mem_block_size(section);
+    uint32_t block_num = address / block_size;
+    uint32_t offset = address - (block_num * block_size);
+    if (offset + data_len > block_size) {
+        cache->valid = false;
+        return;
+    }
+
+    if (!cache->valid || cache->block_num != block_num) {
+        read_mem_section_bytes_raw(section,
+            mem_block_section_addr(section, block_num), cache->bytes,
+            block_size);
+        cache->block_num = block_num;
+        cache->valid = true;
+    }
+
+    // Writing to flash can only change 1s to 0s
+    for (uint8_t i = 0; i < data_len; i++) {
+        cache->bytes[offset + i] &= data[i];
+    }
+}
+
+/*
+Returns the first sector used by a compressed section (the first sector that
+    starts within the section).
+*/
+uint32_t mem_compressed_first_sector(mem_section_t* section) {
+    return mem_sector_for_addr(section->start_addr + MEM_BYTES_PER_SECTOR - 1);
+}
+
+/*
+Returns the last sector used by a compressed section (the last sector that
+    ends within the section).
+Returns a value less than mem_compressed_first_sector() if the section does
+    not contain any full sectors.
+*/
+uint32_t mem_compressed_last_sector(mem_section_t* section) {
+    uint32_t end_sector = mem_sector_for_addr(section->end_addr + 1);
+    if (end_sector == 0) {
+        return 0;
+    }
+    return end_sector - 1;
+}
+
+/*
+Resets the write state of a compressed section so the next record is a
+    keyframe at the start of the section (does not change flash).
+*/
+void init_mem_compressed_section(mem_section_t* section) {
+    mem_compressed_state_t* state = section->compressed;
+    if (state == NULL) {
+        return;
+    }
+
+    state->write_addr = mem_addr_for_sector(
+        mem_compressed_first_sector(section));
+    state->resync = true;
+    state->prev_block_num = MEM_ERASED_BLOCK_NUM;
+    for (uint8_t i = 0; i < sizeof(state->prev_fields); i++) {
+        state->prev_fields[i] = 0xFF;
+    }
+}
+
+/*
+Encodes a block as a compressed record (see MEM_COMPRESSED_KEYFRAME).
+keyframe - if true, stores the full header and fields, otherwise stores the
+    difference from the last record written to the section
+record - must have space for MEM_COMPRESSED_MAX_RECORD_BYTES
+Returns the number of bytes in the record.
+*/
+uint8_t encode_mem_compressed_record(mem_section_t* section,
+        mem_header_t* header, uint8_t* fields, bool keyframe,
+        uint8_t* record) {
+    uint8_t num_fields = section->fields_per_block;
+    uint8_t len = 0;
+
+    if (keyframe) {
+        record[len++] = MEM_COMPRESSED_KEYFRAME;
+        mem_header_to_bytes(header, &record[len]);
+        len += MEM_BYTES_PER_HEADER;
+        memcpy(&record[len], fields, num_fields * MEM_BYTES_PER_FIELD);
+        len += num_fields * MEM_BYTES_PER_FIELD;
+        return len;
+    }
+
+    uint8_t* prev_fields = section->compressed->prev_fields;
+
+    record[len++] = MEM_COMPRESSED_DELTA;
+    record[len++] = header->date.yy;
+    record[len++] = header->date.mm;
+    record[len++] = header->date.dd;
+    record[len++] = header->time.hh;
+    record[len++] = header->time.mm;
+    record[len++] = header->time.ss;
+    record[len++] = header->status;
+
+    uint8_t* bitmap = &record[len];
+    uint8_t bitmap_bytes = (num_fields + 7) / 8;
+    for (uint8_t i = 0; i < bitmap_bytes; i++) {
+        bitmap[i] = 0x00;
+    }
+    len += bitmap_bytes;
+
+    for (uint8_t i = 0; i < num_fields; i++) {
+        uint32_t diff = (get_packed_field(fields, i) -
+            get_packed_field(prev_fields, i)) & 0xFFFFFF;
+        if (diff == 0) {
+            continue;
+        }
+        bitmap[i / 8] |= _BV(i % 8);
+
+        // Zigzag encode the signed 24-bit difference so small negative
+        // changes are also small numbers
+        uint32_t value;
+        if (diff & 0x800000) {
+            value = (((0x1000000UL - diff) << 1) - 1);
+        } else {
+            value = diff << 1;
+        }
+
+        do {
+            uint8_t byte = value & 0x7F;
+            value >>= 7;
+            if (value != 0) {
+                byte |= 0x80;
+            }
+            record[len++] = byte;
+        } while (value != 0);
+    }
+
+    return len;
+}
+
+/*
+Appends a block to a compressed section at its write head.
+A keyframe is written at the start of every sector, after a resync, or if the
+    block number does not follow the last one. Otherwise a delta record is
+    written. If the record does not fit in the rest of the sector, the rest
+    is left erased and a keyframe is written at the start of the next sector
+    (going back to the first sector after the last one).
+fields - must contain section->fields_per_block packed fields
+Returns 1 if the write was successful, 0 if not.
+*/
+uint8_t write_mem_compressed_block(mem_section_t* section,
+        mem_header_t* header, uint8_t* fields) {
+    mem_compressed_state_t* state = section->compressed;
+    uint32_t first_sector = mem_compressed_first_sector(section);
+    uint32_t last_sector = mem_compressed_last_sector(section);
+    if (state == NULL || last_sector < first_sector ||
+            section->fields_per_block > MEM_COMPRESSED_MAX_FIELDS) {
+        return 0;
+    }
+
+    uint32_t sector = mem_sector_for_addr(state->write_addr);
+    uint16_t offset = state->write_addr & (MEM_BYTES_PER_SECTOR - 1);
+    if (sector < first_sector || sector > last_sector) {
+        sector = first_sector;
+        offset = 0;
+    }
+    if (state->resync && offset != 0) {
+        sector = (sector >= last_sector) ? first_sector : sector + 1;
+        offset = 0;
+    }
+
+    bool keyframe = state->resync || offset == 0 ||
+        header->block_num != state->prev_block_num + 1;
+    uint8_t record[MEM_COMPRESSED_MAX_RECORD_BYTES];
+    uint8_t len = encode_mem_compressed_record(section, header, fields,
+        keyframe, record);
+
+    if (offset + len > MEM_BYTES_PER_SECTOR) {
+        sector = (sector >= last_sector) ? first_sector : sector + 1;
+        offset = 0;
+        len = encode_mem_compressed_record(section, header, fields, true,
+            record);
+    }
+
+    // Entering a new sector - make sure it and the next ones are erased
+    if (offset == 0) {
+        erase_mem_section_ahead(section, sector);
+    }
+
+    uint32_t address = mem_addr_for_sector(sector) + offset;
+    invalidate_mem_caches(address, address + len - 1, section);
+    write_mem_bytes_raw(address, record, len);
+
+    state->write_addr = address + len;
+    state->resync = false;
+    state->prev_block_num = header->block_num;
+    memcpy(state->prev_fields, fields,
+        section->fields_per_block * MEM_BYTES_PER_FIELD);
+
+    return 1;
+}
+
+/*
+Returns the block number of the keyframe at the start of the sector, or
+    MEM_ERASED_BLOCK_NUM if the sector does not start with a keyframe.
+*/
+uint32_t read_mem_compressed_sector_keyframe(mem_section_t* section,
+        uint32_t sector) {
+    uint8_t bytes[4];
+    read_mem_bytes(mem_addr_for_sector(sector), bytes, sizeof(bytes));
+    if (bytes[0] != MEM_COMPRESSED_KEYFRAME) {
+        return MEM_ERASED_BLOCK_NUM;
+    }
+    return (((uint32_t) bytes[1]) << 16) |
+        (((uint32_t) bytes[2]) << 8) |
+        ((uint32_t) bytes[3]);
+}
+
+/*
+Decodes the records in one sector of a compressed section, starting from the
+    keyframe at the start of the sector, until it reaches block_num or the
+    end of the records.
+header, fields - set to the decoded block_num block (packed fields), or the
+    last record in the sector if block_num was not found (header->block_num
+    is MEM_ERASED_BLOCK_NUM if there are no records)
+Returns the number of bytes of records decoded (the offset after the last
+    decoded record).
+*/
+uint16_t decode_mem_compressed_sector(mem_section_t* section, uint32_t sector,
+        uint32_t block_num, mem_header_t* header, uint8_t* fields) {
+    uint32_t sector_addr = mem_addr_for_sector(sector);
+    uint8_t num_fields = section->fields_per_block;
+    uint8_t bitmap_bytes = (num_fields + 7) / 8;
+    uint8_t record[MEM_COMPRESSED_MAX_RECORD_BYTES];
+    uint16_t offset = 0;
+
+    header->block_num = MEM_ERASED_BLOCK_NUM;
+
+    while (offset < MEM_BYTES_PER_SECTOR) {
+        uint16_t len = MEM_BYTES_PER_SECTOR - offset;
+        if (len > sizeof(record)) {
+            len = sizeof(record);
+        }
+        read_mem_bytes(sector_addr + offset, record, len);
+
+        uint16_t i = 0;
+        if (record[0] == MEM_COMPRESSED_KEYFRAME) {
+            i = 1 + MEM_BYTES_PER_HEADER + (num_fields * MEM_BYTES_PER_FIELD);
+            if (i > len) {
+                break;
+            }
+
+            mem_bytes_to_header(&record[1], header);
+            memcpy(fields, &record[1 + MEM_BYTES_PER_HEADER],
+                num_fields * MEM_BYTES_PER_FIELD);
+        }
+
+        else if (record[0] == MEM_COMPRESSED_DELTA &&
+                header->block_num != MEM_ERASED_BLOCK_NUM) {
+            i = MEM_COMPRESSED_DELTA_HEADER_BYTES + bitmap_bytes;
+            if (i > len) {
+                break;
+            }
+
+            uint8_t* bitmap = &record[MEM_COMPRESSED_DELTA_HEADER_BYTES];
+            bool valid = true;
+            for (uint8_t f = 0; f < num_fields && valid; f++) {
+                if ((bitmap[f / 8] & _BV(f % 8)) == 0) {
+                    continue;
+                }
+
+                uint32_t value = 0;
+                uint8_t shift = 0;
+                uint8_t byte = 0;
+                do {
+                    if (i >= len ||
+                            shift >= 7 * MEM_COMPRESSED_MAX_VARINT_BYTES) {
+                        valid = false;
+                        break;
+                    }
+                    byte = record[i++];
+                    value |= ((uint32_t) (byte & 0x7F)) << shift;
+                    shift += 7;
+                } while (byte & 0x80);
+
+                uint32_t field = get_packed_field(fields, f);
+                if (value & 1) {
+                    field -= (value + 1) >> 1;
+                } else {
+                    field += value >> 1;
+                }
+                set_packed_field(fields, f, field);
+            }
+            if (!valid) {
+                break;
+            }
+
+            header->block_num += 1;
+            header->date.yy = record[1];
+            header->date.mm = record[2];
+            header->date.dd = record[3];
+            header->time.hh = record[4];
+            header->time.mm = record[5];
+            header->time.ss = record[6];
+            header->status = record[7];
+        }
+
+        // Erased (end of the records in this sector) or not a valid record
+        else {
+            break;
+        }
+
+        offset += i;
+        if (header->block_num == block_num) {
+            break;
+        }
+    }
+
+    return offset;
+}
+
+/*
+Reads and decodes a block from a compressed section.
+The sectors are binary searched (in the order they were written, starting
+    after the write head) using the block number of the keyframe at the start
+    of each sector, so this needs O(log(sectors)) keyframe reads and then
+    decodes forward through at most one sector. This relies on block numbers
+    increasing in the order they are written.
+If the block is not found, the header and fields are set to erased values
+    (what an unwritten block in an uncompressed section reads as).
+Returns true if the block was found.
 */
-    read_mem_bytes(address + section->start_addr, data, data_len);
+bool read_mem_compressed_block(mem_section_t* section, uint32_t block_num,
+        mem_header_t* header, uint8_t* fields) {
+    uint32_t first_sector = mem_compressed_first_sector(section);
+    uint32_t last_sector = mem_compressed_last_sector(section);
+
+    if (section->compressed != NULL && block_num < MEM_ERASED_BLOCK_NUM &&
+            last_sector >= first_sector &&
+            section->fields_per_block <= MEM_COMPRESSED_MAX_FIELDS) {
+        uint32_t num_sectors = last_sector - first_sector + 1;
+        uint32_t head_sector = mem_sector_for_addr(
+            section->compressed->write_addr);
+        if (head_sector < first_sector || head_sector > last_sector) {
+            head_sector = first_sector;
+        }
+
+        // Sector i in write order is (head + 1 + i), so the head is last -
+        // leave it out if nothing has been written there yet
+        uint32_t count = num_sectors;
+        if (read_mem_compressed_sector_keyframe(section, head_sector) ==
+                MEM_ERASED_BLOCK_NUM) {
+            count--;
+        }
+
+        // Find the first sector (in write order) with a keyframe after
+        // block_num - the block can only be in the sector before it
+        // Erased sectors can only be at the start of the order (not written
+        // yet, or erased ahead of the write head)
+        uint32_t lo = 0;
+        uint32_t hi = count;
+        while (lo < hi) {
+            uint32_t mid = lo + ((hi - lo) / 2);
+            uint32_t sector = first_sector +
+                ((head_sector - first_sector + 1 + mid) % num_sectors);
+            uint32_t keyframe = read_mem_compressed_sector_keyframe(section,
+                sector);
+            if (keyframe != MEM_ERASED_BLOCK_NUM && keyframe > block_num) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+
+        if (lo > 0) {
+            uint32_t sector = first_sector +
+                ((head_sector - first_sector + lo) % num_sectors);
+            decode_mem_compressed_sector(section, sector, block_num, header,
+                fields);
+            if (header->block_num == block_num) {
+                return true;
+            }
+        }
+    }
+
+    set_mem_header_erased(header);
+    memset(fields, 0xFF, section->fields_per_block * MEM_BYTES_PER_FIELD);
+    return false;
+}
+
+/*
+Finds the write head of a compressed section from the keyframes in flash, and
+    makes sure the current block number is after the last block written.
+Every sector's keyframe is read (the sector with the largest block number is
+    the head), then the head sector is decoded to find the end of its records.
+The next record goes at the start of the next sector, since the last record
+    could have been cut off by a restart. This costs at most the rest of one
+    sector per restart.
+*/
+void recover_mem_compressed_section(mem_section_t* section) {
+    init_mem_compressed_section(section);
+
+    uint32_t first_sector = mem_compressed_first_sector(section);
+    uint32_t last_sector = mem_compressed_last_sector(section);
+    if (section->compressed == NULL || last_sector < first_sector ||
+            section->fields_per_block > MEM_COMPRESSED_MAX_FIELDS) {
+        return;
+    }
+
+    uint32_t head_sector = first_sector;
+    uint32_t head_keyframe = MEM_ERASED_BLOCK_NUM;
+    for (uint32_t sector = first_sector; sector <= last_sector; sector++) {
+        uint32_t keyframe = read_mem_compressed_sector_keyframe(section,
+            sector);
+        if (keyframe != MEM_ERASED_BLOCK_NUM &&
+                (head_keyframe == MEM_ERASED_BLOCK_NUM ||
+                keyframe > head_keyframe)) {
+            head_sector = sector;
+            head_keyframe = keyframe;
+        }
+    }
+    if (head_keyframe == MEM_ERASED_BLOCK_NUM) {
+        return;
+    }
+
+    mem_header_t header;
+    uint8_t fields[MEM_COMPRESSED_MAX_FIELDS * MEM_BYTES_PER_FIELD];
+    uint16_t end = decode_mem_compressed_sector(section, head_sector,
+        MEM_ERASED_BLOCK_NUM, &header, fields);
+
+    mem_compressed_state_t* state = section->compressed;
+    state->write_addr = mem_addr_for_sector(head_sector) + end;
+    state->prev_block_num = header.block_num;
+
+    uint32_t next_block = header.block_num + 1;
+    if (next_block >= MEM_ERASED_BLOCK_NUM) {
+        next_block = 0;
+    }
+    if (section->curr_block <= header.block_num) {
+#ifdef MEM_DEBUG
+        print("Recovered compressed curr_block: 0x%lx -> 0x%lx\n",
+            section->curr_block, next_block);
+#endif
+        set_mem_section_curr_block(section, next_block);
+    }
 }
 
 void write_mem_bytes(uint32_t address, uint8_t* data, uint32_t data_len){
@@ -540,8 +1905,28 @@ void write_mem_bytes(uint32_t address, uint8_t* data, uint32_t data_len){
 
         the continous roll-over functionality is hard-coded, and will need
         to be modified in the event of changes to the board design
+
+    The data is split into page-aligned bursts before anything is sent. Chip
+    boundaries are always page boundaries, so each burst stays on one chip.
+    This function does NOT wait for the last burst to finish programming - the
+    next operation on that chip will wait for it.
+
+    any block cache overlapping the data is invalidated
 */
 
+    if (data_len == 0) {
+        return;
+    }
+
+    invalidate_mem_caches(address, address + data_len - 1, NULL);
+    write_mem_bytes_raw(address, data, data_len);
+}
+
+/*
+Same as write_mem_bytes(), but does not check the block caches (the caller
+    must have already updated them).
+*/
+void write_mem_bytes_raw(uint32_t address, uint8_t* data, uint32_t data_len){
 #ifdef MEM_DEBUG
     print("%s: ", __FUNCTION__);
     print("addr = 0x%.8lX, len = %u\n", address, data_len);
@@ -553,56 +1938,60 @@ void write_mem_bytes(uint32_t address, uint8_t* data, uint32_t data_len){
     uint8_t addr1;
     uint8_t addr2;
     uint8_t addr3;
-    //calculate the initial chip number
-    process_mem_addr(address, &chip_num, &addr1, &addr2, &addr3);
-    if (chip_num >= MEM_NUM_CHIPS) {
-        return;
-    }
-
-    //initialize counter
-    for (uint32_t i = 0; i < data_len; i++) {
 
-        //rollover condition for chip and page boundaries
-        if (((address + i) % 256 == 0) || (i == 0)) {
-            //end previous write operation
-            set_cs_high(mem_cs[chip_num].pin, mem_cs[chip_num].port);
-
-            //used to determine the end of a write operation
-            //wait for previous operation to terminate
-            wait_for_mem_not_busy(chip_num);
+    while (data_len > 0) {
+        process_mem_addr(address, &chip_num, &addr1, &addr2, &addr3);
+        if (chip_num >= MEM_NUM_CHIPS) {
+            return;
+        }
 
-            send_short_mem_command(MEM_WR_DISABLE, chip_num);
+        // Number of bytes from this address to the end of its page
+        uint16_t burst_len = MEM_BYTES_PER_PAGE - addr3;
+        if (burst_len > data_len) {
+            burst_len = data_len;
+        }
 
-            //calculate address bytes
-            //recalculate and rollover the chip number,
-            //stored in the most significant bits of the address
-            process_mem_addr(address + i, &chip_num, &addr1, &addr2, &addr3);
-            if (chip_num >= MEM_NUM_CHIPS) {
-                return;
-            }
+        // Don't write into a sector that is still waiting to be erased
+        finish_pending_mem_sector_erase(mem_sector_for_addr(address));
+        write_mem_page_burst(chip_num, addr1, addr2, addr3, data, burst_len);
 
-            //enable writing to chip
-            send_short_mem_command(MEM_WR_ENABLE, chip_num);
-            set_cs_low(mem_cs[chip_num].pin, mem_cs[chip_num].port);
-            /* all bytes to be written must be
-            proceeded by the Page Program command */
+        address += burst_len;
+        data += burst_len;
+        data_len -= burst_len;
+    }
+}
 
-            send_spi(MEM_PG_PRG);
+/*
+Programs up to one page (256 bytes) on one chip, starting at the physical
+    address {addr1, addr2, addr3}.
+The bytes must not cross a page boundary (the chip would wrap around to the
+    start of the same page).
+Waits for any previous operation on the chip to finish first, but does not wait
+    for this one - the chip is marked busy instead.
+*/
+void write_mem_page_burst(uint8_t chip_num, uint8_t addr1, uint8_t addr2,
+        uint8_t addr3, uint8_t* data, uint16_t data_len) {
+    wait_for_mem_ready(chip_num);
 
-            send_spi(addr1);
-            send_spi(addr2);
-            send_spi(addr3);
-        }
+    //enable writing to chip
+    send_short_mem_command(MEM_WR_ENABLE, chip_num);
 
+    /* all bytes to be written must be
+    proceeded by the Page Program command */
+    start_spi_dev(&mem_spi_devs[chip_num]);
+    send_spi(MEM_PG_PRG);
+    send_spi(addr1);
+    send_spi(addr2);
+    send_spi(addr3);
+    for (uint16_t i = 0; i < data_len; i++) {
         send_spi(data[i]);
     }
+    // Raising CS starts the internal program operation
+    end_spi_dev(&mem_spi_devs[chip_num]);
 
-    set_cs_high(mem_cs[chip_num].pin, mem_cs[chip_num].port);
-
-    //used to determine the end of a write operation
-    wait_for_mem_not_busy(chip_num);
-
-    send_short_mem_command(MEM_WR_DISABLE, chip_num);
+    // The WEL bit is cleared by the chip when programming completes, so
+    // WR_DISABLE is not needed afterwards
+    mem_chip_busy[chip_num] = 1;
 }
 
 
@@ -615,86 +2004,113 @@ void read_mem_bytes(uint32_t address, uint8_t* data, uint32_t data_len){
         highest address wrap-around (to zero)
 
         reads continously across chips (ie behaves as a continous address space)
+
+    The read is split into one segment per chip up front (instead of checking
+    for a chip rollover on every byte). Each segment is one FAST_READ
+    operation with the SPI clock at its maximum frequency.
 */
 
+#ifdef MEM_DEBUG
+    uint32_t start_address = address;
+    uint8_t* start_data = data;
+    uint32_t start_data_len = data_len;
+#endif
+
     uint8_t chip_num;
     uint8_t addr1;
     uint8_t addr2;
     uint8_t addr3;
-    process_mem_addr(address, &chip_num, &addr1, &addr2, &addr3);
-    if (chip_num >= MEM_NUM_CHIPS) {
-        return;
-    }
 
-    set_cs_low(mem_cs[chip_num].pin, mem_cs[chip_num].port);
-    send_spi(MEM_R_BYTE);
-    send_spi(addr1);
-    send_spi(addr2);
-    send_spi(addr3);
+    while (data_len > 0) {
+        process_mem_addr(address, &chip_num, &addr1, &addr2, &addr3);
+        //ensure wrap-around back to chip 0
+        if (chip_num >= MEM_NUM_CHIPS) {
+            break;
+        }
 
-    for (uint32_t i = 0; i < data_len; i++) {
-        // Get the chip number of the next address
-        uint8_t new_chip_num;
-        process_mem_addr(address + i, &new_chip_num, &addr1, &addr2, &addr3);
-
-        // checks for chip rollover condition (moving to address on new chip)
-        if (new_chip_num != chip_num)
-        {
-            // Stop reading from this chip
-            set_cs_high(mem_cs[chip_num].pin, mem_cs[chip_num].port);
-
-            chip_num = new_chip_num;
-            //ensure wrap-around back to chip 0
-            if (chip_num >= MEM_NUM_CHIPS) {
-                return;
-            }
+        // Number of bytes from this address to the end of its chip
+        uint32_t chip_end = ((uint32_t) chip_num + 1) << MEM_CHIP_ADDR_WIDTH;
+        uint32_t seg_len = chip_end - address;
+        if (seg_len > data_len) {
+            seg_len = data_len;
+        }
 
-            /* Begin read on new chip */
-            set_cs_low(mem_cs[chip_num].pin, mem_cs[chip_num].port);
-            send_spi(MEM_R_BYTE);
-            send_spi(0x00);
-            send_spi(0x00);
-            send_spi(0x00);
+        wait_for_mem_ready(chip_num);
+
+        // Same chip with the SPI clock at its maximum frequency (F_CPU / 2),
+        // which is well below the 104 MHz FAST_READ allows on the SST26VF016B
+        spi_dev_t fast_dev = mem_spi_devs[chip_num];
+        fast_dev.clk = SPI_BUS_CLK_MAX;
+
+        start_spi_dev(&fast_dev);
+        send_spi(MEM_FAST_READ);
+        send_spi(addr1);
+        send_spi(addr2);
+        send_spi(addr3);
+        // FAST_READ requires one dummy byte after the address
+        send_spi(0x00);
+        for (uint32_t i = 0; i < seg_len; i++) {
+            data[i] = send_spi(0x00);
         }
+        end_spi_dev(&fast_dev);
 
-        data[i] = send_spi(0x00);
+        address += seg_len;
+        data += seg_len;
+        data_len -= seg_len;
     }
 
-    set_cs_high(mem_cs[chip_num].pin, mem_cs[chip_num].port);
-
 #ifdef MEM_DEBUG
     print("%s: ", __FUNCTION__);
-    print("addr = 0x%.8lX, len = %u\n", address, data_len);
+    print("addr = 0x%.8lX, len = %u\n", start_address, start_data_len);
     print("data = ");
-    print_bytes(data, data_len);
+    print_bytes(start_data, start_data_len);
 #endif
 }
 
 /*
 Erases all memory chips.
 Erasing is defined as setting all bits to 1 (all bytes to 0xFF).
+The chip erases are all started first and then waited for together, so this
+    takes about as long as erasing one chip.
 */
 void erase_mem(void) {
     for (uint8_t i = 0; i < MEM_NUM_CHIPS; i++) {
-        erase_mem_chip(i);
+        start_mem_chip_erase(i);
     }
+    wait_for_all_mem_ready();
+
+    // Everything waiting for a background erase has just been erased
+    mem_erase_queue_count = 0;
 }
 
 void erase_mem_chip(uint8_t chip){
 /*
     erase the specified memory chip (overwrite all data to ones)
 */
+    start_mem_chip_erase(chip);
+    wait_for_mem_ready(chip);
+}
+
+/*
+Starts erasing the whole chip, but does not wait for the erase to finish (the
+    chip is marked busy instead).
+*/
+void start_mem_chip_erase(uint8_t chip) {
+    invalidate_mem_caches((uint32_t) chip << MEM_CHIP_ADDR_WIDTH,
+        (((uint32_t) chip + 1) << MEM_CHIP_ADDR_WIDTH) - 1, NULL);
+    wait_for_mem_ready(chip);
     send_short_mem_command(MEM_WR_ENABLE, chip);
     send_short_mem_command(MEM_ERASE, chip);
-    send_short_mem_command(MEM_WR_DISABLE, chip);
 
-    wait_for_mem_not_busy(chip);
+    // WEL is cleared by the chip when the erase completes
+    mem_chip_busy[chip] = 1;
 }
 
 
 void unlock_mem(void){
     // send the global mem unlock command to enable write operations
     for(uint8_t i = 0; i < MEM_NUM_CHIPS; i++) {
+        wait_for_mem_ready(i);
         send_short_mem_command(MEM_WR_ENABLE, i);
         send_short_mem_command(MEM_UNLOCK, i);
     }
@@ -722,6 +2138,26 @@ void wait_for_mem_not_busy(uint8_t chip_num) {
 #endif
 }
 
+/*
+If a page program was started on the chip and has not been confirmed finished,
+    waits for it to finish. Does nothing if the chip is already known to be idle.
+*/
+void wait_for_mem_ready(uint8_t chip_num) {
+    if (mem_chip_busy[chip_num]) {
+        wait_for_mem_not_busy(chip_num);
+        mem_chip_busy[chip_num] = 0;
+    }
+}
+
+/*
+Waits for any outstanding page programs on all chips to finish.
+*/
+void wait_for_all_mem_ready(void) {
+    for (uint8_t i = 0; i < MEM_NUM_CHIPS; i++) {
+        wait_for_mem_ready(i);
+    }
+}
+
 uint8_t read_mem_status(uint8_t chip){
     // read from the status register
 
@@ -732,11 +2168,12 @@ uint8_t read_mem_status(uint8_t chip){
 void write_mem_status(uint8_t status, uint8_t chip){
     // write to the configuration register
 
-    set_cs_low(mem_cs[chip].pin, mem_cs[chip].port);
+    wait_for_mem_ready(chip);
+    start_spi_dev(&mem_spi_devs[chip]);
     send_spi(MEM_WRITE_STATUS);
     send_spi(0x00);
     send_spi(status);
-    set_cs_high(mem_cs[chip].pin, mem_cs[chip].port);
+    end_spi_dev(&mem_spi_devs[chip]);
 }
 
 
@@ -744,47 +2181,257 @@ uint8_t send_mem_command(uint8_t command, uint8_t data, uint8_t chip){
     // send a command with an argument and return value to the device
 
     uint8_t value;
-    set_cs_low(mem_cs[chip].pin, mem_cs[chip].port);
+    start_spi_dev(&mem_spi_devs[chip]);
     send_spi(command);
     value = send_spi(data);
-    set_cs_high(mem_cs[chip].pin, mem_cs[chip].port);
+    end_spi_dev(&mem_spi_devs[chip]);
     return value;
 }
 
 
 void send_short_mem_command(uint8_t command, uint8_t chip){
     // send a command without an argument or return value to the device
-    set_cs_low(mem_cs[chip].pin, mem_cs[chip].port);
+    start_spi_dev(&mem_spi_devs[chip]);
     send_spi(command);
-    set_cs_high(mem_cs[chip].pin, mem_cs[chip].port);
+    end_spi_dev(&mem_spi_devs[chip]);
 }
 
 /* Takes an address and chip as input and erases the appropriate sector */
 /* Each sector is 4kb, see pg. 24 for more info on sector erase */
 /* address is in bytes */
 void erase_mem_sector(uint32_t address){
+    uint8_t chip_num;
+    process_mem_addr(address, &chip_num, NULL, NULL, NULL);
+    if (start_mem_sector_erase(address)) {
+        wait_for_mem_ready(chip_num);
+    }
+}
+
+/*
+Starts erasing the sector containing `address`, but does not wait for the erase
+    to finish (the chip is marked busy instead).
+Returns 1 if the erase was started, 0 if the address is invalid.
+*/
+uint8_t start_mem_sector_erase(uint32_t address) {
     uint8_t chip_num;
     uint8_t addr1;
     uint8_t addr2;
     uint8_t addr3;
     process_mem_addr(address, &chip_num, &addr1, &addr2, &addr3);
     if (chip_num >= MEM_NUM_CHIPS) {
-        return;
+        return 0;
     }
 
+    uint32_t sector_addr = mem_addr_for_sector(mem_sector_for_addr(address));
+    invalidate_mem_caches(sector_addr, sector_addr + MEM_BYTES_PER_SECTOR - 1,
+        NULL);
+
+    wait_for_mem_ready(chip_num);
     send_short_mem_command(MEM_WR_ENABLE, chip_num);
 
-    set_cs_low(mem_cs[chip_num].pin, mem_cs[chip_num].port);
+    start_spi_dev(&mem_spi_devs[chip_num]);
     send_spi(MEM_SECTOR_ERASE);
     /* Remaining bits after sector address can be either high or low, so
        the entire address can be sent as bit 23 is the MSB */
     send_spi(addr1);
     send_spi(addr2);
     send_spi(addr3);
-    set_cs_high(mem_cs[chip_num].pin, mem_cs[chip_num].port);
+    end_spi_dev(&mem_spi_devs[chip_num]);
 
-    send_short_mem_command(MEM_WR_DISABLE, chip_num);
-    wait_for_mem_not_busy(chip_num);
+    // WEL is cleared by the chip when the erase completes
+    mem_chip_busy[chip_num] = 1;
+    return 1;
+}
+
+/*
+Checks (without waiting) whether the chip has finished its last program/erase.
+Returns 1 if the chip is ready for a new operation, 0 if it is still busy.
+*/
+uint8_t poll_mem_ready(uint8_t chip_num) {
+    if (mem_chip_busy[chip_num]) {
+        if (read_mem_status(chip_num) & _BV(MEM_BUSY)) {
+            return 0;
+        }
+        mem_chip_busy[chip_num] = 0;
+    }
+    return 1;
+}
+
+/*
+Adds a sector to be erased in the background by run_mem_erase().
+This never erases synchronously (it can be called with interrupts disabled),
+    so if the queue is full nothing is queued.
+Returns true if the sector was queued (or was already queued).
+*/
+bool enqueue_mem_sector_erase(uint32_t sector) {
+    if (mem_addr_for_sector(sector) >= MEM_NUM_ADDRESSES) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < mem_erase_queue_count; i++) {
+        if (mem_erase_queue[i] == sector) {
+            return true;
+        }
+    }
+
+    if (mem_erase_queue_count >= MEM_ERASE_QUEUE_SIZE) {
+        return false;
+    }
+
+    mem_erase_queue[mem_erase_queue_count] = sector;
+    mem_erase_queue_count++;
+    set_event(EVENT_MEM_ERASE);
+    return true;
+}
+
+/*
+Removes the sector at index i from the background erase queue.
+*/
+void remove_mem_erase_queue_entry(uint8_t i) {
+    for (; i + 1 < mem_erase_queue_count; i++) {
+        mem_erase_queue[i] = mem_erase_queue[i + 1];
+    }
+    mem_erase_queue_count--;
+}
+
+/*
+If the sector is still waiting to be erased in the background, erases it now
+    (blocking). Used before writing so data can't be written to a sector and
+    then erased afterwards.
+*/
+void finish_pending_mem_sector_erase(uint32_t sector) {
+    for (uint8_t i = 0; i < mem_erase_queue_count; i++) {
+        if (mem_erase_queue[i] == sector) {
+            remove_mem_erase_queue_entry(i);
+            erase_mem_sector(mem_addr_for_sector(sector));
+            return;
+        }
+    }
+}
+
+/*
+Background erase engine - call this from the main loop.
+Starts the first queued sector erase on each chip that is not busy, without
+    waiting, so erases on different chips run at the same time. The next
+    operation on a chip waits for its erase to finish (normally it has already
+    finished by then).
+*/
+void run_mem_erase(void) {
+    // Bit i is set if chip i is busy (or was just started) in this pass, so
+    // each chip is only polled once
+    uint8_t busy_chips = 0;
+
+    uint8_t prev_count = mem_erase_queue_count;
+
+    uint8_t i = 0;
+    while (i < mem_erase_queue_count) {
+        uint32_t sector = mem_erase_queue[i];
+        uint8_t chip_num;
+        process_mem_addr(mem_addr_for_sector(sector), &chip_num,
+            NULL, NULL, NULL);
+
+        if ((busy_chips & _BV(chip_num)) || !poll_mem_ready(chip_num)) {
+            busy_chips |= _BV(chip_num);
+            i++;
+            continue;
+        }
+
+        remove_mem_erase_queue_entry(i);
+        start_mem_sector_erase(mem_addr_for_sector(sector));
+        busy_chips |= _BV(chip_num);
+
+#ifdef MEM_DEBUG
+        print("Started bg erase: sector = 0x%lx\n", sector);
+#endif
+    }
+
+    // Queue the look-ahead erases that did not fit before
+    if (mem_erase_queue_count < prev_count) {
+        for (uint8_t j = 0; j < MEM_NUM_SECTIONS; j++) {
+            mem_section_t* section = all_mem_sections[j];
+            if (section->erase_retry_sector != MEM_ERASE_NO_RETRY) {
+                erase_mem_section_ahead(section, section->erase_retry_sector);
+            }
+        }
+    }
+
+    if (mem_erase_queue_count > 0) {
+        // Poll again on the next pass
+        set_event(EVENT_MEM_ERASE);
+    }
+}
+
+/*
+Queues background erases for `sector` (the sector a section is about to enter)
+    and the next MEM_ERASE_LOOKAHEAD_SECTORS sectors that are within the section.
+Sectors already queued for this section are not queued again.
+For a striped section, `sector` is in the first part (see
+    mem_section_erase_sector()) and the sector at the same offset in every
+    part is queued with it, so run_mem_erase() erases them in parallel.
+If the queue fills up, the section keeps `sector` in erase_retry_sector and
+    the rest are queued by run_mem_erase() once there is room, or by
+    retry_mem_section_erase_ahead() before the section is written.
+Returns true if `sector` has been queued (even if some of the sectors after it
+    have not been yet).
+*/
+bool erase_mem_section_ahead(mem_section_t* section, uint32_t sector) {
+    uint8_t stripes = mem_section_stripes(section);
+    // Number of sectors in each part
+    uint32_t part_sectors = 0;
+    uint32_t section_last_sector = mem_sector_for_addr(section->end_addr);
+    if (stripes > 1) {
+        part_sectors = (section->end_addr - section->start_addr + 1) /
+            stripes / MEM_BYTES_PER_SECTOR;
+        section_last_sector = mem_sector_for_addr(section->start_addr) +
+            part_sectors - 1;
+    }
+
+    uint32_t last_sector = sector + MEM_ERASE_LOOKAHEAD_SECTORS;
+    if (last_sector > section_last_sector) {
+        last_sector = section_last_sector;
+    }
+
+    // If the section moved somewhere else (e.g. wrapped around or the block
+    // number was set), start over from the sector being entered
+    uint32_t first_sector = section->erase_ahead_sector + 1;
+    if (section->erase_ahead_sector < sector ||
+            section->erase_ahead_sector > last_sector) {
+        first_sector = sector;
+    }
+
+    for (uint32_t i = first_sector; i <= last_sector; i++) {
+        for (uint8_t part = 0; part < stripes; part++) {
+            // If the queue is full, continue from this sector later (the
+            // parts already queued are not queued twice)
+            if (!enqueue_mem_sector_erase(i + (part * part_sectors))) {
+                section->erase_retry_sector = sector;
+                return i > sector;
+            }
+        }
+        section->erase_ahead_sector = i;
+    }
+
+    section->erase_retry_sector = MEM_ERASE_NO_RETRY;
+    return true;
+}
+
+/*
+Before writing to a section, queues the look-ahead erases that did not fit in
+    the queue (see erase_mem_section_ahead()).
+If the sector the section entered still does not fit, the oldest queued
+    erases are finished now (blocking) to make room, so the write erases it
+    first with finish_pending_mem_sector_erase() instead of programming a
+    sector that was never erased.
+*/
+void retry_mem_section_erase_ahead(mem_section_t* section) {
+    if (section->erase_retry_sector == MEM_ERASE_NO_RETRY) {
+        return;
+    }
+
+    while (!erase_mem_section_ahead(section, section->erase_retry_sector) &&
+            mem_erase_queue_count > 0) {
+        finish_pending_mem_sector_erase(mem_erase_queue[0]);
+    }
 }
 
 /* Takes an address and chip as input and deletes the appropriate block.
@@ -800,16 +2447,20 @@ void erase_mem_block(uint32_t address){
         return;
     }
 
+    // Blocks are up to 64kB - invalidate anything in the surrounding 64kB
+    invalidate_mem_caches(address & ~0xFFFFUL, address | 0xFFFFUL, NULL);
+
+    wait_for_mem_ready(chip_num);
     send_short_mem_command(MEM_WR_ENABLE, chip_num);
 
-    set_cs_low(mem_cs[chip_num].pin, mem_cs[chip_num].port);
+    start_spi_dev(&mem_spi_devs[chip_num]);
     send_spi(MEM_BLOCK_ERASE);
     /* Remaining bits after block address can be either high or low, so
        the entire address can be sent as bit 23 is the MSB*/
     send_spi(addr1);
     send_spi(addr2);
     send_spi(addr3);
-    set_cs_high(mem_cs[chip_num].pin, mem_cs[chip_num].port);
+    end_spi_dev(&mem_spi_devs[chip_num]);
 
     send_short_mem_command(MEM_WR_DISABLE, chip_num);
     wait_for_mem_not_busy(chip_num);
@@ -1,6 +1,9 @@
 #ifndef MEM_H
 #define MEM_H
 
+#include <stdbool.h>
+#include <string.h>
+
 // AVR Library Includes
 #include <avr/io.h>
 #include <avr/eeprom.h>
@@ -9,8 +12,12 @@
 #include <spi/spi.h>
 #include <uart/uart.h>
 #include <can/data_protocol.h>
+#include <utilities/utilities.h>
 
+#include "events.h"
+#include "profiler.h"
 #include "rtc.h"
+#include "spi_bus.h"
 
 
 // Pins and Ports
@@ -61,6 +68,11 @@
 #define MEM_BYTES_PER_FIELD         3
 // Number of bytes in one command log
 #define MEM_BYTES_PER_CMD           11
+// Number of bytes in the largest data block (PAY_OPT)
+#define MEM_MAX_BYTES_PER_DATA_BLOCK \
+    (MEM_BYTES_PER_HEADER + (CAN_PAY_OPT_TOT_FIELD_COUNT * MEM_BYTES_PER_FIELD))
+// Number of bytes per page (maximum length of one page program operation)
+#define MEM_BYTES_PER_PAGE          256
 // Number of bytes per memory sector
 #define MEM_BYTES_PER_SECTOR        4096
 
@@ -79,6 +91,14 @@
 
 #define MEM_NUM_ADDRESSES           0x600000UL
 
+// Maximum number of sector erases waiting to be started in the background
+#define MEM_ERASE_QUEUE_SIZE        16
+// Number of sectors past the sector being entered that are erased in the
+// background, so writing a new block never has to wait for an erase
+#define MEM_ERASE_LOOKAHEAD_SECTORS 2
+// erase_retry_sector of a section with all of its look-ahead erases queued
+#define MEM_ERASE_NO_RETRY          0xFFFFFFFFUL
+
 #define MEM_OBC_HK_CURR_BLOCK_EEPROM_ADDR       0x120
 #define MEM_OBC_HK_START_ADDR_EEPROM_ADDR       0x124
 #define MEM_OBC_HK_END_ADDR_EEPROM_ADDR         0x128
@@ -98,6 +118,104 @@
 #define MEM_SEC_CMD_LOG_START_ADDR_EEPROM_ADDR  0x1C4
 #define MEM_SEC_CMD_LOG_END_ADDR_EEPROM_ADDR    0x1C8
 
+// Journal of current block numbers in EEPROM (ring of 32-bit records)
+// Each record is {lap (1 bit), section index (7 bits), curr_block (24 bits)}
+// The *_CURR_BLOCK_EEPROM_ADDR values above are only read if a section has
+// no record in the journal (before its first update)
+// Each lap starts with a record for every section (see append_mem_journal())
+#define MEM_JOURNAL_START_EEPROM_ADDR   0x600
+#define MEM_JOURNAL_END_EEPROM_ADDR     0x800
+#define MEM_JOURNAL_NUM_RECORDS \
+    ((MEM_JOURNAL_END_EEPROM_ADDR - MEM_JOURNAL_START_EEPROM_ADDR) / 4)
+#define MEM_JOURNAL_LAP_BIT             31
+#define MEM_JOURNAL_SECTION_SHIFT       24
+#define MEM_JOURNAL_SECTION_MASK        0x7F
+#define MEM_JOURNAL_BLOCK_MASK          0xFFFFFFUL
+
+// Block number read from the header of a block that has not been written
+#define MEM_ERASED_BLOCK_NUM            0xFFFFFFUL
+
+// Uncomment to store EPS_HK blocks in the compressed format (see
+// mem_compressed_state_t)
+// #define MEM_EPS_HK_COMPRESSED
+
+// Uncomment to store a CRC of each data block after its fields when the block
+// is committed (see write_mem_block_crc()), so ground can check which blocks
+// it has are still the same (see sync_data_blocks_fn())
+// #define MEM_DATA_BLOCK_CRC
+// Number of bytes in a data block's CRC (CRC-16/CCITT-FALSE of the header and
+// fields, big-endian)
+#define MEM_BYTES_PER_CRC               2
+#define MEM_CRC_INIT                    0xFFFF
+// CRC read from a block that has not been committed (a calculated CRC with
+// this value is stored as MEM_CRC_ERASED - 1 instead)
+#define MEM_CRC_ERASED                  0xFFFF
+
+// Uncomment to stripe PAY_OPT across the chips it is on (see
+// mem_section_phy_addr())
+// #define MEM_PAY_OPT_STRIPED
+// PAY_OPT is half on chip 1 and half on chip 2
+#define MEM_PAY_OPT_STRIPES             2
+
+// Compressed data sections
+// Each block is stored as a variable-length record. Records never cross a
+// sector boundary and the first record in every sector is a keyframe, so any
+// block can be found by searching the sectors and decoding forward from the
+// start of one sector.
+// Keyframe: {type, header (10 bytes), fields (3 bytes each)}
+// Delta: {type, date (3 bytes), time (3 bytes), status, bitmap of changed
+//     fields, one varint per changed field} - the block number is one more
+//     than the previous record, and each varint is the zigzag-encoded 24-bit
+//     difference from the same field in the previous record (7 bits per byte,
+//     MSB set if more bytes follow)
+#define MEM_COMPRESSED_KEYFRAME         0x4B
+#define MEM_COMPRESSED_DELTA            0x44
+#define MEM_COMPRESSED_ERASED           0xFF
+// Sections with more fields than this can't be compressed
+#define MEM_COMPRESSED_MAX_FIELDS       32
+#define MEM_COMPRESSED_BITMAP_BYTES     (MEM_COMPRESSED_MAX_FIELDS / 8)
+// Bytes in a delta record before the bitmap
+#define MEM_COMPRESSED_DELTA_HEADER_BYTES   8
+// Maximum number of bytes in one varint (25 bits after zigzag encoding)
+#define MEM_COMPRESSED_MAX_VARINT_BYTES 4
+#define MEM_COMPRESSED_MAX_RECORD_BYTES \
+    (MEM_COMPRESSED_DELTA_HEADER_BYTES + MEM_COMPRESSED_BITMAP_BYTES + \
+    (MEM_COMPRESSED_MAX_FIELDS * MEM_COMPRESSED_MAX_VARINT_BYTES))
+
+
+// Number of bytes in one block of each section (used for the block caches,
+// which also have space for the CRC after the fields)
+#define MEM_OBC_HK_BYTES_PER_BLOCK \
+    (MEM_BYTES_PER_HEADER + (CAN_OBC_HK_FIELD_COUNT * MEM_BYTES_PER_FIELD))
+#define MEM_EPS_HK_BYTES_PER_BLOCK \
+    (MEM_BYTES_PER_HEADER + (CAN_EPS_HK_FIELD_COUNT * MEM_BYTES_PER_FIELD))
+#define MEM_PAY_HK_BYTES_PER_BLOCK \
+    (MEM_BYTES_PER_HEADER + (CAN_PAY_HK_FIELD_COUNT * MEM_BYTES_PER_FIELD))
+#define MEM_CMD_LOG_BYTES_PER_BLOCK \
+    (MEM_BYTES_PER_HEADER + MEM_BYTES_PER_CMD)
+
+
+// Copy in RAM of the most recently written block of a section
+typedef struct {
+    // true if `bytes` matches what is in flash for block `block_num`
+    bool valid;
+    uint32_t block_num;
+    // Raw bytes of the block as stored in flash (header then fields/command)
+    uint8_t* bytes;
+} mem_block_cache_t;
+
+// Write state of a section stored in the compressed format (only kept in RAM,
+// recovered from flash by recover_mem_compressed_section())
+typedef struct {
+    // Address (from the beginning of all memory) to write the next record to
+    uint32_t write_addr;
+    // true if the next record must be a keyframe at the start of a new sector
+    // (e.g. after a restart or if the current sector was erased)
+    bool resync;
+    // Block number and fields (packed) of the last record written
+    uint32_t prev_block_num;
+    uint8_t prev_fields[MEM_COMPRESSED_MAX_FIELDS * MEM_BYTES_PER_FIELD];
+} mem_compressed_state_t;
 
 // Sections in memory
 typedef struct {
@@ -114,6 +232,27 @@ typedef struct {
     // Number of fields in one block (NOT including the header)
     // This only matters for the data block sections, not the command log block sections
     uint8_t fields_per_block;
+    // Number of equal parts (each on a different chip) that consecutive pages
+    // of the section rotate across, so that writes to one chip overlap the
+    // program time of the previous one (1 for a normal section, see
+    // mem_section_phy_addr())
+    uint8_t stripes;
+    // true if a CRC is stored after the fields of each block (see
+    // write_mem_block_crc(), not used for compressed sections)
+    bool block_crc;
+    // Farthest sector that has been queued for a look-ahead erase
+    // (only kept in RAM, it is fine to erase the same sectors again after a
+    // restart)
+    uint32_t erase_ahead_sector;
+    // Sector the section entered when its look-ahead erases did not all fit
+    // in the background erase queue, so they are queued again later
+    // (MEM_ERASE_NO_RETRY if there is nothing to retry)
+    uint32_t erase_retry_sector;
+    // Write-through cache of the most recently written block (NULL for no
+    // cache)
+    mem_block_cache_t* cache;
+    // Compressed format write state (NULL if blocks are stored uncompressed)
+    mem_compressed_state_t* compressed;
 } mem_section_t;
 
 // A collection of the data for one header in memory
@@ -137,37 +276,71 @@ extern mem_section_t prim_cmd_log_mem_section;
 extern mem_section_t sec_cmd_log_mem_section;
 extern mem_section_t* all_mem_sections[];
 
+extern uint8_t mem_chip_busy[];
+extern uint32_t mem_erase_queue[];
+extern uint8_t mem_erase_queue_count;
+
+extern uint16_t mem_journal_head;
+extern uint8_t mem_journal_lap;
+
 
 // Initialization
 void init_mem(void);
 void clear_mem_header(mem_header_t* header);
+void set_mem_header_erased(mem_header_t* header);
 
 // EEPROM
 void write_mem_section_eeprom(mem_section_t* section);
 void read_mem_section_eeprom(mem_section_t* section);
 void read_all_mem_sections_eeprom(void);
+uint8_t mem_section_index(mem_section_t* section);
+void init_mem_journal(void);
+void read_mem_journal(void);
+void write_mem_journal_record(uint8_t section_index, uint32_t curr_block);
+void append_mem_journal(mem_section_t* section);
+
+// Boot recovery of current block numbers from the headers in flash
+bool is_mem_block_erased(mem_section_t* section, uint32_t block_num);
+uint32_t scan_mem_section_head(mem_section_t* section, uint32_t start_block);
+uint32_t find_mem_section_head(mem_section_t* section, uint32_t start_block);
+void recover_mem_section_curr_block(mem_section_t* section);
+void recover_all_mem_sections_curr_block(void);
 void set_mem_section_curr_block(mem_section_t* section, uint32_t curr_block);
 void set_mem_section_start_addr(mem_section_t* section, uint32_t start_addr);
 void set_mem_section_end_addr(mem_section_t* section, uint32_t end_addr);
 
 // High-level operations - blocks
+uint32_t get_packed_field(const uint8_t* fields, uint8_t field_num);
+void set_packed_field(uint8_t* fields, uint8_t field_num, uint32_t value);
 void read_mem_data_block(mem_section_t* section, uint32_t block_num,
-    mem_header_t* header, uint32_t* fields);
+    mem_header_t* header, uint8_t* fields);
 
 uint8_t write_mem_cmd_block(mem_section_t* section, uint32_t block_num,
     mem_header_t* header, uint16_t cmd_id, uint8_t opcode, uint32_t arg1,
     uint32_t arg2);
+void mem_cmd_to_bytes(uint16_t cmd_id, uint8_t opcode, uint32_t arg1,
+    uint32_t arg2, uint8_t* bytes);
 void read_mem_cmd_block(mem_section_t* section, uint32_t block_num,
     mem_header_t* header, uint16_t* cmd_id,
     uint8_t* opcode, uint32_t* arg1, uint32_t* arg2);
 
 // High-level operations - headers and fields
+void mem_bytes_to_header(uint8_t* bytes, mem_header_t* header);
+void mem_header_to_bytes(mem_header_t* header, uint8_t* bytes);
 void write_mem_header_main(mem_section_t* section, uint32_t block_num,
     mem_header_t* header);
 void write_mem_header_status(mem_section_t* section, uint32_t block_num,
     uint8_t status);
 void read_mem_header(mem_section_t* section, uint32_t block_num,
     mem_header_t* header);
+uint8_t write_mem_data_block_fields(mem_section_t* section, uint32_t block_num,
+    mem_header_t* header, uint8_t* fields, bool write_header,
+    uint8_t start_field, uint8_t end_field);
+bool mem_section_has_block_crc(mem_section_t* section);
+uint16_t mem_crc16_update(uint16_t crc, uint8_t byte);
+uint16_t calc_mem_block_crc(mem_section_t* section, uint32_t block_num);
+void write_mem_block_crc(mem_section_t* section, uint32_t block_num);
+uint16_t read_mem_block_crc(mem_section_t* section, uint32_t block_num);
 void write_mem_field(mem_section_t* section, uint32_t block_num,
     uint8_t field_num, uint32_t data);
 uint32_t read_mem_field(mem_section_t* section, uint32_t block_num,
@@ -176,7 +349,15 @@ uint32_t read_mem_field(mem_section_t* section, uint32_t block_num,
 // Address calculations
 uint32_t mem_sector_for_addr(uint32_t address);
 uint32_t mem_addr_for_sector(uint32_t sector);
+uint8_t mem_section_stripes(mem_section_t* section);
+uint32_t mem_section_phy_addr(mem_section_t* section, uint32_t address);
+uint32_t mem_section_phy_len(mem_section_t* section, uint32_t address,
+    uint32_t data_len);
+bool mem_section_bytes_overlap(mem_section_t* section, uint32_t address,
+    uint32_t data_len, uint32_t start_addr, uint32_t end_addr);
+uint32_t mem_section_erase_sector(mem_section_t* section, uint32_t address);
 uint32_t mem_block_size(mem_section_t* section);
+uint32_t mem_section_num_blocks(mem_section_t* section);
 uint32_t mem_block_section_addr(mem_section_t* section, uint32_t block_num);
 uint32_t mem_block_addr(mem_section_t* section, uint32_t block_num);
 uint32_t mem_block_end_section_addr(mem_section_t* section, uint32_t block_num);
@@ -184,22 +365,56 @@ uint32_t mem_block_end_addr(mem_section_t* section, uint32_t block_num);
 uint32_t mem_field_section_addr(mem_section_t* section, uint32_t block_num,
     uint32_t field_num);
 uint32_t mem_cmd_section_addr(mem_section_t* section, uint32_t block_num);
+uint32_t mem_crc_section_addr(mem_section_t* section, uint32_t block_num);
 void process_mem_addr(uint32_t address, uint8_t* chip_num, uint8_t* addr1,
     uint8_t* addr2, uint8_t* addr3);
 
+// Block caches
+void invalidate_mem_caches(uint32_t start_addr, uint32_t end_addr,
+    mem_section_t* skip_section);
+bool read_mem_block_cache(mem_section_t* section, uint32_t address,
+    uint8_t* data, uint8_t data_len);
+void start_mem_block_cache(mem_section_t* section, uint32_t block_num);
+void write_mem_block_cache(mem_section_t* section, uint32_t address,
+    uint8_t* data, uint8_t data_len);
+
+// Compressed data sections
+uint32_t mem_compressed_first_sector(mem_section_t* section);
+uint32_t mem_compressed_last_sector(mem_section_t* section);
+void init_mem_compressed_section(mem_section_t* section);
+uint8_t encode_mem_compressed_record(mem_section_t* section,
+    mem_header_t* header, uint8_t* fields, bool keyframe, uint8_t* record);
+uint8_t write_mem_compressed_block(mem_section_t* section,
+    mem_header_t* header, uint8_t* fields);
+uint32_t read_mem_compressed_sector_keyframe(mem_section_t* section,
+    uint32_t sector);
+uint16_t decode_mem_compressed_sector(mem_section_t* section, uint32_t sector,
+    uint32_t block_num, mem_header_t* header, uint8_t* fields);
+bool read_mem_compressed_block(mem_section_t* section, uint32_t block_num,
+    mem_header_t* header, uint8_t* fields);
+void recover_mem_compressed_section(mem_section_t* section);
+
 // Section operations
 uint8_t write_mem_section_bytes(mem_section_t *section, uint32_t address, uint8_t* data, uint8_t data_len);
 void read_mem_section_bytes(mem_section_t *section, uint32_t address, uint8_t* data, uint8_t data_len);
+void read_mem_section_bytes_raw(mem_section_t* section, uint32_t address,
+    uint8_t* data, uint32_t data_len);
 
 // Low-level operations - raw bytes
 void write_mem_bytes(uint32_t address, uint8_t* data, uint32_t data_len);
+void write_mem_bytes_raw(uint32_t address, uint8_t* data, uint32_t data_len);
+void write_mem_page_burst(uint8_t chip_num, uint8_t addr1, uint8_t addr2,
+    uint8_t addr3, uint8_t* data, uint16_t data_len);
 void read_mem_bytes(uint32_t address, uint8_t* data, uint32_t data_len);
 void erase_mem(void);
 void erase_mem_chip(uint8_t chip);
+void start_mem_chip_erase(uint8_t chip);
 void unlock_mem(void);
 
 // Status
 void wait_for_mem_not_busy(uint8_t chip_num);
+void wait_for_mem_ready(uint8_t chip_num);
+void wait_for_all_mem_ready(void);
 uint8_t read_mem_status(uint8_t chip);
 void write_mem_status(uint8_t status, uint8_t chip);
 
@@ -210,5 +425,14 @@ void send_short_mem_command(uint8_t command, uint8_t chip);
 // Block and sector erase
 void erase_mem_block(uint32_t address);
 void erase_mem_sector(uint32_t address);
+uint8_t start_mem_sector_erase(uint32_t address);
+uint8_t poll_mem_ready(uint8_t chip_num);
+
+// Background (non-blocking) sector erase
+bool enqueue_mem_sector_erase(uint32_t sector);
+void finish_pending_mem_sector_erase(uint32_t sector);
+void run_mem_erase(void);
+bool erase_mem_section_ahead(mem_section_t* section, uint32_t sector);
+void retry_mem_section_erase_ahead(mem_section_t* section);
 
 #endif
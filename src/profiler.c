@@ -0,0 +1,107 @@
+/*
+Main loop profiler
+
+Measures how long each main loop stage takes (number of runs, total and
+longest duration) and the longest time spent in a PROF_ATOMIC_BLOCK, so we can
+find what is using the time when the watchdog gets close or a response is slow.
+The table is read (and reset) from the ground with the read profiler stats
+command.
+
+There is no extra timer - the uptime timer (timer 1) is already running, so
+times are uptime_s plus the timer count within the current second. Reading it
+only takes a few cycles, but the resolution is one timer tick (1024 cycles).
+
+The stage and atomic block table is compiled out unless PROFILER is defined
+(see profiler.h). prof_ticks() is always available since the command latency
+histograms also use it.
+*/
+
+#include "profiler.h"
+
+#ifdef PROFILER
+prof_stage_t prof_stages[PROF_NUM_STAGES];
+// Longest PROF_ATOMIC_BLOCK
+volatile uint16_t prof_atomic_max_ticks = 0;
+#endif
+
+
+/*
+Returns the number of uptime timer ticks per second (one second per compare
+    match).
+*/
+uint16_t prof_ticks_per_s(void) {
+    return OCR1A + 1;
+}
+
+/*
+Returns the time since init_uptime() in uptime timer ticks.
+*/
+uint32_t prof_ticks(void) {
+    uint32_t seconds;
+    uint16_t count;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        seconds = uptime_s;
+        count = TCNT1;
+        // If the compare match happened but the interrupt has not run yet,
+        // the count already started the next second
+        if (TIFR1 & _BV(OCF1A)) {
+            seconds++;
+            count = TCNT1;
+        }
+    }
+    return (seconds * prof_ticks_per_s()) + count;
+}
+
+#ifdef PROFILER
+
+/*
+Adds one run of `stage` that started at `start_ticks` (from prof_ticks()) and
+    ends now.
+*/
+void prof_add_stage(uint8_t stage, uint32_t start_ticks) {
+    if (stage >= PROF_NUM_STAGES) {
+        return;
+    }
+
+    uint32_t ticks = prof_ticks() - start_ticks;
+    prof_stage_t* entry = &prof_stages[stage];
+
+    entry->count++;
+    entry->total_ticks += ticks;
+    if (ticks > entry->max_ticks) {
+        entry->max_ticks = ticks;
+    }
+}
+
+/*
+Cleanup function for PROF_ATOMIC_BLOCK - `start` points to the timer count
+    before the block started.
+Atomic blocks should be much shorter than a second, so only the timer count is
+    used (it goes back to 0 once per second).
+*/
+void prof_atomic_end(uint16_t* start) {
+    uint16_t end = TCNT1;
+    uint16_t ticks = end - *start;
+    if (end < *start) {
+        ticks += prof_ticks_per_s();
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (ticks > prof_atomic_max_ticks) {
+            prof_atomic_max_ticks = ticks;
+        }
+    }
+}
+
+void reset_prof(void) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        for (uint8_t i = 0; i < PROF_NUM_STAGES; i++) {
+            prof_stages[i].count = 0;
+            prof_stages[i].total_ticks = 0;
+            prof_stages[i].max_ticks = 0;
+        }
+        prof_atomic_max_ticks = 0;
+    }
+}
+
+#endif
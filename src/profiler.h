@@ -0,0 +1,84 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <avr/io.h>
+#include <util/atomic.h>
+
+#include <uptime/uptime.h>
+
+// Uncomment (or build with -DPROFILER) to measure the main loop stages and
+// atomic blocks
+// When this is not defined, PROF_STAGE() and PROF_ATOMIC_BLOCK() compile to
+// the plain code and no RAM is used for the table
+// #define PROFILER
+
+// Main loop stages
+#define PROF_STAGE_HB           0
+#define PROF_STAGE_TICK         1
+#define PROF_STAGE_TRANS_RX     2
+#define PROF_STAGE_CMD          3
+#define PROF_STAGE_CMD_LOG      4
+#define PROF_STAGE_MEM_ERASE    5
+#define PROF_STAGE_CAN_TX       6
+#define PROF_STAGE_CAN_RX       7
+#define PROF_STAGE_DATA_COLS    8
+#define PROF_STAGE_TRANS_TX     9
+
+// The read profiler stats response has 5 + (12 * PROF_NUM_STAGES) bytes, so
+// there can be at most 10 stages
+#define PROF_NUM_STAGES         10
+
+// Times are in ticks of the uptime timer (16-bit timer 1, one compare match
+// per second), so one tick is 1024 CPU cycles
+typedef struct {
+    // Number of times the stage ran
+    uint32_t count;
+    // Sum of all durations
+    uint32_t total_ticks;
+    // Longest duration
+    uint32_t max_ticks;
+} prof_stage_t;
+
+#ifdef PROFILER
+
+extern prof_stage_t prof_stages[];
+extern volatile uint16_t prof_atomic_max_ticks;
+
+// Runs the statement(s) `code` and adds their duration to `stage`
+#define PROF_STAGE(stage, code) \
+    do { \
+        uint32_t prof_start_ticks = prof_ticks(); \
+        code; \
+        prof_add_stage((stage), prof_start_ticks); \
+    } while (0)
+
+// Same as ATOMIC_BLOCK(type), but also records the longest time spent in any
+// of these blocks (including when leaving with return)
+#define PROF_ATOMIC_BLOCK(type) \
+    for (uint16_t prof_atomic_start __attribute__((__cleanup__(prof_atomic_end))) = TCNT1, \
+            prof_atomic_once = 1; \
+        prof_atomic_once; prof_atomic_once = 0) \
+        ATOMIC_BLOCK(type)
+
+void prof_add_stage(uint8_t stage, uint32_t start_ticks);
+void prof_atomic_end(uint16_t* start);
+void reset_prof(void);
+
+#else
+
+#define PROF_STAGE(stage, code) \
+    do { \
+        code; \
+    } while (0)
+
+#define PROF_ATOMIC_BLOCK(type) ATOMIC_BLOCK(type)
+
+#endif
+
+uint16_t prof_ticks_per_s(void);
+uint32_t prof_ticks(void);
+
+#endif
@@ -5,6 +5,14 @@ Datasheet: https://www.sparkfun.com/datasheets/BreakoutBoards/DS3234.pdf
 
 - 24-hour clock
 - Can use SPI mode 1 or 3 (choose 1)
+
+Software clock:
+Reading the date and time from the RTC takes an SPI transaction, and it is
+    needed for every command log entry and data block header. Instead, the
+    date and time are read once and saved with the uptime they were read at.
+    get_rtc_clock() adds the seconds of uptime since then, so it only uses RAM.
+    The RTC is read again every RTC_CLOCK_SYNC_PERIOD_S seconds (from the main
+    loop, so it doesn't interrupt another SPI transaction) and when it is set.
 */
 
 #include "rtc.h"
@@ -16,10 +24,21 @@ void no_op(void){
 static alarm_fn_t alarm_1_cmd = no_op;
 static alarm_fn_t alarm_2_cmd = no_op;
 
+// SPI settings and CS pin connection
+// the DS3234 requires this phase setting, which is not our default
+spi_dev_t rtc_spi_dev = {
+    .cs = {
+        .port = &RTC_PORT,
+        .ddr = &RTC_DDR,
+        .pin = RTC_CS
+    },
+    .mode = 1,
+    .clk = SPI_BUS_CLK_DEFAULT
+};
+
 void init_rtc(void){
     // initialize the Chip Select pin
-    init_cs(RTC_CS, &RTC_DDR);
-    set_cs_high(RTC_CS, &RTC_PORT);
+    init_spi_dev(&rtc_spi_dev);
 
     // Write defaults to the control and status registers
     rtc_write(RTC_CTRL_R, RTC_CTRL_DEF);
@@ -37,19 +56,25 @@ void set_rtc_time(rtc_time_t time){
 rtc_time_t read_rtc_time(void){
     // Reads time and returns result in decimal format
 
+    uint8_t regs[3];
+    rtc_read_regs(RTC_SEC_R, regs, sizeof(regs));
+
     rtc_time_t time;
-    time.ss = rtc_bcd_to_dec(rtc_read(RTC_SEC_R));
-    time.mm = rtc_bcd_to_dec(rtc_read(RTC_MIN_R));
-    time.hh = rtc_bcd_to_dec(rtc_read(RTC_HOUR_R));
+    time.ss = rtc_bcd_to_dec(regs[0]);
+    time.mm = rtc_bcd_to_dec(regs[1]);
+    time.hh = rtc_bcd_to_dec(regs[2]);
     return time;
 }
 
 rtc_date_t read_rtc_date(void){
     //Reads time and returns result in decimal format
+    uint8_t regs[3];
+    rtc_read_regs(RTC_DAY_R, regs, sizeof(regs));
+
     rtc_date_t date;
-    date.yy = rtc_bcd_to_dec(rtc_read(RTC_YEAR_R));
-    date.mm = rtc_bcd_to_dec(rtc_read(RTC_MONTH_R));
-    date.dd = rtc_bcd_to_dec(rtc_read(RTC_DAY_R));
+    date.dd = rtc_bcd_to_dec(regs[0]);
+    date.mm = rtc_bcd_to_dec(regs[1]);
+    date.yy = rtc_bcd_to_dec(regs[2]);
     return date;
 }
 
@@ -60,6 +85,139 @@ void set_rtc_date(rtc_date_t date){
     rtc_write(RTC_YEAR_R, rtc_dec_to_bcd(date.yy));
 }
 
+// Last date/time read from the RTC and the uptime when it was read
+rtc_date_t rtc_clock_date = { .dd = 1, .mm = 1, .yy = 0 };
+rtc_time_t rtc_clock_time = { .ss = 0, .mm = 0, .hh = 0 };
+uint32_t rtc_clock_uptime_s = 0;
+// False until the first sync (get_rtc_clock() reads the RTC until then)
+bool rtc_clock_valid = false;
+
+/*
+Sets the software clock to `date` and `time` as of the current uptime (does not
+    change the RTC).
+*/
+void set_rtc_clock(rtc_date_t date, rtc_time_t time) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        rtc_clock_date = date;
+        rtc_clock_time = time;
+        rtc_clock_uptime_s = uptime_s;
+        rtc_clock_valid = true;
+    }
+}
+
+/*
+Sets the software clock from the RTC.
+All of the time and date registers are read in one burst, and the RTC copies
+    them to its user buffers when CS goes low, so they can't roll over in the
+    middle.
+*/
+void sync_rtc_clock(void) {
+    uint8_t regs[RTC_YEAR_R - RTC_SEC_R + 1];
+    rtc_read_regs(RTC_SEC_R, regs, sizeof(regs));
+
+    rtc_time_t time;
+    time.ss = rtc_bcd_to_dec(regs[RTC_SEC_R]);
+    time.mm = rtc_bcd_to_dec(regs[RTC_MIN_R]);
+    time.hh = rtc_bcd_to_dec(regs[RTC_HOUR_R]);
+    rtc_date_t date;
+    date.dd = rtc_bcd_to_dec(regs[RTC_DAY_R]);
+    date.mm = rtc_bcd_to_dec(regs[RTC_MONTH_R]);
+    date.yy = rtc_bcd_to_dec(regs[RTC_YEAR_R]);
+    set_rtc_clock(date, time);
+}
+
+// Syncs the software clock with the RTC once the sync period has passed
+void run_rtc_clock(void) {
+    uint32_t elapsed_s = 0;
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        elapsed_s = uptime_s - rtc_clock_uptime_s;
+    }
+    if (!rtc_clock_valid || elapsed_s >= RTC_CLOCK_SYNC_PERIOD_S) {
+        sync_rtc_clock();
+    }
+}
+
+// Years are 2000 to 2099, so every year divisible by 4 is a leap year
+uint8_t rtc_days_in_month(uint8_t mm, uint8_t yy) {
+    switch (mm) {
+        case 2:
+            return (yy % 4 == 0) ? 29 : 28;
+        case 4:
+        case 6:
+        case 9:
+        case 11:
+            return 30;
+        default:
+            return 31;
+    }
+}
+
+/*
+Returns the number of seconds from 2000-01-01 00:00:00 to the date and time
+    (fits in 32 bits for every date the RTC can hold).
+*/
+uint32_t rtc_clock_to_s(rtc_date_t date, rtc_time_t time) {
+    uint32_t days = 0;
+    for (uint8_t yy = 0; yy < date.yy; yy++) {
+        days += (yy % 4 == 0) ? 366 : 365;
+    }
+    // Stop at December so an invalid month can't count up to 255
+    for (uint8_t mm = 1; mm < date.mm && mm <= 12; mm++) {
+        days += rtc_days_in_month(mm, date.yy);
+    }
+    if (date.dd > 0) {
+        days += date.dd - 1;
+    }
+
+    return (days * 86400UL) + (time.hh * 3600UL) + (time.mm * 60UL) + time.ss;
+}
+
+/*
+Gets the current date and time from the software clock (no SPI transactions
+    after the first sync).
+*/
+void get_rtc_clock(rtc_date_t* date, rtc_time_t* time) {
+    if (!rtc_clock_valid) {
+        *date = read_rtc_date();
+        *time = read_rtc_time();
+        return;
+    }
+
+    rtc_date_t d;
+    rtc_time_t t;
+    uint32_t elapsed_s = 0;
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        d = rtc_clock_date;
+        t = rtc_clock_time;
+        elapsed_s = uptime_s - rtc_clock_uptime_s;
+    }
+
+    uint32_t day_s = ((uint32_t) t.hh * 3600) + ((uint16_t) t.mm * 60) + t.ss +
+        elapsed_s;
+    uint32_t days = day_s / 86400UL;
+    day_s %= 86400UL;
+
+    t.hh = day_s / 3600;
+    t.mm = (day_s / 60) % 60;
+    t.ss = day_s % 60;
+
+    // Usually 0 or 1 days since the RTC is read every sync period
+    for (; days > 0; days--) {
+        d.dd++;
+        if (d.dd > rtc_days_in_month(d.mm, d.yy)) {
+            d.dd = 1;
+            d.mm++;
+            if (d.mm > 12) {
+                d.mm = 1;
+                d.yy = (d.yy + 1) % 100;
+            }
+        }
+    }
+
+    *date = d;
+    *time = t;
+}
+
 uint8_t set_rtc_alarm(rtc_time_t time, rtc_date_t date,
     rtc_alarm_t alarm_number, alarm_fn_t cmd) {
 
@@ -139,6 +297,21 @@ uint8_t rtc_read(uint8_t reg_address){
     return return_data;
 }
 
+/*
+Reads consecutive registers in one transaction (the address increments after
+    each byte).
+reg_address - first register
+data - `len` bytes, populated by this function
+*/
+void rtc_read_regs(uint8_t reg_address, uint8_t* data, uint8_t len) {
+    start_rtc_spi();
+    send_spi(RTC_R | reg_address);
+    for (uint8_t i = 0; i < len; i++) {
+        data[i] = send_spi(0xFF);
+    }
+    end_rtc_spi();
+}
+
 void rtc_write(uint8_t reg_address, uint8_t data){
     //writes data to reg_address on the RTC chip
     start_rtc_spi();
@@ -151,18 +324,14 @@ void rtc_write(uint8_t reg_address, uint8_t data){
 Starts a SPI transmission for the RTC (using SPI mode 1).
 */
 void start_rtc_spi(void) {
-    // adjust the phase
-    // the DS3234 requires this phase setting, which is not our default
-    set_spi_mode(1);
-    set_cs_low(RTC_CS, &RTC_PORT);
+    start_spi_dev(&rtc_spi_dev);
 }
 
 /*
-Ends a SPI transmission for the RTC (resets SPI mode to 0).
+Ends a SPI transmission for the RTC.
 */
 void end_rtc_spi(void) {
-    set_cs_high(RTC_CS, &RTC_PORT);
-    reset_spi_mode();
+    end_spi_dev(&rtc_spi_dev);
 }
 
 uint8_t rtc_bcd_to_dec(uint8_t bcd){
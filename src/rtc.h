@@ -1,6 +1,9 @@
 #ifndef RTC_H
 #define RTC_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 // AVR Library Includes
 #include <avr/io.h>
 #include <avr/interrupt.h>
@@ -8,6 +11,10 @@
 // lib-common includes
 #include <spi/spi.h>
 #include <uart/uart.h>
+#include <uptime/uptime.h>
+
+#include "profiler.h"
+#include "spi_bus.h"
 
 
 // Type definitions
@@ -32,6 +39,11 @@ typedef enum {
 // Callback function signatures for alarms
 typedef void (*alarm_fn_t)(void);
 
+// Software clock
+// Read the RTC again after this many seconds (uptime and the RTC drift apart
+// slowly)
+#define RTC_CLOCK_SYNC_PERIOD_S 600
+
 // Basic Functions
 void init_rtc(void);
 
@@ -41,6 +53,14 @@ rtc_time_t read_rtc_time(void);
 rtc_date_t read_rtc_date(void);
 void set_rtc_date(rtc_date_t date);
 
+// Software clock
+void set_rtc_clock(rtc_date_t date, rtc_time_t time);
+void sync_rtc_clock(void);
+void run_rtc_clock(void);
+void get_rtc_clock(rtc_date_t* date, rtc_time_t* time);
+uint8_t rtc_days_in_month(uint8_t mm, uint8_t yy);
+uint32_t rtc_clock_to_s(rtc_date_t date, rtc_time_t time);
+
 //Alarm functions
 uint8_t set_rtc_alarm(rtc_time_t time, rtc_date_t date,
     rtc_alarm_t alarm_number, alarm_fn_t cmd);
@@ -48,6 +68,7 @@ uint8_t disable_rtc_alarm(rtc_alarm_t alarm_number);
 
 // Read/write registers
 uint8_t rtc_read(uint8_t reg_address);
+void rtc_read_regs(uint8_t reg_address, uint8_t* data, uint8_t len);
 void rtc_write(uint8_t reg_address, uint8_t data);
 
 // SPI
@@ -0,0 +1,103 @@
+/*
+Deadline scheduler
+
+Timers that run a function from the main loop once uptime_s reaches their
+    deadline, for work that only needs to happen at a certain time (e.g.
+    automatic data collection or field request timeouts) instead of checking
+    the time of everything on every pass.
+
+The earliest deadline is kept in sched_next_deadline_s, so run_sched() only
+    compares one number until something is due. Timers are one-shot - a periodic
+    task sets its timer again from its function.
+
+Timers are added once at startup and never removed, so an ID stays valid.
+    The list is short, so it is just scanned when a deadline passes.
+*/
+
+#include "sched.h"
+
+sched_timer_t sched_timers[SCHED_MAX_TIMERS];
+uint8_t sched_num_timers = 0;
+// Earliest deadline of all timers (can be earlier than that if a timer was
+// cleared, then run_sched() just finds the next one)
+uint32_t sched_next_deadline_s = SCHED_NO_DEADLINE;
+
+
+/*
+Adds a timer (not set yet).
+fn - function to call when the deadline passes
+arg - passed to `fn` (e.g. to use the same function for several timers)
+Returns - the ID to set the timer with, or SCHED_NO_TIMER if there is no room
+*/
+uint8_t add_sched_timer(sched_fn_t fn, uint8_t arg) {
+    if (sched_num_timers >= SCHED_MAX_TIMERS) {
+        return SCHED_NO_TIMER;
+    }
+
+    uint8_t id = sched_num_timers;
+    sched_timers[id].deadline_s = SCHED_NO_DEADLINE;
+    sched_timers[id].fn = fn;
+    sched_timers[id].arg = arg;
+    sched_num_timers++;
+    return id;
+}
+
+// Sets the timer to run when uptime_s reaches `deadline_s` (replaces any
+// previous deadline)
+void set_sched_timer(uint8_t id, uint32_t deadline_s) {
+    if (id >= sched_num_timers) {
+        return;
+    }
+
+    sched_timers[id].deadline_s = deadline_s;
+    if (deadline_s < sched_next_deadline_s) {
+        sched_next_deadline_s = deadline_s;
+    }
+}
+
+void clear_sched_timer(uint8_t id) {
+    if (id >= sched_num_timers) {
+        return;
+    }
+    sched_timers[id].deadline_s = SCHED_NO_DEADLINE;
+}
+
+uint32_t sched_timer_deadline(uint8_t id) {
+    if (id >= sched_num_timers) {
+        return SCHED_NO_DEADLINE;
+    }
+    return sched_timers[id].deadline_s;
+}
+
+/*
+Runs the functions of all timers whose deadline has passed (call on
+    EVENT_TICK).
+*/
+void run_sched(void) {
+    uint32_t now_s = 0;
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        now_s = uptime_s;
+    }
+    if (now_s < sched_next_deadline_s) {
+        return;
+    }
+
+    for (uint8_t i = 0; i < sched_num_timers; i++) {
+        sched_timer_t* timer = &sched_timers[i];
+        if (timer->deadline_s <= now_s) {
+            // Clear it first so the function can set it again
+            timer->deadline_s = SCHED_NO_DEADLINE;
+            timer->fn(timer->arg);
+        }
+    }
+
+    // Functions can set timers (including ones already checked), so find the
+    // earliest deadline after all of them ran
+    uint32_t next_s = SCHED_NO_DEADLINE;
+    for (uint8_t i = 0; i < sched_num_timers; i++) {
+        if (sched_timers[i].deadline_s < next_s) {
+            next_s = sched_timers[i].deadline_s;
+        }
+    }
+    sched_next_deadline_s = next_s;
+}
@@ -0,0 +1,42 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <uptime/uptime.h>
+
+#include "profiler.h"
+
+// Maximum number of timers that can be added
+// Each of the 4 data collections uses 2 (automatic collection and field
+// timeouts), plus one spare so another module (or a test) can add one without
+// taking a data collection's timer
+#define SCHED_MAX_TIMERS    9
+// Returned by add_sched_timer() if there is no room
+#define SCHED_NO_TIMER      0xFF
+// Deadline of a timer that is not set
+#define SCHED_NO_DEADLINE   UINT32_MAX
+
+// Called from the main loop once the deadline has passed
+// arg - the value given to add_sched_timer()
+typedef void (*sched_fn_t)(uint8_t arg);
+
+typedef struct {
+    // Value of uptime_s to run at (SCHED_NO_DEADLINE if not set)
+    uint32_t deadline_s;
+    sched_fn_t fn;
+    uint8_t arg;
+} sched_timer_t;
+
+extern sched_timer_t sched_timers[];
+extern uint8_t sched_num_timers;
+extern uint32_t sched_next_deadline_s;
+
+uint8_t add_sched_timer(sched_fn_t fn, uint8_t arg);
+void set_sched_timer(uint8_t id, uint32_t deadline_s);
+void clear_sched_timer(uint8_t id);
+uint32_t sched_timer_deadline(uint8_t id);
+void run_sched(void);
+
+#endif
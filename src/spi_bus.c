@@ -0,0 +1,100 @@
+/*
+SPI bus manager
+
+The flash memory, RTC and I2C bridge share one SPI bus, but need different
+    settings (the RTC uses mode 1, the I2C bridge mode 3, and flash reads run at
+    the maximum clock). Each device has a profile (CS pin, mode and clock), and
+    the bus is only set up again when a transaction starts for a device with
+    different settings than the last one, instead of setting and resetting the
+    mode around every register access.
+
+run_spi_batch() runs a list of transactions for one device (e.g. several
+    commands to the I2C bridge, each needs CS to go high between them) with
+    only one setup.
+
+SPI transactions should only be done from the main loop, since an interrupt
+    could change the settings in the middle of a transaction (the RTC alarm
+    interrupt is only used by a manual test).
+*/
+
+#include "spi_bus.h"
+
+// Settings the bus is set up with
+uint8_t spi_bus_mode = SPI_BUS_NO_MODE;
+uint8_t spi_bus_clk = SPI_BUS_CLK_DEFAULT;
+// Number of times the settings were changed (for testing)
+uint16_t spi_bus_setup_count = 0;
+
+// Clock bits set by init_spi(), saved before the first change
+uint8_t spi_bus_def_spcr = 0;
+uint8_t spi_bus_def_spsr = 0;
+
+
+// Initializes the CS pin of a device (high - not selected)
+void init_spi_dev(const spi_dev_t* dev) {
+    init_cs(dev->cs.pin, dev->cs.ddr);
+    set_cs_high(dev->cs.pin, dev->cs.port);
+}
+
+// Changes the bus settings to the ones for `dev` if they are different
+static void setup_spi_bus(const spi_dev_t* dev) {
+    if (spi_bus_mode == SPI_BUS_NO_MODE) {
+        spi_bus_def_spcr = SPCR & (_BV(SPR1) | _BV(SPR0));
+        spi_bus_def_spsr = SPSR & _BV(SPI2X);
+    } else if (dev->mode == spi_bus_mode && dev->clk == spi_bus_clk) {
+        return;
+    }
+
+    set_spi_mode(dev->mode);
+    if (dev->clk == SPI_BUS_CLK_MAX) {
+        SPCR &= ~(_BV(SPR1) | _BV(SPR0));
+        SPSR |= _BV(SPI2X);
+    } else {
+        SPCR = (SPCR & ~(_BV(SPR1) | _BV(SPR0))) | spi_bus_def_spcr;
+        SPSR = (SPSR & ~_BV(SPI2X)) | spi_bus_def_spsr;
+    }
+
+    spi_bus_mode = dev->mode;
+    spi_bus_clk = dev->clk;
+    spi_bus_setup_count++;
+}
+
+/*
+Starts a transaction - sets up the bus for `dev` (if needed) and sets its CS
+    low.
+Must be followed by end_spi_dev().
+*/
+void start_spi_dev(const spi_dev_t* dev) {
+    setup_spi_bus(dev);
+    set_cs_low(dev->cs.pin, dev->cs.port);
+}
+
+/*
+Ends a transaction - sets CS high. The settings are left for the next
+    transaction.
+*/
+void end_spi_dev(const spi_dev_t* dev) {
+    set_cs_high(dev->cs.pin, dev->cs.port);
+}
+
+/*
+Runs a list of transactions for one device, with CS going high between them.
+dev - device
+trans - array of transactions (`count` long)
+count - number of transactions
+*/
+void run_spi_batch(const spi_dev_t* dev, const spi_trans_t* trans,
+        uint8_t count) {
+    setup_spi_bus(dev);
+
+    for (uint8_t i = 0; i < count; i++) {
+        set_cs_low(dev->cs.pin, dev->cs.port);
+        for (uint8_t j = 0; j < trans[i].len; j++) {
+            uint8_t data = send_spi(trans[i].tx != NULL ? trans[i].tx[j] : 0x00);
+            if (trans[i].rx != NULL) {
+                trans[i].rx[j] = data;
+            }
+        }
+        set_cs_high(dev->cs.pin, dev->cs.port);
+    }
+}
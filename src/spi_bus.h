@@ -0,0 +1,50 @@
+#ifndef SPI_BUS_H
+#define SPI_BUS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <avr/io.h>
+
+#include <spi/spi.h>
+
+// SPI clock of a device
+// Clock set by init_spi()
+#define SPI_BUS_CLK_DEFAULT 0
+// F_CPU / 2 (maximum)
+#define SPI_BUS_CLK_MAX     1
+
+// Mode before the first transaction (the settings are not known yet)
+#define SPI_BUS_NO_MODE     0xFF
+
+// Settings for one device on the bus
+typedef struct {
+    // Chip select pin (active low)
+    pin_info_t cs;
+    // SPI mode (0 to 3)
+    uint8_t mode;
+    // SPI_BUS_CLK_*
+    uint8_t clk;
+} spi_dev_t;
+
+// One transaction in a batch (CS is low for the `len` bytes)
+typedef struct {
+    // Bytes to send (NULL to send 0x00)
+    const uint8_t* tx;
+    // Where to put the bytes received (NULL to ignore them)
+    uint8_t* rx;
+    uint8_t len;
+} spi_trans_t;
+
+extern uint8_t spi_bus_mode;
+extern uint8_t spi_bus_clk;
+extern uint16_t spi_bus_setup_count;
+
+void init_spi_dev(const spi_dev_t* dev);
+void start_spi_dev(const spi_dev_t* dev);
+void end_spi_dev(const spi_dev_t* dev);
+void run_spi_batch(const spi_dev_t* dev, const spi_trans_t* trans,
+    uint8_t count);
+
+#endif
@@ -14,6 +14,13 @@ Each of the command functions calls a send_trans_command function which
 attempts to send a message to the transceiver until it receives a 
 valid response (with a maximum number of attempts)
 
+These block until the response arrives, so they should only be used during
+initialization (or in tests). While the main loop is running, use
+enqueue_trans_read()/enqueue_trans_write() instead - the command is sent by
+run_trans_cmds() and a callback is called when its response arrives or it
+times out. Don't use both at the same time, since they share the command
+response buffer.
+
 Status Control Register Bits:
 15-14: Reserved
 13-12: Baudrate = 0 for 9600
@@ -28,19 +35,33 @@ All bits below this point are read only (no writing)
 1: Correct initialization of FRAM (0 = Error)
 0: Correct initialization of Radio Transceiver (0 = Error)
 
-UART RX Buffer:
-There is a common buffer of characters received over UART from the transceiver in the UART library.
-These could either be a response to a command we send it, or a message from the
-ground station. In either case, we leave all received UART characters in the
-buffer. Every time we receive a new character, scan the entire buffer to see if
-the sequence of characters makes sense (i.e. detect it as either a command
-response or a received message and set the appropriate boolean flag, which
-functions in this library can check for and consume the data if desired). We
-set a timeout where if we do not receive any characters for a certain number of
-seconds, the entire buffer contents are discarded.
-
-Formerly we copied all characters from the standard UART buffer to a separate
-buffer in this library, but that was unnecessary.
+UART RX Parser:
+Characters received over UART from the transceiver could either be a response
+to a command we send it, or a message from the ground station. Every received
+character goes through a small state machine (parse_trans_rx_byte()) that looks
+at it once, copies it to the buffer for a packet or a command response, and
+sets the appropriate boolean flag when one is complete (which functions in this
+library can check for and consume the data if desired). We set a timeout where
+if we do not receive any characters for a certain number of seconds, the parser
+is reset and anything partially received is discarded.
+
+Formerly we left all characters in the lib-common UART buffer and rescanned
+the whole buffer every time a character was received.
+
+Housekeeping Beacon:
+trans_beacon_content holds a few fields from the most recent data blocks as hex
+digits. When a collection finishes, only the fields from that block are
+re-written (set_trans_beacon_field()), and run_trans_beacon() writes the
+content to the transceiver through the command queue at most once every
+TRANS_BEACON_MIN_PERIOD_S.
+
+Link Adaptation:
+At initialization, the UART is switched to the highest baud rate that works
+reliably (init_trans_uart_baud()). The RF mode can be set by a ground command,
+or switched automatically (trans_rf_auto) between the default mode and a faster
+mode from the RSSI and the CRC error counter, which run_trans_link() reads
+periodically through the command queue. It always falls back to the default
+mode if nothing is received from ground for a while.
 
 Note that when pipe mode times out, the transceiver automatically sends the
 following 16 bytes of UART to OBC:
@@ -63,7 +84,8 @@ All buffers have the following format:
 */
 
 /* Command response received back from transceiver (detected by \r termination) */
-volatile uint8_t    trans_cmd_resp[TRANS_CMD_RESP_MAX_SIZE] = {0x00};
+// (1 extra byte for the '\r' while it is being received)
+volatile uint8_t    trans_cmd_resp[TRANS_CMD_RESP_MAX_SIZE + 1] = {0x00};
 volatile uint8_t    trans_cmd_resp_len = 0;
 volatile bool       trans_cmd_resp_avail = false;
 
@@ -71,26 +93,59 @@ volatile bool       trans_cmd_resp_avail = false;
 volatile uint8_t    trans_rx_enc_msg[TRANS_RX_ENC_MSG_MAX_SIZE] = {0x00};
 volatile uint8_t    trans_rx_enc_len = 0;
 volatile bool       trans_rx_enc_avail = false;
+// Checksum of trans_rx_enc_msg calculated as the bytes were received (only
+// valid if trans_rx_enc_crc_avail is true)
+volatile uint32_t   trans_rx_enc_crc = 0;
+volatile bool       trans_rx_enc_crc_avail = false;
+
+// RX parser (see parse_trans_rx_byte())
+volatile uint8_t    trans_rx_state = TRANS_RX_IDLE;
+// Number of bytes received since something valid was last received (or the
+// parser was reset), used for the RX timeout
+volatile uint8_t    trans_rx_count = 0;
+// Position of the next byte in the current packet or command response
+volatile uint8_t    trans_rx_pos = 0;
+// Number of bytes in the current packet (from its length byte)
+volatile uint8_t    trans_rx_pkt_len = 0;
+// CRC register of the checksummed bytes of the current packet so far
+volatile uint32_t   trans_rx_crc = CRC32_INIT;
 
 // Decoded RX message (from ground station)
 volatile uint8_t    trans_rx_dec_msg[TRANS_RX_DEC_MSG_MAX_SIZE] = {0x00};
 volatile uint8_t    trans_rx_dec_len = 0;
 volatile bool       trans_rx_dec_avail = false;
 
-// ACK/NACK to send to ground
-volatile uint16_t   trans_tx_ack_cmd_id = 0;
-volatile uint8_t    trans_tx_ack_status = 0xFF;
-volatile bool       trans_tx_ack_avail = false;
+// ACKs/NACKs waiting to be sent to ground (ring buffer)
+volatile trans_tx_ack_t trans_tx_ack_queue[TRANS_TX_ACK_QUEUE_SIZE];
+volatile uint8_t    trans_tx_ack_head = 0;
+volatile uint8_t    trans_tx_ack_count = 0;
+
+// Encoded ACK frame, with the decoded ACK message (one or more ACKs) in
+// trans_tx_ack_msg, sent before trans_tx_dec_msg
+volatile uint8_t    trans_tx_ack_frame[TRANS_TX_ACK_ENC_MAX_SIZE] = {0x00};
+volatile uint8_t    trans_tx_ack_msg_len = 0;
+volatile bool       trans_tx_ack_msg_avail = false;
 
-// Decoded TX message (to ground station)
-volatile uint8_t    trans_tx_dec_msg[TRANS_TX_DEC_MSG_MAX_SIZE] = {0x00};
+// Encoded TX frame (to ground station), with the decoded message in
+// trans_tx_dec_msg
+volatile uint8_t    trans_tx_dec_frame[TRANS_TX_ENC_MSG_MAX_SIZE] = {0x00};
 volatile uint8_t    trans_tx_dec_len = 0;
 volatile bool       trans_tx_dec_avail = false;
+// CRC register (starting from 0, see trans_tx_dec_checksum()) of the first
+// `trans_tx_dec_crc_len` bytes of trans_tx_dec_msg
+volatile uint32_t   trans_tx_dec_crc = 0;
+volatile uint8_t    trans_tx_dec_crc_len = 0;
 
-// Encoded TX message (to ground station)
-volatile uint8_t    trans_tx_enc_msg[TRANS_TX_ENC_MSG_MAX_SIZE] = {0x00};
+// Encoded TX message being sent (trans_tx_ack_frame or trans_tx_dec_frame)
+volatile uint8_t*   trans_tx_enc_msg = trans_tx_dec_frame;
 volatile uint8_t    trans_tx_enc_len = 0;
 volatile bool       trans_tx_enc_avail = false;
+// Sending progress of the encoded TX message (see send_trans_tx_enc_msg())
+volatile uint8_t    trans_tx_enc_state = TRANS_TX_ENC_IDLE;
+// Number of bytes of trans_tx_enc_msg already written to the UART
+volatile uint8_t    trans_tx_enc_sent = 0;
+// Time (from prof_ticks()) when the current guard time started
+volatile uint32_t   trans_tx_enc_guard_ticks = 0;
 
 // Last time we have received a UART character
 volatile uint32_t trans_rx_prev_uptime_s = 0;
@@ -101,18 +156,118 @@ uint16_t trans_last_cmd_id = 0x0000;
 // Set to true to print transceiver messages
 bool print_trans_msgs = false;
 
+// Housekeeping beacon content (see run_trans_beacon())
+char                trans_beacon_content[TRANS_BEACON_CONTENT_LEN + 1];
+// Set when the content changed since it was last written to the transceiver
+volatile bool       trans_beacon_dirty = false;
+// Set while the write is in the transceiver command queue
+volatile bool       trans_beacon_busy = false;
+// Seconds since the content was last written (starts at the limit so the
+// first content is written right away)
+volatile uint16_t   trans_beacon_wait_s = TRANS_BEACON_MIN_PERIOD_S;
+
+// Link adaptation (see run_trans_link())
+// UART baud rate chosen by init_trans_uart_baud()
+uart_baud_rate_t    trans_uart_baud = UART_BAUD_9600;
+// RF mode currently set in the transceiver
+volatile uint8_t    trans_rf_mode = TRANS_RF_MODE_DEF;
+// Set to true to switch the RF mode automatically from the RSSI and CRC errors
+volatile bool       trans_rf_auto = false;
+// RF mode to switch to (TRANS_RF_MODE_NONE if none)
+volatile uint8_t    trans_rf_mode_req = TRANS_RF_MODE_NONE;
+// RF mode being written to the status register (while the request is in the
+// transceiver command queue)
+volatile uint8_t    trans_rf_mode_next = TRANS_RF_MODE_NONE;
+// Seconds since the last check (from trans_uptime_cb())
+volatile uint16_t   trans_link_check_s = 0;
+// Set when it is time to read the RSSI and packet counters
+volatile bool       trans_link_check_pending = false;
+// Last RSSI and packet counters read from the transceiver
+uint8_t             trans_link_rssi = 0;
+uint32_t            trans_link_rx_count = 0;
+uint32_t            trans_link_crc_count = 0;
+bool                trans_link_counts_valid = false;
+// Received packet count read just before the CRC count
+uint32_t            trans_link_new_rx_count = 0;
+bool                trans_link_new_rx_valid = false;
+// Value of uptime_s when a check last found new packets from ground
+uint32_t            trans_link_prev_rx_s = 0;
+
 
 
 // UART buff used to send commands
 #define COMMAND_BUF_SIZE 80
 static uint8_t command_buf[COMMAND_BUF_SIZE];
 
+// Transceiver commands waiting to be sent (ring buffer, the head is the one
+// in progress)
+trans_cmd_t         trans_cmd_queue[TRANS_CMD_QUEUE_SIZE];
+volatile uint8_t    trans_cmd_head = 0;
+volatile uint8_t    trans_cmd_count = 0;
+// Progress of the command at the head of the queue
+volatile uint8_t    trans_cmd_state = TRANS_CMD_IDLE;
+volatile uint8_t    trans_cmd_attempts = 0;
+// Number of seconds since the command was sent (from trans_uptime_cb())
+volatile uint8_t    trans_cmd_wait_s = 0;
+
+// CRC32 (reflected polynomial 0xEDB88320) of each 4-bit value, for
+// crc32_update()
+const uint32_t crc32_nibble_table[16] PROGMEM = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+    0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+    0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+// The checksum of an encoded message covers the length byte and then the
+// decoded bytes, but the length is only known once the whole TX message has
+// been added. Since CRC32 is linear, the register after the length byte n and
+// then n decoded bytes is (entry n of this table) XOR (the register after the n
+// decoded bytes starting from 0). Entry n is the register after the length
+// byte n followed by n zero bytes (starting from CRC32_INIT).
+const uint32_t crc32_tx_len_table[TRANS_TX_DEC_MSG_MAX_SIZE + 1] PROGMEM = {
+    0x2DFD1072, 0xA73DDC41, 0x033AF283, 0xCC0E8F0D,
+    0xCC5DAE22, 0x1EF0CFEF, 0x014315BB, 0x9018298F,
+    0xA22E4949, 0xE060BC43, 0x76D71697, 0xF5B89D9E,
+    0x6A310086, 0x99BEF663, 0xC55FE46D, 0x9DAED390,
+    0x2141973F, 0x5915DA4B, 0x42010B6B, 0xBF45829D,
+    0xE7E62C23, 0xB5A8F39E, 0x61E72F8D, 0x124D7D95,
+    0x622C45A9, 0x4875919E, 0xA46BE611, 0x6BA1B609,
+    0x8BD110AF, 0x7A828C61, 0x29E7EA31, 0xA02DE27A,
+    0xED64C457, 0xD160F1A5, 0x2DBE098F, 0xE85AF42D,
+    0x71056F5E, 0x012A847E, 0x64276A44, 0xDE9130A4,
+    0x09E89369, 0x955EB581, 0x531EF60E, 0xCDC30B93,
+    0xB5CBD493, 0x167A92B9, 0x09206C15, 0x5065285B,
+    0xDFDB9DCC, 0x163C4CF7, 0xA6FD4907, 0xF70E94E7,
+    0x9DE36EC9, 0xE38030CC, 0xF435DB9B, 0x7ABC6CC0,
+    0x151CD2C0, 0xD1B6D1F1, 0x71BF7A48, 0xB2A5F857,
+    0x5FAE8453, 0x44264EBA, 0xDA25C3B8, 0x4A5533E8,
+    0xB723027D, 0x67EA839C, 0xB56D1F45, 0x633E4022,
+    0x938A0013, 0xDD4BF3B5, 0x0EED6989, 0x3A618579,
+    0x50B3CF80, 0x0AA7D1B4, 0x13949EA2, 0xB689E764,
+    0x6276BB23, 0x5FA611EC, 0x75E891B1, 0xA034F39E,
+    0x7F66FBC7, 0xCC1ED0AD, 0xA22BBC87, 0x297D9DF0,
+    0x8F119806, 0x735886C7, 0x28054D48, 0x2FEA84F6,
+    0x2434DB96, 0xFA4F35D5, 0x6DD9D381, 0x8AC84954,
+    0x02971DAA, 0x523BBB31, 0xFB2A3975, 0xFF922248,
+    0xAB6CDA80, 0x87D67AAD, 0x6C3E0D28, 0x4046506A,
+    0xB3B59229, 0xF4E9CBB3, 0x4BF075A0, 0xDA239370,
+    0x6745A71A, 0x8DB1FF72, 0x74ADBFA1, 0x67EFFE79,
+    0x1E587ADF, 0xA10AB775, 0x407CF8B7, 0x64BD6AE8,
+    0x17BB3A31, 0x2FCE9068, 0x867E1539, 0x5E1B90F5,
+    0x3359CF45, 0x34F350C1, 0x53D1FBA4, 0x40E658CB,
+    0xEDEAFE9F, 0xF50EDC55, 0x19FDBD63, 0xA0A437CA,
+    0x4D85A48C, 0xB51D5BF4, 0x642D57A8, 0xEB96F3BE,
+    0x57C62EC8
+};
+
 
 /*
 Initializes the transceiver for UART RX callbacks (does not change any settings).
 */
 void init_trans(void) {
     init_trans_uart();
+    init_trans_beacon();
 }
 
 void init_trans_uart(void) {
@@ -124,24 +279,52 @@ void trans_uptime_cb(void) {
     // Check for a timeout in receiving characters to clear the buffer
     if (uptime_s > trans_rx_prev_uptime_s &&
         uptime_s - trans_rx_prev_uptime_s >= TRANS_RX_BUF_TIMEOUT_S &&
-        get_uart_rx_count() > 0) {
+        trans_rx_count > 0) {
 
 #ifdef TRANSCEIVER_DEBUG
-        print("UART RX buf (%u bytes): ", get_uart_rx_count());
-        print_bytes((uint8_t*) get_uart_rx_buf(), get_uart_rx_count());
-        print("\nTimed out, clearing UART RX buf\n");
+        print("Trans RX (%u bytes) timed out, resetting parser\n",
+            trans_rx_count);
 #endif
 
         // Only send an ACK for invalid encoded format if we received more than
         // the specified number of bytes from a packet
         // i.e. ignore 1-byte ground station packets that are used to improve
         // transmission reliability
-        if (get_uart_rx_count() >= TRANS_RX_INVALID_ENC_FMT_COUNT_THRESH) {
+        if (trans_rx_count >= TRANS_RX_INVALID_ENC_FMT_COUNT_THRESH) {
             add_trans_tx_ack(CMD_CMD_ID_UNKNOWN, CMD_ACK_STATUS_INVALID_ENC_FMT);
         }
 
-        // Clearing buffer must happen after checking length
-        clear_uart_rx_buf();
+        // Resetting must happen after checking the count
+        reset_trans_rx_parser();
+    }
+
+    // Time out the transceiver command waiting for a response
+    if (trans_cmd_state == TRANS_CMD_WAITING) {
+        trans_cmd_wait_s++;
+        if (trans_cmd_wait_s >= TRANS_CMD_TIMEOUT_S) {
+            set_event(EVENT_TRANS_RX);
+        }
+    }
+
+    // Only check the link if the mode could change
+    trans_link_check_s++;
+    if (trans_link_check_s >= TRANS_LINK_CHECK_PERIOD_S) {
+        trans_link_check_s = 0;
+        if (trans_rf_auto || trans_rf_mode != TRANS_RF_MODE_DEF) {
+            trans_link_check_pending = true;
+            set_event(EVENT_TRANS_RX);
+        }
+    }
+    // Rate limit for the beacon content
+    if (trans_beacon_wait_s < TRANS_BEACON_MIN_PERIOD_S) {
+        trans_beacon_wait_s++;
+    } else if (trans_beacon_dirty) {
+        set_event(EVENT_TRANS_RX);
+    }
+
+    // Check again whether the downlink is idle for an RF mode change
+    if (trans_rf_mode_req != TRANS_RF_MODE_NONE) {
+        set_event(EVENT_TRANS_RX);
     }
 }
 
@@ -150,6 +333,9 @@ UART RX callback
 buf - array of received characters
 len - number of received characters
 Returns - number of characters processed
+
+Each character is only looked at once by parse_trans_rx_byte(), so all of them
+    are always processed and the UART RX buffer never fills up.
 */
 uint8_t trans_uart_rx_cb(const uint8_t* buf, uint8_t len) {
     // Save the new time we have received a character
@@ -158,34 +344,159 @@ uint8_t trans_uart_rx_cb(const uint8_t* buf, uint8_t len) {
     // Output new character
     // put_uart_char(buf[len - 1]);
 
-    // Scan what we have in the buffer now
-    // If we found something, clear it from the main UART buffer because the
-    // other function has already copied it to a dedicated buffer
+    for (uint8_t i = 0; i < len; i++) {
+        parse_trans_rx_byte(buf[i]);
+    }
+
+    return len;
+}
+
+/*
+Resets the RX parser to wait for the start of a packet or command response.
+*/
+void reset_trans_rx_parser(void) {
+    trans_rx_state = TRANS_RX_IDLE;
+    trans_rx_count = 0;
+    trans_rx_pos = 0;
+}
+
+/*
+Handles a byte when the parser is not in a packet or command response.
+*/
+void start_trans_rx_byte(uint8_t byte) {
+    trans_rx_pos = 0;
+
+    // An RX encoded message should always start with the delimiter, and a
+    // command response with "OK" (or "ERR")
+    // Don't start a packet over one that has not been decoded yet
+    if (byte == TRANS_PKT_DELIMITER && !trans_rx_enc_avail) {
+        trans_rx_enc_msg[0] = byte;
+        trans_rx_pos = 1;
+        trans_rx_crc = CRC32_INIT;
+        trans_rx_state = TRANS_RX_PKT;
+    } else if (byte == 'O' || byte == 'E') {
+        trans_cmd_resp[0] = byte;
+        trans_rx_pos = 1;
+        trans_rx_state = TRANS_RX_CMD_RESP;
+    } else {
+        // Ignore anything else (e.g. 1-byte ground station packets), it only
+        // counts towards the RX timeout
+        trans_rx_state = TRANS_RX_IDLE;
+    }
+}
+
+/*
+Handles the next byte of a packet from the ground station:
+    delimiter, length, delimiter, <length> decoded bytes, delimiter,
+    4-byte checksum, delimiter
+The checksum (of the length byte and decoded bytes) is calculated as they are
+    received.
+*/
+void parse_trans_rx_pkt_byte(uint8_t byte) {
+    uint8_t pos = trans_rx_pos;
+
+    if (pos == 1) {
+        // If the length is too long, still receive a full-size packet so
+        // decode_trans_rx_msg() can NACK it for the invalid length
+        if (byte <= TRANS_RX_DEC_MSG_MAX_SIZE) {
+            trans_rx_pkt_len = byte + 9;
+        } else {
+            trans_rx_pkt_len = TRANS_RX_ENC_MSG_MAX_SIZE;
+        }
+        trans_rx_crc = crc32_update(trans_rx_crc, byte);
+    } else if (pos == 2) {
+        // Not a packet after all, so look at this byte again as a new start
+        if (byte != TRANS_PKT_DELIMITER) {
+            start_trans_rx_byte(byte);
+            return;
+        }
+    } else if (pos < 3 + trans_rx_enc_msg[1] &&
+            pos < TRANS_RX_ENC_MSG_MAX_SIZE - 6) {
+        trans_rx_crc = crc32_update(trans_rx_crc, byte);
+    }
+
+    trans_rx_enc_msg[pos] = byte;
+    trans_rx_pos = pos + 1;
+
+    if (trans_rx_pos < trans_rx_pkt_len) {
+        return;
+    }
+
+    // This only checks the delimiter bytes to be fast, and leaves it to
+    // decode_trans_rx_msg() to NACK if the length or checksum don't match
+    // If the delimiters are wrong, the RX timeout sends the NACK
+    uint8_t len = trans_rx_pkt_len;
+    trans_rx_state = TRANS_RX_IDLE;
+    if (trans_rx_enc_msg[len - 6] == TRANS_PKT_DELIMITER &&
+            trans_rx_enc_msg[len - 1] == TRANS_PKT_DELIMITER) {
+        trans_rx_enc_len = len;
+        trans_rx_enc_avail = true;
+        trans_rx_enc_crc = ~trans_rx_crc;
+        trans_rx_enc_crc_avail = true;
+        trans_rx_count = 0;
+        set_event(EVENT_TRANS_RX);
+    }
+}
 
-    // Command response
-    scan_trans_cmd_resp(buf, len);
+/*
+Handles the next byte of a command response from the transceiver (terminated
+    by '\r').
+*/
+void parse_trans_cmd_resp_byte(uint8_t byte) {
+    // Too long for the buffer, drop the rest of it
+    if (trans_rx_pos > TRANS_CMD_RESP_MAX_SIZE) {
+        if (byte == '\r') {
+            trans_rx_state = TRANS_RX_IDLE;
+        }
+        return;
+    }
+
+    trans_cmd_resp[trans_rx_pos] = byte;
+    trans_rx_pos++;
+
+    if (byte != '\r') {
+        return;
+    }
+
+    trans_rx_state = TRANS_RX_IDLE;
+    scan_trans_cmd_resp((const uint8_t*) trans_cmd_resp, trans_rx_pos);
     if (trans_cmd_resp_avail) {
+        trans_rx_count = 0;
+        set_event(EVENT_TRANS_RX);
         print("cmd resp: %u chars: ", trans_cmd_resp_len);
         for (uint8_t i = 0; i < trans_cmd_resp_len; i++) {
             put_uart_char(trans_cmd_resp[i]);
         }
         put_uart_char('\n');
-        return len;
     }
+}
 
-    // RX encoded message
-    scan_trans_rx_enc_msg(buf, len);
-    if (trans_rx_enc_avail) {
-        return len;
+/*
+Handles one received UART byte - takes the same amount of time for every byte
+    instead of rescanning everything received so far.
+This should be called within an ISR so it is atomic
+*/
+void parse_trans_rx_byte(uint8_t byte) {
+    if (trans_rx_count < UINT8_MAX) {
+        trans_rx_count++;
     }
 
-    // By default, we haven't processed any characters
-    return 0;
+    switch (trans_rx_state) {
+        case TRANS_RX_PKT:
+            parse_trans_rx_pkt_byte(byte);
+            break;
+        case TRANS_RX_CMD_RESP:
+            parse_trans_cmd_resp_byte(byte);
+            break;
+        default:
+            start_trans_rx_byte(byte);
+            break;
+    }
 }
 
-
-// Scans the contents of trans_cmd_resp for a command response, sets
-// trans_cmd_resp_avail if appropriate
+// Checks `buf` (a command response ending in '\r') for a successful command
+// response, copies it to trans_cmd_resp and sets trans_cmd_resp_avail if
+// appropriate
 void scan_trans_cmd_resp(const uint8_t* buf, uint8_t len) {
     // This should be a safe distinction
     // An RX encoded message should always start with 0x00 and some number
@@ -206,7 +517,7 @@ void scan_trans_cmd_resp(const uint8_t* buf, uint8_t len) {
         string_cmp(buf, "OK", 2) == 1 &&
         buf[len - 1] == '\r') {
 
-        // Copy all characters except '\r'
+        // Copy all characters except '\r' (buf may be trans_cmd_resp itself)
         for (uint8_t i = 0; i < len - 1; i++) {
             trans_cmd_resp[i] = buf[i];
         }
@@ -215,35 +526,54 @@ void scan_trans_cmd_resp(const uint8_t* buf, uint8_t len) {
     }
 }
 
-// Scans the contents of the UART RX buffer for a received message, sets
-// trans_rx_msg_avail if appropriate
-// This should be called within an ISR so it is atomic
-void scan_trans_rx_enc_msg(const uint8_t* buf, uint8_t len) {
-    // Check conditions
-    // Check the most likely to fail conditions first (want to process as quickly as possible if still receiving characters)
-    // This callback will only check for the delimiter bytes to be fast,
-    // and to leave it to NACK in a different place if the length doesn't match the data
-    if (len == TRANS_RX_ENC_MSG_MAX_SIZE &&
-        buf[0] == TRANS_PKT_DELIMITER &&
-        buf[2] == TRANS_PKT_DELIMITER &&
-        buf[len - 6] == TRANS_PKT_DELIMITER &&
-        buf[len - 1] == TRANS_PKT_DELIMITER) {
-
-        // Copy all characters
-        for (uint8_t i = 0; i < len; i++) {
-            trans_rx_enc_msg[i] = buf[i];
+/*
+Adds an ACK/NACK to the end of the queue.
+If the queue is full, the new ACK is dropped (the ones already waiting are not
+    overwritten).
+*/
+void add_trans_tx_ack(uint16_t cmd_id, uint8_t status) {
+    add_trans_tx_ack_bitmap(cmd_id, status, 0);
+}
+
+/*
+Adds the combined ACK for a batch message - `cmd_id` is the ID of the first
+    command and bit i of `bitmap` is set if command i was accepted.
+*/
+void add_trans_tx_batch_ack(uint16_t cmd_id, uint8_t bitmap) {
+    add_trans_tx_ack_bitmap(cmd_id, CMD_ACK_STATUS_BATCH, bitmap);
+}
+
+void add_trans_tx_ack_bitmap(uint16_t cmd_id, uint8_t status, uint8_t bitmap) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (trans_tx_ack_count < TRANS_TX_ACK_QUEUE_SIZE) {
+            uint8_t index = (trans_tx_ack_head + trans_tx_ack_count) %
+                TRANS_TX_ACK_QUEUE_SIZE;
+            trans_tx_ack_queue[index].cmd_id = cmd_id;
+            trans_tx_ack_queue[index].status = status;
+            trans_tx_ack_queue[index].bitmap = bitmap;
+            trans_tx_ack_count++;
         }
-        trans_rx_enc_len = len;
-        trans_rx_enc_avail = true;
     }
+    set_event(EVENT_TRANS_TX);
 }
 
-void add_trans_tx_ack(uint16_t cmd_id, uint8_t status) {
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        trans_tx_ack_cmd_id = cmd_id;
-        trans_tx_ack_status = status;
-        trans_tx_ack_avail = true;
+/*
+Removes the oldest ACK/NACK from the queue.
+Returns true if there was one to remove.
+*/
+bool dequeue_trans_tx_ack(uint16_t* cmd_id, uint8_t* status, uint8_t* bitmap) {
+    bool avail = false;
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (trans_tx_ack_count > 0) {
+            *cmd_id = trans_tx_ack_queue[trans_tx_ack_head].cmd_id;
+            *status = trans_tx_ack_queue[trans_tx_ack_head].status;
+            *bitmap = trans_tx_ack_queue[trans_tx_ack_head].bitmap;
+            trans_tx_ack_head = (trans_tx_ack_head + 1) % TRANS_TX_ACK_QUEUE_SIZE;
+            trans_tx_ack_count--;
+            avail = true;
+        }
     }
+    return avail;
 }
 
 void print_uint64(uint64_t num) {
@@ -254,12 +584,13 @@ void print_uint64(uint64_t num) {
 
 // trans_rx_enc_msg -> trans_rx_dec_msg
 void decode_trans_rx_msg(void) {
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         // Check encoded message available
         if (!trans_rx_enc_avail) {
             return;
         }
         trans_rx_enc_avail = false;
+        trans_rx_enc_crc_avail = false;
 
         if (print_trans_msgs) {
             print("\n");
@@ -283,14 +614,16 @@ void decode_trans_rx_msg(void) {
             ((uint32_t) trans_rx_enc_msg[enc_len - 3] << 8) |
             ((uint32_t) trans_rx_enc_msg[enc_len - 2] << 0);
 
-        // Array size to contain max number of decoded bytes plus the length byte
-        uint8_t checksum_bytes[TRANS_RX_DEC_MSG_MAX_SIZE + 1] = {0x00};
-        checksum_bytes[0] = dec_len;
-        for (uint8_t i = 0; i < dec_len &&
-                1 + i < sizeof(checksum_bytes) / sizeof(checksum_bytes[0]); i++) {
-            checksum_bytes[1 + i] = trans_rx_enc_msg[3 + i];
+        // Use the checksum calculated while receiving if there is one
+        // (otherwise trans_rx_enc_msg was set directly)
+        uint32_t expected_checksum = trans_rx_enc_crc;
+        if (!trans_rx_enc_crc_avail) {
+            uint32_t crc = crc32_update(CRC32_INIT, dec_len);
+            for (uint8_t i = 0; i < dec_len; i++) {
+                crc = crc32_update(crc, trans_rx_enc_msg[3 + i]);
+            }
+            expected_checksum = ~crc;
         }
-        uint32_t expected_checksum = crc32(checksum_bytes, 1 + dec_len);
 
 #ifdef TRANSCEIVER_DEBUG
         print("Received checksum: actual = 0x%.8lx, expected = 0x%.8lx\n",
@@ -317,112 +650,320 @@ void decode_trans_rx_msg(void) {
     }
 }
 
-// trans_tx_dec_msg -> trans_tx_enc_msg
+/*
+Finishes the packet in `frame` (trans_tx_ack_frame or trans_tx_dec_frame),
+    which already has the decoded bytes (`len` bytes) after the header, with
+    `checksum`, and makes it the encoded message to send.
+*/
+void fill_trans_tx_enc_msg(volatile uint8_t* frame, uint8_t len,
+        uint32_t checksum) {
+    // Decoded length
+    uint8_t dec_len = len;
+    uint8_t enc_len = dec_len + TRANS_PKT_HEADER_LEN + TRANS_PKT_TRAILER_LEN;
+
+    // All encoded messages start with 0x55
+    frame[0] = TRANS_PKT_DELIMITER;
+    // Next field is the length. This value will later be mapped similar to the other bytes.
+    frame[1] = dec_len;
+    frame[2] = TRANS_PKT_DELIMITER;
+    frame[enc_len - 6] = TRANS_PKT_DELIMITER;
+    frame[enc_len - 5] = (checksum >> 24) & 0xFF;
+    frame[enc_len - 4] = (checksum >> 16) & 0xFF;
+    frame[enc_len - 3] = (checksum >> 8) & 0xFF;
+    frame[enc_len - 2] = (checksum >> 0) & 0xFF;
+    frame[enc_len - 1] = TRANS_PKT_DELIMITER;
+
+    trans_tx_enc_msg = frame;
+    trans_tx_enc_len = enc_len;
+    trans_tx_enc_avail = true;
+
+    // print("trans_tx_enc_msg = ");
+    // print_bytes(trans_tx_enc_msg, trans_tx_enc_len);
+
+    // print("trans_tx_enc_len = %u\n", trans_tx_enc_len);
+    // print("trans_tx_enc_avail = %u\n", trans_tx_enc_avail);
+}
+
+/*
+trans_tx_ack_msg or trans_tx_dec_msg -> trans_tx_enc_msg
+ACK frames go first, so they are never held up by a long response
+The decoded message is encoded in place, so its available flag stays true
+    (nothing else can be written to it) until the packet has been sent (see
+    send_trans_tx_enc_msg()).
+*/
 void encode_trans_tx_msg(void) {
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        // Only one packet is sent at a time, until its guard time is over
+        if (trans_tx_enc_avail) {
+            return;
+        }
+
+        if (trans_tx_ack_msg_avail) {
+            if (print_trans_msgs) {
+                print("Trans TX (Decoded ACK): %u bytes: ", trans_tx_ack_msg_len);
+                print_bytes((uint8_t*) trans_tx_ack_msg, trans_tx_ack_msg_len);
+            }
+
+            if (trans_tx_ack_msg_len == 0 ||
+                    trans_tx_ack_msg_len > TRANS_TX_ACK_MSG_MAX_SIZE) {
+                trans_tx_ack_msg_avail = false;
+                return;
+            }
+
+            // Same checksum as trans_tx_dec_checksum(), the register starts
+            // from 0
+            uint32_t crc = 0;
+            for (uint8_t i = 0; i < trans_tx_ack_msg_len; i++) {
+                crc = crc32_update(crc, trans_tx_ack_msg[i]);
+            }
+            uint32_t checksum = ~(pgm_read_dword(
+                &crc32_tx_len_table[trans_tx_ack_msg_len]) ^ crc);
+
+            fill_trans_tx_enc_msg(trans_tx_ack_frame, trans_tx_ack_msg_len,
+                checksum);
+            return;
+        }
+
         if (!trans_tx_dec_avail) {
             return;
         }
-        trans_tx_dec_avail = false;
 
         if (print_trans_msgs) {
             print("Trans TX (Decoded): %u bytes: ", trans_tx_dec_len);
             print_bytes((uint8_t*) trans_tx_dec_msg, trans_tx_dec_len);
         }
 
+        // The next message starts with a new checksum (from
+        // start_trans_tx_dec_msg() or by writing trans_tx_dec_msg directly)
+        uint32_t checksum = trans_tx_dec_checksum();
+        trans_tx_dec_crc = 0;
+        trans_tx_dec_crc_len = 0;
+
         if (trans_tx_dec_len == 0 || trans_tx_dec_len > TRANS_TX_DEC_MSG_MAX_SIZE) {
+            trans_tx_dec_avail = false;
+            set_event(EVENT_CMD);
             return;
         }
 
-        // Decoded length
-        uint8_t dec_len = trans_tx_dec_len;
-        uint8_t enc_len = dec_len + 9;
+        fill_trans_tx_enc_msg(trans_tx_dec_frame, trans_tx_dec_len, checksum);
+    }
+}
 
-        uint8_t checksum_buf[TRANS_TX_DEC_MSG_MAX_SIZE + 1] = {0x00};
-        checksum_buf[0] = dec_len;
-        for (uint8_t i = 0; i < dec_len &&
-                1 + i < sizeof(checksum_buf) / sizeof(checksum_buf[0]); i++) {
-            checksum_buf[1 + i] = trans_tx_dec_msg[i];
-        }
-        uint32_t checksum = crc32(checksum_buf, 1 + dec_len);
+// Number of uptime timer ticks in one guard time
+uint32_t trans_tx_guard_ticks(void) {
+    return ((uint32_t) prof_ticks_per_s() * TRANS_TX_PKT_DELAY_MS) / 1000;
+}
 
-        // All encoded messages start with 0x00
-        trans_tx_enc_msg[0] = TRANS_PKT_DELIMITER;
-        // Next field is the length. This value will later be mapped similar to the other bytes.
-        trans_tx_enc_msg[1] = dec_len;
-        trans_tx_enc_msg[2] = TRANS_PKT_DELIMITER;
-        for (uint8_t i = 0; i < dec_len; i++) {
-            trans_tx_enc_msg[3 + i] = trans_tx_dec_msg[i];
-        }
-        trans_tx_enc_msg[enc_len - 6] = TRANS_PKT_DELIMITER;
-        trans_tx_enc_msg[enc_len - 5] = (checksum >> 24) & 0xFF;
-        trans_tx_enc_msg[enc_len - 4] = (checksum >> 16) & 0xFF;
-        trans_tx_enc_msg[enc_len - 3] = (checksum >> 8) & 0xFF;
-        trans_tx_enc_msg[enc_len - 2] = (checksum >> 0) & 0xFF;
-        trans_tx_enc_msg[enc_len - 1] = TRANS_PKT_DELIMITER;
+/*
+Starts a guard time and sets up the timer 1 compare B interrupt to wake up the
+    main loop (with EVENT_TRANS_TX) when it is over, so the loop can sleep
+    instead of checking the time on every pass.
+The uptime timer counts up to OCR1A once per second and the guard time is less
+    than a second, so the compare matches exactly once, at the end of it.
+*/
+void start_trans_tx_guard(void) {
+    trans_tx_enc_guard_ticks = prof_ticks();
+    uint32_t end_ticks = trans_tx_enc_guard_ticks + trans_tx_guard_ticks();
 
-        trans_tx_enc_len = enc_len;
-        trans_tx_enc_avail = true;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        OCR1B = end_ticks % prof_ticks_per_s();
+        // Don't run for an old compare match
+        TIFR1 = _BV(OCF1B);
+        TIMSK1 |= _BV(OCIE1B);
+    }
+}
 
-        // print("trans_tx_enc_msg = ");
-        // print_bytes(trans_tx_enc_msg, trans_tx_enc_len);
+/*
+Returns true if at least TRANS_TX_PKT_DELAY_MS has passed since the current
+    guard time started.
+*/
+bool trans_tx_guard_done(void) {
+    uint32_t ticks = prof_ticks() - trans_tx_enc_guard_ticks;
+    return ticks >= trans_tx_guard_ticks();
+}
 
-        // print("trans_tx_enc_len = %u\n", trans_tx_enc_len);
-        // print("trans_tx_enc_avail = %u\n", trans_tx_enc_avail);
-        // print("trans_tx_enc_msg = ");
-        // print_bytes(trans_tx_enc_msg, trans_tx_enc_len);
-    }
+// End of the guard time (see start_trans_tx_guard())
+ISR(TIMER1_COMPB_vect) {
+    TIMSK1 &= ~_BV(OCIE1B);
+    set_event(EVENT_TRANS_TX);
 }
 
+/*
+Continues sending the encoded TX message without blocking - call this every
+    time the main loop runs, it sets EVENT_TRANS_TX again until the packet is
+    finished (except during the guard times, which end with the compare
+    interrupt from start_trans_tx_guard()).
+
+The lib-common UART ISR already uses the only LIN/UART interrupt (for RX), so
+    the bytes are written from here, one at a time whenever the UART is not
+    busy, and interrupts stay enabled. The guard times before and after the
+    packet are measured with the uptime timer instead of _delay_ms().
+
+trans_tx_enc_avail stays true (so no other packet is started) until the guard
+    time after the packet is over. The decoded message the packet was built
+    from is freed as soon as its last byte is written, so the next one can be
+    built during the guard time.
+*/
 void send_trans_tx_enc_msg(void) {
     // Assume the transceiver is already in pipe mode (should only be a few
     // seconds since when we received a packet)
 
-    // Make sure all the bytes are sent atomically over UART
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        if (!trans_tx_enc_avail) {
-            return;
-        }
-        trans_tx_enc_avail = false;
+    // We only need to supply the message, not any additional packet
+    // information from Transceiver Packet Protocol document
 
-        if (print_trans_msgs) {
-            print("Trans TX (Encoded): %u bytes: ", trans_tx_enc_len);
-            print_bytes((uint8_t*) trans_tx_enc_msg, trans_tx_enc_len);
-        }
+    // There is no need for a delimiter character, as far as the transmitter
+    // is concerned
+    // For the default 9600-2400 mode, need about 100ms between sent packets
+    // (use 200ms to be safe)
+    // Do this to separate intentional packets from each other and from
+    // unintentional packets from other UART output
+
+    if (!trans_tx_enc_avail) {
+        return;
+    }
+
+    switch (trans_tx_enc_state) {
+        case TRANS_TX_ENC_IDLE:
+            // Wait for the response to a transceiver command first
+            if (trans_cmd_state == TRANS_CMD_WAITING) {
+                break;
+            }
+
+            if (print_trans_msgs) {
+                print("Trans TX (Encoded): %u bytes: ", trans_tx_enc_len);
+                print_bytes((uint8_t*) trans_tx_enc_msg, trans_tx_enc_len);
+            }
+
+            trans_tx_enc_sent = 0;
+            start_trans_tx_guard();
+            trans_tx_enc_state = TRANS_TX_ENC_PRE_GUARD;
+            break;
 
-        // We only need to supply the message, not any additional packet
-        // information from Transceiver Packet Protocol document
+        case TRANS_TX_ENC_PRE_GUARD:
+            if (trans_tx_guard_done()) {
+                trans_tx_enc_state = TRANS_TX_ENC_SENDING;
+            }
+            break;
 
-        // There is no need for a delimiter character, as far as the transmitter
-        // is concerned
-        // For the default 9600-2400 mode, need about 100ms between sent packets
-        // (use 200ms to be safe)
-        // Do this to separate intentional packets from each other and from
-        // unintentional packets from other UART output
+        case TRANS_TX_ENC_SENDING:
+            // put_uart_char() only waits if the UART is busy, so this never
+            // blocks for more than one byte at a time
+            while (trans_tx_enc_sent < trans_tx_enc_len &&
+                    bit_is_clear(LINSIR, LBUSY)) {
+                put_uart_char(trans_tx_enc_msg[trans_tx_enc_sent]);
+                trans_tx_enc_sent++;
+            }
+
+            if (trans_tx_enc_sent >= trans_tx_enc_len) {
+                if (trans_tx_enc_msg == trans_tx_ack_frame) {
+                    trans_tx_ack_msg_avail = false;
+                } else {
+                    trans_tx_dec_avail = false;
+                    // The response slot is free for the next command
+                    set_event(EVENT_CMD);
+                }
+
+                start_trans_tx_guard();
+                trans_tx_enc_state = TRANS_TX_ENC_POST_GUARD;
+            }
+            break;
 
-        _delay_ms(TRANS_TX_PKT_DELAY_MS);
-        for (uint8_t i = 0; i < trans_tx_enc_len; i++) {
-            put_uart_char(trans_tx_enc_msg[i]);
+        case TRANS_TX_ENC_POST_GUARD:
+            if (trans_tx_guard_done()) {
+                trans_tx_enc_state = TRANS_TX_ENC_IDLE;
+                trans_tx_enc_avail = false;
+            }
+            break;
+
+        default:
+            trans_tx_enc_state = TRANS_TX_ENC_IDLE;
+            break;
+    }
+
+    // Keep the main loop running until the packet is done, but let it sleep
+    // until the end of a guard time
+    if (trans_tx_enc_state != TRANS_TX_ENC_PRE_GUARD &&
+            trans_tx_enc_state != TRANS_TX_ENC_POST_GUARD) {
+        set_event(EVENT_TRANS_TX);
+    }
+}
+
+/*
+Sends the whole encoded TX message (if available) before returning, for
+    tests that expect each packet to be sent right away.
+*/
+void flush_trans_tx_enc_msg(void) {
+    while (trans_tx_enc_avail) {
+        send_trans_tx_enc_msg();
+    }
+}
+
+/*
+Starts a new decoded TX message (with no bytes).
+*/
+void start_trans_tx_dec_msg(void) {
+    trans_tx_dec_len = 0;
+    trans_tx_dec_crc = 0;
+    trans_tx_dec_crc_len = 0;
+}
+
+/*
+Adds a byte to the decoded TX message and its checksum.
+*/
+void append_to_trans_tx_dec_msg(uint8_t byte) {
+    if (trans_tx_dec_len < TRANS_TX_DEC_MSG_MAX_SIZE) {
+        trans_tx_dec_msg[trans_tx_dec_len] = byte;
+        trans_tx_dec_len++;
+        if (trans_tx_dec_crc_len == trans_tx_dec_len - 1) {
+            trans_tx_dec_crc = crc32_update(trans_tx_dec_crc, byte);
+            trans_tx_dec_crc_len = trans_tx_dec_len;
         }
-        _delay_ms(TRANS_TX_PKT_DELAY_MS);
     }
 }
 
+/*
+Returns the checksum of the encoded message for trans_tx_dec_msg (the length
+    byte and decoded bytes).
+Bytes written directly to trans_tx_dec_msg after the ones added with
+    append_to_trans_tx_dec_msg() are added to the checksum here.
+*/
+uint32_t trans_tx_dec_checksum(void) {
+    if (trans_tx_dec_crc_len > trans_tx_dec_len) {
+        trans_tx_dec_crc = 0;
+        trans_tx_dec_crc_len = 0;
+    }
+    for (; trans_tx_dec_crc_len < trans_tx_dec_len; trans_tx_dec_crc_len++) {
+        trans_tx_dec_crc = crc32_update(trans_tx_dec_crc,
+            trans_tx_dec_msg[trans_tx_dec_crc_len]);
+    }
+
+    if (trans_tx_dec_len > TRANS_TX_DEC_MSG_MAX_SIZE) {
+        return 0;
+    }
+    return ~(pgm_read_dword(&crc32_tx_len_table[trans_tx_dec_len]) ^
+        trans_tx_dec_crc);
+}
+
+/*
+Adds a byte to a CRC32 register (start with CRC32_INIT, and invert the
+    register at the end to get the checksum).
+Uses two lookups in a 16-entry table instead of looping over each bit.
+*/
+uint32_t crc32_update(uint32_t crc, uint8_t byte) {
+    crc = (crc >> 4) ^
+        pgm_read_dword(&crc32_nibble_table[(crc ^ byte) & 0x0F]);
+    crc = (crc >> 4) ^
+        pgm_read_dword(&crc32_nibble_table[(crc ^ (byte >> 4)) & 0x0F]);
+    return crc;
+}
+
 /**
  * Calculates the checksum for the string message.
- * Algorithm retrieved from:
- * https://stackoverflow.com/questions/21001659/crc32-algorithm-implementation-in-c-without-a-look-up-table-and-with-a-public-li
  */
 uint32_t crc32(unsigned char *message, const uint8_t len) {
-    uint32_t crc = 0xFFFFFFFF;
-
+    uint32_t crc = CRC32_INIT;
     for (uint8_t i = 0; i < len; i++) {
-        uint32_t byte = message[i];            // Get next byte.
-        crc = crc ^ byte;
-        for (uint8_t j = 0; j < 8; j++) {    // Do eight times.
-            uint32_t mask = -(crc & 1);
-            crc = (crc >> 1) ^ (0xEDB88320 & mask);    // 0xEDB88320 is 0x04C11DB7 reversed
-        }
+        crc = crc32_update(crc, message[i]);
     }
     return ~crc;
 }
@@ -515,8 +1056,9 @@ uint8_t string_cmp(const uint8_t* first, const char* second, uint8_t len) {
 }
 
 void clear_trans_cmd_resp(void) {
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         clear_uart_rx_buf();
+        reset_trans_rx_parser();
         trans_cmd_resp_len = 0;
         trans_cmd_resp_avail = false;
     }
@@ -541,8 +1083,18 @@ uint8_t wait_for_trans_cmd_resp(uint8_t expected_len) {
         return 0;
     }
 
+    return check_trans_cmd_resp(expected_len);
+}
+
+/*
+Checks the command response in trans_cmd_resp (assuming trans_cmd_resp_avail
+    is true).
+expected_len - expected length of the response, NOT INCLUDING the checksum
+Returns - 1 if it has the expected length and a valid checksum, 0 otherwise
+*/
+uint8_t check_trans_cmd_resp(uint8_t expected_len) {
     // Check if the string's length matched the expected number of characters
-    // Add 1 to account for the '\r' character
+    // (followed by a space and the 8 checksum characters)
     if (trans_cmd_resp_len != expected_len + 9) {
         return 0;
     }
@@ -573,7 +1125,7 @@ bool send_trans_cmd(uint8_t expected_len, char* fmt, ...) {
     for (uint8_t i = 0; (i < TRANS_MAX_CMD_ATTEMPTS) && (ret == 0); i++) {
         // Send command
         clear_trans_cmd_resp();
-        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
             print("\r%s %.8lX\r", command_buf, check_sum);
         }
 
@@ -585,6 +1137,180 @@ bool send_trans_cmd(uint8_t expected_len, char* fmt, ...) {
 }
 
 
+
+/*
+Adds a register read command to the end of the queue of transceiver commands
+    sent by run_trans_cmds().
+reg - register number (e.g. 0x04 for the number of received packets)
+expected_len - expected length of the response, NOT INCLUDING the checksum
+cb - called when the command finishes (or NULL)
+Returns - true if it was added, false if the queue is full
+*/
+bool enqueue_trans_read(uint8_t reg, uint8_t expected_len, trans_cmd_cb_t cb) {
+    return enqueue_trans_write_op(TRANS_CMD_READ, reg, 0, 0, NULL,
+        expected_len, cb);
+}
+
+/*
+Adds a register write command to the end of the queue of transceiver commands.
+reg - register number
+num_digits - number of hex digits to write `value` with (0 to 8)
+value - value to write
+text - string written after the value (must stay valid until the command
+    finishes), or NULL
+expected_len - expected length of the response, NOT INCLUDING the checksum
+cb - called when the command finishes (or NULL)
+Returns - true if it was added, false if the queue is full
+
+e.g. set_trans_freq() is reg = 0x01, num_digits = 8, value = freq
+*/
+bool enqueue_trans_write(uint8_t reg, uint8_t num_digits, uint32_t value,
+        const char* text, uint8_t expected_len, trans_cmd_cb_t cb) {
+    return enqueue_trans_write_op(TRANS_CMD_WRITE, reg, num_digits, value,
+        text, expected_len, cb);
+}
+
+bool enqueue_trans_write_op(uint8_t op, uint8_t reg, uint8_t num_digits,
+        uint32_t value, const char* text, uint8_t expected_len,
+        trans_cmd_cb_t cb) {
+    bool added = false;
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (trans_cmd_count < TRANS_CMD_QUEUE_SIZE) {
+            trans_cmd_t* cmd = &trans_cmd_queue[
+                (trans_cmd_head + trans_cmd_count) % TRANS_CMD_QUEUE_SIZE];
+            cmd->op = op;
+            cmd->reg = reg;
+            cmd->num_digits = num_digits;
+            cmd->value = value;
+            cmd->text = text;
+            cmd->expected_len = expected_len;
+            cmd->cb = cb;
+            trans_cmd_count++;
+            added = true;
+        }
+    }
+    set_event(EVENT_TRANS_RX);
+    return added;
+}
+
+/*
+Writes the command text for `cmd` to `buf` (same format as the send_trans_cmd()
+    calls, e.g. "ES+R2204") without using vsnprintf().
+size - size of `buf`, including the '\0' termination
+Returns - number of characters (not including the '\0')
+*/
+uint8_t format_trans_cmd(const trans_cmd_t* cmd, uint8_t* buf, uint8_t size) {
+    uint8_t len = 0;
+    buf[len++] = 'E';
+    buf[len++] = 'S';
+    buf[len++] = '+';
+    buf[len++] = cmd->op;
+    buf[len++] = hex_to_char((TRANS_ADDR >> 4) & 0x0F);
+    buf[len++] = hex_to_char(TRANS_ADDR & 0x0F);
+    buf[len++] = hex_to_char((cmd->reg >> 4) & 0x0F);
+    buf[len++] = hex_to_char(cmd->reg & 0x0F);
+    for (uint8_t i = cmd->num_digits; i > 0; i--) {
+        buf[len++] = hex_to_char((cmd->value >> ((i - 1) * 4)) & 0x0F);
+    }
+    if (cmd->text != NULL) {
+        for (uint8_t i = 0; cmd->text[i] != '\0' && len < size - 1; i++) {
+            buf[len++] = cmd->text[i];
+        }
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+/*
+Sends the command at the head of the queue to the transceiver.
+*/
+void send_next_trans_cmd(void) {
+    uint8_t len = format_trans_cmd(&trans_cmd_queue[trans_cmd_head],
+        command_buf, COMMAND_BUF_SIZE);
+    uint32_t check_sum = crc32(command_buf, len);
+
+    clear_trans_cmd_resp();
+    trans_cmd_wait_s = 0;
+    trans_cmd_attempts++;
+    trans_cmd_state = TRANS_CMD_WAITING;
+
+    // Same as print("\r%s %.8lX\r", command_buf, check_sum);
+    put_uart_char('\r');
+    for (uint8_t i = 0; i < len; i++) {
+        put_uart_char(command_buf[i]);
+    }
+    put_uart_char(' ');
+    for (uint8_t i = 8; i > 0; i--) {
+        put_uart_char(hex_to_char((check_sum >> ((i - 1) * 4)) & 0x0F));
+    }
+    put_uart_char('\r');
+}
+
+/*
+Removes the command at the head of the queue and calls its callback.
+The response (if `success`) is still in trans_cmd_resp during the callback.
+*/
+void finish_trans_cmd(bool success) {
+    trans_cmd_cb_t cb = trans_cmd_queue[trans_cmd_head].cb;
+
+    PROF_ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        trans_cmd_head = (trans_cmd_head + 1) % TRANS_CMD_QUEUE_SIZE;
+        trans_cmd_count--;
+        trans_cmd_state = TRANS_CMD_IDLE;
+        trans_cmd_attempts = 0;
+    }
+
+    if (cb != NULL) {
+        cb(success);
+    }
+    clear_trans_cmd_resp();
+
+    // Start the next one
+    if (trans_cmd_count > 0) {
+        set_event(EVENT_TRANS_RX);
+    }
+}
+
+/*
+Makes progress on the transceiver command queue without waiting - sends the
+    next command, checks for its response, and retries it (up to
+    TRANS_MAX_CMD_ATTEMPTS times) if there is no valid response within
+    TRANS_CMD_TIMEOUT_S.
+*/
+void run_trans_cmds(void) {
+    if (trans_cmd_count == 0) {
+        return;
+    }
+
+    if (trans_cmd_state == TRANS_CMD_IDLE) {
+        // Don't mix the command with the bytes of a packet
+        if (trans_tx_enc_avail) {
+            set_event(EVENT_TRANS_RX);
+            return;
+        }
+        send_next_trans_cmd();
+        return;
+    }
+
+    if (trans_cmd_resp_avail) {
+        if (check_trans_cmd_resp(
+                trans_cmd_queue[trans_cmd_head].expected_len)) {
+            finish_trans_cmd(true);
+            return;
+        }
+    } else if (trans_cmd_wait_s < TRANS_CMD_TIMEOUT_S) {
+        return;
+    }
+
+    // Invalid response or timed out
+    if (trans_cmd_attempts >= TRANS_MAX_CMD_ATTEMPTS) {
+        finish_trans_cmd(false);
+    } else {
+        trans_cmd_state = TRANS_CMD_IDLE;
+        set_event(EVENT_TRANS_RX);
+    }
+}
+
 /*
 1. Write to status control register (p. 15-16)
 
@@ -1084,30 +1810,15 @@ uint8_t correct_transceiver_baud_rate(const uart_baud_rate_t new_rate, uart_baud
             break;
         }
     }
+    // Don't write a status register that was never read
+    if (received == 0) {
+        set_uart_baud_rate(new_rate);
+        return 0;
+    }
 
     // set bits 12 and 13 of the scw to correspond to the new baud rate
-    uint16_t scw_new;
-    switch (new_rate) {
-        case UART_BAUD_1200:
-            // 01
-            scw_new = (scw & ~_BV(13)) | _BV(12);
-            break;
-        case UART_BAUD_9600:
-            // 00
-            scw_new = (scw & ~_BV(13)) & ~_BV(12);
-            break;
-        case UART_BAUD_19200:
-            // 10
-            scw_new = (scw | _BV(13)) & ~_BV(12);
-            break;
-        case UART_BAUD_115200:
-            // 11
-            scw_new = (scw | _BV(13)) | _BV(12);
-            break;
-        default: // Default baud rate will be 9600
-            scw_new = (scw & ~_BV(13)) & ~_BV(12);
-            break;
-    }
+    uint16_t scw_new = (scw & ~(0x3 << TRANS_UART_BAUD)) |
+        ((uint16_t) trans_uart_baud_bits(new_rate) << TRANS_UART_BAUD);
 
     set_trans_scw(scw_new);
     // Set the UART baud rate to new rate
@@ -1123,3 +1834,270 @@ uint8_t correct_transceiver_baud_rate(const uart_baud_rate_t new_rate, uart_baud
         return 0;
     }
 }
+
+
+/*
+Sets all beacon fields to 0.
+*/
+void init_trans_beacon(void) {
+    for (uint8_t i = 0; i < TRANS_BEACON_CONTENT_LEN; i++) {
+        trans_beacon_content[i] = '0';
+    }
+    trans_beacon_content[TRANS_BEACON_CONTENT_LEN] = '\0';
+}
+
+/*
+Sets field `index` of the beacon content to the lower 24 bits of `value`.
+Only marks the content as changed if the digits are different.
+*/
+void set_trans_beacon_field(uint8_t index, uint32_t value) {
+    if (index >= TRANS_BEACON_NUM_FIELDS) {
+        return;
+    }
+
+    char* field = &trans_beacon_content[index * TRANS_BEACON_FIELD_LEN];
+    for (uint8_t i = 0; i < TRANS_BEACON_FIELD_LEN; i++) {
+        char c = hex_to_char((value >> ((TRANS_BEACON_FIELD_LEN - 1 - i) * 4)) & 0x0F);
+        if (field[i] != c) {
+            field[i] = c;
+            trans_beacon_dirty = true;
+        }
+    }
+}
+
+void trans_beacon_cb(bool success) {
+    trans_beacon_busy = false;
+    // Try again after the rate limit
+    if (!success) {
+        trans_beacon_dirty = true;
+    }
+}
+
+/*
+Writes the beacon content to the transceiver if it changed, at most once every
+    TRANS_BEACON_MIN_PERIOD_S.
+The command is formatted from trans_beacon_content when it is sent, so it
+    includes any fields changed while it waits in the queue.
+*/
+void run_trans_beacon(void) {
+    if (!trans_beacon_dirty || trans_beacon_busy ||
+            trans_beacon_wait_s < TRANS_BEACON_MIN_PERIOD_S) {
+        return;
+    }
+
+    // Same as set_trans_beacon_content()
+    if (enqueue_trans_write(TRANS_REG_BEACON_CONTENT, 2,
+            TRANS_BEACON_CONTENT_LEN, trans_beacon_content, 2,
+            trans_beacon_cb)) {
+        trans_beacon_busy = true;
+        trans_beacon_dirty = false;
+        trans_beacon_wait_s = 0;
+    }
+}
+
+/*
+Returns the value of the status register baud rate bits (13-12) for `rate`
+    (9600 for an unknown rate).
+*/
+uint8_t trans_uart_baud_bits(uart_baud_rate_t rate) {
+    switch (rate) {
+        case UART_BAUD_1200:
+            return 0x1;
+        case UART_BAUD_19200:
+            return 0x2;
+        case UART_BAUD_115200:
+            return 0x3;
+        case UART_BAUD_9600:
+        default:
+            return 0x0;
+    }
+}
+
+/*
+Switches the OBC and transceiver UART to the highest baud rate (up to
+    TRANS_UART_MAX_BAUD) where TRANS_UART_BAUD_CHECKS status register reads in
+    a row succeed, going down one rate at a time to 9600.
+Assumes both are at 9600 (see correct_transceiver_baud_rate()). Blocking, so
+    only use this during initialization.
+*/
+void init_trans_uart_baud(void) {
+    uart_baud_rate_t previous = UART_BAUD_9600;
+
+    for (uint8_t rate = TRANS_UART_MAX_BAUD; rate > UART_BAUD_9600; rate--) {
+        uint8_t ok = correct_transceiver_baud_rate(rate, &previous);
+        for (uint8_t i = 0; ok && i < TRANS_UART_BAUD_CHECKS; i++) {
+            ok = get_trans_scw(NULL, NULL, NULL);
+        }
+
+        if (ok) {
+            trans_uart_baud = rate;
+            return;
+        }
+
+        // Not stable, go back to 9600 before trying the next rate
+        correct_transceiver_baud_rate(UART_BAUD_9600, &previous);
+    }
+
+    set_uart_baud_rate(UART_BAUD_9600);
+    trans_uart_baud = UART_BAUD_9600;
+}
+
+/*
+Reads the RF mode from the transceiver (it keeps its status register across
+    OBC resets). Blocking, so only use this during initialization.
+*/
+void init_trans_link(void) {
+    uint16_t scw = 0;
+    if (get_trans_scw(NULL, NULL, &scw)) {
+        trans_rf_mode = (scw >> TRANS_RF_MODE) & 0x07;
+    }
+    trans_link_prev_rx_s = uptime_s;
+}
+
+/*
+Returns the RF mode to use after a link check.
+mode - current RF mode
+rssi - last RSSI
+rx_count - number of packets received since the last check
+crc_count - number of packets with CRC errors since the last check
+no_rx_s - number of seconds since packets were last received
+
+Always goes back to the default mode if ground has not been heard from in
+    TRANS_LINK_FALLBACK_S (e.g. the ground station lost the link after a
+    switch). Otherwise if automatic switching is on, switches to the fast mode
+    during a good pass and back when CRC errors rise.
+*/
+uint8_t next_trans_rf_mode(uint8_t mode, uint8_t rssi, uint32_t rx_count,
+        uint32_t crc_count, uint32_t no_rx_s) {
+    if (no_rx_s >= TRANS_LINK_FALLBACK_S) {
+        return TRANS_RF_MODE_DEF;
+    }
+    if (!trans_rf_auto) {
+        return mode;
+    }
+
+    if (crc_count > 0 && crc_count * 100 >=
+            (uint32_t) TRANS_LINK_DOWN_CRC_PCT * (rx_count + crc_count)) {
+        return TRANS_RF_MODE_DEF;
+    }
+    if (rssi >= TRANS_LINK_UP_RSSI && rx_count >= TRANS_LINK_UP_MIN_RX &&
+            crc_count == 0) {
+        return TRANS_RF_MODE_FAST;
+    }
+    return mode;
+}
+
+/*
+Requests an RF mode change, which is written by run_trans_link() once nothing
+    is waiting to be sent (so a response is not sent in the new mode).
+*/
+void request_trans_rf_mode(uint8_t mode) {
+    if (mode > TRANS_RF_MODE_MAX) {
+        return;
+    }
+    trans_rf_mode_req = mode;
+    set_event(EVENT_TRANS_RX);
+}
+
+// Each response has the RSSI in characters 3-4 and the count in 5-12
+void trans_link_rx_cb(bool success) {
+    trans_link_new_rx_valid = success;
+    if (success) {
+        trans_link_new_rx_count = scan_uint(trans_cmd_resp, 5, 8);
+    }
+}
+
+void trans_link_crc_cb(bool success) {
+    if (!success || !trans_link_new_rx_valid) {
+        return;
+    }
+
+    uint8_t rssi = (uint8_t) scan_uint(trans_cmd_resp, 3, 2);
+    uint32_t crc_count = scan_uint(trans_cmd_resp, 5, 8);
+
+    // The counters only go up (until the transceiver resets), so the first
+    // check only sets the starting point
+    if (trans_link_counts_valid &&
+            trans_link_new_rx_count >= trans_link_rx_count &&
+            crc_count >= trans_link_crc_count) {
+        uint32_t rx_diff = trans_link_new_rx_count - trans_link_rx_count;
+        uint32_t crc_diff = crc_count - trans_link_crc_count;
+        if (rx_diff > 0) {
+            trans_link_prev_rx_s = uptime_s;
+        }
+
+        uint8_t mode = next_trans_rf_mode(trans_rf_mode, rssi, rx_diff,
+            crc_diff, uptime_s - trans_link_prev_rx_s);
+        if (mode != trans_rf_mode) {
+            request_trans_rf_mode(mode);
+        }
+    }
+
+    trans_link_rssi = rssi;
+    trans_link_rx_count = trans_link_new_rx_count;
+    trans_link_crc_count = crc_count;
+    trans_link_counts_valid = true;
+}
+
+// Sets the RF mode bits (10-8) in the status register that was just read
+void trans_rf_mode_scw_cb(bool success) {
+    if (!success) {
+        trans_rf_mode_next = TRANS_RF_MODE_NONE;
+        return;
+    }
+
+    uint16_t scw = (uint16_t) scan_uint(trans_cmd_resp, 9, 4);
+    scw = (scw & ~(0x07 << TRANS_RF_MODE)) |
+        ((uint16_t) trans_rf_mode_next << TRANS_RF_MODE);
+    // Same as set_trans_scw()
+    if (!enqueue_trans_write(TRANS_REG_SCW, 4, scw, NULL, 7,
+            trans_rf_mode_set_cb)) {
+        trans_rf_mode_next = TRANS_RF_MODE_NONE;
+    }
+}
+
+void trans_rf_mode_set_cb(bool success) {
+    if (success) {
+        trans_rf_mode = trans_rf_mode_next;
+        // Unless a different mode was requested in the meantime
+        if (trans_rf_mode_req == trans_rf_mode_next) {
+            trans_rf_mode_req = TRANS_RF_MODE_NONE;
+        }
+    }
+    // Otherwise the request is tried again
+    trans_rf_mode_next = TRANS_RF_MODE_NONE;
+}
+
+/*
+Link adaptation - reads the RSSI and packet counters every
+    TRANS_LINK_CHECK_PERIOD_S (see next_trans_rf_mode()) and writes requested
+    RF mode changes, all through the transceiver command queue.
+*/
+void run_trans_link(void) {
+    if (trans_link_check_pending) {
+        trans_link_check_pending = false;
+        // Received packets first, so both counts cover the same packets
+        enqueue_trans_read(TRANS_REG_NUM_RX_PACKETS, 13, trans_link_rx_cb);
+        enqueue_trans_read(TRANS_REG_NUM_RX_PACKETS_CRC, 13, trans_link_crc_cb);
+    }
+
+    if (trans_rf_mode_req == TRANS_RF_MODE_NONE ||
+            trans_rf_mode_next != TRANS_RF_MODE_NONE) {
+        return;
+    }
+    if (trans_rf_mode_req == trans_rf_mode) {
+        trans_rf_mode_req = TRANS_RF_MODE_NONE;
+        return;
+    }
+    // Wait until everything for ground has been sent in the current mode
+    // (trans_uptime_cb() checks again every second)
+    if (trans_tx_ack_count > 0 || trans_tx_ack_msg_avail ||
+            trans_tx_dec_avail || trans_tx_enc_avail) {
+        return;
+    }
+
+    trans_rf_mode_next = trans_rf_mode_req;
+    if (!enqueue_trans_read(TRANS_REG_SCW, 13, trans_rf_mode_scw_cb)) {
+        trans_rf_mode_next = TRANS_RF_MODE_NONE;
+    }
+}
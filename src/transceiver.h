@@ -1,5 +1,9 @@
+#ifndef TRANSCEIVER_H
+#define TRANSCEIVER_H
+
 // AVR Library Includes
 #include <avr/io.h>
+#include <avr/pgmspace.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <math.h>
@@ -10,23 +14,63 @@
 #include <utilities/utilities.h>
 
 #include "command_utilities.h"
+#include "events.h"
+#include "profiler.h"
 
 
 // Number of characters in the buffer of received UART RX characters
 #define TRANS_CMD_RESP_MAX_SIZE     50
-#define TRANS_RX_ENC_MSG_MAX_SIZE   24
-#define TRANS_RX_DEC_MSG_MAX_SIZE   15
+// Large enough for a batch message with CMD_BATCH_MAX_CMDS commands (a
+// message with one command is still 15 bytes, or 24 bytes encoded)
+#define TRANS_RX_ENC_MSG_MAX_SIZE   60
+#define TRANS_RX_DEC_MSG_MAX_SIZE   51
 #define TRANS_TX_DEC_MSG_MAX_SIZE   128
-#define TRANS_TX_ENC_MSG_MAX_SIZE   137
+// Each packet has 0x55, the length and 0x55 before the decoded message, and
+// 0x55, the CRC32 (4 bytes) and 0x55 after it
+#define TRANS_PKT_HEADER_LEN        3
+#define TRANS_PKT_TRAILER_LEN       6
+#define TRANS_TX_ENC_MSG_MAX_SIZE   \
+    (TRANS_TX_DEC_MSG_MAX_SIZE + TRANS_PKT_HEADER_LEN + TRANS_PKT_TRAILER_LEN)
+
+// Number of ACKs/NACKs that can wait to be sent (e.g. while a long response
+// is being sent)
+#define TRANS_TX_ACK_QUEUE_SIZE     16
+// Each ACK is the command ID (2 bytes) and status (1 byte)
+#define TRANS_TX_ACK_LEN            3
+// A batch ACK also has a bitmap of the accepted commands
+#define TRANS_TX_ACK_BATCH_LEN      4
+// An ACK frame has up to one ACK per queue slot (if they are coalesced)
+#define TRANS_TX_ACK_MSG_MAX_SIZE   (TRANS_TX_ACK_QUEUE_SIZE * TRANS_TX_ACK_BATCH_LEN)
+#define TRANS_TX_ACK_ENC_MAX_SIZE   \
+    (TRANS_TX_ACK_MSG_MAX_SIZE + TRANS_PKT_HEADER_LEN + TRANS_PKT_TRAILER_LEN)
+
+// The decoded ACK and TX messages are built in place in their encoded frames
+// (after the packet header), so they are not copied to be sent
+#define trans_tx_ack_msg    (&trans_tx_ack_frame[TRANS_PKT_HEADER_LEN])
+#define trans_tx_dec_msg    (&trans_tx_dec_frame[TRANS_PKT_HEADER_LEN])
 
 #define TRANS_PKT_DELIMITER 0x55
 
+// RX parser states
+#define TRANS_RX_IDLE       0
+#define TRANS_RX_PKT        1
+#define TRANS_RX_CMD_RESP   2
+
+// Initial CRC32 register value
+#define CRC32_INIT          0xFFFFFFFFUL
+
 // Number of seconds to wait (if we are not receiving anymore characters) to clear the buffer
 // Uptime error is +- 1 second, which should be accounted for in this number
 #define TRANS_RX_BUF_TIMEOUT_S  2
-// Number of milliseconds to delay before and after sending a packet
+// Number of milliseconds to wait before and after sending a packet
 #define TRANS_TX_PKT_DELAY_MS   200
 
+// Sending states of the encoded TX message
+#define TRANS_TX_ENC_IDLE       0
+#define TRANS_TX_ENC_PRE_GUARD  1
+#define TRANS_TX_ENC_SENDING    2
+#define TRANS_TX_ENC_POST_GUARD 3
+
 // If we time out while receiving bytes of an RX packet, must have this number
 // of bytes or greater in the RX buffer to send an ACK packet
 // If there are less received bytes than this, don't sent an ACK packet back
@@ -55,6 +99,21 @@
 // Maximum number of times to attempt each command
 #define TRANS_MAX_CMD_ATTEMPTS 3
 
+// Transceiver commands sent without blocking (see run_trans_cmds())
+// Number of commands that can wait in the queue
+#define TRANS_CMD_QUEUE_SIZE    8
+// Number of seconds to wait for a response before trying again
+// Uptime error is +- 1 second, so this is at least 1 second
+#define TRANS_CMD_TIMEOUT_S     2
+
+// Command types (the character after "ES+")
+#define TRANS_CMD_READ          'R'
+#define TRANS_CMD_WRITE         'W'
+
+// States of the command at the head of the queue
+#define TRANS_CMD_IDLE          0
+#define TRANS_CMD_WAITING       1
+
 /*
 Default status register value
 baud rate = 0b00 (9600)
@@ -67,6 +126,41 @@ boot = 0b0 (application mode)
 */
 #define TRANS_DEF_SCW   0x0303
 
+// Registers read by the link adaptation (p. 15-23)
+#define TRANS_REG_SCW                   0x00
+#define TRANS_REG_NUM_RX_PACKETS        0x04
+#define TRANS_REG_NUM_RX_PACKETS_CRC    0x05
+
+// Highest UART baud rate to try in init_trans_uart_baud()
+#define TRANS_UART_MAX_BAUD     UART_BAUD_115200
+// Number of status register reads that must all succeed for a baud rate to
+// be used
+#define TRANS_UART_BAUD_CHECKS  5
+
+// RF modes for link adaptation (p. 15)
+// Mode 3 - 2GFSK, 9600 bps, 2400 Hz Fdev, 0.5 ModInd
+#define TRANS_RF_MODE_DEF       3
+// Mode 5 - 2GFSK, 19200 bps, 4800 Hz Fdev, 0.5 ModInd
+#define TRANS_RF_MODE_FAST      5
+// Largest RF mode number
+#define TRANS_RF_MODE_MAX       7
+// No RF mode change requested
+#define TRANS_RF_MODE_NONE      0xFF
+
+// Number of seconds between reads of the RSSI and packet counters
+#define TRANS_LINK_CHECK_PERIOD_S   30
+// Switch to the fast mode when the RSSI is at least this and at least
+// TRANS_LINK_UP_MIN_RX packets were received without CRC errors since the last
+// check
+#define TRANS_LINK_UP_RSSI          0x60
+#define TRANS_LINK_UP_MIN_RX        4
+// Go back to the default mode when at least this percentage of the packets
+// since the last check had CRC errors
+#define TRANS_LINK_DOWN_CRC_PCT     20
+// Go back to the default mode (which ground always listens on) if nothing was
+// received for this many seconds
+#define TRANS_LINK_FALLBACK_S       600
+
 // Default frequency (435MHz, p.6)
 // This is in the 32-bit format, i.e. from the output of EnduroSat's utility program
 #define TRANS_DEF_FREQ 0x76620F41UL
@@ -74,6 +168,44 @@ boot = 0b0 (application mode)
 // Default beacon parameters
 #define TRANS_BEACON_DEF_PERIOD_S   65535
 
+// Beacon content register (p.6)
+#define TRANS_REG_BEACON_CONTENT    0xFB
+// Housekeeping beacon - each field is 6 hex digits (24 bits), so the content
+// fits in the command buffer with the command and checksum
+#define TRANS_BEACON_NUM_FIELDS     10
+#define TRANS_BEACON_FIELD_LEN      6
+#define TRANS_BEACON_CONTENT_LEN    (TRANS_BEACON_NUM_FIELDS * TRANS_BEACON_FIELD_LEN)
+// Minimum number of seconds between writing the beacon content
+#define TRANS_BEACON_MIN_PERIOD_S   60
+
+// Called when a transceiver command finishes - success is false if there was
+// no valid response after all attempts
+// If successful, the response is in trans_cmd_resp (e.g. read it with
+// scan_uint()) until the callback returns
+typedef void (*trans_cmd_cb_t)(bool success);
+
+// Transceiver command waiting to be sent
+typedef struct {
+    // TRANS_CMD_READ or TRANS_CMD_WRITE
+    uint8_t op;
+    uint8_t reg;
+    // Number of hex digits to write `value` with
+    uint8_t num_digits;
+    uint32_t value;
+    // Written after the value if not NULL
+    const char* text;
+    // Expected length of the response (not including the checksum)
+    uint8_t expected_len;
+    trans_cmd_cb_t cb;
+} trans_cmd_t;
+
+// ACK/NACK waiting to be sent to ground
+typedef struct {
+    uint16_t cmd_id;
+    uint8_t status;
+    // Only for CMD_ACK_STATUS_BATCH
+    uint8_t bitmap;
+} trans_tx_ack_t;
 
 
 
@@ -84,41 +216,89 @@ extern volatile bool       trans_cmd_resp_avail;
 extern volatile uint8_t    trans_rx_enc_msg[];
 extern volatile uint8_t    trans_rx_enc_len;
 extern volatile bool       trans_rx_enc_avail;
+extern volatile uint32_t   trans_rx_enc_crc;
+extern volatile bool       trans_rx_enc_crc_avail;
+extern volatile uint8_t    trans_rx_state;
+extern volatile uint8_t    trans_rx_count;
 
 extern volatile uint8_t    trans_rx_dec_msg[];
 extern volatile uint8_t    trans_rx_dec_len;
 extern volatile bool       trans_rx_dec_avail;
 
-extern volatile uint16_t   trans_tx_ack_cmd_id;
-extern volatile uint8_t    trans_tx_ack_status;
-extern volatile bool       trans_tx_ack_avail;
+extern volatile trans_tx_ack_t trans_tx_ack_queue[];
+extern volatile uint8_t    trans_tx_ack_head;
+extern volatile uint8_t    trans_tx_ack_count;
+
+extern volatile uint8_t    trans_tx_ack_frame[];
+extern volatile uint8_t    trans_tx_ack_msg_len;
+extern volatile bool       trans_tx_ack_msg_avail;
 
-extern volatile uint8_t    trans_tx_dec_msg[];
+extern volatile uint8_t    trans_tx_dec_frame[];
 extern volatile uint8_t    trans_tx_dec_len;
 extern volatile bool       trans_tx_dec_avail;
+extern volatile uint32_t   trans_tx_dec_crc;
+extern volatile uint8_t    trans_tx_dec_crc_len;
 
-extern volatile uint8_t    trans_tx_enc_msg[];
+extern volatile uint8_t*   trans_tx_enc_msg;
 extern volatile uint8_t    trans_tx_enc_len;
 extern volatile bool       trans_tx_enc_avail;
+extern volatile uint8_t    trans_tx_enc_state;
+extern volatile uint8_t    trans_tx_enc_sent;
 
 extern uint16_t trans_last_cmd_id;
 
+extern trans_cmd_t         trans_cmd_queue[];
+extern volatile uint8_t    trans_cmd_head;
+extern volatile uint8_t    trans_cmd_count;
+extern volatile uint8_t    trans_cmd_state;
+extern volatile uint8_t    trans_cmd_attempts;
+
 extern bool print_trans_msgs;
 
+extern char                trans_beacon_content[];
+extern volatile bool       trans_beacon_dirty;
+extern volatile bool       trans_beacon_busy;
+extern volatile uint16_t   trans_beacon_wait_s;
+
+extern uart_baud_rate_t    trans_uart_baud;
+extern volatile uint8_t    trans_rf_mode;
+extern volatile bool       trans_rf_auto;
+extern volatile uint8_t    trans_rf_mode_req;
+extern volatile bool       trans_link_check_pending;
+extern uint8_t             trans_link_rssi;
+extern uint32_t            trans_link_prev_rx_s;
+
 
 // Initialization
 void init_trans(void);
 void init_trans_uart(void);
 void trans_uptime_cb(void);
 uint8_t trans_uart_rx_cb(const uint8_t* buf, uint8_t len);
+void reset_trans_rx_parser(void);
+void start_trans_rx_byte(uint8_t byte);
+void parse_trans_rx_pkt_byte(uint8_t byte);
+void parse_trans_cmd_resp_byte(uint8_t byte);
+void parse_trans_rx_byte(uint8_t byte);
 void scan_trans_cmd_resp(const uint8_t* buf, uint8_t len);
-void scan_trans_rx_enc_msg(const uint8_t* buf, uint8_t len);
 void add_trans_tx_ack(uint16_t cmd_id, uint8_t status);
+void add_trans_tx_batch_ack(uint16_t cmd_id, uint8_t bitmap);
+void add_trans_tx_ack_bitmap(uint16_t cmd_id, uint8_t status, uint8_t bitmap);
+bool dequeue_trans_tx_ack(uint16_t* cmd_id, uint8_t* status, uint8_t* bitmap);
 void decode_trans_rx_msg(void);
+void fill_trans_tx_enc_msg(volatile uint8_t* frame, uint8_t len,
+    uint32_t checksum);
 void encode_trans_tx_msg(void);
+uint32_t trans_tx_guard_ticks(void);
+void start_trans_tx_guard(void);
+bool trans_tx_guard_done(void);
 void send_trans_tx_enc_msg(void);
+void flush_trans_tx_enc_msg(void);
 uint16_t calc_trans_crc(void);
 void update_trans_crc(uint16_t* crc, uint8_t byte);
+void start_trans_tx_dec_msg(void);
+void append_to_trans_tx_dec_msg(uint8_t byte);
+uint32_t trans_tx_dec_checksum(void);
+uint32_t crc32_update(uint32_t crc, uint8_t byte);
 uint32_t crc32(unsigned char *message, uint8_t len);
 
 
@@ -130,6 +310,38 @@ uint8_t string_cmp(const uint8_t* first, const char* second, uint8_t len);
 
 void clear_trans_cmd_resp(void);
 uint8_t wait_for_trans_cmd_resp(uint8_t expected_len);
+uint8_t check_trans_cmd_resp(uint8_t expected_len);
+
+// Transceiver commands without blocking
+bool enqueue_trans_read(uint8_t reg, uint8_t expected_len, trans_cmd_cb_t cb);
+bool enqueue_trans_write(uint8_t reg, uint8_t num_digits, uint32_t value,
+    const char* text, uint8_t expected_len, trans_cmd_cb_t cb);
+bool enqueue_trans_write_op(uint8_t op, uint8_t reg, uint8_t num_digits,
+    uint32_t value, const char* text, uint8_t expected_len,
+    trans_cmd_cb_t cb);
+uint8_t format_trans_cmd(const trans_cmd_t* cmd, uint8_t* buf, uint8_t size);
+void send_next_trans_cmd(void);
+void finish_trans_cmd(bool success);
+void run_trans_cmds(void);
+
+// Housekeeping beacon
+void init_trans_beacon(void);
+void set_trans_beacon_field(uint8_t index, uint32_t value);
+void trans_beacon_cb(bool success);
+void run_trans_beacon(void);
+
+// Link adaptation
+void init_trans_uart_baud(void);
+uint8_t trans_uart_baud_bits(uart_baud_rate_t rate);
+void init_trans_link(void);
+uint8_t next_trans_rf_mode(uint8_t mode, uint8_t rssi, uint32_t rx_count,
+    uint32_t crc_count, uint32_t no_rx_s);
+void request_trans_rf_mode(uint8_t mode);
+void trans_link_rx_cb(bool success);
+void trans_link_crc_cb(bool success);
+void trans_rf_mode_scw_cb(bool success);
+void trans_rf_mode_set_cb(bool success);
+void run_trans_link(void);
 
 // 1
 uint8_t set_trans_scw(uint16_t scw);
@@ -179,3 +391,5 @@ uint8_t get_trans_num_rx_packets_crc(uint8_t* rssi, uint32_t* num_rx_packets_crc
 
 // Corrects transceiver baud rate
 uint8_t correct_transceiver_baud_rate(uart_baud_rate_t new_rate, uart_baud_rate_t* previous);
+
+#endif
@@ -0,0 +1,286 @@
+#!/usr/bin/env python3
+"""
+Reports the SRAM used by the OBC program - static data (.data, .bss and
+.noinit), the largest variables, and the worst-case stack depth.
+
+The stack depth comes from the frame size of each function (the .su files
+written by gcc's -fstack-usage) and the call graph (the call instructions in
+the disassembled program). Each call also pushes the return address. The worst
+case is the deepest path from main(), plus the deepest interrupt handler (AVR
+interrupts do not nest unless a handler enables them again).
+
+Calls through function pointers (e.g. command functions and callbacks) can't be
+followed, so every function that is never called directly is assumed to be a
+possible target of each indirect call. This over-estimates a little, but covers
+the command functions run by execute_next_cmd().
+
+Usage (from the root of the repository, after `make`):
+    python3 ./tools/sram_report.py --elf ./build/obc.elf --su-dir ./build
+or use `make sram`.
+"""
+
+import argparse
+import glob
+import os
+import re
+import subprocess
+import sys
+
+# Pseudo-function for calls through function pointers
+INDIRECT = "<indirect call>"
+
+# Instructions that call a function directly, or jump to one (tail calls)
+CALL_INSNS = {"call", "rcall", "callq"}
+JUMP_INSNS = {"jmp", "rjmp", "jmpq"}
+# Instructions that call through a function pointer
+INDIRECT_CALL_INSNS = {"icall", "eicall"}
+
+FUNC_RE = re.compile(r"^([0-9a-f]+) <([^>]+)>:$")
+INSN_RE = re.compile(r"^\s*[0-9a-f]+:\s+(?:[0-9a-f]{2} )+\s*(\S+)\s*(.*)$")
+TARGET_RE = re.compile(r"<([^>+]+)>")
+
+
+def run(cmd):
+    try:
+        return subprocess.run(cmd, check=True, stdout=subprocess.PIPE,
+            universal_newlines=True).stdout
+    except (OSError, subprocess.CalledProcessError) as e:
+        sys.exit("Could not run {}: {}".format(" ".join(cmd), e))
+
+
+def read_stack_usage(su_dir):
+    """
+    Returns {function: (frame bytes, qualifier)} from all .su files, where the
+    qualifier is "static", "dynamic" or "dynamic,bounded".
+    """
+    frames = {}
+    for path in glob.glob(os.path.join(su_dir, "**", "*.su"), recursive=True):
+        with open(path) as f:
+            for line in f:
+                parts = line.rstrip("\n").split("\t")
+                if len(parts) != 3:
+                    continue
+                name = parts[0].rsplit(":", 1)[-1]
+                frames[name] = (int(parts[1]), parts[2])
+    return frames
+
+
+def read_call_graph(objdump, elf):
+    """
+    Returns {function: set of functions it calls} from the disassembly (tail
+    calls included). Functions with indirect calls call INDIRECT.
+    """
+    calls = {}
+    func = None
+    for line in run([objdump, "-d", elf]).splitlines():
+        m = FUNC_RE.match(line)
+        if m:
+            func = m.group(2)
+            calls.setdefault(func, set())
+            continue
+
+        m = INSN_RE.match(line)
+        if m is None or func is None:
+            continue
+        insn, operands = m.group(1), m.group(2)
+
+        if insn in INDIRECT_CALL_INSNS or \
+                (insn in CALL_INSNS and operands.startswith("*")):
+            calls[func].add(INDIRECT)
+            continue
+        if insn not in CALL_INSNS and insn not in JUMP_INSNS:
+            continue
+
+        # Only to the start of a function (<name>, not <name+0x12>), so
+        # branches within a function and jumps into the middle of library
+        # routines (e.g. __prologue_saves__) are not counted
+        t = TARGET_RE.search(operands)
+        if t is None:
+            continue
+        target = t.group(1).split("@")[0]
+        if target != func:
+            calls[func].add(target)
+    return calls
+
+
+class StackAnalysis:
+    def __init__(self, frames, calls, roots, ret_bytes):
+        self.frames = frames
+        self.calls = calls
+        self.roots = roots
+        self.ret_bytes = ret_bytes
+        # function -> (worst-case bytes, path)
+        self.memo = {}
+        self.active = set()
+        self.recursive = set()
+        self.unknown = set()
+
+        # Possible targets of indirect calls
+        called = set()
+        for targets in calls.values():
+            called |= targets
+        self.indirect_targets = sorted(f for f in frames
+            if f in calls and f not in called and f not in roots)
+        self.calls[INDIRECT] = set(self.indirect_targets)
+
+    def frame(self, func):
+        if func == INDIRECT:
+            return 0
+        if func not in self.frames:
+            self.unknown.add(func)
+            return 0
+        return self.frames[func][0]
+
+    def worst(self, func):
+        """Returns (bytes, path) for the deepest call chain from func."""
+        if func in self.memo:
+            return self.memo[func]
+        if func in self.active:
+            self.recursive.add(func)
+            return (0, [func + " (recursion)"])
+
+        self.active.add(func)
+        best = (0, [])
+        for target in sorted(self.calls.get(func, ())):
+            depth, path = self.worst(target)
+            # An indirect call is not a function itself, so it does not push
+            # a second return address
+            if target != INDIRECT:
+                depth += self.ret_bytes
+            if depth > best[0] or not best[1]:
+                best = (depth, path)
+        self.active.discard(func)
+
+        result = (self.frame(func) + best[0], [func] + best[1])
+        self.memo[func] = result
+        return result
+
+    def describe(self, path):
+        parts = []
+        for func in path:
+            if func in self.frames:
+                parts.append("{} ({})".format(func, self.frames[func][0]))
+            else:
+                parts.append(func)
+        return " -> ".join(parts)
+
+
+def read_sections(size_tool, elf):
+    """Returns {section name: size} from `size -A`."""
+    sections = {}
+    for line in run([size_tool, "-A", elf]).splitlines():
+        parts = line.split()
+        if len(parts) >= 2 and parts[0].startswith(".") and parts[1].isdigit():
+            sections[parts[0]] = int(parts[1])
+    return sections
+
+
+def read_ram_symbols(nm, elf):
+    """Returns [(size, name)] of variables in RAM, largest first."""
+    symbols = []
+    for line in run([nm, "-S", "--size-sort", elf]).splitlines():
+        parts = line.split()
+        if len(parts) == 4 and parts[2] in "bBdD":
+            symbols.append((int(parts[1], 16), parts[3]))
+    symbols.sort(reverse=True)
+    return symbols
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().split("\n")[0])
+    parser.add_argument("--elf", required=True, help="program (.elf)")
+    parser.add_argument("--su-dir", required=True,
+        help="directory with the .su files from -fstack-usage")
+    parser.add_argument("--ram-size", type=int, default=4096,
+        help="bytes of SRAM (default 4096, ATmega64M1)")
+    parser.add_argument("--ret-bytes", type=int, default=2,
+        help="bytes pushed for each return address (default 2, AVR with a "
+            "16-bit program counter)")
+    parser.add_argument("--root", action="append", default=None,
+        help="function the main stack starts from (default main)")
+    parser.add_argument("--isr", default=r"__vector_\d+",
+        help="regex for interrupt handler names (default __vector_N)")
+    parser.add_argument("--tools-prefix", default="avr-",
+        help="prefix of objdump, size and nm (default avr-)")
+    parser.add_argument("--top", type=int, default=12,
+        help="number of the largest variables to list (default 12)")
+    args = parser.parse_args()
+
+    objdump = args.tools_prefix + "objdump"
+    size_tool = args.tools_prefix + "size"
+    nm = args.tools_prefix + "nm"
+    roots = args.root or ["main"]
+
+    frames = read_stack_usage(args.su_dir)
+    if not frames:
+        sys.exit("No .su files in {} (build with -fstack-usage)".format(
+            args.su_dir))
+    calls = read_call_graph(objdump, args.elf)
+    isr_re = re.compile(args.isr)
+    isrs = sorted(f for f in calls if isr_re.fullmatch(f))
+    analysis = StackAnalysis(frames, calls, set(roots) | set(isrs),
+        args.ret_bytes)
+
+    # Static data
+    sections = read_sections(size_tool, args.elf)
+    static = sum(sections.get(s, 0) for s in (".data", ".bss", ".noinit"))
+    print("SRAM: {} bytes".format(args.ram_size))
+    for s in (".data", ".bss", ".noinit"):
+        print("  {:<8} {:>6}".format(s, sections.get(s, 0)))
+    print("  {:<8} {:>6} ({:.1f}%)".format("static", static,
+        100.0 * static / args.ram_size))
+
+    print("\nLargest variables:")
+    for size, name in read_ram_symbols(nm, args.elf)[:args.top]:
+        print("  {:>6}  {}".format(size, name))
+
+    # Stack
+    print("\nWorst-case stack:")
+    main_depth = 0
+    for root in roots:
+        if root not in calls:
+            print("  {}: not found".format(root))
+            continue
+        depth, path = analysis.worst(root)
+        main_depth = max(main_depth, depth)
+        print("  {}: {} bytes".format(root, depth))
+        print("    " + analysis.describe(path))
+
+    isr_depth = 0
+    isr_path = []
+    for isr in isrs:
+        depth, path = analysis.worst(isr)
+        # The interrupt pushes the return address
+        depth += args.ret_bytes
+        if depth > isr_depth:
+            isr_depth, isr_path = depth, path
+    if isr_path:
+        print("  deepest interrupt: {} bytes".format(isr_depth))
+        print("    " + analysis.describe(isr_path))
+
+    total = main_depth + isr_depth
+    print("  total: {} bytes".format(total))
+
+    print("\nFree SRAM after static data and the worst-case stack: {} bytes"
+        .format(args.ram_size - static - total))
+
+    # Anything that makes the estimate less certain
+    dynamic = sorted(f for f, (_, q) in frames.items() if q != "static")
+    if dynamic:
+        print("\nDynamic stack frames (not included): " + ", ".join(dynamic))
+    recursive = sorted(analysis.recursive - {INDIRECT})
+    if recursive:
+        print("\nRecursion (counted once): " + ", ".join(recursive))
+    unknown = sorted(analysis.unknown - {INDIRECT})
+    if unknown:
+        print("\nNo stack usage (library or assembly, counted as 0): " +
+            ", ".join(unknown))
+    print("\n{} possible indirect call targets".format(
+        len(analysis.indirect_targets)))
+
+    if total + static > args.ram_size:
+        sys.exit("Worst-case stack does not fit in SRAM")
+
+
+if __name__ == "__main__":
+    main()